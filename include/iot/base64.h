@@ -44,6 +44,17 @@ extern size_t iot_b64_maxdecodesize (const char * in);
  */
 extern bool iot_b64_decode (const char * in, void * out, size_t * outLen);
 
+/**
+ * @brief Decode base64 (encoded) string in place
+ *
+ * The decoded output overwrites the string, on failure the string contents are undefined.
+ *
+ * @param str    Pointer to base64 encoded string
+ * @param outLen Length of the decoded output
+ * @return       'true' if decode successful, 'false' if decode in error
+ */
+extern bool iot_b64_decode_in_place (char * str, size_t * outLen);
+
 /**
  * @brief Encode input into base64 encoded string
  *
@@ -0,0 +1,185 @@
+//
+// Copyright (c) 2024 IOTech Ltd
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+
+#ifndef _IOT_BUS_H_
+#define _IOT_BUS_H_
+
+/**
+ * @file
+ * @brief IOTech In Process Publish/Subscribe Bus API
+ */
+
+#include "iot/scheduler.h"
+#include "iot/threadpool.h"
+#include "iot/component.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Alias for bus structure */
+typedef struct iot_bus_t iot_bus_t;
+/** Alias for bus publisher structure */
+typedef struct iot_bus_pub_t iot_bus_pub_t;
+/** Alias for bus subscriber structure */
+typedef struct iot_bus_sub_t iot_bus_sub_t;
+
+/**
+ * Alias for subscriber callback function pointer. The function is called with the published data, the subscriber
+ * self pointer and the topic to which the data was published. The data is shared with other subscribers and must
+ * not be modified or freed, a reference should be added if the data is retained.
+ */
+typedef void (*iot_bus_sub_fn_t) (iot_data_t * data, void * self, const char * match);
+
+/**
+ * Alias for publisher callback function pointer. The function is called periodically for a polled publisher,
+ * and returns data to be published, or NULL if none.
+ */
+typedef iot_data_t * (*iot_bus_pub_fn_t) (void * self);
+
+/** Bus component name */
+#define IOT_BUS_TYPE "IOT::Bus"
+
+/** Default subscriber queue size */
+#define IOT_BUS_QUEUE_DEFAULT 1024u
+
+/**
+ * @brief Allocate and initialise a bus
+ *
+ * Topics are sequences of levels separated by '/'. Subscription topics may include the wildcards '+',
+ * matching any single level, and '#' as the last level, matching any number of levels. Subscriptions are
+ * compiled into a trie of topic levels, and the subscribers matching a publisher topic are cached by the
+ * publisher until subscriptions change. Data is delivered to subscribers by reference, without copying.
+ *
+ * @code
+ *
+ *    iot_bus_t * bus = iot_bus_alloc (scheduler, pool, IOT_MS_TO_NS (100));
+ *
+ * @endcode
+ *
+ * @param  scheduler  Scheduler used to poll publishers with a callback, can be NULL if no publishers are polled
+ * @param  pool       Thread pool used to run subscriber callbacks. Each subscriber has a bounded queue, and its
+ *                    callback runs on one thread at a time. If NULL, callbacks are run by the publishing thread
+ * @param  interval   Polled publisher interval, in nanoseconds
+ * @return iot_bus_t  Pointer to the created bus
+ */
+extern iot_bus_t * iot_bus_alloc (iot_scheduler_t * scheduler, iot_threadpool_t * pool, uint64_t interval);
+
+/**
+ * @brief Start the bus, allowing data to be published and polled publishers to run
+ *
+ * @param bus  Pointer to the bus
+ */
+extern void iot_bus_start (iot_bus_t * bus);
+
+/**
+ * @brief Stop the bus. Data published when stopped is discarded, data already queued is delivered.
+ *
+ * @param bus  Pointer to the bus
+ */
+extern void iot_bus_stop (iot_bus_t * bus);
+
+/**
+ * @brief Set the queue size for subscribers subsequently allocated
+ *
+ * @param bus   Pointer to the bus
+ * @param size  Maximum number of queued messages per subscriber, must be non zero
+ */
+extern void iot_bus_set_queue_size (iot_bus_t * bus, uint32_t size);
+
+/**
+ * @brief Allocate a subscriber
+ *
+ * @code
+ *
+ *    iot_bus_sub_t * sub = iot_bus_sub_alloc (bus, self, callback, "sensors/+/temperature");
+ *
+ * @endcode
+ *
+ * @param  bus            Pointer to the bus
+ * @param  self           Pointer passed to the callback
+ * @param  callback       Function called with data published to a matching topic
+ * @param  pattern        Subscription topic, can include wildcards
+ * @return iot_bus_sub_t  Pointer to the subscriber, NULL if the topic is invalid
+ */
+extern iot_bus_sub_t * iot_bus_sub_alloc (iot_bus_t * bus, void * self, iot_bus_sub_fn_t callback, const char * pattern);
+
+/**
+ * @brief Free a subscriber. A callback already running may still be running when the function returns,
+ * no further callbacks are started.
+ *
+ * @param sub  Pointer to the subscriber
+ */
+extern void iot_bus_sub_free (iot_bus_sub_t * sub);
+
+/**
+ * @brief Allocate a publisher
+ *
+ * @param  bus            Pointer to the bus
+ * @param  self           Pointer passed to the callback
+ * @param  callback       Function polled at the bus interval for data to publish, NULL if not polled
+ * @param  topic          Publication topic, cannot include wildcards
+ * @return iot_bus_pub_t  Pointer to the publisher, NULL if the topic is invalid
+ */
+extern iot_bus_pub_t * iot_bus_pub_alloc (iot_bus_t * bus, void * self, iot_bus_pub_fn_t callback, const char * topic);
+
+/**
+ * @brief Free a publisher
+ *
+ * @param pub  Pointer to the publisher
+ */
+extern void iot_bus_pub_free (iot_bus_pub_t * pub);
+
+/**
+ * @brief Publish data
+ *
+ * The data is queued for all matching subscribers by reference. Data published by a publisher is delivered
+ * to each subscriber in the order published.
+ *
+ * @param pub   Pointer to the publisher
+ * @param data  Data to publish, the reference is taken by the bus
+ * @param sync  Whether to wait for space if a subscriber queue is full, otherwise the data is dropped for that subscriber
+ * @return      Whether the data was queued for all matching subscribers, false if the bus is stopped
+ */
+extern bool iot_bus_pub_push (iot_bus_pub_t * pub, iot_data_t * data, bool sync);
+
+/**
+ * @brief Get bus statistics
+ *
+ * @param bus  Pointer to the bus
+ * @return     Data map with "publishers", "subscribers" and "published" counts, and "delivered" and "dropped" totals
+ *             for current subscribers
+ */
+extern iot_data_t * iot_bus_stats (iot_bus_t * bus);
+
+/**
+ * @brief Increment the bus reference count
+ *
+ * @param bus  Pointer to the bus
+ */
+extern void iot_bus_add_ref (iot_bus_t * bus);
+
+/**
+ * @brief Decrement the bus reference count, freeing it if no longer referenced, with any remaining publishers and subscribers
+ *
+ * @param bus  Pointer to the bus
+ */
+extern void iot_bus_free (iot_bus_t * bus);
+
+/**
+ * @brief Create bus component factory
+ *
+ * The factory configuration values are "Scheduler" and "ThreadPool" (component names), "Interval" (polled
+ * publisher interval in milliseconds) and "QueueSize" (subscriber queue size).
+ *
+ * @return  Bus component factory
+ */
+extern const iot_component_factory_t * iot_bus_factory (void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
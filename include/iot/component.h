@@ -46,6 +46,8 @@ typedef enum
 typedef iot_component_t * (*iot_component_config_fn_t) (iot_container_t * cont, const iot_data_t * map);
 /** Type definition for component reconfiguration function pointer */
 typedef bool (*iot_component_reconfig_fn_t) (iot_component_t * comp, iot_container_t * cont, const iot_data_t * map);
+/** Type definition for component reconfiguration function pointer, given the updated configuration and the changes made (see iot_data_diff) */
+typedef bool (*iot_component_reconfig_delta_fn_t) (iot_component_t * comp, iot_container_t * cont, const iot_data_t * config, const iot_data_t * delta);
 /** Type definition for component start function pointer */
 typedef void (*iot_component_start_fn_t) (iot_component_t * comp);
 /** Type definition for component stop function pointer */
@@ -58,6 +60,8 @@ typedef void (*iot_component_running_fn_t) (iot_component_t * comp, bool timeout
 typedef void (*iot_component_stopping_fn_t) (iot_component_t * comp);
 /** Type definition for component starting function pointer */
 typedef void (*iot_component_starting_fn_t) (iot_component_t * comp);
+/** Type definition for component statistics function pointer */
+typedef iot_data_t * (*iot_component_stats_fn_t) (iot_component_t * comp);
 
 /**
  * Component factory structure
@@ -70,6 +74,7 @@ struct iot_component_factory_t
   iot_component_free_fn_t free_fn;         /**< Pointer to function that handles the freeing of a component */
   iot_component_reconfig_fn_t reconfig_fn; /**< Pointer to function that handles component reconfiguration */
   const iot_component_factory_t * next;    /**< Pointer to next component factory structure */
+  iot_component_reconfig_delta_fn_t reconfig_delta_fn; /**< Optional pointer to function that handles incremental reconfiguration, used in preference to reconfig_fn */
 };
 
 /**
@@ -78,7 +83,7 @@ struct iot_component_factory_t
 struct iot_component_t
 {
   char * name;                              /**< Component name */
-  volatile iot_component_state_t state;     /**< Current state of component */
+  _Atomic (iot_component_state_t) state;    /**< Current state of component, changed with the mutex held */
   pthread_mutex_t mutex;                    /**< Synchronisation mutex */
   pthread_cond_t cond;                      /**< Synchronisation condition */
   iot_component_start_fn_t start_fn;        /**< Pointer to function that handles starting a component */
@@ -89,6 +94,8 @@ struct iot_component_t
   atomic_int_fast32_t refs;                 /**< Current reference count */
   iot_data_t * config;                      /**< Parsed configuration */
   const iot_component_factory_t * factory;  /**< Pointer to component factory structure */
+  iot_component_stats_fn_t stats_fn;        /**< Pointer to function returning component runtime statistics */
+  uint32_t level;                           /**< Start level, one above the highest level of components found during configuration */
 };
 
 /**
@@ -123,6 +130,17 @@ extern void iot_component_init (iot_component_t * component, const iot_component
  */
  extern void iot_component_set_stopping_callback (iot_component_t * component, iot_component_stopping_fn_t fn);
 
+ /**
+ * @brief Set component statistics function, called when the component is read
+ *
+ * The function to register a statistics handler with the component. The handler returns a data map
+ * of runtime statistics, which is included in the data returned by iot_component_read.
+ *
+ * @param component  Pointer to the component
+ * @param fn         Function pointer to the component statistics function
+ */
+ extern void iot_component_set_stats_callback (iot_component_t * component, iot_component_stats_fn_t fn);
+
  /**
  * @brief Set component callback function, called before all container components are started
  *
@@ -136,7 +154,9 @@ extern void iot_component_init (iot_component_t * component, const iot_component
 /**
  * @brief Reconfigure component
  *
- * The function to reconfigure a component, if supported. Reconfiguration of parameters depends on the support available by the component
+ * The function to reconfigure a component, if supported. Reconfiguration of parameters depends on the support available by the component.
+ * The map is merged into the component configuration, and the component is only reconfigured if this changes the configuration.
+ * If the factory has a reconfig_delta_fn, this is passed the changes made, as returned by iot_data_diff.
  * @param component  Pointer to the component
  * @param cont       Pointer to the container that holds the component
  * @param map        Reconfigurable parameters in a map
@@ -207,7 +227,8 @@ extern bool iot_component_set_starting (iot_component_t * component);
 /**
  * @brief Block until the component is in a given state
  *
- * The function blocks until the component is in one of a given set of states.
+ * The function blocks until the component is in one of a given set of states. If the component
+ * is already in one of the states, the function returns without taking the component lock.
  *
  * @code
  *
@@ -239,6 +260,26 @@ extern iot_component_state_t iot_component_wait (iot_component_t * component, ui
  */
 extern iot_component_state_t iot_component_wait_and_lock (iot_component_t * component, uint32_t states);
 
+/**
+ * @brief Block until the component state is changed to states, with the component lock held
+ *
+ * As iot_component_wait_and_lock, but called with the component lock already held, so that a thread
+ * looping on the component state need not release and acquire the lock on each iteration.
+ *
+ * @param component  Pointer to the component, which must be locked
+ * @param states     Component state(s) to check for unblocking
+ * @return           State of the component that resulted in unblocking
+ */
+extern iot_component_state_t iot_component_wait_locked (iot_component_t * component, uint32_t states);
+
+/**
+ * @brief Get the component state, without taking the component lock
+ *
+ * @param component  Pointer to the component
+ * @return           Current state of the component
+ */
+extern iot_component_state_t iot_component_get_state (const iot_component_t * component);
+
 /**
  * @brief Acquire lock on the component
  *
@@ -290,7 +331,7 @@ extern const char * iot_component_state_name (iot_component_state_t state);
  * @brief Get state of component
  *
  * @param component  Pointer to component
- * @return           Data map, with keys "name", "type", "state" and "config"
+ * @return           Data map, with keys "name", "type", "state" and "config", and "stats" if the component provides statistics
  */
 extern iot_data_t * iot_component_read (iot_component_t * component);
 
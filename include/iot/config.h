@@ -138,11 +138,53 @@ extern const iot_data_t * iot_config_vector (const iot_data_t * map, const char
  */
 extern iot_component_t * iot_config_component (const iot_data_t * map, const char * key, iot_container_t * container, iot_logger_t * logger);
 
+/** Type for a pre-resolved configuration key, a constant string with a precomputed hash. See iot_config_key_init */
+typedef iot_data_static_t iot_config_key_t;
+
+/**
+ * @brief Initialise a pre-resolved configuration key
+ *
+ * The key name is hashed once, so that the iot_config_key_* functions need neither allocate a temporary key
+ * nor rehash the name on each lookup. Typically used for keys read repeatedly, for example on reconfiguration.
+ *
+ * @param key  Key storage to initialise, typically static
+ * @param name Constant key name, which must remain valid while the key is used
+ * @return     The key as data, usable with iot_data_map_get and similar functions
+ */
+extern const iot_data_t * iot_config_key_init (iot_config_key_t * key, const char * name);
+
+/** As iot_config_i64, but with a pre-resolved key */
+extern bool iot_config_key_i64 (const iot_data_t * map, const iot_config_key_t * key, int64_t * val, iot_logger_t * logger);
+
+/** As iot_config_ui64, but with a pre-resolved key */
+extern bool iot_config_key_ui64 (const iot_data_t * map, const iot_config_key_t * key, uint64_t * val, iot_logger_t * logger);
+
+/** As iot_config_i32, but with a pre-resolved key */
+extern bool iot_config_key_i32 (const iot_data_t * map, const iot_config_key_t * key, int32_t * val, iot_logger_t * logger);
+
+/** As iot_config_ui32, but with a pre-resolved key */
+extern bool iot_config_key_ui32 (const iot_data_t * map, const iot_config_key_t * key, uint32_t * val, iot_logger_t * logger);
+
+/** As iot_config_bool, but with a pre-resolved key */
+extern bool iot_config_key_bool (const iot_data_t * map, const iot_config_key_t * key, bool * val, iot_logger_t * logger);
+
+/** As iot_config_f64, but with a pre-resolved key */
+extern bool iot_config_key_f64 (const iot_data_t * map, const iot_config_key_t * key, double * val, iot_logger_t * logger);
+
+/** As iot_config_string, but with a pre-resolved key */
+extern const char * iot_config_key_string (const iot_data_t * map, const iot_config_key_t * key, bool alloc, iot_logger_t * logger);
+
+/** As iot_config_map, but with a pre-resolved key */
+extern const iot_data_t * iot_config_key_map (const iot_data_t * map, const iot_config_key_t * key, iot_logger_t * logger);
+
+/** As iot_config_vector, but with a pre-resolved key */
+extern const iot_data_t * iot_config_key_vector (const iot_data_t * map, const iot_config_key_t * key, iot_logger_t * logger);
+
 /**
  * @brief Substitute environment variables in a string
  *
  * Replaces references of the form ${ENVIRONMENT_VARIABLE} with the corresponding environment variable. Returns a string.
- * If a referenced environment variable does not exist an error message will
+ * If a referenced environment variable does not exist, or a reference is not terminated, an error message will
  * be logged and NULL returned.
  *
  * @param str The string containing zero or more environment variable references.
@@ -151,6 +193,19 @@ extern iot_component_t * iot_config_component (const iot_data_t * map, const cha
  */
 extern char * iot_config_substitute_env (const char * str, iot_logger_t * logger);
 
+/**
+ * @brief Parse a JSON configuration, substituting environment variables
+ *
+ * References of the form ${ENVIRONMENT_VARIABLE} in string values and map keys are substituted as the JSON is
+ * parsed, so only strings containing references are copied. References outside strings, for example for numeric
+ * values, are substituted in the JSON text before parsing, as for iot_config_substitute_env.
+ *
+ * @param json   The JSON configuration string, may be NULL.
+ * @param logger Logger used to log if environment variable is not found. If not set, default logger is used.
+ * @return       The parsed configuration as for iot_data_from_json, or NULL if json is NULL or a substitution failed.
+ */
+extern iot_data_t * iot_config_from_json (const char * json, iot_logger_t * logger);
+
 #ifdef __cplusplus
 }
 #endif
@@ -13,6 +13,7 @@
  */
 
 #include "iot/component.h"
+#include "iot/threadpool.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -20,6 +21,8 @@ extern "C" {
 
 /** Type for container configuration load function pointer */
 typedef char * (*iot_container_config_load_fn_t) (const char * name, const char * uri);
+/** Type for container parsed configuration load function pointer */
+typedef iot_data_t * (*iot_container_config_load_map_fn_t) (const char * name, const char * uri);
 /** TYpe for container configuration save function pointer */
 typedef bool (*iot_container_config_save_fn_t) (const char * name, const char * uri, const char * config);
 
@@ -31,6 +34,7 @@ typedef struct iot_container_config_t
   iot_container_config_load_fn_t load;  /**< Pointer to function that handles container configuration load functionality */
   const char * uri;                     /**< Configuration URI string (optional) */
   iot_container_config_save_fn_t save;  /**< Pointer to function that handles container configuration save functionality (optional) */
+  iot_container_config_load_map_fn_t load_map; /**< Pointer to function that loads parsed configuration, used in preference to load (optional) */
 } iot_container_config_t;
 
 /**
@@ -71,6 +75,20 @@ extern iot_container_t * iot_container_alloc (const char * name);
  */
 extern bool iot_container_init (iot_container_t * cont);
 
+/**
+ * @brief Set a thread pool for concurrent container initialisation and startup
+ *
+ * When set, iot_container_init loads and parses component configurations concurrently, then creates
+ * components in dependency order. Component dependencies are those found (see iot_config_component)
+ * during configuration. iot_container_start then starts components concurrently in waves by level.
+ * Each wave holds the components that depend only on components started in earlier waves.
+ * The pool must be running, and must not be a component of the container.
+ *
+ * @param cont  Pointer to the container
+ * @param pool  Thread pool to use, or NULL to initialise and start components serially (the default)
+ */
+extern void iot_container_set_threadpool (iot_container_t * cont, iot_threadpool_t * pool);
+
 /**
  *  @brief Start the components within the container
  *
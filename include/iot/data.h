@@ -72,6 +72,15 @@ typedef enum iot_data_tag_t
 /** Opaque iot data structure */
 typedef struct iot_data_t iot_data_t;
 
+/** Opaque iot data allocation arena structure */
+typedef struct iot_data_arena_t iot_data_arena_t;
+
+/** Opaque iot data string intern pool structure */
+typedef struct iot_data_intern_t iot_data_intern_t;
+
+/** Alias for threadpool structure, used for parallel data operations */
+typedef struct iot_threadpool_t iot_threadpool_t;
+
 /**
 * Type for data typecode structure
 */
@@ -92,6 +101,21 @@ typedef void * iot_data_static_t[2u + 16u / sizeof (void*)];
 */
 typedef void * iot_data_list_static_t[4u + 8u / sizeof (void*)];
 
+/**
+* Type for map and vector type static allocation
+*/
+typedef void * iot_data_map_static_t[2u + 32u / sizeof (void*)];
+
+/**
+* Type for vector type static allocation
+*/
+typedef iot_data_map_static_t iot_data_vector_static_t;
+
+/**
+* Type for static allocation of a constant map entry
+*/
+typedef void * iot_data_map_node_static_t[5u + 8u / sizeof (void*)];
+
 /**
 * Macro to cast static data instance (iot_data_static_t) to a iot_data_t pointer
 */
@@ -136,6 +160,7 @@ typedef struct iot_data_list_iter_t
 {
   const struct iot_data_list_t * _list; /**< Pointer to data list structure */
   struct iot_element_t * _element;      /**< Pointer to list element structure */
+  uint32_t _index;                      /**< Index of value in list element */
 } iot_data_list_iter_t;
 
 /**
@@ -161,15 +186,42 @@ typedef struct iot_data_iter_t
   } _iter; /**< Iterator */
 } iot_data_iter_t;
 
+/**
+ * Type for data block cache statistics. Per thread counters are accumulated on each
+ * refill or drain of a thread's block magazine, so may lag slightly.
+ */
+typedef struct iot_data_cache_stats_t
+{
+  uint64_t allocs;  /**< Number of blocks allocated */
+  uint64_t hits;    /**< Number of blocks allocated from a thread magazine without locking */
+  uint64_t refills; /**< Number of thread magazine refills from the global cache */
+  uint64_t drains;  /**< Number of thread magazine drains to the global cache */
+  uint64_t chunks;  /**< Number of memory chunks allocated */
+  uint64_t cached;  /**< Number of free blocks held in the global cache */
+  uint64_t frees;   /**< Number of blocks freed, so allocs less frees blocks are live */
+  uint64_t released; /**< Number of memory chunks released by trimming, so chunks less released chunks are held */
+  uint64_t slabs;   /**< Number of slabs allocated, from which memory chunks are carved */
+  int64_t live[IOT_DATA_INVALID + 1]; /**< Number of live data instances of each type allocated from the cache */
+} iot_data_cache_stats_t;
+
 /** Type for data comparison function pointer */
 typedef bool (*iot_data_cmp_fn) (const iot_data_t * data, const void * arg);
 
+/** Type for data ordering function pointer, returning a value less than, equal to or greater than zero as for iot_data_compare */
+typedef int (*iot_data_order_fn) (const iot_data_t * data1, const iot_data_t * data2);
+
 /** Type for data free function pointer */
 typedef void (*iot_data_free_fn) (void * ptr);
 
 /** Type for data update function pointer */
 typedef iot_data_t * (*iot_data_update_fn) (const iot_data_t * data, void * arg);
 
+/** Type for output sink function pointer, returns whether the output was written */
+typedef bool (*iot_data_write_fn) (void * ctx, const char * str, size_t len);
+
+/** Type for parse time string substitution function pointer, returns an allocated replacement or NULL on failure */
+typedef char * (*iot_data_substitute_fn) (const char * str, void * arg);
+
 /** Function to compare string data with a string value */
 extern iot_data_cmp_fn iot_data_string_cmp;
 
@@ -181,6 +233,35 @@ extern iot_data_cmp_fn iot_data_string_cmp;
  */
 extern bool iot_data_alloc_heap (bool set);
 
+/**
+ * @brief Allocate a data arena
+ *
+ * The function allocates an arena from which data, map nodes and list elements are bump allocated
+ * when it is made the current arena for a thread. Freeing arena data has no effect, instead all data
+ * allocated from the arena is released together when the arena is freed. Data in an arena must only
+ * contain other data from the same arena or constant data, and must not be used after the arena is freed.
+ * An arena must only be used by one thread at a time.
+ *
+ * @param blocks  Number of data blocks per arena chunk, if zero a default is used
+ * @return        Pointer to the allocated arena
+ */
+extern iot_data_arena_t * iot_data_arena_alloc (uint32_t blocks);
+
+/**
+ * @brief Set on a per thread basis the current allocation arena, which takes precedence over the heap policy
+ *
+ * @param arena  The arena to allocate data from, or NULL to restore the cache or heap policy
+ * @return       Previous arena for the thread
+ */
+extern iot_data_arena_t * iot_data_arena_set_current (iot_data_arena_t * arena);
+
+/**
+ * @brief Free an arena, releasing all data allocated from it
+ *
+ * @param arena  The arena to free (can be NULL)
+ */
+extern void iot_data_arena_free (iot_data_arena_t * arena);
+
 /**
  * @brief Return the hash of a String, Array or Binary data type
  *
@@ -205,6 +286,88 @@ extern void iot_data_compress (iot_data_t * data);
  */
 extern void iot_data_compress_with_cache (iot_data_t * data, iot_data_t * cache);
 
+/**
+ * @brief Compress a composed data type (Vector, List or Map) by eliminating duplicate data values in parallel
+ *
+ * As iot_data_compress, but the top level elements of large Maps and Vectors are split into ranges compressed by
+ * thread pool jobs, sharing values through a concurrent hash set. Contained data that is also referenced from
+ * outside the data, or is frozen, is shared as a whole but not itself compressed. The data must not be used by
+ * other threads during compression and the function must not be called from a job running on the same thread pool.
+ *
+ * @param data  The data to be compressed
+ * @param pool  Thread pool to run compression jobs, if NULL data is compressed on the calling thread
+ * @return      The approximate memory freed by compression, in bytes, see iot_data_memory_size
+ */
+extern size_t iot_data_compress_parallel (iot_data_t * data, iot_threadpool_t * pool);
+
+/**
+ * @brief Allocate a string intern pool
+ *
+ * The function allocates a thread safe pool of shared String values. Strings only referenced by the pool
+ * are evicted when the pool is full or purged. If the pool is full and no strings can be evicted, strings
+ * are not pooled.
+ *
+ * @param limit  Approximate maximum number of pooled strings, if zero a default is used
+ * @return       Pointer to the allocated pool
+ */
+extern iot_data_intern_t * iot_data_intern_alloc (uint32_t limit);
+
+/**
+ * @brief Free a string intern pool, releasing the pool references to pooled strings
+ *
+ * @param pool  The pool to free (can be NULL)
+ */
+extern void iot_data_intern_free (iot_data_intern_t * pool);
+
+/**
+ * @brief Return the global string intern pool, shared by all threads
+ *
+ * @return  The global pool
+ */
+extern iot_data_intern_t * iot_data_intern_global (void);
+
+/**
+ * @brief Intern a String value. Ownership of the string is taken and a reference to an equal pooled string is returned.
+ *
+ * @param pool  The pool
+ * @param str   The String data
+ * @return      The pooled string (or str if not pooled), the caller owns the returned reference
+ */
+extern iot_data_t * iot_data_intern (iot_data_intern_t * pool, iot_data_t * str);
+
+/**
+ * @brief Return a reference to a pooled String value equal to a string, adding it to the pool if not present
+ *
+ * @param pool  The pool
+ * @param str   The string value
+ * @return      The pooled String data, the caller owns the returned reference
+ */
+extern iot_data_t * iot_data_intern_string (iot_data_intern_t * pool, const char * str);
+
+/**
+ * @brief Evict all strings from a pool that are only referenced by the pool
+ *
+ * @param pool  The pool
+ * @return      The number of strings evicted
+ */
+extern uint32_t iot_data_intern_purge (iot_data_intern_t * pool);
+
+/**
+ * @brief Return the number of strings in a pool
+ *
+ * @param pool  The pool
+ * @return      The number of pooled strings
+ */
+extern uint32_t iot_data_intern_size (iot_data_intern_t * pool);
+
+/**
+ * @brief Compress a composed data type (Vector, List or Map) by replacing contained strings with pooled strings
+ *
+ * @param data  The data to be compressed
+ * @param pool  The intern pool
+ */
+extern void iot_data_compress_with_pool (iot_data_t * data, iot_data_intern_t * pool);
+
 /**
  * @brief Increment the data reference count
  * @param data  Pointer to data
@@ -219,6 +382,60 @@ extern iot_data_t * iot_data_add_ref (const iot_data_t * data);
  */
 extern uint32_t iot_data_ref_count (const iot_data_t * data);
 
+/**
+ * @brief Freeze data and all data it contains
+ *
+ * Frozen data is immutable and is not reference counted, iot_data_add_ref and iot_data_free returning
+ * without updating the reference count, so sharing long lived data between threads has no atomic
+ * update cost. Frozen data is never freed, see iot_data_thaw. Static data is not affected.
+ *
+ * @param data  Pointer to data (can be NULL), which must not be modified once frozen
+ * @return      Returned pointer to data
+ */
+extern iot_data_t * iot_data_freeze (iot_data_t * data);
+
+/**
+ * @brief Thaw frozen data and all data it contains, restoring reference counting
+ *
+ * The reference count is as it was when the data was frozen, so data should only be thawed once
+ * all references taken while frozen have been released. The data can then be freed with iot_data_free.
+ *
+ * @param data  Pointer to data (can be NULL)
+ * @return      Returned pointer to data
+ */
+extern iot_data_t * iot_data_thaw (iot_data_t * data);
+
+/**
+ * @brief Check if data instance is frozen
+ *
+ * @param data  Pointer to data (can be NULL)
+ * @return      Whether the data is frozen
+ */
+extern bool iot_data_is_frozen (const iot_data_t * data);
+
+/** Type for cache of JSON and CBOR encodings of frozen data */
+typedef struct iot_data_encode_cache_t iot_data_encode_cache_t;
+
+/**
+ * @brief Allocate a cache of encodings of frozen data
+ *
+ * The cache holds the JSON and CBOR encodings of frozen maps, vectors, lists and arrays, keyed by data address and
+ * validated by data hash. The canonical encoding functions splice cached encodings into their output, so re-encoding
+ * mostly frozen data only costs the changed parts. Entries are direct mapped, a new encoding replacing any prior
+ * encoding in the same slot. A cache should only be used by one thread at a time.
+ *
+ * @param size  Number of cache slots per encoding, rounded up to a power of two
+ * @return      Pointer to the allocated cache
+ */
+extern iot_data_encode_cache_t * iot_data_encode_cache_alloc (uint32_t size);
+
+/**
+ * @brief Free an encoding cache
+ *
+ * @param cache  Pointer to the cache, may be NULL
+ */
+extern void iot_data_encode_cache_free (iot_data_encode_cache_t * cache);
+
 /**
  * @brief Free memory allocated to data
  *
@@ -573,6 +790,22 @@ extern iot_data_t * iot_data_alloc_uuid_string (void);
  */
 extern iot_data_t * iot_data_alloc_uuid (void);
 
+/**
+ * @brief Allocate data for a string containing a time ordered (version 7) UUID
+ *
+ * UUIDs hold the Unix time in milliseconds and a counter, so sort in order of allocation.
+ *
+ * @return  Pointer to the allocated data
+ */
+extern iot_data_t * iot_data_alloc_uuid_v7_string (void);
+
+/**
+ * @brief Allocate data for a binary time ordered (version 7) UUID of type UINT8 and length 16
+ *
+ * @return  Pointer to the allocated data
+ */
+extern iot_data_t * iot_data_alloc_uuid_v7 (void);
+
 /**
  * @brief Allocate memory for a string
  *
@@ -600,7 +833,8 @@ extern iot_data_t * iot_data_alloc_const_string (iot_data_static_t * data, const
 /**
  * @brief Allocate memory for a formatted string
  *
- * The function to allocate data for a formatted string
+ * The function to allocate data for a formatted string. Short strings are formatted directly into
+ * the data value buffer, so need no separate allocation.
  *
  * @param format  String with formatting directives
  * @param ...     Arguments for formatting directives
@@ -610,6 +844,21 @@ extern iot_data_t * iot_data_alloc_const_string (iot_data_static_t * data, const
 
 extern iot_data_t * iot_data_alloc_string_fmt (const char * format, ...);
 
+/**
+ * @brief Allocate memory for a formatted string, given its expected length
+ *
+ * As iot_data_alloc_string_fmt, but strings expected to be too long for the data value buffer
+ * are formatted directly into a heap buffer of the expected length. The string is formatted
+ * again only if longer than expected.
+ *
+ * @param len     Expected length of the formatted string, excluding the terminating NULL
+ * @param format  String with formatting directives
+ * @param ...     Arguments for formatting directives
+ *
+ * @return        Pointer to the allocated memory
+ */
+extern iot_data_t * iot_data_alloc_string_fmt_n (size_t len, const char * format, ...);
+
 /**
  * @brief Allocate data for a pointer, with associated free function
  *
@@ -913,6 +1162,32 @@ extern void iot_data_array_to_binary (iot_data_t * data);
  */
 extern iot_data_t * iot_data_alloc_array (void * data, uint32_t length, iot_data_type_t type, iot_data_ownership_t ownership);
 
+/**
+ * @brief Allocate a multi dimensional array
+ *
+ * The function allocates an array holding row major elements of an N dimensional array, such as a sensor frame. The
+ * number of elements is the product of the dimensions. The shape is stored as an IOT_DATA_UINT32 array of dimensions in
+ * the array metadata, so avoiding the construction of nested vectors. Shaped arrays are written as nested arrays
+ * by iot_data_to_json and as RFC 8746 multi dimensional typed arrays by iot_data_to_cbor.
+ *
+ * @param data       Pointer to C array of row major data
+ * @param dims       Array of dimensions, outermost first
+ * @param ndims      Number of dimensions
+ * @param type       Type of array element
+ * @param ownership  If the ownership is set to IOT_DATA_COPY, a new allocation is made and data is copied to the allocated
+ *                   memory, else the ownership of the data is taken.
+ * @return           Pointer to the allocated array
+ */
+extern iot_data_t * iot_data_alloc_shaped_array (void * data, const uint32_t * dims, uint32_t ndims, iot_data_type_t type, iot_data_ownership_t ownership);
+
+/**
+ * @brief Return the shape of a multi dimensional array
+ *
+ * @param array  Input array
+ * @return       IOT_DATA_UINT32 array of dimensions, or NULL if the array has no shape or its length no longer matches the shape
+ */
+extern const iot_data_t * iot_data_array_shape (const iot_data_t * array);
+
 /**
  * @brief Find array element type
  *
@@ -964,6 +1239,60 @@ extern uint32_t iot_data_array_size (const iot_data_t * array);
  */
 extern iot_data_t * iot_data_alloc_map (iot_data_type_t key_type);
 
+/**
+ * @brief  Allocate map data type with a capacity hint
+ *
+ * The function to allocate a data map with a key type, reserving storage for the nodes of the given number of
+ * entries. With the block cache enabled the node blocks are reserved for the calling thread in a single refill,
+ * so adding the entries takes no further locks or memory allocations.
+ *
+ * @param key_type  Datatype of the map keys
+ * @param capacity  Expected number of map entries
+ * @return          Pointer to the allocated data map
+ */
+extern iot_data_t * iot_data_alloc_map_with_capacity (iot_data_type_t key_type, uint32_t capacity);
+
+/**
+ * @brief Allocate constant map data
+ *
+ * The function to allocate data for a constant map, using fixed static storage for the map and its entries, so
+ * no memory is allocated and the map need not be deleted. The keys and values are not referenced or freed by the
+ * map, so must also be constant (typically allocated with iot_data_alloc_const_string or similar). The map tree is
+ * built balanced in the entry storage, in time linear after sorting the keys. A constant map must not be modified.
+ *
+ * @code
+ * static iot_data_static_t strs[4];
+ * static iot_data_map_node_static_t nodes[2];
+ * static iot_data_map_static_t units;
+ * iot_data_t * pairs[] = { iot_data_alloc_const_string (&strs[0], "m"), iot_data_alloc_const_string (&strs[1], "metre"), ... };
+ * iot_data_alloc_const_map (&units, nodes, pairs, 2u, IOT_DATA_STRING);
+ * @endcode
+ *
+ * @param data      Address of static storage for map data
+ * @param nodes     Address of static storage for map entries, of at least count entries
+ * @param pairs     Keys and values, alternating, of length 2 * count. Keys must be unique
+ * @param count     Number of map entries
+ * @param key_type  Datatype of the map keys
+ * @return          Pointer to the allocated data (same address as the static storage)
+ */
+extern iot_data_t * iot_data_alloc_const_map (iot_data_map_static_t * data, iot_data_map_node_static_t * nodes, iot_data_t * const * pairs, uint32_t count, iot_data_type_t key_type);
+
+/**
+ * @brief Allocate constant string map data
+ *
+ * The function to allocate data for a constant map of string keys to string values, as for iot_data_alloc_const_map,
+ * with the key and value strings also allocated in fixed static storage. The strings are not copied, so must be
+ * static (typically string literals).
+ *
+ * @param data      Address of static storage for map data
+ * @param nodes     Address of static storage for map entries, of at least count entries
+ * @param strs      Address of static storage for string data, of at least 2 * count entries
+ * @param pairs     Key and value strings, alternating, of length 2 * count. Keys must be unique
+ * @param count     Number of map entries
+ * @return          Pointer to the allocated data (same address as the static storage)
+ */
+extern iot_data_t * iot_data_alloc_const_string_map (iot_data_map_static_t * data, iot_data_map_node_static_t * nodes, iot_data_static_t * strs, const char * const * pairs, uint32_t count);
+
 /**
  * @brief  Allocate map data type
  *
@@ -975,6 +1304,37 @@ extern iot_data_t * iot_data_alloc_map (iot_data_type_t key_type);
  */
 extern iot_data_t * iot_data_alloc_typed_map (iot_data_type_t key_type, iot_data_type_t element_type);
 
+/**
+ * @brief  Allocate hashed map data type
+ *
+ * The function to allocate a data map with a key type, that maintains an open addressing hash index
+ * of map entries in addition to the ordered tree. Lookups are O(1) rather than O(log n), at the cost of
+ * additional memory. All other map functions, including iteration order, are as for a standard map.
+ *
+ * @param key_type  Datatype of the map keys
+ * @return          Pointer to the allocated data map
+ */
+extern iot_data_t * iot_data_alloc_hash_map (iot_data_type_t key_type);
+
+/**
+ * @brief  Allocate hashed map data type
+ *
+ * The function to allocate a hashed data map with a key type and element type
+ *
+ * @param key_type     Datatype of the map keys
+ * @param element_type Datatype of the map values
+ * @return             Pointer to the allocated data map
+ */
+extern iot_data_t * iot_data_alloc_typed_hash_map (iot_data_type_t key_type, iot_data_type_t element_type);
+
+/**
+ * @brief Check whether a map maintains a hash index
+ *
+ * @param map  Input map
+ * @return     Whether the map was allocated as a hashed map
+ */
+extern bool iot_data_map_is_hashed (const iot_data_t * map);
+
 /**
  * @brief Find map element type
  *
@@ -995,6 +1355,20 @@ extern iot_data_type_t iot_data_map_type (const iot_data_t * map);
  */
 extern iot_data_t * iot_data_alloc_vector (uint32_t size);
 
+/**
+ * @brief Allocate constant vector data
+ *
+ * The function to allocate data for a constant vector, using fixed static storage, so no memory is allocated
+ * and the vector need not be deleted. The values array is used as the vector storage, so must be static. The
+ * values are not referenced or freed by the vector, so must also be constant. A constant vector must not be modified.
+ *
+ * @param data    Address of static storage for vector data
+ * @param values  Static array of vector values
+ * @param size    Length of the vector
+ * @return        Pointer to the allocated data (same address as the static storage)
+ */
+extern iot_data_t * iot_data_alloc_const_vector (iot_data_vector_static_t * data, iot_data_t ** values, uint32_t size);
+
 /**
  * @brief Allocate a data vector
  *
@@ -1253,6 +1627,36 @@ extern bool iot_data_map_add_unused (iot_data_t * map, iot_data_t * key, iot_dat
  */
 extern void iot_data_map_merge (iot_data_t * map, const iot_data_t * add);
 
+/**
+ * @brief Add key-value pairs, in any order, to a map
+ *
+ * The function adds the pairs as if added in turn with iot_data_map_add, so the last value of any
+ * duplicate key is retained. Unless the map is larger than the number of pairs, the pairs are sorted,
+ * merged with the map contents and the map tree rebuilt balanced once, rather than rebalanced and
+ * rehashed for each pair.
+ *
+ * @param map     Map to which the key-value pairs are added
+ * @param keys    Array of keys
+ * @param values  Array of values, the value for each key at the same index
+ * @param count   Number of key-value pairs
+ * Note: The ownership of keys and values passed is owned by the map and cannot be reused, unless reference counted
+ */
+extern void iot_data_map_add_all (iot_data_t * map, iot_data_t ** keys, iot_data_t ** values, uint32_t count);
+
+/**
+ * @brief Add key-value pairs, in ascending key order, to an empty map
+ *
+ * The function builds the map in linear time rather than adding each pair in turn. If the map is
+ * not empty or the keys are not in strictly ascending order, the pairs are added one at a time.
+ *
+ * @param map     Map to which the key-value pairs are added
+ * @param keys    Array of keys
+ * @param values  Array of values, the value for each key at the same index
+ * @param count   Number of key-value pairs
+ * Note: The ownership of keys and values passed is owned by the map and cannot be reused, unless reference counted
+ */
+extern void iot_data_map_build_sorted (iot_data_t * map, iot_data_t ** keys, iot_data_t ** values, uint32_t count);
+
 /**
  * @brief Remove a value by key from a map
  *
@@ -1678,13 +2082,44 @@ extern const void * iot_data_vector_get_pointer (const iot_data_t * vector, uint
  * @brief Resize a vector
  *
  * Resize a vector. If the vector is reduced in size elements no longer
- * included in the vector are freed.
+ * included in the vector are freed. Storage is only reallocated if the size
+ * exceeds the vector capacity, to exactly the new size.
  *
  * @param vector  Input vector
  * @param size    new vector size
  */
 extern void iot_data_vector_resize (iot_data_t * vector, uint32_t size);
 
+/**
+ * @brief Reserve vector storage
+ *
+ * Ensure a vector has storage for at least capacity elements, so it can be resized
+ * or appended to up to that size without reallocation. The vector size is unchanged.
+ *
+ * @param vector    Input vector
+ * @param capacity  Number of elements to reserve storage for
+ */
+extern void iot_data_vector_reserve (iot_data_t * vector, uint32_t capacity);
+
+/**
+ * @brief Get vector capacity
+ *
+ * @param vector  Input vector
+ * @return        Number of elements the vector has storage for
+ */
+extern uint32_t iot_data_vector_capacity (const iot_data_t * vector);
+
+/**
+ * @brief Append a value to a vector
+ *
+ * Add a value at the end of a vector, increasing the vector size by one. Storage is
+ * grown geometrically, so a vector can be built one value at a time in linear time.
+ *
+ * @param vector  Input vector
+ * @param val     Value to append, ownership is transferred to the vector
+ */
+extern void iot_data_vector_append (iot_data_t * vector, iot_data_t * val);
+
 /**
  * @brief Compact a vector
  *
@@ -1817,6 +2252,39 @@ extern const iot_data_t * iot_data_map_end (iot_data_t * map);
  */
 extern const void * iot_data_map_end_pointer (iot_data_t * map);
 
+/**
+ * @brief Return the first key in a map not less than a given key
+ *
+ * The function descends the ordered map once, so is O(log n) in the size of the map.
+ *
+ * @param map   Input map
+ * @param key   Key to search for
+ * @return      First key greater than or equal to key, NULL if no such key
+ */
+extern const iot_data_t * iot_data_map_lower_bound (const iot_data_t * map, const iot_data_t * key);
+
+/**
+ * @brief Return the first key in a map greater than a given key
+ *
+ * @param map   Input map
+ * @param key   Key to search for
+ * @return      First key greater than key, NULL if no such key
+ */
+extern const iot_data_t * iot_data_map_upper_bound (const iot_data_t * map, const iot_data_t * key);
+
+/**
+ * @brief Position a map iterator so that the next element is the first not less than a key
+ *
+ * After seeking, iot_data_map_iter_next moves the iterator to the first element whose key is greater
+ * than or equal to key, so a range query costs O(log n + k) for k elements visited. If all keys are
+ * less than key, the iterator is positioned at the end of the map and has no next element.
+ *
+ * @param iter  Initialised iterator
+ * @param key   Key to seek to
+ * @return      Whether an element with a key not less than key exists
+ */
+extern bool iot_data_map_iter_seek (iot_data_map_iter_t * iter, const iot_data_t * key);
+
 /**
  * @brief Update the iterator to point to the next element within a map
  *
@@ -2043,6 +2511,27 @@ extern const char * iot_data_vector_iter_string (const iot_data_vector_iter_t *
  */
 extern const iot_data_t * iot_data_vector_find (const iot_data_t * vector, iot_data_cmp_fn cmp, const void * arg);
 
+/**
+ * @brief Sort a vector in place
+ *
+ * @param vector  Input vector
+ * @param cmp     Ordering function, NULL to order by iot_data_compare_value
+ */
+extern void iot_data_vector_sort (iot_data_t * vector, iot_data_order_fn cmp);
+
+/**
+ * @brief Binary search a sorted vector for a value
+ *
+ * The vector must be sorted using the same ordering function, see iot_data_vector_sort.
+ *
+ * @param vector  Input vector
+ * @param value   The value to search for
+ * @param cmp     Ordering function, NULL to order by iot_data_compare_value
+ * @param index   Returned index of the first element not less than value (vector size if none), can be NULL
+ * @return        Whether an element equal to value was found
+ */
+extern bool iot_data_vector_search (const iot_data_t * vector, const iot_data_t * value, iot_data_order_fn cmp, uint32_t * index);
+
 /**
  * @brief Initialise iterator to the start of a iterable
  *
@@ -2148,6 +2637,54 @@ extern char * iot_data_to_json_with_size (const iot_data_t * data, uint32_t size
  */
 extern char * iot_data_to_json_with_buffer (const iot_data_t * data, char * buff, uint32_t size);
 
+/**
+ * @brief  Convert data to json string, formatting the elements of a large typed array in parallel
+ *
+ * If the data is a one dimensional typed array of at least 16384 elements, ranges of elements are formatted by
+ * thread pool jobs, otherwise the data is converted as by iot_data_to_json. Jobs that cannot be added to the
+ * pool are run on the calling thread.
+ *
+ * @param  data  Input data
+ * @param  pool  Thread pool to run formatting jobs, if NULL the json is generated on the calling thread
+ * @return       Allocated JSON string, to be released with free
+ */
+extern char * iot_data_to_json_parallel (const iot_data_t * data, iot_threadpool_t * pool);
+
+/**
+ * @brief  Convert data to canonical json string
+ *
+ * Maps are written in key order, ignoring any ordering metadata, so equal data always has the same encoding.
+ * If a cache is given, the encodings of frozen maps, vectors, lists and arrays are cached and spliced into
+ * later encodings, see iot_data_encode_cache_alloc.
+ *
+ * @param  data   Input data
+ * @param  cache  Encoding cache, may be NULL
+ * @return        Allocated JSON string, to be released with free
+ */
+extern char * iot_data_to_json_canonical (const iot_data_t * data, iot_data_encode_cache_t * cache);
+
+/**
+ * @brief  Convert data to json, writing output to a sink function
+ *
+ * The json is generated into a fixed size internal buffer, which is passed to the sink function each time
+ * it fills and on completion, so no memory is allocated. The output is not null terminated. If the sink
+ * function returns false, generation completes but no further output is passed to the sink.
+ *
+ * @param  data      Input data
+ * @param  write_fn  Function called with each chunk of output
+ * @param  ctx       Context passed to write_fn
+ * @return           Whether all calls to write_fn returned true
+ */
+extern bool iot_data_to_json_sink (const iot_data_t * data, iot_data_write_fn write_fn, void * ctx);
+
+/**
+ * @brief  Calculate size of json representation of data
+ *
+ * @param  data  Input data
+ * @return       Length of json generated for data, excluding null terminator
+ */
+extern size_t iot_data_json_size (const iot_data_t * data);
+
 /**
  * @brief Convert json to iot_data_t type
  *
@@ -2191,16 +2728,360 @@ extern iot_data_t * iot_data_from_json_with_ordering (const char * json, bool or
  */
 extern iot_data_t * iot_data_from_json_with_cache (const char * json, bool ordered, iot_data_t * cache);
 
-#ifdef IOT_HAS_CBOR
 /**
- * @brief  Convert data to CBOR block
+ * @brief Convert a JSON string to data, parsing in place
  *
- * The function to convert data to cbor.
+ * The function is as iot_data_from_json_with_cache, but takes ownership of the JSON buffer, which is modified.
+ * Strings in the returned data are unescaped and terminated within the buffer rather than copied, those longer
+ * than the inline value buffer referencing it, so that the buffer is freed when no longer referenced by data.
  *
- * @param  data  Input data
- * @return       CBOR in an IOT_DATA_BINARY
- */
-extern iot_data_t * iot_data_to_cbor (const iot_data_t * data);
+ * @param json    Input json string, allocated with malloc. Ownership is taken.
+ * @param ordered Whether returned map is ordered by position in json
+ * @param cache   Optional string map used as a cache for string values, may be NULL
+ * @return        Pointer to data of type iot_data if input string is a json object, NULL otherwise
+ */
+extern iot_data_t * iot_data_from_json_in_place (char * json, bool ordered, iot_data_t * cache);
+
+/**
+ * @brief Convert a JSON string to data, using an intern pool for string values
+ *
+ * The function is as iot_data_from_json_with_cache, but strings (map keys and values) are shared from the pool.
+ *
+ * @param json    Input json string
+ * @param ordered Whether returned map is ordered by position in json
+ * @param pool    The string intern pool, for example iot_data_intern_global ()
+ * @return        Pointer to data of type iot_data if input string is a json object, NULL otherwise
+ */
+extern iot_data_t * iot_data_from_json_with_pool (const char * json, bool ordered, iot_data_intern_t * pool);
+
+/**
+ * @brief Convert a JSON string to data, parsing the elements of a large top level array in parallel
+ *
+ * The json is tokenized, then if it is an array of at least 512 elements, the elements are located from
+ * the tokens and ranges of elements parsed by thread pool jobs. Jobs that cannot be queued are run by the
+ * calling thread. Strings are shared between jobs via a thread safe intern pool. Other json is parsed on
+ * the calling thread. The function must not be called from a job running on the same thread pool.
+ *
+ * @param json    Input json string
+ * @param ordered Whether returned maps are ordered by position in json
+ * @param intern  The string intern pool, if NULL a pool is allocated for the parse
+ * @param pool    Thread pool to run parsing jobs, if NULL the json is parsed on the calling thread
+ * @return        Pointer to the parsed data, or Null data if the json is invalid
+ */
+extern iot_data_t * iot_data_from_json_parallel (const char * json, bool ordered, iot_data_intern_t * intern, iot_threadpool_t * pool);
+
+/**
+ * @brief Convert a JSON string to data, substituting references in string and primitive values
+ *
+ * The function is as iot_data_from_json_with_ordering, but each (unescaped) string value or map key containing
+ * a "${" reference is passed to the substitution function and replaced by its result, which is then freed.
+ * Only strings containing references are copied for substitution, references outside strings are not valid JSON.
+ *
+ * @param json    Input json string
+ * @param ordered Whether returned map is ordered by position in json
+ * @param fn      The substitution function
+ * @param arg     Argument passed to the substitution function
+ * @return        Pointer to data of type iot_data if input string is a json object, NULL if a substitution failed
+ */
+extern iot_data_t * iot_data_from_json_with_substitute (const char * json, bool ordered, iot_data_substitute_fn fn, void * arg);
+
+/** Opaque reusable json parsing context structure */
+typedef struct iot_data_json_context_t iot_data_json_context_t;
+
+/**
+ * @brief Allocate a reusable json parsing context
+ *
+ * A context retains its token array and string cache between parses, so avoiding their allocation
+ * when parsing many small documents. A context is not thread safe, so should be used by one thread.
+ *
+ * @param ordered Whether returned maps are ordered by position in json, see iot_data_from_json_with_ordering
+ * @return        Pointer to the allocated context
+ */
+extern iot_data_json_context_t * iot_data_json_context_alloc (bool ordered);
+
+/**
+ * @brief Convert a json string to data, using a reusable parsing context
+ *
+ * @param context Pointer to the parsing context
+ * @param json    Input json string
+ * @return        Pointer to data of type iot_data if input string is a json object, NULL otherwise
+ */
+extern iot_data_t * iot_data_from_json_with_context (iot_data_json_context_t * context, const char * json);
+
+/**
+ * @brief Free a reusable json parsing context
+ *
+ * @param context Pointer to the context, may be NULL
+ */
+extern void iot_data_json_context_free (iot_data_json_context_t * context);
+
+/** Opaque lazy json document structure */
+typedef struct iot_data_json_doc_t iot_data_json_doc_t;
+
+/**
+ * @brief Allocate a lazy json document
+ *
+ * The json is parsed to tokens, but data is only created for the values that are accessed, so reading a few
+ * fields from a large document is much cheaper than a full conversion. A document is not thread safe.
+ *
+ * @param json    Input json string, copied by the document
+ * @param ordered Whether created maps are ordered by position in json, see iot_data_from_json_with_ordering
+ * @return        Pointer to the allocated document, or NULL if the json is invalid
+ */
+extern iot_data_json_doc_t * iot_data_json_doc_alloc (const char * json, bool ordered);
+
+/**
+ * @brief Get a value from a lazy json document
+ *
+ * Data for the value (and any values within it) is created on first access, then retained by the document.
+ *
+ * @param doc   Pointer to the document
+ * @param path  A list of keys and indexes, as for iot_data_get_at. If the list is empty the whole document is returned
+ * @return      The data found by following the path, or NULL if the path does not match the document.
+ *              Only valid until the document is freed.
+ */
+extern const iot_data_t * iot_data_json_doc_get_at (iot_data_json_doc_t * doc, const iot_data_t * path);
+
+/**
+ * @brief Get the data for a whole lazy json document
+ *
+ * @param doc   Pointer to the document
+ * @return      The data for the document, as returned by iot_data_from_json. Only valid until the document is freed.
+ */
+extern const iot_data_t * iot_data_json_doc_data (iot_data_json_doc_t * doc);
+
+/**
+ * @brief Free a lazy json document, and all data created from it
+ *
+ * @param doc   Pointer to the document, may be NULL
+ */
+extern void iot_data_json_doc_free (iot_data_json_doc_t * doc);
+
+/** Field descriptor, for decoding a map or json object to a C struct */
+typedef struct iot_data_field_t
+{
+  const char * name;      /**< Field name (map key) */
+  size_t offset;          /**< Offset of the field in the struct (see offsetof) */
+  iot_data_type_t type;   /**< Field type, numeric or boolean, or string for an allocated char * */
+  bool required;          /**< Whether the field must be present */
+  const char * def;       /**< Default if not required and not present, as json primitive or string value. May be NULL */
+} iot_data_field_t;
+
+/**
+ * @brief Decode a map to a C struct
+ *
+ * Each field is set from the map value with the name of the field, cast to the field type. Fields not found
+ * are set to their default, or zero (NULL for strings) if no default. All fields are set, so the struct
+ * can be freed with iot_data_struct_free whether or not decoding succeeds.
+ *
+ * @param map     Map with string keys
+ * @param fields  Array of field descriptors
+ * @param count   Number of fields, at most 64
+ * @param out     Pointer to struct to set
+ * @return        Whether all required fields were found and all found values could be cast to field types
+ */
+extern bool iot_data_map_to_struct (const iot_data_t * map, const iot_data_field_t * fields, uint32_t count, void * out);
+
+/**
+ * @brief Decode a json object to a C struct
+ *
+ * As for iot_data_map_to_struct, but fields are set directly from the json, without creating intermediate data.
+ * Values not matching a field are skipped.
+ *
+ * @param json    Input json string
+ * @param fields  Array of field descriptors
+ * @param count   Number of fields, at most 64
+ * @param out     Pointer to struct to set
+ * @return        Whether json is an object, all required fields were found and all found values could be cast to field types
+ */
+extern bool iot_data_json_to_struct (const char * json, const iot_data_field_t * fields, uint32_t count, void * out);
+
+/**
+ * @brief Free the string fields of a struct decoded by iot_data_map_to_struct or iot_data_json_to_struct
+ *
+ * @param fields  Array of field descriptors
+ * @param count   Number of fields
+ * @param data    Pointer to decoded struct
+ */
+extern void iot_data_struct_free (const iot_data_field_t * fields, uint32_t count, void * data);
+
+/** Opaque incremental json parser structure */
+typedef struct iot_data_json_stream_t iot_data_json_stream_t;
+
+/**
+ * @brief Allocate an incremental json parser
+ *
+ * The parser accepts json in chunks (for example as read from a file or socket), building the
+ * resulting data incrementally. Memory used by the parser is bounded by the nesting depth and
+ * longest string or number in the json, rather than the size of the document.
+ *
+ * @param ordered Whether returned maps are ordered by position in json, see iot_data_from_json_with_ordering
+ * @param cache   Optional string map used as a cache for string values, may be NULL
+ * @return        Pointer to the allocated parser
+ */
+extern iot_data_json_stream_t * iot_data_json_stream_alloc (bool ordered, iot_data_t * cache);
+
+/**
+ * @brief Push a chunk of json into an incremental parser
+ *
+ * @param stream  Pointer to the parser
+ * @param chunk   Json chunk, need not be NULL terminated
+ * @param len     Length of json chunk
+ * @return        Whether the json parsed so far is valid
+ */
+extern bool iot_data_json_stream_push (iot_data_json_stream_t * stream, const char * chunk, size_t len);
+
+/**
+ * @brief Complete incremental parsing, returning the parsed data
+ *
+ * Completes parsing of the current json document and resets the parser so it can be reused.
+ *
+ * @param stream  Pointer to the parser
+ * @return        Pointer to the parsed data, or NULL if the json was incomplete or invalid
+ */
+extern iot_data_t * iot_data_json_stream_finish (iot_data_json_stream_t * stream);
+
+/**
+ * @brief Free an incremental json parser
+ *
+ * @param stream  Pointer to the parser, may be NULL
+ */
+extern void iot_data_json_stream_free (iot_data_json_stream_t * stream);
+
+/** Record sequence formats */
+typedef enum iot_data_seq_format_t
+{
+  IOT_DATA_SEQ_JSON = 0, /**< Newline delimited json (JSON Lines), blank lines are ignored */
+  IOT_DATA_SEQ_CBOR = 1  /**< RFC 8742 CBOR sequence of concatenated data items, requires CBOR support (see IOT_HAS_CBOR) */
+} iot_data_seq_format_t;
+
+/** Opaque record sequence reader structure */
+typedef struct iot_data_seq_reader_t iot_data_seq_reader_t;
+
+/** Opaque record sequence writer structure */
+typedef struct iot_data_seq_writer_t iot_data_seq_writer_t;
+
+/**
+ * @brief Allocate a reader of records from a buffer
+ *
+ * The reader retains its json parsing context (see iot_data_json_context_alloc) or CBOR string cache across
+ * records, so decoding many small records avoids repeated allocation. A reader is not thread safe.
+ *
+ * @param format  Record format
+ * @param buff    Buffer holding the records, not copied so must remain valid while the reader is used
+ * @param size    Size of the buffer
+ * @return        Pointer to the allocated reader
+ */
+extern iot_data_seq_reader_t * iot_data_seq_reader_alloc (iot_data_seq_format_t format, const uint8_t * buff, size_t size);
+
+/**
+ * @brief Allocate a reader of records from a file descriptor
+ *
+ * As iot_data_seq_reader_alloc, but records are read from a file or socket into a buffer, which is grown
+ * to hold the longest record. A malformed CBOR item cannot be distinguished from an incomplete one until
+ * end of file, so the remainder of the input is read before failing.
+ *
+ * @param format  Record format
+ * @param fd      File descriptor to read from, blocking reads are made until end of file
+ * @return        Pointer to the allocated reader
+ */
+extern iot_data_seq_reader_t * iot_data_seq_reader_alloc_fd (iot_data_seq_format_t format, int fd);
+
+/**
+ * @brief Read and decode the next record
+ *
+ * @param reader  Pointer to the reader
+ * @return        Pointer to the decoded record, or NULL at the end of the records or if a record
+ *                could not be read or decoded (see iot_data_seq_reader_failed) (client needs to free)
+ */
+extern iot_data_t * iot_data_seq_reader_next (iot_data_seq_reader_t * reader);
+
+/**
+ * @brief Read and decode a batch of records, optionally decoding records in parallel
+ *
+ * If a thread pool is given and enough records are read, the batch is split into ranges of records, each
+ * decoded by a thread pool job with its own parsing context. Jobs that cannot be queued are run by the
+ * calling thread. The function must not be called from a job running on the same thread pool.
+ *
+ * @param reader  Pointer to the reader
+ * @param max     Maximum number of records to read
+ * @param pool    Thread pool to run decoding jobs, if NULL records are decoded on the calling thread
+ * @return        Vector of decoded records in order, or NULL if no records remain. If a record cannot be
+ *                decoded, the Vector holds only the records before it (client needs to free)
+ */
+extern iot_data_t * iot_data_seq_reader_batch (iot_data_seq_reader_t * reader, uint32_t max, iot_threadpool_t * pool);
+
+/**
+ * @brief Check whether a reader failed to read or decode a record
+ *
+ * @param reader  Pointer to the reader
+ * @return        Whether reading stopped on an error, rather than at the end of the records
+ */
+extern bool iot_data_seq_reader_failed (const iot_data_seq_reader_t * reader);
+
+/**
+ * @brief Free a record sequence reader
+ *
+ * @param reader  Pointer to the reader, may be NULL
+ */
+extern void iot_data_seq_reader_free (iot_data_seq_reader_t * reader);
+
+/**
+ * @brief Allocate a writer of records to a sink
+ *
+ * Records are encoded into a buffer reused across records, which is passed to the sink once it exceeds 64KB,
+ * or when flushed. A writer is not thread safe.
+ *
+ * @param format    Record format
+ * @param write_fn  Sink function, called with the encoded records
+ * @param ctx       Context passed to the sink function
+ * @return          Pointer to the allocated writer
+ */
+extern iot_data_seq_writer_t * iot_data_seq_writer_alloc (iot_data_seq_format_t format, iot_data_write_fn write_fn, void * ctx);
+
+/**
+ * @brief Allocate a writer of records to a file descriptor
+ *
+ * @param format  Record format
+ * @param fd      File descriptor to write to
+ * @return        Pointer to the allocated writer
+ */
+extern iot_data_seq_writer_t * iot_data_seq_writer_alloc_fd (iot_data_seq_format_t format, int fd);
+
+/**
+ * @brief Encode a record and add it to a writer
+ *
+ * @param writer  Pointer to the writer
+ * @param data    Record to write
+ * @return        Whether all records have been successfully written so far
+ */
+extern bool iot_data_seq_writer_put (iot_data_seq_writer_t * writer, const iot_data_t * data);
+
+/**
+ * @brief Write any records buffered by a writer
+ *
+ * @param writer  Pointer to the writer
+ * @return        Whether all records have been successfully written
+ */
+extern bool iot_data_seq_writer_flush (iot_data_seq_writer_t * writer);
+
+/**
+ * @brief Free a record sequence writer, first writing any buffered records
+ *
+ * @param writer  Pointer to the writer, may be NULL
+ */
+extern void iot_data_seq_writer_free (iot_data_seq_writer_t * writer);
+
+#ifdef IOT_HAS_CBOR
+/**
+ * @brief  Convert data to CBOR block
+ *
+ * The function to convert data to cbor.
+ *
+ * @param  data  Input data
+ * @return       CBOR in an IOT_DATA_BINARY
+ */
+extern iot_data_t * iot_data_to_cbor (const iot_data_t * data);
 
 /**
  * @brief  Convert data to CBOR block with initial buffer size
@@ -2215,6 +3096,84 @@ extern iot_data_t * iot_data_to_cbor (const iot_data_t * data);
  */
 extern iot_data_t * iot_data_to_cbor_with_size (const iot_data_t * data, uint32_t size);
 
+/**
+ * @brief  Convert data to canonical CBOR block
+ *
+ * Maps are written in key order, so equal data always has the same encoding. If a cache is given, the encodings
+ * of frozen maps, vectors, lists and arrays are cached and spliced into later encodings, see iot_data_encode_cache_alloc.
+ *
+ * @param  data   Input data
+ * @param  cache  Encoding cache, may be NULL
+ * @return        CBOR in an IOT_DATA_BINARY
+ */
+extern iot_data_t * iot_data_to_cbor_canonical (const iot_data_t * data, iot_data_encode_cache_t * cache);
+
+/**
+ * @brief  Return the exact size of the CBOR encoding of data
+ *
+ * @param  data  Input data
+ * @return       Size in bytes of the CBOR encoding
+ */
+extern size_t iot_data_cbor_size (const iot_data_t * data);
+
+/**
+ * @brief  Convert data to CBOR in a caller supplied buffer
+ *
+ * The function computes the exact encoded size and, if the buffer is large enough, encodes directly into it
+ * without any intermediate allocation.
+ *
+ * @param  data  Input data
+ * @param  buff  Output buffer
+ * @param  size  Size of output buffer
+ * @return       Number of bytes written, zero if the buffer is too small
+ */
+extern size_t iot_data_to_cbor_buffer (const iot_data_t * data, uint8_t * buff, size_t size);
+
+struct iovec;
+
+/**
+ * @brief  Convert data to CBOR as a scatter gather vector
+ *
+ * The function encodes item heads and small payloads into a header buffer, but references large binary,
+ * string and typed array payloads in place, so they are not copied before being written with writev or sendmsg.
+ * The returned vector and header buffer are a single allocation, to be released with free. As payloads are
+ * referenced, the data must not be freed or modified until the vector has been written.
+ *
+ * @param  data   Input data
+ * @param  count  Set to the number of elements in the returned vector
+ * @return        Allocated iovec array describing the CBOR encoding
+ */
+extern struct iovec * iot_data_to_cbor_iovec (const iot_data_t * data, uint32_t * count);
+
+/**
+ * @brief  Convert CBOR to iot_data_t type
+ *
+ * The function to convert a CBOR encoded data item to iot_data. Unsigned and negative integers are
+ * converted to Int64 (or UInt64 if too large for an Int64, Float64 if a negative integer less than INT64_MIN),
+ * byte strings to Binary, text strings to String, arrays to Vector and maps to Map (with key type set if all
+ * keys of the same type). RFC 8746 typed array tags are converted to typed Array data. Other tags are ignored
+ * and the tagged item decoded. Byte and text strings, and typed array contents, are copied from the input once
+ * into the decoded data, so the input need not outlive the result.
+ *
+ * @param  cbor  Input CBOR data
+ * @param  size  Size of input CBOR data
+ * @return       Pointer to decoded data, NULL if input is not well formed CBOR
+ */
+extern iot_data_t * iot_data_from_cbor (const uint8_t * cbor, uint32_t size);
+
+/**
+ * @brief  Convert CBOR to iot_data_t type with shared string cache
+ *
+ * As for iot_data_from_cbor, but string values are shared via the given string cache map,
+ * see also iot_data_from_json_with_cache.
+ *
+ * @param  cbor  Input CBOR data
+ * @param  size  Size of input CBOR data
+ * @param  cache Optional string map used as a cache for string values, may be NULL
+ * @return       Pointer to decoded data, NULL if input is not well formed CBOR
+ */
+extern iot_data_t * iot_data_from_cbor_with_cache (const uint8_t * cbor, uint32_t size, iot_data_t * cache);
+
 #endif
 #ifdef IOT_HAS_XML
 /**
@@ -2230,6 +3189,76 @@ extern iot_data_t * iot_data_to_cbor_with_size (const iot_data_t * data, uint32_
  * @return       A iot_data map if input string is a XML string, NULL otherwise.
  */
 extern iot_data_t * iot_data_from_xml (const char * xml);
+
+/** XML stream event types */
+typedef enum iot_data_xml_event_t
+{
+  IOT_DATA_XML_ELEMENT_START = 0, /**< Element start, name is the element name */
+  IOT_DATA_XML_ATTRIBUTE = 1,     /**< Element attribute, name and value are the attribute name and value */
+  IOT_DATA_XML_ELEMENT_END = 2    /**< Element end, name is the element name and value any element content */
+} iot_data_xml_event_t;
+
+/**
+ * @brief XML stream event callback
+ *
+ * Called for each element start, attribute and element end parsed by an incremental XML parser.
+ * For an element start event, returning true materialises the element, in which case no events
+ * are raised for its attributes or children and the element end event is passed the element as a map
+ * in the same format as returned by iot_data_from_xml. The return value is ignored for other events.
+ * The name, value and element are only valid for the duration of the callback.
+ *
+ * @param arg     Callback argument, as passed to iot_data_xml_stream_alloc
+ * @param event   Event type
+ * @param depth   Element depth, one for the root element
+ * @param name    Element or attribute name
+ * @param value   Attribute value or element content, NULL if element has no content
+ * @param element Materialised element map or NULL
+ * @return        For element start events, whether to materialise the element
+ */
+typedef bool (*iot_data_xml_event_fn) (void * arg, iot_data_xml_event_t event, uint32_t depth, const char * name, const char * value, const iot_data_t * element);
+
+/** Opaque incremental XML parser structure */
+typedef struct iot_data_xml_stream_t iot_data_xml_stream_t;
+
+/**
+ * @brief Allocate an incremental XML parser
+ *
+ * The parser accepts XML in chunks, raising events as elements and attributes are parsed. Memory used by the
+ * parser is bounded by the nesting depth, longest content or attribute value and any materialised elements,
+ * rather than the size of the document.
+ *
+ * @param fn      Event callback function
+ * @param arg     Event callback argument
+ * @return        Pointer to the allocated parser
+ */
+extern iot_data_xml_stream_t * iot_data_xml_stream_alloc (iot_data_xml_event_fn fn, void * arg);
+
+/**
+ * @brief Push a chunk of XML into an incremental parser
+ *
+ * @param stream  Pointer to the parser
+ * @param chunk   XML chunk, need not be NULL terminated
+ * @param len     Length of XML chunk
+ * @return        Whether the XML parsed so far is valid
+ */
+extern bool iot_data_xml_stream_push (iot_data_xml_stream_t * stream, const char * chunk, size_t len);
+
+/**
+ * @brief Complete incremental parsing
+ *
+ * Completes parsing of the current XML document and resets the parser so it can be reused.
+ *
+ * @param stream  Pointer to the parser
+ * @return        Whether the XML document was complete and valid
+ */
+extern bool iot_data_xml_stream_finish (iot_data_xml_stream_t * stream);
+
+/**
+ * @brief Free an incremental XML parser
+ *
+ * @param stream  Pointer to the parser, may be NULL
+ */
+extern void iot_data_xml_stream_free (iot_data_xml_stream_t * stream);
 #endif
 
 #ifdef IOT_HAS_YAML
@@ -2244,6 +3273,44 @@ extern iot_data_t * iot_data_from_xml (const char * xml);
  * @return            A iot_data element if input string is a YAML string, NULL otherwise.
  */
 extern iot_data_t * iot_data_from_yaml (const char * yaml, iot_data_t ** exception);
+
+/**
+ * @brief Convert YAML to iot_data_t type, using a string cache
+ *
+ * As for iot_data_from_yaml, but string values (map keys and values) are shared via the given cache map.
+ *
+ * @param  yaml       Input YAML string
+ * @param  cache      Optional string map used as a cache for string values, may be NULL
+ * @param  exception  If a parse error occurs, on exit this will hold a string describing the problem
+ * @return            A iot_data element if input string is a YAML string, NULL otherwise.
+ */
+extern iot_data_t * iot_data_from_yaml_with_cache (const char * yaml, iot_data_t * cache, iot_data_t ** exception);
+
+/**
+ * @brief Convert YAML to iot_data_t type, substituting references in scalar values
+ *
+ * As for iot_data_from_yaml, but each scalar (map key or value) containing a "${" reference is passed to the
+ * substitution function and replaced by its result, which is then freed. Plain scalars are typed after substitution.
+ *
+ * @param  yaml       Input YAML string
+ * @param  fn         The substitution function
+ * @param  arg        Argument passed to the substitution function
+ * @param  exception  If a parse error occurs or a substitution fails, on exit this will hold a string describing the problem
+ * @return            A iot_data element if input string is a YAML string, NULL otherwise.
+ */
+extern iot_data_t * iot_data_from_yaml_with_substitute (const char * yaml, iot_data_substitute_fn fn, void * arg, iot_data_t ** exception);
+
+/**
+ * @brief Convert YAML read from a file descriptor to iot_data_t type
+ *
+ * The YAML is read incrementally until end of file, so is not held in memory as a whole.
+ *
+ * @param  fd         File descriptor to read YAML from. Not closed.
+ * @param  cache      Optional string map used as a cache for string values, may be NULL
+ * @param  exception  If a parse or read error occurs, on exit this will hold a string describing the problem
+ * @return            A iot_data element if the input is YAML, NULL otherwise.
+ */
+extern iot_data_t * iot_data_from_yaml_fd (int fd, iot_data_t * cache, iot_data_t ** exception);
 #endif
 
 /**
@@ -2269,6 +3336,60 @@ extern bool iot_data_equal (const iot_data_t * data1, const iot_data_t * data2);
  */
 extern bool iot_data_equal_value (const iot_data_t * data1, const iot_data_t * data2);
 
+/**
+ * @brief Find the structural differences between two data instances
+ *
+ * Maps are compared by key and Vectors by index, recursively. Subtrees with differing cached hashes
+ * are descended into, while identical subtrees are skipped. A path is a Vector of the map keys and
+ * vector indices (as UInt32) leading from the top level to a difference, so is empty if the top
+ * level data differs.
+ *
+ * @param  from  Original data
+ * @param  to    Updated data
+ * @return       Map with keys "added", "removed" and "changed", each a List of path Vectors. Keys or
+ *               indices only in "to" are added, only in "from" are removed, and any other differing
+ *               values, including values of differing types, are changed
+ */
+extern iot_data_t * iot_data_diff (const iot_data_t * from, const iot_data_t * to);
+
+/**
+ * @brief Check whether a diff, as returned by iot_data_diff, holds no differences
+ *
+ * @param  diff  Diff map
+ * @return       'true' if no paths were added, removed or changed
+ */
+extern bool iot_data_diff_empty (const iot_data_t * diff);
+
+/**
+ * @brief Create a JSON Patch (RFC 6902) delta between two data instances
+ *
+ * Maps with string keys are compared by key and Vectors by index, recursively, with subtrees having equal cached
+ * hashes and values skipped, as for iot_data_diff. Each difference is a Map with string keys "op" ("add", "remove"
+ * or "replace"), "path" (a JSON Pointer) and, unless removed, "value". Values are shared with "to", not copied.
+ * Elements added to or removed from the end of a Vector are appended (path token "-") or removed last first.
+ * Any other differing values, including the top level, are replaced. The delta can be encoded for transmission
+ * with iot_data_to_json or iot_data_to_cbor, and is typically far smaller than "to" when little has changed.
+ *
+ * @param  from  Original data
+ * @param  to    Updated data
+ * @return       List of patch operations, empty if the data is equal (client needs to free)
+ */
+extern iot_data_t * iot_data_delta (const iot_data_t * from, const iot_data_t * to);
+
+/**
+ * @brief Apply a JSON Patch delta, as created by iot_data_delta or decoded from JSON, to data
+ *
+ * The "add", "remove" and "replace" operations are supported, on Maps with string keys and Vectors. The data
+ * is modified in place, so it and the containers on each path must be neither frozen nor shared. Cached hashes of
+ * containers on each path are invalidated. Operations are applied in order, stopping at the first that fails.
+ * Replacing the top level (empty path) is not supported.
+ *
+ * @param  data   Data to update
+ * @param  delta  List or Vector of patch operations
+ * @return        'true' if all operations were applied, 'false' otherwise
+ */
+extern bool iot_data_apply_delta (iot_data_t * data, const iot_data_t * delta);
+
 /**
  * @brief Compare two data instances, returning whether the first is less than, equal to or greater than the second.
  *        Both types must be the same for values to compare equal.
@@ -2289,6 +3410,33 @@ extern int iot_data_compare (const iot_data_t * data1, const iot_data_t * data2)
  */
 extern int iot_data_compare_value (const iot_data_t * data1, const iot_data_t * data2);
 
+/**
+ * @brief Check for equality of two iot_data types, comparing large Maps or Vectors in parallel
+ *
+ * As iot_data_equal, but the top level elements of large Maps and Vectors are split into ranges
+ * compared by thread pool jobs. Differing hashes are detected before any elements are compared.
+ * The data must not be modified during the comparison and the function must not be called from
+ * a job running on the same thread pool.
+ *
+ * @param  data1 Input data1 (can be NULL)
+ * @param  data2 Input data2 (can be NULL)
+ * @param  pool  Thread pool to run comparison jobs, if NULL data is compared on the calling thread
+ * @return       'true' if data1 & data2 are equal, 'false' otherwise
+ */
+extern bool iot_data_equal_parallel (const iot_data_t * data1, const iot_data_t * data2, iot_threadpool_t * pool);
+
+/**
+ * @brief Compare two data instances, comparing large Maps or Vectors in parallel
+ *
+ * As iot_data_compare, with the same restrictions as iot_data_equal_parallel.
+ *
+ * @param  data1 Input data1 (can be NULL)
+ * @param  data2 Input data2 (can be NULL)
+ * @param  pool  Thread pool to run comparison jobs, if NULL data is compared on the calling thread
+ * @return       Returns zero if data1 equals data2, a value less than zero if data1 less than data2, a value greater than zero if data1 greater than data2
+ */
+extern int iot_data_compare_parallel (const iot_data_t * data1, const iot_data_t * data2, iot_threadpool_t * pool);
+
 /**
  * @brief Copy data
  *
@@ -2301,6 +3449,36 @@ extern int iot_data_compare_value (const iot_data_t * data1, const iot_data_t *
  */
 extern iot_data_t * iot_data_copy (const iot_data_t * src);
 
+/**
+ * @brief Copy data, copying the elements of large Maps or Vectors in parallel
+ *
+ * As iot_data_copy, but the top level elements of large Maps and Vectors are split into ranges
+ * copied by thread pool jobs. Data is copied on the calling thread if allocating from an arena.
+ * The data must not be modified during the copy and the function must not be called from a job
+ * running on the same thread pool.
+ *
+ * @param src   Pointer to the data to be copied
+ * @param pool  Thread pool to run copy jobs, if NULL data is copied on the calling thread
+ * @return      Pointer to the copied data
+ */
+extern iot_data_t * iot_data_copy_parallel (const iot_data_t * src, iot_threadpool_t * pool);
+
+/**
+ * @brief Map the elements of a Vector, Array or Map, calling a function for elements in parallel
+ *
+ * The function is called for each Vector element, Array element (as a value of the Array element type) or
+ * Map value, using iot_threadpool_parallel_for, so the calling thread also calls the function. The function
+ * is called on the calling thread if allocating from an arena. The data must not be modified while mapped.
+ *
+ * @param data  Vector, Array or Map to map
+ * @param fn    Function returning the mapped element, or NULL to leave a Vector element unset or omit a Map key
+ * @param arg   Function argument
+ * @param pool  Thread pool to run map jobs, if NULL all elements are mapped on the calling thread
+ * @return      Vector of mapped elements (for a Vector or Array), or Map of keys to mapped values (for a Map),
+ *              NULL if data is not a Vector, Array or Map (client needs to free)
+ */
+extern iot_data_t * iot_data_parallel_map (const iot_data_t * data, iot_data_update_fn fn, void * arg, iot_threadpool_t * pool);
+
 /**
  * @brief Shallow copy data
  *
@@ -2391,6 +3569,162 @@ iot_data_t * iot_data_transform (const iot_data_t * data, iot_data_type_t type);
  */
 extern iot_data_t * iot_data_array_transform (const iot_data_t * array, iot_data_type_t type);
 
+/**
+ * @brief Calculate the sum of the elements of a numeric (Int8 to Float64) array
+ *
+ * @param array  The array
+ * @param sum    Pointer to the returned sum
+ * @return       Whether the sum was calculated, false if the array is empty or not numeric
+ */
+extern bool iot_data_array_sum (const iot_data_t * array, double * sum);
+
+/**
+ * @brief Calculate the mean of the elements of a numeric (Int8 to Float64) array
+ *
+ * @param array  The array
+ * @param mean   Pointer to the returned mean
+ * @return       Whether the mean was calculated, false if the array is empty or not numeric
+ */
+extern bool iot_data_array_mean (const iot_data_t * array, double * mean);
+
+/**
+ * @brief Find the minimum and maximum element values of a numeric (Int8 to Float64) array in a single pass
+ *
+ * @param array  The array
+ * @param min    Pointer to the returned minimum value
+ * @param max    Pointer to the returned maximum value
+ * @return       Whether the range was found, false if the array is empty or not numeric
+ */
+extern bool iot_data_array_range (const iot_data_t * array, double * min, double * max);
+
+/**
+ * @brief Find the minimum element value of a numeric (Int8 to Float64) array
+ *
+ * @param array  The array
+ * @param min    Pointer to the returned minimum value
+ * @return       Whether the minimum was found, false if the array is empty or not numeric
+ */
+extern bool iot_data_array_min (const iot_data_t * array, double * min);
+
+/**
+ * @brief Find the maximum element value of a numeric (Int8 to Float64) array
+ *
+ * @param array  The array
+ * @param max    Pointer to the returned maximum value
+ * @return       Whether the maximum was found, false if the array is empty or not numeric
+ */
+extern bool iot_data_array_max (const iot_data_t * array, double * max);
+
+/**
+ * @brief Scale and offset the elements of a numeric (Int8 to Float64) array into a new array of the given type.
+ *        Elements are calculated in double precision as (value * scale + offset), then truncated and saturated
+ *        to the range of the target type, NaN values being converted to zero for integer types.
+ *
+ * @param array   The array to scale
+ * @param scale   The scale factor
+ * @param offset  The offset added after scaling
+ * @param type    The numeric element type for the new array
+ * @return        The newly created array, with the same length as the input array
+ */
+extern iot_data_t * iot_data_array_scale (const iot_data_t * array, double scale, double offset, iot_data_type_t type);
+
+/**
+ * @brief Convert a numeric (Int8 to Float64) array to a new array of the given type, saturating values that are
+ *        out of range for the target type. Equivalent to iot_data_array_scale with a scale of 1 and offset of 0.
+ *
+ * @param array  The array to convert
+ * @param type   The numeric element type for the new array
+ * @return       The newly created array, with the same length as the input array
+ */
+extern iot_data_t * iot_data_array_convert (const iot_data_t * array, iot_data_type_t type);
+
+/**
+ * @brief Sort the elements of a numeric (Int8 to Float64) array in place into ascending order, using a radix sort.
+ *        Float NaN values are ordered before (negative NaN) or after (positive NaN) all other values.
+ *
+ * @param array  The array to sort
+ * @return       Whether the array was sorted, false if the array is not numeric
+ */
+extern bool iot_data_array_sort (iot_data_t * array);
+
+/**
+ * @brief Binary search a sorted numeric (Int8 to Float64) array for a value, see iot_data_array_sort
+ *
+ * @param array  The sorted array
+ * @param value  The value to search for, cast to the array element type
+ * @param index  Returned index of the first element not less than value (array length if none), can be NULL
+ * @return       Whether an element equal to value was found, false if the array is not numeric or value cannot be cast
+ */
+extern bool iot_data_array_search (const iot_data_t * array, const iot_data_t * value, uint32_t * index);
+
+/**
+ * @brief Allocate a columnar batch of rows with a fixed schema
+ *
+ * A batch is a map of column name to typed array, each array holding one element per row, so is written to
+ * JSON or CBOR as a map of arrays, e.g. {"ts":[1,2],"value":[0.5,0.7]}. Columns are written in schema order.
+ * Column storage grows geometrically as rows are added. The batch can be used as any other map, but columns
+ * should only be updated using the batch functions.
+ *
+ * @param names    Array of column names
+ * @param types    Array of column element types, each a numeric or boolean type
+ * @param columns  Number of columns, must be greater than zero
+ * @return         Pointer to the allocated empty batch
+ */
+extern iot_data_t * iot_data_alloc_batch (const char * const * names, const iot_data_type_t * types, uint32_t columns);
+
+/**
+ * @brief Get the number of columns in a batch
+ *
+ * @param batch  The batch
+ * @return       The number of columns
+ */
+extern uint32_t iot_data_batch_columns (const iot_data_t * batch);
+
+/**
+ * @brief Get the number of rows in a batch
+ *
+ * @param batch  The batch
+ * @return       The number of rows
+ */
+extern uint32_t iot_data_batch_rows (const iot_data_t * batch);
+
+/**
+ * @brief Get a batch column
+ *
+ * @param batch   The batch
+ * @param column  Column index, in schema order
+ * @return        The column array, with one element per row. Only valid until a row is next added.
+ */
+extern const iot_data_t * iot_data_batch_column (const iot_data_t * batch, uint32_t column);
+
+/**
+ * @brief Add a row to a batch, with all column values set to zero
+ *
+ * @param batch  The batch
+ * @return       Index of the added row
+ */
+extern uint32_t iot_data_batch_add_row (iot_data_t * batch);
+
+/**
+ * @brief Set a value in a batch row
+ *
+ * @param batch   The batch
+ * @param column  Column index, in schema order
+ * @param row     Row index
+ * @param value   The value, cast to the column type (see iot_data_cast)
+ * @return        Whether the value could be cast to the column type
+ */
+extern bool iot_data_batch_set (iot_data_t * batch, uint32_t column, uint32_t row, const iot_data_t * value);
+
+/**
+ * @brief Append a row to a batch
+ *
+ * @param batch   The batch
+ * @param values  Array of values, one per column in schema order. NULL values are set to zero.
+ * @return        Whether all values could be cast to their column types
+ */
+extern bool iot_data_batch_append (iot_data_t * batch, const iot_data_t * const * values);
+
 /**
  * @brief Returns the size of the contained data type in bytes.
  *
@@ -2410,6 +3744,71 @@ extern uint32_t iot_data_type_size (iot_data_type_t type);
  */
 extern const iot_data_t * iot_data_get_at (const iot_data_t * data, const iot_data_t * path);
 
+/** Opaque compiled path structure */
+typedef struct iot_data_path_t iot_data_path_t;
+
+/** Opaque compiled path set structure */
+typedef struct iot_data_paths_t iot_data_paths_t;
+
+/**
+ * @brief  Compile a path, for repeated use with iot_data_path_get
+ *
+ * @param  path A list of keys and indexes, as for iot_data_get_at
+ * @return The compiled path
+ */
+extern iot_data_path_t * iot_data_path_alloc (const iot_data_t * path);
+
+/**
+ * @brief  Returns a data value by following a compiled path. As iot_data_get_at, but the path is not copied
+ *         and each level is resolved by a single lookup.
+ *
+ * @param  data The starting data structure
+ * @param  path The compiled path
+ * @return The data found by following the path or NULL if the path does not match the supplied data
+ */
+extern const iot_data_t * iot_data_path_get (const iot_data_t * data, const iot_data_path_t * path);
+
+/**
+ * @brief  Free a compiled path
+ *
+ * @param  path The compiled path, may be NULL
+ */
+extern void iot_data_path_free (iot_data_path_t * path);
+
+/**
+ * @brief  Compile a set of paths, to be resolved together by iot_data_paths_get
+ *
+ * @param  paths A vector of paths, each a list of keys and indexes as for iot_data_get_at
+ * @return The compiled path set
+ */
+extern iot_data_paths_t * iot_data_paths_alloc (const iot_data_t * paths);
+
+/**
+ * @brief  Get the number of paths in a compiled path set
+ *
+ * @param  paths The compiled path set
+ * @return The number of paths
+ */
+extern uint32_t iot_data_paths_size (const iot_data_paths_t * paths);
+
+/**
+ * @brief  Resolve all paths in a compiled path set in a single traversal. Levels shared by more
+ *         than one path are resolved once.
+ *
+ * @param  data    The starting data structure
+ * @param  paths   The compiled path set
+ * @param  results Array of iot_data_paths_size entries, set to the data found for each path (in the order
+ *                 of the vector the set was compiled from) or NULL if the path does not match
+ */
+extern void iot_data_paths_get (const iot_data_t * data, const iot_data_paths_t * paths, const iot_data_t ** results);
+
+/**
+ * @brief  Free a compiled path set
+ *
+ * @param  paths The compiled path set, may be NULL
+ */
+extern void iot_data_paths_free (iot_data_paths_t * paths);
+
 
 /**
  * @brief  Adds a data value at a point specified by traversing nested maps and vectors following the keys and indexes
@@ -2452,6 +3851,44 @@ extern iot_data_t * iot_data_remove_at (const iot_data_t * data, const iot_data_
  */
 extern iot_data_t * iot_data_update_at (const iot_data_t * data, const iot_data_t * path, iot_data_update_fn fn, void * arg);
 
+/**
+ * @brief  Returns an unshared instance of data, suitable for modification. If the data is only referenced by
+ *         the caller it is returned, otherwise a shallow copy is returned and the caller's reference released.
+ * @param  data The data, the caller's reference is taken
+ * @return The unshared data, the caller owns the returned reference
+ */
+extern iot_data_t * iot_data_make_mutable (iot_data_t * data);
+
+/**
+ * @brief  Copy on write variant of iot_data_add_at. Maps and vectors along the path that are only referenced by
+ *         their parent (or, for data, by the caller) are modified in place, others are replaced by shallow copies.
+ *         Other references to data or nested maps and vectors (snapshots) are unaffected, and the cost depends
+ *         on the path depth rather than the data size unless shared.
+ * @param  data The starting data structure, the caller's reference is taken
+ * @param  path A list of keys and indexes. If the list is empty val is returned
+ * @param  val  The value to add
+ * @return The modified data, the caller owns the returned reference
+ */
+extern iot_data_t * iot_data_add_at_cow (iot_data_t * data, const iot_data_t * path, iot_data_t * val);
+
+/**
+ * @brief  Copy on write variant of iot_data_update_at, see iot_data_add_at_cow
+ * @param  data The starting data structure, the caller's reference is taken
+ * @param  path A list of keys and indexes. If the list is empty the result of the update function is returned
+ * @param  fn   Pointer to an update function, passed the existing value and the arg parameter, returning the new value
+ * @param  arg  User specified pointer supplied to the update function
+ * @return The modified data, the caller owns the returned reference
+ */
+extern iot_data_t * iot_data_update_at_cow (iot_data_t * data, const iot_data_t * path, iot_data_update_fn fn, void * arg);
+
+/**
+ * @brief  Copy on write variant of iot_data_remove_at, see iot_data_add_at_cow
+ * @param  data The starting data structure, the caller's reference is taken
+ * @param  path A list of keys and indexes. If the list is empty data is returned
+ * @return The modified data, the caller owns the returned reference
+ */
+extern iot_data_t * iot_data_remove_at_cow (iot_data_t * data, const iot_data_t * path);
+
 /**
  * @brief Returns the value of a boolean user tag
  *
@@ -2477,6 +3914,17 @@ extern bool iot_data_set_tag (iot_data_t * data, iot_data_tag_t tag, bool value)
  */
 extern uint32_t iot_data_block_size (void);
 
+/**
+ * @brief Returns the approximate memory used by data, including contained data, in bytes
+ *
+ * The memory used by data shared by several references is apportioned between the references,
+ * so reduces when duplicate data is shared, for example by iot_data_compress.
+ *
+ * @param data   The data instance (can be NULL)
+ * @return       The approximate size of the data in bytes
+ */
+extern size_t iot_data_memory_size (const iot_data_t * data);
+
 /**
  * @brief Returns a memory block
  * @param size   Required block size
@@ -2490,6 +3938,106 @@ extern void * iot_data_block_alloc (size_t size);
  */
 extern void iot_data_block_free (void * ptr);
 
+/**
+ * @brief Returns data block cache statistics
+ *
+ * Blocks are allocated from a per thread magazine, which is refilled from and drained to a
+ * global cache in batches. The statistics can be used to determine the magazine hit rate.
+ *
+ * @param stats  Pointer to statistics structure to populate
+ * @return       Whether the block cache is enabled (not the case in debug builds)
+ */
+extern bool iot_data_cache_stats (iot_data_cache_stats_t * stats);
+
+/**
+ * @brief Release unused memory held by the data block cache
+ *
+ * Blocks held by the calling thread are returned to the global cache, then memory chunks all of whose blocks
+ * are in the global cache are released. Blocks held by other threads are not released.
+ *
+ * @return  The number of memory chunks released (zero if the block cache is not enabled)
+ */
+extern uint32_t iot_data_cache_trim (void);
+
+/**
+ * @brief Set the maximum amount of free memory held by the data block cache
+ *
+ * When the free blocks held in the global cache exceed the limit, the cache is trimmed as for iot_data_cache_trim
+ * (without returning the calling thread blocks). If the cache remains over the limit, as free blocks are spread
+ * between chunks, it is not trimmed again until the number of free blocks has doubled.
+ *
+ * @param chunks  Maximum number of memory chunks worth of free blocks, zero for no limit (the default)
+ */
+extern void iot_data_cache_set_limit (uint32_t chunks);
+
+/**
+ * @brief Set the size of slabs from which the data block cache carves memory chunks
+ *
+ * By default each memory chunk is allocated individually. When a slab size is set, chunks are carved from
+ * slabs of that size, aligned to 2MB (and advised as huge pages where supported) if the size is a multiple
+ * of 2MB, reducing TLB pressure and heap fragmentation for data heavy processes. A slab is released by
+ * trimming only once all chunks carved from it are free. The size applies to subsequently allocated slabs.
+ *
+ * @param size  Slab size in bytes, rounded down to a multiple of the 4KB chunk size, zero to allocate chunks individually
+ */
+extern void iot_data_cache_set_slab_size (size_t size);
+
+#if defined (IOT_HAS_FILE) && !defined (_AZURESPHERE_)
+/** Opaque read only data image structure */
+typedef struct iot_data_image_t iot_data_image_t;
+
+/**
+ * @brief Save data as a read only image file
+ *
+ * The image holds the data as constant data, so that once opened it can be used without parsing or copying. Data
+ * shared in the source, and equal strings, are written once. Metadata (such as map ordering) is retained. Images
+ * are specific to the pointer size, byte order and version of the library that saved them.
+ *
+ * @param data  Data to save, which must not contain lists or pointers
+ * @param path  Path of the image file
+ * @return      Whether the image was saved
+ */
+extern bool iot_data_image_save (const iot_data_t * data, const char * path);
+
+/**
+ * @brief Open a read only data image file
+ *
+ * The image is memory mapped read only at a fixed address, in which case its pages are shared with other
+ * processes using the image. If the address is in use (e.g. by another image), the image is mapped privately
+ * and its pointers adjusted, which reads the whole image. Image files must be trusted, as they are not validated.
+ *
+ * @param path  Path of the image file
+ * @return      The image, or NULL if the file could not be read or was not a compatible image
+ */
+extern iot_data_image_t * iot_data_image_open (const char * path);
+
+/**
+ * @brief Get the data held by an image
+ *
+ * The data is constant, so can be used with all functions that do not modify data, and need not be freed. As
+ * constant data is not copied by iot_data_copy, data from the image must not be used once the image is closed.
+ *
+ * @param image  The image
+ * @return       The image data
+ */
+extern const iot_data_t * iot_data_image_root (const iot_data_image_t * image);
+
+/**
+ * @brief Check whether an image is mapped at its fixed address, so its pages are shared
+ *
+ * @param image  The image
+ * @return       Whether the image pages are shared
+ */
+extern bool iot_data_image_is_shared (const iot_data_image_t * image);
+
+/**
+ * @brief Close an image, unmapping its data
+ *
+ * @param image  The image to close
+ */
+extern void iot_data_image_close (iot_data_image_t * image);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
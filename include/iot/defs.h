@@ -0,0 +1,10 @@
+#ifndef _IOT_DEFS_H_
+#define _IOT_DEFS_H_
+
+#define IOT_VERSION "1.6.0"
+#define IOT_HAS_XML
+#define IOT_HAS_YAML
+#define IOT_HAS_CBOR
+#define IOT_HAS_TRACE
+#define IOT_HAS_CPU_DISPATCH
+#endif
@@ -59,6 +59,26 @@ extern bool iot_file_delete (const char * path);
  */
 extern uint8_t * iot_file_read_binary (const char * path, size_t * len);
 
+/**
+ * @brief Map a file read only into memory
+ *
+ * Function to map file contents into memory, avoiding copying of large files. Mapped contents
+ * are not NULL terminated.
+ *
+ * @param path  File path
+ * @param len   Length of mapped contents
+ * @return      Mapped contents of file, or NULL if file not found or empty (client needs to unmap)
+ */
+extern const uint8_t * iot_file_map (const char * path, size_t * len);
+
+/**
+ * @brief Unmap file contents mapped by iot_file_map
+ *
+ * @param addr  Mapped contents of file
+ * @param len   Length of mapped contents
+ */
+extern void iot_file_unmap (const uint8_t * addr, size_t len);
+
 /**
  * @brief Write binary data to a file
  *
@@ -79,6 +99,36 @@ extern bool iot_file_write_binary (const char * path, const uint8_t * binary, si
  */
 extern iot_data_t * iot_file_list (const char * directory, const char * regex_str);
 
+/** Opaque cached directory index structure */
+typedef struct iot_file_index_t iot_file_index_t;
+
+/**
+ * @brief Allocate a cached index of files in a directory
+ *
+ * The regex is compiled and the directory read once. Subsequent listings are updated from file system change
+ * notifications (inotify) where supported, otherwise the directory is read again only if it has been modified.
+ *
+ * @param directory Directory in which to list files
+ * @param regex_str Optional regex string which files must match
+ * @return          The index, or NULL if the regex is invalid
+ */
+extern iot_file_index_t * iot_file_index_alloc (const char * directory, const char * regex_str);
+
+/**
+ * @brief List files in an indexed directory
+ *
+ * @param index The directory index
+ * @return      List of files, as for iot_file_list, or NULL if the directory cannot be read (client needs to free)
+ */
+extern iot_data_t * iot_file_index_list (iot_file_index_t * index);
+
+/**
+ * @brief Free a directory index
+ *
+ * @param index The directory index, may be NULL
+ */
+extern void iot_file_index_free (iot_file_index_t * index);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,95 @@
+//
+// Copyright (c) 2024 IOTech Ltd
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+
+#ifndef _IOT_FLOW_H_
+#define _IOT_FLOW_H_
+
+/**
+ * @file
+ * @brief IOTech Flow Control API
+ */
+
+#include "iot/data.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Alias for flow control structure */
+typedef struct iot_flow_t iot_flow_t;
+
+/**
+ * Alias for flow control callback function pointer. The function is called with the callback argument and true when
+ * the level rises to the high watermark, then with false when the level falls back to the low watermark. It is called
+ * by the thread changing the level, possibly with locks held, so should not block or call the monitored queue or pool.
+ */
+typedef void (*iot_flow_fn_t) (void * arg, bool congested);
+
+/**
+ * @brief Allocate a flow control
+ *
+ * A flow control tracks the level of a queue or thread pool job queue, and is congested from when the level reaches
+ * the high watermark until it falls to the low watermark. Producers can check or be called back on congestion, so as
+ * to slow down rather than block or drop data. A flow control should monitor a single queue or thread pool.
+ *
+ * @code
+ *
+ *    iot_flow_t * flow = iot_flow_alloc (900u, 100u, my_congestion_fn, myApp);
+ *    iot_queue_set_flow (queue, flow);
+ *
+ * @endcode
+ *
+ * @param  high        High watermark, at which the flow becomes congested
+ * @param  low         Low watermark, at which the flow is no longer congested, must be less than high
+ * @param  fn          Function called on congestion changes, can be NULL
+ * @param  arg         Argument passed to the function
+ * @return iot_flow_t  Pointer to the flow control
+ */
+extern iot_flow_t * iot_flow_alloc (uint32_t high, uint32_t low, iot_flow_fn_t fn, void * arg);
+
+/**
+ * @brief Update the flow control level, called by the queue or thread pool monitored
+ *
+ * @param flow   Pointer to the flow control
+ * @param level  Current level
+ */
+extern void iot_flow_update (iot_flow_t * flow, uint32_t level);
+
+/**
+ * @brief Check whether the flow is congested
+ *
+ * @param flow  Pointer to the flow control
+ * @return      Whether the level has reached the high watermark, and not since fallen to the low watermark
+ */
+extern bool iot_flow_congested (const iot_flow_t * flow);
+
+/**
+ * @brief Get flow control statistics
+ *
+ * @param flow  Pointer to the flow control
+ * @return      Data map with "level" (last level), "congested" and "congestions" (number of times the high
+ *              watermark has been reached) entries
+ */
+extern iot_data_t * iot_flow_stats (const iot_flow_t * flow);
+
+/**
+ * @brief Increment the flow control reference count
+ *
+ * @param flow  Pointer to the flow control
+ */
+extern void iot_flow_add_ref (iot_flow_t * flow);
+
+/**
+ * @brief Decrement the flow control reference count, freeing it if no longer referenced
+ *
+ * @param flow  Pointer to the flow control
+ */
+extern void iot_flow_free (iot_flow_t * flow);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
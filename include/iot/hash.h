@@ -19,15 +19,15 @@ extern "C" {
 #endif
 
 /**
- * @brief Bernstein djb2 hash function (Version 2)
+ * @brief Word at a time (wyhash) string hash function
  *
  * @param str String to be hashed
- * @return    Hash value
+ * @return    Hash value, equal to iot_hash_data of the string characters
  */
 extern uint32_t iot_hash (const char * str);
 
 /**
- * @brief Bernstein djb2 hash function (Version 2)
+ * @brief Word at a time (wyhash) data hash function
  *
  * @param data Pointer to data to be hashed
  * @param len  Length of data to be hashed
@@ -35,6 +35,35 @@ extern uint32_t iot_hash (const char * str);
  */
 extern uint32_t iot_hash_data (const uint8_t * data, size_t len);
 
+/**
+ * @brief Seeded string hash function. Using a random, secret seed makes hash values unpredictable,
+ *        protecting hash tables with externally supplied keys against hash flooding.
+ *
+ * @param str  String to be hashed
+ * @param seed Hash seed
+ * @return     Hash value
+ */
+extern uint32_t iot_hash_seeded (const char * str, uint64_t seed);
+
+/**
+ * @brief Seeded data hash function
+ *
+ * @param data Pointer to data to be hashed
+ * @param len  Length of data to be hashed
+ * @param seed Hash seed
+ * @return     Hash value
+ */
+extern uint32_t iot_hash_data_seeded (const uint8_t * data, size_t len, uint64_t seed);
+
+/**
+ * @brief Bernstein djb2 hash function (Version 2), as previously used by iot_hash and iot_hash_data
+ *
+ * @param data Pointer to data to be hashed
+ * @param len  Length of data to be hashed
+ * @return     Hash value
+ */
+extern uint32_t iot_hash_djb2 (const uint8_t * data, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -24,8 +24,12 @@
 #include "iot/thread.h"
 #include "iot/json.h"
 #include "iot/scheduler.h"
+#include "iot/reactor.h"
+#include "iot/bus.h"
+#include "iot/flow.h"
 #include "iot/util.h"
 #include "iot/store.h"
 #include "iot/file.h"
+#include "iot/trace.h"
 
 #endif
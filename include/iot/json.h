@@ -84,6 +84,18 @@ void iot_json_init (iot_json_parser * parser);
   */
 int iot_json_parse (iot_json_parser * parser, const char * json, size_t len, iot_json_tok_t * tokens, uint32_t num_tokens);
 
+ /**
+  * @brief Count JSON tokens
+  *
+  * The JSON data string is scanned a block at a time to find quotes, escapes and structural characters,
+  * without building tokens. For valid JSON the count is the number of tokens required by iot_json_parse.
+  *
+  * @param json       Input JSON string
+  * @param len        Length of JSON string
+  * @return           Number of tokens
+  */
+uint32_t iot_json_count (const char * json, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -24,6 +24,15 @@ extern "C" {
 #define IOT_LOGLEVEL_DEFAULT IOT_LOG_WARN
 /** Maximum log message size */
 #define IOT_LOG_MSG_MAX 1024
+/**
+ * Least severe log level compiled in, from IOT_LOG_NONE to IOT_LOG_TRACE. Logging macro calls for less severe levels
+ * compile to nothing, with arguments not evaluated. Define to override, set for the library by IOT_LOG_MIN_LEVEL in CMake.
+ */
+#ifndef IOT_LOG_MIN_LEVEL
+#define IOT_LOG_MIN_LEVEL IOT_LOG_TRACE
+#endif
+/** Whether a log level is compiled in, a constant expression so calls for other levels are eliminated */
+#define IOT_LOG_ENABLED(lv) ((lv) <= IOT_LOG_MIN_LEVEL)
 
 /**
  * Log level enumeration
@@ -38,15 +47,49 @@ typedef enum iot_loglevel_t
   IOT_LOG_TRACE = 5u     /**< Trace, Debug, Information, Warning and Error logging */
 } iot_loglevel_t;
 
+/**
+ * File logger data sync policy
+ */
+typedef enum iot_logger_sync_t
+{
+  IOT_LOG_SYNC_NONE = 0,      /**< Data not explicitly synced, left to the operating system */
+  IOT_LOG_SYNC_ROTATE = 1u,   /**< Data synced before the file is rotated or closed */
+  IOT_LOG_SYNC_FLUSH = 2u     /**< Data synced after every write to the file */
+} iot_logger_sync_t;
+
+/**
+ * File logger options. Zero initialized options give an unbuffered file logger without rotation.
+ */
+typedef struct iot_logger_file_options_t
+{
+  uint64_t max_size;          /**< File size in bytes at which the file is rotated, 0 for no size based rotation */
+  uint32_t max_age;           /**< Time in seconds from opening at which the file is rotated, 0 for no time based rotation */
+  uint32_t max_files;         /**< Number of rotated files kept, named pathname.1 (most recent) to pathname.max_files */
+  uint32_t buffer_size;       /**< Write buffer size in bytes, 0 to write messages as logged */
+  uint32_t flush_interval;    /**< Maximum time in milliseconds messages are buffered, 0 for the default of one second */
+  iot_logger_sync_t sync;     /**< Data sync policy */
+} iot_logger_file_options_t;
+
 /**
  * Public logger struct. Do not use directly or stack allocate.
  */
 typedef struct iot_logger_t
 {
-  iot_component_t component;      /**< Component base */
-  volatile iot_loglevel_t level;  /**< Log level */
+  iot_component_t component;         /**< Component base */
+  volatile iot_loglevel_t level;     /**< Log level */
+  volatile iot_loglevel_t threshold; /**< Maximum log level of this and chained loggers, checked before formatting */
 } iot_logger_t;
 
+/**
+ * Rate limiting state, for one or more logging call sites. Statically allocate (zero initialized), do not access directly.
+ */
+typedef struct iot_log_ratelimit_t
+{
+  _Atomic (uint64_t) window;      /**< Current one second window */
+  _Atomic (uint64_t) count;       /**< Messages in current window, or in total if sampled */
+  _Atomic (uint64_t) suppressed;  /**< Messages suppressed since last reported */
+} iot_log_ratelimit_t;
+
 /**
  * Logger implementation function type
  */
@@ -83,6 +126,70 @@ extern iot_logger_t * iot_logger_alloc (const char * name, iot_loglevel_t level,
  * @return            Pointer to the logger component created
  */
 extern iot_logger_t * iot_logger_alloc_file (const char * name, iot_loglevel_t level, bool self_start, iot_logger_t * next, const char *pathname);
+
+/**
+ * @brief Allocate memory and initialize file logger component with rotation and buffering options
+ *
+ * As iot_logger_alloc_file, but the file is rotated when it would exceed a maximum size or reaches a maximum age,
+ * renaming it to pathname.1 and rotated files to the next number, deleting the oldest. Messages can be buffered and
+ * written in one call when the buffer is full or after the flush interval, by a background thread.
+ *
+ * @param name        Identifier to use for logging
+ * @param level       Log level
+ * @param self_start  'true' will start the logger after initialization
+ * @param next        Another logger component, this logger component must be pre-initialized. May be NULL
+ * @param pathname    File and location of the logfile
+ * @param options     Rotation, buffering and data sync options
+ * @return            Pointer to the logger component created
+ */
+extern iot_logger_t * iot_logger_alloc_file_options (const char * name, iot_loglevel_t level, bool self_start, iot_logger_t * next, const char *pathname, const iot_logger_file_options_t * options);
+
+/**
+ * @brief Allocate memory and initialize asynchronous file logger component
+ *
+ * As iot_logger_alloc_file, but logging threads only copy messages into a ring of pending messages. A background thread
+ * writes pending messages to the file in batches. If the ring is full messages are dropped, and the number dropped
+ * is written to the file.
+ *
+ * @param name        Identifier to use for logging
+ * @param level       Log level
+ * @param self_start  'true' will start the logger after initialization
+ * @param next        Another logger component, this logger component must be pre-initialized. May be NULL
+ * @param pathname    File and location of the logfile
+ * @param entries     Maximum number of pending messages, must be non zero
+ * @return            Pointer to the logger component created
+ */
+extern iot_logger_t * iot_logger_alloc_file_async (const char * name, iot_loglevel_t level, bool self_start, iot_logger_t * next, const char *pathname, uint32_t entries);
+
+/**
+ * @brief Allocate memory and initialize binary file logger component
+ *
+ * As iot_logger_alloc_file, but messages are written in a compact binary format, to be rendered as text by
+ * iot_logger_decode_binary. Each message holds the timestamp, level, thread id, a format string id and the format
+ * arguments, so logging threads do not format messages. Thread names and format strings are written once, when first
+ * used. The format string must remain valid while the logger is in use, as for string literals. Messages with
+ * conversions that cannot be captured, as for iot_logger_set_deferred, are formatted and written as text.
+ *
+ * @param name        Identifier to use for logging
+ * @param level       Log level
+ * @param self_start  'true' will start the logger after initialization
+ * @param next        Another logger component, this logger component must be pre-initialized. May be NULL
+ * @param pathname    File and location of the logfile
+ * @return            Pointer to the logger component created
+ */
+extern iot_logger_t * iot_logger_alloc_file_binary (const char * name, iot_loglevel_t level, bool self_start, iot_logger_t * next, const char *pathname);
+
+/**
+ * @brief Decode a binary log file to text
+ *
+ * Messages are written as by iot_logger_alloc_file. A log file written on a platform with different argument type
+ * sizes is converted, but not one with a different byte order.
+ *
+ * @param pathname  File and location of the binary logfile
+ * @param out       Stream to write decoded messages to
+ * @return          Whether the file was decoded, false if not a binary log file or truncated
+ */
+extern bool iot_logger_decode_binary (const char * pathname, FILE * out);
 #endif
 
 /**
@@ -100,6 +207,60 @@ extern iot_logger_t * iot_logger_alloc_file (const char * name, iot_loglevel_t l
  */
 extern iot_logger_t * iot_logger_alloc_udp (const char * name, iot_loglevel_t level, bool self_start, iot_logger_t * next, const char *host, uint16_t port);
 
+/**
+ * @brief Allocate memory and initialize asynchronous UDP logger component
+ *
+ * As iot_logger_alloc_udp, but logging threads only copy messages into a ring of pending messages. A background thread
+ * sends pending messages, coalescing consecutive messages into datagrams. If the ring is full messages are dropped,
+ * and the number dropped is sent.
+ *
+ * @param name        Identifier to use for logging
+ * @param level       Log level
+ * @param self_start  'true' will start the logger after initialization
+ * @param next        Another logger component, this logger component must be pre-initialized. May be NULL
+ * @param host        Address to send data - NULL means broadcast
+ * @param port        Port on which to send data
+ * @param entries     Maximum number of pending messages, must be non zero
+ * @return            Pointer to the logger component created
+ */
+extern iot_logger_t * iot_logger_alloc_udp_async (const char * name, iot_loglevel_t level, bool self_start, iot_logger_t * next, const char *host, uint16_t port, uint32_t entries);
+
+/**
+ * @brief Set whether an asynchronous logger defers message formatting to its writer thread
+ *
+ * When deferred, logging threads only copy the format string pointer, thread name and arguments into the ring of
+ * pending messages, and the writer thread formats them. The format string must remain valid until the message is
+ * written, as for string literals, and string arguments are copied. Messages with conversions that cannot be
+ * captured, such as %n or wide character conversions, or arguments that exceed IOT_LOG_MSG_MAX, are formatted by the
+ * logging thread. Can also be set with the "Deferred" logger component configuration value. Binary file loggers
+ * defer formatting by default.
+ *
+ * @param logger  The logger
+ * @param enable  Whether to defer message formatting
+ * @return        Whether the logger is asynchronous or binary, so can defer formatting
+ */
+extern bool iot_logger_set_deferred (iot_logger_t * logger, bool enable);
+
+/**
+ * @brief Get the number of messages dropped by an asynchronous logger
+ *
+ * @param logger  The logger
+ * @return        Total number of messages dropped as pending message ring was full, 0 for synchronous loggers
+ */
+extern uint64_t iot_logger_dropped (const iot_logger_t * logger);
+
+/**
+ * @brief Set the maximum number of messages a logger logs per second
+ *
+ * Messages over the limit in any one second are suppressed, and the number suppressed is logged at the start of
+ * the next second in which a message is logged. Can also be set with the "RateLimit" logger component configuration
+ * value.
+ *
+ * @param logger   The logger
+ * @param per_sec  Maximum messages per second, 0 for no limit
+ */
+extern void iot_logger_set_rate_limit (iot_logger_t * logger, uint32_t per_sec);
+
 /**
  * @brief Allocate memory and initialize logger component with the custom log function
  *
@@ -172,22 +333,75 @@ extern void iot_log__log (iot_logger_t * logger, iot_loglevel_t level, ...);
  */
 extern void iot_log__va_log (iot_logger_t * logger, iot_loglevel_t level, const char* fmt, va_list args);
 
+/**
+ * @brief Check whether to log a rate limited message
+ *
+ * Allows up to per_sec messages per second, for the call sites sharing the rate limit state. When a message is
+ * allowed after others were suppressed, a summary of the number suppressed is first logged.
+ *
+ * @param logger   Pointer to the logger component
+ * @param level    Log level for this entry
+ * @param limit    Rate limit state
+ * @param per_sec  Maximum messages per second, must be non zero
+ * @return         Whether to log the message
+ */
+extern bool iot_log__ratelimit (iot_logger_t * logger, iot_loglevel_t level, iot_log_ratelimit_t * limit, uint32_t per_sec);
+
+/**
+ * @brief Check whether to log a sampled message
+ *
+ * @param limit  Sampling state
+ * @param n      Log the first of every n messages, must be non zero
+ * @return       Whether to log the message
+ */
+extern bool iot_log__every (iot_log_ratelimit_t * limit, uint32_t n);
+
 /** Log trace macro */
-#define iot_log_trace(l,...) if ((l) && (l)->level >= IOT_LOG_TRACE) iot_log__log ((l), IOT_LOG_TRACE, __VA_ARGS__)
+#define iot_log_trace(l,...) if (IOT_LOG_ENABLED (IOT_LOG_TRACE) && (l) && (l)->threshold >= IOT_LOG_TRACE) iot_log__log ((l), IOT_LOG_TRACE, __VA_ARGS__)
 /** Log info macro */
-#define iot_log_info(l,...) if ((l) && (l)->level >= IOT_LOG_INFO) iot_log__log ((l), IOT_LOG_INFO, __VA_ARGS__)
+#define iot_log_info(l,...) if (IOT_LOG_ENABLED (IOT_LOG_INFO) && (l) && (l)->threshold >= IOT_LOG_INFO) iot_log__log ((l), IOT_LOG_INFO, __VA_ARGS__)
 /** Log debug macro */
-#define iot_log_debug(l,...) if ((l) && (l)->level >= IOT_LOG_DEBUG) iot_log__log ((l), IOT_LOG_DEBUG, __VA_ARGS__)
+#define iot_log_debug(l,...) if (IOT_LOG_ENABLED (IOT_LOG_DEBUG) && (l) && (l)->threshold >= IOT_LOG_DEBUG) iot_log__log ((l), IOT_LOG_DEBUG, __VA_ARGS__)
 /** Log warn macro */
-#define iot_log_warn(l,...) if ((l) && (l)->level >= IOT_LOG_WARN) iot_log__log ((l), IOT_LOG_WARN, __VA_ARGS__)
+#define iot_log_warn(l,...) if (IOT_LOG_ENABLED (IOT_LOG_WARN) && (l) && (l)->threshold >= IOT_LOG_WARN) iot_log__log ((l), IOT_LOG_WARN, __VA_ARGS__)
 /** Log error macro */
-#define iot_log_error(l,...) if ((l) && (l)->level >= IOT_LOG_ERROR) iot_log__log ((l), IOT_LOG_ERROR, __VA_ARGS__)
+#define iot_log_error(l,...) if (IOT_LOG_ENABLED (IOT_LOG_ERROR) && (l) && (l)->threshold >= IOT_LOG_ERROR) iot_log__log ((l), IOT_LOG_ERROR, __VA_ARGS__)
 /** Log macro */
-#define iot_log_log(l,lv,...) if ((l) && (l)->level >= (lv)) iot_log__log ((l), (lv), __VA_ARGS__)
+#define iot_log_log(l,lv,...) if (IOT_LOG_ENABLED (lv) && (l) && (l)->threshold >= (lv)) iot_log__log ((l), (lv), __VA_ARGS__)
+
+/** Log macro, rate limited to ps messages per second across all call sites sharing rate limit state k */
+#define iot_log_log_ratelimit(l,lv,k,ps,...) if (IOT_LOG_ENABLED (lv) && (l) && (l)->threshold >= (lv) && iot_log__ratelimit ((l), (lv), (k), (ps))) iot_log__log ((l), (lv), __VA_ARGS__)
+/** Log macro, rate limited to ps messages per second for this call site */
+#define iot_log_log_ratelimit_site(l,lv,ps,...) do { static iot_log_ratelimit_t iot_log_site_; iot_log_log_ratelimit ((l), (lv), &iot_log_site_, (ps), __VA_ARGS__); } while (0)
+/** Log macro, logging the first of every n messages for this call site */
+#define iot_log_log_every(l,lv,n,...) do { static iot_log_ratelimit_t iot_log_site_; if (IOT_LOG_ENABLED (lv) && (l) && (l)->threshold >= (lv) && iot_log__every (&iot_log_site_, (n))) iot_log__log ((l), (lv), __VA_ARGS__); } while (0)
+/** Log trace macro, rate limited to ps messages per second for this call site */
+#define iot_log_trace_ratelimit(l,ps,...) iot_log_log_ratelimit_site ((l), IOT_LOG_TRACE, (ps), __VA_ARGS__)
+/** Log debug macro, rate limited to ps messages per second for this call site */
+#define iot_log_debug_ratelimit(l,ps,...) iot_log_log_ratelimit_site ((l), IOT_LOG_DEBUG, (ps), __VA_ARGS__)
+/** Log info macro, rate limited to ps messages per second for this call site */
+#define iot_log_info_ratelimit(l,ps,...) iot_log_log_ratelimit_site ((l), IOT_LOG_INFO, (ps), __VA_ARGS__)
+/** Log warn macro, rate limited to ps messages per second for this call site */
+#define iot_log_warn_ratelimit(l,ps,...) iot_log_log_ratelimit_site ((l), IOT_LOG_WARN, (ps), __VA_ARGS__)
+/** Log error macro, rate limited to ps messages per second for this call site */
+#define iot_log_error_ratelimit(l,ps,...) iot_log_log_ratelimit_site ((l), IOT_LOG_ERROR, (ps), __VA_ARGS__)
+/** Log trace macro, logging the first of every n messages for this call site */
+#define iot_log_trace_every(l,n,...) iot_log_log_every ((l), IOT_LOG_TRACE, (n), __VA_ARGS__)
+/** Log debug macro, logging the first of every n messages for this call site */
+#define iot_log_debug_every(l,n,...) iot_log_log_every ((l), IOT_LOG_DEBUG, (n), __VA_ARGS__)
+/** Log info macro, logging the first of every n messages for this call site */
+#define iot_log_info_every(l,n,...) iot_log_log_every ((l), IOT_LOG_INFO, (n), __VA_ARGS__)
+/** Log warn macro, logging the first of every n messages for this call site */
+#define iot_log_warn_every(l,n,...) iot_log_log_every ((l), IOT_LOG_WARN, (n), __VA_ARGS__)
+/** Log error macro, logging the first of every n messages for this call site */
+#define iot_log_error_every(l,n,...) iot_log_log_every ((l), IOT_LOG_ERROR, (n), __VA_ARGS__)
 
 /**
  * @brief  Set log level for the logger
  *
+ * Also updates the cached threshold of loggers chained to this logger, so messages dropped by all loggers in a
+ * chain are not formatted.
+ *
  * @param logger  Pointer to the logger
  * @param level   Log level
  */
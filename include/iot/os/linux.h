@@ -19,6 +19,7 @@
 #define IOT_HAS_PTHREAD_MUTEXATTR_SETPROTOCOL
 #define IOT_HAS_PRCTL
 #define IOT_HAS_FILE
+#define IOT_HAS_PTHREAD_CONDATTR_SETCLOCK
 
 #ifdef _REDHAT_SEAWOLF_
 #undef IOT_HAS_CPU_AFFINITY
@@ -41,4 +42,8 @@
 #undef IOT_HAS_CPU_AFFINITY
 #endif
 
+#if defined (__GLIBC__) && defined (_GNU_SOURCE)
+#define IOT_HAS_PTHREAD_MUTEX_ADAPTIVE
+#endif
+
 #endif
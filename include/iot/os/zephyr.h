@@ -56,4 +56,14 @@ extern char * iot_ctok_r (char *str, const char delim, char **saveptr);
 /** Maximum number of threads */
 #define IOT_ZEPHYR_MAX_THREADS 4
 
+#ifndef IOT_ZEPHYR_DATA_BLOCKS
+/** Number of blocks in static data block pool, zero to allocate data blocks from the heap */
+#define IOT_ZEPHYR_DATA_BLOCKS 0
+#endif
+
+#ifndef IOT_ZEPHYR_JOBS
+/** Number of jobs in static threadpool job pool, zero to allocate jobs from the heap */
+#define IOT_ZEPHYR_JOBS 0
+#endif
+
 #endif
@@ -13,6 +13,7 @@
  */
 
 #include "iot/data.h"
+#include "iot/flow.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,6 +30,18 @@ typedef struct iot_queue_t iot_queue_t;
  */
 extern iot_queue_t *iot_queue_alloc (uint32_t maxsize);
 
+/**
+ * @brief Allocate and initialise a bounded lock-free queue
+ *
+ * The queue is backed by a pre-allocated ring supporting multiple producers and consumers.
+ * Enqueue and dequeue operations only take a lock when a thread has to block, or a blocked
+ * thread has to be woken. Blocking and non-blocking semantics are as for iot_queue_alloc.
+ *
+ * @param  size         Maximum number of elements to be held in the queue, must be non zero
+ * @return iot_queue_t  Pointer to the created queue
+ */
+extern iot_queue_t *iot_queue_alloc_ring (uint32_t size);
+
 /**
  * @brief Unblock all threads waiting to enqueue or dequeue elements
  *
@@ -73,6 +86,17 @@ bool iot_queue_try_enqueue (iot_queue_t *q, iot_data_t *element);
  */
 iot_data_t *iot_queue_dequeue (iot_queue_t *q);
 
+/**
+ * @brief Take an element from the queue. If the queue is empty, wait until an element is enqueued or the timeout expires
+ *
+ * Timeouts are measured against the monotonic clock where supported.
+ *
+ * @param  q          Pointer to a queue
+ * @param  timeout_ns Maximum time to wait, in nanoseconds. 0 to not wait, UINT64_MAX to wait as for iot_queue_dequeue
+ * @return iot_data_t Pointer to the dequeued element, or NULL if the timeout expired or iot_queue_stop was called
+ */
+extern iot_data_t *iot_queue_dequeue_timed (iot_queue_t *q, uint64_t timeout_ns);
+
 /**
  * @brief Take an element from the queue, if there is one
  * @param  q          Pointer to a queue
@@ -80,6 +104,31 @@ iot_data_t *iot_queue_dequeue (iot_queue_t *q);
  */
 iot_data_t *iot_queue_try_dequeue (iot_queue_t *q);
 
+/**
+ * @brief Take up to max elements from the queue, in order, under a single lock acquisition
+ *
+ * If the queue is empty, waits until an element is enqueued, the timeout expires or iot_queue_stop is called.
+ * All threads blocked waiting to enqueue are woken once elements are taken.
+ *
+ * @param  q          Pointer to a queue
+ * @param  max        Maximum number of elements to take, must be non zero
+ * @param  timeout_ns Maximum time to wait for an element, in nanoseconds. 0 to not wait
+ * @param  list       Data list to which elements taken are added, at the tail
+ * @return uint32_t   The number of elements taken
+ */
+extern uint32_t iot_queue_dequeue_batch (iot_queue_t *q, uint32_t max, uint64_t timeout_ns, iot_data_t *list);
+
+/**
+ * @brief Add a priority element to the queue, to be dequeued before all ordinary elements
+ *
+ * Priority elements are dequeued in the order added, never block and are not limited by the queue size limit,
+ * but count towards it. A ring queue has no priority lane, so the element is added as for iot_queue_try_enqueue.
+ * @param q       Pointer to a queue
+ * @param element The element to add to the queue
+ * @return bool   Whether the operation was successful, always true for a list queue
+ */
+extern bool iot_queue_enqueue_priority (iot_queue_t *q, iot_data_t *element);
+
 /**
  * @brief Find the queue size
  * @param  q         Pointer to a queue
@@ -97,12 +146,31 @@ uint32_t iot_queue_maxsize (const iot_queue_t *q);
 /**
  * @brief Set the queue size limit.
  * If there are more elements currently in the queue, subsequent enqueue operations will be blocked
- * until the queue size has been reduced to less than the new maximum
+ * until the queue size has been reduced to less than the new maximum. Has no effect for a ring queue.
  * @param q        Pointer to a queue
  * @param maxsize  The maximum number of elements to be allowed before blocking new additions, or 0 for unlimited
  */
 void iot_queue_setmaxsize (iot_queue_t *q, uint32_t maxsize);
 
+/**
+ * @brief Attach flow control to the queue, updated with the queue size as elements are added and removed
+ *
+ * For a ring queue, the flow control should be set before the queue is used by other threads.
+ *
+ * @param q     Pointer to a queue
+ * @param flow  Flow control, the queue takes a reference. NULL to remove flow control
+ */
+extern void iot_queue_set_flow (iot_queue_t *q, iot_flow_t *flow);
+
+/**
+ * @brief Get queue runtime statistics
+ * @param q      Pointer to a queue
+ * @return       Data map with "size", "max_size", "enqueued", "dequeued", "enqueue_blocked", "dequeue_blocked" counts
+ *               and "enqueue_wait_ns" and "dequeue_wait_ns" total blocked times. List queues also report the
+ *               "high_water" size. For a ring queue, "max_size" is the ring size.
+ */
+extern iot_data_t *iot_queue_stats (const iot_queue_t *q);
+
 #ifdef __cplusplus
 }
 #endif
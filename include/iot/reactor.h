@@ -0,0 +1,161 @@
+//
+// Copyright (c) 2024 IOTech Ltd
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+
+#ifndef _IOT_REACTOR_H_
+#define _IOT_REACTOR_H_
+
+/**
+ * @file
+ * @brief IOTech I/O Reactor API
+ */
+
+#include "iot/threadpool.h"
+#include "iot/component.h"
+#include "iot/logger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Alias for reactor structure */
+typedef struct iot_reactor_t iot_reactor_t;
+
+/**
+ * Alias for reactor callback function pointer. The function is called with the descriptor (or timer identifier),
+ * the events ready (a mask of IOT_REACTOR_READ, IOT_REACTOR_WRITE and IOT_REACTOR_ERROR) and the callback argument.
+ */
+typedef void (*iot_reactor_fn_t) (int fd, uint32_t events, void * arg);
+
+/** Reactor component name */
+#define IOT_REACTOR_TYPE "IOT::Reactor"
+
+/** Descriptor is readable (or timer has expired) */
+#define IOT_REACTOR_READ 1u
+/** Descriptor is writable */
+#define IOT_REACTOR_WRITE 2u
+/** Descriptor has an error or hang up condition, always reported */
+#define IOT_REACTOR_ERROR 4u
+
+/**
+ * @brief Allocate and initialise a reactor
+ *
+ * A reactor waits for readiness on a set of descriptors and timers from a single thread, and dispatches the
+ * associated callbacks to a thread pool. A descriptor is not watched while its callback is running, so each
+ * callback runs on one thread at a time. Uses epoll and timerfd on Linux, otherwise poll.
+ *
+ * @code
+ *
+ *    iot_reactor_t * reactor = iot_reactor_alloc (pool, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+ *
+ * @endcode
+ *
+ * @param  pool           Thread pool used to run callbacks, if NULL callbacks are run on the reactor thread
+ * @param  priority       The thread priority for running the reactor, (not set if -1)
+ * @param  affinity       The processor affinity for the reactor (not set if less than zero)
+ * @param  logger         Logger, can be NULL
+ * @return iot_reactor_t  Pointer to the created reactor, NULL on error
+ */
+extern iot_reactor_t * iot_reactor_alloc (iot_threadpool_t * pool, int priority, int affinity, iot_logger_t * logger);
+
+/**
+ * @brief Start the reactor
+ *
+ * @param reactor  Pointer to the reactor
+ */
+extern void iot_reactor_start (iot_reactor_t * reactor);
+
+/**
+ * @brief Stop the reactor. Readiness is not dispatched while stopped, pending events are dispatched when restarted.
+ *
+ * @param reactor  Pointer to the reactor
+ */
+extern void iot_reactor_stop (iot_reactor_t * reactor);
+
+/**
+ * @brief Watch a descriptor
+ *
+ * @param reactor  Pointer to the reactor
+ * @param fd       Descriptor to watch, should be non blocking
+ * @param events   Events to watch for, a mask of IOT_REACTOR_READ and IOT_REACTOR_WRITE
+ * @param fn       Function called when the descriptor is ready
+ * @param arg      Argument passed to the function
+ * @return         Whether the descriptor was added, false if already watched or invalid
+ */
+extern bool iot_reactor_add (iot_reactor_t * reactor, int fd, uint32_t events, iot_reactor_fn_t fn, void * arg);
+
+/**
+ * @brief Change the events watched for a descriptor
+ *
+ * @param reactor  Pointer to the reactor
+ * @param fd       Watched descriptor
+ * @param events   Events to watch for, a mask of IOT_REACTOR_READ and IOT_REACTOR_WRITE
+ * @return         Whether the descriptor is watched
+ */
+extern bool iot_reactor_modify (iot_reactor_t * reactor, int fd, uint32_t events);
+
+/**
+ * @brief Add a timer
+ *
+ * Timers share the reactor wait with descriptors. On Linux a timer is a timerfd, so timer expiry is reported by the
+ * same epoll wait as descriptor readiness. The callback is called with IOT_REACTOR_READ and the timer identifier.
+ *
+ * @param reactor  Pointer to the reactor
+ * @param delay    Time until the timer first expires, in nanoseconds
+ * @param period   Timer period in nanoseconds, zero for a one shot timer, removed once run
+ * @param fn       Function called when the timer expires
+ * @param arg      Argument passed to the function
+ * @return         Timer identifier, used to remove the timer, or -1 on error
+ */
+extern int iot_reactor_add_timer (iot_reactor_t * reactor, uint64_t delay, uint64_t period, iot_reactor_fn_t fn, void * arg);
+
+/**
+ * @brief Stop watching a descriptor or remove a timer
+ *
+ * A callback already dispatched may still be running when the function returns. The descriptor is not closed.
+ *
+ * @param reactor  Pointer to the reactor
+ * @param fd       Watched descriptor or timer identifier
+ * @return         Whether the descriptor or timer was removed
+ */
+extern bool iot_reactor_remove (iot_reactor_t * reactor, int fd);
+
+/**
+ * @brief Get reactor statistics
+ *
+ * @param reactor  Pointer to the reactor
+ * @return         Data map with "sources" (descriptors and timers), "waits" (number of waits returning events)
+ *                 and "dispatched" (number of callbacks run) entries
+ */
+extern iot_data_t * iot_reactor_stats (iot_reactor_t * reactor);
+
+/**
+ * @brief Increment the reactor reference count
+ *
+ * @param reactor  Pointer to the reactor
+ */
+extern void iot_reactor_add_ref (iot_reactor_t * reactor);
+
+/**
+ * @brief Decrement the reactor reference count, freeing it if no longer referenced
+ *
+ * @param reactor  Pointer to the reactor
+ */
+extern void iot_reactor_free (iot_reactor_t * reactor);
+
+/**
+ * @brief Create reactor component factory
+ *
+ * The factory configuration values are "ThreadPool" (thread pool component name), "Logger", "Priority" and
+ * "Affinity".
+ *
+ * @return  Reactor component factory
+ */
+extern const iot_component_factory_t * iot_reactor_factory (void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -42,6 +42,8 @@ extern "C" {
 typedef struct iot_scheduler_t iot_scheduler_t;
 /** Alias for schedule structure */
 typedef struct iot_schedule_t iot_schedule_t;
+/** Alias for schedule group structure */
+typedef struct iot_schedule_group_t iot_schedule_group_t;
 /** Alias for schedule function pointer */
 typedef void * (*iot_schedule_fn_t) (void * arg);
 /** Alias for schedule free function pointer */
@@ -66,6 +68,21 @@ typedef void (*iot_schedule_free_fn_t) (void * arg);
  */
 extern iot_scheduler_t * iot_scheduler_alloc (int priority, int affinity, iot_logger_t * logger);
 
+/**
+ * @brief Allocate memory and initialise a scheduler using a timer wheel
+ *
+ * As iot_scheduler_alloc, but active schedules are held in a hierarchical timer wheel, making adding, removing and
+ * re-queuing a schedule constant time. Schedules due within the same resolution interval may run in any order.
+ * The wheel can also be selected via the "WheelResolution" scheduler component configuration value.
+ *
+ * @param  priority          The thread priority for running the scheduler, (not set if -1)
+ * @param  affinity          The processor affinity for the scheduler (not set if less than zero)
+ * @param  resolution        The timer wheel resolution in nanoseconds, 0 for a standard scheduler
+ * @param  logger            logger, can be NULL
+ * @return iot_scheduler_t   Pointer to the created scheduler, NULL on error
+ */
+extern iot_scheduler_t * iot_scheduler_alloc_wheel (int priority, int affinity, uint64_t resolution, iot_logger_t * logger);
+
 /**
  * @brief Increment the scheduler reference count
  *
@@ -102,7 +119,7 @@ extern void iot_scheduler_start (iot_scheduler_t * scheduler);
  * @param  period             The period of the schedule (in nanoseconds)
  * @param  delay              The time delay before the schedule is first triggered (in nanoseconds)
  * @param  repeat             The number of times the schedule should repeat, (0 = infinite)
- * @param  pool               The thread pool used to run the schedule
+ * @param  pool               The thread pool used to run the schedule, NULL for the scheduler executor
  * @param  priority           The thread priority for running the schedule, (not set if -1)
  * @return iot_schedule       Pointer to the created schedule, NULL on error
  */
@@ -128,6 +145,37 @@ extern iot_schedule_t * iot_schedule_create
  */
 extern void iot_schedule_set_concurrent (iot_schedule_t * schedule, bool enable);
 
+/**
+ * @brief Run a schedule without a thread pool in a new thread for each run. By default such
+ * schedules are run by a small elastic thread pool created by the scheduler when first needed.
+ *
+ * @param schedule Pointer to the schedule
+ * @param enable   Whether to create a thread for each schedule run
+ */
+extern void iot_schedule_set_thread (iot_schedule_t * schedule, bool enable);
+
+/**
+ * @brief Enable precise execution of a schedule, where the scheduler thread wakes early and
+ * waits for the schedule start time with iot_wait_precise_nsecs. This reduces start time jitter
+ * for short period schedules, at the cost of the scheduler thread spinning for some microseconds
+ * before each run.
+ *
+ * @param schedule Pointer to the schedule
+ * @param enable   Whether to enable precise schedule execution
+ */
+extern void iot_schedule_set_precise (iot_schedule_t * schedule, bool enable);
+
+/**
+ * @brief Slow a schedule while a flow control is congested. Each run started while the flow control is
+ * congested sets the next start time from the period multiplied by the backoff factor, so that a schedule
+ * polling data into a queue or thread pool samples less often until the consumer catches up.
+ *
+ * @param schedule Pointer to the schedule
+ * @param flow     Flow control, the schedule takes a reference. NULL to remove flow control
+ * @param backoff  Period multiplier applied while congested, must be non zero
+ */
+extern void iot_schedule_set_flow (iot_schedule_t * schedule, iot_flow_t * flow, uint32_t backoff);
+
 /**
  * @brief Enable synchronous execution of a schedule, where the main scheduling thread
  * also executes the schedule function. Note that for repeated schedules, the repeat
@@ -186,6 +234,105 @@ extern bool iot_schedule_remove (iot_scheduler_t * scheduler, iot_schedule_t * s
  */
 extern void iot_schedule_reset (iot_scheduler_t * scheduler, iot_schedule_t * schedule, uint64_t delay);
 
+/**
+ * @brief  Spread the start times of a group of schedules evenly across their periods
+ *
+ * The next run of the nth of count schedules is set to n/count of its period from now, plus an
+ * optional jitter, derived from the schedule id so repeatable, modulo the period. Subsequent runs
+ * keep the phase, so schedules with the same period no longer all run at once.
+ *
+ * @code
+ *
+ *    iot_schedule_spread (myScheduler, mySchedules, 100, IOT_MS_TO_NS (1));
+ *
+ * @endcode
+ *
+ * @param  scheduler  Pointer to a scheduler
+ * @param  schedules  Array of schedules to spread
+ * @param  count      Number of schedules in the array
+ * @param  jitter     Maximum jitter added to each start time (in nanoseconds), 0 for no jitter
+ */
+extern void iot_schedule_spread (iot_scheduler_t * scheduler, iot_schedule_t * const * schedules, uint32_t count, uint64_t jitter);
+
+/**
+ * @brief  Create a schedule group
+ *
+ * A schedule group is a single schedule that calls each of its member functions when run, so many
+ * schedules sharing a period and start time use one scheduler queue entry. Members are run in order
+ * in one thread pool job, or if a thread pool and chunk size are given, in jobs of up to chunk members,
+ * the first run by the group schedule. The group schedule is added, removed, reset and configured
+ * as any other schedule, see iot_schedule_group_schedule.
+ *
+ * @code
+ *
+ *    iot_schedule_group_t * myGroup = iot_schedule_group_create (myScheduler, IOT_SEC_TO_NS (1), 0, 0, myPool, IOT_THREAD_NO_PRIORITY, 100);
+ *
+ * @endcode
+ *
+ * @param  scheduler          Pointer to a scheduler
+ * @param  period             The period of the group schedule (in nanoseconds)
+ * @param  delay              The time delay before the group is first run (in nanoseconds)
+ * @param  repeat             The number of times the group should repeat, (0 = infinite)
+ * @param  pool               The thread pool used to run the group, NULL for the scheduler executor
+ * @param  priority           The thread priority for running the group, (not set if -1)
+ * @param  chunk              The number of members run per thread pool job, 0 to run all in one job
+ * @return                    Pointer to the created schedule group, NULL on error
+ */
+extern iot_schedule_group_t * iot_schedule_group_create
+(
+  iot_scheduler_t * scheduler,
+  uint64_t period,
+  uint64_t delay,
+  uint64_t repeat,
+  iot_threadpool_t * pool,
+  int priority,
+  uint32_t chunk
+);
+
+/**
+ * @brief  Get the schedule used to run a schedule group
+ *
+ * @param  group  Pointer to a schedule group
+ * @return        Pointer to the group schedule, owned by the group
+ */
+extern iot_schedule_t * iot_schedule_group_schedule (const iot_schedule_group_t * group);
+
+/**
+ * @brief  Add a member function to a schedule group. Members can be added while the group is scheduled,
+ * taking effect from the next group run.
+ *
+ * @param  group  Pointer to a schedule group
+ * @param  func   The function called when the group is run
+ * @param  arg    The argument to be passed to the function, not freed by the group
+ */
+extern void iot_schedule_group_add (iot_schedule_group_t * group, iot_schedule_fn_t func, void * arg);
+
+/**
+ * @brief  Remove a member function from a schedule group. A group run in progress may still call the member.
+ *
+ * @param  group  Pointer to a schedule group
+ * @param  func   The member function
+ * @param  arg    The member function argument
+ * @return        Whether a matching member was found and removed
+ */
+extern bool iot_schedule_group_remove (iot_schedule_group_t * group, iot_schedule_fn_t func, const void * arg);
+
+/**
+ * @brief  Get the number of members in a schedule group
+ *
+ * @param  group  Pointer to a schedule group
+ * @return        The number of group members
+ */
+extern uint32_t iot_schedule_group_size (iot_schedule_group_t * group);
+
+/**
+ * @brief  Delete a schedule group and its schedule
+ *
+ * @param  scheduler  Pointer to a scheduler
+ * @param  group      Pointer to the schedule group to be deleted
+ */
+extern void iot_schedule_group_delete (iot_scheduler_t * scheduler, iot_schedule_group_t * group);
+
 /**
  * @brief  Add callback function to be invoked when a schedule is run
  *
@@ -230,6 +377,37 @@ extern void iot_schedule_add_abort_callback (iot_scheduler_t * scheduler, iot_sc
  */
 extern void iot_schedule_delete (iot_scheduler_t * scheduler, iot_schedule_t * schedule);
 
+/**
+ * @brief  Maintain the cached Unix time (see iot_time_cached_usecs) from the scheduler thread
+ *
+ * Creates and adds a synchronous schedule updating the cached time each interval. Deleting the
+ * schedule stops using the cached time. Only one cache is maintained per process.
+ *
+ * @code
+ *
+ *    iot_schedule_t * cache = iot_scheduler_time_cache (myScheduler, IOT_MS_TO_NS (1));
+ *
+ * @endcode
+ *
+ * @param  scheduler  Pointer to a scheduler
+ * @param  interval   The cache update interval (in nanoseconds)
+ * @return            Pointer to the cache update schedule, NULL on error
+ */
+extern iot_schedule_t * iot_scheduler_time_cache (iot_scheduler_t * scheduler, uint64_t interval);
+
+/**
+ * @brief  Set whether the scheduler dispatches all due schedules per wakeup
+ *
+ * In batch mode the scheduler thread collects every due schedule in one pass, submitting runs to
+ * each thread pool with iot_threadpool_try_work_batch. The number of batches and the largest batch
+ * are then reported in the scheduler statistics. Batch mode can also be selected via the "Batch"
+ * scheduler component configuration value.
+ *
+ * @param  scheduler  Pointer to a scheduler
+ * @param  enable     Whether to enable batch mode
+ */
+extern void iot_scheduler_set_batch (iot_scheduler_t * scheduler, bool enable);
+
 /**
  * @brief  Stops execution of the scheduler and set the scheduler state to IOT_COMPONENT_STOPPED
  *
@@ -270,6 +448,17 @@ extern void iot_scheduler_free (iot_scheduler_t * scheduler);
  */
  extern uint64_t iot_schedule_dropped (const iot_schedule_t * schedule);
 
+/**
+ * @brief  Get scheduler runtime statistics
+ *
+ * Statistics are also returned in the "stats" entry of the scheduler component read data.
+ *
+ * @param  scheduler  Pointer to a scheduler
+ * @return            Data map with "active" and "idle" schedule counts, "fired", "dropped" and "skipped" run counts
+ *                    and a "lateness" histogram map of schedule start to run times, as for iot_threadpool_stats
+ */
+extern iot_data_t * iot_scheduler_stats (iot_scheduler_t * scheduler);
+
  /**
  * @brief  Return unique schedule id
  *
@@ -24,6 +24,8 @@ typedef uint8_t * (*iot_store_read_fn) (const char * path, size_t * len);
 typedef bool (*iot_store_write_fn) (const char * path, const uint8_t * binary, size_t len);
 /** Function pointer type for delete capability */
 typedef bool (*iot_store_delete_fn) (const char * path);
+/** Function pointer type for configuration list capability, see iot_store_config_list */
+typedef iot_data_t * (*iot_store_list_fn) (const char * directory);
 
 /**
  * @brief Configure store to use given functions for read, write and delete implementation
@@ -34,6 +36,73 @@ typedef bool (*iot_store_delete_fn) (const char * path);
  */
 extern void iot_store_config (iot_store_read_fn read_fn, iot_store_write_fn write_fn, iot_store_delete_fn del_fn);
 
+/**
+ * @brief Configure store to use given function to list configurations
+ *
+ * @param list_fn  List function pointer, or NULL to list configuration files in a directory
+ */
+extern void iot_store_config_lister (iot_store_list_fn list_fn);
+
+#if defined (IOT_HAS_FILE) && !defined (_AZURESPHERE_)
+/**
+ * @brief Open a log structured key-value store and configure the store to use it
+ *
+ * All store data is held in a single segment file, to which writes and deletes are appended as checksummed
+ * records, so that a record torn by a crash is discarded when the store is next opened. An in-memory index
+ * of the latest record for each path is used for reads and for listing configurations, rather than scanning
+ * a directory. Superseded records are removed by compacting the segment in a background thread, once they
+ * are larger than the live data. Only one key-value store may be open.
+ *
+ * @param path  Path of the segment file, created if it does not exist
+ * @return      Whether the store was opened
+ */
+extern bool iot_store_kv_open (const char * path);
+
+/**
+ * @brief Compact the open key-value store, so that the segment holds only live records
+ *
+ * @return Whether the segment was compacted
+ */
+extern bool iot_store_kv_compact (void);
+
+/**
+ * @brief Get key-value store statistics
+ *
+ * @return Map of "keys" (uint32) and "size", "live" and "garbage" byte counts (uint64), or NULL if no store open (client needs to free)
+ */
+extern iot_data_t * iot_store_kv_stats (void);
+
+/**
+ * @brief Close the open key-value store, configuring the store to use the default file functions
+ *
+ * Should not be called while the store is in use by other threads.
+ */
+extern void iot_store_kv_close (void);
+#endif
+
+/**
+ * @brief Enable or disable write-behind of store writes
+ *
+ * When enabled, store writes (including configuration saves) are held in memory and written by a background
+ * thread once the delay after the first write to a path has passed. Writes to the same path within the delay are
+ * coalesced, so only the latest contents are written. Reads of a path return any pending contents. With the
+ * default file store functions each write is made atomically, via a temporary file which is renamed. Not thread
+ * safe with respect to itself, so should be called on initialisation and shutdown.
+ *
+ * @param delay Write delay in milliseconds. Zero disables write-behind, writing any pending data.
+ * @return      Whether the background thread was started or the pending data written
+ */
+extern bool iot_store_write_behind (uint32_t delay);
+
+/**
+ * @brief Write all data pending from write-behind
+ *
+ * Should be called before shutdown if write-behind is enabled.
+ *
+ * @return Whether all pending data was successfully written
+ */
+extern bool iot_store_flush (void);
+
 /**
  * @brief Load string from store path, returns store contents as a NULL terminated string
  *
@@ -87,6 +156,49 @@ extern bool iot_store_write_binary (const char * path, const uint8_t * binary, s
  */
 extern char * iot_store_config_load (const char * name, const char * uri);
 
+/**
+ * @brief Load and parse JSON configuration from store
+ *
+ * Environment variable references in the configuration are substituted before parsing. When the
+ * store uses the default file read function, parsed configurations are cached by file path, and
+ * a configuration is only read and parsed again if the file modification time or size changes.
+ * Can be used as the container load_map function.
+ *
+ * @param name  Name of the configuration
+ * @param uri   URI for configuration
+ * @return      Parsed configuration, or NULL if not found or invalid (client needs to free)
+ */
+extern iot_data_t * iot_store_config_load_map (const char * name, const char * uri);
+
+/**
+ * @brief Discard all configurations cached by iot_store_config_load_map, and any directory index of iot_store_config_list
+ */
+extern void iot_store_config_cache_clear (void);
+
+/**
+ * @brief Save configurations cached by iot_store_config_load_map to a binary snapshot
+ *
+ * The snapshot is written in CBOR format. It holds each parsed configuration, with environment variables
+ * substituted, and the modification time and size of its file. Requires CBOR support (see IOT_HAS_CBOR).
+ *
+ * @param path  Path of the snapshot to write
+ * @return      Whether the snapshot was written
+ */
+extern bool iot_store_config_snapshot_save (const char * path);
+
+/**
+ * @brief Add configurations from a binary snapshot to the configuration cache
+ *
+ * Loading a snapshot before iot_container_init, with iot_store_config_load_map as the container
+ * load_map function, avoids reading and parsing configuration files. A file is still read and
+ * parsed if its modification time or size differs from the snapshot. As environment variables are
+ * substituted in the snapshot, a snapshot should not be loaded if the environment has changed.
+ *
+ * @param path  Path of the snapshot to read
+ * @return      Whether the snapshot was read
+ */
+extern bool iot_store_config_snapshot_load (const char * path);
+
 /**
  * @brief Save JSON configuration to store
  *
@@ -108,6 +220,10 @@ extern bool iot_store_config_delete (const char * name, const char * uri);
 
 /**
  * @brief List json files in given directory
+ *
+ * With the default file store functions, an index of the most recently listed directory is retained (see
+ * iot_file_index_alloc), so that listing it again only costs the changes made since.
+ *
  * @param directory Directory in which to list json files
  * @return List of file names with '.json' removed
  */
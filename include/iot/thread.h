@@ -79,6 +79,13 @@ extern bool iot_thread_set_priority (pthread_t thread, int priority);
  */
 extern bool iot_thread_priority_valid (int priority);
 
+/** Mutex types */
+typedef enum iot_mutex_type_t
+{
+  IOT_MUTEX_DEFAULT = 0u,  /**< Blocking mutex, using priority inheritance where supported and enabled */
+  IOT_MUTEX_ADAPTIVE = 1u  /**< Mutex that spins briefly before blocking, for short critical sections. Does not use priority inheritance */
+} iot_mutex_type_t;
+
 /**
  * @brief Initialise specified mutex
  *
@@ -86,6 +93,58 @@ extern bool iot_thread_priority_valid (int priority);
  */
 extern void iot_mutex_init (pthread_mutex_t * mutex);
 
+/**
+ * @brief Initialise specified mutex of a given type
+ *
+ * Adaptive mutexes are supported with glibc, otherwise a default mutex without priority inheritance is initialised.
+ *
+ * @param mutex Mutex to initialise
+ * @param type  Type of mutex
+ */
+extern void iot_mutex_init_type (pthread_mutex_t * mutex, iot_mutex_type_t type);
+
+/**
+ * @brief Set whether default mutexes use priority inheritance
+ *
+ * Priority inheritance prevents priority inversion between real time (SCHED_FIFO) threads, for
+ * example thread pool threads created with a priority, contending for component, logger and
+ * scheduler mutexes. It is enabled by default where supported. The setting applies to mutexes
+ * subsequently initialised, so should be made before any components are created.
+ *
+ * @param enable Whether priority inheritance is used
+ */
+extern void iot_mutex_set_priority_inherit (bool enable);
+
+/** Deadline for iot_cond_timedwait with no timeout */
+#define IOT_COND_NO_DEADLINE UINT64_MAX
+
+/**
+ * @brief Initialise specified condition variable for timed waits
+ *
+ * Timed waits are against the monotonic clock where supported, so are not affected by system time changes.
+ *
+ * @param cond Condition variable to initialise
+ */
+extern void iot_cond_init (pthread_cond_t * cond);
+
+/**
+ * @brief Calculate a deadline for iot_cond_timedwait
+ *
+ * @param timeout_ns Time from now, in nanoseconds
+ * @return           Deadline, IOT_COND_NO_DEADLINE if not representable
+ */
+extern uint64_t iot_cond_deadline (uint64_t timeout_ns);
+
+/**
+ * @brief Wait on a condition variable initialised by iot_cond_init until a deadline
+ *
+ * @param cond     Condition variable to wait on
+ * @param mutex    Mutex held by the caller
+ * @param deadline Deadline as from iot_cond_deadline, or IOT_COND_NO_DEADLINE to wait without a timeout
+ * @return         'false' if the deadline passed, 'true' otherwise
+ */
+extern bool iot_cond_timedwait (pthread_cond_t * cond, pthread_mutex_t * mutex, uint64_t deadline);
+
 
 #ifdef __cplusplus
 }
@@ -13,6 +13,7 @@
  */
 
 #include "iot/logger.h"
+#include "iot/flow.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -24,6 +25,14 @@ extern "C" {
 /** Alias for threadpool structure */
 typedef struct iot_threadpool_t iot_threadpool_t;
 
+/** Thread pool job description, used for batch submission */
+typedef struct iot_threadpool_job_t
+{
+  void * (*function) (void * arg);   /**< Function to run */
+  void * arg;                        /**< Function argument */
+  int priority;                      /**< Priority to run thread at (not set if -1) */
+} iot_threadpool_job_t;
+
 /**
  * @brief Allocate memory and initialise thread pool
  *
@@ -39,6 +48,62 @@ typedef struct iot_threadpool_t iot_threadpool_t;
  */
 extern iot_threadpool_t * iot_threadpool_alloc (uint16_t num_threads, uint32_t max_jobs, int default_prio, int affinity, iot_logger_t * logger);
 
+/**
+ * @brief Allocate memory and initialise a work stealing thread pool
+ *
+ * As iot_threadpool_alloc, but each thread has its own job queue. Work added from a pool thread is queued
+ * locally, other work is distributed round robin. Idle threads run the highest priority job from their own
+ * queue, or steal from other threads' queues, so job priority ordering is per thread rather than pool wide.
+ * The mode can also be selected via the "WorkStealing" thread pool component configuration value.
+ *
+ * @param num_threads        Number of threads to be created in the threadpool, must be non zero
+ * @param max_jobs           Maximum number of jobs to queue (before blocking)
+ * @param default_prio       Default priority for created threads (not set if -1)
+ * @param affinity           Processor affinity for pool threads (not set if less than zero)
+ * @param logger             Logger, can be NULL
+ * @returns iot_threadpool_t Created thread pool on success, NULL on error
+ */
+extern iot_threadpool_t * iot_threadpool_alloc_stealing (uint16_t num_threads, uint32_t max_jobs, int default_prio, int affinity, iot_logger_t * logger);
+
+/**
+ * @brief Allocate memory and initialise an elastic thread pool
+ *
+ * As iot_threadpool_alloc, but the pool starts with min_threads threads. A thread is added, up to max_threads, when
+ * jobs are queued with no thread available to run them, and threads above min_threads exit when idle for
+ * idle_timeout milliseconds. An elastic pool can also be configured with the "MinThreads" (with "Threads" the
+ * maximum) and "IdleTimeout" thread pool component configuration values, for a pool without work stealing.
+ *
+ * @param min_threads        Minimum number of threads
+ * @param max_threads        Maximum number of threads, must be non zero and at least min_threads
+ * @param max_jobs           Maximum number of jobs to queue (before blocking)
+ * @param default_prio       Default priority for created threads (not set if -1)
+ * @param affinity           Processor affinity for pool threads (not set if less than zero)
+ * @param idle_timeout       Idle time in milliseconds after which threads above the minimum exit, must be non zero
+ * @param logger             Logger, can be NULL
+ * @returns iot_threadpool_t Created thread pool on success, NULL on error
+ */
+extern iot_threadpool_t * iot_threadpool_alloc_elastic (uint16_t min_threads, uint16_t max_threads, uint32_t max_jobs, int default_prio, int affinity, uint32_t idle_timeout, iot_logger_t * logger);
+
+/**
+ * @brief Allocate memory and initialise a thread pool with threads spread over a set of processors
+ *
+ * As iot_threadpool_alloc or iot_threadpool_alloc_stealing, but pool threads are pinned round robin to the processors
+ * in a list, such as "0-3,8,10-11". If the list is not valid, threads are not pinned. For a work stealing pool,
+ * each thread can also allocate its own local job cache, so on NUMA systems job memory is local to the node on
+ * which the thread runs. The list and local allocation can also be set with the "Affinity" (as a string) and
+ * "NumaLocal" thread pool component configuration values.
+ *
+ * @param num_threads        Number of threads to be created in the threadpool, must be non zero if stealing
+ * @param max_jobs           Maximum number of jobs to queue (before blocking)
+ * @param default_prio       Default priority for created threads (not set if -1)
+ * @param cpus               Processor list for pool threads
+ * @param stealing           Whether to create a work stealing thread pool
+ * @param numa_local         Whether pool threads allocate their own job caches (work stealing only)
+ * @param logger             Logger, can be NULL
+ * @returns iot_threadpool_t Created thread pool on success, NULL on error
+ */
+extern iot_threadpool_t * iot_threadpool_alloc_cpus (uint16_t num_threads, uint32_t max_jobs, int default_prio, const char * cpus, bool stealing, bool numa_local, iot_logger_t * logger);
+
 /**
  * @brief Add work to the thread pool
  *
@@ -51,6 +116,57 @@ extern iot_threadpool_t * iot_threadpool_alloc (uint16_t num_threads, uint32_t m
  */
 extern void iot_threadpool_add_work (iot_threadpool_t * pool, void * (*function) (void*), void * arg, int priority);
 
+/**
+ * @brief Add work with a deadline to the thread pool
+ *
+ * The function adds work as for iot_threadpool_add_work, with an absolute deadline by which the job should start.
+ * Jobs are ordered by priority, then earliest deadline first within each priority, with jobs without a deadline
+ * after those with one. Jobs starting after their deadline are counted and, if the pool is set to drop expired
+ * jobs (see iot_threadpool_set_drop_expired), are not run.
+ *
+ * @param  pool          Pool to which the work will be added
+ * @param  function      Function to add as work
+ * @param  arg           Function argument
+ * @param  priority      Priority to run thread at (not set if -1)
+ * @param  deadline      Absolute deadline as from iot_time_nsecs, zero if none
+ */
+extern void iot_threadpool_add_work_deadline (iot_threadpool_t * pool, void * (*function) (void*), void * arg, int priority, uint64_t deadline);
+
+/**
+ * @brief Set whether jobs past their deadline are dropped
+ *
+ * @param  pool  Thread pool
+ * @param  drop  Whether jobs starting after their deadline are dropped rather than run (default false)
+ */
+extern void iot_threadpool_set_drop_expired (iot_threadpool_t * pool, bool drop);
+
+/**
+ * @brief Attach flow control to the pool, updated with the number of queued jobs as jobs are added and started
+ *
+ * Producers, such as schedules (see iot_schedule_set_flow), can use the flow control to slow down as the job
+ * queue approaches max_jobs, rather than blocking. The flow control should be set before work is added.
+ *
+ * @param  pool  Pointer to the pool
+ * @param  flow  Flow control, the pool takes a reference. NULL to remove flow control
+ */
+extern void iot_threadpool_set_flow (iot_threadpool_t * pool, iot_flow_t * flow);
+
+/**
+ * @brief Add keyed work to the thread pool
+ *
+ * Jobs added with the same key run one at a time, in the order added, while jobs with other keys run in parallel.
+ * The jobs for a key are run by a single pool job, which is requeued after each few jobs so that other work is not
+ * blocked, at the priority of the next job for the key. This function will wait until a space is available in the
+ * job queue if there are no pending jobs for the key.
+ *
+ * @param  pool          Pool to which the work will be added
+ * @param  key           Key, such as a device identifier, for jobs to be run in order
+ * @param  function      Function to add as work
+ * @param  arg           Function argument
+ * @param  priority      Priority to run thread at (not set if -1)
+ */
+extern void iot_threadpool_add_keyed_work (iot_threadpool_t * pool, uint64_t key, void * (*function) (void*), void * arg, int priority);
+
 /**
  * @brief Try to add work to the thread pool
  *
@@ -65,6 +181,147 @@ extern void iot_threadpool_add_work (iot_threadpool_t * pool, void * (*function)
  */
 extern bool iot_threadpool_try_work (iot_threadpool_t * pool, void * (*function) (void*), void * arg, int priority);
 
+/**
+ * @brief Add a batch of work to the thread pool
+ *
+ * The function adds an array of jobs to the thread pool's job queue, taking the queue lock once and waking
+ * idle threads with a single broadcast. This function will wait until space is available in the job queue
+ * to add all of the jobs.
+ *
+ * @param  pool          Pool to which the work will be added
+ * @param  jobs          Array of jobs to add
+ * @param  count         Number of jobs in the array
+ */
+extern void iot_threadpool_add_work_batch (iot_threadpool_t * pool, const iot_threadpool_job_t * jobs, uint32_t count);
+
+/**
+ * @brief Try to add a batch of work to the thread pool
+ *
+ * The function adds as many jobs from the start of an array as space in the job queue allows, without blocking.
+ *
+ * @param  pool          Pool to which the work will be added
+ * @param  jobs          Array of jobs to add
+ * @param  count         Number of jobs in the array
+ * @return uint32_t      Number of jobs added, from the start of the array
+ */
+extern uint32_t iot_threadpool_try_work_batch (iot_threadpool_t * pool, const iot_threadpool_job_t * jobs, uint32_t count);
+
+/** Alias for future structure, holding the result of a job once complete */
+typedef struct iot_future_t iot_future_t;
+
+/** Function type for future continuations, called with the result of the preceding future */
+typedef void * (*iot_future_fn) (void * result, void * arg);
+
+/**
+ * @brief Add work to the thread pool, returning a future for its result
+ *
+ * As iot_threadpool_add_work, with the value returned by the function setting the result of the future.
+ *
+ * @param  pool          Pool to which the work will be added
+ * @param  function      Function to run
+ * @param  arg           Function argument
+ * @param  priority      Priority to run thread at (not set if -1)
+ * @return               Future for the function result (client needs to free)
+ */
+extern iot_future_t * iot_threadpool_submit (iot_threadpool_t * pool, void * (*function) (void*), void * arg, int priority);
+
+/**
+ * @brief Allocate a future, whose result is set by iot_future_set
+ *
+ * @return  Future (client needs to free)
+ */
+extern iot_future_t * iot_future_alloc (void);
+
+/**
+ * @brief Set the result of a future, running any continuations
+ *
+ * A future result must only be set once.
+ *
+ * @param future  Future to set
+ * @param result  Future result
+ */
+extern void iot_future_set (iot_future_t * future, void * result);
+
+/**
+ * @brief Add a continuation to a future
+ *
+ * Once the future has a result, the continuation function is called with that result, and its return value sets
+ * the result of the returned future. The continuation is added to a thread pool (which may be another pool), or if
+ * no pool is given, run on the thread setting the result, or on the calling thread if the future already has a result.
+ * Continuations are added and completed without locking.
+ *
+ * @param  future  Preceding future
+ * @param  pool    Pool on which to run the continuation, NULL to run it directly
+ * @param  fn      Continuation function
+ * @param  arg     Continuation function argument
+ * @return         Future for the continuation result (client needs to free)
+ */
+extern iot_future_t * iot_future_then (iot_future_t * future, iot_threadpool_t * pool, iot_future_fn fn, void * arg);
+
+/**
+ * @brief Combine futures, into a future completed once all the futures are complete
+ *
+ * @param  futures  Array of futures, which remain owned by the caller
+ * @param  count    Number of futures
+ * @return          Future with a NULL result, set when all futures complete (client needs to free)
+ */
+extern iot_future_t * iot_future_when_all (iot_future_t * const * futures, uint32_t count);
+
+/**
+ * @brief Combine futures, into a future completed once any of the futures is complete
+ *
+ * @param  futures  Array of futures, which remain owned by the caller
+ * @param  count    Number of futures, must be non zero
+ * @return          Future whose result is the first of the futures to complete (client needs to free)
+ */
+extern iot_future_t * iot_future_when_any (iot_future_t * const * futures, uint32_t count);
+
+/**
+ * @brief Check whether a future has a result
+ *
+ * @param  future  Future to check
+ * @return         Whether the future result is set
+ */
+extern bool iot_future_ready (const iot_future_t * future);
+
+/**
+ * @brief Get the result of a future, waiting until it is set
+ *
+ * Should not be called from a job running on a pool whose jobs are needed to set the result.
+ *
+ * @param  future  Future to wait for
+ * @return         The future result
+ */
+extern void * iot_future_wait (iot_future_t * future);
+
+/**
+ * @brief Free a future
+ *
+ * A future is reference counted, so remains valid for pending continuations and combinators.
+ *
+ * @param future  Future to free
+ */
+extern void iot_future_free (iot_future_t * future);
+
+/** Function type for parallel for, called with a range of indices from begin to (but not including) end */
+typedef void (*iot_threadpool_range_fn) (uint32_t begin, uint32_t end, void * ctx);
+
+/**
+ * @brief Call a function for each range of indices, running the ranges in parallel
+ *
+ * The indices are split into ranges of grain indices, which are run by the calling thread and by jobs added to
+ * the pool, up to one per pool thread. Jobs that cannot be queued are not added. The function returns once all
+ * ranges are complete, waiting only for its own jobs, so can be called from a job running on the same pool.
+ *
+ * @param pool   Pool to which the jobs are added, if NULL all ranges are run by the calling thread
+ * @param begin  First index
+ * @param end    Index after last
+ * @param grain  Number of indices in each range, if zero set to give four ranges per pool thread
+ * @param fn     Function to call for each range
+ * @param ctx    Function context
+ */
+extern void iot_threadpool_parallel_for (iot_threadpool_t * pool, uint32_t begin, uint32_t end, uint32_t grain, iot_threadpool_range_fn fn, void * ctx);
+
 /**
  * @brief Wait for all queued jobs to finish
  *
@@ -74,6 +331,18 @@ extern bool iot_threadpool_try_work (iot_threadpool_t * pool, void * (*function)
  */
 extern void iot_threadpool_wait (iot_threadpool_t * pool);
 
+/**
+ * @brief Wait for all queued jobs to finish, or until a timeout expires
+ *
+ * As iot_threadpool_wait, but returns if jobs are still queued or running after the timeout. Timeouts are measured
+ * against the monotonic clock where supported.
+ *
+ * @param pool        the thread pool to wait for
+ * @param timeout_ns  Maximum time to wait, in nanoseconds
+ * @return            'true' if all jobs finished, 'false' if the timeout expired
+ */
+extern bool iot_threadpool_wait_timed (iot_threadpool_t * pool, uint64_t timeout_ns);
+
 /**
  * @brief Start the thread pool
  *
@@ -92,15 +361,45 @@ extern void iot_threadpool_start (iot_threadpool_t * pool);
  */
 extern void iot_threadpool_stop (iot_threadpool_t * pool);
 
+/**
+ * @brief Shut down the thread pool, stopping its threads
+ *
+ * Unless cancelled, queued jobs are run first, so the pool should be running. Pool threads are then signalled
+ * to exit, and the function returns as soon as they have all finished any job being run. Any queued jobs not
+ * run are discarded when the pool is freed, with the futures of any submitted jobs completed with a NULL result.
+ * Jobs added after shutdown are not run. Must not be called from a pool thread.
+ *
+ * @param pool    Pool to shut down
+ * @param cancel  Whether to discard queued jobs, rather than run them
+ */
+extern void iot_threadpool_shutdown (iot_threadpool_t * pool, bool cancel);
+
 /**
  * @brief Destroy the thread pool
  *
  * The function that will wait for the currently active threads to finish and then frees the thread pool.
+ * Queued jobs not yet started are discarded, see iot_threadpool_shutdown to run them first. The futures of discarded
+ * jobs, and of continuations added to the pool, are completed with a NULL result.
  *
  * @param pool  Pool to free
  */
 extern void iot_threadpool_free (iot_threadpool_t * pool);
 
+/**
+ * @brief Get thread pool runtime statistics
+ *
+ * Statistics are also returned in the "stats" entry of the thread pool component read data.
+ *
+ * @param pool  Pool for which to return statistics
+ * @return      Data map with "threads" (currently running), "max_threads", "max_jobs" (0 if unlimited), "busy",
+ *              "queue_depth", "queue_high_water", "jobs_run", "deadline_missed" (jobs run after their deadline) and
+ *              "deadline_dropped" (jobs not run as past their deadline) entries, and "wait" (queue to start) and "run"
+ *              job duration histogram maps, each with "count", "total_ns", "max_ns" and "buckets" entries. The "buckets"
+ *              array counts durations under 1us, then from 2^(n-1) to 2^n us, with the last bucket counting all
+ *              longer durations.
+ */
+extern iot_data_t * iot_threadpool_stats (iot_threadpool_t * pool);
+
 /**
  * @brief Increment the thread pool reference count
  *
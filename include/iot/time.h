@@ -46,6 +46,65 @@ extern uint64_t iot_time_usecs (void);
  */
 extern uint64_t iot_time_nsecs (void);
 
+/**
+ * @brief Get coarse Unix time in milliseconds
+ *
+ * Uses the coarse real time clock where available, read without a system call but updated only
+ * at the kernel tick (typically 1 to 10 milliseconds).
+ *
+ * @return Coarse Unix time in milliseconds
+ */
+extern uint64_t iot_time_coarse_msecs (void);
+
+/**
+ * @brief Get coarse Unix time in microseconds
+ *
+ * @return Coarse Unix time in microseconds, at kernel tick resolution
+ */
+extern uint64_t iot_time_coarse_usecs (void);
+
+/**
+ * @brief Get coarse Unix time in nanoseconds
+ *
+ * @return Coarse Unix time in nanoseconds, at kernel tick resolution
+ */
+extern uint64_t iot_time_coarse_nsecs (void);
+
+/**
+ * @brief Set the cached Unix time to the current time
+ *
+ * Typically called periodically by a scheduler thread (see iot_scheduler_time_cache).
+ *
+ * @return The cached Unix time in nanoseconds
+ */
+extern uint64_t iot_time_cache_update (void);
+
+/**
+ * @brief Stop using the cached Unix time, the iot_time_cached functions read the clock
+ */
+extern void iot_time_cache_disable (void);
+
+/**
+ * @brief Get the cached Unix time in milliseconds
+ *
+ * @return Unix time in milliseconds of the last cache update, or the current time if no cache is maintained
+ */
+extern uint64_t iot_time_cached_msecs (void);
+
+/**
+ * @brief Get the cached Unix time in microseconds
+ *
+ * @return Unix time in microseconds of the last cache update, or the current time if no cache is maintained
+ */
+extern uint64_t iot_time_cached_usecs (void);
+
+/**
+ * @brief Get the cached Unix time in nanoseconds
+ *
+ * @return Unix time in nanoseconds of the last cache update, or the current time if no cache is maintained
+ */
+extern uint64_t iot_time_cached_nsecs (void);
+
 /**
  * @brief Uninterrupted wait in seconds
  *
@@ -67,6 +126,24 @@ extern void iot_wait_msecs (uint64_t interval);
  */
 extern void iot_wait_usecs (uint64_t interval);
 
+/**
+ * @brief Precise uninterrupted wait in nanoseconds
+ *
+ * Sleeps on the monotonic clock until shortly before the interval elapses, then spins for the
+ * remainder. The spin period adapts to the observed sleep overrun, so a waiting thread uses CPU
+ * for some microseconds per wait.
+ *
+ * @param interval Time to wait in nanoseconds
+ */
+extern void iot_wait_precise_nsecs (uint64_t interval);
+
+/**
+ * @brief Precise uninterrupted wait in microseconds
+ *
+ * @param interval Time to wait in microseconds
+ */
+extern void iot_wait_precise_usecs (uint64_t interval);
+
 #ifdef __cplusplus
 }
 #endif
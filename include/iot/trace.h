@@ -0,0 +1,100 @@
+//
+// Copyright (c) 2023 IOTech Ltd
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+
+#ifndef _IOT_TRACE_H_
+#define _IOT_TRACE_H_
+
+/**
+ * @file
+ * @brief IOTech Trace API
+ *
+ * Binary event tracing for hot paths. Events are recorded, when tracing is enabled, into per thread
+ * lock free rings, each holding the most recent IOT_TRACE_RING_SIZE events of a thread, and can be
+ * written out in Chrome trace event JSON format, as loaded by chrome://tracing or Perfetto.
+ * Library tracepoints are built if IOT_HAS_TRACE is defined (see iot/defs.h).
+ */
+
+#include "iot/os.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of events held per thread */
+#define IOT_TRACE_RING_SIZE 4096u
+
+/** Trace event types */
+typedef enum iot_trace_event_t
+{
+  IOT_TRACE_JOB_START = 0,      /**< Thread pool job started, argument is the job function address */
+  IOT_TRACE_JOB_END = 1,        /**< Thread pool job completed, argument is the job function address */
+  IOT_TRACE_SCHEDULE_FIRE = 2,  /**< Schedule run, argument is the schedule id */
+  IOT_TRACE_QUEUE_ENQUEUE = 3,  /**< Element added to queue, argument is the queue address */
+  IOT_TRACE_QUEUE_DEQUEUE = 4,  /**< Element taken from queue, argument is the queue address */
+  IOT_TRACE_DATA_BLOCK_ALLOC = 5 /**< Thread data block cache refilled, argument is the number of blocks added */
+} iot_trace_event_t;
+
+/**
+ * @brief Enable or disable event recording
+ *
+ * @param enable  Whether to record events
+ */
+extern void iot_trace_enable (bool enable);
+
+/**
+ * @brief Find whether event recording is enabled
+ *
+ * @return  Whether events are recorded
+ */
+extern bool iot_trace_enabled (void);
+
+/**
+ * @brief Record an event for the calling thread, if recording is enabled
+ *
+ * @param event  The event type
+ * @param arg    Event argument
+ */
+extern void iot_trace_event (iot_trace_event_t event, uint64_t arg);
+
+/**
+ * @brief Discard all recorded events
+ */
+extern void iot_trace_clear (void);
+
+/**
+ * @brief Write recorded events in Chrome trace event JSON format
+ *
+ * Events recorded concurrently with the dump, or overwritten during it, may be omitted.
+ *
+ * @param file  File to write to
+ * @return      Whether the events were written
+ */
+extern bool iot_trace_dump (FILE * file);
+
+/**
+ * @brief Write recorded events in Chrome trace event JSON format to a named file
+ *
+ * @param path  Path of file to create or overwrite
+ * @return      Whether the events were written
+ */
+extern bool iot_trace_dump_path (const char * path);
+
+/**
+ * @brief Write recorded events to a named file on receipt of a signal
+ *
+ * The signal handler only notifies a dump thread, so is async signal safe. Subsequent calls add
+ * signals and replace the path.
+ *
+ * @param signum  Signal number, for example SIGUSR1
+ * @param path    Path of file to write on receipt of the signal
+ * @return        Whether the signal handler was installed
+ */
+extern bool iot_trace_dump_on_signal (int signum, const char * path);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -6,6 +6,8 @@
 #ifndef IOT_UUID_H
 #define IOT_UUID_H
 
+#include "iot/os.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -15,6 +17,8 @@ extern "C" {
 typedef unsigned char iot_uuid_t[16];
 
 extern void iot_uuid_generate (iot_uuid_t out);
+extern void iot_uuid_generate_n (iot_uuid_t * out, uint32_t n);
+extern void iot_uuid_generate_v7 (iot_uuid_t out);
 extern void iot_uuid_unparse (const iot_uuid_t uuid, char * out);
 
 #ifdef __cplusplus
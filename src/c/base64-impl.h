@@ -0,0 +1,17 @@
+//
+// Copyright (c) 2024 IOTech Ltd
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+
+#ifndef _IOT_BASE64_IMPL_H_
+#define _IOT_BASE64_IMPL_H_
+
+#include "iot/base64.h"
+
+// Select the base64 block variants for a set of processor features (IOT_CPU_*), the portable code if none.
+// Selected for iot_cpu_features when loaded, otherwise only used by tests comparing variants.
+
+extern void iot_b64_select (uint32_t features);
+
+#endif
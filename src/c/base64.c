@@ -6,7 +6,8 @@
  *
  */
 
-#include "iot/base64.h"
+#include "base64-impl.h"
+#include "cpu-impl.h"
 
 /* BASE64 encode/decode functions based on public domain code at 
  * https://en.wikibooks.org/wiki/Algorithm_Implementation/Miscellaneous/Base64
@@ -36,6 +37,216 @@ static const unsigned char dec[] =
 
 static const char enc[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
+/* Vector kernels encode and decode whole blocks ahead of the scalar code, which completes any
+ * remainder. Decoding stops at the first block containing whitespace, padding or invalid characters,
+ * leaving the scalar code to handle these. Kernels return the number of input bytes consumed, and
+ * as output never overtakes input when decoding, also decode in place. The x86 kernels (SSSE3 encoding
+ * and decoding per Wojciech Mula and Alfred Klomp, widened to AVX2) are selected at runtime, NEON when built
+ * for AArch64.
+ */
+
+typedef size_t (*iot_b64_encode_fn) (const uint8_t * in, size_t inLen, char * out);
+typedef size_t (*iot_b64_decode_fn) (const char * in, size_t inLen, uint8_t * out, size_t outLen);
+
+static size_t iot_b64_encode_none (const uint8_t * in, size_t inLen, char * out)
+{
+  (void) in;
+  (void) inLen;
+  (void) out;
+  return 0;
+}
+
+static size_t iot_b64_decode_none (const char * in, size_t inLen, uint8_t * out, size_t outLen)
+{
+  (void) in;
+  (void) inLen;
+  (void) out;
+  (void) outLen;
+  return 0;
+}
+
+#ifdef IOT_CPU_X86
+#include <immintrin.h>
+
+IOT_CPU_TARGET ("ssse3") static inline __m128i iot_b64_enc_translate_ssse3 (__m128i in)
+{
+  /* Reshuffle 12 bytes into 16 6-bit indices, then add offset to ASCII by index range */
+  in = _mm_shuffle_epi8 (in, _mm_set_epi8 (10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+  __m128i t0 = _mm_mulhi_epu16 (_mm_and_si128 (in, _mm_set1_epi32 (0x0fc0fc00)), _mm_set1_epi32 (0x04000040));
+  __m128i t1 = _mm_mullo_epi16 (_mm_and_si128 (in, _mm_set1_epi32 (0x003f03f0)), _mm_set1_epi32 (0x01000010));
+  __m128i idx = _mm_or_si128 (t0, t1);
+  __m128i lut = _mm_setr_epi8 (65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+  __m128i range = _mm_sub_epi8 (_mm_subs_epu8 (idx, _mm_set1_epi8 (51)), _mm_cmpgt_epi8 (idx, _mm_set1_epi8 (25)));
+  return _mm_add_epi8 (idx, _mm_shuffle_epi8 (lut, range));
+}
+
+IOT_CPU_TARGET ("ssse3") static inline bool iot_b64_dec_translate_ssse3 (__m128i * str)
+{
+  /* Validate and translate 16 characters to 6-bit values, then pack into 12 bytes */
+  const __m128i lut_lo = _mm_setr_epi8 (0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8 (0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8 (0x2f);
+  __m128i hi_nibbles = _mm_and_si128 (_mm_srli_epi32 (*str, 4), mask_2f);
+  __m128i lo_nibbles = _mm_and_si128 (*str, mask_2f);
+  __m128i hi = _mm_shuffle_epi8 (lut_hi, hi_nibbles);
+  __m128i lo = _mm_shuffle_epi8 (lut_lo, lo_nibbles);
+  if (_mm_movemask_epi8 (_mm_cmpgt_epi8 (_mm_and_si128 (lo, hi), _mm_setzero_si128 ()))) return false;
+  __m128i roll = _mm_shuffle_epi8 (lut_roll, _mm_add_epi8 (_mm_cmpeq_epi8 (*str, mask_2f), hi_nibbles));
+  __m128i val = _mm_add_epi8 (*str, roll);
+  val = _mm_madd_epi16 (_mm_maddubs_epi16 (val, _mm_set1_epi32 (0x01400140)), _mm_set1_epi32 (0x00011000));
+  *str = _mm_shuffle_epi8 (val, _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+  return true;
+}
+
+IOT_CPU_TARGET ("ssse3") static size_t iot_b64_encode_ssse3 (const uint8_t * in, size_t inLen, char * out)
+{
+  size_t i = 0;
+  for (; (i + 16u) <= inLen; i += 12u, out += 16)
+  {
+    _mm_storeu_si128 ((__m128i*) out, iot_b64_enc_translate_ssse3 (_mm_loadu_si128 ((const __m128i*) (in + i))));
+  }
+  return i;
+}
+
+IOT_CPU_TARGET ("ssse3") static size_t iot_b64_decode_ssse3 (const char * in, size_t inLen, uint8_t * out, size_t outLen)
+{
+  size_t i = 0;
+  for (; (i + 16u) <= inLen && 16u <= outLen; i += 16u, out += 12, outLen -= 12u)
+  {
+    __m128i str = _mm_loadu_si128 ((const __m128i*) (in + i));
+    if (! iot_b64_dec_translate_ssse3 (&str)) break;
+    _mm_storeu_si128 ((__m128i*) out, str);
+  }
+  return i;
+}
+
+IOT_CPU_TARGET ("avx2") static size_t iot_b64_encode_avx2 (const uint8_t * in, size_t inLen, char * out)
+{
+  const __m256i lut = _mm256_setr_epi8 (65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0, 65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+  const __m256i shuf = _mm256_setr_epi8 (1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  size_t i = 0;
+  for (; (i + 28u) <= inLen; i += 24u, out += 32)
+  {
+    __m256i v = _mm256_inserti128_si256 (_mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i*) (in + i))), _mm_loadu_si128 ((const __m128i*) (in + i + 12u)), 1);
+    v = _mm256_shuffle_epi8 (v, shuf);
+    __m256i t0 = _mm256_mulhi_epu16 (_mm256_and_si256 (v, _mm256_set1_epi32 (0x0fc0fc00)), _mm256_set1_epi32 (0x04000040));
+    __m256i t1 = _mm256_mullo_epi16 (_mm256_and_si256 (v, _mm256_set1_epi32 (0x003f03f0)), _mm256_set1_epi32 (0x01000010));
+    __m256i idx = _mm256_or_si256 (t0, t1);
+    __m256i range = _mm256_sub_epi8 (_mm256_subs_epu8 (idx, _mm256_set1_epi8 (51)), _mm256_cmpgt_epi8 (idx, _mm256_set1_epi8 (25)));
+    _mm256_storeu_si256 ((__m256i*) out, _mm256_add_epi8 (idx, _mm256_shuffle_epi8 (lut, range)));
+  }
+  return i + iot_b64_encode_ssse3 (in + i, inLen - i, out);
+}
+
+IOT_CPU_TARGET ("avx2") static size_t iot_b64_decode_avx2 (const char * in, size_t inLen, uint8_t * out, size_t outLen)
+{
+  const __m256i lut_lo = _mm256_setr_epi8 (0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+    0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i lut_hi = _mm256_setr_epi8 (0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i pack = _mm256_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i mask_2f = _mm256_set1_epi8 (0x2f);
+  size_t i = 0;
+  for (; (i + 32u) <= inLen && 32u <= outLen; i += 32u, out += 24, outLen -= 24u)
+  {
+    __m256i str = _mm256_loadu_si256 ((const __m256i*) (in + i));
+    __m256i hi_nibbles = _mm256_and_si256 (_mm256_srli_epi32 (str, 4), mask_2f);
+    __m256i lo = _mm256_shuffle_epi8 (lut_lo, _mm256_and_si256 (str, mask_2f));
+    __m256i hi = _mm256_shuffle_epi8 (lut_hi, hi_nibbles);
+    if (! _mm256_testz_si256 (lo, hi)) break;
+    __m256i roll = _mm256_shuffle_epi8 (lut_roll, _mm256_add_epi8 (_mm256_cmpeq_epi8 (str, mask_2f), hi_nibbles));
+    __m256i val = _mm256_add_epi8 (str, roll);
+    val = _mm256_madd_epi16 (_mm256_maddubs_epi16 (val, _mm256_set1_epi32 (0x01400140)), _mm256_set1_epi32 (0x00011000));
+    val = _mm256_shuffle_epi8 (val, pack);
+    _mm256_storeu_si256 ((__m256i*) out, _mm256_permutevar8x32_epi32 (val, _mm256_setr_epi32 (0, 1, 2, 4, 5, 6, 7, 7)));
+  }
+  return i + iot_b64_decode_ssse3 (in + i, inLen - i, out, outLen);
+}
+#endif
+
+#if defined (__aarch64__) && defined (__ARM_NEON)
+#include <arm_neon.h>
+
+static size_t iot_b64_encode_neon (const uint8_t * in, size_t inLen, char * out)
+{
+  const uint8x16x4_t lut = vld1q_u8_x4 ((const uint8_t*) enc);
+  const uint8x16_t mask = vdupq_n_u8 (0x3f);
+  size_t i = 0;
+  for (; (i + 48u) <= inLen; i += 48u, out += 64)
+  {
+    uint8x16x3_t src = vld3q_u8 (in + i);
+    uint8x16x4_t idx;
+    idx.val[0] = vshrq_n_u8 (src.val[0], 2);
+    idx.val[1] = vandq_u8 (vorrq_u8 (vshlq_n_u8 (src.val[0], 4), vshrq_n_u8 (src.val[1], 4)), mask);
+    idx.val[2] = vandq_u8 (vorrq_u8 (vshlq_n_u8 (src.val[1], 2), vshrq_n_u8 (src.val[2], 6)), mask);
+    idx.val[3] = vandq_u8 (src.val[2], mask);
+    for (unsigned j = 0; j < 4; j++) idx.val[j] = vqtbl4q_u8 (lut, idx.val[j]);
+    vst4q_u8 ((uint8_t*) out, idx);
+  }
+  return i;
+}
+
+static size_t iot_b64_decode_neon (const char * in, size_t inLen, uint8_t * out, size_t outLen)
+{
+  const uint8x16x4_t lut_lo = vld1q_u8_x4 (dec);
+  const uint8x16x4_t lut_hi = vld1q_u8_x4 (dec + 64);
+  const uint8x16_t offset = vdupq_n_u8 (64);
+  size_t i = 0;
+  for (; (i + 64u) <= inLen && 48u <= outLen; i += 64u, out += 48, outLen -= 48u)
+  {
+    uint8x16x4_t str = vld4q_u8 ((const uint8_t*) in + i);
+    uint8x16_t invalid = vdupq_n_u8 (0);
+    for (unsigned j = 0; j < 4; j++)
+    {
+      uint8x16_t c = str.val[j];
+      str.val[j] = vqtbx4q_u8 (vqtbl4q_u8 (lut_lo, c), lut_hi, vsubq_u8 (c, offset));
+      invalid = vorrq_u8 (invalid, vorrq_u8 (vcgeq_u8 (str.val[j], offset), vcgeq_u8 (c, vdupq_n_u8 (128))));
+    }
+    if (vmaxvq_u8 (invalid)) break;
+    uint8x16x3_t dst;
+    dst.val[0] = vorrq_u8 (vshlq_n_u8 (str.val[0], 2), vshrq_n_u8 (str.val[1], 4));
+    dst.val[1] = vorrq_u8 (vshlq_n_u8 (str.val[1], 4), vshrq_n_u8 (str.val[2], 2));
+    dst.val[2] = vorrq_u8 (vshlq_n_u8 (str.val[2], 6), str.val[3]);
+    vst3q_u8 (out, dst);
+  }
+  return i;
+}
+#endif
+
+static iot_b64_encode_fn iot_b64_encode_blocks = iot_b64_encode_none;
+static iot_b64_decode_fn iot_b64_decode_blocks = iot_b64_decode_none;
+
+void iot_b64_select (uint32_t features)
+{
+  iot_b64_encode_blocks = iot_b64_encode_none;
+  iot_b64_decode_blocks = iot_b64_decode_none;
+#ifdef IOT_CPU_X86
+  if (features & IOT_CPU_AVX2)
+  {
+    iot_b64_encode_blocks = iot_b64_encode_avx2;
+    iot_b64_decode_blocks = iot_b64_decode_avx2;
+  }
+  else if (features & IOT_CPU_SSSE3)
+  {
+    iot_b64_encode_blocks = iot_b64_encode_ssse3;
+    iot_b64_decode_blocks = iot_b64_decode_ssse3;
+  }
+#elif defined (__aarch64__) && defined (__ARM_NEON)
+  if (features & IOT_CPU_NEON)
+  {
+    iot_b64_encode_blocks = iot_b64_encode_neon;
+    iot_b64_decode_blocks = iot_b64_decode_neon;
+  }
+#endif
+}
+
+__attribute__((constructor)) static void iot_b64_init (void)
+{
+  iot_b64_select (iot_cpu_features ());
+}
+
 size_t iot_b64_encodesize (size_t binsize)
 {
   size_t result = binsize / 3 * 4;    // Four chars per three bytes
@@ -49,12 +260,14 @@ size_t iot_b64_maxdecodesize (const char *in)
   return (inLen % 4) ? inLen / 4 * 3 + 2 : inLen / 4 * 3;
 }
 
-bool iot_b64_decode (const char *in, void *outv, size_t *outLen)
+static bool iot_b64_decode_len (const char *in, size_t inLen, uint8_t *out, size_t *outLen)
 {
-  uint8_t *out = (uint8_t *) outv;
   int iter = 0;
   uint32_t buf = 0;
-  size_t len = 0;
+  size_t done = iot_b64_decode_blocks (in, inLen, out, *outLen);
+  size_t len = done / 4 * 3;
+  in += done;
+  out += len;
 
   while (*in)
   {
@@ -94,16 +307,29 @@ bool iot_b64_decode (const char *in, void *outv, size_t *outLen)
   return true;
 }
 
+bool iot_b64_decode (const char *in, void *out, size_t *outLen)
+{
+  return iot_b64_decode_len (in, strlen (in), (uint8_t *) out, outLen);
+}
+
+bool iot_b64_decode_in_place (char *str, size_t *outLen)
+{
+  size_t len = strlen (str);
+  *outLen = len;
+  return iot_b64_decode_len (str, len, (uint8_t *) str, outLen);
+}
+
 bool iot_b64_encode (const void *in, size_t inLen, char *out, size_t outLen)
 {
   bool ok = outLen >= iot_b64_encodesize (inLen);
   if (ok)
   {
     const uint8_t *data = (const uint8_t *) in;
-    size_t resultIndex = 0;
+    size_t done = iot_b64_encode_blocks (data, inLen, out);
+    size_t resultIndex = done / 3 * 4;
 
-    /* iterate over the length of the string, three characters at a time */
-    for (size_t x = 0; x < inLen; x += 3)
+    /* iterate over the remaining length of the string, three characters at a time */
+    for (size_t x = done; x < inLen; x += 3)
     {
       /* combine up to three bytes into 24 bits */
       uint32_t n = ((uint32_t) data[x]) << 16;
@@ -0,0 +1,580 @@
+//
+// Copyright (c) 2024 IOTech
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+
+#include "iot/bus.h"
+#include "iot/container.h"
+#include "iot/queue.h"
+#include "iot/thread.h"
+
+#define IOT_BUS_BATCH 64u                // Maximum messages delivered by a subscriber job before resubmitting
+#define IOT_BUS_INTERVAL_DEFAULT 1000u   // Default polled publisher interval in ms (component configuration)
+
+#ifdef IOT_BUILD_COMPONENTS
+#define IOT_BUS_FACTORY iot_bus_factory ()
+#else
+#define IOT_BUS_FACTORY NULL
+#endif
+
+// Topic split into levels, pointing into a copy of the topic with separators replaced by terminators
+
+typedef struct iot_bus_topic_t
+{
+  char * str;                        // Copy of topic, split into levels
+  const char ** levels;              // Topic levels
+  uint32_t count;                    // Number of levels
+} iot_bus_topic_t;
+
+// Subscription trie node. Each subscriber is held at the node for its topic, nodes are freed with the bus.
+
+typedef struct iot_bus_node_t
+{
+  iot_data_t * children;             // Map of child nodes keyed by topic level, NULL if none
+  struct iot_bus_node_t * any;       // Child node for single level wildcard, NULL if none
+  iot_bus_sub_t * subs;              // Subscribers with topics ending at this node
+  iot_bus_sub_t * rest;              // Subscribers with a multi level wildcard following this node
+} iot_bus_node_t;
+
+// Subscribers are reference counted, as they are referenced by publisher match caches and queued delivery jobs
+
+struct iot_bus_sub_t
+{
+  iot_bus_t * bus;                   // Owning bus
+  iot_bus_sub_fn_t callback;         // Delivery callback
+  void * self;                       // Callback self pointer
+  iot_bus_topic_t pattern;           // Subscription topic
+  iot_queue_t * queue;               // Queued messages, NULL if callbacks are run by publishers
+  iot_threadpool_t * pool;           // Thread pool running delivery jobs
+  iot_bus_sub_t * next;              // Next subscriber at trie node
+  iot_bus_sub_t * link;              // Next subscriber of bus
+  atomic_bool scheduled;             // Whether a delivery job is queued or running
+  atomic_bool removed;               // Whether the subscriber has been freed
+  _Atomic uint64_t delivered;        // Number of messages delivered
+  _Atomic uint64_t dropped;          // Number of messages dropped as queue full
+  atomic_int_fast32_t refs;          // Current reference count
+};
+
+// Publishers are reference counted, as they are referenced by their poll schedule
+
+struct iot_bus_pub_t
+{
+  iot_bus_t * bus;                   // Owning bus, NULL once freed
+  iot_bus_pub_fn_t callback;         // Poll callback, NULL if not polled
+  void * self;                       // Callback self pointer
+  iot_bus_topic_t topic;             // Publication topic
+  iot_data_t * name;                 // Publication topic, shared by published messages
+  iot_schedule_t * schedule;         // Poll schedule, NULL if not polled
+  iot_bus_pub_t * link;              // Next publisher of bus
+  pthread_mutex_t mutex;             // Serialises publishing and guards the match cache
+  uint64_t gen;                      // Subscription generation of match cache
+  iot_bus_sub_t ** matched;          // Match cache, subscribers matching the topic
+  uint32_t count;                    // Number of matching subscribers
+  uint32_t size;                     // Allocated size of match cache
+  atomic_int_fast32_t refs;          // Current reference count
+};
+
+struct iot_bus_t
+{
+  iot_component_t component;         // Component base type
+  iot_scheduler_t * scheduler;       // Scheduler polling publishers
+  iot_threadpool_t * pool;           // Thread pool running subscriber callbacks, NULL to run in publisher
+  iot_bus_node_t * root;             // Subscription trie
+  iot_bus_pub_t * pubs;              // Publishers
+  iot_bus_sub_t * subs;              // Subscribers
+  uint64_t interval;                 // Publisher poll interval in ns
+  uint32_t queue_size;               // Subscriber queue size
+  uint32_t pub_count;                // Number of publishers
+  uint32_t sub_count;                // Number of subscribers
+  atomic_bool running;               // Whether data can be published
+  _Atomic uint64_t gen;              // Subscription generation, incremented when subscriptions change
+  _Atomic uint64_t published;        // Number of messages published
+};
+
+static bool iot_bus_topic_init (iot_bus_topic_t * topic, const char * str, bool wildcards)
+{
+  uint32_t count = 1u;
+  if (str == NULL || *str == '\0') return false;
+  for (const char * c = str; *c; c++) if (*c == '/') count++;
+  topic->str = strdup (str);
+  topic->levels = malloc (count * sizeof (*topic->levels));
+  topic->count = count;
+  char * level = topic->str;
+  bool valid = true;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    char * sep = strchr (level, '/');
+    topic->levels[i] = level;
+    if (sep) *sep = '\0';
+    if (strpbrk (level, "+#"))
+    {
+      // Wildcards must be a complete level, multi level wildcard must be the last level
+      valid = valid && wildcards && level[1] == '\0' && (level[0] == '+' || i == count - 1u);
+    }
+    if (sep) level = sep + 1;
+  }
+  if (! valid)
+  {
+    free (topic->levels);
+    free (topic->str);
+  }
+  return valid;
+}
+
+static inline void iot_bus_topic_fini (iot_bus_topic_t * topic)
+{
+  free (topic->levels);
+  free (topic->str);
+}
+
+static void iot_bus_node_free (void * arg)
+{
+  iot_bus_node_t * node = (iot_bus_node_t*) arg;
+  if (node)
+  {
+    iot_data_free (node->children);
+    iot_bus_node_free (node->any);
+    free (node);
+  }
+}
+
+// Find the subscriber list for a subscription topic, creating trie nodes if required. Called with bus locked.
+
+static iot_bus_sub_t ** iot_bus_node_list (iot_bus_t * bus, const iot_bus_topic_t * pattern)
+{
+  iot_bus_node_t * node = bus->root;
+  for (uint32_t i = 0; i < pattern->count; i++)
+  {
+    const char * level = pattern->levels[i];
+    if (strcmp (level, "#") == 0) return &node->rest;
+    if (strcmp (level, "+") == 0)
+    {
+      if (node->any == NULL) node->any = calloc (1u, sizeof (iot_bus_node_t));
+      node = node->any;
+      continue;
+    }
+    if (node->children == NULL) node->children = iot_data_alloc_map (IOT_DATA_STRING);
+    const iot_data_t * child = iot_data_string_map_get (node->children, level);
+    if (child)
+    {
+      node = (iot_bus_node_t*) iot_data_pointer (child);
+    }
+    else
+    {
+      iot_bus_node_t * created = calloc (1u, sizeof (iot_bus_node_t));
+      iot_data_map_add (node->children, iot_data_alloc_string (level, IOT_DATA_COPY), iot_data_alloc_pointer (created, iot_bus_node_free));
+      node = created;
+    }
+  }
+  return &node->subs;
+}
+
+static inline void iot_bus_sub_add_ref (iot_bus_sub_t * sub)
+{
+  atomic_fetch_add (&sub->refs, 1u);
+}
+
+static void iot_bus_sub_release (iot_bus_sub_t * sub)
+{
+  if (atomic_fetch_sub (&sub->refs, 1u) <= 1u)
+  {
+    iot_queue_free (sub->queue);
+    iot_threadpool_free (sub->pool);
+    iot_bus_topic_fini (&sub->pattern);
+    free (sub);
+  }
+}
+
+static void iot_bus_match_add (iot_bus_pub_t * pub, iot_bus_sub_t * sub)
+{
+  for (; sub; sub = sub->next)
+  {
+    if (pub->count == pub->size)
+    {
+      pub->size = pub->size ? pub->size * 2u : 4u;
+      pub->matched = realloc (pub->matched, pub->size * sizeof (*pub->matched));
+    }
+    iot_bus_sub_add_ref (sub);
+    pub->matched[pub->count++] = sub;
+  }
+}
+
+// Add the subscribers matching a publisher topic to its match cache, walking the trie from a node. Called with bus locked.
+
+static void iot_bus_match_node (iot_bus_pub_t * pub, const iot_bus_node_t * node, uint32_t depth)
+{
+  iot_bus_match_add (pub, node->rest);
+  if (depth == pub->topic.count)
+  {
+    iot_bus_match_add (pub, node->subs);
+    return;
+  }
+  const iot_data_t * child = node->children ? iot_data_string_map_get (node->children, pub->topic.levels[depth]) : NULL;
+  if (child) iot_bus_match_node (pub, (const iot_bus_node_t*) iot_data_pointer (child), depth + 1u);
+  if (node->any) iot_bus_match_node (pub, node->any, depth + 1u);
+}
+
+static void iot_bus_match_clear (iot_bus_pub_t * pub)
+{
+  for (uint32_t i = 0; i < pub->count; i++) iot_bus_sub_release (pub->matched[i]);
+  pub->count = 0u;
+}
+
+// Rebuild a publisher match cache. Called with publisher locked.
+
+static void iot_bus_match (iot_bus_pub_t * pub)
+{
+  iot_bus_t * bus = pub->bus;
+  iot_bus_match_clear (pub);
+  iot_component_lock (&bus->component);
+  iot_bus_match_node (pub, bus->root, 0u);
+  pub->gen = atomic_load (&bus->gen);
+  iot_component_unlock (&bus->component);
+}
+
+static void * iot_bus_sub_run (void * arg)
+{
+  iot_bus_sub_t * sub = (iot_bus_sub_t*) arg;
+  while (true)
+  {
+    iot_data_t * msg;
+    uint32_t count = 0u;
+    while (count++ < IOT_BUS_BATCH && (msg = iot_queue_try_dequeue (sub->queue)))
+    {
+      if (! atomic_load (&sub->removed))
+      {
+        sub->callback ((iot_data_t*) iot_data_vector_get (msg, 1u), sub->self, iot_data_string (iot_data_vector_get (msg, 0u)));
+        atomic_fetch_add (&sub->delivered, 1u);
+      }
+      iot_data_free (msg);
+    }
+    atomic_store (&sub->scheduled, false);
+    // Messages queued after the last dequeue, but before the scheduled flag was cleared, are not otherwise delivered
+    if (iot_queue_size (sub->queue) == 0u || atomic_exchange (&sub->scheduled, true)) break;
+    if (iot_threadpool_try_work (sub->pool, iot_bus_sub_run, sub, IOT_THREAD_NO_PRIORITY)) return NULL; // Yield to other jobs
+  }
+  iot_bus_sub_release (sub);
+  return NULL;
+}
+
+static bool iot_bus_sub_enqueue (iot_bus_sub_t * sub, iot_data_t * msg, bool sync)
+{
+  if (atomic_load (&sub->removed)) return true;
+  iot_data_add_ref (msg);
+  bool queued = iot_queue_try_enqueue (sub->queue, msg);
+  if (! queued && sync)
+  {
+    iot_queue_enqueue (sub->queue, msg); // Queue never stopped, so waits until a delivery job takes a message
+    queued = true;
+  }
+  if (queued)
+  {
+    if (! atomic_exchange (&sub->scheduled, true))
+    {
+      iot_bus_sub_add_ref (sub);
+      iot_threadpool_add_work (sub->pool, iot_bus_sub_run, sub, IOT_THREAD_NO_PRIORITY);
+    }
+  }
+  else
+  {
+    iot_data_free (msg);
+    atomic_fetch_add (&sub->dropped, 1u);
+  }
+  return queued;
+}
+
+// Publish data to matching subscribers. Called with publisher locked.
+
+static bool iot_bus_pub_send (iot_bus_pub_t * pub, iot_data_t * data, bool sync)
+{
+  iot_bus_t * bus = pub->bus;
+  bool result = false;
+  if (bus && atomic_load (&bus->running))
+  {
+    result = true;
+    if (pub->gen != atomic_load (&bus->gen)) iot_bus_match (pub);
+    atomic_fetch_add (&bus->published, 1u);
+    if (bus->pool && pub->count)
+    {
+      // Message is a topic and data pair, queued by reference for each subscriber
+      iot_data_t * msg = iot_data_alloc_vector (2u);
+      iot_data_vector_add (msg, 0u, iot_data_add_ref (pub->name));
+      iot_data_vector_add (msg, 1u, data);
+      data = msg;
+      for (uint32_t i = 0; i < pub->count; i++) result = iot_bus_sub_enqueue (pub->matched[i], msg, sync) && result;
+    }
+    else
+    {
+      for (uint32_t i = 0; i < pub->count; i++)
+      {
+        iot_bus_sub_t * sub = pub->matched[i];
+        if (! atomic_load (&sub->removed))
+        {
+          sub->callback (data, sub->self, iot_data_string (pub->name));
+          atomic_fetch_add (&sub->delivered, 1u);
+        }
+      }
+    }
+  }
+  iot_data_free (data);
+  return result;
+}
+
+static void * iot_bus_pub_poll (void * arg)
+{
+  iot_bus_pub_t * pub = (iot_bus_pub_t*) arg;
+  pthread_mutex_lock (&pub->mutex);
+  if (pub->bus && atomic_load (&pub->bus->running))
+  {
+    iot_data_t * data = pub->callback (pub->self);
+    if (data) iot_bus_pub_send (pub, data, false);
+  }
+  pthread_mutex_unlock (&pub->mutex);
+  return NULL;
+}
+
+static void iot_bus_pub_release (void * arg)
+{
+  iot_bus_pub_t * pub = (iot_bus_pub_t*) arg;
+  if (atomic_fetch_sub (&pub->refs, 1u) <= 1u)
+  {
+    iot_data_free (pub->name);
+    iot_bus_topic_fini (&pub->topic);
+    free (pub->matched);
+    pthread_mutex_destroy (&pub->mutex);
+    free (pub);
+  }
+}
+
+// Detach a publisher from its bus. A running poll completes before the publisher is detached.
+
+static void iot_bus_pub_close (iot_bus_pub_t * pub)
+{
+  iot_scheduler_t * scheduler = pub->bus->scheduler;
+  pthread_mutex_lock (&pub->mutex);
+  pub->bus = NULL;
+  iot_bus_match_clear (pub);
+  pthread_mutex_unlock (&pub->mutex);
+  if (pub->schedule) iot_schedule_delete (scheduler, pub->schedule);
+  iot_bus_pub_release (pub);
+}
+
+iot_bus_t * iot_bus_alloc (iot_scheduler_t * scheduler, iot_threadpool_t * pool, uint64_t interval)
+{
+  iot_bus_t * bus = (iot_bus_t*) calloc (1u, sizeof (*bus));
+  iot_component_init (&bus->component, IOT_BUS_FACTORY, (iot_component_start_fn_t) iot_bus_start, (iot_component_stop_fn_t) iot_bus_stop);
+  iot_component_set_stats_callback (&bus->component, (iot_component_stats_fn_t) iot_bus_stats);
+  bus->root = calloc (1u, sizeof (iot_bus_node_t));
+  bus->scheduler = scheduler;
+  bus->pool = pool;
+  bus->interval = interval;
+  bus->queue_size = IOT_BUS_QUEUE_DEFAULT;
+  iot_scheduler_add_ref (scheduler);
+  iot_threadpool_add_ref (pool);
+  return bus;
+}
+
+void iot_bus_add_ref (iot_bus_t * bus)
+{
+  if (bus) iot_component_add_ref (&bus->component);
+}
+
+void iot_bus_start (iot_bus_t * bus)
+{
+  assert (bus);
+  iot_component_set_running (&bus->component);
+  atomic_store (&bus->running, true);
+}
+
+void iot_bus_stop (iot_bus_t * bus)
+{
+  assert (bus);
+  atomic_store (&bus->running, false);
+  iot_component_set_stopped (&bus->component);
+}
+
+void iot_bus_set_queue_size (iot_bus_t * bus, uint32_t size)
+{
+  assert (bus && size);
+  iot_component_lock (&bus->component);
+  bus->queue_size = size;
+  iot_component_unlock (&bus->component);
+}
+
+iot_bus_sub_t * iot_bus_sub_alloc (iot_bus_t * bus, void * self, iot_bus_sub_fn_t callback, const char * pattern)
+{
+  assert (bus && callback);
+  iot_bus_sub_t * sub = (iot_bus_sub_t*) calloc (1u, sizeof (*sub));
+  if (! iot_bus_topic_init (&sub->pattern, pattern, true))
+  {
+    free (sub);
+    return NULL;
+  }
+  sub->bus = bus;
+  sub->callback = callback;
+  sub->self = self;
+  sub->pool = bus->pool;
+  atomic_store (&sub->refs, 1u);
+  iot_threadpool_add_ref (sub->pool);
+  iot_component_lock (&bus->component);
+  if (sub->pool) sub->queue = iot_queue_alloc_ring (bus->queue_size);
+  iot_bus_sub_t ** list = iot_bus_node_list (bus, &sub->pattern);
+  sub->next = *list;
+  *list = sub;
+  sub->link = bus->subs;
+  bus->subs = sub;
+  bus->sub_count++;
+  atomic_fetch_add (&bus->gen, 1u);
+  iot_component_unlock (&bus->component);
+  return sub;
+}
+
+void iot_bus_sub_free (iot_bus_sub_t * sub)
+{
+  if (sub)
+  {
+    iot_bus_t * bus = sub->bus;
+    iot_component_lock (&bus->component);
+    iot_bus_sub_t ** prev = iot_bus_node_list (bus, &sub->pattern);
+    while (*prev != sub) prev = &(*prev)->next;
+    *prev = sub->next;
+    prev = &bus->subs;
+    while (*prev != sub) prev = &(*prev)->link;
+    *prev = sub->link;
+    bus->sub_count--;
+    atomic_fetch_add (&bus->gen, 1u);
+    iot_component_unlock (&bus->component);
+    atomic_store (&sub->removed, true);
+    iot_bus_sub_release (sub);
+  }
+}
+
+iot_bus_pub_t * iot_bus_pub_alloc (iot_bus_t * bus, void * self, iot_bus_pub_fn_t callback, const char * topic)
+{
+  assert (bus);
+  iot_bus_pub_t * pub = (iot_bus_pub_t*) calloc (1u, sizeof (*pub));
+  if (! iot_bus_topic_init (&pub->topic, topic, false))
+  {
+    free (pub);
+    return NULL;
+  }
+  pub->bus = bus;
+  pub->callback = callback;
+  pub->self = self;
+  pub->name = iot_data_alloc_string (topic, IOT_DATA_COPY);
+  pub->gen = UINT64_MAX;
+  atomic_store (&pub->refs, 1u);
+  iot_mutex_init (&pub->mutex);
+  if (callback && bus->scheduler)
+  {
+    atomic_fetch_add (&pub->refs, 1u); // Reference held by poll schedule
+    pub->schedule = iot_schedule_create (bus->scheduler, iot_bus_pub_poll, iot_bus_pub_release, pub, bus->interval, bus->interval, 0u, NULL, IOT_THREAD_NO_PRIORITY);
+    iot_schedule_add (bus->scheduler, pub->schedule);
+  }
+  iot_component_lock (&bus->component);
+  pub->link = bus->pubs;
+  bus->pubs = pub;
+  bus->pub_count++;
+  iot_component_unlock (&bus->component);
+  return pub;
+}
+
+void iot_bus_pub_free (iot_bus_pub_t * pub)
+{
+  if (pub)
+  {
+    iot_bus_t * bus = pub->bus;
+    iot_component_lock (&bus->component);
+    iot_bus_pub_t ** prev = &bus->pubs;
+    while (*prev != pub) prev = &(*prev)->link;
+    *prev = pub->link;
+    bus->pub_count--;
+    iot_component_unlock (&bus->component);
+    iot_bus_pub_close (pub);
+  }
+}
+
+bool iot_bus_pub_push (iot_bus_pub_t * pub, iot_data_t * data, bool sync)
+{
+  assert (pub && data);
+  pthread_mutex_lock (&pub->mutex);
+  bool result = iot_bus_pub_send (pub, data, sync);
+  pthread_mutex_unlock (&pub->mutex);
+  return result;
+}
+
+iot_data_t * iot_bus_stats (iot_bus_t * bus)
+{
+  assert (bus);
+  uint64_t delivered = 0u;
+  uint64_t dropped = 0u;
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_component_lock (&bus->component);
+  for (const iot_bus_sub_t * sub = bus->subs; sub; sub = sub->link)
+  {
+    delivered += atomic_load (&sub->delivered);
+    dropped += atomic_load (&sub->dropped);
+  }
+  iot_data_string_map_add (map, "publishers", iot_data_alloc_ui32 (bus->pub_count));
+  iot_data_string_map_add (map, "subscribers", iot_data_alloc_ui32 (bus->sub_count));
+  iot_component_unlock (&bus->component);
+  iot_data_string_map_add (map, "published", iot_data_alloc_ui64 (atomic_load (&bus->published)));
+  iot_data_string_map_add (map, "delivered", iot_data_alloc_ui64 (delivered));
+  iot_data_string_map_add (map, "dropped", iot_data_alloc_ui64 (dropped));
+  return map;
+}
+
+void iot_bus_free (iot_bus_t * bus)
+{
+  if (bus && iot_component_dec_ref (&bus->component))
+  {
+    atomic_store (&bus->running, false);
+    while (bus->pubs)
+    {
+      iot_bus_pub_t * pub = bus->pubs;
+      bus->pubs = pub->link;
+      iot_bus_pub_close (pub);
+    }
+    while (bus->subs)
+    {
+      iot_bus_sub_t * sub = bus->subs;
+      bus->subs = sub->link;
+      atomic_store (&sub->removed, true);
+      iot_bus_sub_release (sub);
+    }
+    iot_bus_node_free (bus->root);
+    iot_scheduler_free (bus->scheduler);
+    iot_threadpool_free (bus->pool);
+    iot_component_fini (&bus->component);
+    free (bus);
+  }
+}
+
+#ifdef IOT_BUILD_COMPONENTS
+
+static iot_component_t * iot_bus_config (iot_container_t * cont, const iot_data_t * map)
+{
+  iot_scheduler_t * scheduler = (iot_scheduler_t*) iot_container_find_component (cont, iot_data_string_map_get_string (map, "Scheduler"));
+  iot_threadpool_t * pool = (iot_threadpool_t*) iot_container_find_component (cont, iot_data_string_map_get_string (map, "ThreadPool"));
+  uint64_t interval = (uint64_t) iot_data_string_map_get_i64 (map, "Interval", IOT_BUS_INTERVAL_DEFAULT);
+  iot_bus_t * bus = iot_bus_alloc (scheduler, pool, IOT_MS_TO_NS (interval));
+  iot_bus_set_queue_size (bus, (uint32_t) iot_data_string_map_get_i64 (map, "QueueSize", IOT_BUS_QUEUE_DEFAULT));
+  return (iot_component_t*) bus;
+}
+
+const iot_component_factory_t * iot_bus_factory (void)
+{
+  static iot_component_factory_t factory =
+  {
+    IOT_BUS_TYPE,
+    IOT_CATEGORY_CORE,
+    iot_bus_config,
+    (iot_component_free_fn_t) iot_bus_free,
+    NULL,
+    NULL
+  };
+  return &factory;
+}
+
+#endif
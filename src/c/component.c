@@ -8,6 +8,7 @@
 #include "iot/container.h"
 #include "iot/component.h"
 #include "iot/thread.h"
+#include "stats-impl.h"
 
 #ifdef NDEBUG
 #define IOT_RET_CHECK(n) n
@@ -21,6 +22,7 @@ void iot_component_init (iot_component_t * component, const iot_component_factor
   component->start_fn = start;
   component->stop_fn = stop;
   component->factory = factory;
+  component->stats_fn = NULL;
   iot_mutex_init (&component->mutex);
   pthread_cond_init (&component->cond, NULL);
   atomic_store (&component->refs, 1u);
@@ -32,6 +34,12 @@ void iot_component_set_running_callback (iot_component_t * component, iot_compon
   component->running_fn = fn;
 }
 
+void iot_component_set_stats_callback (iot_component_t * component, iot_component_stats_fn_t fn)
+{
+  assert (component);
+  component->stats_fn = fn;
+}
+
 void iot_component_set_stopping_callback (iot_component_t * component, iot_component_stopping_fn_t fn)
 {
   assert (component);
@@ -48,18 +56,36 @@ bool iot_component_reconfig (iot_component_t * component, iot_container_t * cont
 {
   bool ok = true;
   assert (component && cont && map);
-  if (component->factory->reconfig_fn) ok = (component->factory->reconfig_fn) (component, cont, map);
-  if (ok)
+  const iot_component_factory_t * factory = component->factory;
+  iot_data_t * updated = iot_data_copy (component->config);
+  iot_data_map_merge (updated, map);
+  iot_data_t * delta = iot_data_diff (component->config, updated);
+  if (! iot_data_diff_empty (delta)) // Only reconfigure if configuration changed
   {
-    const iot_container_config_t * config = iot_container_get_config ();
-    iot_data_map_merge (component->config, map);
-    if (config->save)
+    if (factory->reconfig_delta_fn)
+    {
+      ok = (factory->reconfig_delta_fn) (component, cont, updated, delta);
+    }
+    else if (factory->reconfig_fn)
     {
-      char * json = iot_data_to_json (component->config);
-      (config->save) (component->name, config->uri, json);
-      free (json);
+      ok = (factory->reconfig_fn) (component, cont, map);
+    }
+    if (ok)
+    {
+      const iot_container_config_t * config = iot_container_get_config ();
+      iot_data_free (component->config);
+      component->config = updated;
+      updated = NULL;
+      if (config && config->save)
+      {
+        char * json = iot_data_to_json (component->config);
+        (config->save) (component->name, config->uri, json);
+        free (json);
+      }
     }
   }
+  iot_data_free (updated);
+  iot_data_free (delta);
   return ok;
 }
 
@@ -98,17 +124,27 @@ static bool iot_component_set_state (iot_component_t * component, uint32_t state
   if (valid)
   {
     changed = component->state != state;
-    component->state = state;
+    atomic_store_explicit (&component->state, state, memory_order_release);
     IOT_RET_CHECK (pthread_cond_broadcast (&component->cond));
   }
   IOT_RET_CHECK (pthread_mutex_unlock (&component->mutex));
   return changed;
 }
 
+iot_component_state_t iot_component_get_state (const iot_component_t * component)
+{
+  assert (component);
+  return atomic_load_explicit (&component->state, memory_order_acquire);
+}
+
 extern iot_component_state_t iot_component_wait (iot_component_t * component, uint32_t states)
 {
-  iot_component_state_t state = iot_component_wait_and_lock (component, states);
-  IOT_RET_CHECK (pthread_mutex_unlock (&component->mutex));
+  iot_component_state_t state = iot_component_get_state (component);
+  if ((state & states) == 0) // Only lock if not already in a required state
+  {
+    state = iot_component_wait_and_lock (component, states);
+    IOT_RET_CHECK (pthread_mutex_unlock (&component->mutex));
+  }
   return state;
 }
 
@@ -116,6 +152,12 @@ extern iot_component_state_t iot_component_wait_and_lock (iot_component_t * comp
 {
   assert (component);
   IOT_RET_CHECK (pthread_mutex_lock (&component->mutex));
+  return iot_component_wait_locked (component, states);
+}
+
+iot_component_state_t iot_component_wait_locked (iot_component_t * component, uint32_t states)
+{
+  assert (component);
   while ((component->state & states) == 0)
   {
     pthread_cond_wait (&component->cond, &component->mutex);
@@ -167,9 +209,27 @@ extern iot_data_t * iot_component_read (iot_component_t * component)
   iot_data_map_add (data, IOT_DATA_STATIC (&iot_data_consts.config), iot_data_add_ref (component->config));
   if (component->factory->category) iot_data_map_add (data, IOT_DATA_STATIC (&iot_data_consts.category), iot_data_alloc_string (component->factory->category, IOT_DATA_REF));
   pthread_mutex_unlock (&component->mutex);
+  if (component->stats_fn) iot_data_string_map_add (data, "stats", (component->stats_fn) (component)); // Called unlocked as may take component lock
   return data;
 }
 
+iot_data_t * iot_stats_hist_data (const iot_stats_hist_t * hist)
+{
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+  uint64_t * buckets = malloc (IOT_STATS_BUCKETS * sizeof (uint64_t));
+  uint64_t count = 0u;
+  for (uint32_t i = 0; i < IOT_STATS_BUCKETS; i++)
+  {
+    buckets[i] = atomic_load_explicit (&hist->buckets[i], memory_order_relaxed);
+    count += buckets[i];
+  }
+  iot_data_string_map_add (map, "count", iot_data_alloc_ui64 (count));
+  iot_data_string_map_add (map, "total_ns", iot_data_alloc_ui64 (atomic_load_explicit (&hist->total, memory_order_relaxed)));
+  iot_data_string_map_add (map, "max_ns", iot_data_alloc_ui64 (atomic_load_explicit (&hist->max, memory_order_relaxed)));
+  iot_data_string_map_add (map, "buckets", iot_data_alloc_array (buckets, IOT_STATS_BUCKETS, IOT_DATA_UINT64, IOT_DATA_TAKE));
+  return map;
+}
+
 extern const char * iot_component_state_name (iot_component_state_t state)
 {
   switch (state)
@@ -14,72 +14,87 @@ typedef struct iot_parsed_holder_t
   size_t len;
 } iot_parsed_holder_t;
 
-static const iot_data_t * iot_config_get_type (const iot_data_t * map, const char * key, iot_data_type_t type, iot_logger_t * logger)
+static const iot_data_t * iot_config_get_type (const iot_data_t * map, const iot_data_t * key, iot_data_type_t type, iot_logger_t * logger)
 {
   assert (map && key);
-  const iot_data_t * data = iot_data_string_map_get (map, key);
-  if (iot_data_type (data) != type)
+  const iot_data_t * data = iot_data_map_get_typed (map, key, type);
+  if (data == NULL)
   {
     if (logger == NULL) logger = iot_logger_default ();
-    iot_log_error (logger, "Failed to resolve %s configuration value for: %s", iot_data_type_string (type), key);
-    data = NULL;
+    iot_log_error (logger, "Failed to resolve %s configuration value for: %s", iot_data_type_string (type), iot_data_string (key));
   }
   return data;
 }
 
-static bool iot_config_cast (const iot_data_t * map, const char * key, void * val, iot_data_type_t type, iot_logger_t * logger)
+static bool iot_config_cast (const iot_data_t * map, const iot_data_t * key, void * val, iot_data_type_t type, iot_logger_t * logger)
 {
   assert (map && key && val);
-  const iot_data_t * data = iot_data_string_map_get (map, key);
+  const iot_data_t * data = iot_data_map_get (map, key);
   bool ret = (data && iot_data_cast (data, type, val));
   if (! ret)
   {
-    iot_log_error (logger, "Failed to resolve %s configuration value for: %s", iot_data_type_string (type), key);
+    iot_log_error (logger, "Failed to resolve %s configuration value for: %s", iot_data_type_string (type), iot_data_string (key));
   }
   return ret;
 }
 
+static const char * iot_config_get_string (const iot_data_t * map, const iot_data_t * key, bool alloc, iot_logger_t * logger)
+{
+  const iot_data_t * data = iot_config_get_type (map, key, IOT_DATA_STRING, logger);
+  const char * val = NULL;
+
+  if (data)
+  {
+    val = iot_data_string (data);
+    if (alloc) val = strdup (val);
+  }
+  return val;
+}
+
+// Key name lookups wrap the name in a temporary constant string, as for iot_data_string_map_get
+
+#define IOT_CONFIG_KEY(k) iot_data_alloc_const_string (&(iot_data_static_t) { 0 }, k)
+
 bool iot_config_i64 (const iot_data_t * map, const char * key, int64_t * val, iot_logger_t * logger)
 {
-  return iot_config_cast (map, key, val, IOT_DATA_INT64, logger);
+  assert (key);
+  return iot_config_cast (map, IOT_CONFIG_KEY (key), val, IOT_DATA_INT64, logger);
 }
 
 bool iot_config_ui64 (const iot_data_t * map, const char * key, uint64_t * val, iot_logger_t * logger)
 {
-  return iot_config_cast (map, key, val, IOT_DATA_UINT64, logger);
+  assert (key);
+  return iot_config_cast (map, IOT_CONFIG_KEY (key), val, IOT_DATA_UINT64, logger);
 }
 
 bool iot_config_i32 (const iot_data_t * map, const char * key, int32_t * val, iot_logger_t * logger)
 {
-  return iot_config_cast (map, key, val, IOT_DATA_INT32, logger);
+  assert (key);
+  return iot_config_cast (map, IOT_CONFIG_KEY (key), val, IOT_DATA_INT32, logger);
 }
 
 bool iot_config_ui32 (const iot_data_t * map, const char * key, uint32_t * val, iot_logger_t * logger)
 {
-  return iot_config_cast (map, key, val, IOT_DATA_UINT32, logger);
+  assert (key);
+  return iot_config_cast (map, IOT_CONFIG_KEY (key), val, IOT_DATA_UINT32, logger);
 }
 
 bool iot_config_bool (const iot_data_t * map, const char * key, bool * val, iot_logger_t * logger)
 {
-  return iot_config_cast (map, key, val, IOT_DATA_BOOL, logger);
+  assert (key);
+  return iot_config_cast (map, IOT_CONFIG_KEY (key), val, IOT_DATA_BOOL, logger);
 }
 
 bool iot_config_f64 (const iot_data_t * map, const char * key, double * val, iot_logger_t * logger)
 {
-  return iot_config_cast (map, key, val, IOT_DATA_FLOAT64, logger);
+  assert (key);
+  return iot_config_cast (map, IOT_CONFIG_KEY (key), val, IOT_DATA_FLOAT64, logger);
 }
 
 const char * iot_config_string (const iot_data_t * map, const char * key, bool alloc, iot_logger_t * logger)
 {
-  const iot_data_t * data = iot_config_get_type (map, key, IOT_DATA_STRING, logger);
-  const char * val = NULL;
-
-  if (data)
-  {
-    val = iot_data_string (data);
-    if (alloc) val = strdup (val);
-  }
-  return val;
+  assert (key);
+  return iot_config_get_string (map, IOT_CONFIG_KEY (key), alloc, logger);
 }
 
 extern const char * iot_config_string_default (const iot_data_t * map, const char * key, const char * def, bool alloc)
@@ -93,12 +108,65 @@ extern const char * iot_config_string_default (const iot_data_t * map, const cha
 
 extern const iot_data_t * iot_config_map (const iot_data_t * map, const char * key, iot_logger_t * logger)
 {
-  return iot_config_get_type (map, key, IOT_DATA_MAP, logger);
+  assert (key);
+  return iot_config_get_type (map, IOT_CONFIG_KEY (key), IOT_DATA_MAP, logger);
 }
 
 extern const iot_data_t * iot_config_vector (const iot_data_t * map, const char * key, iot_logger_t * logger)
 {
-  return iot_config_get_type (map, key, IOT_DATA_VECTOR, logger);
+  assert (key);
+  return iot_config_get_type (map, IOT_CONFIG_KEY (key), IOT_DATA_VECTOR, logger);
+}
+
+const iot_data_t * iot_config_key_init (iot_config_key_t * key, const char * name)
+{
+  assert (key && name);
+  return iot_data_alloc_const_string (key, name);
+}
+
+bool iot_config_key_i64 (const iot_data_t * map, const iot_config_key_t * key, int64_t * val, iot_logger_t * logger)
+{
+  return iot_config_cast (map, IOT_DATA_STATIC (key), val, IOT_DATA_INT64, logger);
+}
+
+bool iot_config_key_ui64 (const iot_data_t * map, const iot_config_key_t * key, uint64_t * val, iot_logger_t * logger)
+{
+  return iot_config_cast (map, IOT_DATA_STATIC (key), val, IOT_DATA_UINT64, logger);
+}
+
+bool iot_config_key_i32 (const iot_data_t * map, const iot_config_key_t * key, int32_t * val, iot_logger_t * logger)
+{
+  return iot_config_cast (map, IOT_DATA_STATIC (key), val, IOT_DATA_INT32, logger);
+}
+
+bool iot_config_key_ui32 (const iot_data_t * map, const iot_config_key_t * key, uint32_t * val, iot_logger_t * logger)
+{
+  return iot_config_cast (map, IOT_DATA_STATIC (key), val, IOT_DATA_UINT32, logger);
+}
+
+bool iot_config_key_bool (const iot_data_t * map, const iot_config_key_t * key, bool * val, iot_logger_t * logger)
+{
+  return iot_config_cast (map, IOT_DATA_STATIC (key), val, IOT_DATA_BOOL, logger);
+}
+
+bool iot_config_key_f64 (const iot_data_t * map, const iot_config_key_t * key, double * val, iot_logger_t * logger)
+{
+  return iot_config_cast (map, IOT_DATA_STATIC (key), val, IOT_DATA_FLOAT64, logger);
+}
+
+const char * iot_config_key_string (const iot_data_t * map, const iot_config_key_t * key, bool alloc, iot_logger_t * logger)
+{
+  return iot_config_get_string (map, IOT_DATA_STATIC (key), alloc, logger);
+}
+
+const iot_data_t * iot_config_key_map (const iot_data_t * map, const iot_config_key_t * key, iot_logger_t * logger)
+{
+  return iot_config_get_type (map, IOT_DATA_STATIC (key), IOT_DATA_MAP, logger);
+}
+
+const iot_data_t * iot_config_key_vector (const iot_data_t * map, const iot_config_key_t * key, iot_logger_t * logger)
+{
+  return iot_config_get_type (map, IOT_DATA_STATIC (key), IOT_DATA_VECTOR, logger);
 }
 
 iot_component_t * iot_config_component (const iot_data_t * map, const char * key, iot_container_t * container, iot_logger_t * logger)
@@ -183,6 +251,10 @@ char * iot_config_substitute_env (const char * str, iot_logger_t * logger)
           start = end + 1;
           continue;
         }
+        if (logger == NULL) logger = iot_logger_default ();
+        iot_log_error (logger, "${: unterminated substitution in config");
+        free (holder.parsed);
+        goto FAIL;
       }
       iot_update_parsed (&holder, start, 1u);
       start++;
@@ -194,3 +266,22 @@ char * iot_config_substitute_env (const char * str, iot_logger_t * logger)
 FAIL:
   return result;
 }
+
+static char * iot_config_substitute_fn (const char * str, void * arg)
+{
+  return iot_config_substitute_env (str, (iot_logger_t*) arg);
+}
+
+iot_data_t * iot_config_from_json (const char * json, iot_logger_t * logger)
+{
+  if (json == NULL) return NULL;
+  iot_data_t * config = iot_data_from_json_with_substitute (json, false, iot_config_substitute_fn, logger);
+  if (config && iot_data_type (config) == IOT_DATA_NULL && strstr (json, "${")) // References outside strings, so substitute text
+  {
+    iot_data_free (config);
+    char * str = iot_config_substitute_env (json, logger);
+    config = str ? iot_data_from_json (str) : NULL;
+    free (str);
+  }
+  return config;
+}
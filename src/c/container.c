@@ -7,6 +7,7 @@
 #include "iot/logger.h"
 #include "iot/config.h"
 #include "iot/time.h"
+#include "iot/thread.h"
 #ifdef IOT_BUILD_DYNAMIC_LOAD
 #include <dlfcn.h>
 #endif
@@ -24,10 +25,31 @@ struct iot_container_t
 {
   iot_logger_t * logger;
   iot_data_t * components;
+  iot_data_t * index;
+  iot_data_t * configs;
+  iot_threadpool_t * pool;
   char * name;
   pthread_rwlock_t lock;
 };
 
+// Count of outstanding container thread pool jobs
+
+typedef struct iot_container_jobs_t
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  uint32_t pending;
+} iot_container_jobs_t;
+
+typedef struct iot_container_job_t
+{
+  iot_container_jobs_t * jobs;
+  iot_container_t * cont;
+  const char * name;
+  iot_component_t * comp;
+  iot_data_t * map;
+} iot_container_job_t;
+
 typedef struct iot_load_in_progress_t
 {
   const char * name;
@@ -35,13 +57,26 @@ typedef struct iot_load_in_progress_t
 } iot_load_in_progress_t;
 
 static const iot_component_factory_t * iot_component_factories = NULL;
+static iot_data_t * iot_component_factory_index = NULL;
+#ifdef IOT_BUILD_DYNAMIC_LOAD
+static iot_data_t * iot_component_library_index = NULL; // Factories loaded from libraries, keyed by "library:factory"
+#endif
 static const iot_container_config_t * iot_config = NULL;
 static iot_load_in_progress_t * iot_load_in_progress = NULL;
+static _Thread_local uint32_t * iot_container_level = NULL; // Start level of component being configured
+
+// Factory lookups take a shared lock, so only serialise against factory registration
 
 #ifdef __ZEPHYR__
   static PTHREAD_MUTEX_DEFINE (iot_container_mutex);
+  #define IOT_FACTORY_RDLOCK() pthread_mutex_lock (&iot_container_mutex)
+  #define IOT_FACTORY_WRLOCK() pthread_mutex_lock (&iot_container_mutex)
+  #define IOT_FACTORY_UNLOCK() pthread_mutex_unlock (&iot_container_mutex)
 #else
-  static pthread_mutex_t iot_container_mutex = PTHREAD_MUTEX_INITIALIZER;
+  static pthread_rwlock_t iot_container_lock = PTHREAD_RWLOCK_INITIALIZER;
+  #define IOT_FACTORY_RDLOCK() pthread_rwlock_rdlock (&iot_container_lock)
+  #define IOT_FACTORY_WRLOCK() pthread_rwlock_wrlock (&iot_container_lock)
+  #define IOT_FACTORY_UNLOCK() pthread_rwlock_unlock (&iot_container_lock)
 #endif
 
 static void iot_component_free (void * ptr)
@@ -54,34 +89,34 @@ static void iot_component_free (void * ptr)
   (component->factory->free_fn) (component);
 }
 
-/* Replace ${VALUE} in configuration string with corresponding environment variable */
+/* Parse configuration string, replacing ${VALUE} with corresponding environment variable */
 
 static iot_data_t * iot_component_config_to_map (const char * config, iot_logger_t * logger)
 {
-  iot_data_t * map = NULL;
-  char * str = iot_config_substitute_env (config, logger);
-  if (str) map = iot_data_from_json (str);
+  iot_data_t * map = iot_config_from_json (config, logger);
   if (map == NULL || ! iot_data_map_key_is_of_type (map, IOT_DATA_STRING))
   {
     iot_log_error (logger, "iot_component_config_to_map: Invalid JSON configuration");
     iot_data_free (map);
     map = NULL;
   }
-  free (str);
   return map;
 }
 
 /*
- * Create a component instance from it's factory with a json configuration.
+ * Create a component instance from it's factory with a parsed configuration.
  */
 
-static void iot_component_create (iot_container_t * cont, const char *cname, const iot_component_factory_t * factory, const char * config)
+static void iot_component_create_map (iot_container_t * cont, const char *cname, const iot_component_factory_t * factory, iot_data_t * map)
 {
   iot_component_t * comp = NULL;
-  iot_data_t * map = iot_component_config_to_map (config, cont->logger);
+  uint32_t level = 0u;
+  uint32_t * outer = iot_container_level;
 
   if (map == NULL) goto ERROR;
+  iot_container_level = &level;
   comp = (factory->config_fn) (cont, map);
+  iot_container_level = outer;
   if (comp == NULL)
   {
     iot_data_free (map);
@@ -90,7 +125,12 @@ static void iot_component_create (iot_container_t * cont, const char *cname, con
   comp->config = map;
   comp->name = strdup (cname);
   comp->factory = factory;
+  comp->level = level;
   iot_data_list_head_push (cont->components, iot_data_alloc_pointer (comp, iot_component_free));
+  if (iot_data_string_map_get (cont->index, cname) == NULL) // Index first created of any same named components
+  {
+    iot_data_string_map_add (cont->index, comp->name, iot_data_alloc_pointer (comp, NULL));
+  }
 #if defined (_AZURESPHERE_) && ! defined (NDEBUG)
   Log_Debug ("iot_component_create: %s (Total Memory: %" PRIu32 " kB)\n", cname, (uint32_t) Applications_GetTotalMemoryUsageInKB ());
 #endif
@@ -100,16 +140,172 @@ ERROR:
   if (comp == NULL) iot_log_warn (cont->logger, "Container: %s Failed to create component: %s", cont->name, cname);
 }
 
-static const iot_component_factory_t * iot_component_factory_find_locked (const char * type)
+static void iot_component_create (iot_container_t * cont, const char *cname, const iot_component_factory_t * factory, const char * config)
 {
-  assert (type);
-  const iot_component_factory_t * iter = iot_component_factories;
-  while (iter)
+  iot_component_create_map (cont, cname, factory, iot_component_config_to_map (config, cont->logger));
+}
+
+/* Load a parsed configuration, using the configuration map loader if set */
+
+static iot_data_t * iot_container_config_load (iot_container_t * cont, const char * name)
+{
+  iot_data_t * map = NULL;
+  if (iot_config->load_map)
+  {
+    map = (iot_config->load_map) (name, iot_config->uri);
+    if (map && ! iot_data_map_key_is_of_type (map, IOT_DATA_STRING))
+    {
+      iot_log_error (cont->logger, "iot_container_config_load: Invalid JSON configuration");
+      iot_data_free (map);
+      map = NULL;
+    }
+  }
+  else
+  {
+    char * config = (iot_config->load) (name, iot_config->uri);
+    if (config) map = iot_component_config_to_map (config, cont->logger);
+    free (config);
+  }
+  return map;
+}
+
+static void iot_container_jobs_init (iot_container_jobs_t * jobs)
+{
+  iot_mutex_init (&jobs->mutex);
+  iot_cond_init (&jobs->cond);
+  jobs->pending = 0u;
+}
+
+static void iot_container_jobs_add (iot_container_t * cont, iot_container_job_t * job, void * (*fn) (void*))
+{
+  pthread_mutex_lock (&job->jobs->mutex);
+  job->jobs->pending++;
+  pthread_mutex_unlock (&job->jobs->mutex);
+  iot_threadpool_add_work (cont->pool, fn, job, IOT_THREAD_NO_PRIORITY);
+}
+
+static void iot_container_jobs_done (iot_container_jobs_t * jobs)
+{
+  pthread_mutex_lock (&jobs->mutex);
+  if (--jobs->pending == 0u) pthread_cond_signal (&jobs->cond);
+  pthread_mutex_unlock (&jobs->mutex);
+}
+
+static void iot_container_jobs_wait (iot_container_jobs_t * jobs)
+{
+  pthread_mutex_lock (&jobs->mutex);
+  while (jobs->pending) pthread_cond_wait (&jobs->cond, &jobs->mutex);
+  pthread_mutex_unlock (&jobs->mutex);
+}
+
+static void iot_container_jobs_fini (iot_container_jobs_t * jobs)
+{
+  pthread_cond_destroy (&jobs->cond);
+  pthread_mutex_destroy (&jobs->mutex);
+}
+
+static void * iot_container_load_job (void * arg)
+{
+  iot_container_job_t * job = arg;
+  job->map = iot_container_config_load (job->cont, job->name);
+  iot_container_jobs_done (job->jobs);
+  return NULL;
+}
+
+static void * iot_container_start_job (void * arg)
+{
+  iot_container_job_t * job = arg;
+  (job->comp->start_fn) (job->comp);
+  iot_container_jobs_done (job->jobs);
+  return NULL;
+}
+
+/* Concurrently load and parse configurations of all components in a container configuration */
+
+static void iot_container_prefetch (iot_container_t * cont, const iot_data_t * map)
+{
+  uint32_t count = iot_data_map_size (map);
+  iot_container_job_t * list = calloc (count ? count : 1u, sizeof (*list));
+  iot_container_jobs_t jobs;
+  iot_data_map_iter_t iter;
+  uint32_t i = 0u;
+
+  iot_container_jobs_init (&jobs);
+  iot_data_map_iter (map, &iter);
+  while (iot_data_map_iter_next (&iter))
   {
-    if (strcmp (iter->type, type) == 0) break;
-    iter = iter->next;
+    iot_container_job_t * job = &list[i++];
+    job->jobs = &jobs;
+    job->cont = cont;
+    job->name = iot_data_map_iter_string_key (&iter);
+    iot_container_jobs_add (cont, job, iot_container_load_job);
   }
-  return iter;
+  iot_container_jobs_wait (&jobs);
+  iot_container_jobs_fini (&jobs);
+  cont->configs = iot_data_alloc_typed_hash_map (IOT_DATA_STRING, IOT_DATA_MAP);
+  for (i = 0u; i < count; i++)
+  {
+    if (list[i].map) iot_data_string_map_add (cont->configs, list[i].name, list[i].map);
+  }
+  free (list);
+}
+
+/* Create a component, from a prefetched configuration if available */
+
+static void iot_container_create (iot_container_t * cont, const char * cname, const iot_component_factory_t * factory)
+{
+  const iot_data_t * map = cont->configs ? iot_data_string_map_get (cont->configs, cname) : NULL;
+  iot_data_t * config;
+  if (map)
+  {
+    config = iot_data_add_ref (map);
+    iot_data_string_map_remove (cont->configs, cname);
+  }
+  else
+  {
+    config = iot_container_config_load (cont, cname);
+  }
+  if (config) iot_component_create_map (cont, cname, factory, config);
+}
+
+/* Start components concurrently, in waves of increasing level */
+
+static void iot_container_start_parallel (iot_container_t * cont)
+{
+  uint32_t count = iot_data_list_length (cont->components);
+  iot_container_job_t * list = calloc (count ? count : 1u, sizeof (*list));
+  iot_container_jobs_t jobs;
+  iot_data_list_iter_t iter;
+  uint32_t max = 0u;
+
+  iot_container_jobs_init (&jobs);
+  for (uint32_t level = 0u; level <= max; level++)
+  {
+    uint32_t i = 0u;
+    iot_data_list_iter (cont->components, &iter);
+    while (iot_data_list_iter_next (&iter))
+    {
+      iot_component_t * comp = (iot_component_t*) iot_data_list_iter_pointer_value (&iter);
+      if (comp->level > max) max = comp->level;
+      if (comp->level == level)
+      {
+        iot_container_job_t * job = &list[i];
+        job->jobs = &jobs;
+        job->comp = comp;
+        iot_container_jobs_add (cont, job, iot_container_start_job);
+      }
+      i++;
+    }
+    iot_container_jobs_wait (&jobs);
+  }
+  iot_container_jobs_fini (&jobs);
+  free (list);
+}
+
+static const iot_component_factory_t * iot_component_factory_find_locked (const char * type)
+{
+  assert (type);
+  return iot_component_factory_index ? iot_data_string_map_get_pointer (iot_component_factory_index, type) : NULL;
 }
 
 static bool iot_component_cmp (const iot_data_t * value, const void * arg)
@@ -121,23 +317,36 @@ static bool iot_component_cmp (const iot_data_t * value, const void * arg)
 static const iot_component_t * iot_container_find_component_locked (const iot_container_t * cont, const char * name)
 {
   assert (cont && name);
-  const iot_data_t * value = iot_data_list_find (cont->components, iot_component_cmp, name);
-  return (const iot_component_t*) (value ? iot_data_pointer (value) : NULL);
+  return iot_data_string_map_get_pointer (cont->index, name);
 }
 
 #ifdef IOT_BUILD_DYNAMIC_LOAD
 
-static const iot_component_factory_t * iot_container_try_load_component (iot_container_t * cont, const char * config)
+static char * iot_component_library_key (const char * library, const char * factory)
+{
+  char * key = malloc (strlen (library) + strlen (factory) + 2);
+  strcpy (key, library);
+  strcat (key, ":");
+  strcat (key, factory);
+  return key;
+}
+
+/* Load a component factory from a library, libraries and factories already loaded in the process are not reloaded */
+
+static const iot_component_factory_t * iot_container_try_load_component_map (iot_container_t * cont, const iot_data_t * cmap)
 {
   const iot_component_factory_t * result = NULL;
-  iot_data_t * cmap = iot_component_config_to_map (config, cont->logger);
   if (cmap)
   {
     const char * library = iot_data_string_map_get_string (cmap, "Library");
     const char * factory = iot_data_string_map_get_string (cmap, "Factory");
     if (library && factory)
     {
-      void *handle = dlopen (library, RTLD_LAZY);
+      char * key = iot_component_library_key (library, factory);
+      IOT_FACTORY_RDLOCK ();
+      result = iot_component_library_index ? iot_data_string_map_get_pointer (iot_component_library_index, key) : NULL;
+      IOT_FACTORY_UNLOCK ();
+      void *handle = result ? NULL : dlopen (library, RTLD_LAZY);
       if (handle)
       {
         const iot_component_factory_t *(*factory_fn) (void) = dlsym (handle, factory);
@@ -145,6 +354,11 @@ static const iot_component_factory_t * iot_container_try_load_component (iot_con
         {
           result = factory_fn ();
           iot_component_factory_add (result);
+          IOT_FACTORY_WRLOCK ();
+          if (iot_component_library_index == NULL) iot_component_library_index = iot_data_alloc_typed_hash_map (IOT_DATA_STRING, IOT_DATA_POINTER);
+          iot_data_map_add (iot_component_library_index, iot_data_alloc_string (key, IOT_DATA_TAKE), iot_data_alloc_pointer ((void*) result, NULL));
+          IOT_FACTORY_UNLOCK ();
+          key = NULL;
         }
         else
         {
@@ -152,15 +366,67 @@ static const iot_component_factory_t * iot_container_try_load_component (iot_con
           dlclose (handle);
         }
       }
-      else
+      else if (result == NULL)
       {
         iot_log_error (cont->logger, "Invalid configuration, Could not dynamically load Library: %s - %s", library, dlerror ());
       }
+      free (key);
     }
-    iot_data_free (cmap);
   }
   return result;
 }
+
+static void * iot_container_preload_job (void * arg)
+{
+  iot_container_job_t * job = arg;
+  iot_container_try_load_component_map (job->cont, job->map);
+  iot_container_jobs_done (job->jobs);
+  return NULL;
+}
+
+/* Load factories of component types not yet added, from libraries named in component configurations, concurrently if a pool is set */
+
+static void iot_container_preload (iot_container_t * cont, const iot_data_t * map)
+{
+  uint32_t count = iot_data_map_size (map);
+  iot_container_job_t * list = calloc (count ? count : 1u, sizeof (*list));
+  iot_container_jobs_t jobs;
+  iot_data_map_iter_t iter;
+  uint32_t i = 0u;
+
+  iot_container_jobs_init (&jobs);
+  iot_data_map_iter (map, &iter);
+  while (iot_data_map_iter_next (&iter))
+  {
+    const char * cname = iot_data_map_iter_string_key (&iter);
+    if (iot_component_factory_find (iot_data_map_iter_string_value (&iter))) continue;
+    const iot_data_t * cmap = cont->configs ? iot_data_string_map_get (cont->configs, cname) : NULL;
+    iot_container_job_t * job = &list[i++];
+    job->jobs = &jobs;
+    job->cont = cont;
+    job->map = cmap ? iot_data_add_ref (cmap) : iot_container_config_load (cont, cname);
+    if (cont->pool)
+    {
+      iot_container_jobs_add (cont, job, iot_container_preload_job);
+    }
+    else
+    {
+      iot_container_try_load_component_map (cont, job->map);
+    }
+  }
+  iot_container_jobs_wait (&jobs);
+  iot_container_jobs_fini (&jobs);
+  while (i--) iot_data_free (list[i].map);
+  free (list);
+}
+
+static const iot_component_factory_t * iot_container_try_load_component (iot_container_t * cont, const char * config)
+{
+  iot_data_t * cmap = iot_component_config_to_map (config, cont->logger);
+  const iot_component_factory_t * result = iot_container_try_load_component_map (cont, cmap);
+  iot_data_free (cmap);
+  return result;
+}
 #endif
 
 static bool iot_container_typed_load (iot_container_t * cont, const char * cname, const char * ctype)
@@ -171,12 +437,7 @@ static bool iot_container_typed_load (iot_container_t * cont, const char * cname
     const iot_component_factory_t *factory = iot_component_factory_find (ctype);
     if (factory)
     {
-      char * config = (iot_config->load) (cname, iot_config->uri);
-      if (config)
-      {
-        iot_component_create (cont, cname, factory, config);
-        free (config);
-      }
+      iot_container_create (cont, cname, factory);
       result = true;
     }
     else
@@ -206,9 +467,7 @@ static bool iot_container_load_locked (iot_container_t * cont, const char * cnam
     if (!loading)
     {
       iot_load_in_progress = &this;
-      char * config = (iot_config->load) (cont->name, iot_config->uri);
-      iot_data_t * map = iot_component_config_to_map (config, cont->logger);
-      free (config);
+      iot_data_t * map = iot_container_config_load (cont, cont->name);
 
       if (map)
       {
@@ -243,6 +502,9 @@ iot_container_t * iot_container_alloc (const char * name)
   cont->name = strdup (name);
   cont->logger = iot_logger_default ();
   cont->components = iot_data_alloc_typed_list (IOT_DATA_POINTER);
+  cont->index = iot_data_alloc_typed_hash_map (IOT_DATA_STRING, IOT_DATA_POINTER);
+  cont->configs = NULL;
+  cont->pool = NULL;
   pthread_rwlock_init (&cont->lock, NULL);
   iot_logger_start (cont->logger);
   return cont;
@@ -252,40 +514,32 @@ bool iot_container_init (iot_container_t * cont)
 {
   assert (iot_config && cont);
 
-  char * config = (iot_config->load) (cont->name, iot_config->uri);
-  iot_data_t * map = iot_component_config_to_map (config, cont->logger);
-  free (config);
+  iot_data_t * map = iot_container_config_load (cont, cont->name);
 
-  if (map)
+  if (map == NULL)
+  {
+    iot_log_error (cont->logger, "Container: %s Failed to load configuration", cont->name);
+  }
+  else
   {
     const char * cname;
     const char * ctype;
     iot_data_map_iter_t iter;
     iot_data_map_iter (map, &iter);
 
+    if (cont->pool) iot_container_prefetch (cont, map);
 #ifdef IOT_BUILD_DYNAMIC_LOAD
-
     // pre-pass to find the factory to be added to support dynamic loading of libraries
-    while (iot_data_map_iter_next (&iter))
-    {
-      cname = iot_data_map_iter_string_key (&iter);
-      ctype = iot_data_map_iter_string_value (&iter);
-      config = (iot_config->load) (cname, iot_config->uri);
-
-      if ((iot_component_factory_find (ctype) == NULL) && config)
-      {
-        iot_container_try_load_component (cont, config);
-      }
-      free (config);
-    }
+    iot_container_preload (cont, map);
 #endif
-
     while (iot_data_map_iter_next (&iter))
     {
       cname = iot_data_map_iter_string_key (&iter);
       ctype = iot_data_map_iter_string_value (&iter);
       iot_container_typed_load (cont, cname, ctype);
     }
+    iot_data_free (cont->configs);
+    cont->configs = NULL;
     iot_data_free (map);
   }
   return (map != NULL);
@@ -295,7 +549,9 @@ void iot_container_free (iot_container_t * cont)
 {
   if (cont)
   {
+    iot_data_free (cont->index);
     iot_data_free (cont->components);
+    iot_threadpool_free (cont->pool);
     pthread_rwlock_destroy (&cont->lock);
     free (cont->name);
     free (cont);
@@ -333,6 +589,14 @@ AGAIN:
   }
 }
 
+void iot_container_set_threadpool (iot_container_t * cont, iot_threadpool_t * pool)
+{
+  assert (cont);
+  if (pool) iot_threadpool_add_ref (pool);
+  iot_threadpool_free (cont->pool);
+  cont->pool = pool;
+}
+
 void iot_container_start (iot_container_t * cont)
 {
   pthread_rwlock_rdlock (&cont->lock);
@@ -343,14 +607,21 @@ void iot_container_start (iot_container_t * cont)
     iot_component_t * comp = (iot_component_t*) iot_data_list_iter_pointer_value (&iter);
     if (comp->starting_fn) (comp->starting_fn) (comp);
   }
-  iot_data_list_iter (cont->components, &iter);
-  while (iot_data_list_iter_next (&iter))
+  if (cont->pool)
   {
-    iot_component_t * comp = (iot_component_t*) iot_data_list_iter_pointer_value (&iter);
-    (comp->start_fn) (comp);
+    iot_container_start_parallel (cont);
+  }
+  else
+  {
+    iot_data_list_iter (cont->components, &iter);
+    while (iot_data_list_iter_next (&iter))
+    {
+      iot_component_t * comp = (iot_component_t*) iot_data_list_iter_pointer_value (&iter);
+      (comp->start_fn) (comp);
 #if defined (_AZURESPHERE_) && ! defined (NDEBUG)
-    Log_Debug ("iot_container_start: %s (Total Memory: %" PRIu32 " kB)\n", comp->name, (uint32_t) Applications_GetTotalMemoryUsageInKB ());
+      Log_Debug ("iot_container_start: %s (Total Memory: %" PRIu32 " kB)\n", comp->name, (uint32_t) Applications_GetTotalMemoryUsageInKB ());
 #endif
+    }
   }
   iot_container_running (cont);
   pthread_rwlock_unlock (&cont->lock);
@@ -378,20 +649,22 @@ void iot_container_stop (iot_container_t * cont)
 void iot_component_factory_add (const iot_component_factory_t * factory)
 {
   assert (factory);
-  pthread_mutex_lock (&iot_container_mutex);
+  IOT_FACTORY_WRLOCK ();
   if (iot_component_factory_find_locked (factory->type) == NULL)
   {
     ((iot_component_factory_t*) factory)->next = iot_component_factories;
     iot_component_factories = factory;
+    if (iot_component_factory_index == NULL) iot_component_factory_index = iot_data_alloc_typed_hash_map (IOT_DATA_STRING, IOT_DATA_POINTER);
+    iot_data_string_map_add (iot_component_factory_index, factory->type, iot_data_alloc_pointer ((void*) factory, NULL));
   }
-  pthread_mutex_unlock (&iot_container_mutex);
+  IOT_FACTORY_UNLOCK ();
 }
 
 extern const iot_component_factory_t * iot_component_factory_find (const char * type)
 {
-  pthread_mutex_lock (&iot_container_mutex);
+  IOT_FACTORY_RDLOCK ();
   const iot_component_factory_t * factory = iot_component_factory_find_locked (type);
-  pthread_mutex_unlock (&iot_container_mutex);
+  IOT_FACTORY_UNLOCK ();
   return factory;
 }
 
@@ -430,6 +703,7 @@ iot_component_t * iot_container_find_component (iot_container_t * cont, const ch
       comp = iot_container_find_component_locked (cont, name);
     }
     pthread_rwlock_unlock (&cont->lock);
+    if (comp && iot_container_level && comp->level >= *iot_container_level) *iot_container_level = comp->level + 1u;
   }
   return (iot_component_t*) comp;
 }
@@ -438,7 +712,16 @@ void iot_container_delete_component (iot_container_t * cont, const char * name)
 {
   assert (cont && name);
   pthread_rwlock_wrlock (&cont->lock);
-  iot_data_list_remove (cont->components, iot_component_cmp, name);
+  if (iot_data_string_map_remove (cont->index, name))
+  {
+    iot_data_list_remove (cont->components, iot_component_cmp, name);
+    const iot_data_t * value = iot_data_list_find (cont->components, iot_component_cmp, name); // Reindex any later component of same name
+    if (value)
+    {
+      iot_component_t * comp = (iot_component_t*) iot_data_pointer (value);
+      iot_data_string_map_add (cont->index, comp->name, iot_data_alloc_pointer (comp, NULL));
+    }
+  }
   pthread_rwlock_unlock (&cont->lock);
 }
 
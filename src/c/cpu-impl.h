@@ -0,0 +1,38 @@
+//
+// Copyright (c) 2024 IOTech Ltd
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+
+#ifndef _IOT_CPU_IMPL_H_
+#define _IOT_CPU_IMPL_H_
+
+#include "iot/defs.h"
+#include "iot/os.h"
+
+// Processor features, detected once at run time, used to select variants of hot functions. Without
+// IOT_HAS_CPU_DISPATCH, only features enabled for the whole build (for example with -march) are reported.
+// Currently selects the base64 block and typed array sum and range variants; other vector loops use the build target.
+
+#define IOT_CPU_SSSE3 0x01u
+#define IOT_CPU_SSE42 0x02u
+#define IOT_CPU_AVX2 0x04u
+#define IOT_CPU_AVX512 0x08u // AVX-512 F and BW
+#define IOT_CPU_NEON 0x10u
+#define IOT_CPU_SVE 0x20u
+
+// x86 variants are compiled with IOT_CPU_TARGET, so need not be supported by the build baseline
+
+#if (defined (__x86_64__) || defined (__i386__)) && defined (__GNUC__) && (defined (IOT_HAS_CPU_DISPATCH) || defined (__SSSE3__))
+#define IOT_CPU_X86
+#define IOT_CPU_TARGET(isa) __attribute__((target (isa)))
+#endif
+
+extern uint32_t iot_cpu_features (void);
+
+static inline bool iot_cpu_has (uint32_t features)
+{
+  return (iot_cpu_features () & features) == features;
+}
+
+#endif
@@ -0,0 +1,59 @@
+//
+// Copyright (c) 2024 IOTech Ltd
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+
+#include "cpu-impl.h"
+#if defined (IOT_HAS_CPU_DISPATCH) && defined (__aarch64__) && defined (__linux__)
+#include <sys/auxv.h>
+#endif
+
+#define IOT_CPU_DETECTED 0x80000000u
+
+static _Atomic uint32_t iot_cpu_flags = 0u;
+
+static uint32_t iot_cpu_detect (void)
+{
+  uint32_t features = 0u;
+#if defined (IOT_CPU_X86) && defined (IOT_HAS_CPU_DISPATCH)
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("ssse3")) features |= IOT_CPU_SSSE3;
+  if (__builtin_cpu_supports ("sse4.2")) features |= IOT_CPU_SSE42;
+  if (__builtin_cpu_supports ("avx2")) features |= IOT_CPU_AVX2;
+  if (__builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512bw")) features |= IOT_CPU_AVX512;
+#else
+#ifdef __SSSE3__
+  features |= IOT_CPU_SSSE3;
+#endif
+#ifdef __SSE4_2__
+  features |= IOT_CPU_SSE42;
+#endif
+#ifdef __AVX2__
+  features |= IOT_CPU_AVX2;
+#endif
+#if defined (__AVX512F__) && defined (__AVX512BW__)
+  features |= IOT_CPU_AVX512;
+#endif
+#endif
+#if defined (__aarch64__) && defined (__ARM_NEON)
+  features |= IOT_CPU_NEON;
+#endif
+#if defined (__ARM_FEATURE_SVE)
+  features |= IOT_CPU_SVE;
+#elif defined (IOT_HAS_CPU_DISPATCH) && defined (__aarch64__) && defined (__linux__) && defined (HWCAP_SVE)
+  if (getauxval (AT_HWCAP) & HWCAP_SVE) features |= IOT_CPU_SVE;
+#endif
+  return features;
+}
+
+uint32_t iot_cpu_features (void)
+{
+  uint32_t flags = atomic_load_explicit (&iot_cpu_flags, memory_order_relaxed);
+  if (flags == 0u) // Detection is idempotent, so threads racing to detect store the same flags
+  {
+    flags = iot_cpu_detect () | IOT_CPU_DETECTED;
+    atomic_store_explicit (&iot_cpu_flags, flags, memory_order_relaxed);
+  }
+  return flags & ~IOT_CPU_DETECTED;
+}
@@ -0,0 +1,415 @@
+//
+// Copyright (c) 2023 IOTech
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+#include "data-impl.h"
+#include "cpu-impl.h"
+#include <float.h>
+
+// Typed array kernels. Reductions keep IOT_ARRAY_LANES independent accumulators and conversions
+// are staged through a block of doubles, so that the inner loops vectorise for the target
+// (SSE/AVX on x86, NEON on Arm) without reordering floating point operations, else run as scalar code.
+// On x86, the sum and range reductions are also built for AVX2 and selected at run time if supported.
+
+#define IOT_ARRAY_LANES 8u
+#define IOT_ARRAY_CHUNK 256u
+#define IOT_ARRAY_IS_NUMERIC(t) ((t) <= IOT_DATA_FLOAT64)
+#define IOT_ARRAY_TYPES (IOT_DATA_FLOAT64 + 1)
+
+typedef double (*iot_array_sum_fn) (const void * in, uint32_t len);
+typedef void (*iot_array_range_fn) (const void * in, uint32_t len, double * min, double * max);
+typedef void (*iot_array_load_fn) (const void * in, double * out, uint32_t len);
+typedef void (*iot_array_store_fn) (const double * in, void * out, uint32_t len);
+typedef uint64_t (*iot_array_key_fn) (const void * in);
+
+#define IOT_ARRAY_SUM(N,T,A) IOT_ARRAY_SUM_ISA (N,T,A,)
+#define IOT_ARRAY_SUM_ISA(N,T,A,ISA) \
+ISA static double iot_array_sum_##N (const void * in, uint32_t len) \
+{ \
+  const T * restrict src = in; \
+  A acc[IOT_ARRAY_LANES] = { 0 }; \
+  A total = 0; \
+  uint32_t i = 0; \
+  for (; (i + IOT_ARRAY_LANES) <= len; i += IOT_ARRAY_LANES) \
+  { \
+    for (uint32_t j = 0; j < IOT_ARRAY_LANES; j++) acc[j] += src[i + j]; \
+  } \
+  for (; i < len; i++) acc[0] += src[i]; \
+  for (uint32_t j = 0; j < IOT_ARRAY_LANES; j++) total += acc[j]; \
+  return (double) total; \
+}
+
+#define IOT_ARRAY_RANGE(N,T) IOT_ARRAY_RANGE_ISA (N,T,)
+#define IOT_ARRAY_RANGE_ISA(N,T,ISA) \
+ISA static void iot_array_range_##N (const void * in, uint32_t len, double * min, double * max) \
+{ \
+  const T * restrict src = in; \
+  T lo[IOT_ARRAY_LANES]; \
+  T hi[IOT_ARRAY_LANES]; \
+  uint32_t i = 0; \
+  for (uint32_t j = 0; j < IOT_ARRAY_LANES; j++) lo[j] = hi[j] = src[0]; \
+  for (; (i + IOT_ARRAY_LANES) <= len; i += IOT_ARRAY_LANES) \
+  { \
+    for (uint32_t j = 0; j < IOT_ARRAY_LANES; j++) \
+    { \
+      lo[j] = (src[i + j] < lo[j]) ? src[i + j] : lo[j]; \
+      hi[j] = (src[i + j] > hi[j]) ? src[i + j] : hi[j]; \
+    } \
+  } \
+  for (; i < len; i++) \
+  { \
+    lo[0] = (src[i] < lo[0]) ? src[i] : lo[0]; \
+    hi[0] = (src[i] > hi[0]) ? src[i] : hi[0]; \
+  } \
+  for (uint32_t j = 1; j < IOT_ARRAY_LANES; j++) \
+  { \
+    lo[0] = (lo[j] < lo[0]) ? lo[j] : lo[0]; \
+    hi[0] = (hi[j] > hi[0]) ? hi[j] : hi[0]; \
+  } \
+  *min = (double) lo[0]; \
+  *max = (double) hi[0]; \
+}
+
+#define IOT_ARRAY_LOAD(N,T) \
+static void iot_array_load_##N (const void * in, double * restrict out, uint32_t len) \
+{ \
+  const T * restrict src = in; \
+  for (uint32_t i = 0; i < len; i++) out[i] = (double) src[i]; \
+}
+
+// Saturating store, values at or beyond LIMIT are set to MAX and NaN values to zero
+
+#define IOT_ARRAY_STORE(N,T,MIN,MAX,LIMIT) \
+static void iot_array_store_##N (const double * restrict in, void * out, uint32_t len) \
+{ \
+  T * restrict dst = out; \
+  for (uint32_t i = 0; i < len; i++) \
+  { \
+    double v = in[i]; \
+    dst[i] = (v != v) ? 0 : ((v <= (double) (MIN)) ? (MIN) : ((v >= (LIMIT)) ? (MAX) : (T) v)); \
+  } \
+}
+
+// Sort keys, unsigned values with the same ordering as the element values. Signed integers have the sign bit
+// inverted, floats have the sign bit set if positive else all bits inverted, so NaNs are ordered by sign.
+
+#define IOT_ARRAY_INT_KEY(N,T,U,SIGN) \
+static uint64_t iot_array_key_##N (const void * in) \
+{ \
+  T v; \
+  memcpy (&v, in, sizeof (v)); \
+  return (uint64_t) (U) ((U) v ^ (SIGN)); \
+}
+
+#define IOT_ARRAY_FLOAT_KEY(N,U,SIGN) \
+static uint64_t iot_array_key_##N (const void * in) \
+{ \
+  U v; \
+  memcpy (&v, in, sizeof (v)); \
+  return (uint64_t) ((v & (SIGN)) ? (U) ~v : (U) (v | (SIGN))); \
+}
+
+IOT_ARRAY_SUM (i8, int8_t, int64_t)
+IOT_ARRAY_SUM (ui8, uint8_t, uint64_t)
+IOT_ARRAY_SUM (i16, int16_t, int64_t)
+IOT_ARRAY_SUM (ui16, uint16_t, uint64_t)
+IOT_ARRAY_SUM (i32, int32_t, int64_t)
+IOT_ARRAY_SUM (ui32, uint32_t, uint64_t)
+IOT_ARRAY_SUM (i64, int64_t, double)
+IOT_ARRAY_SUM (ui64, uint64_t, double)
+IOT_ARRAY_SUM (f32, float, double)
+IOT_ARRAY_SUM (f64, double, double)
+
+IOT_ARRAY_RANGE (i8, int8_t)
+IOT_ARRAY_RANGE (ui8, uint8_t)
+IOT_ARRAY_RANGE (i16, int16_t)
+IOT_ARRAY_RANGE (ui16, uint16_t)
+IOT_ARRAY_RANGE (i32, int32_t)
+IOT_ARRAY_RANGE (ui32, uint32_t)
+IOT_ARRAY_RANGE (i64, int64_t)
+IOT_ARRAY_RANGE (ui64, uint64_t)
+IOT_ARRAY_RANGE (f32, float)
+IOT_ARRAY_RANGE (f64, double)
+
+IOT_ARRAY_LOAD (i8, int8_t)
+IOT_ARRAY_LOAD (ui8, uint8_t)
+IOT_ARRAY_LOAD (i16, int16_t)
+IOT_ARRAY_LOAD (ui16, uint16_t)
+IOT_ARRAY_LOAD (i32, int32_t)
+IOT_ARRAY_LOAD (ui32, uint32_t)
+IOT_ARRAY_LOAD (i64, int64_t)
+IOT_ARRAY_LOAD (ui64, uint64_t)
+IOT_ARRAY_LOAD (f32, float)
+IOT_ARRAY_LOAD (f64, double)
+
+IOT_ARRAY_STORE (i8, int8_t, INT8_MIN, INT8_MAX, (double) INT8_MAX)
+IOT_ARRAY_STORE (ui8, uint8_t, 0, UINT8_MAX, (double) UINT8_MAX)
+IOT_ARRAY_STORE (i16, int16_t, INT16_MIN, INT16_MAX, (double) INT16_MAX)
+IOT_ARRAY_STORE (ui16, uint16_t, 0, UINT16_MAX, (double) UINT16_MAX)
+IOT_ARRAY_STORE (i32, int32_t, INT32_MIN, INT32_MAX, (double) INT32_MAX)
+IOT_ARRAY_STORE (ui32, uint32_t, 0, UINT32_MAX, (double) UINT32_MAX)
+IOT_ARRAY_STORE (i64, int64_t, INT64_MIN, INT64_MAX, 9223372036854775808.0)
+IOT_ARRAY_STORE (ui64, uint64_t, 0, UINT64_MAX, 18446744073709551616.0)
+
+IOT_ARRAY_INT_KEY (i8, int8_t, uint8_t, 0x80u)
+IOT_ARRAY_INT_KEY (ui8, uint8_t, uint8_t, 0u)
+IOT_ARRAY_INT_KEY (i16, int16_t, uint16_t, 0x8000u)
+IOT_ARRAY_INT_KEY (ui16, uint16_t, uint16_t, 0u)
+IOT_ARRAY_INT_KEY (i32, int32_t, uint32_t, 0x80000000u)
+IOT_ARRAY_INT_KEY (ui32, uint32_t, uint32_t, 0u)
+IOT_ARRAY_INT_KEY (i64, int64_t, uint64_t, 0x8000000000000000u)
+IOT_ARRAY_INT_KEY (ui64, uint64_t, uint64_t, 0u)
+IOT_ARRAY_FLOAT_KEY (f32, uint32_t, 0x80000000u)
+IOT_ARRAY_FLOAT_KEY (f64, uint64_t, 0x8000000000000000u)
+
+static void iot_array_store_f32 (const double * restrict in, void * out, uint32_t len)
+{
+  float * restrict dst = out;
+  for (uint32_t i = 0; i < len; i++)
+  {
+    double v = in[i];
+    dst[i] = (v < -FLT_MAX) ? -FLT_MAX : ((v > FLT_MAX) ? FLT_MAX : (float) v);
+  }
+}
+
+static void iot_array_store_f64 (const double * restrict in, void * out, uint32_t len)
+{
+  double * restrict dst = out;
+  for (uint32_t i = 0; i < len; i++) dst[i] = in[i];
+}
+
+static const iot_array_sum_fn iot_array_sum_none[IOT_ARRAY_TYPES] =
+{
+  iot_array_sum_i8, iot_array_sum_ui8, iot_array_sum_i16, iot_array_sum_ui16, iot_array_sum_i32,
+  iot_array_sum_ui32, iot_array_sum_i64, iot_array_sum_ui64, iot_array_sum_f32, iot_array_sum_f64
+};
+
+static const iot_array_range_fn iot_array_range_none[IOT_ARRAY_TYPES] =
+{
+  iot_array_range_i8, iot_array_range_ui8, iot_array_range_i16, iot_array_range_ui16, iot_array_range_i32,
+  iot_array_range_ui32, iot_array_range_i64, iot_array_range_ui64, iot_array_range_f32, iot_array_range_f64
+};
+
+#ifdef IOT_CPU_X86
+#define IOT_ARRAY_AVX2 IOT_CPU_TARGET ("avx2")
+
+IOT_ARRAY_SUM_ISA (i8_avx2, int8_t, int64_t, IOT_ARRAY_AVX2)
+IOT_ARRAY_SUM_ISA (ui8_avx2, uint8_t, uint64_t, IOT_ARRAY_AVX2)
+IOT_ARRAY_SUM_ISA (i16_avx2, int16_t, int64_t, IOT_ARRAY_AVX2)
+IOT_ARRAY_SUM_ISA (ui16_avx2, uint16_t, uint64_t, IOT_ARRAY_AVX2)
+IOT_ARRAY_SUM_ISA (i32_avx2, int32_t, int64_t, IOT_ARRAY_AVX2)
+IOT_ARRAY_SUM_ISA (ui32_avx2, uint32_t, uint64_t, IOT_ARRAY_AVX2)
+IOT_ARRAY_SUM_ISA (i64_avx2, int64_t, double, IOT_ARRAY_AVX2)
+IOT_ARRAY_SUM_ISA (ui64_avx2, uint64_t, double, IOT_ARRAY_AVX2)
+IOT_ARRAY_SUM_ISA (f32_avx2, float, double, IOT_ARRAY_AVX2)
+IOT_ARRAY_SUM_ISA (f64_avx2, double, double, IOT_ARRAY_AVX2)
+
+IOT_ARRAY_RANGE_ISA (i8_avx2, int8_t, IOT_ARRAY_AVX2)
+IOT_ARRAY_RANGE_ISA (ui8_avx2, uint8_t, IOT_ARRAY_AVX2)
+IOT_ARRAY_RANGE_ISA (i16_avx2, int16_t, IOT_ARRAY_AVX2)
+IOT_ARRAY_RANGE_ISA (ui16_avx2, uint16_t, IOT_ARRAY_AVX2)
+IOT_ARRAY_RANGE_ISA (i32_avx2, int32_t, IOT_ARRAY_AVX2)
+IOT_ARRAY_RANGE_ISA (ui32_avx2, uint32_t, IOT_ARRAY_AVX2)
+IOT_ARRAY_RANGE_ISA (i64_avx2, int64_t, IOT_ARRAY_AVX2)
+IOT_ARRAY_RANGE_ISA (ui64_avx2, uint64_t, IOT_ARRAY_AVX2)
+IOT_ARRAY_RANGE_ISA (f32_avx2, float, IOT_ARRAY_AVX2)
+IOT_ARRAY_RANGE_ISA (f64_avx2, double, IOT_ARRAY_AVX2)
+
+static const iot_array_sum_fn iot_array_sum_avx2[IOT_ARRAY_TYPES] =
+{
+  iot_array_sum_i8_avx2, iot_array_sum_ui8_avx2, iot_array_sum_i16_avx2, iot_array_sum_ui16_avx2, iot_array_sum_i32_avx2,
+  iot_array_sum_ui32_avx2, iot_array_sum_i64_avx2, iot_array_sum_ui64_avx2, iot_array_sum_f32_avx2, iot_array_sum_f64_avx2
+};
+
+static const iot_array_range_fn iot_array_range_avx2[IOT_ARRAY_TYPES] =
+{
+  iot_array_range_i8_avx2, iot_array_range_ui8_avx2, iot_array_range_i16_avx2, iot_array_range_ui16_avx2, iot_array_range_i32_avx2,
+  iot_array_range_ui32_avx2, iot_array_range_i64_avx2, iot_array_range_ui64_avx2, iot_array_range_f32_avx2, iot_array_range_f64_avx2
+};
+#endif
+
+static const iot_array_sum_fn * iot_array_sum_fns = iot_array_sum_none;
+static const iot_array_range_fn * iot_array_range_fns = iot_array_range_none;
+
+void iot_data_array_select (uint32_t features)
+{
+  iot_array_sum_fns = iot_array_sum_none;
+  iot_array_range_fns = iot_array_range_none;
+#ifdef IOT_CPU_X86
+  if (features & IOT_CPU_AVX2)
+  {
+    iot_array_sum_fns = iot_array_sum_avx2;
+    iot_array_range_fns = iot_array_range_avx2;
+  }
+#endif
+}
+
+__attribute__((constructor)) static void iot_data_array_init (void)
+{
+  iot_data_array_select (iot_cpu_features ());
+}
+
+static const iot_array_load_fn iot_array_load_fns[IOT_ARRAY_TYPES] =
+{
+  iot_array_load_i8, iot_array_load_ui8, iot_array_load_i16, iot_array_load_ui16, iot_array_load_i32,
+  iot_array_load_ui32, iot_array_load_i64, iot_array_load_ui64, iot_array_load_f32, iot_array_load_f64
+};
+
+static const iot_array_store_fn iot_array_store_fns[IOT_ARRAY_TYPES] =
+{
+  iot_array_store_i8, iot_array_store_ui8, iot_array_store_i16, iot_array_store_ui16, iot_array_store_i32,
+  iot_array_store_ui32, iot_array_store_i64, iot_array_store_ui64, iot_array_store_f32, iot_array_store_f64
+};
+
+static const iot_array_key_fn iot_array_key_fns[IOT_ARRAY_TYPES] =
+{
+  iot_array_key_i8, iot_array_key_ui8, iot_array_key_i16, iot_array_key_ui16, iot_array_key_i32,
+  iot_array_key_ui32, iot_array_key_i64, iot_array_key_ui64, iot_array_key_f32, iot_array_key_f64
+};
+
+// Least significant byte first radix sort, skipping passes where all elements have the same key byte
+
+static void iot_array_radix_sort (uint8_t * data, uint32_t len, uint32_t size, iot_array_key_fn key)
+{
+  uint8_t * tmp = malloc ((size_t) len * size);
+  uint8_t * src = data;
+  uint8_t * dst = tmp;
+  uint32_t count[256];
+
+  for (uint32_t shift = 0; shift < size * 8u; shift += 8u)
+  {
+    memset (count, 0, sizeof (count));
+    for (uint32_t i = 0; i < len; i++) count[(key (src + (size_t) i * size) >> shift) & 0xffu]++;
+    if (count[(key (src) >> shift) & 0xffu] == len) continue;
+    for (uint32_t b = 0, total = 0; b < 256u; b++)
+    {
+      uint32_t c = count[b];
+      count[b] = total;
+      total += c;
+    }
+    for (uint32_t i = 0; i < len; i++)
+    {
+      const uint8_t * elem = src + (size_t) i * size;
+      memcpy (dst + (size_t) (count[(key (elem) >> shift) & 0xffu]++) * size, elem, size);
+    }
+    uint8_t * swap = src;
+    src = dst;
+    dst = swap;
+  }
+  if (src != data) memcpy (data, src, (size_t) len * size);
+  free (tmp);
+}
+
+bool iot_data_array_sort (iot_data_t * array)
+{
+  assert (array);
+  iot_data_type_t type = iot_data_array_type (array);
+  uint32_t len = iot_data_array_length (array);
+  if (! IOT_ARRAY_IS_NUMERIC (type)) return false;
+  if (len > 1u)
+  {
+    iot_array_radix_sort ((uint8_t*) iot_data_address (array), len, iot_data_type_size (type), iot_array_key_fns[type]);
+    array->rehash = true;
+  }
+  return true;
+}
+
+bool iot_data_array_search (const iot_data_t * array, const iot_data_t * value, uint32_t * index)
+{
+  assert (array && value);
+  iot_data_type_t type = iot_data_array_type (array);
+  uint32_t len = iot_data_array_length (array);
+  uint32_t size = iot_data_type_size (type);
+  const uint8_t * data = iot_data_address (array);
+  uint64_t val = 0u;
+  uint32_t lo = 0u;
+  uint32_t hi = len;
+  if (! IOT_ARRAY_IS_NUMERIC (type) || ! iot_data_cast (value, type, &val)) return false;
+  iot_array_key_fn key = iot_array_key_fns[type];
+  uint64_t target = key (&val);
+  while (lo < hi)
+  {
+    uint32_t mid = lo + (hi - lo) / 2u;
+    if (key (data + (size_t) mid * size) < target) lo = mid + 1u; else hi = mid;
+  }
+  if (index) *index = lo;
+  return (lo < len) && (key (data + (size_t) lo * size) == target);
+}
+
+bool iot_data_array_sum (const iot_data_t * array, double * sum)
+{
+  assert (array && sum);
+  iot_data_type_t type = iot_data_array_type (array);
+  uint32_t len = iot_data_array_length (array);
+  if (len == 0 || ! IOT_ARRAY_IS_NUMERIC (type)) return false;
+  *sum = (iot_array_sum_fns[type]) (iot_data_address (array), len);
+  return true;
+}
+
+bool iot_data_array_mean (const iot_data_t * array, double * mean)
+{
+  assert (mean);
+  bool ok = iot_data_array_sum (array, mean);
+  if (ok) *mean /= iot_data_array_length (array);
+  return ok;
+}
+
+bool iot_data_array_range (const iot_data_t * array, double * min, double * max)
+{
+  assert (array && min && max);
+  iot_data_type_t type = iot_data_array_type (array);
+  uint32_t len = iot_data_array_length (array);
+  if (len == 0 || ! IOT_ARRAY_IS_NUMERIC (type)) return false;
+  (iot_array_range_fns[type]) (iot_data_address (array), len, min, max);
+  return true;
+}
+
+bool iot_data_array_min (const iot_data_t * array, double * min)
+{
+  double max;
+  return iot_data_array_range (array, min, &max);
+}
+
+bool iot_data_array_max (const iot_data_t * array, double * max)
+{
+  double min;
+  return iot_data_array_range (array, &min, max);
+}
+
+iot_data_t * iot_data_array_scale (const iot_data_t * array, double scale, double offset, iot_data_type_t type)
+{
+  assert (array && IOT_ARRAY_IS_NUMERIC (type) && IOT_ARRAY_IS_NUMERIC (iot_data_array_type (array)));
+  iot_data_type_t in_type = iot_data_array_type (array);
+  uint32_t len = iot_data_array_length (array);
+  uint32_t in_size = iot_data_type_size (in_type);
+  uint32_t out_size = iot_data_type_size (type);
+  const uint8_t * in = iot_data_address (array);
+  uint8_t * out = len ? malloc ((size_t) len * out_size) : NULL;
+  bool transform = (scale != 1.0) || (offset != 0.0);
+  double buff[IOT_ARRAY_CHUNK];
+
+  if (! transform && in_type == type)
+  {
+    if (len) memcpy (out, in, (size_t) len * out_size);
+  }
+  else
+  {
+    for (uint32_t pos = 0; pos < len; pos += IOT_ARRAY_CHUNK)
+    {
+      uint32_t count = ((len - pos) < IOT_ARRAY_CHUNK) ? (len - pos) : IOT_ARRAY_CHUNK;
+      (iot_array_load_fns[in_type]) (in + (size_t) pos * in_size, buff, count);
+      if (transform)
+      {
+        for (uint32_t i = 0; i < count; i++) buff[i] = buff[i] * scale + offset;
+      }
+      (iot_array_store_fns[type]) (buff, out + (size_t) pos * out_size, count);
+    }
+  }
+  return iot_data_alloc_array (out, len, type, IOT_DATA_TAKE);
+}
+
+iot_data_t * iot_data_array_convert (const iot_data_t * array, iot_data_type_t type)
+{
+  return iot_data_array_scale (array, 1.0, 0.0, type);
+}
@@ -6,18 +6,50 @@
 #include "iot/data.h"
 #include "data-impl.h"
 #include <endian.h>
+#include <sys/uio.h>
+#include <math.h>
 
 #define IOT_CBOR_BUFF_SIZE 512u
 #define IOT_CBOR_BUFF_DOUBLING_LIMIT 4096u
 #define IOT_CBOR_BUFF_INCREMENT 1024u
+#define IOT_CBOR_MAX_DEPTH 64u
+#define IOT_CBOR_INDEFINITE 31u
+#define IOT_CBOR_BREAK 0xffu
+#define IOT_CBOR_TAG_TYPED_ARRAY_MIN 64u
+#define IOT_CBOR_TAG_TYPED_ARRAY_MAX 87u
+#define IOT_CBOR_TAG_MULTI_DIM_ARRAY 40u
+#define IOT_CBOR_IOVEC_MIN 256u
+#define IOT_CBOR_IOVEC_SEGS 8u
+
+typedef struct iot_cbor_segment_t
+{
+  size_t offset;         // Offset in header buffer at which payload is inserted
+  const void * data;     // Payload referenced in place
+  size_t length;         // Payload length
+} iot_cbor_segment_t;
 
 typedef struct iot_cbor_holder_t
 {
   uint8_t * data;
   size_t size;
   size_t index;
+  bool sizing;                  // Only count encoded size, nothing written
+  iot_cbor_segment_t * segs;    // Payloads referenced in place, if encoding to an iovec
+  uint32_t nsegs;
+  uint32_t maxsegs;
+  uint8_t scratch[9];           // Written to when sizing
+  iot_data_encode_cache_t * cache; // If set, cached encodings of frozen data spliced in
 } iot_cbor_holder_t;
 
+typedef struct iot_cbor_reader_t
+{
+  const uint8_t * data;
+  size_t size;
+  size_t index;
+  iot_data_t * cache;
+  uint32_t depth;
+} iot_cbor_reader_t;
+
 static void iot_cbor_holder_check_size (iot_cbor_holder_t * holder, size_t required)
 {
   size_t total = holder->index + required;
@@ -30,52 +62,108 @@ static void iot_cbor_holder_check_size (iot_cbor_holder_t * holder, size_t requi
   }
 }
 
+// Reserve space for an item head of at most nine bytes, returning where to write it
+
+static uint8_t * iot_cbor_holder_reserve (iot_cbor_holder_t * holder, size_t required)
+{
+  uint8_t * ptr = holder->scratch;
+  if (! holder->sizing)
+  {
+    iot_cbor_holder_check_size (holder, required);
+    ptr = holder->data + holder->index;
+  }
+  holder->index += required;
+  return ptr;
+}
+
+static inline void iot_data_cbor_write_byte (iot_cbor_holder_t * holder, uint8_t byte)
+{
+  *iot_cbor_holder_reserve (holder, 1) = byte;
+}
+
 static void iot_data_cbor_write_bytes (iot_cbor_holder_t * holder, const void *data, size_t length)
 {
-  iot_cbor_holder_check_size (holder, length);
-  memcpy (holder->data + holder->index, data, length);
-  holder->index += length;
+  if (holder->segs && length >= IOT_CBOR_IOVEC_MIN)
+  {
+    if (holder->nsegs == holder->maxsegs)
+    {
+      holder->maxsegs *= 2u;
+      holder->segs = realloc (holder->segs, holder->maxsegs * sizeof (*holder->segs));
+    }
+    holder->segs[holder->nsegs++] = (iot_cbor_segment_t) { .offset = holder->index, .data = data, .length = length };
+  }
+  else if (holder->sizing)
+  {
+    holder->index += length;
+  }
+  else
+  {
+    iot_cbor_holder_check_size (holder, length);
+    memcpy (holder->data + holder->index, data, length);
+    holder->index += length;
+  }
 }
 
 static void iot_data_cbor_write_uint (iot_cbor_holder_t * holder, uint64_t value, uint8_t tag)
 {
+  uint8_t * ptr;
   if (value < 0x18)
   {
-    iot_cbor_holder_check_size (holder, 1);
-    holder->data[holder->index++] = (uint8_t) (value + tag);
+    iot_data_cbor_write_byte (holder, (uint8_t) (value + tag));
   }
   else if (value <= UINT8_MAX)
   {
-    iot_cbor_holder_check_size (holder, 2);
-    holder->data[holder->index++] = 0x18 + tag;
-    holder->data[holder->index++] = (uint8_t) value;
+    ptr = iot_cbor_holder_reserve (holder, 2);
+    ptr[0] = 0x18 + tag;
+    ptr[1] = (uint8_t) value;
   }
   else if (value <= UINT16_MAX)
   {
-    iot_cbor_holder_check_size (holder, 3);
-    holder->data[holder->index++] = 0x19 + tag;
-    *(uint16_t *)(holder->data + holder->index) = htobe16 (value);
-    holder->index += 2;
+    uint16_t v = htobe16 (value);
+    ptr = iot_cbor_holder_reserve (holder, 3);
+    ptr[0] = 0x19 + tag;
+    memcpy (ptr + 1, &v, sizeof (v));
   }
   else if (value <= UINT32_MAX)
   {
-    iot_cbor_holder_check_size (holder, 5);
-    holder->data[holder->index++] = 0x1a + tag;
-    *(uint32_t *)(holder->data + holder->index) = htobe32 (value);
-    holder->index += 4;
+    uint32_t v = htobe32 (value);
+    ptr = iot_cbor_holder_reserve (holder, 5);
+    ptr[0] = 0x1a + tag;
+    memcpy (ptr + 1, &v, sizeof (v));
   }
   else
   {
-    iot_cbor_holder_check_size (holder, 9);
-    holder->data[holder->index++] = 0x1b + tag;
-    *(uint64_t *)(holder->data + holder->index) = htobe64 (value);
-    holder->index += 8;
+    uint64_t v = htobe64 (value);
+    ptr = iot_cbor_holder_reserve (holder, 9);
+    ptr[0] = 0x1b + tag;
+    memcpy (ptr + 1, &v, sizeof (v));
   }
 }
 
 static void iot_data_cbor_write_int (iot_cbor_holder_t * holder, int64_t value)
 {
-  iot_data_cbor_write_uint (holder, value < 0 ? -value : value, value < 0 ? 0x20 : 0);
+  // Negative integers are encoded as -1 - value
+  iot_data_cbor_write_uint (holder, value < 0 ? (uint64_t) (-1 - value) : (uint64_t) value, value < 0 ? 0x20 : 0);
+}
+
+static void iot_data_cbor_write_f32 (iot_cbor_holder_t * holder, float value)
+{
+  uint32_t v;
+  memcpy (&v, &value, sizeof (v));
+  v = htobe32 (v);
+  uint8_t * ptr = iot_cbor_holder_reserve (holder, 5);
+  ptr[0] = 0xfa;
+  memcpy (ptr + 1, &v, sizeof (v));
+}
+
+static void iot_data_cbor_write_f64 (iot_cbor_holder_t * holder, double value)
+{
+  uint64_t v;
+  memcpy (&v, &value, sizeof (v));
+  v = htobe64 (v);
+  uint8_t * ptr = iot_cbor_holder_reserve (holder, 9);
+  ptr[0] = 0xfb;
+  memcpy (ptr + 1, &v, sizeof (v));
 }
 
 static void iot_data_dump_cbor_ptr (iot_cbor_holder_t * holder, const void * ptr, const iot_data_type_t type)
@@ -90,16 +178,58 @@ static void iot_data_dump_cbor_ptr (iot_cbor_holder_t * holder, const void * ptr
     case IOT_DATA_UINT32: iot_data_cbor_write_uint (holder, *(const uint32_t *) ptr, 0); break;
     case IOT_DATA_INT64: iot_data_cbor_write_int (holder, *(const int64_t *) ptr); break;
     case IOT_DATA_UINT64: iot_data_cbor_write_uint (holder, *(const uint64_t *) ptr, 0); break;
-    case IOT_DATA_FLOAT32: iot_data_cbor_write_uint (holder, *(const uint32_t *) ptr, 0xe0); break;
-    case IOT_DATA_FLOAT64: iot_data_cbor_write_uint (holder, *(const uint64_t *) ptr, 0xe0); break;
+    case IOT_DATA_FLOAT32: iot_data_cbor_write_f32 (holder, *(const float *) ptr); break;
+    case IOT_DATA_FLOAT64: iot_data_cbor_write_f64 (holder, *(const double *) ptr); break;
     case IOT_DATA_NULL:
-      iot_cbor_holder_check_size (holder, 1); holder->data[holder->index++] = 0xf6; break;
+      iot_data_cbor_write_byte (holder, 0xf6); break;
     default:
-      iot_cbor_holder_check_size (holder, 1); holder->data[holder->index++] = *(const bool *)ptr ? 0xf5 : 0xf4; break;
+      iot_data_cbor_write_byte (holder, *(const bool *)ptr ? 0xf5 : 0xf4); break;
   }
 }
 
-static void iot_data_dump_cbor (iot_cbor_holder_t * holder, const iot_data_t * data)
+// Write RFC 8746 typed array tag and native byte order elements, tag bits are 010fsell: f float, s signed, e little endian, ll length
+
+static void iot_data_dump_cbor_typed_array (iot_cbor_holder_t * holder, const iot_data_t * array, iot_data_type_t type)
+{
+  uint32_t esize = iot_data_type_size (type);
+  uint64_t tag = IOT_CBOR_TAG_TYPED_ARRAY_MIN;
+  if (type == IOT_DATA_FLOAT32 || type == IOT_DATA_FLOAT64)
+  {
+    tag |= 0x10u | ((type == IOT_DATA_FLOAT32) ? 1u : 2u);
+  }
+  else
+  {
+    if (type == IOT_DATA_INT8 || type == IOT_DATA_INT16 || type == IOT_DATA_INT32 || type == IOT_DATA_INT64) tag |= 0x08u;
+    tag |= (esize == 8u) ? 3u : (esize >> 1u);
+  }
+  if (esize > 1u && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)) tag |= 0x04u;
+  iot_data_cbor_write_uint (holder, tag, 0xC0);
+  iot_data_cbor_write_uint (holder, iot_data_array_size (array), 0x40);
+  iot_data_cbor_write_bytes (holder, iot_data_address (array), iot_data_array_size (array));
+}
+
+// Write row major boolean array elements as nested arrays, having no typed array encoding
+
+static void iot_data_dump_cbor_shaped (iot_cbor_holder_t * holder, const uint8_t ** ptr, const uint32_t * dims, uint32_t ndims, iot_data_type_t type, uint32_t esize)
+{
+  iot_data_cbor_write_uint (holder, dims[0], 0x80);
+  for (uint32_t i = 0; i < dims[0]; i++)
+  {
+    if (ndims > 1u)
+    {
+      iot_data_dump_cbor_shaped (holder, ptr, dims + 1, ndims - 1u, type, esize);
+    }
+    else
+    {
+      iot_data_dump_cbor_ptr (holder, *ptr, type);
+      *ptr += esize;
+    }
+  }
+}
+
+static void iot_data_dump_cbor (iot_cbor_holder_t * holder, const iot_data_t * data);
+
+static void iot_data_dump_cbor_value (iot_cbor_holder_t * holder, const iot_data_t * data)
 {
   switch (data->type)
   {
@@ -128,24 +258,13 @@ static void iot_data_dump_cbor (iot_cbor_holder_t * holder, const iot_data_t * d
       iot_data_cbor_write_int (holder, iot_data_i64 (data));
       break;
     case IOT_DATA_FLOAT32:
-    {
-      uint32_t v;
-      float f = iot_data_f32 (data);
-      memcpy (&v, &f, sizeof (v));
-      iot_data_cbor_write_uint (holder, v, 0xe0);
+      iot_data_cbor_write_f32 (holder, iot_data_f32 (data));
       break;
-    }
     case IOT_DATA_FLOAT64:
-    {
-      uint64_t v;
-      double d = iot_data_f64 (data);
-      memcpy (&v, &d, sizeof (v));
-      iot_data_cbor_write_uint (holder, v, 0xe0);
+      iot_data_cbor_write_f64 (holder, iot_data_f64 (data));
       break;
-    }
     case IOT_DATA_BOOL:
-      iot_cbor_holder_check_size (holder, 1);
-      holder->data[holder->index++] = iot_data_bool (data) ? 0xf5 : 0xf4;
+      iot_data_cbor_write_byte (holder, iot_data_bool (data) ? 0xf5 : 0xf4);
       break;
     case IOT_DATA_POINTER:
       break;
@@ -158,8 +277,7 @@ static void iot_data_dump_cbor (iot_cbor_holder_t * holder, const iot_data_t * d
       break;
     }
     case IOT_DATA_NULL:
-      iot_cbor_holder_check_size (holder, 1);
-      holder->data[holder->index++] = 0xf6;
+      iot_data_cbor_write_byte (holder, 0xf6);
       break;
     case IOT_DATA_BINARY:
       iot_data_cbor_write_uint (holder, iot_data_array_size (data), 0x40);
@@ -169,6 +287,23 @@ static void iot_data_dump_cbor (iot_cbor_holder_t * holder, const iot_data_t * d
     {
       iot_data_array_iter_t iter;
       iot_data_type_t type = iot_data_array_type (data);
+      const iot_data_t * shape = iot_data_array_shape (data);
+      if (shape && type == IOT_DATA_BOOL)
+      {
+        const uint8_t * ptr = iot_data_address (data);
+        iot_data_dump_cbor_shaped (holder, &ptr, iot_data_address (shape), iot_data_array_length (shape), type, iot_data_type_size (type));
+        break;
+      }
+      if (shape)
+      {
+        const uint32_t * dims = iot_data_address (shape);
+        iot_data_cbor_write_uint (holder, IOT_CBOR_TAG_MULTI_DIM_ARRAY, 0xC0);
+        iot_data_cbor_write_uint (holder, 2u, 0x80);
+        iot_data_cbor_write_uint (holder, iot_data_array_length (shape), 0x80);
+        for (uint32_t i = 0; i < iot_data_array_length (shape); i++) iot_data_cbor_write_uint (holder, dims[i], 0);
+        iot_data_dump_cbor_typed_array (holder, data, type);
+        break;
+      }
       iot_data_cbor_write_uint (holder, iot_data_array_length (data), 0x80);
       iot_data_array_iter (data, &iter);
       while (iot_data_array_iter_next (&iter))
@@ -215,8 +350,7 @@ static void iot_data_dump_cbor (iot_cbor_holder_t * holder, const iot_data_t * d
         }
         else
         {
-          iot_cbor_holder_check_size (holder, 1);
-          holder->data[holder->index++] = 0xf6;  // null
+          iot_data_cbor_write_byte (holder, 0xf6);  // null
         }
       }
       break;
@@ -229,6 +363,31 @@ static void iot_data_dump_cbor (iot_cbor_holder_t * holder, const iot_data_t * d
   }
 }
 
+// Splice in any cached encoding of frozen data, else encode and cache it
+
+static void iot_data_dump_cbor (iot_cbor_holder_t * holder, const iot_data_t * data)
+{
+  if (iot_data_encode_cacheable (holder->cache, data))
+  {
+    uint32_t len;
+    const char * cached = iot_data_encode_cache_get (holder->cache, data, IOT_DATA_ENCODE_CBOR, &len);
+    if (cached)
+    {
+      iot_data_cbor_write_bytes (holder, cached, len);
+    }
+    else
+    {
+      size_t start = holder->index;
+      iot_data_dump_cbor_value (holder, data);
+      iot_data_encode_cache_put (holder->cache, data, IOT_DATA_ENCODE_CBOR, holder->data + start, holder->index - start);
+    }
+  }
+  else
+  {
+    iot_data_dump_cbor_value (holder, data);
+  }
+}
+
 iot_data_t * iot_data_to_cbor (const iot_data_t * data)
 {
   return iot_data_to_cbor_with_size (data, IOT_CBOR_BUFF_SIZE);
@@ -236,11 +395,8 @@ iot_data_t * iot_data_to_cbor (const iot_data_t * data)
 
 iot_data_t * iot_data_to_cbor_with_size (const iot_data_t * data, uint32_t size)
 {
-  iot_cbor_holder_t holder;
+  iot_cbor_holder_t holder = { .data = malloc (size), .size = size };
   assert (data && size > 0);
-  holder.data = malloc (size);
-  holder.size = size;
-  holder.index = 0;
   iot_data_dump_cbor (&holder, data);
   if (holder.index <= UINT32_MAX)
   {
@@ -252,3 +408,426 @@ iot_data_t * iot_data_to_cbor_with_size (const iot_data_t * data, uint32_t size)
     return NULL;
   }
 }
+
+iot_data_t * iot_data_to_cbor_canonical (const iot_data_t * data, iot_data_encode_cache_t * cache)
+{
+  iot_cbor_holder_t holder = { .data = malloc (IOT_CBOR_BUFF_SIZE), .size = IOT_CBOR_BUFF_SIZE, .cache = cache };
+  assert (data);
+  iot_data_dump_cbor (&holder, data);
+  if (holder.index <= UINT32_MAX)
+  {
+    return iot_data_alloc_binary (holder.data, (uint32_t) holder.index, IOT_DATA_TAKE);
+  }
+  free (holder.data);
+  return NULL;
+}
+
+size_t iot_data_cbor_size (const iot_data_t * data)
+{
+  iot_cbor_holder_t holder = { .sizing = true };
+  assert (data);
+  iot_data_dump_cbor (&holder, data);
+  return holder.index;
+}
+
+size_t iot_data_to_cbor_buffer (const iot_data_t * data, uint8_t * buff, size_t size)
+{
+  assert (data && buff);
+  size_t required = iot_data_cbor_size (data);
+  if (required > size) return 0u;
+  iot_cbor_holder_t holder = { .data = buff, .size = required };
+  iot_data_dump_cbor (&holder, data);
+  assert (holder.data == buff && holder.index == required);
+  return required;
+}
+
+struct iovec * iot_data_to_cbor_iovec (const iot_data_t * data, uint32_t * count)
+{
+  assert (data && count);
+  iot_cbor_holder_t holder = { .data = malloc (IOT_CBOR_BUFF_SIZE), .size = IOT_CBOR_BUFF_SIZE, .maxsegs = IOT_CBOR_IOVEC_SEGS };
+  holder.segs = malloc (holder.maxsegs * sizeof (*holder.segs));
+  iot_data_dump_cbor (&holder, data);
+
+  // Single allocation of iovec array followed by the header bytes, one header vector before each payload and one after the last
+
+  uint32_t max = 2u * holder.nsegs + 1u;
+  struct iovec * iov = malloc (max * sizeof (*iov) + holder.index);
+  uint8_t * headers = (uint8_t*) (iov + max);
+  size_t offset = 0u;
+  uint32_t n = 0u;
+  memcpy (headers, holder.data, holder.index);
+  for (uint32_t i = 0; i <= holder.nsegs; i++)
+  {
+    size_t end = (i < holder.nsegs) ? holder.segs[i].offset : holder.index;
+    if (end > offset) iov[n++] = (struct iovec) { .iov_base = headers + offset, .iov_len = end - offset };
+    if (i < holder.nsegs) iov[n++] = (struct iovec) { .iov_base = (void*) holder.segs[i].data, .iov_len = holder.segs[i].length };
+    offset = end;
+  }
+  free (holder.segs);
+  free (holder.data);
+  *count = n;
+  return iov;
+}
+
+static bool iot_cbor_read_uint (iot_cbor_reader_t * reader, uint8_t info, uint64_t * val)
+{
+  size_t len = (info < 24u) ? 0u : (info <= 27u) ? (1u << (info - 24u)) : SIZE_MAX;
+  if ((len == SIZE_MAX) || (reader->size - reader->index) < len) return false;
+  const uint8_t * ptr = reader->data + reader->index;
+  *val = (len == 0u) ? info : 0u;
+  for (size_t i = 0; i < len; i++) *val = (*val << 8) | ptr[i];
+  reader->index += len;
+  return true;
+}
+
+// Read item header, returning major type and argument. Argument info is IOT_CBOR_INDEFINITE for indefinite length items.
+
+static bool iot_cbor_read_head (iot_cbor_reader_t * reader, uint8_t * major, uint8_t * info, uint64_t * val)
+{
+  if (reader->index >= reader->size) return false;
+  uint8_t byte = reader->data[reader->index++];
+  *major = byte >> 5;
+  *info = byte & 0x1f;
+  if ((*info == IOT_CBOR_INDEFINITE) && (*major >= 2u) && (*major <= 5u)) return true;
+  return iot_cbor_read_uint (reader, *info, val);
+}
+
+static inline bool iot_cbor_at_break (iot_cbor_reader_t * reader)
+{
+  bool brk = (reader->index < reader->size) && (reader->data[reader->index] == IOT_CBOR_BREAK);
+  if (brk) reader->index++;
+  return brk;
+}
+
+// Read definite or indefinite length byte or text string, appending to buffer
+
+static bool iot_cbor_read_bytes (iot_cbor_reader_t * reader, uint8_t major, uint8_t info, uint64_t len, uint8_t ** buff, size_t * size)
+{
+  if (info == IOT_CBOR_INDEFINITE)
+  {
+    while (! iot_cbor_at_break (reader))
+    {
+      uint8_t cmajor;
+      uint8_t cinfo;
+      uint64_t clen;
+      if (! iot_cbor_read_head (reader, &cmajor, &cinfo, &clen) || (cmajor != major) || (cinfo == IOT_CBOR_INDEFINITE)) return false;
+      if (! iot_cbor_read_bytes (reader, major, cinfo, clen, buff, size)) return false;
+    }
+    return true;
+  }
+  if ((reader->size - reader->index) < len) return false;
+  *buff = realloc (*buff, *size + len + 1u); // Allow for string terminator
+  memcpy (*buff + *size, reader->data + reader->index, len);
+  *size += len;
+  (*buff)[*size] = 0;
+  reader->index += len;
+  return true;
+}
+
+static double iot_cbor_half_to_double (uint16_t half)
+{
+  int exp = (half >> 10) & 0x1f;
+  int mant = half & 0x3ff;
+  double val;
+  if (exp == 0) val = ldexp (mant, -24);
+  else if (exp != 31) val = ldexp (mant + 1024, exp - 25);
+  else val = (mant == 0) ? INFINITY : NAN;
+  return (half & 0x8000) ? -val : val;
+}
+
+// Decode RFC 8746 typed array, tag bits are 010fsell: f float, s signed, e little endian, ll length
+
+static iot_data_t * iot_cbor_typed_array (uint64_t tag, uint8_t * bytes, size_t size)
+{
+  static const iot_data_type_t int_types[2][4] =
+  {
+    { IOT_DATA_UINT8, IOT_DATA_UINT16, IOT_DATA_UINT32, IOT_DATA_UINT64 },
+    { IOT_DATA_INT8, IOT_DATA_INT16, IOT_DATA_INT32, IOT_DATA_INT64 }
+  };
+  static const iot_data_type_t float_types[4] = { IOT_DATA_INVALID, IOT_DATA_FLOAT32, IOT_DATA_FLOAT64, IOT_DATA_INVALID };
+  bool is_float = (tag & 0x10u) != 0;
+  bool is_signed = (tag & 0x08u) != 0;
+  bool little = (tag & 0x04u) != 0;
+  iot_data_type_t type = is_float ? float_types[tag & 0x03u] : int_types[is_signed][tag & 0x03u];
+  if (type == IOT_DATA_INVALID) return NULL; // Half and quad precision not supported
+  uint32_t esize = iot_data_type_size (type);
+  if ((size % esize) || (size / esize) > UINT32_MAX) return NULL;
+  if (esize > 1u && little != (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__))
+  {
+    for (uint8_t * ptr = bytes; ptr < bytes + size; ptr += esize)
+    {
+      for (uint32_t i = 0; i < esize / 2u; i++)
+      {
+        uint8_t tmp = ptr[i];
+        ptr[i] = ptr[esize - 1u - i];
+        ptr[esize - 1u - i] = tmp;
+      }
+    }
+  }
+  return iot_data_alloc_array (bytes, (uint32_t) (size / esize), type, IOT_DATA_TAKE);
+}
+
+static iot_data_t * iot_cbor_decode (iot_cbor_reader_t * reader);
+
+static iot_data_t * iot_cbor_decode_array (iot_cbor_reader_t * reader, uint8_t info, uint64_t len)
+{
+  bool indefinite = (info == IOT_CBOR_INDEFINITE);
+  if (! indefinite && (len > (reader->size - reader->index))) return NULL; // Each element at least one byte
+  uint32_t size = indefinite ? 8u : (uint32_t) len;
+  uint32_t index = 0u;
+  iot_data_t * vector = iot_data_alloc_vector (size);
+  while (indefinite ? ! iot_cbor_at_break (reader) : (index < len))
+  {
+    iot_data_t * elem = iot_cbor_decode (reader);
+    if (elem == NULL)
+    {
+      iot_data_free (vector);
+      return NULL;
+    }
+    if (index == size) iot_data_vector_resize (vector, size *= 2u);
+    iot_data_vector_add (vector, index++, elem);
+  }
+  if (index != size) iot_data_vector_resize (vector, index);
+  return vector;
+}
+
+static iot_data_t * iot_cbor_decode_map (iot_cbor_reader_t * reader, uint8_t info, uint64_t len)
+{
+  bool indefinite = (info == IOT_CBOR_INDEFINITE);
+  if (! indefinite && (len > (reader->size - reader->index) / 2u)) return NULL; // Each entry at least two bytes
+  iot_data_type_t key_type = IOT_DATA_INVALID;
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_MULTI);
+  uint64_t count = 0u;
+  while (indefinite ? ! iot_cbor_at_break (reader) : (count++ < len))
+  {
+    iot_data_t * key = iot_cbor_decode (reader);
+    iot_data_t * value = key ? iot_cbor_decode (reader) : NULL;
+    if (value == NULL)
+    {
+      iot_data_free (key);
+      iot_data_free (map);
+      return NULL;
+    }
+    key_type = (key_type == IOT_DATA_INVALID || key_type == key->type) ? key->type : IOT_DATA_MULTI;
+    iot_data_map_add (map, key, value);
+  }
+  if (key_type != IOT_DATA_INVALID) map->key_type = key_type; // Set key type if all keys of same type
+  return map;
+}
+
+// Decode RFC 8746 row major multi dimensional array, an array of dimensions followed by a typed array
+
+static iot_data_t * iot_cbor_multi_dim_array (iot_data_t * pair)
+{
+  iot_data_t * array = NULL;
+  bool ok = (pair->type == IOT_DATA_VECTOR) && (iot_data_vector_size (pair) == 2u);
+  const iot_data_t * dimvec = ok ? iot_data_vector_get (pair, 0u) : NULL;
+  const iot_data_t * elements = ok ? iot_data_vector_get (pair, 1u) : NULL;
+  if (dimvec && elements && (dimvec->type == IOT_DATA_VECTOR) && (elements->type == IOT_DATA_ARRAY) && iot_data_vector_size (dimvec))
+  {
+    iot_data_t * dims = iot_data_vector_to_array (dimvec, IOT_DATA_UINT32, false);
+    if (iot_data_array_length (dims) == iot_data_vector_size (dimvec) && iot_data_array_length (elements) == 0u)
+    {
+      bool empty = false;
+      for (uint32_t i = 0; i < iot_data_array_length (dims); i++) empty = empty || (((const uint32_t*) iot_data_address (dims))[i] == 0u);
+      array = empty ? iot_data_add_ref (elements) : NULL; // Arrays with a zero dimension have no shape
+      iot_data_free (dims);
+    }
+    else if (iot_data_array_length (dims) == iot_data_vector_size (dimvec))
+    {
+      array = iot_data_add_ref (elements);
+      iot_data_set_metadata (array, dims, IOT_DATA_STATIC (&iot_data_shape));
+      if (iot_data_array_shape (array) == NULL) // Dimensions inconsistent with element count
+      {
+        iot_data_free (array);
+        array = NULL;
+      }
+    }
+    else
+    {
+      iot_data_free (dims);
+    }
+  }
+  iot_data_free (pair);
+  return array;
+}
+
+static iot_data_t * iot_cbor_decode (iot_cbor_reader_t * reader)
+{
+  iot_data_t * data = NULL;
+  uint8_t major;
+  uint8_t info;
+  uint64_t val = 0u;
+
+  if ((reader->depth >= IOT_CBOR_MAX_DEPTH) || ! iot_cbor_read_head (reader, &major, &info, &val)) return NULL;
+  reader->depth++;
+  switch (major)
+  {
+    case 0u: // Unsigned integer
+      data = (val <= INT64_MAX) ? iot_data_alloc_i64 ((int64_t) val) : iot_data_alloc_ui64 (val);
+      break;
+    case 1u: // Negative integer
+      data = (val <= INT64_MAX) ? iot_data_alloc_i64 (-1 - (int64_t) val) : iot_data_alloc_f64 (-1.0 - (double) val); // Below INT64_MIN as Float64
+      break;
+    case 2u: // Byte string
+    case 3u: // Text string
+    {
+      uint8_t * buff = NULL;
+      size_t size = 0u;
+      if (iot_cbor_read_bytes (reader, major, info, val, &buff, &size) && (size <= UINT32_MAX))
+      {
+        if (major == 3u)
+        {
+          data = iot_data_string_from_cache (buff ? (char*) buff : strdup (""), reader->cache);
+          buff = NULL;
+        }
+        else if (size)
+        {
+          data = iot_data_alloc_binary (buff, (uint32_t) size, IOT_DATA_TAKE);
+          buff = NULL;
+        }
+        else
+        {
+          data = iot_data_alloc_binary (NULL, 0u, IOT_DATA_REF);
+        }
+      }
+      free (buff);
+      break;
+    }
+    case 4u: data = iot_cbor_decode_array (reader, info, val); break;
+    case 5u: data = iot_cbor_decode_map (reader, info, val); break;
+    case 6u: // Tag, typed arrays decoded, other tags ignored
+    {
+      if (val >= IOT_CBOR_TAG_TYPED_ARRAY_MIN && val <= IOT_CBOR_TAG_TYPED_ARRAY_MAX)
+      {
+        uint8_t bmajor;
+        uint8_t binfo;
+        uint64_t blen;
+        uint8_t * buff = NULL;
+        size_t size = 0u;
+        if (iot_cbor_read_head (reader, &bmajor, &binfo, &blen) && (bmajor == 2u) && iot_cbor_read_bytes (reader, bmajor, binfo, blen, &buff, &size))
+        {
+          data = iot_cbor_typed_array (val, size ? buff : NULL, size);
+          if (data && size) buff = NULL;
+        }
+        free (buff);
+      }
+      else if (val == IOT_CBOR_TAG_MULTI_DIM_ARRAY)
+      {
+        data = iot_cbor_decode (reader);
+        if (data) data = iot_cbor_multi_dim_array (data);
+      }
+      else
+      {
+        data = iot_cbor_decode (reader);
+      }
+      break;
+    }
+    default: // Simple values and floats
+    {
+      switch (info)
+      {
+        case 20u: data = iot_data_alloc_bool (false); break;
+        case 21u: data = iot_data_alloc_bool (true); break;
+        case 22u: case 23u: data = iot_data_alloc_null (); break; // null and undefined
+        case 25u: data = iot_data_alloc_f32 ((float) iot_cbor_half_to_double ((uint16_t) val)); break;
+        case 26u:
+        {
+          uint32_t v = (uint32_t) val;
+          float f;
+          memcpy (&f, &v, sizeof (f));
+          data = iot_data_alloc_f32 (f);
+          break;
+        }
+        case 27u:
+        {
+          double d;
+          memcpy (&d, &val, sizeof (d));
+          data = iot_data_alloc_f64 (d);
+          break;
+        }
+        default: break;
+      }
+      break;
+    }
+  }
+  reader->depth--;
+  return data;
+}
+
+iot_data_t * iot_data_from_cbor (const uint8_t * cbor, uint32_t size)
+{
+  return iot_data_from_cbor_with_cache (cbor, size, NULL);
+}
+
+iot_data_t * iot_data_from_cbor_with_cache (const uint8_t * cbor, uint32_t size, iot_data_t * cache)
+{
+  assert (cbor || size == 0);
+  assert ((cache == NULL) || iot_data_map_key_is_of_type (cache, IOT_DATA_STRING));
+  iot_cbor_reader_t reader = { .data = cbor, .size = size, .index = 0u, .cache = cache, .depth = 0u };
+  iot_data_t * data = iot_cbor_decode (&reader);
+  if (data && (reader.index != reader.size)) // Trailing bytes
+  {
+    iot_data_free (data);
+    data = NULL;
+  }
+  return data;
+}
+
+// Skip a data item without decoding it, checking only that it is complete
+
+static bool iot_cbor_skip (iot_cbor_reader_t * reader)
+{
+  uint8_t major;
+  uint8_t info;
+  uint64_t val = 0u;
+  bool ok = true;
+
+  if ((reader->depth >= IOT_CBOR_MAX_DEPTH) || ! iot_cbor_read_head (reader, &major, &info, &val)) return false;
+  reader->depth++;
+  switch (major)
+  {
+    case 2u: // Byte string
+    case 3u: // Text string
+    {
+      if (info == IOT_CBOR_INDEFINITE)
+      {
+        while (ok && ! iot_cbor_at_break (reader)) ok = (reader->index < reader->size) && ((reader->data[reader->index] >> 5) == major) && iot_cbor_skip (reader);
+      }
+      else if ((reader->size - reader->index) < val)
+      {
+        ok = false;
+      }
+      else
+      {
+        reader->index += val;
+      }
+      break;
+    }
+    case 4u: // Array
+    case 5u: // Map
+    {
+      if (info == IOT_CBOR_INDEFINITE)
+      {
+        while (ok && ! iot_cbor_at_break (reader)) ok = iot_cbor_skip (reader) && ((major == 4u) || iot_cbor_skip (reader));
+        ok = ok && (reader->index <= reader->size);
+      }
+      else
+      {
+        uint64_t count = (major == 5u) ? 2u * val : val;
+        for (uint64_t i = 0; ok && i < count; i++) ok = iot_cbor_skip (reader);
+      }
+      break;
+    }
+    case 6u: ok = iot_cbor_skip (reader); break; // Tag
+    default: break; // Integers, simple values and floats have no content beyond the head
+  }
+  reader->depth--;
+  return ok;
+}
+
+size_t iot_data_cbor_item_size (const uint8_t * cbor, size_t size)
+{
+  iot_cbor_reader_t reader = { .data = cbor, .size = size, .index = 0u, .cache = NULL, .depth = 0u };
+  return iot_cbor_skip (&reader) ? reader.index : 0u;
+}
@@ -36,19 +36,95 @@ struct iot_data_t
   bool rehash : 1;
   bool tag1 : 1;
   bool tag2 : 1;
+  bool arena : 1;
+  bool view : 1;
+  bool frozen : 1;
+  bool clean : 1; // String known to need no json escaping
 };
 
+#define IOT_DATA_SINK_SIZE 512u
+#define IOT_DATA_SINK_PART (IOT_DATA_SINK_SIZE / 8u)
+
 typedef struct iot_string_holder_t
 {
   char * str;
   size_t size;
   size_t free;
+  iot_data_write_fn sink; // If set, buffer is a fixed size and flushed to sink rather than reallocated
+  void * ctx;
+  bool ok;
+  bool canonical;         // Ignore map ordering metadata
+  iot_data_encode_cache_t * cache; // If set, cached encodings of frozen data spliced in, not used with a sink
 } iot_string_holder_t;
 
+typedef enum iot_data_encode_kind_t
+{
+  IOT_DATA_ENCODE_JSON = 0,
+  IOT_DATA_ENCODE_CBOR = 1
+} iot_data_encode_kind_t;
+
+#define IOT_DATA_ENCODE_KINDS 2u
+
+bool iot_data_encode_cacheable (const iot_data_encode_cache_t * cache, const iot_data_t * data);
+
+const char * iot_data_encode_cache_get (const iot_data_encode_cache_t * cache, const iot_data_t * data, iot_data_encode_kind_t kind, uint32_t * length);
+
+void iot_data_encode_cache_put (iot_data_encode_cache_t * cache, const iot_data_t * data, iot_data_encode_kind_t kind, const void * bytes, size_t length);
+
+typedef struct iot_data_dedup_t iot_data_dedup_t;
+
+iot_data_dedup_t * iot_data_dedup_alloc (void);
+
+void iot_data_dedup_free (iot_data_dedup_t * set);
+
+size_t iot_data_dedup_range (iot_data_dedup_t * set, iot_data_t * data, iot_data_map_iter_t * iter, uint32_t start, uint32_t end);
+
+iot_data_t * iot_data_array_element_alloc (const iot_data_t * array, uint32_t index);
+
+iot_data_t * iot_data_string_from_cache (char * val, iot_data_t * cache);
+
+iot_data_t * iot_data_string_cached (iot_data_t * str, iot_data_t * cache);
+
+iot_data_t * iot_data_alloc_string_view (const char * str, iot_data_t * source);
+
+void iot_data_holder_flush (iot_string_holder_t * holder);
+
 void iot_data_holder_realloc (iot_string_holder_t * holder, size_t required);
 
 void iot_data_strcat_escape (iot_string_holder_t * holder, const char * add, bool escape);
 
+void iot_data_strcat_string (iot_string_holder_t * holder, const iot_data_t * str);
+
+// Number formatting for json, writing a terminated string of at most 24 characters and returning its length
+
+uint32_t iot_data_format_u64 (char * buff, uint64_t val);
+
+uint32_t iot_data_format_i64 (char * buff, int64_t val);
+
+uint32_t iot_data_format_f64 (char * buff, double val);
+
+uint32_t iot_data_format_f32 (char * buff, float val);
+
+// Parse a json number as a double, as strtod
+
+double iot_data_parse_f64 (const char * str);
+
+// As iot_data_from_json_with_context, but returns NULL if the json is invalid
+
+iot_data_t * iot_data_json_context_parse (iot_data_json_context_t * context, const char * json);
+
+#ifdef IOT_HAS_CBOR
+// Size of the first complete CBOR data item in a buffer, zero if the item is incomplete or not well formed
+
+size_t iot_data_cbor_item_size (const uint8_t * cbor, size_t size);
+#endif
+
+// Select the typed array reduction variants for a set of processor features (IOT_CPU_*), the portable code if none.
+// Selected for iot_cpu_features when loaded, otherwise only used by tests comparing variants.
+
+extern void iot_data_array_select (uint32_t features);
+
 extern iot_data_static_t iot_data_order;
+extern iot_data_static_t iot_data_shape;
 
 #endif
@@ -6,14 +6,31 @@
 #include "iot/data.h"
 #include "iot/json.h"
 #include "iot/base64.h"
+#include "iot/threadpool.h"
+#include "iot/thread.h"
 #include "data-impl.h"
 #include <math.h>
 #include <uchar.h>
 
 #define IOT_JSON_BUFF_SIZE 512u
 #define IOT_VAL_BUFF_SIZE 31u
+#define IOT_JSON_SHORT_SIZE 64u
 
-static iot_data_t * iot_data_value_from_json (iot_json_tok_t ** tokens, const char * json, bool ordered, iot_data_t * cache);
+// Context for parsing from JSON tokens
+
+typedef struct iot_data_json_ctx_t
+{
+  const char * json;        // JSON source
+  iot_data_t * cache;       // String cache map, if not using a pool
+  iot_data_t * source;      // Source buffer data, if parsing in place
+  iot_data_intern_t * pool; // String intern pool, if interning
+  bool ordered;             // Whether maps are ordered by position in JSON
+  iot_data_substitute_fn subst; // String substitution function, if substituting
+  void * subst_arg;         // Substitution function argument
+  bool * failed;            // Set if a substitution fails
+} iot_data_json_ctx_t;
+
+static iot_data_t * iot_data_value_from_json (iot_json_tok_t ** tokens, const iot_data_json_ctx_t * ctx);
 
 static inline void iot_data_strcat (iot_string_holder_t * holder, const char * add)
 {
@@ -25,12 +42,10 @@ static inline void iot_data_add_quote (iot_string_holder_t * holder)
   iot_data_strcat_escape (holder, "\"", false);
 }
 
-static void iot_data_base64_encode (iot_string_holder_t * holder, const iot_data_t * array)
+static void iot_data_base64_encode_part (iot_string_holder_t * holder, const uint8_t * data, uint32_t inLen)
 {
-  uint32_t inLen = iot_data_array_size (array);
   if (inLen)
   {
-    const uint8_t *data = iot_data_address (array);
     assert (strlen (holder->str) == (holder->size - holder->free - 1));
     size_t len = iot_b64_encodesize (inLen) - 1; /* Allow for string terminator */
     char *out;
@@ -47,6 +62,23 @@ static void iot_data_base64_encode (iot_string_holder_t * holder, const iot_data
   }
 }
 
+static void iot_data_base64_encode (iot_string_holder_t * holder, const iot_data_t * array)
+{
+  uint32_t inLen = iot_data_array_size (array);
+  const uint8_t * data = iot_data_address (array);
+  if (holder->sink) // Encode in parts that fit the sink buffer, a multiple of 3 bytes so encodes concatenate
+  {
+    const uint32_t part = (IOT_DATA_SINK_PART / 2u) * 3u;
+    while (inLen > part)
+    {
+      iot_data_base64_encode_part (holder, data, part);
+      data += part;
+      inLen -= part;
+    }
+  }
+  iot_data_base64_encode_part (holder, data, inLen);
+}
+
 static void iot_data_dump_json_ptr (iot_string_holder_t * holder, const void * ptr, const iot_data_type_t type)
 {
   if (holder->free < IOT_VAL_BUFF_SIZE)
@@ -54,33 +86,126 @@ static void iot_data_dump_json_ptr (iot_string_holder_t * holder, const void * p
     iot_data_holder_realloc (holder, IOT_VAL_BUFF_SIZE);
   }
   char * buff = holder->str + holder->size - holder->free - 1;
+  uint32_t len;
   switch (type)
   {
-    case IOT_DATA_INT8: snprintf (buff, IOT_VAL_BUFF_SIZE, "%" PRId8 , *(const int8_t *) ptr); break;
-    case IOT_DATA_UINT8: snprintf (buff, IOT_VAL_BUFF_SIZE, "%" PRIu8, *(const uint8_t *) ptr); break;
-    case IOT_DATA_INT16: snprintf (buff, IOT_VAL_BUFF_SIZE, "%" PRId16, *(const int16_t *) ptr); break;
-    case IOT_DATA_UINT16: snprintf (buff, IOT_VAL_BUFF_SIZE, "%" PRIu16, *(const uint16_t *) ptr); break;
-    case IOT_DATA_INT32: snprintf (buff, IOT_VAL_BUFF_SIZE, "%" PRId32, *(const int32_t *) ptr); break;
-    case IOT_DATA_UINT32: snprintf (buff, IOT_VAL_BUFF_SIZE, "%" PRIu32, *(const uint32_t *) ptr); break;
-    case IOT_DATA_INT64: snprintf (buff, IOT_VAL_BUFF_SIZE, "%" PRId64, *(const int64_t *) ptr); break;
-    case IOT_DATA_UINT64: snprintf (buff, IOT_VAL_BUFF_SIZE, "%" PRIu64, *(const uint64_t *) ptr); break;
-    case IOT_DATA_FLOAT32:
-      (fpclassify (*(const float*) ptr) == FP_INFINITE) ? snprintf (buff, IOT_VAL_BUFF_SIZE, "1e400") : snprintf (buff, IOT_VAL_BUFF_SIZE, "%.8e", *(const float*) ptr); break;
-    case IOT_DATA_FLOAT64:
-      (fpclassify (*(const double*) ptr) == FP_INFINITE) ? snprintf (buff, IOT_VAL_BUFF_SIZE, "1e800") : snprintf (buff, IOT_VAL_BUFF_SIZE, "%.16e", *(const double*) ptr); break;
-    case IOT_DATA_NULL: strncpy (buff, "null", IOT_VAL_BUFF_SIZE); break;
-    default: strncpy (buff, (*(const bool*) ptr) ? "true" : "false", IOT_VAL_BUFF_SIZE); break;
+    case IOT_DATA_INT8: len = iot_data_format_i64 (buff, *(const int8_t *) ptr); break;
+    case IOT_DATA_UINT8: len = iot_data_format_u64 (buff, *(const uint8_t *) ptr); break;
+    case IOT_DATA_INT16: len = iot_data_format_i64 (buff, *(const int16_t *) ptr); break;
+    case IOT_DATA_UINT16: len = iot_data_format_u64 (buff, *(const uint16_t *) ptr); break;
+    case IOT_DATA_INT32: len = iot_data_format_i64 (buff, *(const int32_t *) ptr); break;
+    case IOT_DATA_UINT32: len = iot_data_format_u64 (buff, *(const uint32_t *) ptr); break;
+    case IOT_DATA_INT64: len = iot_data_format_i64 (buff, *(const int64_t *) ptr); break;
+    case IOT_DATA_UINT64: len = iot_data_format_u64 (buff, *(const uint64_t *) ptr); break;
+    case IOT_DATA_FLOAT32: len = iot_data_format_f32 (buff, *(const float *) ptr); break;
+    case IOT_DATA_FLOAT64: len = iot_data_format_f64 (buff, *(const double *) ptr); break;
+    case IOT_DATA_NULL: strcpy (buff, "null"); len = 4u; break;
+    default: strcpy (buff, (*(const bool*) ptr) ? "true" : "false"); len = (*(const bool*) ptr) ? 4u : 5u; break;
   }
-  holder->free -= strlen (buff);
+  holder->free -= len;
 }
 
-static void iot_data_dump_json (iot_string_holder_t * holder, const iot_data_t * data)
+// Maximum length of a json formatted array element
+
+static uint32_t iot_data_json_element_max (iot_data_type_t type)
+{
+  switch (type)
+  {
+    case IOT_DATA_INT8: return 4u;
+    case IOT_DATA_UINT8: return 3u;
+    case IOT_DATA_INT16: return 6u;
+    case IOT_DATA_UINT16: return 5u;
+    case IOT_DATA_INT32: return 11u;
+    case IOT_DATA_UINT32: return 10u;
+    case IOT_DATA_FLOAT32: return 16u;
+    case IOT_DATA_BOOL: return 5u;
+    default: return 24u;
+  }
+}
+
+#define IOT_DATA_JSON_FORMAT(ctype,fn) \
+  { const ctype * vals = (const ctype*) ptr; for (uint32_t i = 0; i < count; i++) { out += fn (out, vals[i]); *out++ = ','; } break; }
+
+// Format comma separated array elements into a buffer of at least count * (max + 1) + 1 characters, returning the length
+
+static size_t iot_data_json_format_elements (char * buff, const void * ptr, uint32_t count, iot_data_type_t type)
+{
+  char * out = buff;
+  switch (type)
+  {
+    case IOT_DATA_INT8: IOT_DATA_JSON_FORMAT (int8_t, iot_data_format_i64)
+    case IOT_DATA_UINT8: IOT_DATA_JSON_FORMAT (uint8_t, iot_data_format_u64)
+    case IOT_DATA_INT16: IOT_DATA_JSON_FORMAT (int16_t, iot_data_format_i64)
+    case IOT_DATA_UINT16: IOT_DATA_JSON_FORMAT (uint16_t, iot_data_format_u64)
+    case IOT_DATA_INT32: IOT_DATA_JSON_FORMAT (int32_t, iot_data_format_i64)
+    case IOT_DATA_UINT32: IOT_DATA_JSON_FORMAT (uint32_t, iot_data_format_u64)
+    case IOT_DATA_INT64: IOT_DATA_JSON_FORMAT (int64_t, iot_data_format_i64)
+    case IOT_DATA_UINT64: IOT_DATA_JSON_FORMAT (uint64_t, iot_data_format_u64)
+    case IOT_DATA_FLOAT32: IOT_DATA_JSON_FORMAT (float, iot_data_format_f32)
+    case IOT_DATA_FLOAT64: IOT_DATA_JSON_FORMAT (double, iot_data_format_f64)
+    default:
+    {
+      const bool * vals = ptr;
+      for (uint32_t i = 0; i < count; i++)
+      {
+        memcpy (out, vals[i] ? "true," : "false,", vals[i] ? 5u : 6u);
+        out += vals[i] ? 5u : 6u;
+      }
+      break;
+    }
+  }
+  if (count) out--; // Remove trailing comma
+  *out = '\0';
+  return (size_t) (out - buff);
+}
+
+// Write array elements directly from the element buffer, reserving space for each run of elements up front.
+// When writing to a sink, runs are limited to what fits in the sink buffer.
+
+static void iot_data_dump_json_elements (iot_string_holder_t * holder, const uint8_t * ptr, uint32_t count, iot_data_type_t type)
+{
+  uint32_t max = iot_data_json_element_max (type) + 1u;
+  uint32_t esize = iot_data_type_size (type);
+  uint32_t run = holder->sink ? (uint32_t) ((holder->size - 2u) / max) : count;
+  iot_data_strcat (holder, "[");
+  for (uint32_t i = 0; i < count; i += run)
+  {
+    uint32_t n = (count - i < run) ? (count - i) : run;
+    if (i) iot_data_strcat (holder, ",");
+    if (holder->free < (size_t) n * max) iot_data_holder_realloc (holder, (size_t) n * max);
+    holder->free -= iot_data_json_format_elements (holder->str + holder->size - holder->free - 1, ptr + (size_t) i * esize, n, type);
+  }
+  iot_data_strcat (holder, "]");
+}
+
+// Write row major array elements as nested JSON arrays in a single pass over the element buffer
+
+static void iot_data_dump_json_shaped (iot_string_holder_t * holder, const uint8_t ** ptr, const uint32_t * dims, uint32_t ndims, iot_data_type_t type, uint32_t esize)
+{
+  if (ndims == 1u)
+  {
+    iot_data_dump_json_elements (holder, *ptr, dims[0], type);
+    *ptr += (size_t) dims[0] * esize;
+    return;
+  }
+  iot_data_strcat (holder, "[");
+  for (uint32_t i = 0; i < dims[0]; i++)
+  {
+    if (i) iot_data_strcat (holder, ",");
+    iot_data_dump_json_shaped (holder, ptr, dims + 1, ndims - 1u, type, esize);
+  }
+  iot_data_strcat (holder, "]");
+}
+
+static void iot_data_dump_json (iot_string_holder_t * holder, const iot_data_t * data);
+
+static void iot_data_dump_json_value (iot_string_holder_t * holder, const iot_data_t * data)
 {
   switch (data->type)
   {
     case IOT_DATA_STRING:
       iot_data_add_quote (holder);
-      iot_data_strcat (holder, iot_data_string (data));
+      iot_data_strcat_string (holder, data);
       iot_data_add_quote (holder);
       break;
     case IOT_DATA_BINARY:
@@ -91,20 +216,19 @@ static void iot_data_dump_json (iot_string_holder_t * holder, const iot_data_t *
     case IOT_DATA_ARRAY:
     {
       iot_data_type_t type = iot_data_array_type (data);
-      iot_data_array_iter_t iter;
-      iot_data_array_iter (data, &iter);
-      iot_data_strcat (holder, "[");
-      while (iot_data_array_iter_next (&iter))
+      const iot_data_t * shape = iot_data_array_shape (data);
+      if (shape)
       {
-        iot_data_dump_json_ptr (holder, iot_data_array_iter_value (&iter), type);
-        if (iot_data_array_iter_has_next (&iter)) iot_data_strcat (holder, ",");
+        const uint8_t * ptr = iot_data_address (data);
+        iot_data_dump_json_shaped (holder, &ptr, iot_data_address (shape), iot_data_array_length (shape), type, iot_data_type_size (type));
+        break;
       }
-      iot_data_strcat (holder, "]");
+      iot_data_dump_json_elements (holder, iot_data_address (data), iot_data_array_length (data), type);
       break;
     }
     case IOT_DATA_MAP:
     {
-      const iot_data_t * ordering = iot_data_get_metadata (data, IOT_DATA_STATIC (&iot_data_order));
+      const iot_data_t * ordering = holder->canonical ? NULL : iot_data_get_metadata (data, IOT_DATA_STATIC (&iot_data_order));
       iot_data_map_iter_t iter;
       iot_data_vector_iter_t vec_iter = { 0 };
       bool first = true;
@@ -170,6 +294,31 @@ static void iot_data_dump_json (iot_string_holder_t * holder, const iot_data_t *
   }
 }
 
+// Splice in any cached encoding of frozen data, else encode and cache it
+
+static void iot_data_dump_json (iot_string_holder_t * holder, const iot_data_t * data)
+{
+  if (iot_data_encode_cacheable (holder->cache, data))
+  {
+    uint32_t len;
+    const char * cached = iot_data_encode_cache_get (holder->cache, data, IOT_DATA_ENCODE_JSON, &len);
+    if (cached)
+    {
+      iot_data_strcat_escape (holder, cached, false);
+    }
+    else
+    {
+      size_t start = holder->size - holder->free - 1u;
+      iot_data_dump_json_value (holder, data);
+      iot_data_encode_cache_put (holder->cache, data, IOT_DATA_ENCODE_JSON, holder->str + start, holder->size - holder->free - 1u - start);
+    }
+  }
+  else
+  {
+    iot_data_dump_json_value (holder, data);
+  }
+}
+
 extern char * iot_data_to_json (const iot_data_t * data)
 {
   return iot_data_to_json_with_size (data, IOT_JSON_BUFF_SIZE);
@@ -188,81 +337,239 @@ extern char * iot_data_to_json_with_buffer (const iot_data_t * data, char * buff
   holder.str = buff;
   holder.size = size;
   holder.free = size - 1; // Allowing for string terminator
+  holder.sink = NULL;
+  holder.canonical = false;
+  holder.cache = NULL;
   *buff = 0;
   iot_data_dump_json (&holder, data);
   return holder.str;
 }
 
-static char * iot_data_string_from_json_token (const char * json, const iot_json_tok_t * token)
+extern char * iot_data_to_json_canonical (const iot_data_t * data, iot_data_encode_cache_t * cache)
 {
-  size_t len = (size_t) (token->end - token->start);
-  char * str = calloc (1u, len + 1u);
-  if (token->type == IOT_JSON_STRING_ESC)
+  assert (data);
+  iot_string_holder_t holder = { .str = malloc (IOT_JSON_BUFF_SIZE), .size = IOT_JSON_BUFF_SIZE, .free = IOT_JSON_BUFF_SIZE - 1, .canonical = true, .cache = cache };
+  *holder.str = 0;
+  iot_data_dump_json (&holder, data);
+  return holder.str;
+}
+
+extern bool iot_data_to_json_sink (const iot_data_t * data, iot_data_write_fn write_fn, void * ctx)
+{
+  char buff[IOT_DATA_SINK_SIZE];
+  iot_string_holder_t holder;
+  assert (data && write_fn);
+  holder.str = buff;
+  holder.size = sizeof (buff);
+  holder.free = sizeof (buff) - 1; // Allowing for string terminator
+  holder.sink = write_fn;
+  holder.ctx = ctx;
+  holder.ok = true;
+  holder.canonical = false;
+  holder.cache = NULL;
+  *buff = 0;
+  iot_data_dump_json (&holder, data);
+  iot_data_holder_flush (&holder);
+  return holder.ok;
+}
+
+static bool iot_data_json_count (void * ctx, const char * str, size_t len)
+{
+  (void) str;
+  *((size_t*) ctx) += len;
+  return true;
+}
+
+extern size_t iot_data_json_size (const iot_data_t * data)
+{
+  size_t size = 0u;
+  iot_data_to_json_sink (data, iot_data_json_count, &size);
+  return size;
+}
+
+// Unescape a JSON string, dst may be the same as src as unescaped strings are never longer
+
+static void iot_data_json_unescape_to (char * dst, const char * src, size_t len)
+{
+  const char * end = src + len;
+  while (src < end)
   {
-    const char *src = json + token->start;
-    char *dst = str;
-    while (src < json + token->start + len)
+    if (*src == '\\')
     {
-      if (*src == '\\')
-      {
-        switch (*++src)
-        {
-          case 'b': *dst++ = '\b'; break;
-          case 'f': *dst++ = '\f'; break;
-          case 'r': *dst++ = '\r'; break;
-          case 'n': *dst++ = '\n'; break;
-          case 't': *dst++ = '\t'; break;
-          case 'u':
-            if (src + 4 < json + token->start + len)
-            {
-              char32_t wc;
-              mbstate_t ps = { 0 };
-              sscanf (++src, "%4" SCNx32, &wc);
-              size_t charsz = c32rtomb (dst, wc, &ps);
-              if (charsz > 0) dst += charsz;
-              src += 3;
-            }
-            break;
-          default:
-            *dst++ = *src;
-        }
-        src++;
-      }
-      else
+      switch (*++src)
       {
-        *dst++ = *src++;
+        case 'b': *dst++ = '\b'; break;
+        case 'f': *dst++ = '\f'; break;
+        case 'r': *dst++ = '\r'; break;
+        case 'n': *dst++ = '\n'; break;
+        case 't': *dst++ = '\t'; break;
+        case 'u':
+          if (src + 4 < end)
+          {
+            char32_t wc;
+            mbstate_t ps = { 0 };
+            sscanf (++src, "%4" SCNx32, &wc);
+            size_t charsz = c32rtomb (dst, wc, &ps);
+            if (charsz > 0) dst += charsz;
+            src += 3;
+          }
+          break;
+        default:
+          *dst++ = *src;
       }
+      src++;
     }
+    else
+    {
+      *dst++ = *src++;
+    }
+  }
+  *dst = '\0';
+}
+
+static char * iot_data_json_unescape (const char * src, size_t len, bool escaped)
+{
+  char * str = calloc (1u, len + 1u);
+  if (escaped)
+  {
+    iot_data_json_unescape_to (str, src, len);
   }
   else
   {
-    memcpy (str, json + token->start, len);
+    memcpy (str, src, len);
   }
   return str;
 }
 
-static iot_data_t * iot_data_string_from_json (iot_json_tok_t ** tokens, const char * json, iot_data_t * cache)
+// When parsing in place, tokens are unescaped and terminated within the (writable) source buffer
+
+static inline char * iot_data_json_token_in_place (const char * json, const iot_json_tok_t * token)
 {
-  iot_data_t * str = iot_data_alloc_string (iot_data_string_from_json_token (json, *tokens), IOT_DATA_TAKE);
-  (*tokens)++;
-  const iot_data_t * cached = iot_data_map_get (cache, str);
-  if (cached)
+  char * str = (char*) json + token->start;
+  if (token->type == IOT_JSON_STRING_ESC)
   {
-    iot_data_free (str);
-    str = (iot_data_t*) cached;
+    iot_data_json_unescape_to (str, str, (size_t) (token->end - token->start));
   }
   else
   {
-    iot_data_map_add (cache, str, iot_data_add_ref (str));
+    str[token->end - token->start] = '\0';
   }
-  return iot_data_add_ref (str);
+  return str;
 }
 
-static iot_data_t * iot_data_primitive_from_json (iot_json_tok_t ** tokens, const char * json)
+static inline char * iot_data_string_from_json_token (const char * json, const iot_json_tok_t * token)
 {
-  iot_data_t * ret = NULL;
-  char * str = iot_data_string_from_json_token (json, *tokens);
+  return iot_data_json_unescape (json + token->start, (size_t) (token->end - token->start), token->type == IOT_JSON_STRING_ESC);
+}
+
+// Short tokens are unescaped into a (stack) buffer, so avoiding a heap allocation
+
+static inline bool iot_data_json_token_short (const char * json, const iot_json_tok_t * token, char * buff)
+{
+  size_t len = (size_t) (token->end - token->start);
+  if (len >= IOT_JSON_SHORT_SIZE) return false;
+  if (token->type == IOT_JSON_STRING_ESC)
+  {
+    iot_data_json_unescape_to (buff, json + token->start, len);
+  }
+  else
+  {
+    memcpy (buff, json + token->start, len);
+    buff[len] = '\0';
+  }
+  return true;
+}
+
+// Returns the token following a token and all of its descendants
+
+// Skip the tokens of a value, as walked when converting (a key and a value per object entry). Returns the token
+// after the value, or NULL if the value's tokens overrun the last used token (as for some malformed JSON)
+
+static const iot_json_tok_t * iot_data_json_token_skip (const iot_json_tok_t * token, const iot_json_tok_t * last)
+{
+  const iot_json_tok_t * next = token + 1;
+  if (token->type == IOT_JSON_OBJECT || token->type == IOT_JSON_ARRAY)
+  {
+    uint32_t keyed = (token->type == IOT_JSON_OBJECT) ? 1u : 0u;
+    for (uint32_t elements = token->size; elements > 0; elements--)
+    {
+      next += keyed;
+      if (next >= last || (next = iot_data_json_token_skip (next, last)) == NULL) return NULL;
+    }
+  }
+  return next;
+}
+
+static bool iot_data_json_token_equal (const char * json, const iot_json_tok_t * token, const char * str)
+{
+  size_t len = (size_t) (token->end - token->start);
+  bool ret;
+  if (token->type == IOT_JSON_STRING_ESC)
+  {
+    char buff[IOT_JSON_SHORT_SIZE];
+    char * tmp = iot_data_json_token_short (json, token, buff) ? buff : iot_data_string_from_json_token (json, token);
+    ret = (strcmp (tmp, str) == 0);
+    if (tmp != buff) free (tmp);
+  }
+  else
+  {
+    ret = (strncmp (json + token->start, str, len) == 0) && (str[len] == '\0');
+  }
+  return ret;
+}
+
+// Whether a token contains a "${" reference, so needs substitution
+
+static bool iot_data_json_token_has_ref (const char * json, const iot_json_tok_t * token)
+{
+  const char * end = json + token->end;
+  for (const char * ptr = json + token->start; ptr + 1 < end; ptr++)
+  {
+    if (ptr[0] == '$' && ptr[1] == '{') return true;
+  }
+  return false;
+}
+
+static char * iot_data_json_token_substitute (const iot_json_tok_t * token, const iot_data_json_ctx_t * ctx)
+{
+  char * str = iot_data_string_from_json_token (ctx->json, token);
+  char * sub = (ctx->subst) (str, ctx->subst_arg);
+  free (str);
+  if (sub == NULL)
+  {
+    *ctx->failed = true;
+    sub = strdup ("");
+  }
+  return sub;
+}
+
+static iot_data_t * iot_data_string_from_json (iot_json_tok_t ** tokens, const iot_data_json_ctx_t * ctx)
+{
+  iot_data_t * str;
+  char buff[IOT_JSON_SHORT_SIZE];
+  if (ctx->subst && iot_data_json_token_has_ref (ctx->json, *tokens))
+  {
+    str = iot_data_alloc_string (iot_data_json_token_substitute (*tokens, ctx), IOT_DATA_TAKE);
+  }
+  else if (ctx->source)
+  {
+    str = iot_data_alloc_string_view (iot_data_json_token_in_place (ctx->json, *tokens), ctx->source);
+  }
+  else if (iot_data_json_token_short (ctx->json, *tokens, buff)) // Short strings held in data block
+  {
+    str = iot_data_alloc_string (buff, IOT_DATA_COPY);
+  }
+  else
+  {
+    str = iot_data_alloc_string (iot_data_string_from_json_token (ctx->json, *tokens), IOT_DATA_TAKE);
+  }
   (*tokens)++;
+  return ctx->pool ? iot_data_intern (ctx->pool, str) : iot_data_string_cached (str, ctx->cache);
+}
+
+static iot_data_t * iot_data_primitive_from_string (const char * str)
+{
+  iot_data_t * ret = NULL;
   switch (str[0])
   {
     case 't': case 'f': ret = iot_data_alloc_bool (str[0] == 't'); break; // true/false
@@ -271,7 +578,7 @@ static iot_data_t * iot_data_primitive_from_json (iot_json_tok_t ** tokens, cons
     {
       if (strchr (str, '.') || strchr (str, 'e') || strchr (str, 'E'))
       {
-        ret = iot_data_alloc_f64 (strtod (str, NULL));
+        ret = iot_data_alloc_f64 (iot_data_parse_f64 (str));
       }
       else if (strchr (str, '-'))
       {
@@ -289,29 +596,50 @@ static iot_data_t * iot_data_primitive_from_json (iot_json_tok_t ** tokens, cons
       break;
     }
   }
-  free (str);
   return ret;
 }
 
-static iot_data_t * iot_data_map_from_json (iot_json_tok_t ** tokens, const char * json, bool ordered, iot_data_t * cache)
+static iot_data_t * iot_data_primitive_from_json (iot_json_tok_t ** tokens, const iot_data_json_ctx_t * ctx)
+{
+  iot_data_t * ret;
+  char buff[IOT_JSON_SHORT_SIZE];
+  if (ctx->source)
+  {
+    ret = iot_data_primitive_from_string (iot_data_json_token_in_place (ctx->json, *tokens));
+  }
+  else if (iot_data_json_token_short (ctx->json, *tokens, buff))
+  {
+    ret = iot_data_primitive_from_string (buff);
+  }
+  else
+  {
+    char * str = iot_data_string_from_json_token (ctx->json, *tokens);
+    ret = iot_data_primitive_from_string (str);
+    free (str);
+  }
+  (*tokens)++;
+  return ret;
+}
+
+static iot_data_t * iot_data_map_from_json (iot_json_tok_t ** tokens, const iot_data_json_ctx_t * ctx)
 {
   uint32_t elements = (*tokens)->size;
   iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
-  iot_data_t * ordering = ordered ? iot_data_alloc_vector (elements) : NULL;
+  iot_data_t * ordering = ctx->ordered ? iot_data_alloc_vector (elements) : NULL;
   uint32_t i = 0;
 
   (*tokens)++;
   while  (elements--)
   {
-    iot_data_t * key = iot_data_string_from_json (tokens, json, cache);
-    if (ordered) iot_data_vector_add (ordering, i++, iot_data_add_ref (key));
-    iot_data_map_add (map, key, iot_data_value_from_json (tokens, json, ordered, cache));
+    iot_data_t * key = iot_data_string_from_json (tokens, ctx);
+    if (ctx->ordered) iot_data_vector_add (ordering, i++, iot_data_add_ref (key));
+    iot_data_map_add (map, key, iot_data_value_from_json (tokens, ctx));
   }
-  if (ordered) iot_data_set_metadata (map, ordering,IOT_DATA_STATIC (&iot_data_order));
+  if (ctx->ordered) iot_data_set_metadata (map, ordering,IOT_DATA_STATIC (&iot_data_order));
   return map;
 }
 
-static iot_data_t * iot_data_vector_from_json (iot_json_tok_t ** tokens, const char * json, bool ordered, iot_data_t * cache)
+static iot_data_t * iot_data_vector_from_json (iot_json_tok_t ** tokens, const iot_data_json_ctx_t * ctx)
 {
   uint32_t elements = (*tokens)->size;
   uint32_t index = 0;
@@ -320,20 +648,20 @@ static iot_data_t * iot_data_vector_from_json (iot_json_tok_t ** tokens, const c
   (*tokens)++;
   while (elements--)
   {
-    iot_data_vector_add (vector, index++, iot_data_value_from_json (tokens, json, ordered, cache));
+    iot_data_vector_add (vector, index++, iot_data_value_from_json (tokens, ctx));
   }
   return vector;
 }
 
-static iot_data_t * iot_data_value_from_json (iot_json_tok_t ** tokens, const char * json, bool ordered, iot_data_t * cache)
+static iot_data_t * iot_data_value_from_json (iot_json_tok_t ** tokens, const iot_data_json_ctx_t * ctx)
 {
   iot_data_t * data = NULL;
   switch ((*tokens)->type)
   {
-    case IOT_JSON_PRIMITIVE: data = iot_data_primitive_from_json (tokens, json); break;
-    case IOT_JSON_OBJECT: data = iot_data_map_from_json (tokens, json, ordered, cache); break;
-    case IOT_JSON_ARRAY: data = iot_data_vector_from_json (tokens, json, ordered, cache); break;
-    default: data = iot_data_string_from_json (tokens, json, cache); break;
+    case IOT_JSON_PRIMITIVE: data = iot_data_primitive_from_json (tokens, ctx); break;
+    case IOT_JSON_OBJECT: data = iot_data_map_from_json (tokens, ctx); break;
+    case IOT_JSON_ARRAY: data = iot_data_vector_from_json (tokens, ctx); break;
+    default: data = iot_data_string_from_json (tokens, ctx); break;
   }
   return data;
 }
@@ -348,42 +676,898 @@ extern iot_data_t * iot_data_from_json_with_ordering (const char * json, bool or
   return iot_data_from_json_with_cache (json, ordered, NULL);
 }
 
-extern iot_data_t * iot_data_from_json_with_cache (const char * json, bool ordered, iot_data_t * cache)
+// Parse JSON into a token array, grown to the exact token count if too small. Returns the number of tokens used, zero if the JSON is invalid
+
+static uint32_t iot_data_json_tokenize (const char * json, iot_json_tok_t ** tokens, uint32_t * size)
+{
+  uint32_t used = 0u;
+
+  if (json && *json)
+  {
+    iot_json_parser parser;
+    size_t len = strlen (json);
+    uint32_t count = iot_json_count (json, len);
+    if (count > *size)
+    {
+      free (*tokens);
+      *tokens = malloc (sizeof (**tokens) * count);
+      *size = count;
+    }
+    iot_json_init (&parser);
+    int32_t ret = iot_json_parse (&parser, json, len, *tokens, count);
+    if (ret > 0 && ((uint32_t) ret <= count) && iot_data_json_token_skip (*tokens, *tokens + ret)) used = (uint32_t) ret;
+  }
+  return used;
+}
+
+static iot_data_t * iot_data_json_parse (iot_data_json_ctx_t * ctx)
 {
   iot_data_t * data = NULL;
-  const char * ptr = json;
+  iot_json_tok_t * tokens = NULL;
+  uint32_t size = 0u;
+
+  if (iot_data_json_tokenize (ctx->json, &tokens, &size))
+  {
+    iot_json_tok_t * tptr = tokens;
+    iot_data_t * cache = ctx->cache;
+    if (ctx->pool == NULL && cache == NULL) ctx->cache = iot_data_alloc_map (IOT_DATA_STRING);
+    data = iot_data_value_from_json (&tptr, ctx);
+    if (cache != ctx->cache) iot_data_free (ctx->cache);
+  }
+  free (tokens);
+  return data ? data : iot_data_alloc_null ();
+}
 
+extern iot_data_t * iot_data_from_json_with_cache (const char * json, bool ordered, iot_data_t * cache)
+{
   assert ((cache == NULL) || iot_data_map_key_is_of_type (cache, IOT_DATA_STRING));
+  iot_data_json_ctx_t ctx = { .json = json, .cache = cache, .source = NULL, .pool = NULL, .ordered = ordered };
+  return iot_data_json_parse (&ctx);
+}
 
-  if (ptr && *ptr)
+extern iot_data_t * iot_data_from_json_in_place (char * json, bool ordered, iot_data_t * cache)
+{
+  assert ((cache == NULL) || iot_data_map_key_is_of_type (cache, IOT_DATA_STRING));
+  iot_data_json_ctx_t ctx = { .json = json, .cache = cache, .source = json ? iot_data_alloc_pointer (json, free) : NULL, .pool = NULL, .ordered = ordered };
+  iot_data_t * data = iot_data_json_parse (&ctx);
+  iot_data_free (ctx.source); // Source buffer now only referenced by string views
+  return data;
+}
+
+extern iot_data_t * iot_data_from_json_with_pool (const char * json, bool ordered, iot_data_intern_t * pool)
+{
+  assert (pool);
+  iot_data_json_ctx_t ctx = { .json = json, .cache = NULL, .source = NULL, .pool = pool, .ordered = ordered };
+  return iot_data_json_parse (&ctx);
+}
+
+extern iot_data_t * iot_data_from_json_with_substitute (const char * json, bool ordered, iot_data_substitute_fn fn, void * arg)
+{
+  assert (fn);
+  bool failed = false;
+  iot_data_json_ctx_t ctx = { .json = json, .cache = NULL, .source = NULL, .pool = NULL, .ordered = ordered, .subst = fn, .subst_arg = arg, .failed = &failed };
+  iot_data_t * data = iot_data_json_parse (&ctx);
+  if (failed)
   {
-    iot_json_parser parser;
-    int32_t used;
-    uint32_t count = 1;
+    iot_data_free (data);
+    data = NULL;
+  }
+  return data;
+}
+
+/* Parallel parsing of large top level arrays. Elements are located from the token array, then ranges of
+   elements are parsed by thread pool jobs, sharing a thread safe intern pool in place of a string cache. */
+
+#define IOT_JSON_PARALLEL_MIN 256u  // Minimum number of elements per job
+#define IOT_JSON_PARALLEL_JOBS 16u  // Maximum number of jobs
+
+typedef struct iot_data_json_parallel_t
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  uint32_t pending;                 // Number of jobs not yet complete
+  const iot_data_json_ctx_t * ctx;  // Parsing context, shared by jobs
+  iot_json_tok_t ** starts;         // First token of each element
+  iot_data_t ** elements;           // Parsed elements
+  bool heap;                        // Allocation policy of calling thread
+} iot_data_json_parallel_t;
+
+typedef struct iot_data_json_parallel_job_t
+{
+  iot_data_json_parallel_t * par;
+  uint32_t start;                   // First element
+  uint32_t end;                     // Element after last
+} iot_data_json_parallel_job_t;
+
+static void * iot_data_json_parallel_run (void * arg)
+{
+  iot_data_json_parallel_job_t * job = arg;
+  iot_data_json_parallel_t * par = job->par;
+  bool heap = iot_data_alloc_heap (par->heap);
+  for (uint32_t i = job->start; i < job->end; i++)
+  {
+    iot_json_tok_t * tptr = par->starts[i];
+    par->elements[i] = iot_data_value_from_json (&tptr, par->ctx);
+  }
+  iot_data_alloc_heap (heap);
+  pthread_mutex_lock (&par->mutex);
+  if (--par->pending == 0u) pthread_cond_signal (&par->cond);
+  pthread_mutex_unlock (&par->mutex);
+  return NULL;
+}
+
+static iot_data_t * iot_data_json_parse_parallel (iot_json_tok_t * tokens, uint32_t count, const iot_data_json_ctx_t * ctx, iot_threadpool_t * pool)
+{
+  iot_data_json_parallel_job_t jobs[IOT_JSON_PARALLEL_JOBS];
+  iot_threadpool_job_t tjobs[IOT_JSON_PARALLEL_JOBS];
+  iot_data_json_parallel_t par = { .ctx = ctx };
+  uint32_t size = tokens->size;
+  uint32_t njobs = size / IOT_JSON_PARALLEL_MIN;
+  if (njobs > IOT_JSON_PARALLEL_JOBS) njobs = IOT_JSON_PARALLEL_JOBS;
+  uint32_t chunk = (size + njobs - 1u) / njobs;
+
+  par.starts = malloc (size * sizeof (*par.starts));
+  par.elements = malloc (size * sizeof (*par.elements));
+  const iot_json_tok_t * token = tokens + 1;
+  for (uint32_t i = 0; i < size; i++)
+  {
+    par.starts[i] = (iot_json_tok_t*) token;
+    token = iot_data_json_token_skip (token, tokens + count);
+  }
+  iot_mutex_init (&par.mutex);
+  pthread_cond_init (&par.cond, NULL);
+  par.heap = iot_data_alloc_heap (false);
+  iot_data_alloc_heap (par.heap);
+  for (uint32_t i = 0; i < njobs; i++)
+  {
+    jobs[i].par = &par;
+    jobs[i].start = i * chunk;
+    jobs[i].end = (jobs[i].start + chunk < size) ? (jobs[i].start + chunk) : size;
+    tjobs[i].function = iot_data_json_parallel_run;
+    tjobs[i].arg = &jobs[i];
+    tjobs[i].priority = -1;
+  }
+  par.pending = njobs;
+  uint32_t added = iot_threadpool_try_work_batch (pool, tjobs, njobs);
+  for (uint32_t i = added; i < njobs; i++) iot_data_json_parallel_run (&jobs[i]);
+  pthread_mutex_lock (&par.mutex);
+  while (par.pending) pthread_cond_wait (&par.cond, &par.mutex);
+  pthread_mutex_unlock (&par.mutex);
+  pthread_cond_destroy (&par.cond);
+  pthread_mutex_destroy (&par.mutex);
+
+  iot_data_t * vector = iot_data_alloc_vector (size); // Elements added serially, as adding updates vector flags
+  for (uint32_t i = 0; i < size; i++) iot_data_vector_add (vector, i, par.elements[i]);
+  free (par.elements);
+  free (par.starts);
+  return vector;
+}
+
+extern iot_data_t * iot_data_from_json_parallel (const char * json, bool ordered, iot_data_intern_t * intern, iot_threadpool_t * pool)
+{
+  iot_data_t * data = NULL;
+  iot_json_tok_t * tokens = NULL;
+  uint32_t size = 0u;
+  uint32_t count = iot_data_json_tokenize (json, &tokens, &size);
+
+  if (count)
+  {
+    iot_data_arena_t * arena = iot_data_arena_set_current (NULL);
+    iot_data_arena_set_current (arena);
+    iot_data_intern_t * shared = intern ? intern : iot_data_intern_alloc (0u);
+    iot_data_json_ctx_t ctx = { .json = json, .cache = NULL, .source = NULL, .pool = shared, .ordered = ordered };
+    if (pool && (arena == NULL) && (tokens->type == IOT_JSON_ARRAY) && (tokens->size >= 2u * IOT_JSON_PARALLEL_MIN)) // Not when allocating from an (unsynchronised) arena
+    {
+      data = iot_data_json_parse_parallel (tokens, count, &ctx, pool);
+    }
+    else
+    {
+      iot_json_tok_t * tptr = tokens;
+      data = iot_data_value_from_json (&tptr, &ctx);
+    }
+    if (shared != intern) iot_data_intern_free (shared);
+  }
+  free (tokens);
+  return data ? data : iot_data_alloc_null ();
+}
+
+/* Parallel encoding of large typed arrays. Ranges of elements are formatted into separate buffers by thread
+   pool jobs, which are then concatenated. */
+
+#define IOT_JSON_ENCODE_PARALLEL_MIN 8192u // Minimum number of elements per job
+
+typedef struct iot_data_json_encode_job_t
+{
+  iot_data_json_parallel_t * par;
+  const uint8_t * ptr;              // First element
+  uint32_t count;                   // Number of elements
+  iot_data_type_t type;
+  char * buff;                      // Formatted elements
+  size_t len;                       // Length of formatted elements
+} iot_data_json_encode_job_t;
+
+static void * iot_data_json_encode_run (void * arg)
+{
+  iot_data_json_encode_job_t * job = arg;
+  iot_data_json_parallel_t * par = job->par;
+  job->buff = malloc ((size_t) job->count * (iot_data_json_element_max (job->type) + 1u) + 1u);
+  job->len = iot_data_json_format_elements (job->buff, job->ptr, job->count, job->type);
+  pthread_mutex_lock (&par->mutex);
+  if (--par->pending == 0u) pthread_cond_signal (&par->cond);
+  pthread_mutex_unlock (&par->mutex);
+  return NULL;
+}
+
+static char * iot_data_json_encode_parallel (const iot_data_t * array, iot_threadpool_t * pool)
+{
+  iot_data_json_encode_job_t jobs[IOT_JSON_PARALLEL_JOBS];
+  iot_threadpool_job_t tjobs[IOT_JSON_PARALLEL_JOBS];
+  iot_data_json_parallel_t par = { .ctx = NULL };
+  iot_data_type_t type = iot_data_array_type (array);
+  uint32_t esize = iot_data_type_size (type);
+  uint32_t length = iot_data_array_length (array);
+  uint32_t njobs = length / IOT_JSON_ENCODE_PARALLEL_MIN;
+  if (njobs > IOT_JSON_PARALLEL_JOBS) njobs = IOT_JSON_PARALLEL_JOBS;
+  uint32_t chunk = (length + njobs - 1u) / njobs;
+  const uint8_t * ptr = iot_data_address (array);
+
+  iot_mutex_init (&par.mutex);
+  pthread_cond_init (&par.cond, NULL);
+  for (uint32_t i = 0; i < njobs; i++)
+  {
+    uint32_t start = i * chunk;
+    jobs[i].par = &par;
+    jobs[i].ptr = ptr + (size_t) start * esize;
+    jobs[i].count = (start + chunk < length) ? chunk : (length - start);
+    jobs[i].type = type;
+    tjobs[i].function = iot_data_json_encode_run;
+    tjobs[i].arg = &jobs[i];
+    tjobs[i].priority = -1;
+  }
+  par.pending = njobs;
+  uint32_t added = iot_threadpool_try_work_batch (pool, tjobs, njobs);
+  for (uint32_t i = added; i < njobs; i++) iot_data_json_encode_run (&jobs[i]);
+  pthread_mutex_lock (&par.mutex);
+  while (par.pending) pthread_cond_wait (&par.cond, &par.mutex);
+  pthread_mutex_unlock (&par.mutex);
+  pthread_cond_destroy (&par.cond);
+  pthread_mutex_destroy (&par.mutex);
+
+  size_t total = njobs + 2u; // Brackets, commas and terminator
+  for (uint32_t i = 0; i < njobs; i++) total += jobs[i].len;
+  char * json = malloc (total);
+  char * out = json;
+  *out++ = '[';
+  for (uint32_t i = 0; i < njobs; i++)
+  {
+    if (i) *out++ = ',';
+    memcpy (out, jobs[i].buff, jobs[i].len);
+    out += jobs[i].len;
+    free (jobs[i].buff);
+  }
+  *out++ = ']';
+  *out = '\0';
+  return json;
+}
+
+extern char * iot_data_to_json_parallel (const iot_data_t * data, iot_threadpool_t * pool)
+{
+  assert (data);
+  if (pool && (iot_data_type (data) == IOT_DATA_ARRAY) && (iot_data_array_shape (data) == NULL) && (iot_data_array_length (data) >= 2u * IOT_JSON_ENCODE_PARALLEL_MIN))
+  {
+    return iot_data_json_encode_parallel (data, pool);
+  }
+  return iot_data_to_json (data);
+}
+
+/* Reusable parsing context. The token array and string cache are retained between parses. */
+
+#define IOT_JSON_CONTEXT_CACHE_SIZE 1024u // Cache emptied when larger, so bounding growth from unique strings
+
+struct iot_data_json_context_t
+{
+  iot_json_tok_t * tokens;    // Token array
+  uint32_t size;              // Token array size
+  iot_data_t * cache;         // String cache
+  bool ordered;               // Whether maps are ordered by position in JSON
+};
+
+iot_data_json_context_t * iot_data_json_context_alloc (bool ordered)
+{
+  iot_data_json_context_t * context = calloc (1, sizeof (*context));
+  context->cache = iot_data_alloc_map (IOT_DATA_STRING);
+  context->ordered = ordered;
+  return context;
+}
+
+void iot_data_json_context_free (iot_data_json_context_t * context)
+{
+  if (context)
+  {
+    iot_data_free (context->cache);
+    free (context->tokens);
+    free (context);
+  }
+}
+
+iot_data_t * iot_data_from_json_with_context (iot_data_json_context_t * context, const char * json)
+{
+  iot_data_t * data = iot_data_json_context_parse (context, json);
+  return data ? data : iot_data_alloc_null ();
+}
+
+iot_data_t * iot_data_json_context_parse (iot_data_json_context_t * context, const char * json)
+{
+  assert (context);
+  iot_data_t * data = NULL;
+  if (iot_data_json_tokenize (json, &context->tokens, &context->size))
+  {
+    iot_json_tok_t * tptr = context->tokens;
+    if (iot_data_map_size (context->cache) > IOT_JSON_CONTEXT_CACHE_SIZE)
+    {
+      iot_data_free (context->cache);
+      context->cache = iot_data_alloc_map (IOT_DATA_STRING);
+    }
+    iot_data_json_ctx_t ctx = { .json = json, .cache = context->cache, .source = NULL, .pool = NULL, .ordered = context->ordered };
+    data = iot_data_value_from_json (&tptr, &ctx);
+  }
+  return data;
+}
+
+/* Lazy JSON document. Tokens are retained and data only created for a path when first accessed. */
+
+struct iot_data_json_doc_t
+{
+  char * json;                // Copy of JSON source
+  iot_json_tok_t * tokens;    // Parsed tokens
+  uint32_t count;             // Number of tokens
+  iot_data_t * cache;         // String cache, shared by all created data
+  iot_data_t * nodes;         // Map of token index to created data
+  bool ordered;               // Whether maps are ordered by position in JSON
+};
+
+iot_data_json_doc_t * iot_data_json_doc_alloc (const char * json, bool ordered)
+{
+  iot_json_tok_t * tokens = NULL;
+  uint32_t size = 0u;
+  uint32_t count = iot_data_json_tokenize (json, &tokens, &size);
+  iot_data_json_doc_t * doc = NULL;
+  if (count == 0u)
+  {
+    free (tokens);
+  }
+  else
+  {
+    doc = malloc (sizeof (*doc));
+    doc->json = strdup (json);
+    doc->tokens = tokens;
+    doc->count = count;
+    doc->cache = iot_data_alloc_map (IOT_DATA_STRING);
+    doc->nodes = iot_data_alloc_map (IOT_DATA_UINT32);
+    doc->ordered = ordered;
+  }
+  return doc;
+}
+
+void iot_data_json_doc_free (iot_data_json_doc_t * doc)
+{
+  if (doc)
+  {
+    iot_data_free (doc->nodes);
+    iot_data_free (doc->cache);
+    free (doc->tokens);
+    free (doc->json);
+    free (doc);
+  }
+}
+
+// Find the token for a map value (the last for duplicate keys, as when converted) or vector element
+
+static const iot_json_tok_t * iot_data_json_doc_child (const iot_data_json_doc_t * doc, const iot_json_tok_t * token, const iot_data_t * index)
+{
+  const iot_json_tok_t * found = NULL;
+  const iot_json_tok_t * child = token + 1;
+  const iot_json_tok_t * last = doc->tokens + doc->count;
+  uint32_t size = token->size;
+
+  if (token->type == IOT_JSON_OBJECT && iot_data_type (index) == IOT_DATA_STRING)
+  {
+    while (size--)
+    {
+      if (iot_data_json_token_equal (doc->json, child, iot_data_string (index))) found = child + 1;
+      child = iot_data_json_token_skip (child + 1, last);
+    }
+  }
+  else if (token->type == IOT_JSON_ARRAY && iot_data_type (index) == IOT_DATA_UINT32 && iot_data_ui32 (index) < size)
+  {
+    for (uint32_t i = iot_data_ui32 (index); i > 0; i--) child = iot_data_json_token_skip (child, last);
+    found = child;
+  }
+  return found;
+}
+
+static const iot_data_t * iot_data_json_doc_node (iot_data_json_doc_t * doc, const iot_json_tok_t * token)
+{
+  iot_data_static_t skey;
+  iot_data_t * key = iot_data_alloc_const_ui32 (&skey, (uint32_t) (token - doc->tokens));
+  const iot_data_t * data = iot_data_map_get (doc->nodes, key);
+  if (data == NULL)
+  {
+    iot_json_tok_t * tptr = (iot_json_tok_t*) token;
+    iot_data_json_ctx_t ctx = { .json = doc->json, .cache = doc->cache, .source = NULL, .pool = NULL, .ordered = doc->ordered };
+    iot_data_t * value = iot_data_value_from_json (&tptr, &ctx);
+    if (value == NULL) value = iot_data_alloc_null ();
+    iot_data_map_add (doc->nodes, iot_data_alloc_ui32 ((uint32_t) (token - doc->tokens)), value);
+    data = value;
+  }
+  return data;
+}
+
+const iot_data_t * iot_data_json_doc_get_at (iot_data_json_doc_t * doc, const iot_data_t * path)
+{
+  assert (doc && path);
+  const iot_json_tok_t * token = doc->tokens;
+  iot_data_list_iter_t iter;
+  iot_data_list_iter (path, &iter);
+  while (token && iot_data_list_iter_prev (&iter)) // Path iterated from head
+  {
+    token = iot_data_json_doc_child (doc, token, iot_data_list_iter_value (&iter));
+  }
+  return token ? iot_data_json_doc_node (doc, token) : NULL;
+}
+
+const iot_data_t * iot_data_json_doc_data (iot_data_json_doc_t * doc)
+{
+  assert (doc);
+  return iot_data_json_doc_node (doc, doc->tokens);
+}
+
+/* Decoding to C structs from field descriptor tables. Defaults are json primitives, or the value for string fields. */
+
+#define IOT_DATA_FIELD_MAX 64u
+
+static inline void * iot_data_field_ptr (const iot_data_field_t * field, void * out)
+{
+  return (uint8_t*) out + field->offset;
+}
+
+static bool iot_data_field_cast (const iot_data_field_t * field, const iot_data_t * value, void * out)
+{
+  return (value && iot_data_type (value) <= IOT_DATA_BOOL && iot_data_cast (value, field->type, iot_data_field_ptr (field, out)));
+}
 
-    // Approximate token count
-    while (*ptr != '\0')
+static bool iot_data_field_primitive (const iot_data_field_t * field, const char * str, void * out)
+{
+  iot_data_t * value = iot_data_primitive_from_string (str);
+  bool ok = iot_data_field_cast (field, value, out);
+  iot_data_free (value);
+  return ok;
+}
+
+static inline void iot_data_field_set_string (const iot_data_field_t * field, char * str, void * out, bool seen)
+{
+  char ** ptr = iot_data_field_ptr (field, out);
+  if (seen) free (*ptr);
+  *ptr = str;
+}
+
+// Set defaults for fields not found, all fields initialised even if required so the struct can be freed
+
+static bool iot_data_fields_complete (const iot_data_field_t * fields, uint32_t count, uint64_t seen, void * out)
+{
+  bool ok = true;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    const iot_data_field_t * field = &fields[i];
+    if (seen & (1ull << i)) continue;
+    if (field->type == IOT_DATA_STRING)
+    {
+      iot_data_field_set_string (field, (field->def && ! field->required) ? strdup (field->def) : NULL, out, false);
+    }
+    else
+    {
+      memset (iot_data_field_ptr (field, out), 0, iot_data_type_size (field->type));
+      if (field->def && ! field->required) ok = iot_data_field_primitive (field, field->def, out) && ok;
+    }
+    if (field->required) ok = false;
+  }
+  return ok;
+}
+
+bool iot_data_map_to_struct (const iot_data_t * map, const iot_data_field_t * fields, uint32_t count, void * out)
+{
+  assert (map && fields && out && count <= IOT_DATA_FIELD_MAX);
+  uint64_t seen = 0u;
+  bool ok = true;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    const iot_data_t * value = iot_data_string_map_get (map, fields[i].name);
+    bool set = false;
+    if (value == NULL) continue;
+    if (fields[i].type == IOT_DATA_STRING)
+    {
+      set = (iot_data_type (value) == IOT_DATA_STRING);
+      if (set) iot_data_field_set_string (&fields[i], strdup (iot_data_string (value)), out, false);
+    }
+    else
+    {
+      set = iot_data_field_cast (&fields[i], value, out);
+    }
+    if (set) seen |= (1ull << i);
+    ok = set && ok;
+  }
+  return iot_data_fields_complete (fields, count, seen, out) && ok;
+}
+
+static bool iot_data_field_from_json (const iot_data_field_t * field, const char * json, const iot_json_tok_t * token, void * out, bool seen)
+{
+  char buff[IOT_JSON_SHORT_SIZE];
+  bool ok = false;
+  if (field->type == IOT_DATA_STRING)
+  {
+    ok = (token->type == IOT_JSON_STRING || token->type == IOT_JSON_STRING_ESC);
+    if (ok) iot_data_field_set_string (field, iot_data_string_from_json_token (json, token), out, seen);
+  }
+  else if (token->type == IOT_JSON_PRIMITIVE)
+  {
+    if (iot_data_json_token_short (json, token, buff))
+    {
+      ok = iot_data_field_primitive (field, buff, out);
+    }
+    else
     {
-      switch (*ptr)
+      char * str = iot_data_string_from_json_token (json, token);
+      ok = iot_data_field_primitive (field, str, out);
+      free (str);
+    }
+  }
+  return ok;
+}
+
+bool iot_data_json_to_struct (const char * json, const iot_data_field_t * fields, uint32_t count, void * out)
+{
+  assert (fields && out && count <= IOT_DATA_FIELD_MAX);
+  iot_json_tok_t * tokens = NULL;
+  uint32_t size = 0u;
+  uint32_t used = iot_data_json_tokenize (json, &tokens, &size);
+  uint64_t seen = 0u;
+  bool ok = (used > 0u && tokens->type == IOT_JSON_OBJECT);
+
+  if (ok)
+  {
+    const iot_json_tok_t * last = tokens + used;
+    const iot_json_tok_t * key = tokens + 1;
+    for (uint32_t elements = tokens->size; elements > 0; elements--)
+    {
+      for (uint32_t i = 0; i < count; i++)
       {
-        case ',': case '{': count++; break;
-        case ':': case '[': count += 2; break;
-        default: break;
+        if (iot_data_json_token_equal (json, key, fields[i].name))
+        {
+          bool was_seen = (seen & (1ull << i)) != 0u;
+          if (iot_data_field_from_json (&fields[i], json, key + 1, out, was_seen))
+          {
+            seen |= (1ull << i);
+          }
+          else
+          {
+            ok = false;
+          }
+          break;
+        }
       }
-      ptr++;
+      key = iot_data_json_token_skip (key + 1, last);
     }
-    iot_json_tok_t *tokens = calloc (1, sizeof (*tokens) * count);
-    iot_json_tok_t *tptr = tokens;
+  }
+  free (tokens);
+  return iot_data_fields_complete (fields, count, seen, out) && ok;
+}
 
-    iot_json_init (&parser);
-    used = iot_json_parse (&parser, json, strlen (json), tptr, count);
-    if (used && (used <= count))
+void iot_data_struct_free (const iot_data_field_t * fields, uint32_t count, void * data)
+{
+  assert (fields && data);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (fields[i].type == IOT_DATA_STRING) iot_data_field_set_string (&fields[i], NULL, data, true);
+  }
+}
+
+/* Incremental (push) JSON parser. Memory use is bounded by nesting depth and longest token, not document size. */
+
+#define IOT_JSON_STREAM_DEPTH 8u
+#define IOT_JSON_STREAM_TOKEN_SIZE 64u
+#define IOT_JSON_STREAM_VECTOR_SIZE 8u
+
+typedef enum iot_json_stream_state_t
+{
+  IOT_JSON_STREAM_VALUE,     // Expecting a value
+  IOT_JSON_STREAM_KEY,       // Expecting an object key
+  IOT_JSON_STREAM_COLON,     // Expecting a key/value separator
+  IOT_JSON_STREAM_NEXT,      // Expecting an element separator or end of object/array
+  IOT_JSON_STREAM_STRING,    // Within a string
+  IOT_JSON_STREAM_PRIMITIVE, // Within a number, boolean or null
+  IOT_JSON_STREAM_DONE,      // Complete value parsed
+  IOT_JSON_STREAM_ERROR      // Invalid JSON
+} iot_json_stream_state_t;
+
+typedef struct iot_json_frame_t
+{
+  iot_data_t * data;     // Map or vector being populated
+  iot_data_t * key;      // Pending map key
+  iot_data_t * ordering; // Map key ordering vector, if ordered
+  uint32_t count;        // Number of elements added
+} iot_json_frame_t;
+
+struct iot_data_json_stream_t
+{
+  iot_json_frame_t * stack;      // Stack of open objects and arrays
+  uint32_t depth;                // Number of open objects and arrays
+  uint32_t max_depth;            // Allocated stack size
+  char * token;                  // Current string or primitive token
+  size_t token_len;              // Current token length
+  size_t token_size;             // Allocated token buffer size
+  iot_data_t * result;           // Parsed value
+  iot_data_t * cache;            // String cache
+  iot_json_stream_state_t state; // Parser state
+  uint32_t escape;               // Escape sequence characters still expected
+  bool escaped : 1;              // Whether current string contains escape sequences
+  bool key : 1;                  // Whether current string is an object key
+  bool ordered : 1;              // Whether maps are ordered by position in json
+  bool free_cache : 1;           // Whether cache allocated by parser
+};
+
+iot_data_json_stream_t * iot_data_json_stream_alloc (bool ordered, iot_data_t * cache)
+{
+  assert ((cache == NULL) || iot_data_map_key_is_of_type (cache, IOT_DATA_STRING));
+  iot_data_json_stream_t * stream = calloc (1, sizeof (*stream));
+  stream->max_depth = IOT_JSON_STREAM_DEPTH;
+  stream->stack = calloc (stream->max_depth, sizeof (*stream->stack));
+  stream->token_size = IOT_JSON_STREAM_TOKEN_SIZE;
+  stream->token = malloc (stream->token_size);
+  stream->cache = cache ? cache : iot_data_alloc_map (IOT_DATA_STRING);
+  stream->free_cache = (cache == NULL);
+  stream->ordered = ordered;
+  stream->state = IOT_JSON_STREAM_VALUE;
+  return stream;
+}
+
+static void iot_data_json_stream_reset (iot_data_json_stream_t * stream)
+{
+  while (stream->depth)
+  {
+    iot_json_frame_t * frame = &stream->stack[--stream->depth];
+    iot_data_free (frame->data);
+    iot_data_free (frame->key);
+    iot_data_free (frame->ordering);
+  }
+  iot_data_free (stream->result);
+  stream->result = NULL;
+  stream->token_len = 0;
+  stream->state = IOT_JSON_STREAM_VALUE;
+}
+
+void iot_data_json_stream_free (iot_data_json_stream_t * stream)
+{
+  if (stream)
+  {
+    iot_data_json_stream_reset (stream);
+    if (stream->free_cache) iot_data_free (stream->cache);
+    free (stream->token);
+    free (stream->stack);
+    free (stream);
+  }
+}
+
+static inline void iot_data_json_stream_addc (iot_data_json_stream_t * stream, char c)
+{
+  if (stream->token_len + 1u >= stream->token_size)
+  {
+    stream->token_size *= 2u;
+    stream->token = realloc (stream->token, stream->token_size);
+  }
+  stream->token[stream->token_len++] = c;
+}
+
+static void iot_data_json_stream_value (iot_data_json_stream_t * stream, iot_data_t * value)
+{
+  if (stream->depth == 0)
+  {
+    stream->result = value;
+    stream->state = IOT_JSON_STREAM_DONE;
+    return;
+  }
+  iot_json_frame_t * frame = &stream->stack[stream->depth - 1u];
+  if (frame->data->type == IOT_DATA_MAP)
+  {
+    if (frame->ordering)
     {
-      iot_data_t * km = cache ? cache : iot_data_alloc_map (IOT_DATA_STRING);
-      data = iot_data_value_from_json (&tptr, json, ordered, km);
-      if (cache == NULL) iot_data_free (km);
+      if (frame->count == iot_data_vector_size (frame->ordering)) iot_data_vector_resize (frame->ordering, frame->count * 2u);
+      iot_data_vector_add (frame->ordering, frame->count, iot_data_add_ref (frame->key));
     }
-    free (tokens);
+    iot_data_map_add (frame->data, frame->key, value);
+    frame->key = NULL;
   }
-  return data ? data : iot_data_alloc_null ();
+  else
+  {
+    if (frame->count == iot_data_vector_size (frame->data)) iot_data_vector_resize (frame->data, frame->count * 2u);
+    iot_data_vector_add (frame->data, frame->count, value);
+  }
+  frame->count++;
+  stream->state = IOT_JSON_STREAM_NEXT;
+}
+
+static void iot_data_json_stream_open (iot_data_json_stream_t * stream, bool object)
+{
+  if (stream->depth == stream->max_depth)
+  {
+    stream->max_depth *= 2u;
+    stream->stack = realloc (stream->stack, stream->max_depth * sizeof (*stream->stack));
+  }
+  iot_json_frame_t * frame = &stream->stack[stream->depth++];
+  frame->data = object ? iot_data_alloc_map (IOT_DATA_STRING) : iot_data_alloc_vector (IOT_JSON_STREAM_VECTOR_SIZE);
+  frame->ordering = (object && stream->ordered) ? iot_data_alloc_vector (IOT_JSON_STREAM_VECTOR_SIZE) : NULL;
+  frame->key = NULL;
+  frame->count = 0u;
+  stream->state = object ? IOT_JSON_STREAM_KEY : IOT_JSON_STREAM_VALUE;
+}
+
+static bool iot_data_json_stream_close (iot_data_json_stream_t * stream, bool object)
+{
+  if (stream->depth == 0) return false;
+  iot_json_frame_t * frame = &stream->stack[stream->depth - 1u];
+  if ((frame->data->type == IOT_DATA_MAP) != object) return false;
+  if (object)
+  {
+    if (frame->ordering)
+    {
+      iot_data_vector_resize (frame->ordering, frame->count);
+      iot_data_set_metadata (frame->data, frame->ordering, IOT_DATA_STATIC (&iot_data_order));
+    }
+  }
+  else
+  {
+    iot_data_vector_resize (frame->data, frame->count);
+  }
+  stream->depth--;
+  iot_data_json_stream_value (stream, frame->data);
+  return true;
+}
+
+static bool iot_data_json_stream_primitive (iot_data_json_stream_t * stream)
+{
+  stream->token[stream->token_len] = '\0';
+  iot_data_t * value = iot_data_primitive_from_string (stream->token);
+  if (value) iot_data_json_stream_value (stream, value);
+  return (value != NULL);
+}
+
+static bool iot_data_json_stream_char (iot_data_json_stream_t * stream, char c)
+{
+  switch (stream->state)
+  {
+    case IOT_JSON_STREAM_STRING:
+    {
+      if (stream->escape)
+      {
+        if (stream->escape == 5u) // Character following backslash
+        {
+          stream->escaped = true;
+          if (c == 'u') stream->escape = 4u;
+          else if (strchr ("\"/\\bfrnt", c)) stream->escape = 0u;
+          else return false;
+        }
+        else
+        {
+          if (! isxdigit ((unsigned char) c)) return false;
+          stream->escape--;
+        }
+      }
+      else if (c == '\\')
+      {
+        stream->escape = 5u;
+      }
+      else if (c == '"')
+      {
+        iot_data_t * str = iot_data_string_from_cache (iot_data_json_unescape (stream->token, stream->token_len, stream->escaped), stream->cache);
+        if (stream->key)
+        {
+          stream->stack[stream->depth - 1u].key = str;
+          stream->state = IOT_JSON_STREAM_COLON;
+        }
+        else
+        {
+          iot_data_json_stream_value (stream, str);
+        }
+        return true;
+      }
+      iot_data_json_stream_addc (stream, c);
+      return true;
+    }
+    case IOT_JSON_STREAM_PRIMITIVE:
+    {
+      if (c == ',' || c == ']' || c == '}' || isspace ((unsigned char) c))
+      {
+        return iot_data_json_stream_primitive (stream) && iot_data_json_stream_char (stream, c);
+      }
+      if (c < 32 || c >= 127) return false;
+      iot_data_json_stream_addc (stream, c);
+      return true;
+    }
+    default: break;
+  }
+  if (isspace ((unsigned char) c)) return true;
+  switch (stream->state)
+  {
+    case IOT_JSON_STREAM_VALUE:
+    {
+      switch (c)
+      {
+        case '{': iot_data_json_stream_open (stream, true); break;
+        case '[': iot_data_json_stream_open (stream, false); break;
+        case ']': return (stream->depth && stream->stack[stream->depth - 1u].count == 0) && iot_data_json_stream_close (stream, false);
+        case '"':
+          stream->key = false;
+          stream->escaped = false;
+          stream->token_len = 0;
+          stream->state = IOT_JSON_STREAM_STRING;
+          break;
+        case ',': case ':': case '}': return false;
+        default:
+          stream->token_len = 0;
+          stream->state = IOT_JSON_STREAM_PRIMITIVE;
+          return iot_data_json_stream_char (stream, c);
+      }
+      return true;
+    }
+    case IOT_JSON_STREAM_KEY:
+    {
+      if (c == '}') return (stream->stack[stream->depth - 1u].count == 0) && iot_data_json_stream_close (stream, true);
+      if (c != '"') return false;
+      stream->key = true;
+      stream->escaped = false;
+      stream->token_len = 0;
+      stream->state = IOT_JSON_STREAM_STRING;
+      return true;
+    }
+    case IOT_JSON_STREAM_COLON:
+    {
+      if (c != ':') return false;
+      stream->state = IOT_JSON_STREAM_VALUE;
+      return true;
+    }
+    case IOT_JSON_STREAM_NEXT:
+    {
+      if (c == '}' || c == ']') return iot_data_json_stream_close (stream, c == '}');
+      if (c != ',') return false;
+      stream->state = (stream->stack[stream->depth - 1u].data->type == IOT_DATA_MAP) ? IOT_JSON_STREAM_KEY : IOT_JSON_STREAM_VALUE;
+      return true;
+    }
+    default: return false; // Trailing characters after complete value
+  }
+}
+
+bool iot_data_json_stream_push (iot_data_json_stream_t * stream, const char * chunk, size_t len)
+{
+  assert (stream && (chunk || len == 0));
+  for (size_t i = 0; (i < len) && (stream->state != IOT_JSON_STREAM_ERROR); i++)
+  {
+    if (! iot_data_json_stream_char (stream, chunk[i])) stream->state = IOT_JSON_STREAM_ERROR;
+  }
+  return (stream->state != IOT_JSON_STREAM_ERROR);
+}
+
+iot_data_t * iot_data_json_stream_finish (iot_data_json_stream_t * stream)
+{
+  assert (stream);
+  iot_data_t * result = NULL;
+  if ((stream->state == IOT_JSON_STREAM_PRIMITIVE) && (stream->depth == 0))
+  {
+    if (! iot_data_json_stream_primitive (stream)) stream->state = IOT_JSON_STREAM_ERROR;
+  }
+  if (stream->state == IOT_JSON_STREAM_DONE)
+  {
+    result = stream->result;
+    stream->result = NULL;
+  }
+  iot_data_json_stream_reset (stream);
+  return result;
 }
@@ -0,0 +1,374 @@
+//
+// Copyright (c) 2023 IOTech
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+#include "iot/data.h"
+#include "iot/threadpool.h"
+#include "iot/thread.h"
+#include "data-impl.h"
+
+// Parallel copy, comparison and compression. Top level maps and vectors are split into key or index ranges,
+// each processed by a thread pool job. Jobs that cannot be queued are run by the calling thread. Parallel map
+// uses iot_threadpool_parallel_for, with the calling thread taking part.
+
+#define IOT_DATA_PARALLEL_MIN 64u   // Minimum number of elements per job
+#define IOT_DATA_PARALLEL_JOBS 16u  // Maximum number of jobs
+
+struct iot_data_parallel_job_t;
+
+typedef void (*iot_data_parallel_fn) (struct iot_data_parallel_job_t * job);
+
+typedef struct iot_data_parallel_t
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  uint32_t pending;           // Number of jobs not yet complete
+  _Atomic uint32_t stop;      // Index of first job finding a difference
+  iot_data_parallel_fn fn;    // Job function
+  const iot_data_t * data1;   // Data to copy or compare
+  const iot_data_t * data2;   // Data to compare
+  iot_data_t ** keys;         // Copied map keys
+  iot_data_t ** values;       // Copied map or vector values
+  bool heap;                  // Allocation policy of calling thread
+  iot_data_dedup_t * set;     // Shared values when compressing
+} iot_data_parallel_t;
+
+typedef struct iot_data_parallel_job_t
+{
+  iot_data_parallel_t * ctx;
+  uint32_t index;             // Job index
+  uint32_t start;             // First element
+  uint32_t end;               // Element after last
+  iot_data_map_iter_t iter1;  // Map iterators, positioned before first element
+  iot_data_map_iter_t iter2;
+  int result;                 // Comparison result
+  size_t saved;               // Memory freed by compression
+} iot_data_parallel_job_t;
+
+static inline bool iot_data_parallel_stopped (const iot_data_parallel_job_t * job)
+{
+  return atomic_load (&job->ctx->stop) < job->index;
+}
+
+static void iot_data_parallel_found (iot_data_parallel_job_t * job, int result)
+{
+  uint32_t stop = atomic_load (&job->ctx->stop);
+  job->result = result;
+  while (job->index < stop && ! atomic_compare_exchange_weak (&job->ctx->stop, &stop, job->index));
+}
+
+static void iot_data_parallel_copy_map (iot_data_parallel_job_t * job)
+{
+  for (uint32_t i = job->start; i < job->end; i++)
+  {
+    iot_data_map_iter_next (&job->iter1);
+    job->ctx->keys[i] = iot_data_copy (iot_data_map_iter_key (&job->iter1));
+    job->ctx->values[i] = iot_data_copy (iot_data_map_iter_value (&job->iter1));
+  }
+}
+
+static void iot_data_parallel_copy_vector (iot_data_parallel_job_t * job)
+{
+  for (uint32_t i = job->start; i < job->end; i++)
+  {
+    job->ctx->values[i] = iot_data_copy (iot_data_vector_get (job->ctx->data1, i));
+  }
+}
+
+static void iot_data_parallel_compare_map (iot_data_parallel_job_t * job)
+{
+  for (uint32_t i = job->start; i < job->end && ! iot_data_parallel_stopped (job); i++)
+  {
+    iot_data_map_iter_next (&job->iter1);
+    iot_data_map_iter_next (&job->iter2);
+    int ret = iot_data_compare (iot_data_map_iter_key (&job->iter1), iot_data_map_iter_key (&job->iter2));
+    if (ret == 0) ret = iot_data_compare (iot_data_map_iter_value (&job->iter1), iot_data_map_iter_value (&job->iter2));
+    if (ret != 0)
+    {
+      iot_data_parallel_found (job, ret);
+      break;
+    }
+  }
+}
+
+static void iot_data_parallel_compare_vector (iot_data_parallel_job_t * job)
+{
+  for (uint32_t i = job->start; i < job->end && ! iot_data_parallel_stopped (job); i++)
+  {
+    int ret = iot_data_compare (iot_data_vector_get (job->ctx->data1, i), iot_data_vector_get (job->ctx->data2, i));
+    if (ret != 0)
+    {
+      iot_data_parallel_found (job, ret);
+      break;
+    }
+  }
+}
+
+static void iot_data_parallel_compress (iot_data_parallel_job_t * job)
+{
+  job->saved = iot_data_dedup_range (job->ctx->set, (iot_data_t*) job->ctx->data1, &job->iter1, job->start, job->end);
+}
+
+static void * iot_data_parallel_run (void * arg)
+{
+  iot_data_parallel_job_t * job = arg;
+  iot_data_parallel_t * ctx = job->ctx;
+  bool heap = iot_data_alloc_heap (ctx->heap);
+  (ctx->fn) (job);
+  iot_data_alloc_heap (heap);
+  pthread_mutex_lock (&ctx->mutex);
+  if (--ctx->pending == 0u) pthread_cond_signal (&ctx->cond);
+  pthread_mutex_unlock (&ctx->mutex);
+  return NULL;
+}
+
+// Only split maps and vectors large enough, and not when allocating from an (unsynchronised) arena
+
+static uint32_t iot_data_parallel_size (const iot_data_t * data, const iot_threadpool_t * pool)
+{
+  uint32_t size = 0u;
+  iot_data_arena_t * arena = iot_data_arena_set_current (NULL);
+  iot_data_arena_set_current (arena);
+  if (pool && data && (arena == NULL))
+  {
+    if (data->type == IOT_DATA_MAP) size = iot_data_map_size (data);
+    else if (data->type == IOT_DATA_VECTOR) size = iot_data_vector_size (data);
+  }
+  return (size >= 2u * IOT_DATA_PARALLEL_MIN) ? size : 0u;
+}
+
+// Split data into jobs, run them on the pool (or inline if pool queue full) and wait for
+// completion. Returns the index of the first job finding a difference when comparing.
+
+static uint32_t iot_data_parallel_exec (iot_threadpool_t * pool, iot_data_parallel_t * ctx, uint32_t size, iot_data_parallel_job_t * jobs)
+{
+  iot_threadpool_job_t tjobs[IOT_DATA_PARALLEL_JOBS];
+  uint32_t count = size / IOT_DATA_PARALLEL_MIN;
+  if (count > IOT_DATA_PARALLEL_JOBS) count = IOT_DATA_PARALLEL_JOBS;
+  uint32_t chunk = (size + count - 1u) / count;
+  iot_data_map_iter_t iter1 = { 0 };
+  iot_data_map_iter_t iter2 = { 0 };
+  bool map = (ctx->data1->type == IOT_DATA_MAP);
+
+  if (map)
+  {
+    iot_data_map_iter (ctx->data1, &iter1);
+    if (ctx->data2) iot_data_map_iter (ctx->data2, &iter2);
+  }
+  iot_mutex_init (&ctx->mutex);
+  pthread_cond_init (&ctx->cond, NULL);
+  atomic_store (&ctx->stop, UINT32_MAX);
+  ctx->heap = iot_data_alloc_heap (false);
+  iot_data_alloc_heap (ctx->heap);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    iot_data_parallel_job_t * job = &jobs[i];
+    job->ctx = ctx;
+    job->index = i;
+    job->start = i * chunk;
+    job->end = (job->start + chunk < size) ? (job->start + chunk) : size;
+    job->result = 0;
+    job->iter1 = iter1;
+    job->iter2 = iter2;
+    if (map) // Advance iterators to end of job range
+    {
+      for (uint32_t j = job->start; j < job->end; j++)
+      {
+        iot_data_map_iter_next (&iter1);
+        if (ctx->data2) iot_data_map_iter_next (&iter2);
+      }
+    }
+    tjobs[i].function = iot_data_parallel_run;
+    tjobs[i].arg = job;
+    tjobs[i].priority = -1;
+  }
+  ctx->pending = count;
+  uint32_t added = iot_threadpool_try_work_batch (pool, tjobs, count);
+  for (uint32_t i = added; i < count; i++) iot_data_parallel_run (&jobs[i]);
+  pthread_mutex_lock (&ctx->mutex);
+  while (ctx->pending) pthread_cond_wait (&ctx->cond, &ctx->mutex);
+  pthread_mutex_unlock (&ctx->mutex);
+  pthread_cond_destroy (&ctx->cond);
+  pthread_mutex_destroy (&ctx->mutex);
+  return atomic_load (&ctx->stop);
+}
+
+iot_data_t * iot_data_copy_parallel (const iot_data_t * data, iot_threadpool_t * pool)
+{
+  iot_data_parallel_job_t jobs[IOT_DATA_PARALLEL_JOBS];
+  iot_data_parallel_t ctx = { .data1 = data };
+  iot_data_t * ret;
+  uint32_t size = iot_data_parallel_size (data, pool);
+  if (size == 0u) return iot_data_copy (data);
+
+  if (data->type == IOT_DATA_MAP)
+  {
+    ctx.fn = iot_data_parallel_copy_map;
+    ctx.keys = malloc (2u * size * sizeof (iot_data_t*));
+    ctx.values = ctx.keys + size;
+    iot_data_parallel_exec (pool, &ctx, size, jobs);
+    ret = iot_data_map_is_hashed (data) ? iot_data_alloc_typed_hash_map (data->key_type, data->element_type) : iot_data_alloc_typed_map (data->key_type, data->element_type);
+    iot_data_map_build_sorted (ret, ctx.keys, ctx.values, size);
+    free (ctx.keys);
+  }
+  else
+  {
+    ctx.fn = iot_data_parallel_copy_vector;
+    ctx.values = malloc (size * sizeof (iot_data_t*));
+    iot_data_parallel_exec (pool, &ctx, size, jobs);
+    ret = iot_data_alloc_typed_vector (size, data->element_type);
+    for (uint32_t i = 0; i < size; i++)
+    {
+      if (ctx.values[i]) iot_data_vector_add (ret, i, ctx.values[i]);
+    }
+    free (ctx.values);
+  }
+  ret->base.meta = iot_data_add_ref (data->base.meta);
+  return ret;
+}
+
+int iot_data_compare_parallel (const iot_data_t * data1, const iot_data_t * data2, iot_threadpool_t * pool)
+{
+  iot_data_parallel_job_t jobs[IOT_DATA_PARALLEL_JOBS];
+  iot_data_parallel_t ctx = { .data1 = data1, .data2 = data2 };
+  uint32_t size = iot_data_parallel_size (data1, pool);
+  if (size == 0u || data2 == NULL || data1 == data2 || data1->type != data2->type) return iot_data_compare (data1, data2);
+
+  // Order as for iot_data_compare, by size then hash then elements
+
+  uint32_t size2 = (data2->type == IOT_DATA_MAP) ? iot_data_map_size (data2) : iot_data_vector_size (data2);
+  if (size != size2) return size < size2 ? -1 : 1;
+  uint32_t hash1 = iot_data_hash (data1);
+  uint32_t hash2 = iot_data_hash (data2);
+  if (hash1 != hash2) return hash1 < hash2 ? -1 : 1;
+  ctx.fn = (data1->type == IOT_DATA_MAP) ? iot_data_parallel_compare_map : iot_data_parallel_compare_vector;
+  uint32_t stop = iot_data_parallel_exec (pool, &ctx, size, jobs);
+  return (stop < IOT_DATA_PARALLEL_JOBS) ? jobs[stop].result : 0;
+}
+
+bool iot_data_equal_parallel (const iot_data_t * data1, const iot_data_t * data2, iot_threadpool_t * pool)
+{
+  return (iot_data_hash (data1) == iot_data_hash (data2)) && (iot_data_compare_parallel (data1, data2, pool) == 0);
+}
+
+size_t iot_data_compress_parallel (iot_data_t * data, iot_threadpool_t * pool)
+{
+  iot_data_parallel_job_t jobs[IOT_DATA_PARALLEL_JOBS] = { 0 };
+  iot_data_parallel_t ctx = { .data1 = data, .fn = iot_data_parallel_compress };
+  size_t saved = 0u;
+  assert (data);
+  if (! data->composed) return 0u;
+  uint32_t size = iot_data_parallel_size (data, pool);
+  ctx.set = iot_data_dedup_alloc ();
+  iot_data_hash (data); // Update any stale hashes before data is shared between jobs
+  if (size)
+  {
+    iot_data_parallel_exec (pool, &ctx, size, jobs);
+    for (uint32_t i = 0; i < IOT_DATA_PARALLEL_JOBS; i++) saved += jobs[i].saved;
+  }
+  else
+  {
+    saved = iot_data_dedup_range (ctx.set, data, NULL, 0u, UINT32_MAX);
+  }
+  iot_data_dedup_free (ctx.set);
+  return saved;
+}
+
+typedef struct iot_data_parallel_map_t
+{
+  const iot_data_t * data;    // Vector or array to map
+  const iot_data_t ** values; // Map values to map
+  iot_data_t ** results;      // Mapped elements
+  iot_data_update_fn fn;      // Map function
+  void * arg;                 // Map function argument
+  bool heap;                  // Allocation policy of calling thread
+} iot_data_parallel_map_t;
+
+static void iot_data_parallel_map_range (uint32_t begin, uint32_t end, void * arg)
+{
+  iot_data_parallel_map_t * ctx = arg;
+  bool heap = iot_data_alloc_heap (ctx->heap);
+  for (uint32_t i = begin; i < end; i++)
+  {
+    if (ctx->values)
+    {
+      ctx->results[i] = (ctx->fn) (ctx->values[i], ctx->arg);
+    }
+    else if (ctx->data->type == IOT_DATA_ARRAY)
+    {
+      iot_data_t * element = iot_data_array_element_alloc (ctx->data, i);
+      ctx->results[i] = (ctx->fn) (element, ctx->arg);
+      iot_data_free (element);
+    }
+    else
+    {
+      const iot_data_t * element = iot_data_vector_get (ctx->data, i);
+      ctx->results[i] = element ? (ctx->fn) (element, ctx->arg) : NULL;
+    }
+  }
+  iot_data_alloc_heap (heap);
+}
+
+iot_data_t * iot_data_parallel_map (const iot_data_t * data, iot_data_update_fn fn, void * arg, iot_threadpool_t * pool)
+{
+  iot_data_parallel_map_t ctx = { .data = data, .fn = fn, .arg = arg };
+  iot_data_t ** keys = NULL;
+  iot_data_t * ret = NULL;
+  uint32_t size;
+  assert (fn);
+  if (data == NULL) return NULL;
+  switch (data->type)
+  {
+    case IOT_DATA_VECTOR: size = iot_data_vector_size (data); break;
+    case IOT_DATA_ARRAY: size = iot_data_array_length (data); break;
+    case IOT_DATA_MAP: size = iot_data_map_size (data); break;
+    default: return NULL;
+  }
+  iot_data_arena_t * arena = iot_data_arena_set_current (NULL);
+  iot_data_arena_set_current (arena);
+  if (arena) pool = NULL;
+  ctx.heap = iot_data_alloc_heap (false);
+  iot_data_alloc_heap (ctx.heap);
+  ctx.results = calloc (size ? size : 1u, sizeof (iot_data_t*));
+  if (data->type == IOT_DATA_MAP) // Gather values, as map iterators cannot be positioned by index
+  {
+    iot_data_map_iter_t iter;
+    uint32_t i = 0u;
+    keys = malloc ((size ? size : 1u) * sizeof (iot_data_t*));
+    ctx.values = malloc ((size ? size : 1u) * sizeof (iot_data_t*));
+    iot_data_map_iter (data, &iter);
+    while (iot_data_map_iter_next (&iter))
+    {
+      keys[i] = (iot_data_t*) iot_data_map_iter_key (&iter);
+      ctx.values[i++] = iot_data_map_iter_value (&iter);
+    }
+  }
+  iot_threadpool_parallel_for (pool, 0u, size, IOT_DATA_PARALLEL_MIN, iot_data_parallel_map_range, &ctx);
+  if (keys)
+  {
+    uint32_t count = 0u;
+    for (uint32_t i = 0; i < size; i++) // Omit keys mapped to NULL
+    {
+      if (ctx.results[i])
+      {
+        keys[count] = iot_data_add_ref (keys[i]);
+        ctx.results[count++] = ctx.results[i];
+      }
+    }
+    ret = iot_data_map_is_hashed (data) ? iot_data_alloc_hash_map (data->key_type) : iot_data_alloc_map (data->key_type);
+    iot_data_map_build_sorted (ret, keys, ctx.results, count);
+    free (ctx.values);
+    free (keys);
+  }
+  else
+  {
+    ret = iot_data_alloc_vector (size);
+    for (uint32_t i = 0; i < size; i++)
+    {
+      if (ctx.results[i]) iot_data_vector_add (ret, i, ctx.results[i]);
+    }
+  }
+  free (ctx.results);
+  return ret;
+}
@@ -0,0 +1,476 @@
+//
+// Copyright (c) 2023 IOTech
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+#include "iot/data.h"
+#include "iot/threadpool.h"
+#include "iot/thread.h"
+#include "data-impl.h"
+
+// Readers and writers for sequences of records, as newline delimited JSON or RFC 8742 CBOR sequences.
+// Records are located in a buffer, or in a buffer refilled from a file descriptor, then decoded with a
+// parsing context (or string cache) reused across records. Batches of records can be decoded in parallel,
+// each thread pool job decoding a range of records with its own context.
+
+#define IOT_DATA_SEQ_READ_SIZE 65536u  // Initial read buffer size and minimum read
+#define IOT_DATA_SEQ_WRITE_SIZE 65536u // Writer buffer flushed when larger
+#define IOT_DATA_SEQ_CACHE_SIZE 1024u  // CBOR string cache emptied when larger
+#define IOT_DATA_SEQ_PARALLEL_MIN 16u  // Minimum number of records per job
+#define IOT_DATA_SEQ_JOBS 16u          // Maximum number of jobs
+
+struct iot_data_seq_reader_t
+{
+  iot_data_seq_format_t format;
+  int fd;                             // File descriptor, -1 if reading from a buffer
+  const uint8_t * data;               // Buffer being read
+  size_t size;                        // Size of data in buffer
+  size_t pos;                         // Position of next record
+  uint8_t * buff;                     // Allocated read buffer, if reading from a file descriptor
+  size_t capacity;                    // Read buffer size
+  char * line;                        // Terminated copy of current json record
+  size_t line_size;
+  iot_data_json_context_t * context;  // Json parsing context
+  iot_data_t * cache;                 // CBOR string cache
+  bool eof;                           // Whether end of file reached
+  bool failed;                        // Whether a read or decode failed
+};
+
+struct iot_data_seq_writer_t
+{
+  iot_data_seq_format_t format;
+  iot_data_write_fn write_fn;
+  void * ctx;
+  int fd;
+  char * buff;                        // Encoded records not yet written
+  size_t len;
+  size_t capacity;
+  bool failed;
+};
+
+static iot_data_seq_reader_t * iot_data_seq_reader_create (iot_data_seq_format_t format, int fd)
+{
+  iot_data_seq_reader_t * reader = calloc (1, sizeof (*reader));
+  reader->format = format;
+  reader->fd = fd;
+  if (format == IOT_DATA_SEQ_JSON)
+  {
+    reader->context = iot_data_json_context_alloc (false);
+  }
+  else
+  {
+    reader->cache = iot_data_alloc_map (IOT_DATA_STRING);
+  }
+  return reader;
+}
+
+iot_data_seq_reader_t * iot_data_seq_reader_alloc (iot_data_seq_format_t format, const uint8_t * buff, size_t size)
+{
+  assert (buff || size == 0);
+  iot_data_seq_reader_t * reader = iot_data_seq_reader_create (format, -1);
+  reader->data = buff;
+  reader->size = size;
+  reader->eof = true;
+  return reader;
+}
+
+iot_data_seq_reader_t * iot_data_seq_reader_alloc_fd (iot_data_seq_format_t format, int fd)
+{
+  assert (fd >= 0);
+  iot_data_seq_reader_t * reader = iot_data_seq_reader_create (format, fd);
+  reader->capacity = IOT_DATA_SEQ_READ_SIZE;
+  reader->buff = malloc (reader->capacity);
+  reader->data = reader->buff;
+  return reader;
+}
+
+void iot_data_seq_reader_free (iot_data_seq_reader_t * reader)
+{
+  if (reader)
+  {
+    iot_data_json_context_free (reader->context);
+    iot_data_free (reader->cache);
+    free (reader->line);
+    free (reader->buff);
+    free (reader);
+  }
+}
+
+bool iot_data_seq_reader_failed (const iot_data_seq_reader_t * reader)
+{
+  assert (reader);
+  return reader->failed;
+}
+
+// Move any partial record to the start of the read buffer, growing it if full, and read more data
+
+static bool iot_data_seq_fill (iot_data_seq_reader_t * reader)
+{
+  if (reader->eof || reader->failed) return false;
+  if (reader->pos)
+  {
+    memmove (reader->buff, reader->buff + reader->pos, reader->size - reader->pos);
+    reader->size -= reader->pos;
+    reader->pos = 0u;
+  }
+  if (reader->capacity - reader->size < IOT_DATA_SEQ_READ_SIZE / 2u)
+  {
+    reader->capacity *= 2u;
+    reader->buff = realloc (reader->buff, reader->capacity);
+    reader->data = reader->buff;
+  }
+  ssize_t ret;
+  do
+  {
+    ret = read (reader->fd, reader->buff + reader->size, reader->capacity - reader->size);
+  } while (ret < 0 && errno == EINTR);
+  if (ret > 0)
+  {
+    reader->size += (size_t) ret;
+  }
+  else
+  {
+    reader->eof = true;
+    reader->failed = (ret < 0);
+  }
+  return (ret > 0);
+}
+
+static bool iot_data_seq_blank (const uint8_t * rec, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    if (! isspace (rec[i])) return false;
+  }
+  return true;
+}
+
+// Locate the next record, returning its position and length. Blank json lines are skipped.
+
+static bool iot_data_seq_slice (iot_data_seq_reader_t * reader, const uint8_t ** rec, size_t * len)
+{
+  while (! reader->failed)
+  {
+    const uint8_t * start = reader->data + reader->pos;
+    size_t avail = reader->size - reader->pos;
+    if (reader->format == IOT_DATA_SEQ_JSON)
+    {
+      const uint8_t * nl = memchr (start, '\n', avail);
+      if (nl || (reader->eof && avail))
+      {
+        *len = nl ? (size_t) (nl - start) : avail;
+        reader->pos += nl ? (*len + 1u) : avail;
+        if (iot_data_seq_blank (start, *len)) continue;
+        *rec = start;
+        return true;
+      }
+    }
+#ifdef IOT_HAS_CBOR
+    else if (avail)
+    {
+      *len = iot_data_cbor_item_size (start, avail);
+      if (*len)
+      {
+        reader->pos += *len;
+        *rec = start;
+        return true;
+      }
+      if (reader->eof) reader->failed = true; // Incomplete or not well formed item
+    }
+#endif
+    if (! iot_data_seq_fill (reader) && (reader->failed || reader->pos == reader->size)) break;
+  }
+  return false;
+}
+
+// Decode a record, the json record being terminated by its copy
+
+static iot_data_t * iot_data_seq_decode (iot_data_seq_format_t format, const uint8_t * rec, size_t len, iot_data_json_context_t * context, iot_data_t ** cache)
+{
+  iot_data_t * data = NULL;
+  if (format == IOT_DATA_SEQ_JSON)
+  {
+    data = iot_data_json_context_parse (context, (const char*) rec);
+  }
+#ifdef IOT_HAS_CBOR
+  else if (len <= UINT32_MAX)
+  {
+    if (iot_data_map_size (*cache) > IOT_DATA_SEQ_CACHE_SIZE)
+    {
+      iot_data_free (*cache);
+      *cache = iot_data_alloc_map (IOT_DATA_STRING);
+    }
+    data = iot_data_from_cbor_with_cache (rec, (uint32_t) len, *cache);
+  }
+#else
+  (void) len;
+  (void) cache;
+#endif
+  return data;
+}
+
+static const uint8_t * iot_data_seq_line (iot_data_seq_reader_t * reader, const uint8_t * rec, size_t len)
+{
+  if (len + 1u > reader->line_size)
+  {
+    reader->line_size = len + 1u;
+    reader->line = realloc (reader->line, reader->line_size);
+  }
+  memcpy (reader->line, rec, len);
+  reader->line[len] = '\0';
+  return (const uint8_t*) reader->line;
+}
+
+iot_data_t * iot_data_seq_reader_next (iot_data_seq_reader_t * reader)
+{
+  assert (reader);
+  const uint8_t * rec;
+  size_t len;
+  iot_data_t * data = NULL;
+  if (iot_data_seq_slice (reader, &rec, &len))
+  {
+    if (reader->format == IOT_DATA_SEQ_JSON) rec = iot_data_seq_line (reader, rec, len);
+    data = iot_data_seq_decode (reader->format, rec, len, reader->context, &reader->cache);
+    if (data == NULL) reader->failed = true;
+  }
+  return data;
+}
+
+typedef struct iot_data_seq_batch_t
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  uint32_t pending;           // Number of jobs not yet complete
+  iot_data_seq_format_t format;
+  const uint8_t * records;    // Copied records
+  const size_t * offsets;     // Record offsets, with end offset of last record
+  iot_data_t ** results;      // Decoded records
+  bool heap;                  // Allocation policy of calling thread
+} iot_data_seq_batch_t;
+
+typedef struct iot_data_seq_job_t
+{
+  iot_data_seq_batch_t * batch;
+  uint32_t start;             // First record
+  uint32_t end;               // Record after last
+} iot_data_seq_job_t;
+
+static void iot_data_seq_decode_range (iot_data_seq_batch_t * batch, uint32_t start, uint32_t end, iot_data_json_context_t * context, iot_data_t ** cache)
+{
+  for (uint32_t i = start; i < end; i++)
+  {
+    size_t len = batch->offsets[i + 1u] - batch->offsets[i] - ((batch->format == IOT_DATA_SEQ_JSON) ? 1u : 0u);
+    batch->results[i] = iot_data_seq_decode (batch->format, batch->records + batch->offsets[i], len, context, cache);
+  }
+}
+
+static void * iot_data_seq_job_run (void * arg)
+{
+  iot_data_seq_job_t * job = arg;
+  iot_data_seq_batch_t * batch = job->batch;
+  bool heap = iot_data_alloc_heap (batch->heap);
+  iot_data_json_context_t * context = (batch->format == IOT_DATA_SEQ_JSON) ? iot_data_json_context_alloc (false) : NULL;
+  iot_data_t * cache = (batch->format == IOT_DATA_SEQ_JSON) ? NULL : iot_data_alloc_map (IOT_DATA_STRING);
+  iot_data_seq_decode_range (batch, job->start, job->end, context, &cache);
+  iot_data_json_context_free (context);
+  iot_data_free (cache);
+  iot_data_alloc_heap (heap);
+  pthread_mutex_lock (&batch->mutex);
+  if (--batch->pending == 0u) pthread_cond_signal (&batch->cond);
+  pthread_mutex_unlock (&batch->mutex);
+  return NULL;
+}
+
+// Split records into jobs, run them on the pool (or inline if pool queue full) and wait for completion
+
+static void iot_data_seq_decode_parallel (iot_data_seq_batch_t * batch, uint32_t count, iot_threadpool_t * pool)
+{
+  iot_data_seq_job_t jobs[IOT_DATA_SEQ_JOBS];
+  iot_threadpool_job_t tjobs[IOT_DATA_SEQ_JOBS];
+  uint32_t njobs = count / IOT_DATA_SEQ_PARALLEL_MIN;
+  if (njobs > IOT_DATA_SEQ_JOBS) njobs = IOT_DATA_SEQ_JOBS;
+  uint32_t chunk = (count + njobs - 1u) / njobs;
+
+  iot_mutex_init (&batch->mutex);
+  pthread_cond_init (&batch->cond, NULL);
+  batch->heap = iot_data_alloc_heap (false);
+  iot_data_alloc_heap (batch->heap);
+  for (uint32_t i = 0; i < njobs; i++)
+  {
+    jobs[i].batch = batch;
+    jobs[i].start = i * chunk;
+    jobs[i].end = (jobs[i].start + chunk < count) ? (jobs[i].start + chunk) : count;
+    tjobs[i].function = iot_data_seq_job_run;
+    tjobs[i].arg = &jobs[i];
+    tjobs[i].priority = -1;
+  }
+  batch->pending = njobs;
+  uint32_t added = iot_threadpool_try_work_batch (pool, tjobs, njobs);
+  for (uint32_t i = added; i < njobs; i++) iot_data_seq_job_run (&jobs[i]);
+  pthread_mutex_lock (&batch->mutex);
+  while (batch->pending) pthread_cond_wait (&batch->cond, &batch->mutex);
+  pthread_mutex_unlock (&batch->mutex);
+  pthread_cond_destroy (&batch->cond);
+  pthread_mutex_destroy (&batch->mutex);
+}
+
+iot_data_t * iot_data_seq_reader_batch (iot_data_seq_reader_t * reader, uint32_t max, iot_threadpool_t * pool)
+{
+  assert (reader && max);
+  const uint8_t * rec;
+  size_t len;
+  uint8_t * records = NULL;
+  size_t used = 0u;
+  size_t capacity = 0u;
+  size_t * offsets = malloc ((max + 1u) * sizeof (*offsets));
+  uint32_t count = 0u;
+  iot_data_t * vector = NULL;
+  bool json = (reader->format == IOT_DATA_SEQ_JSON);
+
+  // Copy records, as a file descriptor read buffer is reused, terminating json records
+
+  while (count < max && iot_data_seq_slice (reader, &rec, &len))
+  {
+    if (used + len + 1u > capacity)
+    {
+      capacity = (used + len + 1u > 2u * capacity) ? (used + len + 1u) : (2u * capacity);
+      records = realloc (records, capacity);
+    }
+    offsets[count++] = used;
+    memcpy (records + used, rec, len);
+    used += len;
+    if (json) records[used++] = '\0';
+  }
+  offsets[count] = used;
+
+  if (count)
+  {
+    iot_data_seq_batch_t batch = { .format = reader->format, .records = records, .offsets = offsets };
+    iot_data_arena_t * arena = iot_data_arena_set_current (NULL);
+    iot_data_arena_set_current (arena);
+    batch.results = malloc (count * sizeof (*batch.results));
+    if (pool && (arena == NULL) && (count >= 2u * IOT_DATA_SEQ_PARALLEL_MIN)) // Not when allocating from an (unsynchronised) arena
+    {
+      iot_data_seq_decode_parallel (&batch, count, pool);
+    }
+    else
+    {
+      iot_data_seq_decode_range (&batch, 0u, count, reader->context, &reader->cache);
+    }
+    vector = iot_data_alloc_vector (count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      if (batch.results[i] == NULL) // Records following one that cannot be decoded are discarded
+      {
+        reader->failed = true;
+        for (uint32_t j = i + 1u; j < count; j++) iot_data_free (batch.results[j]);
+        iot_data_vector_resize (vector, i);
+        break;
+      }
+      iot_data_vector_add (vector, i, batch.results[i]);
+    }
+    free (batch.results);
+    if (iot_data_vector_size (vector) == 0u)
+    {
+      iot_data_free (vector);
+      vector = NULL;
+    }
+  }
+  free (records);
+  free (offsets);
+  return vector;
+}
+
+static bool iot_data_seq_write_fd (void * ctx, const char * str, size_t len)
+{
+  int fd = *(int*) ctx;
+  while (len)
+  {
+    ssize_t ret = write (fd, str, len);
+    if (ret < 0)
+    {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    str += ret;
+    len -= (size_t) ret;
+  }
+  return true;
+}
+
+iot_data_seq_writer_t * iot_data_seq_writer_alloc (iot_data_seq_format_t format, iot_data_write_fn write_fn, void * ctx)
+{
+  assert (write_fn);
+  iot_data_seq_writer_t * writer = calloc (1, sizeof (*writer));
+  writer->format = format;
+  writer->write_fn = write_fn;
+  writer->ctx = ctx;
+  writer->fd = -1;
+  writer->capacity = IOT_DATA_SEQ_WRITE_SIZE;
+  writer->buff = malloc (writer->capacity);
+  return writer;
+}
+
+iot_data_seq_writer_t * iot_data_seq_writer_alloc_fd (iot_data_seq_format_t format, int fd)
+{
+  assert (fd >= 0);
+  iot_data_seq_writer_t * writer = iot_data_seq_writer_alloc (format, iot_data_seq_write_fd, NULL);
+  writer->fd = fd;
+  writer->ctx = &writer->fd;
+  return writer;
+}
+
+static void iot_data_seq_reserve (iot_data_seq_writer_t * writer, size_t len)
+{
+  if (writer->len + len > writer->capacity)
+  {
+    writer->capacity = (writer->len + len > 2u * writer->capacity) ? (writer->len + len) : (2u * writer->capacity);
+    writer->buff = realloc (writer->buff, writer->capacity);
+  }
+}
+
+static bool iot_data_seq_append (void * ctx, const char * str, size_t len)
+{
+  iot_data_seq_writer_t * writer = ctx;
+  iot_data_seq_reserve (writer, len);
+  memcpy (writer->buff + writer->len, str, len);
+  writer->len += len;
+  return true;
+}
+
+bool iot_data_seq_writer_flush (iot_data_seq_writer_t * writer)
+{
+  assert (writer);
+  if (writer->len && ! writer->failed) writer->failed = ! (writer->write_fn) (writer->ctx, writer->buff, writer->len);
+  writer->len = 0u;
+  return ! writer->failed;
+}
+
+bool iot_data_seq_writer_put (iot_data_seq_writer_t * writer, const iot_data_t * data)
+{
+  assert (writer && data);
+  if (writer->format == IOT_DATA_SEQ_JSON)
+  {
+    iot_data_to_json_sink (data, iot_data_seq_append, writer);
+    iot_data_seq_append (writer, "\n", 1u);
+  }
+#ifdef IOT_HAS_CBOR
+  else
+  {
+    size_t len = iot_data_cbor_size (data);
+    iot_data_seq_reserve (writer, len);
+    writer->len += iot_data_to_cbor_buffer (data, (uint8_t*) writer->buff + writer->len, len);
+  }
+#endif
+  return (writer->len < IOT_DATA_SEQ_WRITE_SIZE) ? ! writer->failed : iot_data_seq_writer_flush (writer);
+}
+
+void iot_data_seq_writer_free (iot_data_seq_writer_t * writer)
+{
+  if (writer)
+  {
+    iot_data_seq_writer_flush (writer);
+    free (writer->buff);
+    free (writer);
+  }
+}
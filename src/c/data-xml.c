@@ -39,18 +39,12 @@ static iot_data_t * iot_data_map_from_xml (bool root, yxml_t * x, iot_string_hol
           }
           else
           {
-            uint32_t size = 0u;
             if (!children)
             {
-              children = iot_data_alloc_vector (1u);
+              children = iot_data_alloc_vector (0u);
               iot_data_string_map_add (elem, "children", children);
             }
-            else
-            {
-              size = iot_data_vector_size (children);
-              iot_data_vector_resize (children, size + 1u);
-            }
-            iot_data_vector_add (children, size, child);
+            iot_data_vector_append (children, child);
           }
         }
         else
@@ -111,9 +105,200 @@ iot_data_t * iot_data_from_xml (const char * xml)
   holder.str = calloc (1, YXML_BUFF_SIZE);
   holder.size = YXML_BUFF_SIZE;
   holder.free = YXML_BUFF_SIZE - 1; // Allowing for string terminator
+  holder.sink = NULL;
   yxml_init (x, x+1, YXML_PARSER_BUFF_SIZE);
   result = iot_data_map_from_xml (true, x, &holder, &xml);
   free (x);
   free (holder.str);
   return result;
 }
+
+// Incremental XML parser. Element names are held on a stack of frames, one per open element, with
+// maps only built for frames within a materialised element.
+
+#define IOT_XML_STREAM_DEPTH 16u
+
+typedef struct iot_xml_frame_t
+{
+  iot_data_t * elem;          // Element map if materialised, else NULL
+  iot_data_t * attrs;         // Element attributes map if materialised
+  iot_data_t * children;      // Element children vector if materialised and has children
+  size_t name;                // Offset of element name in names buffer
+} iot_xml_frame_t;
+
+struct iot_data_xml_stream_t
+{
+  yxml_t * parser;            // yxml parser and stack
+  iot_xml_frame_t * stack;    // Stack of open elements
+  uint32_t depth;             // Number of open elements
+  uint32_t max_depth;         // Allocated stack size
+  uint32_t materialise;       // Depth of materialised element, zero if none
+  char * names;               // Names of open elements, each NULL terminated
+  size_t names_len;           // Used length of names buffer
+  size_t names_size;          // Allocated names buffer size
+  iot_string_holder_t holder; // Current content or attribute value
+  iot_data_xml_event_fn fn;   // Event callback
+  void * arg;                 // Event callback argument
+  bool error;                 // Whether the XML parsed so far is invalid
+};
+
+static inline void iot_data_xml_stream_clear (iot_data_xml_stream_t * stream)
+{
+  stream->holder.str[0] = '\0';
+  stream->holder.free = stream->holder.size - 1;
+}
+
+iot_data_xml_stream_t * iot_data_xml_stream_alloc (iot_data_xml_event_fn fn, void * arg)
+{
+  assert (fn);
+  iot_data_xml_stream_t * stream = calloc (1, sizeof (*stream));
+  stream->parser = malloc (sizeof (yxml_t) + YXML_PARSER_BUFF_SIZE);
+  stream->max_depth = IOT_XML_STREAM_DEPTH;
+  stream->stack = calloc (stream->max_depth, sizeof (*stream->stack));
+  stream->names_size = YXML_BUFF_SIZE;
+  stream->names = malloc (stream->names_size);
+  stream->holder.str = calloc (1, YXML_BUFF_SIZE);
+  stream->holder.size = YXML_BUFF_SIZE;
+  stream->holder.free = YXML_BUFF_SIZE - 1; // Allowing for string terminator
+  stream->fn = fn;
+  stream->arg = arg;
+  yxml_init (stream->parser, stream->parser + 1, YXML_PARSER_BUFF_SIZE);
+  return stream;
+}
+
+static void iot_data_xml_stream_reset (iot_data_xml_stream_t * stream)
+{
+  if (stream->materialise) iot_data_free (stream->stack[stream->materialise - 1u].elem);
+  memset (stream->stack, 0, stream->max_depth * sizeof (*stream->stack));
+  stream->depth = 0u;
+  stream->materialise = 0u;
+  stream->names_len = 0u;
+  stream->error = false;
+  iot_data_xml_stream_clear (stream);
+  yxml_init (stream->parser, stream->parser + 1, YXML_PARSER_BUFF_SIZE);
+}
+
+void iot_data_xml_stream_free (iot_data_xml_stream_t * stream)
+{
+  if (stream)
+  {
+    iot_data_xml_stream_reset (stream);
+    free (stream->holder.str);
+    free (stream->names);
+    free (stream->stack);
+    free (stream->parser);
+    free (stream);
+  }
+}
+
+static void iot_data_xml_stream_start (iot_data_xml_stream_t * stream)
+{
+  const char * name = stream->parser->elem;
+  size_t len = strlen (name) + 1u;
+  if (stream->depth == stream->max_depth)
+  {
+    stream->stack = realloc (stream->stack, 2u * stream->max_depth * sizeof (*stream->stack));
+    memset (stream->stack + stream->max_depth, 0, stream->max_depth * sizeof (*stream->stack));
+    stream->max_depth *= 2u;
+  }
+  while (stream->names_len + len > stream->names_size)
+  {
+    stream->names_size *= 2u;
+    stream->names = realloc (stream->names, stream->names_size);
+  }
+  iot_xml_frame_t * frame = &stream->stack[stream->depth++];
+  frame->name = stream->names_len;
+  memcpy (stream->names + stream->names_len, name, len);
+  stream->names_len += len;
+  iot_data_xml_stream_clear (stream);
+
+  if (stream->materialise == 0u && (stream->fn) (stream->arg, IOT_DATA_XML_ELEMENT_START, stream->depth, name, NULL, NULL))
+  {
+    stream->materialise = stream->depth;
+  }
+  if (stream->materialise)
+  {
+    frame->elem = iot_data_alloc_map (IOT_DATA_STRING);
+    frame->attrs = iot_data_alloc_map (IOT_DATA_STRING);
+    iot_data_string_map_add (frame->elem, "name", iot_data_alloc_string (name, IOT_DATA_COPY));
+    iot_data_string_map_add (frame->elem, "attributes", frame->attrs);
+    if (stream->depth > stream->materialise)
+    {
+      iot_xml_frame_t * parent = frame - 1;
+      if (! parent->children)
+      {
+        parent->children = iot_data_alloc_vector (0u);
+        iot_data_string_map_add (parent->elem, "children", parent->children);
+      }
+      iot_data_vector_append (parent->children, frame->elem);
+    }
+  }
+}
+
+static void iot_data_xml_stream_attribute (iot_data_xml_stream_t * stream)
+{
+  iot_xml_frame_t * frame = &stream->stack[stream->depth - 1u];
+  if (frame->attrs)
+  {
+    iot_data_map_add (frame->attrs, iot_data_alloc_string (stream->parser->attr, IOT_DATA_COPY), iot_data_alloc_string (stream->holder.str, IOT_DATA_COPY));
+  }
+  else
+  {
+    (stream->fn) (stream->arg, IOT_DATA_XML_ATTRIBUTE, stream->depth, stream->parser->attr, stream->holder.str, NULL);
+  }
+  iot_data_xml_stream_clear (stream);
+}
+
+static void iot_data_xml_stream_end (iot_data_xml_stream_t * stream)
+{
+  iot_xml_frame_t * frame = &stream->stack[stream->depth - 1u];
+  const char * content = (stream->holder.str[0] != '\0') ? stream->holder.str : NULL;
+  if (frame->elem && content)
+  {
+    iot_data_string_map_add (frame->elem, "content", iot_data_alloc_string (content, IOT_DATA_COPY));
+  }
+  if (frame->elem == NULL || stream->depth == stream->materialise)
+  {
+    (stream->fn) (stream->arg, IOT_DATA_XML_ELEMENT_END, stream->depth, stream->names + frame->name, content, frame->elem);
+  }
+  if (stream->depth == stream->materialise)
+  {
+    iot_data_free (frame->elem);
+    stream->materialise = 0u;
+  }
+  stream->names_len = frame->name;
+  stream->depth--;
+  memset (frame, 0, sizeof (*frame));
+  iot_data_xml_stream_clear (stream);
+}
+
+bool iot_data_xml_stream_push (iot_data_xml_stream_t * stream, const char * chunk, size_t len)
+{
+  assert (stream && (chunk || len == 0));
+  for (size_t i = 0; i < len && ! stream->error; i++)
+  {
+    switch (yxml_parse (stream->parser, chunk[i]))
+    {
+      case YXML_ELEMSTART: iot_data_xml_stream_start (stream); break;
+      case YXML_ELEMEND: iot_data_xml_stream_end (stream); break;
+      case YXML_ATTREND: iot_data_xml_stream_attribute (stream); break;
+      case YXML_ATTRVAL:
+      case YXML_CONTENT: iot_data_strcat_escape (&stream->holder, stream->parser->data, false); break;
+      case YXML_EEOF:
+      case YXML_EREF:
+      case YXML_ECLOSE:
+      case YXML_ESTACK:
+      case YXML_ESYN: stream->error = true; break;
+      default: break;
+    }
+  }
+  return ! stream->error;
+}
+
+bool iot_data_xml_stream_finish (iot_data_xml_stream_t * stream)
+{
+  assert (stream);
+  bool ok = ! stream->error && (yxml_eof (stream->parser) == YXML_OK);
+  iot_data_xml_stream_reset (stream);
+  return ok;
+}
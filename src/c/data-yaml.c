@@ -8,92 +8,171 @@
 #include <math.h>
 #include <yaml.h>
 
-static iot_data_t * iot_data_map_from_yaml (yaml_parser_t *parser, iot_data_t **exception);
+// Context for parsing from YAML events
 
-static iot_data_t * iot_data_string_from_yaml (const yaml_event_t *event)
+typedef struct iot_data_yaml_ctx_t
 {
-  return iot_data_alloc_string ((const char *)event->data.scalar.value, IOT_DATA_COPY);
-}
+  yaml_parser_t parser;     // libyaml parser
+  iot_data_t * cache;       // String cache map
+  iot_data_t ** exception;  // Parse error description
+  iot_data_substitute_fn subst; // Scalar substitution function, if substituting
+  void * subst_arg;         // Substitution function argument
+} iot_data_yaml_ctx_t;
+
+// Plain scalar classes, determined in a single pass so at most one conversion is attempted
 
-static iot_data_t * iot_data_value_from_yaml (const yaml_event_t *event)
+typedef enum iot_data_yaml_class_t
 {
-  iot_data_t *ret = NULL;
-  const char *val = (const char *)event->data.scalar.value;
-  if (event->data.scalar.style == YAML_PLAIN_SCALAR_STYLE)
+  IOT_YAML_STRING,
+  IOT_YAML_TRUE,
+  IOT_YAML_FALSE,
+  IOT_YAML_NULL,
+  IOT_YAML_INT,
+  IOT_YAML_FLOAT
+} iot_data_yaml_class_t;
+
+static iot_data_t * iot_data_map_from_yaml (iot_data_yaml_ctx_t * ctx);
+
+static iot_data_yaml_class_t iot_data_yaml_classify (const char * val, size_t len)
+{
+  const char * ptr = val;
+  const char * end = val + len;
+  bool digits = false;
+  bool real = false;
+
+  switch (*val)
+  {
+    case 't': return (len == 4u && memcmp (val, "true", 4u) == 0) ? IOT_YAML_TRUE : IOT_YAML_STRING;
+    case 'f': return (len == 5u && memcmp (val, "false", 5u) == 0) ? IOT_YAML_FALSE : IOT_YAML_STRING;
+    case 'n': if (len == 4u && memcmp (val, "null", 4u) == 0) return IOT_YAML_NULL; break;
+    case '\0': return IOT_YAML_STRING;
+    default: break;
+  }
+  if (*ptr == '-' || *ptr == '+') ptr++;
+  if (ptr[0] == '0' && (ptr[1] == 'x' || ptr[1] == 'X')) // Hexadecimal
+  {
+    for (ptr += 2; ptr < end && isxdigit ((unsigned char) *ptr); ptr++) digits = true;
+    return (ptr == end && digits) ? IOT_YAML_INT : IOT_YAML_FLOAT;
+  }
+  switch (*ptr)
+  {
+    case 'i': case 'I': case 'n': case 'N': // Possible inf, infinity or nan
+      return ((end - ptr) == 3 || (end - ptr) == 8) ? IOT_YAML_FLOAT : IOT_YAML_STRING;
+    default: break;
+  }
+  for (; ptr < end; ptr++)
   {
-    if (strcmp (val, "true") == 0)
+    char c = *ptr;
+    if (c >= '0' && c <= '9')
     {
-      ret = iot_data_alloc_bool (true);
+      digits = true;
     }
-    else if (strcmp (val, "false") == 0)
+    else if (c == '.' || c == 'e' || c == 'E' || ((c == '-' || c == '+') && real))
     {
-      ret = iot_data_alloc_bool (false);
+      real = true;
     }
-    else if (strcmp (val, "null") == 0)
+    else
     {
-      ret = iot_data_alloc_null ();
+      return IOT_YAML_STRING;
     }
-    else if (*val)
+  }
+  return digits ? (real ? IOT_YAML_FLOAT : IOT_YAML_INT) : IOT_YAML_STRING;
+}
+
+// Returns the substituted scalar if it contains a "${" reference, otherwise NULL. Sets the exception if the substitution fails
+
+static char * iot_data_yaml_substitute (const iot_data_yaml_ctx_t * ctx, const yaml_event_t *event)
+{
+  char * sub = NULL;
+  const char *val = (const char *)event->data.scalar.value;
+  if (ctx->subst && strstr (val, "${"))
+  {
+    sub = (ctx->subst) (val, ctx->subst_arg);
+    if (sub == NULL) *ctx->exception = iot_data_alloc_string_fmt ("Substitution failed at line %zu", event->start_mark.line);
+  }
+  return sub;
+}
+
+static iot_data_t * iot_data_string_from_yaml (const iot_data_yaml_ctx_t * ctx, const yaml_event_t *event)
+{
+  char * sub = iot_data_yaml_substitute (ctx, event);
+  if (*ctx->exception) return NULL;
+  return iot_data_string_cached (sub ? iot_data_alloc_string (sub, IOT_DATA_TAKE) : iot_data_alloc_string ((const char *)event->data.scalar.value, IOT_DATA_COPY), ctx->cache);
+}
+
+static iot_data_t * iot_data_value_from_yaml (const iot_data_yaml_ctx_t * ctx, const yaml_event_t *event)
+{
+  iot_data_t *ret = NULL;
+  char * sub = iot_data_yaml_substitute (ctx, event);
+  const char *val = sub ? sub : (const char *)event->data.scalar.value;
+  if (*ctx->exception) return NULL;
+  if (event->data.scalar.style == YAML_PLAIN_SCALAR_STYLE)
+  {
+    char *e;
+    switch (iot_data_yaml_classify (val, sub ? strlen (sub) : event->data.scalar.length))
     {
-      char *e;
-      if (*val == '-')
+      case IOT_YAML_TRUE: ret = iot_data_alloc_bool (true); break;
+      case IOT_YAML_FALSE: ret = iot_data_alloc_bool (false); break;
+      case IOT_YAML_NULL: ret = iot_data_alloc_null (); break;
+      case IOT_YAML_INT:
       {
-        long long ll = strtoll (val, &e, 0);
-        if (*e == '\0')
+        if (*val == '-')
         {
-          ret = iot_data_alloc_i64 (ll);
+          long long ll = strtoll (val, &e, 0);
+          if (*e == '\0') ret = iot_data_alloc_i64 (ll);
         }
-      }
-      if (ret == NULL)
-      {
-        unsigned long long ull = strtoull (val, &e, 0);
-        if (*e == '\0')
+        else
         {
-          ret = ull < INT64_MAX ? iot_data_alloc_i64 (ull) : iot_data_alloc_ui64 (ull);
+          unsigned long long ull = strtoull (val, &e, 0);
+          if (*e == '\0') ret = ull < INT64_MAX ? iot_data_alloc_i64 (ull) : iot_data_alloc_ui64 (ull);
         }
+        if (ret) break;
       }
-      if (ret == NULL)
+      /* Fallthrough, as numbers with leading zeros (octal) may not be valid integers */
+      case IOT_YAML_FLOAT:
       {
         double d = strtod (val, &e);
-        if (*e == '\0')
-        {
-          ret = iot_data_alloc_f64 (d);
-        }
+        if (*e == '\0') ret = iot_data_alloc_f64 (d);
+        break;
       }
+      default: break;
     }
   }
   if (ret == NULL)
   {
-    ret = iot_data_alloc_string (val, IOT_DATA_COPY);
+    ret = iot_data_string_cached (sub ? iot_data_alloc_string (sub, IOT_DATA_TAKE) : iot_data_alloc_string (val, IOT_DATA_COPY), ctx->cache);
+  }
+  else
+  {
+    free (sub);
   }
   return ret;
 }
 
-static iot_data_t * iot_data_vector_from_yaml (yaml_parser_t *parser, iot_data_t **exception)
+static iot_data_t * iot_data_vector_from_yaml (iot_data_yaml_ctx_t * ctx)
 {
   yaml_event_t event;
   bool done = false;
-  uint32_t size = 0;
   iot_data_t *elem;
-  iot_data_t * vec = iot_data_alloc_vector (size);
+  iot_data_t * vec = iot_data_alloc_vector (0u);
   do
   {
     elem = NULL;
-    if (!yaml_parser_parse (parser, &event))
+    if (!yaml_parser_parse (&ctx->parser, &event))
     {
-      *exception = iot_data_alloc_string_fmt ("%s at line %zu", parser->problem, parser->problem_mark.line);
+      *ctx->exception = iot_data_alloc_string_fmt ("%s at line %zu", ctx->parser.problem, ctx->parser.problem_mark.line);
       break;
     }
     switch (event.type)
     {
       case YAML_SCALAR_EVENT:
-        elem = iot_data_value_from_yaml (&event);
+        elem = iot_data_value_from_yaml (ctx, &event);
         break;
       case YAML_MAPPING_START_EVENT:
-        elem = iot_data_map_from_yaml (parser, exception);
+        elem = iot_data_map_from_yaml (ctx);
         break;
       case YAML_SEQUENCE_START_EVENT:
-        elem = iot_data_vector_from_yaml (parser, exception);
+        elem = iot_data_vector_from_yaml (ctx);
         break;
       case YAML_SEQUENCE_END_EVENT:
         done = true;
@@ -101,14 +180,10 @@ static iot_data_t * iot_data_vector_from_yaml (yaml_parser_t *parser, iot_data_t
       default:
         break;
     }
-    if (elem)
-    {
-      iot_data_vector_resize (vec, size + 1);
-      iot_data_vector_add (vec, size++, elem);
-    }
+    if (elem) iot_data_vector_append (vec, elem);
     yaml_event_delete (&event);
-  } while (!done && *exception == NULL);
-  if (*exception)
+  } while (!done && *ctx->exception == NULL);
+  if (*ctx->exception)
   {
     iot_data_free (vec);
     return NULL;
@@ -119,7 +194,7 @@ static iot_data_t * iot_data_vector_from_yaml (yaml_parser_t *parser, iot_data_t
   }
 }
 
-static iot_data_t * iot_data_map_from_yaml (yaml_parser_t *parser, iot_data_t **exception)
+static iot_data_t * iot_data_map_from_yaml (iot_data_yaml_ctx_t * ctx)
 {
   yaml_event_t event;
   bool done = false;
@@ -128,9 +203,9 @@ static iot_data_t * iot_data_map_from_yaml (yaml_parser_t *parser, iot_data_t **
   iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
   do
   {
-    if (!yaml_parser_parse (parser, &event))
+    if (!yaml_parser_parse (&ctx->parser, &event))
     {
-      *exception = iot_data_alloc_string_fmt ("%s at line %zu", parser->problem, parser->problem_mark.line);
+      *ctx->exception = iot_data_alloc_string_fmt ("%s at line %zu", ctx->parser.problem, ctx->parser.problem_mark.line);
       break;
     }
     switch (event.type)
@@ -138,18 +213,18 @@ static iot_data_t * iot_data_map_from_yaml (yaml_parser_t *parser, iot_data_t **
       case YAML_SCALAR_EVENT:
         if (name)
         {
-          elem = iot_data_value_from_yaml (&event);
+          elem = iot_data_value_from_yaml (ctx, &event);
         }
         else
         {
-          name = iot_data_string_from_yaml (&event);
+          name = iot_data_string_from_yaml (ctx, &event);
         }
         break;
       case YAML_MAPPING_START_EVENT:
-        elem = iot_data_map_from_yaml (parser, exception);
+        elem = iot_data_map_from_yaml (ctx);
         break;
       case YAML_SEQUENCE_START_EVENT:
-        elem = iot_data_vector_from_yaml (parser, exception);
+        elem = iot_data_vector_from_yaml (ctx);
         break;
       case YAML_MAPPING_END_EVENT:
         done = true;
@@ -165,16 +240,16 @@ static iot_data_t * iot_data_map_from_yaml (yaml_parser_t *parser, iot_data_t **
       }
       else
       {
-        *exception = iot_data_alloc_string_fmt ("Unexpected (anonymous) %s in map at line %zu", event.type == YAML_MAPPING_START_EVENT ? "map" : "sequence", parser->mark.line);
+        *ctx->exception = iot_data_alloc_string_fmt ("Unexpected (anonymous) %s in map at line %zu", event.type == YAML_MAPPING_START_EVENT ? "map" : "sequence", ctx->parser.mark.line);
         iot_data_free (elem);
       }
       name = NULL;
       elem = NULL;
     }
     yaml_event_delete (&event);
-  } while (!done && *exception == NULL);
+  } while (!done && *ctx->exception == NULL);
   iot_data_free (name);
-  if (*exception)
+  if (*ctx->exception)
   {
     iot_data_free (map);
     return NULL;
@@ -185,35 +260,33 @@ static iot_data_t * iot_data_map_from_yaml (yaml_parser_t *parser, iot_data_t **
   }
 }
 
-iot_data_t * iot_data_from_yaml (const char * yaml, iot_data_t **exception)
+static iot_data_t * iot_data_yaml_parse (iot_data_yaml_ctx_t * ctx)
 {
-  assert (yaml);
   iot_data_t *result = NULL;
-  yaml_parser_t parser;
   yaml_event_t event;
   bool done = false;
-  *exception = NULL;
-  yaml_parser_initialize (&parser);
-  yaml_parser_set_input_string (&parser, (const yaml_char_t *)yaml, strlen (yaml));
+  iot_data_t * cache = ctx->cache;
+  if (cache == NULL) ctx->cache = iot_data_alloc_map (IOT_DATA_STRING);
+  *ctx->exception = NULL;
   do
   {
-    if (!yaml_parser_parse (&parser, &event))
+    if (!yaml_parser_parse (&ctx->parser, &event))
     {
-      *exception = iot_data_alloc_string_fmt ("%s at line %zu", parser.problem, parser.problem_mark.line);
+      *ctx->exception = iot_data_alloc_string_fmt ("%s at line %zu", ctx->parser.problem, ctx->parser.problem_mark.line);
       break;
     }
     switch (event.type)
     {
       case YAML_SCALAR_EVENT:
-        result = iot_data_value_from_yaml (&event);
+        result = iot_data_value_from_yaml (ctx, &event);
         done = true;
         break;
       case YAML_MAPPING_START_EVENT:
-        result = iot_data_map_from_yaml (&parser, exception);
+        result = iot_data_map_from_yaml (ctx);
         done = true;
         break;
       case YAML_SEQUENCE_START_EVENT:
-        result = iot_data_vector_from_yaml (&parser, exception);
+        result = iot_data_vector_from_yaml (ctx);
         done = true;
         break;
       case YAML_STREAM_END_EVENT:
@@ -225,6 +298,52 @@ iot_data_t * iot_data_from_yaml (const char * yaml, iot_data_t **exception)
     yaml_event_delete (&event);
   } while (!done);
 
-  yaml_parser_delete (&parser);
+  if (cache != ctx->cache) iot_data_free (ctx->cache);
+  yaml_parser_delete (&ctx->parser);
   return result;
 }
+
+iot_data_t * iot_data_from_yaml (const char * yaml, iot_data_t **exception)
+{
+  return iot_data_from_yaml_with_cache (yaml, NULL, exception);
+}
+
+iot_data_t * iot_data_from_yaml_with_cache (const char * yaml, iot_data_t * cache, iot_data_t **exception)
+{
+  assert (yaml && exception);
+  assert ((cache == NULL) || iot_data_map_key_is_of_type (cache, IOT_DATA_STRING));
+  iot_data_yaml_ctx_t ctx = { .cache = cache, .exception = exception };
+  yaml_parser_initialize (&ctx.parser);
+  yaml_parser_set_input_string (&ctx.parser, (const yaml_char_t *)yaml, strlen (yaml));
+  return iot_data_yaml_parse (&ctx);
+}
+
+iot_data_t * iot_data_from_yaml_with_substitute (const char * yaml, iot_data_substitute_fn fn, void * arg, iot_data_t **exception)
+{
+  assert (yaml && fn && exception);
+  iot_data_yaml_ctx_t ctx = { .cache = NULL, .exception = exception, .subst = fn, .subst_arg = arg };
+  yaml_parser_initialize (&ctx.parser);
+  yaml_parser_set_input_string (&ctx.parser, (const yaml_char_t *)yaml, strlen (yaml));
+  return iot_data_yaml_parse (&ctx);
+}
+
+static int iot_data_yaml_read (void * data, unsigned char * buffer, size_t size, size_t * size_read)
+{
+  ssize_t ret;
+  do
+  {
+    ret = read (*(int*) data, buffer, size);
+  } while (ret < 0 && errno == EINTR);
+  *size_read = (ret > 0) ? (size_t) ret : 0u;
+  return (ret >= 0) ? 1 : 0;
+}
+
+iot_data_t * iot_data_from_yaml_fd (int fd, iot_data_t * cache, iot_data_t **exception)
+{
+  assert (fd >= 0 && exception);
+  assert ((cache == NULL) || iot_data_map_key_is_of_type (cache, IOT_DATA_STRING));
+  iot_data_yaml_ctx_t ctx = { .cache = cache, .exception = exception };
+  yaml_parser_initialize (&ctx.parser);
+  yaml_parser_set_input (&ctx.parser, iot_data_yaml_read, &fd);
+  return iot_data_yaml_parse (&ctx);
+}
@@ -8,28 +8,51 @@
 #include "iot/base64.h"
 #include "iot/hash.h"
 #include "iot/uuid.h"
+#include "iot/thread.h"
+#include "trace-impl.h"
 #include <stdarg.h>
 #include <float.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#if defined (IOT_HAS_FILE) && !defined (_AZURESPHERE_)
+#include "iot/file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #define IOT_DATA_IS_COMPOSED_TYPE(t) ((t) >= IOT_DATA_VECTOR && (t) <= IOT_DATA_MAP)
 #define IOT_DATA_IS_FLOAT_TYPE(t) ((t) == IOT_DATA_FLOAT32 || (t) == IOT_DATA_FLOAT64)
 #define IOT_DATA_IS_INT_TYPE(t) ((t) >= IOT_DATA_INT8 && (t) <= IOT_DATA_UINT64)
 #define IOT_DATA_IS_SIGNED_TYPE(t) ((t) == IOT_DATA_INT8 || (t) == IOT_DATA_INT16 || (t) == IOT_DATA_INT32 || (t) == IOT_DATA_INT64)
 
-#if defined (NDEBUG) || defined (_AZURESPHERE_)
+#if defined (__ZEPHYR__) && (IOT_ZEPHYR_DATA_BLOCKS > 0)
+#define IOT_DATA_ZEPHYR_POOL
+#elif defined (NDEBUG) || defined (_AZURESPHERE_)
 #define IOT_DATA_CACHE
 #endif
 
 #define IOT_DATA_TYPES (IOT_DATA_INVALID + 1)
 #define IOT_MEMORY_BLOCK_SIZE 4096u
+#define IOT_DATA_HUGE_PAGE_SIZE 0x200000u
 #define IOT_VAL_BUFF_SIZE 31u
 #define IOT_STR_BUFF_DOUBLING_LIMIT 4096u
 #define IOT_STR_BUFF_INCREMENT 1024u
+#define IOT_DATA_MAGAZINE_SIZE 32u
+#define IOT_MAP_INDEX_MIN 16u
+#define IOT_DATA_INTERN_SHARDS 16u
+#define IOT_DATA_INTERN_MIN 64u
+#define IOT_DATA_INTERN_LIMIT 65536u
+#define IOT_DATA_ENCODE_CACHE_MIN 64u
+#define IOT_DATA_DEDUP_SHARDS 64u
 
 static const char * iot_data_type_names [IOT_DATA_TYPES] = {"Int8","UInt8","Int16","UInt16","Int32","UInt32","Int64","UInt64","Float32","Float64","Bool","Pointer","String","Null","Binary","Array","Vector","List","Map","Multi", "Invalid"};
 static const uint8_t iot_data_type_sizes [IOT_DATA_BINARY + 1] = {1u, 1u, 2u, 2u, 4u, 4u, 8u, 8u, 4u, 8u, sizeof (bool), sizeof (void*), sizeof (char*), 0u, 1u };
 static _Thread_local bool iot_data_alloc_from_heap = false; /* Thread specific memory allocation policy */
+static _Thread_local iot_data_arena_t * iot_data_arena_current = NULL; /* Thread specific allocation arena */
 iot_data_static_t iot_data_order = { 0 };
+iot_data_static_t iot_data_shape = { 0 };
 static const char * iot_data_const_strings [] = { "category","config","name","state","type",NULL };
 
 iot_data_consts_t iot_data_consts = { 0 };
@@ -66,6 +89,7 @@ typedef struct iot_data_array_t
 {
   iot_data_t base;
   uint32_t length;
+  uint32_t capacity; // Number of allocated elements, grown geometrically for batch columns
   void * data;
 } iot_data_array_t;
 
@@ -73,6 +97,7 @@ typedef struct iot_data_vector_t
 {
   iot_data_t base;
   uint32_t size;
+  uint32_t capacity;     // Number of allocated values, those beyond size are NULL
   iot_data_t ** values;
 } iot_data_vector_t;
 
@@ -85,23 +110,41 @@ typedef struct iot_node_t
   iot_data_t * value;
   iot_node_colour_t colour;
   bool heap : 1;
+  bool arena : 1;
+  uint32_t ikey; // Inline copy of integer keys of up to 32 bits, see iot_data_inline_key
 } iot_node_t;
 
+/* Optional open addressing hash index of map nodes, keyed by key hash */
+
+typedef struct iot_map_index_t
+{
+  uint32_t capacity;     // Number of slots, always a power of two
+  uint32_t used;         // Number of occupied and deleted slots
+  iot_node_t * slots[];  // Node pointers, NULL if free
+} iot_map_index_t;
+
 typedef struct iot_data_map_t
 {
   iot_data_t base;
   uint32_t size;
   iot_node_t * tree;
+  iot_map_index_t * index;
 } iot_data_map_t;
 
+/* Lists are unrolled, each element holding up to IOT_DATA_LIST_CHUNK values in a single data block */
+
+#define IOT_DATA_LIST_CHUNK ((sizeof (iot_node_t) - 2u * sizeof (void*) - 8u) / sizeof (iot_data_t*))
+
 typedef struct iot_element_t
 {
   struct iot_element_t * next;
   struct iot_element_t * prev;
-  iot_data_t * value;
-  uint32_t priority;
   uint32_t length;
+  uint8_t start;                             // Index of first value
+  uint8_t count;                             // Number of values
   bool heap : 1;
+  bool arena : 1;
+  iot_data_t * values[IOT_DATA_LIST_CHUNK];  // Values, in tail to head order
 } iot_element_t;
 
 /* Note: Due to size constraints, list length is carried by head element */
@@ -127,6 +170,7 @@ typedef struct iot_data_pointer_t
 #define IOT_DATA_BLOCK_SIZE (((IOT_DATA_MAX + 7) / 8) * 8)
 #define IOT_DATA_BLOCKS ((IOT_MEMORY_BLOCK_SIZE / IOT_DATA_BLOCK_SIZE) - 1)
 #define IOT_DATA_VALUE_BUFF_SIZE (IOT_DATA_BLOCK_SIZE - sizeof (iot_data_value_base_t))
+#define IOT_DATA_VECTOR_BLOCK_SIZE (IOT_DATA_BLOCK_SIZE / sizeof (iot_data_t*))
 
 typedef struct iot_data_value_t
 {
@@ -135,13 +179,74 @@ typedef struct iot_data_value_t
   char buff [IOT_DATA_VALUE_BUFF_SIZE];
 } iot_data_value_t;
 
+// String views hold a reference to the data owning the string in the (otherwise unused) value buffer
+
+static inline iot_data_t * iot_data_string_source (const iot_data_value_t * val)
+{
+  iot_data_t * source;
+  memcpy (&source, val->buff, sizeof (source));
+  return source;
+}
+
 // Total size of this struct should be <= IOT_MEMORY_BLOCK_SIZE, chunks must be 8 byte aligned.
+// Chunks are aligned to their size, so the chunk holding a block can be found when trimming the cache.
 typedef struct iot_memory_block_t
 {
   uint64_t chunks [(IOT_DATA_BLOCKS * IOT_DATA_BLOCK_SIZE) / (sizeof (uint64_t))];
   struct iot_memory_block_t * next;
+  struct iot_data_slab_t * slab; // Slab chunk carved from, NULL if allocated individually
+  uint32_t free; // Number of blocks in the global cache, counted when trimming
 } iot_memory_block_t;
 
+// Optional large aligned slab from which chunks are carved, reducing TLB pressure and fragmentation
+
+typedef struct iot_data_slab_t
+{
+  struct iot_data_slab_t * next;
+  uint8_t * base;        // Slab memory
+  uint32_t chunks;       // Number of chunks in slab
+  uint32_t carved;       // Number of chunks carved from slab
+  uint32_t free;         // Number of wholly free carved chunks, counted when trimming
+} iot_data_slab_t;
+
+// Arena chunk of bump allocated blocks. Data blocks and other blocks (map nodes, list elements
+// and strings) are held in separate chunk lists so that data blocks can be walked on release.
+
+typedef struct iot_data_arena_chunk_t
+{
+  struct iot_data_arena_chunk_t * next;
+  uint32_t used;
+  uint32_t size;
+  uint64_t blocks[];
+} iot_data_arena_chunk_t;
+
+// String intern pool, sharded by hash to reduce lock contention. Each shard is an open
+// addressing (linear probing) table of strings, each holding a reference to the string.
+
+typedef struct iot_data_intern_shard_t
+{
+  pthread_mutex_t mutex;
+  iot_data_t ** slots;  // String slots, NULL if free
+  uint32_t capacity;    // Number of slots, always a power of two
+  uint32_t count;       // Number of strings
+} iot_data_intern_shard_t;
+
+struct iot_data_intern_t
+{
+  iot_data_intern_shard_t shards[IOT_DATA_INTERN_SHARDS];
+  uint32_t limit;       // Maximum strings per shard
+};
+
+static iot_data_intern_t * iot_data_intern_pool = NULL;
+static pthread_once_t iot_data_intern_once = PTHREAD_ONCE_INIT;
+
+struct iot_data_arena_t
+{
+  iot_data_arena_chunk_t * data;  // Chunks holding iot_data_t blocks
+  iot_data_arena_chunk_t * other; // Chunks holding node, element and string blocks
+  uint32_t blocks;                // Number of blocks per chunk
+};
+
 typedef struct iot_data_struct_dummy_t
 {
   iot_data_static_t s1;
@@ -156,6 +261,7 @@ _Static_assert (sizeof (iot_data_map_t) <= IOT_DATA_BLOCK_SIZE, "iot_data_map bi
 _Static_assert (sizeof (iot_data_pointer_t) <= IOT_DATA_BLOCK_SIZE, "iot_data_pointer bigger than IOT_DATA_BLOCK_SIZE");
 _Static_assert (sizeof (iot_data_vector_t) <= IOT_DATA_BLOCK_SIZE, "iot_data_vector bigger than IOT_DATA_BLOCK_SIZE");
 _Static_assert (sizeof (iot_data_array_t) <= IOT_DATA_BLOCK_SIZE, "iot_data_array bigger than IOT_DATA_BLOCK_SIZE");
+_Static_assert (IOT_DATA_VECTOR_BLOCK_SIZE >= 4u, "IOT_DATA_VECTOR_BLOCK_SIZE less than 4 elements");
 _Static_assert (sizeof (iot_typecode_t) <= IOT_DATA_BLOCK_SIZE, "iot_typecode bigger than IOT_DATA_BLOCK_SIZE");
 _Static_assert (sizeof (iot_memory_block_t) <= IOT_MEMORY_BLOCK_SIZE, "iot_memory_block bigger than IOT_MEMORY_BLOCK_SIZE");
 _Static_assert (sizeof (iot_data_vector_t) <= IOT_MEMORY_BLOCK_SIZE, "iot_data_vector bigger than IOT_MEMORY_BLOCK_SIZE");
@@ -164,8 +270,13 @@ _Static_assert (sizeof (iot_data_array_t) <= IOT_MEMORY_BLOCK_SIZE, "iot_data_ar
 _Static_assert (sizeof (iot_data_list_t) <= IOT_MEMORY_BLOCK_SIZE, "iot_data_list bigger than IOT_MEMORY_BLOCK_SIZE");
 _Static_assert (sizeof (iot_node_t) <= IOT_MEMORY_BLOCK_SIZE, "iot_node bigger than IOT_MEMORY_BLOCK_SIZE");
 _Static_assert (sizeof (iot_element_t) <= IOT_MEMORY_BLOCK_SIZE, "iot_element bigger than IOT_MEMORY_BLOCK_SIZE");
+_Static_assert (sizeof (iot_element_t) <= IOT_DATA_BLOCK_SIZE, "iot_element bigger than IOT_DATA_BLOCK_SIZE");
+_Static_assert (IOT_DATA_LIST_CHUNK >= 3u, "IOT_DATA_LIST_CHUNK less than 3 values");
 _Static_assert (sizeof (iot_data_static_t) == sizeof (iot_data_value_base_t), "iot_data_static not equal to iot_data_value_base");
 _Static_assert (sizeof (iot_data_list_static_t) == sizeof (iot_data_list_t), "iot_data_list_static not equal to iot_data_list");
+_Static_assert (sizeof (iot_data_map_static_t) >= sizeof (iot_data_map_t), "iot_data_map_static smaller than iot_data_map");
+_Static_assert (sizeof (iot_data_vector_static_t) >= sizeof (iot_data_vector_t), "iot_data_vector_static smaller than iot_data_vector");
+_Static_assert (sizeof (iot_data_map_node_static_t) == sizeof (iot_node_t), "iot_data_map_node_static not equal to iot_node");
 _Static_assert (sizeof (iot_data_struct_dummy_t) == 2 * sizeof (iot_data_static_t), "iot_data_static_t structs not aligned for iot_data_static_t");
 _Static_assert (sizeof (int) == sizeof (int32_t) || sizeof (int) == sizeof (int64_t), "int not int32_t or int64_t");
 _Static_assert (sizeof (unsigned) == sizeof (uint32_t) || sizeof (unsigned) == sizeof (uint64_t), "unsigned not uint32_t or uint64_t");
@@ -173,9 +284,31 @@ _Static_assert (sizeof (unsigned) == sizeof (uint32_t) || sizeof (unsigned) == s
 // Data cache usually disabled for debug builds as otherwise too difficult to trace leaks
 
 #ifdef IOT_DATA_CACHE
+
+// Per thread magazine of cached blocks, refilled from and drained to the global cache in batches
+
+typedef struct iot_data_magazine_t
+{
+  iot_block_t * blocks;  // Singly linked list of cached blocks
+  uint32_t count;        // Number of blocks in magazine
+  uint64_t allocs;       // Blocks allocated since last statistics update
+  uint64_t hits;         // Blocks allocated from magazine since last statistics update
+  uint64_t frees;        // Blocks freed since last statistics update
+  int64_t live[IOT_DATA_TYPES]; // Change in data blocks per type since last statistics update
+  bool registered : 1;   // Whether registered for flush on thread exit
+} iot_data_magazine_t;
+
 static iot_block_t * iot_data_cache = NULL;
+static uint32_t iot_data_cache_count = 0u;
 static iot_memory_block_t * iot_data_blocks = NULL;
+static iot_data_slab_t * iot_data_slabs = NULL;       // Slabs, the first being carved
+static size_t iot_data_slab_size = 0u;               // Size of new slabs, zero if chunks allocated individually
 static pthread_mutex_t iot_data_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t iot_data_magazine_key;
+static _Thread_local iot_data_magazine_t iot_data_magazine = { .blocks = NULL };
+static iot_data_cache_stats_t iot_data_stats = { .allocs = 0u };
+static uint32_t iot_data_cache_limit = 0u; // Maximum cached blocks before trimming, zero if unlimited
+static uint32_t iot_data_cache_mark = 0u;  // Cached blocks at which next trimmed
 #endif
 
 /* Static values for boolean and null types */
@@ -184,13 +317,31 @@ static iot_data_value_base_t iot_data_bool_true = { .value.bl = true, .base.type
 static iot_data_value_base_t iot_data_bool_false = { .value.bl = false, .base.type = IOT_DATA_BOOL, .base.element_type = IOT_DATA_INVALID, .base.key_type = IOT_DATA_INVALID, .base.constant = true };
 static iot_data_value_base_t iot_data_null = { .base.type = IOT_DATA_NULL, .base.element_type = IOT_DATA_INVALID, .base.key_type = IOT_DATA_INVALID, .base.constant = true };
 
+/* Marker for deleted map hash index slots */
+
+static iot_node_t iot_map_index_deleted;
+
 extern void iot_data_map_dump (iot_data_t * map);
 static void iot_node_free (iot_data_map_t * map, iot_node_t * node);
 static iot_node_t * iot_node_next (iot_node_t * iter);
 static iot_node_t * iot_node_prev (iot_node_t * iter);
+
+// Key-value pair to be added to a map, with its index in the pairs added
+
+typedef struct iot_data_pair_t
+{
+  iot_data_t * key;
+  iot_data_t * value;
+  uint32_t index;
+} iot_data_pair_t;
+
 static bool iot_node_add (iot_data_map_t * map, iot_data_t * key, iot_data_t * value);
 static bool iot_node_remove (iot_data_map_t * map, const iot_data_t * key);
-static iot_node_t * iot_node_find (const iot_node_t * node, const iot_data_t * key);
+static iot_node_t * iot_node_find (const iot_data_map_t * map, const iot_data_t * key);
+static iot_node_t * iot_map_find (const iot_data_map_t * map, const iot_data_t * key);
+static void iot_map_build (iot_data_map_t * map, iot_data_t ** keys, iot_data_t ** values, uint32_t count);
+static void iot_map_merge (iot_data_map_t * map, const iot_data_map_t * add);
+static void iot_map_merge_pairs (iot_data_map_t * map, const iot_data_pair_t * pairs, uint32_t count);
 
 __attribute__((constructor)) static void iot_data_init (void);
 
@@ -236,39 +387,358 @@ bool iot_data_alloc_heap (bool set)
   return old;
 }
 
+iot_data_arena_t * iot_data_arena_alloc (uint32_t blocks)
+{
+  iot_data_arena_t * arena = calloc (1, sizeof (*arena));
+  arena->blocks = blocks ? blocks : IOT_DATA_BLOCKS;
+  return arena;
+}
+
+iot_data_arena_t * iot_data_arena_set_current (iot_data_arena_t * arena)
+{
+  iot_data_arena_t * old = iot_data_arena_current;
+  iot_data_arena_current = arena;
+  return old;
+}
+
+static void * iot_data_arena_block (iot_data_arena_t * arena, bool data)
+{
+  iot_data_arena_chunk_t ** list = data ? &arena->data : &arena->other;
+  iot_data_arena_chunk_t * chunk = *list;
+  if (chunk == NULL || chunk->used == chunk->size)
+  {
+    chunk = calloc (1, sizeof (*chunk) + (size_t) arena->blocks * IOT_DATA_BLOCK_SIZE);
+    chunk->size = arena->blocks;
+    chunk->next = *list;
+    *list = chunk;
+  }
+  return ((uint8_t*) chunk->blocks) + (size_t) (chunk->used++) * IOT_DATA_BLOCK_SIZE;
+}
+
+static void iot_data_arena_chunks_free (iot_data_arena_chunk_t * chunk)
+{
+  while (chunk)
+  {
+    iot_data_arena_chunk_t * next = chunk->next;
+    free (chunk);
+    chunk = next;
+  }
+}
+
+// Release heap storage owned by arena data. Contained data is either in the arena or constant so is not freed.
+
+static void iot_data_arena_release (iot_data_t * data)
+{
+  switch (data->type)
+  {
+    case IOT_DATA_STRING:
+    {
+      iot_data_value_t * val = (iot_data_value_t*) data;
+      if (data->release && (val->value.str != val->buff)) free (val->value.str);
+      if (data->view) iot_data_free (iot_data_string_source (val));
+      break;
+    }
+    case IOT_DATA_BINARY:
+    case IOT_DATA_ARRAY: if (data->release) free (((iot_data_array_t*) data)->data); break;
+    case IOT_DATA_MAP: free (((iot_data_map_t*) data)->index); break;
+    case IOT_DATA_VECTOR: free (((iot_data_vector_t*) data)->values); break;
+    case IOT_DATA_POINTER:
+    {
+      iot_data_pointer_t * pointer = (iot_data_pointer_t*) data;
+      if (pointer->free_fn) (pointer->free_fn) (pointer->value);
+      break;
+    }
+    default: break;
+  }
+}
+
+void iot_data_arena_free (iot_data_arena_t * arena)
+{
+  if (arena)
+  {
+    if (iot_data_arena_current == arena) iot_data_arena_current = NULL;
+    for (iot_data_arena_chunk_t * chunk = arena->data; chunk; chunk = chunk->next)
+    {
+      uint8_t * iter = (uint8_t*) chunk->blocks;
+      for (uint32_t i = 0; i < chunk->used; i++)
+      {
+        iot_data_arena_release ((iot_data_t*) iter);
+        iter += IOT_DATA_BLOCK_SIZE;
+      }
+    }
+    iot_data_arena_chunks_free (arena->data);
+    iot_data_arena_chunks_free (arena->other);
+    free (arena);
+  }
+}
+
 extern uint32_t iot_data_block_size (void)
 {
   return IOT_DATA_BLOCK_SIZE;
 }
 
-static void * iot_data_alloc_block (void)
-{
 #ifdef IOT_DATA_CACHE
+static inline void iot_data_magazine_stats_update (iot_data_magazine_t * mag)
+{
+  iot_data_stats.allocs += mag->allocs;
+  iot_data_stats.hits += mag->hits;
+  iot_data_stats.frees += mag->frees;
+  mag->allocs = 0u;
+  mag->hits = 0u;
+  mag->frees = 0u;
+  for (uint32_t i = 0; i < IOT_DATA_TYPES; i++)
+  {
+    iot_data_stats.live[i] += mag->live[i];
+    mag->live[i] = 0;
+  }
+}
+
+static inline iot_memory_block_t * iot_data_block_chunk (const iot_block_t * block)
+{
+  return (iot_memory_block_t*) ((uintptr_t) block & ~((uintptr_t) IOT_MEMORY_BLOCK_SIZE - 1u));
+}
+
+// Release chunks all of whose blocks are in the global cache, called with the cache mutex held. Chunks
+// carved from a slab are only released, with the slab, once all chunks carved from the slab are free.
+
+static inline bool iot_data_chunk_releasable (const iot_memory_block_t * chunk)
+{
+  return (chunk->free == IOT_DATA_BLOCKS) && ((chunk->slab == NULL) || (chunk->slab->free == chunk->slab->carved));
+}
+
+static uint32_t iot_data_cache_release (void)
+{
+  uint32_t released = 0u;
+  iot_block_t ** prev = &iot_data_cache;
+  iot_memory_block_t ** chunk = &iot_data_blocks;
+  iot_data_slab_t ** slab = &iot_data_slabs;
+  for (iot_memory_block_t * iter = iot_data_blocks; iter; iter = iter->next) iter->free = 0u;
+  for (iot_data_slab_t * iter = iot_data_slabs; iter; iter = iter->next) iter->free = 0u;
+  for (const iot_block_t * iter = iot_data_cache; iter; iter = iter->next) iot_data_block_chunk (iter)->free++;
+  for (iot_memory_block_t * iter = iot_data_blocks; iter; iter = iter->next)
+  {
+    if (iter->slab && iter->free == IOT_DATA_BLOCKS) iter->slab->free++;
+  }
+  while (*prev)
+  {
+    if (iot_data_chunk_releasable (iot_data_block_chunk (*prev))) *prev = (*prev)->next;
+    else prev = &(*prev)->next;
+  }
+  while (*chunk)
+  {
+    iot_memory_block_t * iter = *chunk;
+    if (iot_data_chunk_releasable (iter))
+    {
+      *chunk = iter->next;
+      if (iter->slab == NULL) free (iter);
+      released++;
+    }
+    else
+    {
+      chunk = &iter->next;
+    }
+  }
+  while (*slab)
+  {
+    iot_data_slab_t * iter = *slab;
+    if (iter->free == iter->carved)
+    {
+      *slab = iter->next;
+      free (iter->base);
+      free (iter);
+    }
+    else
+    {
+      slab = &iter->next;
+    }
+  }
+  iot_data_cache_count -= released * IOT_DATA_BLOCKS;
+  iot_data_stats.released += released;
+  iot_data_cache_mark = (iot_data_cache_count > iot_data_cache_limit / 2u) ? (iot_data_cache_count * 2u) : iot_data_cache_limit; // Limit rescans if fragmented
+  if (iot_data_cache_mark < iot_data_cache_limit) iot_data_cache_mark = iot_data_cache_limit;
+  return released;
+}
+
+static void iot_data_magazine_drain (iot_data_magazine_t * mag, uint32_t count)
+{
+  pthread_mutex_lock (&iot_data_mutex);
+  while (count-- && mag->blocks)
+  {
+    iot_block_t * block = mag->blocks;
+    mag->blocks = block->next;
+    mag->count--;
+    block->next = iot_data_cache;
+    iot_data_cache = block;
+    iot_data_cache_count++;
+  }
+  iot_data_stats.drains++;
+  iot_data_magazine_stats_update (mag);
+  if (iot_data_cache_limit && (iot_data_cache_count > iot_data_cache_mark)) iot_data_cache_release ();
+  pthread_mutex_unlock (&iot_data_mutex);
+}
+
+static inline void iot_data_magazine_register (iot_data_magazine_t * mag)
+{
+  if (! mag->registered) // Register magazine so flushed to global cache on thread exit
+  {
+    mag->registered = true;
+    pthread_setspecific (iot_data_magazine_key, mag);
+  }
+}
+
+static iot_memory_block_t * iot_data_chunk_alloc (void)
+{
+  iot_data_slab_t * slab = iot_data_slabs;
+  iot_memory_block_t * chunk;
+  if (iot_data_slab_size && (slab == NULL || slab->carved == slab->chunks))
+  {
+    size_t align = (iot_data_slab_size % IOT_DATA_HUGE_PAGE_SIZE) ? IOT_MEMORY_BLOCK_SIZE : IOT_DATA_HUGE_PAGE_SIZE;
+    slab = calloc (1, sizeof (*slab));
+    slab->base = aligned_alloc (align, iot_data_slab_size);
+    slab->chunks = (uint32_t) (iot_data_slab_size / IOT_MEMORY_BLOCK_SIZE);
+#ifdef MADV_HUGEPAGE
+    madvise (slab->base, iot_data_slab_size, MADV_HUGEPAGE);
+#endif
+    slab->next = iot_data_slabs;
+    iot_data_slabs = slab;
+    iot_data_stats.slabs++;
+  }
+  if (iot_data_slab_size)
+  {
+    chunk = (iot_memory_block_t*) (slab->base + (size_t) slab->carved++ * IOT_MEMORY_BLOCK_SIZE);
+    memset (chunk, 0, IOT_MEMORY_BLOCK_SIZE);
+    chunk->slab = slab;
+  }
+  else
+  {
+    chunk = aligned_alloc (IOT_MEMORY_BLOCK_SIZE, IOT_MEMORY_BLOCK_SIZE);
+    memset (chunk, 0, IOT_MEMORY_BLOCK_SIZE);
+  }
+  return chunk;
+}
+
+// Refill a thread magazine with a number of blocks (a multiple of the magazine size) from the global cache
+
+static void iot_data_magazine_refill (iot_data_magazine_t * mag, uint32_t count)
+{
+  iot_data_magazine_register (mag);
   pthread_mutex_lock (&iot_data_mutex);
-  if (iot_data_cache == NULL)
+  while (iot_data_cache_count < count)
   {
-    iot_memory_block_t * block = calloc (1, IOT_MEMORY_BLOCK_SIZE);
+    iot_memory_block_t * block = iot_data_chunk_alloc ();
     block->next = iot_data_blocks;
     iot_data_blocks = block;
     uint8_t * iter = (uint8_t*) block->chunks;
-    iot_data_cache = (iot_block_t*) iter;
-    for (unsigned i = 0; i < (IOT_DATA_BLOCKS - 1); i++)
+    for (unsigned i = 0; i < IOT_DATA_BLOCKS; i++)
     {
-      iot_block_t * prev = (iot_block_t*) iter;
+      iot_block_t * blk = (iot_block_t*) iter;
+      blk->next = iot_data_cache;
+      iot_data_cache = blk;
       iter += IOT_DATA_BLOCK_SIZE;
-      prev->next = (iot_block_t*) iter;
     }
+    iot_data_cache_count += IOT_DATA_BLOCKS;
+    iot_data_stats.chunks++;
+  }
+  for (uint32_t i = 0; i < count; i++)
+  {
+    iot_block_t * block = iot_data_cache;
+    iot_data_cache = block->next;
+    block->next = mag->blocks;
+    mag->blocks = block;
   }
-  iot_block_t * data = iot_data_cache;
-  iot_data_cache = data->next;
+  iot_data_cache_count -= count;
+  mag->count += count;
+  iot_data_stats.refills++;
+  iot_data_magazine_stats_update (mag);
   pthread_mutex_unlock (&iot_data_mutex);
+  IOT_TRACE (IOT_TRACE_DATA_BLOCK_ALLOC, count);
+}
+
+static void iot_data_magazine_flush (void * arg)
+{
+  iot_data_magazine_t * mag = arg;
+  iot_data_magazine_drain (mag, mag->count);
+  mag->registered = false;
+}
+#endif
+
+#ifdef IOT_DATA_ZEPHYR_POOL
+
+// Statically sized pool of data blocks, avoiding heap allocation latency and fragmentation. The heap is used if exhausted.
+
+K_MEM_SLAB_DEFINE (iot_data_zephyr_slab, IOT_DATA_BLOCK_SIZE, IOT_ZEPHYR_DATA_BLOCKS, 8);
+
+static void * iot_data_zephyr_block_alloc (void)
+{
+  void * block;
+  if (k_mem_slab_alloc (&iot_data_zephyr_slab, &block, K_NO_WAIT) != 0) return calloc (1, IOT_DATA_BLOCK_SIZE);
+  memset (block, 0, IOT_DATA_BLOCK_SIZE);
+  return block;
+}
+
+static void iot_data_zephyr_block_free (void * block)
+{
+  const uint8_t * start = (const uint8_t*) iot_data_zephyr_slab.buffer;
+  if ((const uint8_t*) block >= start && (const uint8_t*) block < start + (IOT_ZEPHYR_DATA_BLOCKS * IOT_DATA_BLOCK_SIZE))
+  {
+    k_mem_slab_free (&iot_data_zephyr_slab, &block);
+  }
+  else
+  {
+    free (block);
+  }
+}
+#endif
+
+static void * iot_data_alloc_block (void)
+{
+#ifdef IOT_DATA_CACHE
+  iot_data_magazine_t * mag = &iot_data_magazine;
+  mag->allocs++;
+  if (mag->blocks)
+  {
+    mag->hits++;
+  }
+  else
+  {
+    iot_data_magazine_refill (mag, IOT_DATA_MAGAZINE_SIZE);
+  }
+  iot_block_t * data = mag->blocks;
+  mag->blocks = data->next;
+  mag->count--;
   memset (data, 0, IOT_DATA_BLOCK_SIZE);
   return data;
+#elif defined (IOT_DATA_ZEPHYR_POOL)
+  return iot_data_zephyr_block_alloc ();
 #else
   return calloc (1, IOT_DATA_BLOCK_SIZE);
 #endif
 }
 
+// Reserve blocks in the calling thread magazine, so a known number of allocations are made without locking
+
+static void iot_data_block_reserve (uint32_t count)
+{
+#ifdef IOT_DATA_CACHE
+  iot_data_magazine_t * mag = &iot_data_magazine;
+  if (mag->count < count)
+  {
+    count -= mag->count;
+    iot_data_magazine_refill (mag, ((count + IOT_DATA_MAGAZINE_SIZE - 1u) / IOT_DATA_MAGAZINE_SIZE) * IOT_DATA_MAGAZINE_SIZE);
+  }
+#else
+  (void) count;
+#endif
+}
+
+// Allocate a block according to the thread allocation policy: arena, heap or data cache
+
+static inline void * iot_data_policy_block (iot_data_arena_t * arena, bool heap, bool data)
+{
+  if (arena) return iot_data_arena_block (arena, data);
+  return heap ? calloc (1, IOT_DATA_BLOCK_SIZE) : iot_data_alloc_block ();
+}
+
 extern void * iot_data_block_alloc (size_t size)
 {
   return (size <= IOT_DATA_BLOCK_SIZE) ? iot_data_alloc_block () : NULL;
@@ -277,16 +747,78 @@ extern void * iot_data_block_alloc (size_t size)
 extern void iot_data_block_free (void  * ptr)
 {
 #ifdef IOT_DATA_CACHE
-  pthread_mutex_lock (&iot_data_mutex);
+  iot_data_magazine_t * mag = &iot_data_magazine;
   iot_block_t * block = ptr;
-  block->next = iot_data_cache;
-  iot_data_cache = block;
-  pthread_mutex_unlock (&iot_data_mutex);
+  iot_data_magazine_register (mag);
+  block->next = mag->blocks;
+  mag->blocks = block;
+  mag->frees++;
+  if (++mag->count >= (2u * IOT_DATA_MAGAZINE_SIZE))
+  {
+    iot_data_magazine_drain (mag, IOT_DATA_MAGAZINE_SIZE);
+  }
+#elif defined (IOT_DATA_ZEPHYR_POOL)
+  iot_data_zephyr_block_free (ptr);
 #else
   free (ptr);
 #endif
 }
 
+bool iot_data_cache_stats (iot_data_cache_stats_t * stats)
+{
+  assert (stats);
+#ifdef IOT_DATA_CACHE
+  iot_data_magazine_t * mag = &iot_data_magazine;
+  pthread_mutex_lock (&iot_data_mutex);
+  iot_data_magazine_stats_update (mag);
+  *stats = iot_data_stats;
+  stats->cached = iot_data_cache_count;
+  pthread_mutex_unlock (&iot_data_mutex);
+  return true;
+#else
+  memset (stats, 0, sizeof (*stats));
+  return false;
+#endif
+}
+
+uint32_t iot_data_cache_trim (void)
+{
+  uint32_t released = 0u;
+#ifdef IOT_DATA_CACHE
+  iot_data_magazine_t * mag = &iot_data_magazine;
+  iot_data_magazine_drain (mag, mag->count); // Return calling thread blocks, so their chunks can be released
+  pthread_mutex_lock (&iot_data_mutex);
+  released = iot_data_cache_release ();
+  pthread_mutex_unlock (&iot_data_mutex);
+#endif
+  return released;
+}
+
+void iot_data_cache_set_slab_size (size_t size)
+{
+#ifdef IOT_DATA_CACHE
+  pthread_mutex_lock (&iot_data_mutex);
+  iot_data_slab_size = (size / IOT_MEMORY_BLOCK_SIZE) * IOT_MEMORY_BLOCK_SIZE;
+  if (iot_data_slab_size > ((size_t) UINT32_MAX * IOT_MEMORY_BLOCK_SIZE)) iot_data_slab_size = (size_t) UINT32_MAX * IOT_MEMORY_BLOCK_SIZE;
+  if (iot_data_slabs) iot_data_slabs->chunks = iot_data_slabs->carved; // Stop carving current slab
+  pthread_mutex_unlock (&iot_data_mutex);
+#else
+  (void) size;
+#endif
+}
+
+void iot_data_cache_set_limit (uint32_t chunks)
+{
+#ifdef IOT_DATA_CACHE
+  pthread_mutex_lock (&iot_data_mutex);
+  iot_data_cache_limit = chunks * IOT_DATA_BLOCKS;
+  iot_data_cache_mark = iot_data_cache_limit;
+  pthread_mutex_unlock (&iot_data_mutex);
+#else
+  (void) chunks;
+#endif
+}
+
 static inline void iot_data_map_hash (iot_data_t * map, const iot_data_t * key, const iot_data_t * value)
 {
   uint32_t key_hash = iot_data_hash (key);
@@ -302,7 +834,12 @@ uint32_t iot_data_hash (const iot_data_t * data)
   {
     da->hash = 0;
     da->rehash = false;
-    if (da->type == IOT_DATA_VECTOR)
+    if (da->type == IOT_DATA_ARRAY)
+    {
+      const iot_data_array_t * array = (const iot_data_array_t*) da;
+      if (array->data) da->hash = iot_hash_data (array->data, array->length * iot_data_type_sizes[da->element_type]);
+    }
+    else if (da->type == IOT_DATA_VECTOR)
     {
       iot_data_vector_iter_t iter;
       iot_data_vector_iter (da, &iter);
@@ -335,19 +872,40 @@ uint32_t iot_data_hash (const iot_data_t * data)
 
 static inline void iot_element_free (iot_element_t * element)
 {
-  (element->heap) ? free (element) : iot_data_block_free (element);
+  if (! element->arena) (element->heap) ? free (element) : iot_data_block_free (element);
 }
 
 static iot_element_t * iot_element_alloc (void)
 {
-  bool heap = iot_data_alloc_from_heap;
-  iot_element_t * element = heap ? calloc (1, IOT_DATA_BLOCK_SIZE) : iot_data_alloc_block ();
+  iot_data_arena_t * arena = iot_data_arena_current;
+  bool heap = iot_data_alloc_from_heap && ! arena;
+  iot_element_t * element = iot_data_policy_block (arena, heap, false);
   element->heap = heap;
+  element->arena = (arena != NULL);
   return element;
 }
 
+// Count data blocks allocated from the cache by type, adjusted when data changes type
+
+static inline void iot_data_block_count (const iot_data_t * data, iot_data_type_t type, int64_t count)
+{
+#ifdef IOT_DATA_CACHE
+  if (! data->heap && ! data->arena && ! data->constant) iot_data_magazine.live[type] += count;
+#else
+  (void) data; (void) type; (void) count;
+#endif
+}
+
+static inline void iot_data_block_retype (iot_data_t * data, iot_data_type_t type)
+{
+  iot_data_block_count (data, data->type, -1);
+  iot_data_block_count (data, type, 1);
+  data->type = type;
+}
+
 static inline void iot_data_block_free_data (iot_data_t * data)
 {
+  iot_data_block_count (data, data->type, -1);
   (data->heap) ? free (data) : iot_data_block_free (data);
 }
 
@@ -361,11 +919,14 @@ static void iot_data_block_init (iot_data_t * data, iot_data_type_t type)
 
 static void * iot_data_block_alloc_data (iot_data_type_t type)
 {
-  bool heap = iot_data_alloc_from_heap;
-  iot_data_t * data = heap ? calloc (1, IOT_DATA_BLOCK_SIZE) : iot_data_alloc_block ();
+  iot_data_arena_t * arena = iot_data_arena_current;
+  bool heap = iot_data_alloc_from_heap && ! arena;
+  iot_data_t * data = iot_data_policy_block (arena, heap, true);
   data->heap = heap;
+  data->arena = (arena != NULL);
   data->composed = IOT_DATA_IS_COMPOSED_TYPE (type);
   iot_data_block_init (data, type);
+  iot_data_block_count (data, type, 1);
   return data;
 }
 
@@ -378,12 +939,20 @@ static inline iot_data_value_t * iot_data_value_alloc (iot_data_type_t type, iot
 
 static void iot_data_fini (void)
 {
+  iot_data_intern_free (iot_data_intern_pool);
 #ifdef IOT_DATA_CACHE
   while (iot_data_blocks)
   {
     iot_memory_block_t * block = iot_data_blocks;
     iot_data_blocks = block->next;
-    free (block);
+    if (block->slab == NULL) free (block);
+  }
+  while (iot_data_slabs)
+  {
+    iot_data_slab_t * slab = iot_data_slabs;
+    iot_data_slabs = slab->next;
+    free (slab->base);
+    free (slab);
   }
 #endif
 }
@@ -406,11 +975,16 @@ static void iot_data_init (void)
   printf ("sizeof (iot_data_list_static_t): %zu\n", sizeof (iot_data_list_static_t));
   printf ("IOT_DATA_BLOCK_SIZE: %zu IOT_DATA_BLOCKS: %zu\n", IOT_DATA_BLOCK_SIZE, IOT_DATA_BLOCKS);
   printf ("IOT_DATA_VALUE_BUFF_SIZE: %zu\n", IOT_DATA_VALUE_BUFF_SIZE);
+  printf ("IOT_DATA_VECTOR_BLOCK_SIZE: %zu\n", IOT_DATA_VECTOR_BLOCK_SIZE);
+  printf ("IOT_DATA_LIST_CHUNK: %zu\n", IOT_DATA_LIST_CHUNK);
 #endif
 #ifdef IOT_DATA_CACHE
+  iot_mutex_init_type (&iot_data_mutex, IOT_MUTEX_ADAPTIVE); // Short critical sections refilling and draining magazines
+  pthread_key_create (&iot_data_magazine_key, iot_data_magazine_flush);
   iot_data_block_free (iot_data_alloc_block ());  // Initialize data cache
 #endif
   iot_data_alloc_const_pointer (&iot_data_order, &iot_data_order);
+  iot_data_alloc_const_pointer (&iot_data_shape, &iot_data_shape);
   const char ** str = iot_data_const_strings;
   iot_data_static_t * ptr = (iot_data_static_t*) &iot_data_consts;
   while (*str) iot_data_alloc_const_string (ptr++, *str++);
@@ -419,7 +993,7 @@ static void iot_data_init (void)
 
 iot_data_t * iot_data_add_ref (const iot_data_t * data)
 {
-  if (data) atomic_fetch_add (&((iot_data_t*) data)->refs, 1u);
+  if (data && ! data->frozen) atomic_fetch_add (&((iot_data_t*) data)->refs, 1u);
   return (iot_data_t*) data;
 }
 
@@ -428,40 +1002,206 @@ uint32_t iot_data_ref_count (const iot_data_t * data)
   return data ? atomic_load (&((iot_data_t*) data)->refs) : 0u;
 }
 
-iot_data_type_t iot_data_name_type (const char * name)
-{
-  iot_data_type_t type = 0;
-  while (type < IOT_DATA_INVALID)
-  {
-    if (strcasecmp (name, iot_data_type_names[type]) == 0) break;
-    type++;
-  }
-  return type;
-}
-
-const char * iot_data_type_string (iot_data_type_t type)
-{
-  return iot_data_type_names[(type > IOT_DATA_INVALID) ? IOT_DATA_INVALID : type];
-}
+// Set or clear the frozen flag of data and all contained data. Constant data is never frozen.
 
-const char * iot_data_type_name (const iot_data_t * data)
+static void iot_data_set_frozen (iot_data_t * data, bool frozen)
 {
-  assert (data);
-  return iot_data_type_string (data->type);
+  if (data == NULL || data->constant) return;
+  data->frozen = frozen;
+  iot_data_set_frozen (data->base.meta, frozen);
+  switch (data->type)
+  {
+    case IOT_DATA_VECTOR:
+    {
+      const iot_data_vector_t * vector = (const iot_data_vector_t*) data;
+      for (uint32_t i = 0; i < vector->size; i++) iot_data_set_frozen (vector->values[i], frozen);
+      break;
+    }
+    case IOT_DATA_LIST:
+    {
+      iot_data_list_iter_t iter;
+      iot_data_list_iter (data, &iter);
+      while (iot_data_list_iter_next (&iter)) iot_data_set_frozen (iter._element->values[iter._index], frozen);
+      break;
+    }
+    case IOT_DATA_MAP:
+    {
+      iot_data_map_iter_t iter;
+      iot_data_map_iter (data, &iter);
+      while (iot_data_map_iter_next (&iter))
+      {
+        iot_data_set_frozen (iter._node->key, frozen);
+        iot_data_set_frozen (iter._node->value, frozen);
+      }
+      break;
+    }
+    default: break;
+  }
+}
+
+iot_data_t * iot_data_freeze (iot_data_t * data)
+{
+  iot_data_set_frozen (data, true);
+  return data;
+}
+
+iot_data_t * iot_data_thaw (iot_data_t * data)
+{
+  iot_data_set_frozen (data, false);
+  return data;
+}
+
+bool iot_data_is_frozen (const iot_data_t * data)
+{
+  return (data && data->frozen);
+}
+
+/* Direct mapped cache of JSON and CBOR encodings of frozen data, keyed by address and validated by hash */
+
+typedef struct iot_data_encoding_t
+{
+  const iot_data_t * data;
+  uint32_t hash;
+  uint32_t length;
+  char * bytes;
+} iot_data_encoding_t;
+
+struct iot_data_encode_cache_t
+{
+  uint32_t mask;
+  iot_data_encoding_t * entries[IOT_DATA_ENCODE_KINDS];
+};
+
+iot_data_encode_cache_t * iot_data_encode_cache_alloc (uint32_t size)
+{
+  iot_data_encode_cache_t * cache = calloc (1, sizeof (*cache));
+  uint32_t slots = IOT_DATA_ENCODE_CACHE_MIN;
+  while (slots < size) slots <<= 1;
+  cache->mask = slots - 1u;
+  for (uint32_t kind = 0; kind < IOT_DATA_ENCODE_KINDS; kind++) cache->entries[kind] = calloc (slots, sizeof (iot_data_encoding_t));
+  return cache;
+}
+
+void iot_data_encode_cache_free (iot_data_encode_cache_t * cache)
+{
+  if (cache)
+  {
+    for (uint32_t kind = 0; kind < IOT_DATA_ENCODE_KINDS; kind++)
+    {
+      for (uint32_t i = 0; i <= cache->mask; i++) free (cache->entries[kind][i].bytes);
+      free (cache->entries[kind]);
+    }
+    free (cache);
+  }
+}
+
+static inline iot_data_encoding_t * iot_data_encode_cache_slot (const iot_data_encode_cache_t * cache, const iot_data_t * data, iot_data_encode_kind_t kind)
+{
+  uint64_t addr = (uintptr_t) data;
+  return &cache->entries[kind][((addr >> 4) * 0x9e3779b97f4a7c15u >> 32) & cache->mask];
+}
+
+bool iot_data_encode_cacheable (const iot_data_encode_cache_t * cache, const iot_data_t * data)
+{
+  return cache && data->frozen && (data->type == IOT_DATA_ARRAY || data->type == IOT_DATA_VECTOR || data->type == IOT_DATA_LIST || data->type == IOT_DATA_MAP);
+}
+
+const char * iot_data_encode_cache_get (const iot_data_encode_cache_t * cache, const iot_data_t * data, iot_data_encode_kind_t kind, uint32_t * length)
+{
+  const iot_data_encoding_t * entry = iot_data_encode_cache_slot (cache, data, kind);
+  bool hit = (entry->data == data) && (entry->hash == iot_data_hash (data));
+  *length = hit ? entry->length : 0u;
+  return hit ? entry->bytes : NULL;
+}
+
+void iot_data_encode_cache_put (iot_data_encode_cache_t * cache, const iot_data_t * data, iot_data_encode_kind_t kind, const void * bytes, size_t length)
+{
+  if (length <= UINT32_MAX)
+  {
+    iot_data_encoding_t * entry = iot_data_encode_cache_slot (cache, data, kind);
+    free (entry->bytes);
+    entry->bytes = malloc (length + 1u); // Terminated for use as a JSON string
+    memcpy (entry->bytes, bytes, length);
+    entry->bytes[length] = '\0';
+    entry->length = (uint32_t) length;
+    entry->data = data;
+    entry->hash = iot_data_hash (data);
+  }
+}
+
+iot_data_type_t iot_data_name_type (const char * name)
+{
+  iot_data_type_t type = 0;
+  while (type < IOT_DATA_INVALID)
+  {
+    if (strcasecmp (name, iot_data_type_names[type]) == 0) break;
+    type++;
+  }
+  return type;
+}
+
+const char * iot_data_type_string (iot_data_type_t type)
+{
+  return iot_data_type_names[(type > IOT_DATA_INVALID) ? IOT_DATA_INVALID : type];
+}
+
+const char * iot_data_type_name (const iot_data_t * data)
+{
+  assert (data);
+  return iot_data_type_string (data->type);
+}
+
+// Metadata is held as key value pairs in the slots of a vector, whose values fit in a single data block,
+// and is promoted to a map when more keys are set than there are slots.
+
+#define IOT_DATA_META_SLOTS (IOT_DATA_VECTOR_BLOCK_SIZE / 2u)
+
+static uint32_t iot_data_meta_find (const iot_data_t * meta, const iot_data_t * key)
+{
+  iot_data_t * const * slots = ((const iot_data_vector_t*) meta)->values;
+  uint32_t i = 0u;
+  while ((i < IOT_DATA_META_SLOTS) && slots[2u * i] && (slots[2u * i] != key) && ! iot_data_equal (slots[2u * i], key)) i++;
+  return i;
 }
 
 extern void iot_data_set_metadata (iot_data_t * data, iot_data_t * metadata, const iot_data_t * key)
 {
   if (data && metadata && key)
   {
-    if (data->base.meta == NULL) data->base.meta = iot_data_alloc_map (IOT_DATA_MULTI);
-    iot_data_map_add (data->base.meta, iot_data_add_ref (key), metadata);
+    iot_data_t * meta = data->base.meta;
+    if (meta == NULL) meta = data->base.meta = iot_data_alloc_vector (2u * IOT_DATA_META_SLOTS);
+    if (meta->type == IOT_DATA_VECTOR)
+    {
+      iot_data_t ** slots = ((iot_data_vector_t*) meta)->values;
+      uint32_t i = iot_data_meta_find (meta, key);
+      meta->rehash = true;
+      if (i < IOT_DATA_META_SLOTS)
+      {
+        if (slots[2u * i]) iot_data_free (slots[2u * i + 1u]); // Replace value of existing key
+        else slots[2u * i] = iot_data_add_ref (key);
+        slots[2u * i + 1u] = metadata;
+        return;
+      }
+      data->base.meta = iot_data_alloc_map (IOT_DATA_MULTI); // Slots full, so promote to map
+      for (i = 0; i < 2u * IOT_DATA_META_SLOTS; i += 2u)
+      {
+        iot_data_map_add (data->base.meta, slots[i], slots[i + 1u]);
+        slots[i] = slots[i + 1u] = NULL;
+      }
+      iot_data_free (meta);
+      meta = data->base.meta;
+    }
+    iot_data_map_add (meta, iot_data_add_ref (key), metadata);
   }
 }
 
 extern const iot_data_t * iot_data_get_metadata (const iot_data_t * data, const iot_data_t * key)
 {
-  return (data && data->base.meta && key) ? iot_data_map_get (data->base.meta, key): NULL;
+  const iot_data_t * meta = data ? data->base.meta : NULL;
+  if (meta == NULL || key == NULL) return NULL;
+  if (meta->type == IOT_DATA_MAP) return iot_data_map_get (meta, key);
+  uint32_t i = iot_data_meta_find (meta, key);
+  return (i < IOT_DATA_META_SLOTS) ? ((const iot_data_vector_t*) meta)->values[2u * i + 1u] : NULL;
 }
 
 static bool iot_data_cast_val (const iot_data_union_t in, void * out, iot_data_type_t in_type, iot_data_type_t out_type)
@@ -688,206 +1428,681 @@ bool iot_data_equal_value (const iot_data_t * data1, const iot_data_t * data2)
   return (iot_data_cmp (data1, data2, true) == 0);
 }
 
-bool iot_data_cast (const iot_data_t * data, iot_data_type_t type, void * val)
-{
-  assert (data && val);
-  return iot_data_cast_val (((const iot_data_value_t *) data)->value, val, data->type, type);
-}
+// Add copy of current path, extended by an optional key, to a diff list
 
-iot_data_t * iot_data_transform (const iot_data_t * data, iot_data_type_t type)
+static void iot_data_diff_add (iot_data_t * diffs, const iot_data_t * path, const iot_data_t * key)
 {
-  assert (data);
-  iot_data_union_t out = { 0 };
-  if (data->type == type) return iot_data_add_ref (data);
-  if (iot_data_cast_val (((const iot_data_value_t*) data)->value, &out, data->type, type))
-  {
-    switch (type)
-    {
-      case IOT_DATA_INT8: return iot_data_alloc_i8 (out.i8);
-      case IOT_DATA_UINT8: return iot_data_alloc_ui8 (out.ui8);
-      case IOT_DATA_INT16: return iot_data_alloc_i16 (out.i16);
-      case IOT_DATA_UINT16: return iot_data_alloc_ui16 (out.ui16);
-      case IOT_DATA_INT32: return iot_data_alloc_i32 (out.i32);
-      case IOT_DATA_UINT32: return iot_data_alloc_ui32 (out.ui32);
-      case IOT_DATA_INT64: return iot_data_alloc_i64 (out.i64);
-      case IOT_DATA_UINT64: return iot_data_alloc_ui64 (out.ui64);
-      case IOT_DATA_FLOAT32: return iot_data_alloc_f32 (out.f32);
-      case IOT_DATA_FLOAT64: return iot_data_alloc_f64 (out.f64);
-      case IOT_DATA_BOOL: return iot_data_alloc_bool (out.bl);
-      default: break;
-    }
-  }
-  return NULL;
+  uint32_t len = iot_data_list_length (path);
+  iot_data_t * vector = iot_data_alloc_vector (len + (key ? 1u : 0u));
+  iot_data_list_iter_t iter;
+  uint32_t i = 0u;
+  iot_data_list_iter (path, &iter);
+  while (iot_data_list_iter_next (&iter)) iot_data_vector_add (vector, i++, iot_data_add_ref (iot_data_list_iter_value (&iter)));
+  if (key) iot_data_vector_add (vector, i, iot_data_add_ref (key));
+  iot_data_list_tail_push (diffs, vector);
 }
 
-iot_data_t * iot_data_array_transform (const iot_data_t * array, iot_data_type_t type)
+static void iot_data_diff_walk (const iot_data_t * from, const iot_data_t * to, iot_data_t * path, iot_data_t * const diffs[3])
 {
-  assert (array && (array->type == IOT_DATA_ARRAY) && (type <= IOT_DATA_BOOL));
-  uint32_t len = iot_data_array_length (array);
-  void * data = NULL;
-  uint32_t asize = 0u;
-
-  if (len)
+  if (from == to || iot_data_equal (from, to)) return; // Cached hashes detect most changed subtrees without comparing elements
+  if (from->type == IOT_DATA_MAP && to->type == IOT_DATA_MAP)
   {
-    uint32_t esize = iot_data_type_sizes[type];
-    data = calloc (len, esize);
-    uint8_t * ptr = (uint8_t*) data;
-    iot_data_array_iter_t iter;
-    iot_data_array_iter (array, &iter);
-    while (iot_data_array_iter_next (&iter))
+    iot_data_map_iter_t iter;
+    iot_data_map_iter (from, &iter);
+    while (iot_data_map_iter_next (&iter))
     {
-      const iot_data_union_t * element = iot_data_array_iter_value (&iter);
-      if (iot_data_cast_val (*element, ptr, array->element_type, type))
+      const iot_data_t * key = iot_data_map_iter_key (&iter);
+      const iot_data_t * value = iot_data_map_get (to, key);
+      if (value)
       {
-        ptr += esize;
-        asize++;
+        iot_data_list_head_push (path, iot_data_add_ref (key));
+        iot_data_diff_walk (iot_data_map_iter_value (&iter), value, path, diffs);
+        iot_data_free (iot_data_list_head_pop (path));
+      }
+      else
+      {
+        iot_data_diff_add (diffs[1], path, key);
       }
     }
-    if (asize == 0)
+    iot_data_map_iter (to, &iter);
+    while (iot_data_map_iter_next (&iter))
     {
-      free (data);
-      data = NULL;
+      const iot_data_t * key = iot_data_map_iter_key (&iter);
+      if (iot_data_map_get (from, key) == NULL) iot_data_diff_add (diffs[0], path, key);
     }
   }
-  return iot_data_alloc_array (data, asize, type, IOT_DATA_TAKE);
+  else if (from->type == IOT_DATA_VECTOR && to->type == IOT_DATA_VECTOR)
+  {
+    uint32_t from_size = iot_data_vector_size (from);
+    uint32_t to_size = iot_data_vector_size (to);
+    uint32_t size = (from_size > to_size) ? from_size : to_size;
+    for (uint32_t i = 0; i < size; i++)
+    {
+      const iot_data_t * v1 = (i < from_size) ? iot_data_vector_get (from, i) : NULL;
+      const iot_data_t * v2 = (i < to_size) ? iot_data_vector_get (to, i) : NULL;
+      if (v1 == NULL && v2 == NULL) continue;
+      iot_data_t * index = iot_data_alloc_ui32 (i);
+      if (v1 && v2)
+      {
+        iot_data_list_head_push (path, index);
+        iot_data_diff_walk (v1, v2, path, diffs);
+        iot_data_free (iot_data_list_head_pop (path));
+      }
+      else
+      {
+        iot_data_diff_add (v1 ? diffs[1] : diffs[0], path, index);
+        iot_data_free (index);
+      }
+    }
+  }
+  else
+  {
+    iot_data_diff_add (diffs[2], path, NULL);
+  }
 }
 
-iot_data_t * iot_data_alloc_map (iot_data_type_t key_type)
+iot_data_t * iot_data_diff (const iot_data_t * from, const iot_data_t * to)
 {
-  assert (key_type != IOT_DATA_NULL);
-  iot_data_map_t * map = iot_data_block_alloc_data (IOT_DATA_MAP);
-  map->base.key_type = key_type;
-  return (iot_data_t*) map;
+  assert (from && to);
+  iot_data_t * path = iot_data_alloc_list ();
+  iot_data_t * diffs[3] = { iot_data_alloc_list (), iot_data_alloc_list (), iot_data_alloc_list () };
+  iot_data_t * result = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_data_diff_walk (from, to, path, diffs);
+  iot_data_string_map_add (result, "added", diffs[0]);
+  iot_data_string_map_add (result, "removed", diffs[1]);
+  iot_data_string_map_add (result, "changed", diffs[2]);
+  iot_data_free (path);
+  return result;
 }
 
-iot_data_t * iot_data_alloc_typed_map (iot_data_type_t key_type, iot_data_type_t element_type)
+bool iot_data_diff_empty (const iot_data_t * diff)
 {
-  iot_data_t * map = iot_data_alloc_map (key_type);
-  map->element_type = element_type;
-  return map;
+  assert (diff);
+  iot_data_map_iter_t iter;
+  iot_data_map_iter (diff, &iter);
+  while (iot_data_map_iter_next (&iter))
+  {
+    if (iot_data_list_length (iot_data_map_iter_value (&iter))) return false;
+  }
+  return true;
 }
 
-iot_data_type_t iot_data_map_type (const iot_data_t * map)
+// JSON-Patch (RFC 6902) delta. The current JSON Pointer is held in a growing buffer, with tokens escaped
+// ('~' as "~0" and '/' as "~1") as they are pushed and truncated as they are popped.
+
+typedef struct iot_data_delta_path_t
 {
-  assert (map);
-  return map->element_type;
-}
+  char * str;
+  size_t len;
+  size_t size;
+} iot_data_delta_path_t;
 
-iot_data_t * iot_data_alloc_vector (uint32_t size)
+static size_t iot_data_delta_push (iot_data_delta_path_t * path, const char * token)
 {
-  iot_data_vector_t * vector = iot_data_block_alloc_data (IOT_DATA_VECTOR);
-  if (size)
+  size_t prev = path->len;
+  size_t need = path->len + 2u * strlen (token) + 2u;
+  if (need > path->size)
   {
-    vector->size = size;
-    vector->values = calloc (size, sizeof (iot_data_t *));
+    path->size = (need > 2u * path->size) ? need : 2u * path->size;
+    path->str = realloc (path->str, path->size);
   }
-  return (iot_data_t*) vector;
+  path->str[path->len++] = '/';
+  for (const char * c = token; *c; c++)
+  {
+    if (*c == '~' || *c == '/')
+    {
+      path->str[path->len++] = '~';
+      path->str[path->len++] = (*c == '~') ? '0' : '1';
+    }
+    else
+    {
+      path->str[path->len++] = *c;
+    }
+  }
+  path->str[path->len] = '\0';
+  return prev;
 }
 
-iot_data_t * iot_data_alloc_typed_vector (uint32_t size, iot_data_type_t element_type)
+static void iot_data_delta_pop (iot_data_delta_path_t * path, size_t len)
 {
-  iot_data_t * vector = iot_data_alloc_vector (size);
-  vector->element_type = element_type;
-  return vector;
+  path->len = len;
+  path->str[len] = '\0';
 }
 
-iot_data_type_t iot_data_vector_type (const iot_data_t * vector)
+static void iot_data_delta_op (iot_data_t * delta, const char * op, const iot_data_delta_path_t * path, const iot_data_t * value)
 {
-  assert (vector);
-  return vector->element_type;
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_data_string_map_add (map, "op", iot_data_alloc_string (op, IOT_DATA_REF));
+  iot_data_string_map_add (map, "path", iot_data_alloc_string (path->str, IOT_DATA_COPY));
+  if (value) iot_data_string_map_add (map, "value", iot_data_add_ref (value));
+  iot_data_list_tail_push (delta, map);
 }
 
-iot_data_t * iot_data_alloc_pointer (void * ptr, iot_data_free_fn free_fn)
+static void iot_data_delta_walk (const iot_data_t * from, const iot_data_t * to, iot_data_delta_path_t * path, iot_data_t * delta)
 {
-  iot_data_pointer_t * pointer = iot_data_block_alloc_data (IOT_DATA_POINTER);
-  pointer->free_fn = free_fn;
-  pointer->value = ptr;
-  pointer->base.hash = (uint32_t) (intptr_t) ptr;
-  return (iot_data_t*) pointer;
+  if (from == to || iot_data_equal (from, to)) return; // Cached hashes detect most changed subtrees without comparing elements
+  if (from->type == IOT_DATA_MAP && to->type == IOT_DATA_MAP && iot_data_map_key_type (from) == IOT_DATA_STRING && iot_data_map_key_type (to) == IOT_DATA_STRING)
+  {
+    iot_data_map_iter_t iter;
+    iot_data_map_iter (from, &iter);
+    while (iot_data_map_iter_next (&iter))
+    {
+      const iot_data_t * value = iot_data_map_get (to, iot_data_map_iter_key (&iter));
+      size_t len = iot_data_delta_push (path, iot_data_map_iter_string_key (&iter));
+      if (value)
+      {
+        iot_data_delta_walk (iot_data_map_iter_value (&iter), value, path, delta);
+      }
+      else
+      {
+        iot_data_delta_op (delta, "remove", path, NULL);
+      }
+      iot_data_delta_pop (path, len);
+    }
+    iot_data_map_iter (to, &iter);
+    while (iot_data_map_iter_next (&iter))
+    {
+      if (iot_data_map_get (from, iot_data_map_iter_key (&iter)) == NULL)
+      {
+        size_t len = iot_data_delta_push (path, iot_data_map_iter_string_key (&iter));
+        iot_data_delta_op (delta, "add", path, iot_data_map_iter_value (&iter));
+        iot_data_delta_pop (path, len);
+      }
+    }
+  }
+  else if (from->type == IOT_DATA_VECTOR && to->type == IOT_DATA_VECTOR)
+  {
+    // Common elements are compared, then elements are appended or removed from the end, last first so indices remain valid
+    uint32_t from_size = iot_data_vector_size (from);
+    uint32_t to_size = iot_data_vector_size (to);
+    uint32_t size = (from_size < to_size) ? from_size : to_size;
+    char index[12];
+    for (uint32_t i = 0; i < size; i++)
+    {
+      const iot_data_t * v1 = iot_data_vector_get (from, i);
+      const iot_data_t * v2 = iot_data_vector_get (to, i);
+      if (v1 == v2) continue;
+      sprintf (index, "%" PRIu32, i);
+      size_t len = iot_data_delta_push (path, index);
+      if (v1 && v2)
+      {
+        iot_data_delta_walk (v1, v2, path, delta);
+      }
+      else
+      {
+        iot_data_delta_op (delta, "replace", path, v2);
+      }
+      iot_data_delta_pop (path, len);
+    }
+    for (uint32_t i = size; i < to_size; i++)
+    {
+      size_t len = iot_data_delta_push (path, "-");
+      iot_data_delta_op (delta, "add", path, iot_data_vector_get (to, i));
+      iot_data_delta_pop (path, len);
+    }
+    for (uint32_t i = from_size; i > size; i--)
+    {
+      sprintf (index, "%" PRIu32, i - 1u);
+      size_t len = iot_data_delta_push (path, index);
+      iot_data_delta_op (delta, "remove", path, NULL);
+      iot_data_delta_pop (path, len);
+    }
+  }
+  else
+  {
+    iot_data_delta_op (delta, "replace", path, to);
+  }
 }
 
-iot_data_t * iot_data_alloc_list (void)
+iot_data_t * iot_data_delta (const iot_data_t * from, const iot_data_t * to)
 {
-  return (iot_data_t*) iot_data_block_alloc_data (IOT_DATA_LIST);
+  assert (from && to);
+  iot_data_delta_path_t path = { .str = calloc (1u, 64u), .len = 0u, .size = 64u };
+  iot_data_t * delta = iot_data_alloc_list ();
+  iot_data_delta_walk (from, to, &path, delta);
+  free (path.str);
+  return delta;
 }
 
-iot_data_t * iot_data_alloc_const_list (iot_data_list_static_t * data)
-{
-  iot_data_list_t * val = (iot_data_list_t*) data;
-  memset (data, 0, sizeof (*data));
-  iot_data_block_init (&val->base, IOT_DATA_LIST);
-  val->base.composed = true;
-  val->base.constant = true;
-  return (iot_data_t*) val;
-}
+// Decode next JSON Pointer token into buffer, returning pointer to following token or NULL if last
 
-iot_data_t * iot_data_alloc_typed_list (iot_data_type_t element_type)
+static const char * iot_data_delta_token (const char * ptr, char * token)
 {
-  iot_data_t * list = iot_data_block_alloc_data (IOT_DATA_LIST);
-  list->element_type = element_type;
-  return list;
+  while (*ptr && *ptr != '/')
+  {
+    if (*ptr == '~' && (ptr[1] == '0' || ptr[1] == '1'))
+    {
+      *token++ = (ptr[1] == '0') ? '~' : '/';
+      ptr += 2;
+    }
+    else
+    {
+      *token++ = *ptr++;
+    }
+  }
+  *token = '\0';
+  return (*ptr == '/') ? ptr + 1 : NULL;
 }
 
-iot_data_type_t iot_data_list_type (const iot_data_t * list)
+static bool iot_data_delta_index (const char * token, uint32_t size, bool append, uint32_t * index)
 {
-  assert (list);
-  return list->element_type;
+  char * end;
+  if (append && strcmp (token, "-") == 0)
+  {
+    *index = size;
+    return true;
+  }
+  if (! isdigit ((unsigned char) *token)) return false;
+  unsigned long val = strtoul (token, &end, 10);
+  *index = (uint32_t) val;
+  return (*end == '\0' && val <= (append ? size : size - 1u) && (append || size));
 }
 
-uint32_t iot_data_list_length (const iot_data_t * list)
+static bool iot_data_delta_apply_op (iot_data_t * data, const char * op, const char * ptr, const iot_data_t * value)
 {
-  assert (list);
-  const iot_data_list_t * impl = (const iot_data_list_t*) list;
-  return impl->head ? impl->head->length : 0;
+  bool add = (strcmp (op, "add") == 0);
+  bool replace = (strcmp (op, "replace") == 0);
+  bool remove = (strcmp (op, "remove") == 0);
+  if (! (add || replace || remove) || (! remove && value == NULL) || *ptr++ != '/') return false;
+
+  char * token = malloc (strlen (ptr) + 1u);
+  bool ok = false;
+  uint32_t index;
+  while (true)
+  {
+    if (iot_data_is_frozen (data)) break;
+    ptr = iot_data_delta_token (ptr, token);
+    data->rehash = true; // Hashes of containers on the path are no longer valid
+    if (ptr) // Descend to child
+    {
+      iot_data_t * child = NULL;
+      if (data->type == IOT_DATA_MAP && iot_data_map_key_type (data) == IOT_DATA_STRING)
+      {
+        child = (iot_data_t*) iot_data_string_map_get (data, token);
+      }
+      else if (data->type == IOT_DATA_VECTOR && iot_data_delta_index (token, iot_data_vector_size (data), false, &index))
+      {
+        child = (iot_data_t*) iot_data_vector_get (data, index);
+      }
+      if (child == NULL) break;
+      data = child;
+      continue;
+    }
+    if (data->type == IOT_DATA_MAP && iot_data_map_key_type (data) == IOT_DATA_STRING)
+    {
+      iot_data_t * key = iot_data_alloc_string (token, IOT_DATA_COPY);
+      if (remove)
+      {
+        ok = iot_data_map_remove (data, key);
+      }
+      else if (add || iot_data_map_get (data, key))
+      {
+        iot_data_map_add (data, key, iot_data_add_ref (value));
+        key = NULL;
+        ok = true;
+      }
+      iot_data_free (key);
+    }
+    else if (data->type == IOT_DATA_VECTOR)
+    {
+      uint32_t size = iot_data_vector_size (data);
+      if (iot_data_delta_index (token, size, add, &index))
+      {
+        if (add) // Insert, moving following elements up
+        {
+          iot_data_vector_resize (data, size + 1u);
+          for (uint32_t i = size; i > index; i--) iot_data_vector_add (data, i, iot_data_add_ref (iot_data_vector_get (data, i - 1u)));
+        }
+        else if (remove) // Move following elements down
+        {
+          for (uint32_t i = index + 1u; i < size; i++) iot_data_vector_add (data, i - 1u, iot_data_add_ref (iot_data_vector_get (data, i)));
+          iot_data_vector_resize (data, size - 1u);
+        }
+        if (! remove) iot_data_vector_add (data, index, iot_data_add_ref (value));
+        ok = true;
+      }
+    }
+    break;
+  }
+  free (token);
+  return ok;
+}
+
+bool iot_data_apply_delta (iot_data_t * data, const iot_data_t * delta)
+{
+  assert (data && delta);
+  iot_data_iter_t iter;
+  iot_data_iter (delta, &iter);
+  while (iot_data_iter_next (&iter))
+  {
+    const iot_data_t * op = iot_data_iter_value (&iter);
+    if (iot_data_type (op) != IOT_DATA_MAP) return false;
+    const char * name = iot_data_string_map_get_string (op, "op");
+    const char * ptr = iot_data_string_map_get_string (op, "path");
+    if (name == NULL || ptr == NULL || ! iot_data_delta_apply_op (data, name, ptr, iot_data_string_map_get (op, "value"))) return false;
+  }
+  return true;
+}
+
+bool iot_data_cast (const iot_data_t * data, iot_data_type_t type, void * val)
+{
+  assert (data && val);
+  return iot_data_cast_val (((const iot_data_value_t *) data)->value, val, data->type, type);
+}
+
+static iot_data_t * iot_data_alloc_union (iot_data_union_t val, iot_data_type_t type)
+{
+  switch (type)
+  {
+    case IOT_DATA_INT8: return iot_data_alloc_i8 (val.i8);
+    case IOT_DATA_UINT8: return iot_data_alloc_ui8 (val.ui8);
+    case IOT_DATA_INT16: return iot_data_alloc_i16 (val.i16);
+    case IOT_DATA_UINT16: return iot_data_alloc_ui16 (val.ui16);
+    case IOT_DATA_INT32: return iot_data_alloc_i32 (val.i32);
+    case IOT_DATA_UINT32: return iot_data_alloc_ui32 (val.ui32);
+    case IOT_DATA_INT64: return iot_data_alloc_i64 (val.i64);
+    case IOT_DATA_UINT64: return iot_data_alloc_ui64 (val.ui64);
+    case IOT_DATA_FLOAT32: return iot_data_alloc_f32 (val.f32);
+    case IOT_DATA_FLOAT64: return iot_data_alloc_f64 (val.f64);
+    case IOT_DATA_BOOL: return iot_data_alloc_bool (val.bl);
+    default: return NULL;
+  }
+}
+
+iot_data_t * iot_data_transform (const iot_data_t * data, iot_data_type_t type)
+{
+  assert (data);
+  iot_data_union_t out = { 0 };
+  if (data->type == type) return iot_data_add_ref (data);
+  return iot_data_cast_val (((const iot_data_value_t*) data)->value, &out, data->type, type) ? iot_data_alloc_union (out, type) : NULL;
+}
+
+iot_data_t * iot_data_array_transform (const iot_data_t * array, iot_data_type_t type)
+{
+  assert (array && (array->type == IOT_DATA_ARRAY) && (type <= IOT_DATA_BOOL));
+  uint32_t len = iot_data_array_length (array);
+  void * data = NULL;
+  uint32_t asize = 0u;
+
+  if (len)
+  {
+    uint32_t esize = iot_data_type_sizes[type];
+    data = calloc (len, esize);
+    uint8_t * ptr = (uint8_t*) data;
+    iot_data_array_iter_t iter;
+    iot_data_array_iter (array, &iter);
+    while (iot_data_array_iter_next (&iter))
+    {
+      const iot_data_union_t * element = iot_data_array_iter_value (&iter);
+      if (iot_data_cast_val (*element, ptr, array->element_type, type))
+      {
+        ptr += esize;
+        asize++;
+      }
+    }
+    if (asize == 0)
+    {
+      free (data);
+      data = NULL;
+    }
+  }
+  return iot_data_alloc_array (data, asize, type, IOT_DATA_TAKE);
+}
+
+iot_data_t * iot_data_array_element_alloc (const iot_data_t * array, uint32_t index)
+{
+  assert (array && (array->type == IOT_DATA_ARRAY) && (index < iot_data_array_length (array)));
+  uint32_t esize = iot_data_type_sizes[array->element_type];
+  iot_data_union_t val = { 0 };
+  memcpy (&val, (const uint8_t*) ((const iot_data_array_t*) array)->data + (size_t) index * esize, esize);
+  return iot_data_alloc_union (val, array->element_type);
+}
+
+iot_data_t * iot_data_alloc_map (iot_data_type_t key_type)
+{
+  assert (key_type != IOT_DATA_NULL);
+  iot_data_map_t * map = iot_data_block_alloc_data (IOT_DATA_MAP);
+  map->base.key_type = key_type;
+  return (iot_data_t*) map;
+}
+
+iot_data_t * iot_data_alloc_map_with_capacity (iot_data_type_t key_type, uint32_t capacity)
+{
+  if (capacity && ! iot_data_alloc_from_heap && ! iot_data_arena_current) iot_data_block_reserve (capacity + 1u);
+  return iot_data_alloc_map (key_type);
+}
+
+iot_data_t * iot_data_alloc_typed_map (iot_data_type_t key_type, iot_data_type_t element_type)
+{
+  iot_data_t * map = iot_data_alloc_map (key_type);
+  map->element_type = element_type;
+  return map;
+}
+
+iot_data_t * iot_data_alloc_hash_map (iot_data_type_t key_type)
+{
+  return iot_data_alloc_typed_hash_map (key_type, IOT_DATA_MULTI);
+}
+
+iot_data_t * iot_data_alloc_typed_hash_map (iot_data_type_t key_type, iot_data_type_t element_type)
+{
+  iot_data_map_t * map = (iot_data_map_t*) iot_data_alloc_typed_map (key_type, element_type);
+  map->index = calloc (1, sizeof (*map->index) + IOT_MAP_INDEX_MIN * sizeof (iot_node_t*));
+  map->index->capacity = IOT_MAP_INDEX_MIN;
+  return (iot_data_t*) map;
+}
+
+bool iot_data_map_is_hashed (const iot_data_t * map)
+{
+  assert (map && (map->type == IOT_DATA_MAP));
+  return ((const iot_data_map_t*) map)->index != NULL;
+}
+
+static inline iot_data_t * iot_data_alloc_map_like (const iot_data_t * map)
+{
+  return iot_data_map_is_hashed (map) ? iot_data_alloc_typed_hash_map (map->key_type, map->element_type) : iot_data_alloc_typed_map (map->key_type, map->element_type);
+}
+
+iot_data_type_t iot_data_map_type (const iot_data_t * map)
+{
+  assert (map);
+  return map->element_type;
+}
+
+// Small vector values are held in a data block (unless allocated from an arena or the heap)
+
+static void iot_data_vector_values_alloc (iot_data_vector_t * vector, uint32_t size)
+{
+  vector->base.release_block = (size <= IOT_DATA_VECTOR_BLOCK_SIZE) && ! vector->base.arena && ! vector->base.heap;
+  vector->values = vector->base.release_block ? iot_data_alloc_block () : calloc (size, sizeof (iot_data_t *));
+  vector->capacity = vector->base.release_block ? IOT_DATA_VECTOR_BLOCK_SIZE : size;
+}
+
+// Grow vector values to the given capacity, moving values from a block to the heap if required
+
+static void iot_data_vector_grow (iot_data_vector_t * vector, uint32_t capacity)
+{
+  if (vector->values == NULL)
+  {
+    iot_data_vector_values_alloc (vector, capacity);
+  }
+  else if (vector->base.release_block)
+  {
+    iot_data_t ** values = vector->values;
+    vector->values = calloc (capacity, sizeof (iot_data_t*));
+    memcpy (vector->values, values, vector->capacity * sizeof (iot_data_t*));
+    iot_data_block_free (values);
+    vector->base.release_block = false;
+    vector->capacity = capacity;
+  }
+  else
+  {
+    vector->values = realloc (vector->values, capacity * sizeof (iot_data_t*));
+    memset (&vector->values[vector->capacity], 0, (capacity - vector->capacity) * sizeof (iot_data_t*));
+    vector->capacity = capacity;
+  }
+}
+
+static inline void iot_data_vector_values_free (iot_data_vector_t * vector)
+{
+  vector->base.release_block ? iot_data_block_free (vector->values) : free (vector->values);
+}
+
+iot_data_t * iot_data_alloc_vector (uint32_t size)
+{
+  iot_data_vector_t * vector = iot_data_block_alloc_data (IOT_DATA_VECTOR);
+  if (size)
+  {
+    vector->size = size;
+    iot_data_vector_values_alloc (vector, size);
+  }
+  return (iot_data_t*) vector;
+}
+
+iot_data_t * iot_data_alloc_const_vector (iot_data_vector_static_t * data, iot_data_t ** values, uint32_t size)
+{
+  assert (data && (values || size == 0u));
+  iot_data_vector_t * vector = (iot_data_vector_t*) data;
+  memset (data, 0, sizeof (*data));
+  iot_data_block_init (&vector->base, IOT_DATA_VECTOR);
+  vector->base.composed = true;
+  vector->base.constant = true;
+  vector->size = vector->capacity = size;
+  vector->values = values;
+  return (iot_data_t*) vector;
+}
+
+iot_data_t * iot_data_alloc_typed_vector (uint32_t size, iot_data_type_t element_type)
+{
+  iot_data_t * vector = iot_data_alloc_vector (size);
+  vector->element_type = element_type;
+  return vector;
 }
 
-static iot_element_t * iot_data_list_find_element (const iot_data_list_t * list, iot_data_cmp_fn cmp, const void * arg)
+iot_data_type_t iot_data_vector_type (const iot_data_t * vector)
+{
+  assert (vector);
+  return vector->element_type;
+}
+
+iot_data_t * iot_data_alloc_pointer (void * ptr, iot_data_free_fn free_fn)
+{
+  iot_data_pointer_t * pointer = iot_data_block_alloc_data (IOT_DATA_POINTER);
+  pointer->free_fn = free_fn;
+  pointer->value = ptr;
+  pointer->base.hash = (uint32_t) (intptr_t) ptr;
+  return (iot_data_t*) pointer;
+}
+
+iot_data_t * iot_data_alloc_list (void)
+{
+  return (iot_data_t*) iot_data_block_alloc_data (IOT_DATA_LIST);
+}
+
+iot_data_t * iot_data_alloc_const_list (iot_data_list_static_t * data)
+{
+  iot_data_list_t * val = (iot_data_list_t*) data;
+  memset (data, 0, sizeof (*data));
+  iot_data_block_init (&val->base, IOT_DATA_LIST);
+  val->base.composed = true;
+  val->base.constant = true;
+  return (iot_data_t*) val;
+}
+
+iot_data_t * iot_data_alloc_typed_list (iot_data_type_t element_type)
+{
+  iot_data_t * list = iot_data_block_alloc_data (IOT_DATA_LIST);
+  list->element_type = element_type;
+  return list;
+}
+
+iot_data_type_t iot_data_list_type (const iot_data_t * list)
+{
+  assert (list);
+  return list->element_type;
+}
+
+uint32_t iot_data_list_length (const iot_data_t * list)
+{
+  assert (list);
+  const iot_data_list_t * impl = (const iot_data_list_t*) list;
+  return impl->head ? impl->head->length : 0;
+}
+
+static bool iot_data_list_find_value (const iot_data_t * list, iot_data_cmp_fn cmp, const void * arg, iot_data_list_iter_t * iter)
 {
   assert (list && cmp);
-  iot_element_t * iter = list->tail;
-  while (iter)
+  iot_data_list_iter (list, iter);
+  while (iot_data_list_iter_next (iter))
   {
-    if (cmp (iter->value, arg)) break;
-    iter = iter->next;
+    if (cmp (iter->_element->values[iter->_index], arg)) return true;
   }
-  return iter;
+  return false;
 }
 
 const iot_data_t * iot_data_list_find (const iot_data_t * list, iot_data_cmp_fn cmp, const void * arg)
 {
-  const iot_element_t * element = iot_data_list_find_element ((const iot_data_list_t*) list, cmp, arg);
-  return element ? element->value : NULL;
+  iot_data_list_iter_t iter;
+  return iot_data_list_find_value (list, cmp, arg, &iter) ? iter._element->values[iter._index] : NULL;
 }
 
-static void iot_data_list_remove_element (iot_data_list_t * list, iot_element_t * element)
+// Link a new element at the tail or head of a list
+
+static iot_element_t * iot_data_list_add_element (iot_data_list_t * list, bool tail)
 {
-  iot_data_t * value = element->value;
-  if (element == list->head) // Remove from head of list
+  iot_element_t * element = iot_element_alloc ();
+  element->start = tail ? (uint8_t) (IOT_DATA_LIST_CHUNK - 1u) : 0u;
+  if (list->head == NULL)
   {
-    iot_data_list_head_pop ((iot_data_t*) list);
+    list->head = element;
+    list->tail = element;
   }
-  else if (element == list->tail) // Remove from tail of list
+  else if (tail)
   {
-    iot_data_list_tail_pop ((iot_data_t*) list);
+    element->next = list->tail;
+    list->tail->prev = element;
+    list->tail = element;
   }
-  else // Remove from middle of list
+  else
+  {
+    element->length = list->head->length;
+    element->prev = list->head;
+    list->head->next = element;
+    list->head = element;
+  }
+  return element;
+}
+
+// Remove a value from an element, freeing the element if then empty. Values above the removed value are moved down.
+
+static void iot_data_list_remove_value (iot_data_list_t * list, iot_element_t * element, uint32_t index)
+{
+  uint32_t end = (uint32_t) element->start + element->count;
+  list->head->length--;
+  list->base.rehash = true;
+  if (index == element->start)
   {
-    element->next->prev = element->prev;
-    element->prev->next = element->next;
-    list->head->length--;
-    list->base.rehash = true;
+    element->start++;
+  }
+  else
+  {
+    memmove (&element->values[index], &element->values[index + 1u], (end - index - 1u) * sizeof (iot_data_t*));
+  }
+  if (--element->count == 0u)
+  {
+    if (element->next) element->next->prev = element->prev; else list->head = element->prev;
+    if (element->prev) element->prev->next = element->next; else list->tail = element->next;
+    if (list->head && element->next == NULL) list->head->length = element->length;
     iot_element_free (element);
   }
-  iot_data_free (value);
 }
 
 extern bool iot_data_list_remove (iot_data_t * list, iot_data_cmp_fn cmp, const void * arg)
 {
-  assert (list && cmp);
-  iot_data_list_t * impl = (iot_data_list_t*) list;
-  iot_element_t * element = iot_data_list_find_element (impl, cmp, arg);
-  if (element) iot_data_list_remove_element (impl, element);
-  return (element != NULL);
+  iot_data_list_iter_t iter;
+  bool found = iot_data_list_find_value (list, cmp, arg, &iter);
+  if (found) iot_data_list_iter_remove (&iter);
+  return found;
 }
 
 void iot_data_list_iter (const iot_data_t * list, iot_data_list_iter_t * iter)
@@ -895,245 +2110,645 @@ void iot_data_list_iter (const iot_data_t * list, iot_data_list_iter_t * iter)
   assert (iter && list && list->type == IOT_DATA_LIST);
   iter->_list = (const iot_data_list_t*) list;
   iter->_element = NULL;
+  iter->_index = 0u;
 }
 
 bool iot_data_list_iter_next (iot_data_list_iter_t * iter)
 {
   assert (iter);
-  iter->_element = (iter->_element) ? iter->_element->next : iter->_list->tail;
+  iot_element_t * element = iter->_element;
+  if (element && (iter->_index + 1u < (uint32_t) element->start + element->count))
+  {
+    iter->_index++;
+  }
+  else
+  {
+    iter->_element = element ? element->next : iter->_list->tail;
+    iter->_index = iter->_element ? iter->_element->start : 0u;
+  }
   return (iter->_element != NULL);
 }
 
 bool iot_data_list_iter_has_next (const iot_data_list_iter_t * iter)
 {
   assert (iter);
-  return ((iter->_element == NULL) ||  iter->_element->next);
+  const iot_element_t * element = iter->_element;
+  return ((element == NULL) || (iter->_index + 1u < (uint32_t) element->start + element->count) || element->next);
 }
 
 bool iot_data_list_iter_prev (iot_data_list_iter_t * iter)
 {
   assert (iter);
-  iter->_element = (iter->_element) ? iter->_element->prev : iter->_list->head;
+  iot_element_t * element = iter->_element;
+  if (element && (iter->_index > element->start))
+  {
+    iter->_index--;
+  }
+  else
+  {
+    iter->_element = element ? element->prev : iter->_list->head;
+    iter->_index = iter->_element ? (uint32_t) iter->_element->start + iter->_element->count - 1u : 0u;
+  }
   return (iter->_element != NULL);
 }
 
 const iot_data_t * iot_data_list_iter_value (const iot_data_list_iter_t * iter)
 {
-  assert (iter);
-  return (iter->_element) ? iter->_element->value : NULL;
+  assert (iter);
+  return (iter->_element) ? iter->_element->values[iter->_index] : NULL;
+}
+
+const char * iot_data_list_iter_string_value (const iot_data_list_iter_t * iter)
+{
+  assert (iter);
+  return (iter->_element) ? iot_data_string (iter->_element->values[iter->_index]) : NULL;
+}
+
+const void * iot_data_list_iter_pointer_value (const iot_data_list_iter_t * iter)
+{
+  assert (iter);
+  return (iter->_element) ? iot_data_pointer (iter->_element->values[iter->_index]) : NULL;
+}
+
+iot_data_t * iot_data_list_iter_replace (const iot_data_list_iter_t * iter, iot_data_t * value)
+{
+  assert (iter && iter->_list && value && (iter->_list->base.element_type == IOT_DATA_MULTI || iter->_list->base.element_type == value->type));
+  iot_data_t * res = (iter->_element) ? iter->_element->values[iter->_index] : NULL;
+  if (res)
+  {
+    iot_data_t * base = (iot_data_t*) &iter->_list->base;
+    base->rehash = true;
+    iter->_element->values[iter->_index] = value;
+  }
+  return res;
+}
+
+bool iot_data_list_iter_remove (iot_data_list_iter_t * iter)
+{
+  assert (iter && iter->_list);
+  iot_data_list_t * impl = (iot_data_list_t*) iter->_list;
+  iot_element_t * element = iter->_element;
+  if (element)
+  {
+    uint32_t index = iter->_index;
+    iot_data_t * value = element->values[index];
+    iot_data_list_iter_prev (iter); // Previous value not moved by removal
+    iot_data_list_remove_value (impl, element, index);
+    iot_data_free (value);
+  }
+  return element != NULL;
+}
+
+void iot_data_list_tail_push (iot_data_t * list, iot_data_t * value)
+{
+  assert (list && value && (list->element_type == IOT_DATA_MULTI || list->element_type == value->type)); // Check element type matches for fixed type list
+  iot_data_list_t * impl = (iot_data_list_t*) list;
+  iot_element_t * element = impl->tail;
+  if (element && element->start > 0u)
+  {
+    element->start--;
+  }
+  else
+  {
+    element = iot_data_list_add_element (impl, true);
+  }
+  element->values[element->start] = value;
+  element->count++;
+  impl->head->length++;
+  list->hash ^= iot_data_hash (value);
+}
+
+iot_data_t * iot_data_list_tail_pop (iot_data_t * list)
+{
+  iot_data_t * value = NULL;
+  assert (list);
+  iot_data_list_t * impl = (iot_data_list_t*) list;
+  iot_element_t * element = impl->tail;
+  if (element)
+  {
+    value = element->values[element->start];
+    iot_data_list_remove_value (impl, element, element->start);
+  }
+  return value;
+}
+
+void iot_data_list_head_push (iot_data_t * list, iot_data_t * value)
+{
+  assert (list && value && (list->element_type == IOT_DATA_MULTI || list->element_type == value->type)); // Check element type matches for fixed type list
+  iot_data_list_t * impl = (iot_data_list_t*) list;
+  iot_element_t * element = impl->head;
+  if (element == NULL || (uint32_t) element->start + element->count == IOT_DATA_LIST_CHUNK)
+  {
+    element = iot_data_list_add_element (impl, false);
+  }
+  element->values[element->start + element->count++] = value;
+  element->length++;
+  list->hash ^= iot_data_hash (value);
+}
+
+iot_data_t * iot_data_list_head_pop (iot_data_t * list)
+{
+  assert (list);
+  iot_data_t * value = NULL;
+  iot_data_list_t * impl = (iot_data_list_t*) list;
+  iot_element_t * element = impl->head;
+  if (element)
+  {
+    uint32_t index = (uint32_t) element->start + element->count - 1u;
+    value = element->values[index];
+    iot_data_list_remove_value (impl, element, index);
+  }
+  return value;
+}
+
+iot_data_type_t iot_data_type (const iot_data_t * data)
+{
+  return data ? data->type : IOT_DATA_INVALID;
+}
+
+bool iot_data_is_of_type (const iot_data_t * data, iot_data_type_t type)
+{
+  return (data && (data->type == type));
+}
+
+bool iot_data_is_static (const iot_data_t * data)
+{
+  return (data && data->constant);
+}
+
+bool iot_data_is_nan (const iot_data_t * data)
+{
+  iot_data_type_t type = iot_data_type (data);
+  if (type != IOT_DATA_FLOAT32 && type != IOT_DATA_FLOAT64) return false;
+  return type == IOT_DATA_FLOAT32 ? iot_data_f32 (data) != iot_data_f32 (data) : iot_data_f64 (data) != iot_data_f64 (data);
+}
+
+static void iot_data_cache_add (iot_data_t * cache, iot_data_t ** data)
+{
+  iot_data_t * cached = (iot_data_t*) iot_data_map_get (cache, *data);
+  if (cached)
+  {
+    iot_data_free (*data);
+    iot_data_add_ref (cached);
+    *data = cached;
+  }
+  else
+  {
+    iot_data_map_add (cache, iot_data_add_ref (*data), iot_data_add_ref (*data));
+    if ((*data)->composed)
+    {
+      iot_data_compress_with_cache (*data, cache);
+    }
+  }
+}
+
+void iot_data_compress_with_cache (iot_data_t * data, iot_data_t * cache)
+{
+  assert (data && cache && (cache->key_type == IOT_DATA_MULTI) && (cache->element_type == IOT_DATA_MULTI));
+  if (data->composed)
+  {
+    if (data->type == IOT_DATA_VECTOR)
+    {
+      iot_data_vector_iter_t iter;
+      iot_data_vector_iter (data, &iter);
+      while (iot_data_vector_iter_next (&iter))
+      {
+        iot_data_cache_add (cache, &(iter._vector->values[iter._index]));
+      }
+    }
+    else if (data->type == IOT_DATA_LIST)
+    {
+      iot_data_list_iter_t iter;
+      iot_data_list_iter (data, &iter);
+      while (iot_data_list_iter_next (&iter))
+      {
+        iot_data_cache_add (cache, &(iter._element->values[iter._index]));
+      }
+    }
+    else // Map
+    {
+      iot_data_map_iter_t iter;
+      iot_data_map_iter (data, &iter);
+      while (iot_data_map_iter_next (&iter))
+      {
+        iot_data_cache_add (cache, &(iter._node->value));
+        iot_data_cache_add (cache, &(iter._node->key));
+      }
+    }
+  }
+}
+
+iot_data_intern_t * iot_data_intern_alloc (uint32_t limit)
+{
+  iot_data_intern_t * pool = calloc (1, sizeof (*pool));
+  limit = limit ? limit : IOT_DATA_INTERN_LIMIT;
+  pool->limit = (limit + IOT_DATA_INTERN_SHARDS - 1u) / IOT_DATA_INTERN_SHARDS;
+  for (uint32_t i = 0; i < IOT_DATA_INTERN_SHARDS; i++)
+  {
+    iot_mutex_init_type (&pool->shards[i].mutex, IOT_MUTEX_ADAPTIVE);
+  }
+  return pool;
+}
+
+void iot_data_intern_free (iot_data_intern_t * pool)
+{
+  if (pool)
+  {
+    for (uint32_t i = 0; i < IOT_DATA_INTERN_SHARDS; i++)
+    {
+      iot_data_intern_shard_t * shard = &pool->shards[i];
+      for (uint32_t j = 0; j < shard->capacity; j++) iot_data_free (shard->slots[j]);
+      free (shard->slots);
+      pthread_mutex_destroy (&shard->mutex);
+    }
+    free (pool);
+  }
+}
+
+static void iot_data_intern_global_init (void)
+{
+  iot_data_intern_pool = iot_data_intern_alloc (0u);
+}
+
+iot_data_intern_t * iot_data_intern_global (void)
+{
+  pthread_once (&iot_data_intern_once, iot_data_intern_global_init);
+  return iot_data_intern_pool;
+}
+
+static inline iot_data_intern_shard_t * iot_data_intern_shard (iot_data_intern_t * pool, uint32_t hash)
+{
+  return &pool->shards[(hash >> 16) % IOT_DATA_INTERN_SHARDS]; // High hash bits select shard, low bits slot
+}
+
+static iot_data_t ** iot_data_intern_slot (const iot_data_intern_shard_t * shard, const char * str, uint32_t hash)
+{
+  uint32_t mask = shard->capacity - 1u;
+  uint32_t i = hash & mask;
+  while (shard->slots[i])
+  {
+    const iot_data_t * entry = shard->slots[i];
+    if (entry->hash == hash && strcmp (((const iot_data_value_t*) entry)->value.str, str) == 0) break;
+    i = (i + 1u) & mask;
+  }
+  return &shard->slots[i];
+}
+
+// Rebuild shard table, evicting strings only referenced by the pool if purging
+
+static uint32_t iot_data_intern_rebuild (iot_data_intern_shard_t * shard, uint32_t capacity, bool purge)
+{
+  iot_data_t ** old = shard->slots;
+  uint32_t old_capacity = shard->capacity;
+  uint32_t evicted = 0u;
+  shard->slots = calloc (capacity, sizeof (iot_data_t*));
+  shard->capacity = capacity;
+  shard->count = 0u;
+  for (uint32_t i = 0; i < old_capacity; i++)
+  {
+    iot_data_t * entry = old[i];
+    if (entry == NULL) continue;
+    if (purge && ! entry->frozen && atomic_load (&entry->refs) <= 1u)
+    {
+      iot_data_free (entry);
+      evicted++;
+    }
+    else
+    {
+      *iot_data_intern_slot (shard, ((const iot_data_value_t*) entry)->value.str, entry->hash) = entry;
+      shard->count++;
+    }
+  }
+  free (old);
+  return evicted;
+}
+
+// Pooled strings must outlive arenas and buffers they reference, so are copied unless owned and on the cache or heap
+
+static iot_data_t * iot_data_intern_entry (const char * val, iot_data_t * str)
+{
+  if (str && str->release && ! str->arena) return iot_data_add_ref (str);
+  iot_data_arena_t * arena = iot_data_arena_set_current (NULL);
+  iot_data_t * entry = iot_data_alloc_string (val, IOT_DATA_COPY);
+  iot_data_arena_set_current (arena);
+  return entry;
+}
+
+// Find or add a pooled string, returning a new reference to the pooled string (or a new
+// string if the pool is full). The string data (if not NULL) is consumed.
+
+static iot_data_t * iot_data_intern_find (iot_data_intern_t * pool, const char * val, uint32_t hash, iot_data_t * str)
+{
+  iot_data_t * entry;
+  iot_data_intern_shard_t * shard = iot_data_intern_shard (pool, hash);
+  pthread_mutex_lock (&shard->mutex);
+  if (shard->capacity == 0u) iot_data_intern_rebuild (shard, IOT_DATA_INTERN_MIN, false);
+  iot_data_t ** slot = iot_data_intern_slot (shard, val, hash);
+  if (*slot == NULL)
+  {
+    if (shard->count >= pool->limit) // Evict unreferenced strings, if none then do not pool
+    {
+      if (iot_data_intern_rebuild (shard, shard->capacity, true) == 0u)
+      {
+        pthread_mutex_unlock (&shard->mutex);
+        return str ? str : iot_data_alloc_string (val, IOT_DATA_COPY);
+      }
+    }
+    else if ((shard->count + 1u) * 4u > shard->capacity * 3u) // Keep load factor below 3/4
+    {
+      iot_data_intern_rebuild (shard, shard->capacity * 2u, true);
+    }
+    slot = iot_data_intern_slot (shard, val, hash);
+    *slot = iot_data_intern_entry (val, str);
+    shard->count++;
+  }
+  entry = iot_data_add_ref (*slot);
+  pthread_mutex_unlock (&shard->mutex);
+  iot_data_free (str);
+  return entry;
 }
 
-const char * iot_data_list_iter_string_value (const iot_data_list_iter_t * iter)
+iot_data_t * iot_data_intern (iot_data_intern_t * pool, iot_data_t * str)
 {
-  assert (iter);
-  return (iter->_element) ? iot_data_string (iter->_element->value) : NULL;
+  assert (pool && str && str->type == IOT_DATA_STRING);
+  if (str->constant) return str;
+  return iot_data_intern_find (pool, ((const iot_data_value_t*) str)->value.str, str->hash, str);
 }
 
-const void * iot_data_list_iter_pointer_value (const iot_data_list_iter_t * iter)
+iot_data_t * iot_data_intern_string (iot_data_intern_t * pool, const char * str)
 {
-  assert (iter);
-  return (iter->_element) ? iot_data_pointer (iter->_element->value) : NULL;
+  assert (pool && str);
+  return iot_data_intern_find (pool, str, iot_hash (str), NULL);
 }
 
-iot_data_t * iot_data_list_iter_replace (const iot_data_list_iter_t * iter, iot_data_t * value)
+uint32_t iot_data_intern_purge (iot_data_intern_t * pool)
 {
-  assert (iter && iter->_list && value && (iter->_list->base.element_type == IOT_DATA_MULTI || iter->_list->base.element_type == value->type));
-  iot_data_t * res = (iter->_element) ? iter->_element->value : NULL;
-  if (res)
+  uint32_t evicted = 0u;
+  assert (pool);
+  for (uint32_t i = 0; i < IOT_DATA_INTERN_SHARDS; i++)
   {
-    iot_data_t * base = (iot_data_t*) &iter->_list->base;
-    base->rehash = true;
-    iter->_element->value = value;
+    iot_data_intern_shard_t * shard = &pool->shards[i];
+    pthread_mutex_lock (&shard->mutex);
+    if (shard->capacity) evicted += iot_data_intern_rebuild (shard, shard->capacity, true);
+    pthread_mutex_unlock (&shard->mutex);
   }
-  return res;
+  return evicted;
 }
 
-bool iot_data_list_iter_remove (iot_data_list_iter_t * iter)
+uint32_t iot_data_intern_size (iot_data_intern_t * pool)
 {
-  assert (iter && iter->_list);
-  iot_data_list_t * impl = (iot_data_list_t*) iter->_list;
-  iot_element_t * element = iter->_element;
-  if (element)
+  uint32_t size = 0u;
+  assert (pool);
+  for (uint32_t i = 0; i < IOT_DATA_INTERN_SHARDS; i++)
   {
-    iot_data_list_iter_prev (iter);
-    iot_data_list_remove_element (impl, element);
+    pthread_mutex_lock (&pool->shards[i].mutex);
+    size += pool->shards[i].count;
+    pthread_mutex_unlock (&pool->shards[i].mutex);
   }
-  return element != NULL;
+  return size;
 }
 
-void iot_data_list_tail_push (iot_data_t * list, iot_data_t * value)
+static void iot_data_intern_add (iot_data_intern_t * pool, iot_data_t ** data)
 {
-  assert (list && value && (list->element_type == IOT_DATA_MULTI || list->element_type == value->type)); // Check element type matches for fixed type list
-  iot_data_list_t * impl = (iot_data_list_t*) list;
-  iot_element_t * element = impl->tail;
-  impl->tail = iot_element_alloc ();
-  impl->tail->value = value;
-  impl->tail->next = element;
-  if (element)
+  if ((*data)->type == IOT_DATA_STRING)
   {
-    element->prev = impl->tail;
+    *data = iot_data_intern (pool, *data);
   }
-  else
+  else if ((*data)->composed)
   {
-    impl->head = impl->tail;
+    iot_data_compress_with_pool (*data, pool);
   }
-  impl->head->length++;
-  list->hash ^= iot_data_hash (value);
 }
 
-iot_data_t * iot_data_list_tail_pop (iot_data_t * list)
+void iot_data_compress_with_pool (iot_data_t * data, iot_data_intern_t * pool)
 {
-  iot_data_t * value = NULL;
-  assert (list);
-  iot_data_list_t * impl = (iot_data_list_t*) list;
-  iot_element_t * element = impl->tail;
-  if (element)
+  assert (data && pool);
+  if (data->type == IOT_DATA_VECTOR)
   {
-    value = element->value;
-    impl->tail = element->next;
-    if (impl->tail)
+    iot_data_vector_iter_t iter;
+    iot_data_vector_iter (data, &iter);
+    while (iot_data_vector_iter_next (&iter))
     {
-      impl->tail->prev = NULL;
-      impl->head->length--;
+      iot_data_intern_add (pool, &(iter._vector->values[iter._index]));
     }
-    else
+  }
+  else if (data->type == IOT_DATA_LIST)
+  {
+    iot_data_list_iter_t iter;
+    iot_data_list_iter (data, &iter);
+    while (iot_data_list_iter_next (&iter))
     {
-      impl->head = NULL;
+      iot_data_intern_add (pool, &(iter._element->values[iter._index]));
+    }
+  }
+  else if (data->type == IOT_DATA_MAP)
+  {
+    iot_data_map_iter_t iter;
+    iot_data_map_iter (data, &iter);
+    while (iot_data_map_iter_next (&iter))
+    {
+      iot_data_intern_add (pool, &(iter._node->value));
+      iot_data_intern_add (pool, &(iter._node->key));
     }
-    list->rehash = true;
-    iot_element_free (element);
   }
-  return value;
 }
 
-void iot_data_list_head_push (iot_data_t * list, iot_data_t * value)
+void iot_data_compress (iot_data_t * data)
 {
-  assert (list && value && (list->element_type == IOT_DATA_MULTI || list->element_type == value->type)); // Check element type matches for fixed type list
-  iot_data_list_t * impl = (iot_data_list_t*) list;
-  iot_element_t * element = impl->head;
-  impl->head = iot_element_alloc ();
-  impl->head->value = value;
-  impl->head->prev = element;
-  if (element)
-  {
-    impl->head->length = element->length + 1;
-    element->next = impl->head;
-  }
-  else
-  {
-    impl->tail = impl->head;
-    impl->head->length = 1;
-  }
-  list->hash ^= iot_data_hash (value);
+  iot_data_t * cache = iot_data_alloc_typed_map (IOT_DATA_MULTI, IOT_DATA_MULTI);
+  iot_data_compress_with_cache (data, cache);
+  iot_data_free (cache);
 }
 
-iot_data_t * iot_data_list_head_pop (iot_data_t * list)
+// Concurrent set of data used to share equal values when compressing in parallel. Sharded as for the
+// string intern pool, each shard being an open addressing table of data holding a reference to each entry.
+
+struct iot_data_dedup_t
 {
-  assert (list);
-  iot_data_t * value = NULL;
-  iot_data_list_t * impl = (iot_data_list_t*) list;
-  iot_element_t * element = impl->head;
-  if (element)
-  {
-    value = element->value;
-    impl->head = element->prev;
-    if (impl->head)
-    {
-      impl->head->next = NULL;
-      impl->head->length = element->length - 1;
-    }
-    else
-    {
-      impl->tail = NULL;
-    }
-    list->rehash = true;
-    iot_element_free (element);
-  }
-  return value;
+  iot_data_intern_shard_t shards[IOT_DATA_DEDUP_SHARDS];
+};
+
+iot_data_dedup_t * iot_data_dedup_alloc (void)
+{
+  iot_data_dedup_t * set = calloc (1, sizeof (*set));
+  for (uint32_t i = 0; i < IOT_DATA_DEDUP_SHARDS; i++) iot_mutex_init_type (&set->shards[i].mutex, IOT_MUTEX_ADAPTIVE);
+  return set;
 }
 
-iot_data_type_t iot_data_type (const iot_data_t * data)
+void iot_data_dedup_free (iot_data_dedup_t * set)
 {
-  return data ? data->type : IOT_DATA_INVALID;
+  for (uint32_t i = 0; i < IOT_DATA_DEDUP_SHARDS; i++)
+  {
+    iot_data_intern_shard_t * shard = &set->shards[i];
+    for (uint32_t j = 0; j < shard->capacity; j++) iot_data_free (shard->slots[j]);
+    free (shard->slots);
+    pthread_mutex_destroy (&shard->mutex);
+  }
+  free (set);
 }
 
-bool iot_data_is_of_type (const iot_data_t * data, iot_data_type_t type)
+static iot_data_t ** iot_data_dedup_slot (const iot_data_intern_shard_t * shard, const iot_data_t * data, uint32_t hash)
 {
-  return (data && (data->type == type));
+  uint32_t mask = shard->capacity - 1u;
+  uint32_t i = hash & mask;
+  while (shard->slots[i] && ! ((shard->slots[i]->hash == hash) && iot_data_equal (shard->slots[i], data))) i = (i + 1u) & mask;
+  return &shard->slots[i];
 }
 
-bool iot_data_is_static (const iot_data_t * data)
+// Return a new reference to an entry equal to data, else NULL having added data to the set if insert set
+
+static iot_data_t * iot_data_dedup_find (iot_data_dedup_t * set, iot_data_t * data, bool insert)
 {
-  return (data && data->constant);
+  uint32_t hash = iot_data_hash (data);
+  iot_data_intern_shard_t * shard = &set->shards[(hash >> 16) % IOT_DATA_DEDUP_SHARDS];
+  iot_data_t * entry = NULL;
+  pthread_mutex_lock (&shard->mutex);
+  if (shard->capacity == 0u) iot_data_intern_rebuild (shard, IOT_DATA_INTERN_MIN, false);
+  iot_data_t ** slot = iot_data_dedup_slot (shard, data, hash);
+  if (*slot)
+  {
+    entry = iot_data_add_ref (*slot);
+  }
+  else if (insert)
+  {
+    if ((shard->count + 1u) * 4u > shard->capacity * 3u) // Keep load factor below 3/4
+    {
+      iot_data_t ** old = shard->slots;
+      uint32_t capacity = shard->capacity;
+      shard->slots = calloc (capacity * 2u, sizeof (iot_data_t*));
+      shard->capacity = capacity * 2u;
+      for (uint32_t i = 0; i < capacity; i++) if (old[i]) *iot_data_dedup_slot (shard, old[i], old[i]->hash) = old[i];
+      free (old);
+      slot = iot_data_dedup_slot (shard, data, hash);
+    }
+    *slot = iot_data_add_ref (data);
+    shard->count++;
+  }
+  pthread_mutex_unlock (&shard->mutex);
+  return entry;
 }
 
-bool iot_data_is_nan (const iot_data_t * data)
+// Replace data with an equal shared entry, else compress it and add it to the set. Only data held solely by
+// the slot is compressed, so no other job can be modifying it, and it is added once complete, so entries
+// compared by other jobs are never modified. Returns the approximate memory freed.
+
+static size_t iot_data_dedup_add (iot_data_dedup_t * set, iot_data_t ** slot)
 {
-  iot_data_type_t type = iot_data_type (data);
-  if (type != IOT_DATA_FLOAT32 && type != IOT_DATA_FLOAT64) return false;
-  return type == IOT_DATA_FLOAT32 ? iot_data_f32 (data) != iot_data_f32 (data) : iot_data_f64 (data) != iot_data_f64 (data);
+  iot_data_t * data = *slot;
+  size_t saved = 0u;
+  if (data == NULL || data->constant) return 0u;
+  bool owned = ! data->frozen && (atomic_load (&data->refs) == 1u);
+  iot_data_t * shared = iot_data_dedup_find (set, data, false);
+  if (shared == NULL)
+  {
+    if (owned && data->composed) saved = iot_data_dedup_range (set, data, NULL, 0u, UINT32_MAX);
+    shared = iot_data_dedup_find (set, data, true);
+  }
+  if (shared)
+  {
+    if (owned) saved += iot_data_memory_size (data);
+    iot_data_free (data);
+    *slot = shared;
+  }
+  return saved;
 }
 
-static void iot_data_cache_add (iot_data_t * cache, iot_data_t ** data)
+size_t iot_data_dedup_range (iot_data_dedup_t * set, iot_data_t * data, iot_data_map_iter_t * iter, uint32_t start, uint32_t end)
 {
-  iot_data_t * cached = (iot_data_t*) iot_data_map_get (cache, *data);
-  if (cached)
+  size_t saved = 0u;
+  if (data->type == IOT_DATA_VECTOR)
   {
-    iot_data_free (*data);
-    iot_data_add_ref (cached);
-    *data = cached;
+    iot_data_vector_t * vector = (iot_data_vector_t*) data;
+    if (end > vector->size) end = vector->size;
+    for (uint32_t i = start; i < end; i++) saved += iot_data_dedup_add (set, &vector->values[i]);
   }
-  else
+  else if (data->type == IOT_DATA_LIST)
   {
-    iot_data_map_add (cache, iot_data_add_ref (*data), iot_data_add_ref (*data));
-    if ((*data)->composed)
+    iot_data_list_iter_t it;
+    iot_data_list_iter (data, &it);
+    while (iot_data_list_iter_next (&it)) saved += iot_data_dedup_add (set, &(it._element->values[it._index]));
+  }
+  else if (data->type == IOT_DATA_MAP)
+  {
+    iot_data_map_iter_t it;
+    if (iter == NULL)
     {
-      iot_data_compress_with_cache (*data, cache);
+      iot_data_map_iter (data, &it);
+      iter = &it;
+    }
+    for (uint32_t i = start; i < end && iot_data_map_iter_next (iter); i++)
+    {
+      saved += iot_data_dedup_add (set, &(iter->_node->value));
+      saved += iot_data_dedup_add (set, &(iter->_node->key));
     }
   }
+  return saved;
 }
 
-void iot_data_compress_with_cache (iot_data_t * data, iot_data_t * cache)
+// Approximate memory used by a heap allocation, including allocator overhead
+
+static inline size_t iot_data_heap_size (size_t size)
 {
-  assert (data && cache && (cache->key_type == IOT_DATA_MULTI) && (cache->element_type == IOT_DATA_MULTI));
-  if (data->composed)
+  return size ? ((size + sizeof (size_t) + 15u) & ~((size_t) 15u)) : 0u;
+}
+
+static inline size_t iot_data_block_memory (bool heap)
+{
+  return heap ? iot_data_heap_size (IOT_DATA_BLOCK_SIZE) : IOT_DATA_BLOCK_SIZE;
+}
+
+size_t iot_data_memory_size (const iot_data_t * data)
+{
+  size_t size = 0u;
+  if (data == NULL || data->constant) return 0u;
+  size = iot_data_block_memory (data->heap) + iot_data_memory_size (data->base.meta);
+  switch (data->type)
   {
-    if (data->type == IOT_DATA_VECTOR)
+    case IOT_DATA_STRING:
     {
-      iot_data_vector_iter_t iter;
-      iot_data_vector_iter (data, &iter);
-      while (iot_data_vector_iter_next (&iter))
+      const iot_data_value_t * val = (const iot_data_value_t*) data;
+      if (data->release && (val->value.str != val->buff))
       {
-        iot_data_cache_add (cache, &(iter._vector->values[iter._index]));
+        size += data->release_block ? IOT_DATA_BLOCK_SIZE : iot_data_heap_size (strlen (val->value.str) + 1u);
       }
+      break;
     }
-    else if (data->type == IOT_DATA_LIST)
+    case IOT_DATA_BINARY:
+    case IOT_DATA_ARRAY: if (data->release) size += iot_data_heap_size (iot_data_array_size (data)); break;
+    case IOT_DATA_VECTOR:
     {
-      iot_data_list_iter_t iter;
-      iot_data_list_iter (data, &iter);
-      while (iot_data_list_iter_next (&iter))
+      const iot_data_vector_t * vector = (const iot_data_vector_t*) data;
+      if (vector->values) size += data->release_block ? IOT_DATA_BLOCK_SIZE : iot_data_heap_size (vector->capacity * sizeof (iot_data_t*));
+      for (uint32_t i = 0; i < vector->size; i++) size += iot_data_memory_size (vector->values[i]);
+      break;
+    }
+    case IOT_DATA_LIST:
+    {
+      for (const iot_element_t * element = ((const iot_data_list_t*) data)->tail; element; element = element->next)
       {
-        iot_data_cache_add (cache, &(iter._element->value));
+        size += iot_data_block_memory (element->heap);
+        for (uint32_t i = element->start; i < (uint32_t) element->start + element->count; i++)
+        {
+          size += iot_data_memory_size (element->values[i]);
+        }
       }
+      break;
     }
-    else // Map
+    case IOT_DATA_MAP:
     {
+      const iot_map_index_t * index = ((const iot_data_map_t*) data)->index;
       iot_data_map_iter_t iter;
       iot_data_map_iter (data, &iter);
       while (iot_data_map_iter_next (&iter))
       {
-        iot_data_cache_add (cache, &(iter._node->value));
-        iot_data_cache_add (cache, &(iter._node->key));
+        size += iot_data_block_memory (iter._node->heap) + iot_data_memory_size (iter._node->key) + iot_data_memory_size (iter._node->value);
       }
+      if (index) size += iot_data_heap_size (sizeof (*index) + index->capacity * sizeof (iot_node_t*));
+      break;
     }
+    default: break;
   }
-}
-
-void iot_data_compress (iot_data_t * data)
-{
-  iot_data_t * cache = iot_data_alloc_typed_map (IOT_DATA_MULTI, IOT_DATA_MULTI);
-  iot_data_compress_with_cache (data, cache);
-  iot_data_free (cache);
+  return size / atomic_load (&((iot_data_t*) data)->refs); // Shared data apportioned between references
 }
 
 const void * iot_data_address (const iot_data_t * data)
@@ -1149,7 +2764,7 @@ const void * iot_data_address (const iot_data_t * data)
 
 void iot_data_free (iot_data_t * data)
 {
-  if (data && !data->constant && ((uint32_t) atomic_fetch_sub (&data->refs, 1u) <= 1u))
+  if (data && !data->constant && !data->arena && !data->frozen && ((uint32_t) atomic_fetch_sub (&data->refs, 1u) <= 1u))
   {
     if (data->base.meta) iot_data_free (data->base.meta);
     switch (data->type)
@@ -1161,6 +2776,7 @@ void iot_data_free (iot_data_t * data)
         {
           data->release_block ? iot_data_block_free (val->value.str) : free (val->value.str);
         }
+        if (data->view) iot_data_free (iot_data_string_source (val));
         break;
       }
       case IOT_DATA_BINARY:
@@ -1172,6 +2788,7 @@ void iot_data_free (iot_data_t * data)
       case IOT_DATA_MAP:
       {
         iot_node_free ((iot_data_map_t*) data, ((iot_data_map_t*) data)->tree);
+        free (((iot_data_map_t*) data)->index);
         break;
       }
       case IOT_DATA_VECTOR:
@@ -1181,8 +2798,9 @@ void iot_data_free (iot_data_t * data)
         {
           iot_data_free (vector->values[i]);
         }
-        free (vector->values);
+        if (vector->values) iot_data_vector_values_free (vector);
         vector->size = 0;
+        vector->capacity = 0;
         break;
       }
       case IOT_DATA_POINTER:
@@ -1198,7 +2816,10 @@ void iot_data_free (iot_data_t * data)
         {
           iot_element_t * element = iter;
           iter = iter->next;
-          iot_data_free (element->value);
+          for (uint32_t i = element->start; i < (uint32_t) element->start + element->count; i++)
+          {
+            iot_data_free (element->values[i]);
+          }
           iot_element_free (element);
         }
         break;
@@ -1455,6 +3076,22 @@ iot_data_t * iot_data_alloc_uuid (void)
   return iot_data_alloc_array (uuid, sizeof (iot_uuid_t), IOT_DATA_UINT8, IOT_DATA_COPY);
 }
 
+iot_data_t * iot_data_alloc_uuid_v7_string (void)
+{
+  char *uuid_str = malloc (UUID_STR_LEN);
+  iot_uuid_t uuid;
+  iot_uuid_generate_v7 (uuid);
+  iot_uuid_unparse (uuid, uuid_str);
+  return iot_data_alloc_string (uuid_str, IOT_DATA_TAKE);
+}
+
+iot_data_t * iot_data_alloc_uuid_v7 (void)
+{
+  iot_uuid_t uuid;
+  iot_uuid_generate_v7 (uuid);
+  return iot_data_alloc_array (uuid, sizeof (iot_uuid_t), IOT_DATA_UINT8, IOT_DATA_COPY);
+}
+
 iot_data_t * iot_data_alloc_const_string (iot_data_static_t * data, const char * str)
 {
   iot_data_value_base_t * val = (iot_data_value_base_t*) data;
@@ -1491,6 +3128,12 @@ iot_data_t * iot_data_alloc_string (const char * val, iot_data_ownership_t owner
       data->value.str = data->buff;
       strcpy (data->buff, val);
     }
+    else if (data->base.arena && len < IOT_DATA_BLOCK_SIZE) // If in arena and less than size of block save in arena block
+    {
+      data->value.str = iot_data_arena_block (iot_data_arena_current, false);
+      strcpy (data->value.str, val);
+      data->base.release = false;
+    }
     else if (len < IOT_DATA_BLOCK_SIZE) // If less than size of block save in block
     {
       data->value.str = iot_data_alloc_block ();
@@ -1505,25 +3148,64 @@ iot_data_t * iot_data_alloc_string (const char * val, iot_data_ownership_t owner
   return (iot_data_t*) data;
 }
 
-iot_data_t * iot_data_alloc_string_fmt (const char *format, ...)
+iot_data_t * iot_data_alloc_string_view (const char * str, iot_data_t * source)
 {
-  va_list args;
+  assert (str && source);
+  if (strlen (str) < IOT_DATA_VALUE_BUFF_SIZE) return iot_data_alloc_string (str, IOT_DATA_COPY); // Short strings copied into value buffer
+  iot_data_value_t * data = iot_data_value_alloc (IOT_DATA_STRING, IOT_DATA_REF);
+  data->value.str = (char*) str;
+  data->base.hash = iot_hash (str);
+  data->base.view = true;
+  iot_data_add_ref (source);
+  memcpy (data->buff, &source, sizeof (source));
+  return (iot_data_t*) data;
+}
+
+// Format into the value buffer, or a heap buffer of the expected length if too large for it, reformatting
+// into a heap buffer of the exact length only if the formatted string overflows the buffer.
+
+static iot_data_t * iot_data_alloc_string_vfmt (size_t len, const char * format, va_list args)
+{
+  va_list copy;
+  iot_data_value_t * data = iot_data_value_alloc (IOT_DATA_STRING, IOT_DATA_TAKE);
+  size_t size = (len < IOT_DATA_VALUE_BUFF_SIZE) ? IOT_DATA_VALUE_BUFF_SIZE : (len + 1u);
+  char * str = (size == IOT_DATA_VALUE_BUFF_SIZE) ? data->buff : malloc (size);
+
+  va_copy (copy, args);
+  size_t n = (size_t) vsnprintf (str, size, format, copy);
+  va_end (copy);
+  if (n >= size)
+  {
+    str = realloc ((str == data->buff) ? NULL : str, n + 1u);
+    vsnprintf (str, n + 1u, format, args);
+  }
+  data->value.str = str;
+  data->base.hash = iot_hash (str);
+  return (iot_data_t*) data;
+}
 
+iot_data_t * iot_data_alloc_string_fmt (const char * format, ...)
+{
+  va_list args;
   va_start (args, format);
-  size_t n = 1u + (size_t) vsnprintf (NULL, 0, format, args);
+  iot_data_t * data = iot_data_alloc_string_vfmt (0u, format, args);
   va_end (args);
+  return data;
+}
 
-  char * str = malloc (n);
+iot_data_t * iot_data_alloc_string_fmt_n (size_t len, const char * format, ...)
+{
+  va_list args;
   va_start (args, format);
-  vsprintf (str, format, args);
+  iot_data_t * data = iot_data_alloc_string_vfmt (len, format, args);
   va_end (args);
-  return iot_data_alloc_string (str, IOT_DATA_TAKE);
+  return data;
 }
 
 extern iot_data_t * iot_data_alloc_binary (void * data, uint32_t length, iot_data_ownership_t ownership)
 {
   iot_data_t * bin = iot_data_alloc_array (data, length, IOT_DATA_UINT8, ownership);
-  bin->type = IOT_DATA_BINARY;
+  iot_data_block_retype (bin, IOT_DATA_BINARY);
   return bin;
 }
 
@@ -1533,11 +3215,12 @@ extern void * iot_data_binary_take (iot_data_t * data, uint32_t * len)
   assert (data && len && (data->type == IOT_DATA_BINARY || data->type == IOT_DATA_ARRAY));
   iot_data_array_t * array = (iot_data_array_t*) data;
   *len = iot_data_array_size (data);
-  if (array->base.release && (atomic_load (&(data)->refs) == 1u))
+  if (array->base.release && ! data->frozen && (atomic_load (&(data)->refs) == 1u))
   {
     ret = array->data;
     array->data = NULL;
     array->length = 0u;
+    array->capacity = 0u;
   }
   else
   {
@@ -1551,13 +3234,13 @@ extern void * iot_data_binary_take (iot_data_t * data, uint32_t * len)
 extern void iot_data_array_to_binary (iot_data_t * data)
 {
   assert (data && (data->type == IOT_DATA_ARRAY || data->type == IOT_DATA_BINARY) && data->element_type == IOT_DATA_UINT8);
-  data->type = IOT_DATA_BINARY;
+  iot_data_block_retype (data, IOT_DATA_BINARY);
 }
 
 extern void iot_data_binary_to_array (iot_data_t * data)
 {
   assert (data && (data->type == IOT_DATA_ARRAY || data->type == IOT_DATA_BINARY) && data->element_type == IOT_DATA_UINT8);
-  data->type = IOT_DATA_ARRAY;
+  iot_data_block_retype (data, IOT_DATA_ARRAY);
 }
 
 extern iot_data_t * iot_data_binary_from_string (const iot_data_t * data)
@@ -1585,6 +3268,7 @@ extern iot_data_t * iot_data_alloc_array (void * data, uint32_t length, iot_data
   array->base.element_type = type;
   array->data = length ? data : NULL;
   array->length = length;
+  array->capacity = length;
   array->base.hash = data ? iot_hash_data (data, size) : 0;
   array->base.release = data ? (ownership != IOT_DATA_REF) : false;
   if (length && data && (ownership == IOT_DATA_COPY))
@@ -1595,6 +3279,30 @@ extern iot_data_t * iot_data_alloc_array (void * data, uint32_t length, iot_data
   return (iot_data_t*) array;
 }
 
+extern iot_data_t * iot_data_alloc_shaped_array (void * data, const uint32_t * dims, uint32_t ndims, iot_data_type_t type, iot_data_ownership_t ownership)
+{
+  assert (dims && ndims);
+  uint64_t length = 1u;
+  for (uint32_t i = 0; i < ndims; i++) length *= dims[i];
+  assert (length <= UINT32_MAX);
+  iot_data_t * array = iot_data_alloc_array (data, (uint32_t) length, type, ownership);
+  iot_data_set_metadata (array, iot_data_alloc_array ((void*) dims, ndims, IOT_DATA_UINT32, IOT_DATA_COPY), IOT_DATA_STATIC (&iot_data_shape));
+  return array;
+}
+
+extern const iot_data_t * iot_data_array_shape (const iot_data_t * array)
+{
+  assert (array && (array->type == IOT_DATA_ARRAY));
+  const iot_data_t * shape = iot_data_get_metadata (array, IOT_DATA_STATIC (&iot_data_shape));
+  uint64_t length = shape ? 1u : 0u;
+  if (shape)
+  {
+    const iot_data_array_t * dims = (const iot_data_array_t*) shape;
+    for (uint32_t i = 0; i < dims->length; i++) length *= ((const uint32_t*) dims->data)[i];
+  }
+  return (length && (length == ((const iot_data_array_t*) array)->length)) ? shape : NULL; // Shape invalid if array length changed
+}
+
 extern iot_data_type_t iot_data_array_type (const iot_data_t * array)
 {
   assert (array && (array->type == IOT_DATA_ARRAY || array->type == IOT_DATA_BINARY));
@@ -1608,15 +3316,127 @@ extern bool iot_data_array_is_of_type (const iot_data_t * array, iot_data_type_t
 
 extern uint32_t iot_data_array_size (const iot_data_t * array)
 {
-  assert (array && (array->type == IOT_DATA_ARRAY || array->type == IOT_DATA_BINARY));
-  const iot_data_array_t * arr = (const iot_data_array_t *) array;
-  return (arr->length * iot_data_type_sizes[arr->base.element_type]);
+  assert (array && (array->type == IOT_DATA_ARRAY || array->type == IOT_DATA_BINARY));
+  const iot_data_array_t * arr = (const iot_data_array_t *) array;
+  return (arr->length * iot_data_type_sizes[arr->base.element_type]);
+}
+
+extern uint32_t iot_data_array_length (const iot_data_t * array)
+{
+  assert (array && (array->type == IOT_DATA_ARRAY || array->type == IOT_DATA_BINARY));
+  return ((const iot_data_array_t*) array)->length;
+}
+
+// Batches are maps of column name to typed array, with one array element per row. Column order is
+// held as ordering metadata, so is preserved when written as JSON. Column storage doubles when full.
+
+#define IOT_DATA_BATCH_MIN 16u
+
+static iot_data_array_t * iot_data_batch_array (const iot_data_t * batch, uint32_t column)
+{
+  assert (batch && batch->type == IOT_DATA_MAP);
+  const iot_data_t * ordering = iot_data_get_metadata (batch, IOT_DATA_STATIC (&iot_data_order));
+  assert (ordering && column < iot_data_vector_size (ordering));
+  return (iot_data_array_t*) iot_data_map_get (batch, iot_data_vector_get (ordering, column));
+}
+
+static void iot_data_batch_reserve (iot_data_array_t * array, uint32_t capacity)
+{
+  size_t size = iot_data_type_sizes[array->base.element_type];
+  if (array->base.release)
+  {
+    array->data = realloc (array->data, capacity * size);
+  }
+  else
+  {
+    void * data = malloc (capacity * size);
+    if (array->length) memcpy (data, array->data, array->length * size);
+    array->data = data;
+    array->base.release = true;
+  }
+  array->capacity = capacity;
+}
+
+iot_data_t * iot_data_alloc_batch (const char * const * names, const iot_data_type_t * types, uint32_t columns)
+{
+  assert (names && types && columns);
+  iot_data_t * batch = iot_data_alloc_typed_map (IOT_DATA_STRING, IOT_DATA_ARRAY);
+  iot_data_t * ordering = iot_data_alloc_typed_vector (columns, IOT_DATA_STRING);
+  for (uint32_t i = 0; i < columns; i++)
+  {
+    assert (names[i] && types[i] <= IOT_DATA_BOOL);
+    iot_data_t * key = iot_data_alloc_string (names[i], IOT_DATA_COPY);
+    iot_data_array_t * array = (iot_data_array_t*) iot_data_alloc_array (NULL, 0u, types[i], IOT_DATA_TAKE);
+    iot_data_batch_reserve (array, IOT_DATA_BATCH_MIN);
+    iot_data_vector_add (ordering, i, iot_data_add_ref (key));
+    iot_data_map_add (batch, key, (iot_data_t*) array);
+  }
+  iot_data_set_metadata (batch, ordering, IOT_DATA_STATIC (&iot_data_order));
+  return batch;
+}
+
+uint32_t iot_data_batch_columns (const iot_data_t * batch)
+{
+  assert (batch && batch->type == IOT_DATA_MAP);
+  return iot_data_map_size (batch);
+}
+
+uint32_t iot_data_batch_rows (const iot_data_t * batch)
+{
+  return iot_data_batch_array (batch, 0u)->length;
+}
+
+const iot_data_t * iot_data_batch_column (const iot_data_t * batch, uint32_t column)
+{
+  return (const iot_data_t*) iot_data_batch_array (batch, column);
+}
+
+uint32_t iot_data_batch_add_row (iot_data_t * batch)
+{
+  assert (batch && batch->type == IOT_DATA_MAP && ! batch->constant);
+  uint32_t row = iot_data_batch_rows (batch);
+  iot_data_map_iter_t iter;
+  iot_data_map_iter (batch, &iter);
+  while (iot_data_map_iter_next (&iter))
+  {
+    iot_data_array_t * array = (iot_data_array_t*) iot_data_map_iter_value (&iter);
+    size_t size = iot_data_type_sizes[array->base.element_type];
+    assert (array->length == row);
+    if (row == array->capacity) iot_data_batch_reserve (array, row ? (row * 2u) : IOT_DATA_BATCH_MIN);
+    memset ((uint8_t*) array->data + row * size, 0, size);
+    array->length++;
+    array->base.rehash = true;
+  }
+  batch->rehash = true;
+  return row;
+}
+
+bool iot_data_batch_set (iot_data_t * batch, uint32_t column, uint32_t row, const iot_data_t * value)
+{
+  assert (value && ! batch->constant);
+  iot_data_array_t * array = iot_data_batch_array (batch, column);
+  assert (row < array->length);
+  void * ptr = (uint8_t*) array->data + row * iot_data_type_sizes[array->base.element_type];
+  bool ok = iot_data_cast (value, array->base.element_type, ptr);
+  if (ok)
+  {
+    array->base.rehash = true;
+    batch->rehash = true;
+  }
+  return ok;
 }
 
-extern uint32_t iot_data_array_length (const iot_data_t * array)
+bool iot_data_batch_append (iot_data_t * batch, const iot_data_t * const * values)
 {
-  assert (array && (array->type == IOT_DATA_ARRAY || array->type == IOT_DATA_BINARY));
-  return ((const iot_data_array_t*) array)->length;
+  assert (values);
+  bool ok = true;
+  uint32_t row = iot_data_batch_add_row (batch);
+  uint32_t columns = iot_data_batch_columns (batch);
+  for (uint32_t i = 0; i < columns; i++)
+  {
+    if (values[i]) ok = iot_data_batch_set (batch, i, row, values[i]) && ok;
+  }
+  return ok;
 }
 
 iot_data_t * iot_data_alloc_array_from_base64 (const char * value)
@@ -1775,7 +3595,7 @@ bool iot_data_map_add_unused (iot_data_t * map, iot_data_t * key, iot_data_t * v
   assert (map->type == IOT_DATA_MAP);
   assert (key->type == map->key_type || map->key_type == IOT_DATA_MULTI);
   assert (map->element_type == val->type || map->element_type == IOT_DATA_MULTI);
-  bool add = iot_node_find (((const iot_data_map_t*) map)->tree, key) == NULL;
+  bool add = iot_map_find ((const iot_data_map_t*) map, key) == NULL;
   if (add)
   {
     iot_node_add ((iot_data_map_t *) map, key, val);
@@ -1787,17 +3607,92 @@ bool iot_data_map_add_unused (iot_data_t * map, iot_data_t * key, iot_data_t * v
 void iot_data_map_merge (iot_data_t * map, const iot_data_t * add)
 {
   assert (map && (map->type == IOT_DATA_MAP));
-  if (add)
+  if (add && (add != map))
   {
     assert (add->type == IOT_DATA_MAP);
     assert (map->key_type == IOT_DATA_MULTI || (map->key_type == add->key_type));
-    iot_data_map_iter_t iter;
-    iot_data_map_iter (add, &iter);
-    while (iot_data_map_iter_next (&iter))
+    if (iot_data_map_size (add) == 0u) return;
+    if (iot_data_map_size (map) <= iot_data_map_size (add)) // Linear merge and rebuild unless adding to a larger map
+    {
+      iot_map_merge ((iot_data_map_t*) map, (const iot_data_map_t*) add);
+    }
+    else
+    {
+      iot_data_map_iter_t iter;
+      iot_data_map_iter (add, &iter);
+      while (iot_data_map_iter_next (&iter))
+      {
+        iot_data_map_add (map, iot_data_add_ref (iot_data_map_iter_key (&iter)), iot_data_add_ref (iot_data_map_iter_value (&iter)));
+      }
+    }
+  }
+}
+
+// Order pairs by key, then by index so the last of any duplicate keys is last
+
+static int iot_data_pair_cmp (const void * p1, const void * p2)
+{
+  const iot_data_pair_t * pair1 = p1;
+  const iot_data_pair_t * pair2 = p2;
+  int cmp = iot_data_cmp (pair1->key, pair2->key, false);
+  return cmp ? cmp : ((pair1->index < pair2->index) ? -1 : 1);
+}
+
+void iot_data_map_add_all (iot_data_t * map, iot_data_t ** keys, iot_data_t ** values, uint32_t count)
+{
+  assert (map && (map->type == IOT_DATA_MAP) && (count == 0 || (keys && values)));
+  iot_data_map_t * mp = (iot_data_map_t*) map;
+  if (count == 0u) return;
+  if (mp->size > count) // Adding to a larger map, so add each pair in turn
+  {
+    for (uint32_t i = 0; i < count; i++) iot_data_map_add (map, keys[i], values[i]);
+    return;
+  }
+  uint32_t unique = 0u;
+  iot_data_pair_t * pairs = malloc (count * sizeof (*pairs));
+  for (uint32_t i = 0; i < count; i++)
+  {
+    assert (keys[i] && values[i]);
+    assert (keys[i]->type == map->key_type || map->key_type == IOT_DATA_MULTI);
+    assert (map->element_type == values[i]->type || map->element_type == IOT_DATA_MULTI);
+    pairs[i] = (iot_data_pair_t) { .key = keys[i], .value = values[i], .index = i };
+  }
+  qsort (pairs, count, sizeof (*pairs), iot_data_pair_cmp);
+  for (uint32_t i = 0; i < count; i++) // Keep the last value of duplicate keys, as if added in turn
+  {
+    if ((i + 1u < count) && (iot_data_cmp (pairs[i].key, pairs[i + 1u].key, false) == 0))
+    {
+      iot_data_free (pairs[i].key);
+      iot_data_free (pairs[i].value);
+    }
+    else
     {
-      iot_data_map_add (map, iot_data_add_ref (iot_data_map_iter_key (&iter)), iot_data_add_ref (iot_data_map_iter_value (&iter)));
+      pairs[unique++] = pairs[i];
     }
   }
+  iot_map_merge_pairs (mp, pairs, unique);
+  free (pairs);
+}
+
+void iot_data_map_build_sorted (iot_data_t * map, iot_data_t ** keys, iot_data_t ** values, uint32_t count)
+{
+  assert (map && (map->type == IOT_DATA_MAP) && (count == 0 || (keys && values)));
+  bool sorted = (iot_data_map_size (map) == 0u);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    assert (keys[i] && values[i]);
+    assert (keys[i]->type == map->key_type || map->key_type == IOT_DATA_MULTI);
+    assert (map->element_type == values[i]->type || map->element_type == IOT_DATA_MULTI);
+    if (sorted && i) sorted = (iot_data_cmp (keys[i - 1], keys[i], false) < 0);
+  }
+  if (sorted)
+  {
+    iot_map_build ((iot_data_map_t*) map, keys, values, count);
+  }
+  else
+  {
+    for (uint32_t i = 0; i < count; i++) iot_data_map_add (map, keys[i], values[i]);
+  }
 }
 
 uint32_t iot_data_map_size (const iot_data_t * map)
@@ -1806,6 +3701,8 @@ uint32_t iot_data_map_size (const iot_data_t * map)
   return ((const iot_data_map_t*) map)->size;
 }
 
+#define IOT_DATA_BASE64_CHARS "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/=\n"
+
 bool iot_data_map_base64_to_array (const iot_data_t * map, const iot_data_t * key)
 {
   assert (map && (map->type == IOT_DATA_MAP));
@@ -1813,11 +3710,29 @@ bool iot_data_map_base64_to_array (const iot_data_t * map, const iot_data_t * ke
 
   iot_data_t * array = NULL;
   const iot_data_map_t * mp = (const iot_data_map_t*) map;
-  iot_node_t * node = iot_node_find (mp->tree, key);
+  iot_node_t * node = iot_map_find (mp, key);
 
   if (node && (node->value->type == IOT_DATA_STRING))
   {
-    array = iot_data_alloc_array_from_base64 (((iot_data_value_t*) node->value)->value.str);
+    iot_data_value_t * val = (iot_data_value_t*) node->value;
+
+    // Decode unshared heap allocated strings in place, taking the string buffer for the array. As in place
+    // decoding overwrites the string, first check that it only contains base64 and whitespace characters.
+
+    if (val->base.release && ! val->base.release_block && ! val->base.view && ! val->base.frozen && (val->value.str != val->buff) && (atomic_load (&val->base.refs) == 1u) &&
+      val->value.str[strspn (val->value.str, IOT_DATA_BASE64_CHARS)] == '\0')
+    {
+      size_t len;
+      if (iot_b64_decode_in_place (val->value.str, &len))
+      {
+        array = iot_data_alloc_array (val->value.str, (uint32_t) len, IOT_DATA_UINT8, IOT_DATA_TAKE);
+        val->base.release = false;
+      }
+    }
+    else
+    {
+      array = iot_data_alloc_array_from_base64 (val->value.str);
+    }
     if (array)
     {
       iot_data_free (node->value);
@@ -1830,14 +3745,14 @@ bool iot_data_map_base64_to_array (const iot_data_t * map, const iot_data_t * ke
 const iot_data_t * iot_data_map_get (const iot_data_t * map, const iot_data_t * key)
 {
   assert (map && key && (map->type == IOT_DATA_MAP));
-  const iot_node_t * node = iot_node_find (((const iot_data_map_t*) map)->tree, key);
+  const iot_node_t * node = iot_map_find ((const iot_data_map_t*) map, key);
   return node ? node->value : NULL;
 }
 
 const iot_data_t * iot_data_map_get_typed (const iot_data_t * map, const iot_data_t * key, iot_data_type_t type)
 {
   assert (map && key && (map->type == IOT_DATA_MAP));
-  const iot_node_t * node = iot_node_find (((const iot_data_map_t*) map)->tree, key);
+  const iot_node_t * node = iot_map_find ((const iot_data_map_t*) map, key);
   return (node && (node->value->type == type)) ? node->value : NULL;
 }
 
@@ -2037,22 +3952,39 @@ void iot_data_vector_resize (iot_data_t * vector, uint32_t size)
 {
   iot_data_vector_t * vec = (iot_data_vector_t*) vector;
   assert (vector && (vector->type == IOT_DATA_VECTOR));
-  if (size < vec->size)
-  {
-    for (uint32_t i = size; i < vec->size; i++)
-    {
-      iot_data_free (vec->values[i]);
-    }
-  }
-  else if (size > vec->size)
+  for (uint32_t i = size; i < vec->size; i++)
   {
-    vec->values = realloc (vec->values, size * sizeof (iot_data_t*));
-    memset (&vec->values[vec->size], 0, (size - vec->size) * sizeof (iot_data_t*));
+    iot_data_free (vec->values[i]);
+    vec->values[i] = NULL;
   }
+  if (size > vec->capacity) iot_data_vector_grow (vec, size);
   vector->rehash = vec->size != size;
   vec->size = size;
 }
 
+void iot_data_vector_reserve (iot_data_t * vector, uint32_t capacity)
+{
+  iot_data_vector_t * vec = (iot_data_vector_t*) vector;
+  assert (vector && (vector->type == IOT_DATA_VECTOR));
+  if (capacity > vec->capacity) iot_data_vector_grow (vec, capacity);
+}
+
+uint32_t iot_data_vector_capacity (const iot_data_t * vector)
+{
+  assert (vector && (vector->type == IOT_DATA_VECTOR));
+  return ((const iot_data_vector_t*) vector)->capacity;
+}
+
+void iot_data_vector_append (iot_data_t * vector, iot_data_t * val)
+{
+  iot_data_vector_t * vec = (iot_data_vector_t*) vector;
+  assert (vector && (vector->type == IOT_DATA_VECTOR));
+  assert ((val == NULL) || (vector->element_type == IOT_DATA_MULTI || vector->element_type == val->type)); // Check element type matches for fixed type vector
+  if (vec->size == vec->capacity) iot_data_vector_grow (vec, vec->capacity ? vec->capacity * 2u : IOT_DATA_VECTOR_BLOCK_SIZE);
+  vec->values[vec->size++] = val;
+  vector->hash ^= iot_data_hash (val);
+}
+
 uint32_t iot_data_vector_compact (iot_data_t * vector)
 {
   iot_data_vector_t * vec = (iot_data_vector_t*) vector;
@@ -2299,7 +4231,7 @@ bool iot_data_map_iter_next (iot_data_map_iter_t * iter)
 bool iot_data_map_iter_has_next (const iot_data_map_iter_t * iter)
 {
   assert (iter && iter->_map);
-  return (iter->_count < iter->_map->size);
+  return (iter->_node) ? (iot_node_next (iter->_node) != NULL) : (iter->_count < iter->_map->size);
 }
 
 static inline iot_node_t * iot_node_end (iot_node_t * node)
@@ -2334,6 +4266,116 @@ const void * iot_data_map_end_pointer (iot_data_t * map)
   return value ? iot_data_pointer (value) : NULL;
 }
 
+// Map keys are compared with a function selected by the map key type, which compares keys of that type
+// without dispatching on type. Keys of a different type, and maps of other key types, use iot_data_cmp.
+
+typedef int (*iot_data_key_cmp_fn) (const iot_data_t * v1, const iot_data_t * v2);
+
+#define IOT_DATA_KEY_CMP(N) \
+static int iot_data_key_cmp_##N (const iot_data_t * v1, const iot_data_t * v2) \
+{ \
+  const iot_data_union_t * u1 = &((const iot_data_value_t*) v1)->value; \
+  const iot_data_union_t * u2 = &((const iot_data_value_t*) v2)->value; \
+  return (u1->N == u2->N) ? 0 : ((u1->N < u2->N) ? -1 : 1); \
+}
+
+IOT_DATA_KEY_CMP (i8)
+IOT_DATA_KEY_CMP (ui8)
+IOT_DATA_KEY_CMP (i16)
+IOT_DATA_KEY_CMP (ui16)
+IOT_DATA_KEY_CMP (i32)
+IOT_DATA_KEY_CMP (ui32)
+IOT_DATA_KEY_CMP (i64)
+IOT_DATA_KEY_CMP (ui64)
+IOT_DATA_KEY_CMP (f32)
+IOT_DATA_KEY_CMP (f64)
+
+static int iot_data_key_cmp_str (const iot_data_t * v1, const iot_data_t * v2)
+{
+  const char * s1 = ((const iot_data_value_t*) v1)->value.str;
+  const char * s2 = ((const iot_data_value_t*) v2)->value.str;
+  return (s1 == s2) ? 0 : strcmp (s1, s2);
+}
+
+static int iot_data_key_cmp_any (const iot_data_t * v1, const iot_data_t * v2)
+{
+  return iot_data_cmp (v1, v2, false);
+}
+
+static const iot_data_key_cmp_fn iot_data_key_cmps[IOT_DATA_TYPES] =
+{
+  iot_data_key_cmp_i8, iot_data_key_cmp_ui8, iot_data_key_cmp_i16, iot_data_key_cmp_ui16, iot_data_key_cmp_i32, iot_data_key_cmp_ui32,
+  iot_data_key_cmp_i64, iot_data_key_cmp_ui64, iot_data_key_cmp_f32, iot_data_key_cmp_f64, [IOT_DATA_STRING] = iot_data_key_cmp_str
+};
+
+static inline iot_data_key_cmp_fn iot_map_key_cmp (const iot_data_map_t * map, const iot_data_t * key)
+{
+  iot_data_key_cmp_fn cmp = (key->type == map->base.key_type) ? iot_data_key_cmps[key->type] : NULL;
+  return cmp ? cmp : iot_data_key_cmp_any;
+}
+
+// Integer keys of up to 32 bits are also held in map nodes, as values whose unsigned order is the key order,
+// so that searches of maps with these key types compare nodes without following the node key pointers.
+
+static inline uint32_t iot_data_inline_key (const iot_data_t * key)
+{
+  const iot_data_union_t * val = &((const iot_data_value_t*) key)->value;
+  switch (key->type)
+  {
+    case IOT_DATA_INT8: return (uint32_t) (int32_t) val->i8 ^ 0x80000000u;
+    case IOT_DATA_UINT8: return val->ui8;
+    case IOT_DATA_INT16: return (uint32_t) (int32_t) val->i16 ^ 0x80000000u;
+    case IOT_DATA_UINT16: return val->ui16;
+    case IOT_DATA_INT32: return (uint32_t) val->i32 ^ 0x80000000u;
+    case IOT_DATA_UINT32: return val->ui32;
+    default: return 0u;
+  }
+}
+
+static iot_node_t * iot_node_bound (const iot_data_map_t * map, const iot_data_t * key, bool upper)
+{
+  iot_data_key_cmp_fn cmp_fn = iot_map_key_cmp (map, key);
+  iot_node_t * node = map->tree;
+  iot_node_t * bound = NULL;
+  while (node)
+  {
+    int cmp = cmp_fn (node->key, key);
+    if (cmp > 0 || (cmp == 0 && ! upper))
+    {
+      bound = node;
+      node = node->left;
+    }
+    else
+    {
+      node = node->right;
+    }
+  }
+  return bound;
+}
+
+const iot_data_t * iot_data_map_lower_bound (const iot_data_t * map, const iot_data_t * key)
+{
+  assert (map && map->type == IOT_DATA_MAP && key);
+  const iot_node_t * node = iot_node_bound ((const iot_data_map_t*) map, key, false);
+  return node ? node->key : NULL;
+}
+
+const iot_data_t * iot_data_map_upper_bound (const iot_data_t * map, const iot_data_t * key)
+{
+  assert (map && map->type == IOT_DATA_MAP && key);
+  const iot_node_t * node = iot_node_bound ((const iot_data_map_t*) map, key, true);
+  return node ? node->key : NULL;
+}
+
+bool iot_data_map_iter_seek (iot_data_map_iter_t * iter, const iot_data_t * key)
+{
+  assert (iter && iter->_map && key);
+  iot_node_t * bound = iot_node_bound (iter->_map, key, false);
+  iter->_node = bound ? iot_node_prev (bound) : iot_node_end (iter->_map->tree);
+  iter->_count = iter->_node ? 1u : 0u; // Position not tracked after a seek, has_next follows the tree instead
+  return (bound != NULL);
+}
+
 bool iot_data_map_iter_prev (iot_data_map_iter_t * iter)
 {
   assert (iter);
@@ -2504,6 +4546,39 @@ const char * iot_data_vector_iter_string (const iot_data_vector_iter_t * iter)
   return (iter->_index < iter->_vector->size) ? iot_data_string (iter->_vector->values[iter->_index]) : NULL;
 }
 
+static _Thread_local iot_data_order_fn iot_data_sort_order = NULL; /* Ordering function for current thread vector sort */
+
+static int iot_data_sort_cmp (const void * v1, const void * v2)
+{
+  return iot_data_sort_order (*(const iot_data_t * const *) v1, *(const iot_data_t * const *) v2);
+}
+
+void iot_data_vector_sort (iot_data_t * vector, iot_data_order_fn cmp)
+{
+  iot_data_vector_t * vec = (iot_data_vector_t*) vector;
+  assert (vector && (vector->type == IOT_DATA_VECTOR));
+  iot_data_order_fn order = iot_data_sort_order; // Allow ordering function to sort
+  iot_data_sort_order = cmp ? cmp : iot_data_compare_value;
+  if (vec->size > 1u) qsort (vec->values, vec->size, sizeof (iot_data_t*), iot_data_sort_cmp);
+  iot_data_sort_order = order;
+}
+
+bool iot_data_vector_search (const iot_data_t * vector, const iot_data_t * value, iot_data_order_fn cmp, uint32_t * index)
+{
+  const iot_data_vector_t * vec = (const iot_data_vector_t*) vector;
+  assert (vector && (vector->type == IOT_DATA_VECTOR));
+  uint32_t lo = 0u;
+  uint32_t hi = vec->size;
+  if (cmp == NULL) cmp = iot_data_compare_value;
+  while (lo < hi)
+  {
+    uint32_t mid = lo + (hi - lo) / 2u;
+    if (cmp (vec->values[mid], value) < 0) lo = mid + 1u; else hi = mid;
+  }
+  if (index) *index = lo;
+  return (lo < vec->size) && (cmp (vec->values[lo], value) == 0);
+}
+
 const iot_data_t * iot_data_vector_find (const iot_data_t * vector, iot_data_cmp_fn cmp, const void * arg)
 {
   assert (vector && cmp);
@@ -2535,8 +4610,45 @@ static size_t iot_data_repr_size (char c)
   return size_map[(uint8_t) c];
 }
 
+iot_data_t * iot_data_string_from_cache (char * val, iot_data_t * cache)
+{
+  return iot_data_string_cached (iot_data_alloc_string (val, IOT_DATA_TAKE), cache);
+}
+
+iot_data_t * iot_data_string_cached (iot_data_t * str, iot_data_t * cache)
+{
+  if (cache)
+  {
+    const iot_data_t * cached = iot_data_map_get (cache, str);
+    if (cached)
+    {
+      iot_data_free (str);
+      str = iot_data_add_ref (cached);
+    }
+    else
+    {
+      iot_data_map_add (cache, iot_data_add_ref (str), iot_data_add_ref (str));
+    }
+  }
+  return str;
+}
+
+void iot_data_holder_flush (iot_string_holder_t * holder)
+{
+  size_t len = holder->size - holder->free - 1;
+  if (len && holder->ok) holder->ok = (holder->sink) (holder->ctx, holder->str, len);
+  holder->free = holder->size - 1;
+  *holder->str = '\0';
+}
+
 void iot_data_holder_realloc (iot_string_holder_t * holder, size_t required)
 {
+  if (holder->sink)
+  {
+    iot_data_holder_flush (holder);
+    assert (holder->free >= required);
+    return;
+  }
   size_t inc = holder->size > IOT_STR_BUFF_DOUBLING_LIMIT ? IOT_STR_BUFF_INCREMENT : holder->size;
   if (inc < required) inc = required;
   holder->size += inc;
@@ -2544,69 +4656,121 @@ void iot_data_holder_realloc (iot_string_holder_t * holder, size_t required)
   holder->str = realloc (holder->str, holder->size);
 }
 
-void iot_data_strcat_escape (iot_string_holder_t * holder, const char * add, bool escape)
+// Returns offset of the first character of a string needing json escaping, or len if none. Eight
+// characters are tested at a time, for control characters, quotes and backslashes.
+
+#define IOT_DATA_BYTES(c) (UINT64_C (0x0101010101010101) * (c))
+#define IOT_DATA_HAS_LESS(w,c) (((w) - IOT_DATA_BYTES (c)) & ~(w) & IOT_DATA_BYTES (0x80u))
+
+static size_t iot_data_escape_scan (const char * str, size_t len)
 {
-  size_t len = strlen (add);
-  size_t adj_len = len;
+  size_t i = 0;
+  for (; (i + sizeof (uint64_t)) <= len; i += sizeof (uint64_t))
+  {
+    uint64_t w;
+    memcpy (&w, str + i, sizeof (w));
+    if (IOT_DATA_HAS_LESS (w, 0x20u) | IOT_DATA_HAS_LESS (w ^ IOT_DATA_BYTES ('"'), 1u) | IOT_DATA_HAS_LESS (w ^ IOT_DATA_BYTES ('\\'), 1u)) break;
+  }
+  while (i < len && iot_data_repr_size (str[i]) == 1) i++;
+  return i;
+}
+
+// Append string of given length, escaping from offset of first character needing escape
+
+static void iot_data_strcat_len (iot_string_holder_t * holder, const char * add, size_t len, size_t first)
+{
+  size_t adj_len = first;
   size_t i;
-  if (escape)
+  for (i = first; i < len; i++)
   {
-    adj_len = 0;
-    for (i = 0; i < len; i++)
+    adj_len += iot_data_repr_size (add[i]);
+  }
+  if (holder->sink && adj_len >= holder->size) // Too large for sink buffer, so add in parts
+  {
+    for (i = 0; i < len; i += IOT_DATA_SINK_PART)
     {
-      adj_len += iot_data_repr_size (add[i]);
+      size_t plen = ((len - i) < IOT_DATA_SINK_PART) ? (len - i) : IOT_DATA_SINK_PART;
+      iot_data_strcat_len (holder, add + i, plen, (first >= i + plen) ? plen : iot_data_escape_scan (add + i, plen));
     }
+    return;
   }
   if (holder->free < adj_len)
   {
     iot_data_holder_realloc (holder, adj_len);
   }
+  assert (strlen (holder->str) == (holder->size - holder->free - 1));
+  uint8_t * ptr = (uint8_t*) holder->str + holder->size - holder->free - 1;
   if (len == adj_len)
   {
-    strcpy (holder->str + holder->size - holder->free - 1, add);
+    memcpy (ptr, add, len);
+    ptr += len;
   }
   else
   {
     static const char * hex = "0123456789abcdef";
-    assert (strlen (holder->str) == (holder->size - holder->free - 1));
-    uint8_t * ptr = (uint8_t*) holder->str + holder->size - holder->free - 1;
-    for (i = 0; i < len; i++)
+    memcpy (ptr, add, first);
+    ptr += first;
+    for (i = first; i < len;) // Escape character then copy run of characters not needing escape
     {
-      uint8_t c = add[i];
-      switch (iot_data_repr_size (c))
+      uint8_t c = add[i++];
+      if (iot_data_repr_size (c) == 2)
       {
-        case 1:
-          *ptr++ = c;
-          break;
-        case 2:
-          *ptr++ = '\\';
-          switch (c)
-          {
-            case '\b': *ptr++ = 'b'; break;
-            case '\f': *ptr++ = 'f'; break;
-            case '\n': *ptr++ = 'n'; break;
-            case '\r': *ptr++ = 'r'; break;
-            case '\t': *ptr++ = 't'; break;
-            case '\"': *ptr++ = '\"'; break;
-            case '\\': *ptr++ = '\\'; break;
-            default: break;
-          }
-          break;
-        default: // 6
-          *ptr++ = '\\';
-          *ptr++ = 'u';
-          *ptr++ = '0';
-          *ptr++ = '0';
-          *ptr++ = (c & 0x10u) ? '1' : '0';
-          *ptr++ = hex[c & 0x0fu];
-          break;
+        *ptr++ = '\\';
+        switch (c)
+        {
+          case '\b': *ptr++ = 'b'; break;
+          case '\f': *ptr++ = 'f'; break;
+          case '\n': *ptr++ = 'n'; break;
+          case '\r': *ptr++ = 'r'; break;
+          case '\t': *ptr++ = 't'; break;
+          case '\"': *ptr++ = '\"'; break;
+          case '\\': *ptr++ = '\\'; break;
+          default: break;
+        }
+      }
+      else // 6
+      {
+        *ptr++ = '\\';
+        *ptr++ = 'u';
+        *ptr++ = '0';
+        *ptr++ = '0';
+        *ptr++ = (c & 0x10u) ? '1' : '0';
+        *ptr++ = hex[c & 0x0fu];
       }
+      size_t run = iot_data_escape_scan (add + i, len - i);
+      memcpy (ptr, add + i, run);
+      ptr += run;
+      i += run;
     }
-    *ptr = '\0';
   }
+  *ptr = '\0';
   holder->free -= adj_len;
 }
 
+void iot_data_strcat_escape (iot_string_holder_t * holder, const char * add, bool escape)
+{
+  size_t len = strlen (add);
+  iot_data_strcat_len (holder, add, len, escape ? iot_data_escape_scan (add, len) : len);
+}
+
+// A string found not to need escaping is marked, so later serialisation of the same string
+// (e.g. an interned map key) only copies it. As strings are immutable, a racing update by
+// another thread writes the same result.
+
+void iot_data_strcat_string (iot_string_holder_t * holder, const iot_data_t * str)
+{
+  iot_data_t * da = (iot_data_t*) str;
+  const char * add = iot_data_string (str);
+  size_t len = strlen (add);
+  size_t first = len;
+  if (! da->clean)
+  {
+    first = iot_data_escape_scan (add, len);
+    if (first == len && ! da->constant) da->clean = true; // Constant data may be read only
+  }
+  iot_data_strcat_len (holder, add, len, first);
+}
+
 static inline void iot_data_strcat (iot_string_holder_t * holder, const char * add)
 {
   iot_data_strcat_escape (holder, add, true);
@@ -2629,7 +4793,7 @@ iot_data_t * iot_data_copy (const iot_data_t * data)
     case IOT_DATA_STRING:
     {
       const iot_data_value_t * val = (const iot_data_value_t *) data;
-      ret = iot_data_alloc_string (val->value.str, val->base.release ? IOT_DATA_COPY : IOT_DATA_REF);
+      ret = iot_data_alloc_string (val->value.str, (val->base.release || val->base.view) ? IOT_DATA_COPY : IOT_DATA_REF);
       break;
     }
     case IOT_DATA_BINARY:
@@ -2637,20 +4801,25 @@ iot_data_t * iot_data_copy (const iot_data_t * data)
     {
       const iot_data_array_t * array = (const iot_data_array_t *) data;
       ret = iot_data_alloc_array (array->data, array->length, array->base.element_type, array->base.release ? IOT_DATA_COPY : IOT_DATA_REF);
-      ret->type = data->type; // May be binary or array
+      iot_data_block_retype (ret, data->type); // May be binary or array
       break;
     }
     case IOT_DATA_MAP:
     {
       iot_data_map_iter_t iter;
-      ret = iot_data_alloc_typed_map (data->key_type, data->element_type);
+      uint32_t size = iot_data_map_size (data);
+      iot_data_t ** keys = size ? malloc (2u * size * sizeof (iot_data_t*)) : NULL;
+      iot_data_t ** values = keys ? (keys + size) : NULL;
+      uint32_t i = 0;
+      ret = iot_data_alloc_map_like (data);
       iot_data_map_iter (data, &iter);
-      while (iot_data_map_iter_next (&iter))
+      while (iot_data_map_iter_next (&iter)) // Map iterated in key order, so copy built directly
       {
-        iot_data_t * key = iot_data_copy (iot_data_map_iter_key (&iter));
-        iot_data_t * value = iot_data_copy (iot_data_map_iter_value (&iter));
-        iot_data_map_add (ret, key, value);
+        keys[i] = iot_data_copy (iot_data_map_iter_key (&iter));
+        values[i++] = iot_data_copy (iot_data_map_iter_value (&iter));
       }
+      iot_map_build ((iot_data_map_t*) ret, keys, values, size);
+      free (keys);
       break;
     }
     case IOT_DATA_VECTOR:
@@ -2728,13 +4897,20 @@ extern iot_data_t * iot_data_shallow_copy (const iot_data_t * src)
   {
     case IOT_DATA_MAP:
     {
-      result = iot_data_alloc_typed_map (src->key_type, src->element_type);
+      uint32_t size = iot_data_map_size (src);
+      iot_data_t ** keys = size ? malloc (2u * size * sizeof (iot_data_t*)) : NULL;
+      iot_data_t ** values = keys ? (keys + size) : NULL;
+      uint32_t i = 0;
+      result = iot_data_alloc_map_like (src);
       iot_data_map_iter_t iter;
       iot_data_map_iter (src, &iter);
       while (iot_data_map_iter_next (&iter))
       {
-        iot_data_map_add (result, iot_data_add_ref (iot_data_map_iter_key (&iter)), iot_data_add_ref (iot_data_map_iter_value (&iter)));
+        keys[i] = iot_data_add_ref (iot_data_map_iter_key (&iter));
+        values[i++] = iot_data_add_ref (iot_data_map_iter_value (&iter));
       }
+      iot_map_build ((iot_data_map_t*) result, keys, values, size);
+      free (keys);
       break;
     }
     case IOT_DATA_VECTOR:
@@ -2780,7 +4956,180 @@ extern const iot_data_t * iot_data_get_at (const iot_data_t * data, const iot_da
     iot_data_free (index);
     iot_data_free (p);
   }
-  return result;
+  return result;
+}
+
+// Compiled paths. Segments are held with their type, so each level is resolved by a single lookup without
+// copying the path. Path sets are sorted by segment, so that paths sharing a prefix resolve it once.
+
+#define IOT_DATA_PATH_STACK 16u // Maximum path depth resolved without allocation
+
+typedef struct iot_data_path_seg_t
+{
+  iot_data_t * key;           // Map key or vector index
+  iot_data_type_t type;       // Key type
+} iot_data_path_seg_t;
+
+struct iot_data_path_t
+{
+  uint32_t length;            // Number of segments
+  iot_data_path_seg_t segs[]; // Segments from root
+};
+
+typedef struct iot_data_path_entry_t
+{
+  iot_data_path_t * path;
+  uint32_t index;             // Original index of path
+} iot_data_path_entry_t;
+
+struct iot_data_paths_t
+{
+  uint32_t count;             // Number of paths
+  uint32_t depth;             // Longest path length
+  iot_data_path_t ** paths;   // Paths, sorted by segment
+  uint32_t * order;           // Original index of each sorted path
+  uint32_t * shared;          // Number of leading segments shared with previous sorted path
+};
+
+iot_data_path_t * iot_data_path_alloc (const iot_data_t * path)
+{
+  assert (path);
+  uint32_t length = iot_data_list_length (path);
+  iot_data_path_t * compiled = malloc (sizeof (*compiled) + length * sizeof (iot_data_path_seg_t));
+  iot_data_list_iter_t iter;
+  uint32_t i = 0;
+  compiled->length = length;
+  iot_data_list_iter (path, &iter);
+  while (iot_data_list_iter_prev (&iter)) // Path iterated from head
+  {
+    iot_data_t * key = iot_data_add_ref (iot_data_list_iter_value (&iter));
+    iot_data_hash (key);
+    compiled->segs[i].key = key;
+    compiled->segs[i++].type = key->type;
+  }
+  return compiled;
+}
+
+void iot_data_path_free (iot_data_path_t * path)
+{
+  if (path)
+  {
+    for (uint32_t i = 0; i < path->length; i++) iot_data_free (path->segs[i].key);
+    free (path);
+  }
+}
+
+static inline const iot_data_t * iot_data_path_step (const iot_data_t * data, const iot_data_path_seg_t * seg)
+{
+  const iot_data_t * result = NULL;
+  if (data->type == IOT_DATA_MAP)
+  {
+    if (data->key_type == IOT_DATA_MULTI || data->key_type == seg->type)
+    {
+      const iot_node_t * node = iot_map_find ((const iot_data_map_t*) data, seg->key);
+      result = node ? node->value : NULL;
+    }
+  }
+  else if (data->type == IOT_DATA_VECTOR && seg->type == IOT_DATA_UINT32)
+  {
+    uint32_t index = iot_data_ui32 (seg->key);
+    result = (index < ((const iot_data_vector_t*) data)->size) ? iot_data_vector_get (data, index) : NULL;
+  }
+  return result;
+}
+
+static const iot_data_t * iot_data_path_resolve (const iot_data_t * data, const iot_data_path_t * path, uint32_t from)
+{
+  for (uint32_t i = from; data && i < path->length; i++) data = iot_data_path_step (data, &path->segs[i]);
+  return data;
+}
+
+const iot_data_t * iot_data_path_get (const iot_data_t * data, const iot_data_path_t * path)
+{
+  assert (data && path);
+  return iot_data_path_resolve (data, path, 0u);
+}
+
+static int iot_data_path_cmp (const void * p1, const void * p2)
+{
+  const iot_data_path_t * path1 = ((const iot_data_path_entry_t*) p1)->path;
+  const iot_data_path_t * path2 = ((const iot_data_path_entry_t*) p2)->path;
+  uint32_t length = (path1->length < path2->length) ? path1->length : path2->length;
+  for (uint32_t i = 0; i < length; i++)
+  {
+    int ret = iot_data_compare (path1->segs[i].key, path2->segs[i].key);
+    if (ret) return ret;
+  }
+  return (path1->length == path2->length) ? 0 : ((path1->length < path2->length) ? -1 : 1);
+}
+
+iot_data_paths_t * iot_data_paths_alloc (const iot_data_t * paths)
+{
+  assert (paths && paths->type == IOT_DATA_VECTOR);
+  uint32_t count = iot_data_vector_size (paths);
+  iot_data_paths_t * set = calloc (1, sizeof (*set));
+  iot_data_path_entry_t * entries = malloc (count * sizeof (*entries) + 1u);
+  set->count = count;
+  set->paths = malloc (count * sizeof (*set->paths) + 1u);
+  set->order = malloc (2u * count * sizeof (uint32_t) + 1u);
+  set->shared = set->order + count;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    entries[i].path = iot_data_path_alloc (iot_data_vector_get (paths, i));
+    entries[i].index = i;
+    if (entries[i].path->length > set->depth) set->depth = entries[i].path->length;
+  }
+  qsort (entries, count, sizeof (*entries), iot_data_path_cmp);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    uint32_t shared = 0u;
+    iot_data_path_t * path = entries[i].path;
+    if (i > 0)
+    {
+      const iot_data_path_t * prev = entries[i - 1].path;
+      while (shared < prev->length && shared < path->length && iot_data_equal (prev->segs[shared].key, path->segs[shared].key)) shared++;
+    }
+    set->paths[i] = path;
+    set->order[i] = entries[i].index;
+    set->shared[i] = shared;
+  }
+  free (entries);
+  return set;
+}
+
+void iot_data_paths_free (iot_data_paths_t * paths)
+{
+  if (paths)
+  {
+    for (uint32_t i = 0; i < paths->count; i++) iot_data_path_free (paths->paths[i]);
+    free (paths->paths);
+    free (paths->order);
+    free (paths);
+  }
+}
+
+uint32_t iot_data_paths_size (const iot_data_paths_t * paths)
+{
+  assert (paths);
+  return paths->count;
+}
+
+void iot_data_paths_get (const iot_data_t * data, const iot_data_paths_t * paths, const iot_data_t ** results)
+{
+  assert (data && paths && results);
+  const iot_data_t * stack[IOT_DATA_PATH_STACK];
+  const iot_data_t ** nodes = (paths->depth < IOT_DATA_PATH_STACK) ? stack : malloc ((paths->depth + 1u) * sizeof (*nodes));
+  nodes[0] = data;
+  for (uint32_t i = 0; i < paths->count; i++)
+  {
+    const iot_data_path_t * path = paths->paths[i];
+    for (uint32_t j = paths->shared[i]; j < path->length; j++) // Levels up to shared resolved by previous paths
+    {
+      nodes[j + 1] = nodes[j] ? iot_data_path_step (nodes[j], &path->segs[j]) : NULL;
+    }
+    results[paths->order[i]] = nodes[path->length];
+  }
+  if (nodes != stack) free (nodes);
 }
 
 extern void iot_data_list_empty (iot_data_t * list)
@@ -2879,6 +5228,119 @@ extern iot_data_t * iot_data_update_at (const iot_data_t * data, const iot_data_
   return result;
 }
 
+iot_data_t * iot_data_make_mutable (iot_data_t * data)
+{
+  assert (data);
+  if (data->constant || data->frozen || atomic_load (&data->refs) > 1u)
+  {
+    iot_data_t * copy = iot_data_shallow_copy (data);
+    iot_data_free (data);
+    data = copy;
+  }
+  return data;
+}
+
+// Copy on write path operation applied to the final element of a path
+
+typedef struct iot_data_cow_op_t
+{
+  iot_data_t * val;         // Value to add
+  iot_data_update_fn fn;    // Update function
+  void * arg;               // Update function argument
+  bool remove;              // Whether removing
+} iot_data_cow_op_t;
+
+// Apply operation to an unshared map or vector. Unshared elements on the path are updated in place,
+// shared elements are replaced by a (shallow) copy.
+
+static void iot_data_cow_at (iot_data_t * data, iot_data_list_iter_t * iter, const iot_data_cow_op_t * op)
+{
+  assert (data->type == IOT_DATA_MAP || data->type == IOT_DATA_VECTOR);
+  const iot_data_t * index = iot_data_list_iter_value (iter);
+  bool map = (data->type == IOT_DATA_MAP);
+  iot_data_t * child = (iot_data_t*) (map ? iot_data_map_get (data, index) : iot_data_vector_get (data, iot_data_ui32 (index)));
+  iot_data_t * update = NULL;
+
+  if (! iot_data_list_iter_prev (iter)) // Final path element
+  {
+    if (op->remove)
+    {
+      if (map)
+      {
+        iot_data_map_remove (data, index);
+      }
+      else
+      {
+        iot_data_vector_add (data, iot_data_ui32 (index), NULL);
+        iot_data_vector_compact (data);
+      }
+    }
+    else if (op->fn)
+    {
+      if (child || ! map) update = (op->fn) (child, op->arg);
+    }
+    else
+    {
+      update = op->val;
+    }
+  }
+  else
+  {
+    assert (child);
+    if (child->constant || child->frozen || atomic_load (&child->refs) > 1u)
+    {
+      update = iot_data_shallow_copy (child);
+      iot_data_cow_at (update, iter, op);
+    }
+    else // Only referenced by data, so update in place
+    {
+      iot_data_cow_at (child, iter, op);
+      data->rehash = true;
+    }
+  }
+  if (update)
+  {
+    map ? iot_data_map_add (data, iot_data_add_ref (index), update) : iot_data_vector_add (data, iot_data_ui32 (index), update);
+  }
+}
+
+static iot_data_t * iot_data_cow_path (iot_data_t * data, const iot_data_t * path, const iot_data_cow_op_t * op)
+{
+  iot_data_list_iter_t iter;
+  iot_data_list_iter (path, &iter);
+  if (! iot_data_list_iter_prev (&iter)) // Path iterated from head
+  {
+    if (op->remove) return data;
+    iot_data_t * result = op->fn ? (op->fn) (data, op->arg) : op->val;
+    iot_data_free (data);
+    return result;
+  }
+  data = iot_data_make_mutable (data);
+  iot_data_cow_at (data, &iter, op);
+  return data;
+}
+
+iot_data_t * iot_data_add_at_cow (iot_data_t * data, const iot_data_t * path, iot_data_t * val)
+{
+  assert (data && path && val);
+  iot_data_cow_op_t op = { .val = val };
+  return iot_data_cow_path (data, path, &op);
+}
+
+iot_data_t * iot_data_update_at_cow (iot_data_t * data, const iot_data_t * path, iot_data_update_fn fn, void * arg)
+{
+  assert (data && path && fn);
+  iot_data_cow_op_t op = { .fn = fn, .arg = arg };
+  return iot_data_cow_path (data, path, &op);
+}
+
+iot_data_t * iot_data_remove_at_cow (iot_data_t * data, const iot_data_t * path)
+{
+  assert (data && path);
+  iot_data_cow_op_t op = { .remove = true };
+  return iot_data_cow_path (data, path, &op);
+}
+
 /* Red/Black binary tree manipulation functions. Implements iot_data_map_t.
  *
  * https://algorithmtutor.com/Data-Structures/Tree/Red-Black-Trees/
@@ -2922,11 +5384,14 @@ static inline iot_node_t * iot_node_sibling (const iot_node_t * node)
 
 static inline iot_node_t * iot_node_alloc (iot_node_t * parent, iot_data_t * key, iot_data_t * value)
 {
-  bool heap = iot_data_alloc_from_heap;
-  iot_node_t * node = heap ? calloc (1, IOT_DATA_BLOCK_SIZE) : iot_data_alloc_block ();
+  iot_data_arena_t * arena = iot_data_arena_current;
+  bool heap = iot_data_alloc_from_heap && ! arena;
+  iot_node_t * node = iot_data_policy_block (arena, heap, false);
   node->heap = heap;
+  node->arena = (arena != NULL);
   node->value = value;
   node->key = key;
+  node->ikey = iot_data_inline_key (key);
   node->parent = parent;
   node->colour = IOT_NODE_RED;
   return node;
@@ -2936,7 +5401,7 @@ static void iot_node_delete (iot_node_t * node)
 {
   iot_data_free (node->key);
   iot_data_free (node->value);
-  (node->heap) ? free (node) : iot_data_block_free (node);
+  if (! node->arena) (node->heap) ? free (node) : iot_data_block_free (node);
 }
 
 static inline iot_node_t * iot_node_minimum (iot_node_t * node)
@@ -3096,30 +5561,128 @@ static void iot_node_remove_balance (iot_data_map_t * map, iot_node_t * x)
   x->colour = IOT_NODE_BLACK;
 }
 
-static inline iot_node_t * iot_node_find (const iot_node_t * node, const iot_data_t * key)
+// Search for a node, comparing inline keys if inlined, else keys using the comparator
+
+static inline iot_node_t * iot_node_search (const iot_node_t * node, const iot_data_t * key, iot_data_key_cmp_fn cmp_fn, bool inlined)
 {
+  uint32_t ikey = inlined ? iot_data_inline_key (key) : 0u;
   while (node)
   {
-    int cmp = iot_data_cmp (node->key, key, false);
+    int cmp = inlined ? ((node->ikey == ikey) ? 0 : ((node->ikey > ikey) ? 1 : -1)) : cmp_fn (node->key, key);
     if (cmp == 0) break;
     node = (cmp > 0) ? node->left : node->right;
   }
   return (iot_node_t*) node;
 }
 
-static void iot_node_insert (iot_data_map_t * map, iot_data_t * key, iot_data_t * value)
+// Searches of the common key types are specialised, so that the comparison is inlined in the search loop
+
+static iot_node_t * iot_node_find (const iot_data_map_t * map, const iot_data_t * key)
+{
+  switch ((key->type == map->base.key_type) ? key->type : IOT_DATA_MULTI)
+  {
+    case IOT_DATA_INT8: case IOT_DATA_UINT8: case IOT_DATA_INT16: case IOT_DATA_UINT16: case IOT_DATA_INT32: case IOT_DATA_UINT32:
+      return iot_node_search (map->tree, key, NULL, true);
+    case IOT_DATA_INT64: return iot_node_search (map->tree, key, iot_data_key_cmp_i64, false);
+    case IOT_DATA_UINT64: return iot_node_search (map->tree, key, iot_data_key_cmp_ui64, false);
+    case IOT_DATA_STRING: return iot_node_search (map->tree, key, iot_data_key_cmp_str, false);
+    default: return iot_node_search (map->tree, key, iot_map_key_cmp (map, key), false);
+  }
+}
+
+static inline uint32_t iot_map_index_slot (const iot_map_index_t * index, const iot_data_t * key)
+{
+  return (iot_data_hash (key) * 0x9e3779b1u) & (index->capacity - 1u); // Fibonacci hashing spreads sequential keys
+}
+
+static void iot_map_index_insert (iot_data_map_t * map, iot_node_t * node);
+
+static void iot_map_index_rebuild (iot_data_map_t * map)
+{
+  uint32_t capacity = IOT_MAP_INDEX_MIN;
+  while (capacity < (4u * (map->size + 1u))) capacity <<= 1; // Rebuild to a load factor of at most a quarter
+  free (map->index);
+  map->index = calloc (1, sizeof (*map->index) + capacity * sizeof (iot_node_t*));
+  map->index->capacity = capacity;
+  for (iot_node_t * node = iot_node_start (map->tree); node; node = iot_node_next (node))
+  {
+    iot_map_index_insert (map, node);
+  }
+}
+
+static void iot_map_index_insert (iot_data_map_t * map, iot_node_t * node)
+{
+  iot_map_index_t * index = map->index;
+  if ((2u * (index->used + 1u)) > index->capacity) // Keep load factor, including deleted slots, at most a half
+  {
+    iot_map_index_rebuild (map);
+    return; // Rebuild indexes all nodes in tree, including this one
+  }
+  uint32_t mask = index->capacity - 1u;
+  uint32_t slot = iot_map_index_slot (index, node->key);
+  while (index->slots[slot]) slot = (slot + 1u) & mask;
+  index->slots[slot] = node;
+  index->used++;
+}
+
+static iot_node_t ** iot_map_index_find (const iot_data_map_t * map, const iot_data_t * key)
+{
+  const iot_map_index_t * index = map->index;
+  iot_data_key_cmp_fn cmp_fn = iot_map_key_cmp (map, key);
+  uint32_t mask = index->capacity - 1u;
+  uint32_t slot = iot_map_index_slot (index, key);
+  uint32_t hash = iot_data_hash (key);
+  iot_node_t * const * ptr;
+  while (*(ptr = &index->slots[slot]))
+  {
+    const iot_node_t * node = *ptr;
+    if ((node != &iot_map_index_deleted) && (iot_data_hash (node->key) == hash) && (cmp_fn (node->key, key) == 0)) return (iot_node_t**) ptr;
+    slot = (slot + 1u) & mask;
+  }
+  return NULL;
+}
+
+static inline iot_node_t * iot_map_find (const iot_data_map_t * map, const iot_data_t * key)
+{
+  if (map->index)
+  {
+    iot_node_t ** ptr = iot_map_index_find (map, key);
+    return ptr ? *ptr : NULL;
+  }
+  return iot_node_find (map, key);
+}
+
+// Find the parent of a node to be inserted, and whether the node is its left child, comparing as for iot_node_search
+
+static inline iot_node_t * iot_node_parent (iot_node_t * x, const iot_node_t * node, iot_data_key_cmp_fn cmp_fn, bool inlined, bool * left)
 {
-  iot_node_t * node = iot_node_alloc (NULL, key, value);
   iot_node_t * y = NULL;
-  iot_node_t * x = map->tree;
   while (x)
   {
     y = x;
-    x = (iot_data_cmp (key, x->key, false) < 0) ? x->left : x->right;
+    *left = inlined ? (node->ikey < x->ikey) : (cmp_fn (node->key, x->key) < 0);
+    x = *left ? x->left : x->right;
+  }
+  return y;
+}
+
+static void iot_node_insert (iot_data_map_t * map, iot_data_t * key, iot_data_t * value)
+{
+  iot_node_t * node = iot_node_alloc (NULL, key, value);
+  iot_node_t * y;
+  bool left = false;
+  switch ((key->type == map->base.key_type) ? key->type : IOT_DATA_MULTI)
+  {
+    case IOT_DATA_INT8: case IOT_DATA_UINT8: case IOT_DATA_INT16: case IOT_DATA_UINT16: case IOT_DATA_INT32: case IOT_DATA_UINT32:
+      y = iot_node_parent (map->tree, node, NULL, true, &left); break;
+    case IOT_DATA_INT64: y = iot_node_parent (map->tree, node, iot_data_key_cmp_i64, false, &left); break;
+    case IOT_DATA_UINT64: y = iot_node_parent (map->tree, node, iot_data_key_cmp_ui64, false, &left); break;
+    case IOT_DATA_STRING: y = iot_node_parent (map->tree, node, iot_data_key_cmp_str, false, &left); break;
+    default: y = iot_node_parent (map->tree, node, iot_map_key_cmp (map, key), false, &left); break;
   }
   node->parent = y;
   if (y == NULL) map->tree = node;
-  else if (iot_data_cmp (key, y->key, false) < 0) y->left = node;
+  else if (left) y->left = node;
   else y->right = node;
 
   if (node->parent)
@@ -3130,6 +5693,194 @@ static void iot_node_insert (iot_data_map_t * map, iot_data_t * key, iot_data_t
   {
     node->colour = IOT_NODE_BLACK;
   }
+  if (map->index) iot_map_index_insert (map, node);
+}
+
+// Build a balanced subtree from sorted keys and values. Nodes at the red depth (the deepest level
+// of an imperfect tree) are red, all others black, so all paths have the same black height.
+
+static iot_node_t * iot_node_build (iot_data_t ** keys, iot_data_t ** values, uint32_t lo, uint32_t hi, iot_node_t * parent, uint32_t depth, uint32_t red)
+{
+  if (lo >= hi) return NULL;
+  uint32_t mid = lo + (hi - lo) / 2u;
+  iot_node_t * node = iot_node_alloc (parent, keys[mid], values[mid]);
+  node->colour = (depth == red) ? IOT_NODE_RED : IOT_NODE_BLACK;
+  node->left = iot_node_build (keys, values, lo, mid, node, depth + 1u, red);
+  node->right = iot_node_build (keys, values, mid + 1u, hi, node, depth + 1u, red);
+  return node;
+}
+
+// Build the tree of an empty map from strictly ascending keys in linear time
+
+static void iot_map_build (iot_data_map_t * map, iot_data_t ** keys, iot_data_t ** values, uint32_t count)
+{
+  uint32_t depth = 0u;
+  assert (map->tree == NULL);
+  for (uint32_t n = count; n > 1u; n >>= 1) depth++;
+  map->tree = iot_node_build (keys, values, 0u, count, NULL, 0u, depth ? depth : UINT32_MAX);
+  map->size = count;
+  for (uint32_t i = 0; i < count; i++) iot_data_map_hash (&map->base, keys[i], values[i]);
+  if (map->index) iot_map_index_rebuild (map);
+}
+
+// Link a balanced subtree of constant map entries sorted by key, coloured as for iot_node_build
+
+static iot_node_t * iot_node_link (iot_node_t * nodes, uint32_t lo, uint32_t hi, iot_node_t * parent, uint32_t depth, uint32_t red)
+{
+  if (lo >= hi) return NULL;
+  uint32_t mid = lo + (hi - lo) / 2u;
+  iot_node_t * node = &nodes[mid];
+  node->parent = parent;
+  node->colour = (depth == red) ? IOT_NODE_RED : IOT_NODE_BLACK;
+  node->left = iot_node_link (nodes, lo, mid, node, depth + 1u, red);
+  node->right = iot_node_link (nodes, mid + 1u, hi, node, depth + 1u, red);
+  return node;
+}
+
+static int iot_node_key_cmp (const void * n1, const void * n2)
+{
+  return iot_data_cmp (((const iot_node_t*) n1)->key, ((const iot_node_t*) n2)->key, false);
+}
+
+// Build a constant map from entries whose keys and values are set, sorting the entries then linking them as a balanced tree
+
+static iot_data_t * iot_data_const_map_build (iot_data_map_static_t * data, iot_node_t * entries, uint32_t count, iot_data_type_t key_type)
+{
+  assert (key_type != IOT_DATA_NULL);
+  iot_data_map_t * map = (iot_data_map_t*) data;
+  uint32_t depth = 0u;
+  memset (data, 0, sizeof (*data));
+  iot_data_block_init (&map->base, IOT_DATA_MAP);
+  map->base.key_type = key_type;
+  map->base.composed = true;
+  map->base.constant = true;
+  if (count)
+  {
+    for (uint32_t i = 0; i < count; i++)
+    {
+      assert (entries[i].key->type == key_type || key_type == IOT_DATA_MULTI);
+      entries[i].ikey = iot_data_inline_key (entries[i].key);
+      iot_data_map_hash (&map->base, entries[i].key, entries[i].value);
+    }
+    qsort (entries, count, sizeof (iot_node_t), iot_node_key_cmp);
+    for (uint32_t i = 1u; i < count; i++) assert (iot_node_key_cmp (&entries[i - 1u], &entries[i]) < 0);
+    for (uint32_t n = count; n > 1u; n >>= 1) depth++;
+    map->tree = iot_node_link (entries, 0u, count, NULL, 0u, depth ? depth : UINT32_MAX);
+    map->size = count;
+  }
+  return (iot_data_t*) map;
+}
+
+iot_data_t * iot_data_alloc_const_map (iot_data_map_static_t * data, iot_data_map_node_static_t * nodes, iot_data_t * const * pairs, uint32_t count, iot_data_type_t key_type)
+{
+  assert (data && (count == 0u || (nodes && pairs)));
+  iot_node_t * entries = (iot_node_t*) nodes;
+  if (count) memset (nodes, 0, count * sizeof (*nodes));
+  for (uint32_t i = 0; i < count; i++)
+  {
+    entries[i].key = pairs[2u * i];
+    entries[i].value = pairs[2u * i + 1u];
+  }
+  return iot_data_const_map_build (data, entries, count, key_type);
+}
+
+iot_data_t * iot_data_alloc_const_string_map (iot_data_map_static_t * data, iot_data_map_node_static_t * nodes, iot_data_static_t * strs, const char * const * pairs, uint32_t count)
+{
+  assert (data && (count == 0u || (nodes && strs && pairs)));
+  iot_node_t * entries = (iot_node_t*) nodes;
+  if (count) memset (nodes, 0, count * sizeof (*nodes));
+  for (uint32_t i = 0; i < count; i++)
+  {
+    entries[i].key = iot_data_alloc_const_string (&strs[2u * i], pairs[2u * i]);
+    entries[i].value = iot_data_alloc_const_string (&strs[2u * i + 1u], pairs[2u * i + 1u]);
+  }
+  iot_data_t * map = iot_data_const_map_build (data, entries, count, IOT_DATA_STRING);
+  map->element_type = IOT_DATA_STRING;
+  return map;
+}
+
+// Merge map contents in key order, then rebuild the map tree. Values of existing keys are replaced.
+
+static void iot_map_merge (iot_data_map_t * map, const iot_data_map_t * add)
+{
+  uint32_t count = 0u;
+  uint32_t size = map->size + add->size;
+  iot_data_t ** keys = malloc (2u * size * sizeof (iot_data_t*));
+  iot_data_t ** values = keys + size;
+  iot_node_t * node = iot_node_start (map->tree);
+  const iot_node_t * anode = iot_node_start (add->tree);
+  while (node || anode)
+  {
+    int cmp = (node && anode) ? iot_map_key_cmp (map, anode->key) (node->key, anode->key) : (node ? -1 : 1);
+    if (cmp <= 0) // Take key and value from existing node
+    {
+      keys[count] = node->key;
+      values[count] = node->value;
+      node->key = node->value = NULL;
+      node = iot_node_next (node);
+    }
+    if (cmp >= 0)
+    {
+      if (cmp == 0) iot_data_free (values[count]);
+      else keys[count] = iot_data_add_ref (anode->key);
+      values[count] = iot_data_add_ref (anode->value);
+      anode = iot_node_next ((iot_node_t*) anode);
+    }
+    count++;
+  }
+  iot_node_free (map, map->tree); // Nodes now empty, so only node blocks freed
+  map->tree = NULL;
+  map->base.hash = 0u;
+  map->base.rehash = false;
+  iot_map_build (map, keys, values, count);
+  free (keys);
+}
+
+// Merge pairs, in strictly ascending key order, with map contents in key order, then rebuild the map tree.
+// Values of existing keys are replaced.
+
+static void iot_map_merge_pairs (iot_data_map_t * map, const iot_data_pair_t * pairs, uint32_t count)
+{
+  uint32_t n = 0u;
+  uint32_t size = map->size + count;
+  iot_data_t ** mkeys = malloc (2u * size * sizeof (iot_data_t*));
+  iot_data_t ** mvalues = mkeys + size;
+  iot_node_t * node = iot_node_start (map->tree);
+  const iot_data_pair_t * pair = pairs;
+  const iot_data_pair_t * end = pairs + count;
+  while (node || (pair < end)) // Merge existing and new pairs in key order, new values replacing existing
+  {
+    int cmp = (node && (pair < end)) ? iot_map_key_cmp (map, pair->key) (node->key, pair->key) : (node ? -1 : 1);
+    if (cmp <= 0) // Take key and value from existing node
+    {
+      mkeys[n] = node->key;
+      mvalues[n] = node->value;
+      node->key = node->value = NULL;
+      node = iot_node_next (node);
+    }
+    if (cmp >= 0)
+    {
+      if (cmp == 0)
+      {
+        iot_data_free (pair->key);
+        iot_data_free (mvalues[n]);
+      }
+      else
+      {
+        mkeys[n] = pair->key;
+      }
+      mvalues[n] = pair->value;
+      pair++;
+    }
+    n++;
+  }
+  iot_node_free (map, map->tree); // Nodes now empty, so only node blocks freed
+  map->tree = NULL;
+  map->base.hash = 0u;
+  map->base.rehash = false;
+  if (! iot_data_alloc_from_heap && ! iot_data_arena_current) iot_data_block_reserve (n);
+  iot_map_build (map, mkeys, mvalues, n);
+  free (mkeys);
 }
 
 static void iot_node_transplant (iot_data_map_t * map, iot_node_t * u, iot_node_t * v)
@@ -3142,9 +5893,11 @@ static void iot_node_transplant (iot_data_map_t * map, iot_node_t * u, iot_node_
 
 static bool iot_node_remove (iot_data_map_t * map, const iot_data_t * key)
 {
-  iot_node_t * z = iot_node_find (map->tree, key);
+  iot_node_t ** slot = map->index ? iot_map_index_find (map, key) : NULL;
+  iot_node_t * z = map->index ? (slot ? *slot : NULL) : iot_node_find (map, key);
   if (z)
   {
+    if (slot) *slot = &iot_map_index_deleted;
     iot_node_t * x;
     iot_node_t * y = z;
     iot_node_colour_t col = y->colour;
@@ -3186,7 +5939,7 @@ static bool iot_node_remove (iot_data_map_t * map, const iot_data_t * key)
 
 static bool iot_node_add (iot_data_map_t * map, iot_data_t * key, iot_data_t * value)
 {
-  iot_node_t * node = iot_node_find (map->tree, key);
+  iot_node_t * node = iot_map_find (map, key);
   if (node)
   {
     map->base.rehash = true;
@@ -3394,3 +6147,332 @@ const iot_data_t *iot_data_iter_value (const iot_data_iter_t * iter)
       return NULL;
   }
 }
+
+#if defined (IOT_HAS_FILE) && !defined (_AZURESPHERE_)
+
+/* Read only data images. Data is written as constant, frozen data blocks, whose pointers are valid when the image
+   is at a preferred base address, followed by a table of the offsets of those pointers. An image mapped at its base
+   address is used in place, so its pages are shared between processes, else it is mapped privately and relocated.
+   Metadata keys (the addresses of library statics) are held in the first page, after the header, and set when the
+   image is opened, so only that page is private to each process. */
+
+#define IOT_DATA_IMAGE_MAGIC "IOTIMG02"
+#define IOT_DATA_IMAGE_MAGIC_LEN 8u
+#define IOT_DATA_IMAGE_ENDIAN 0x01020304u
+#define IOT_DATA_IMAGE_PAGE 65536u // Offset of image data, a multiple of the page size
+#define IOT_DATA_IMAGE_LAYOUT ((uint32_t) (sizeof (void*) | (sizeof (iot_data_t) << 8) | (sizeof (iot_node_t) << 16) | (sizeof (iot_data_map_t) << 24)))
+#if UINTPTR_MAX > UINT32_MAX
+#define IOT_DATA_IMAGE_BASE ((uintptr_t) 0x5e0000000000u)
+#else
+#define IOT_DATA_IMAGE_BASE ((uintptr_t) 0x60000000u)
+#endif
+
+typedef struct iot_data_image_header_t
+{
+  char magic[IOT_DATA_IMAGE_MAGIC_LEN];
+  uint32_t layout;  // Pointer and data structure sizes, so only used by compatible builds
+  uint32_t endian;  // Byte order check
+  uint64_t base;    // Address at which image pointers are valid
+  uint64_t size;    // Size of image, excluding relocation table
+  uint64_t root;    // Offset of root data
+  uint64_t relocs;  // Number of pointer offsets in relocation table
+  iot_data_static_t keys[2]; // Order and shape metadata keys
+} iot_data_image_header_t;
+
+struct iot_data_image_t
+{
+  uint8_t * addr;   // Mapped image
+  size_t len;       // Length of mapping
+  bool shared;      // Whether mapped at base address
+};
+
+typedef struct iot_data_image_builder_t
+{
+  uint8_t * buff;
+  size_t size;
+  size_t capacity;
+  uint64_t * relocs;
+  size_t nrelocs;
+  size_t rcapacity;
+  iot_data_t * written; // Offsets of data written, keyed by address and (for strings) by value
+  bool ok;
+} iot_data_image_builder_t;
+
+static size_t iot_data_image_reserve (iot_data_image_builder_t * b, size_t len)
+{
+  size_t off = (b->size + 7u) & ~(size_t) 7u;
+  if (off + len > b->capacity)
+  {
+    size_t capacity = b->capacity ? b->capacity : 4096u;
+    while (capacity < off + len) capacity *= 2u;
+    b->buff = realloc (b->buff, capacity);
+    memset (b->buff + b->capacity, 0, capacity - b->capacity);
+    b->capacity = capacity;
+  }
+  b->size = off + len;
+  return off;
+}
+
+// Set pointer at slot offset to address of target offset when image at base address, recording the slot for relocation
+
+static void iot_data_image_ptr (iot_data_image_builder_t * b, size_t slot, size_t target)
+{
+  uintptr_t addr = IOT_DATA_IMAGE_BASE + target;
+  memcpy (b->buff + slot, &addr, sizeof (addr));
+  if (b->nrelocs == b->rcapacity)
+  {
+    b->rcapacity = b->rcapacity ? b->rcapacity * 2u : 1024u;
+    b->relocs = realloc (b->relocs, b->rcapacity * sizeof (*b->relocs));
+  }
+  b->relocs[b->nrelocs++] = slot;
+}
+
+#define IOT_DATA_IMAGE_AT(b,off,type) ((type*) ((b)->buff + (off)))
+#define IOT_DATA_IMAGE_SLOT(off,type,field) ((off) + offsetof (type, field))
+
+static size_t iot_data_image_write (iot_data_image_builder_t * b, const iot_data_t * data);
+
+// Link a balanced tree of map nodes, sorted by key, as for iot_node_link
+
+static size_t iot_data_image_link (iot_data_image_builder_t * b, size_t nodes, uint32_t lo, uint32_t hi, size_t parent, uint32_t depth, uint32_t red)
+{
+  if (lo >= hi) return 0u;
+  uint32_t mid = lo + (hi - lo) / 2u;
+  size_t node = nodes + mid * sizeof (iot_node_t);
+  size_t left = iot_data_image_link (b, nodes, lo, mid, node, depth + 1u, red);
+  size_t right = iot_data_image_link (b, nodes, mid + 1u, hi, node, depth + 1u, red);
+  IOT_DATA_IMAGE_AT (b, node, iot_node_t)->colour = (depth == red) ? IOT_NODE_RED : IOT_NODE_BLACK;
+  if (parent) iot_data_image_ptr (b, IOT_DATA_IMAGE_SLOT (node, iot_node_t, parent), parent);
+  if (left) iot_data_image_ptr (b, IOT_DATA_IMAGE_SLOT (node, iot_node_t, left), left);
+  if (right) iot_data_image_ptr (b, IOT_DATA_IMAGE_SLOT (node, iot_node_t, right), right);
+  return node;
+}
+
+static size_t iot_data_image_write_value (iot_data_image_builder_t * b, const iot_data_t * data)
+{
+  size_t off;
+  switch (data->type)
+  {
+    case IOT_DATA_STRING:
+    {
+      const char * str = iot_data_string (data);
+      size_t len = strlen (str) + 1u;
+      off = iot_data_image_reserve (b, sizeof (iot_data_value_base_t));
+      size_t soff = iot_data_image_reserve (b, len);
+      memcpy (b->buff + soff, str, len);
+      iot_data_image_ptr (b, IOT_DATA_IMAGE_SLOT (off, iot_data_value_base_t, value.str), soff);
+      break;
+    }
+    case IOT_DATA_BINARY:
+    case IOT_DATA_ARRAY:
+    {
+      const iot_data_array_t * array = (const iot_data_array_t*) data;
+      size_t size = array->length * iot_data_type_sizes[data->element_type];
+      off = iot_data_image_reserve (b, sizeof (iot_data_array_t));
+      IOT_DATA_IMAGE_AT (b, off, iot_data_array_t)->length = array->length;
+      IOT_DATA_IMAGE_AT (b, off, iot_data_array_t)->capacity = array->length;
+      if (size)
+      {
+        size_t doff = iot_data_image_reserve (b, size);
+        memcpy (b->buff + doff, array->data, size);
+        iot_data_image_ptr (b, IOT_DATA_IMAGE_SLOT (off, iot_data_array_t, data), doff);
+      }
+      break;
+    }
+    case IOT_DATA_VECTOR:
+    {
+      const iot_data_vector_t * vector = (const iot_data_vector_t*) data;
+      off = iot_data_image_reserve (b, sizeof (iot_data_vector_t));
+      size_t voff = iot_data_image_reserve (b, vector->size * sizeof (iot_data_t*));
+      IOT_DATA_IMAGE_AT (b, off, iot_data_vector_t)->size = vector->size;
+      IOT_DATA_IMAGE_AT (b, off, iot_data_vector_t)->capacity = vector->size;
+      if (vector->size) iot_data_image_ptr (b, IOT_DATA_IMAGE_SLOT (off, iot_data_vector_t, values), voff);
+      for (uint32_t i = 0; i < vector->size; i++)
+      {
+        if (vector->values[i]) iot_data_image_ptr (b, voff + i * sizeof (iot_data_t*), iot_data_image_write (b, vector->values[i]));
+      }
+      break;
+    }
+    case IOT_DATA_MAP:
+    {
+      const iot_data_map_t * map = (const iot_data_map_t*) data;
+      uint32_t depth = 0u;
+      uint32_t i = 0u;
+      off = iot_data_image_reserve (b, sizeof (iot_data_map_t));
+      size_t nodes = iot_data_image_reserve (b, map->size * sizeof (iot_node_t));
+      for (iot_node_t * node = iot_node_start (map->tree); node; node = iot_node_next (node), i++)
+      {
+        size_t noff = nodes + i * sizeof (iot_node_t);
+        iot_data_image_ptr (b, IOT_DATA_IMAGE_SLOT (noff, iot_node_t, key), iot_data_image_write (b, node->key));
+        iot_data_image_ptr (b, IOT_DATA_IMAGE_SLOT (noff, iot_node_t, value), iot_data_image_write (b, node->value));
+        IOT_DATA_IMAGE_AT (b, noff, iot_node_t)->ikey = node->ikey;
+      }
+      for (uint32_t n = map->size; n > 1u; n >>= 1) depth++;
+      size_t tree = iot_data_image_link (b, nodes, 0u, map->size, 0u, 0u, depth ? depth : UINT32_MAX);
+      if (tree) iot_data_image_ptr (b, IOT_DATA_IMAGE_SLOT (off, iot_data_map_t, tree), tree);
+      IOT_DATA_IMAGE_AT (b, off, iot_data_map_t)->size = map->size;
+      break;
+    }
+    case IOT_DATA_POINTER:
+    case IOT_DATA_LIST:
+      b->ok = false;
+      return 0u;
+    default:
+      off = iot_data_image_reserve (b, sizeof (iot_data_value_base_t));
+      IOT_DATA_IMAGE_AT (b, off, iot_data_value_base_t)->value = ((const iot_data_value_base_t*) data)->value;
+      break;
+  }
+  iot_data_t * img = IOT_DATA_IMAGE_AT (b, off, iot_data_t);
+  atomic_store (&img->refs, 1u);
+  img->hash = iot_data_hash (data);
+  img->type = data->type;
+  img->element_type = data->element_type;
+  img->key_type = data->key_type;
+  img->composed = data->composed;
+  img->tag1 = data->tag1;
+  img->tag2 = data->tag2;
+  img->constant = true;
+  img->frozen = true;
+  if (data->base.meta) iot_data_image_ptr (b, IOT_DATA_IMAGE_SLOT (off, iot_data_t, base.meta), iot_data_image_write (b, data->base.meta));
+  return off;
+}
+
+// Write data once, whether shared by address or (for strings) equal in value
+
+static size_t iot_data_image_write (iot_data_image_builder_t * b, const iot_data_t * data)
+{
+  if (data == IOT_DATA_STATIC (&iot_data_order)) return offsetof (iot_data_image_header_t, keys[0]);
+  if (data == IOT_DATA_STATIC (&iot_data_shape)) return offsetof (iot_data_image_header_t, keys[1]);
+  iot_data_t * addr = iot_data_alloc_ui64 ((uintptr_t) data);
+  const iot_data_t * found = iot_data_map_get (b->written, addr);
+  if (found == NULL && data->type == IOT_DATA_STRING) found = iot_data_map_get (b->written, data);
+  if (found)
+  {
+    iot_data_free (addr);
+    return (size_t) iot_data_ui64 (found);
+  }
+  size_t off = iot_data_image_write_value (b, data);
+  if (data->type == IOT_DATA_STRING) iot_data_map_add (b->written, iot_data_add_ref (data), iot_data_alloc_ui64 (off));
+  iot_data_map_add (b->written, addr, iot_data_alloc_ui64 (off));
+  return off;
+}
+
+bool iot_data_image_save (const iot_data_t * data, const char * path)
+{
+  assert (data && path);
+  iot_data_image_builder_t b = { .written = iot_data_alloc_map (IOT_DATA_MULTI), .ok = true };
+  size_t header = iot_data_image_reserve (&b, IOT_DATA_IMAGE_PAGE);
+  size_t root = iot_data_image_write (&b, data);
+  size_t size = (b.size + 7u) & ~(size_t) 7u;
+  size_t table = iot_data_image_reserve (&b, b.nrelocs * sizeof (uint64_t));
+  if (b.nrelocs) memcpy (b.buff + table, b.relocs, b.nrelocs * sizeof (uint64_t));
+  iot_data_image_header_t * hdr = IOT_DATA_IMAGE_AT (&b, header, iot_data_image_header_t);
+  memcpy (hdr->magic, IOT_DATA_IMAGE_MAGIC, IOT_DATA_IMAGE_MAGIC_LEN);
+  hdr->layout = IOT_DATA_IMAGE_LAYOUT;
+  hdr->endian = IOT_DATA_IMAGE_ENDIAN;
+  hdr->base = IOT_DATA_IMAGE_BASE;
+  hdr->size = size;
+  hdr->root = root;
+  hdr->relocs = b.nrelocs;
+  bool ok = b.ok && iot_file_write_binary (path, b.buff, b.size);
+  iot_data_free (b.written);
+  free (b.relocs);
+  free (b.buff);
+  return ok;
+}
+
+// Set the metadata keys in the (writable) first page of an image
+
+static void iot_data_image_keys (uint8_t * addr)
+{
+  iot_data_image_header_t * hdr = (iot_data_image_header_t*) addr;
+  iot_data_alloc_const_pointer (&hdr->keys[0], &iot_data_order)->frozen = true;
+  iot_data_alloc_const_pointer (&hdr->keys[1], &iot_data_shape)->frozen = true;
+}
+
+iot_data_image_t * iot_data_image_open (const char * path)
+{
+  assert (path);
+  iot_data_image_t * image = NULL;
+  iot_data_image_header_t hdr;
+  struct stat st;
+  int fd = open (path, O_RDONLY);
+  if (fd == -1) return NULL;
+  if
+  (
+    fstat (fd, &st) == 0 && pread (fd, &hdr, sizeof (hdr), 0) == (ssize_t) sizeof (hdr) &&
+    memcmp (hdr.magic, IOT_DATA_IMAGE_MAGIC, IOT_DATA_IMAGE_MAGIC_LEN) == 0 &&
+    hdr.layout == IOT_DATA_IMAGE_LAYOUT && hdr.endian == IOT_DATA_IMAGE_ENDIAN && hdr.base == IOT_DATA_IMAGE_BASE &&
+    hdr.size <= (uint64_t) st.st_size && hdr.relocs == ((uint64_t) st.st_size - hdr.size) / sizeof (uint64_t) &&
+    hdr.size + hdr.relocs * sizeof (uint64_t) == (uint64_t) st.st_size && hdr.root >= IOT_DATA_IMAGE_PAGE && hdr.root < hdr.size &&
+    sysconf (_SC_PAGESIZE) <= (long) IOT_DATA_IMAGE_PAGE
+  )
+  {
+    size_t len = (size_t) hdr.size;
+    uint8_t * addr = mmap ((void*) IOT_DATA_IMAGE_BASE, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    bool ok = (addr != MAP_FAILED);
+    if (ok && addr != (uint8_t*) IOT_DATA_IMAGE_BASE) // Base address in use, so map privately and relocate
+    {
+      munmap (addr, len);
+      len = (size_t) st.st_size;
+      addr = mmap (NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      ok = (addr != MAP_FAILED);
+      const uint64_t * relocs = (const uint64_t*) (addr + hdr.size);
+      uintptr_t delta = (uintptr_t) addr - IOT_DATA_IMAGE_BASE;
+      for (uint64_t i = 0; i < hdr.relocs && ok; i++)
+      {
+        uintptr_t ptr;
+        ok = (relocs[i] >= sizeof (hdr)) && (relocs[i] + sizeof (ptr) <= hdr.size);
+        if (ok)
+        {
+          memcpy (&ptr, addr + relocs[i], sizeof (ptr));
+          ptr += delta;
+          memcpy (addr + relocs[i], &ptr, sizeof (ptr));
+        }
+      }
+      if (ok) iot_data_image_keys (addr);
+      ok = ok && (mprotect (addr, len, PROT_READ) == 0);
+    }
+    else if (ok) // Only first page written, so other pages remain shared
+    {
+      ok = (mprotect (addr, IOT_DATA_IMAGE_PAGE, PROT_READ | PROT_WRITE) == 0);
+      if (ok) iot_data_image_keys (addr);
+      ok = ok && (mprotect (addr, IOT_DATA_IMAGE_PAGE, PROT_READ) == 0);
+    }
+    if (ok)
+    {
+      image = calloc (1u, sizeof (*image));
+      image->addr = addr;
+      image->len = len;
+      image->shared = (addr == (uint8_t*) IOT_DATA_IMAGE_BASE);
+    }
+    else if (addr != MAP_FAILED)
+    {
+      munmap (addr, len);
+    }
+  }
+  close (fd);
+  return image;
+}
+
+const iot_data_t * iot_data_image_root (const iot_data_image_t * image)
+{
+  assert (image);
+  return (const iot_data_t*) (image->addr + ((const iot_data_image_header_t*) image->addr)->root);
+}
+
+bool iot_data_image_is_shared (const iot_data_image_t * image)
+{
+  assert (image);
+  return image->shared;
+}
+
+void iot_data_image_close (iot_data_image_t * image)
+{
+  if (image)
+  {
+    munmap (image->addr, image->len);
+    free (image);
+  }
+}
+#endif
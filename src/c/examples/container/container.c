@@ -89,6 +89,7 @@ static const char * pool_config =
   "\"Threads\":2,"
   "\"MaxJobs\":10,"
   "\"ShutdownDelay\":500,"
+  "\"WorkStealing\":false,"
   "\"Logger\":\"logger\""
 "}";
 
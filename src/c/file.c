@@ -71,6 +71,15 @@ extern bool iot_file_delete (const char * path)
 #else // _AZURESPHERE_
 #include <dirent.h>
 #include <regex.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#define IOT_FILE_INOTIFY
+#include <sys/inotify.h>
+#endif
+
+#define IOT_FILE_MMAP_MIN 65536u // Files of at least this size are read via a memory mapping
 
 bool iot_file_delete (const char * path)
 {
@@ -78,32 +87,90 @@ bool iot_file_delete (const char * path)
   return (remove (path) == 0);
 }
 
+static bool iot_file_read_fd (int fd, uint8_t * buff, size_t size)
+{
+  while (size)
+  {
+    ssize_t ret = read (fd, buff, size);
+    if (ret <= 0)
+    {
+      if (ret < 0 && errno == EINTR) continue;
+      return false;
+    }
+    buff += ret;
+    size -= (size_t) ret;
+  }
+  return true;
+}
+
+static const uint8_t * iot_file_map_fd (int fd, size_t size)
+{
+  void * addr = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) return NULL;
+#ifdef MADV_SEQUENTIAL
+  madvise (addr, size, MADV_SEQUENTIAL);
+#endif
+  return addr;
+}
+
 uint8_t * iot_file_read_binary (const char * path, size_t * len)
 {
   assert (path);
   uint8_t * ret = NULL;
   size_t size = 0;
+  struct stat st;
 
-  FILE * fd = fopen (path, "r");
-  if (fd)
+  int fd = open (path, O_RDONLY);
+  if (fd != -1)
   {
-    fseek (fd, 0, SEEK_END);
-    size = ftell (fd);
-    if (size) // Return NULL if file empty
+    if (fstat (fd, &st) == 0 && st.st_size > 0) // Return NULL if file empty
     {
-      rewind (fd);
+      size = (size_t) st.st_size;
       ret = malloc (size + 1); // Allocate extra byte so can be NULL terminated if a string
-      size_t items = fread (ret, size, 1u, fd);
-      assert (items == 1);
-      (void) items;
-      ret[size] = 0; // String NULL terminator
+      const uint8_t * addr = (size >= IOT_FILE_MMAP_MIN) ? iot_file_map_fd (fd, size) : NULL;
+      if (addr) // Copy directly from page cache, avoiding read system calls
+      {
+        memcpy (ret, addr, size);
+        munmap ((void*) addr, size);
+      }
+      else if (! iot_file_read_fd (fd, ret, size))
+      {
+        free (ret);
+        ret = NULL;
+        size = 0;
+      }
+      if (ret) ret[size] = 0; // String NULL terminator
     }
-    fclose (fd);
+    close (fd);
   }
   if (len) *len = size;
   return ret;
 }
 
+const uint8_t * iot_file_map (const char * path, size_t * len)
+{
+  assert (path && len);
+  const uint8_t * addr = NULL;
+  struct stat st;
+  *len = 0;
+
+  int fd = open (path, O_RDONLY);
+  if (fd != -1)
+  {
+    if (fstat (fd, &st) == 0 && st.st_size > 0 && (addr = iot_file_map_fd (fd, (size_t) st.st_size)))
+    {
+      *len = (size_t) st.st_size;
+    }
+    close (fd);
+  }
+  return addr;
+}
+
+void iot_file_unmap (const uint8_t * addr, size_t len)
+{
+  if (addr) munmap ((void*) addr, len);
+}
+
 bool iot_file_write_binary (const char * path, const uint8_t * binary, size_t len)
 {
   assert (path && binary);
@@ -160,5 +227,187 @@ DONE:
   return list;
 }
 
+/*
+ * Cached directory index. Matching file names are held in a map, updated from inotify events where supported
+ * so that a listing only costs the changes since the last. Otherwise, or if events were lost, the directory is
+ * scanned again if its modification time has changed. As modification times may be coarse, a directory
+ * modified within IOT_FILE_INDEX_RACY_NS of being scanned is always scanned again.
+ */
+
+#define IOT_FILE_INDEX_RACY_NS 1000000000u
+#define IOT_FILE_INDEX_EVENT_BUFF 4096u
+
+struct iot_file_index_t
+{
+  char * directory;
+  regex_t regex;
+  bool has_regex;
+  iot_data_t * names;       // Map of matching file names, NULL if directory could not be read
+  int fd;                   // inotify descriptor, -1 if scanning on modification
+  struct timespec mtime;    // Directory modification time when scanned
+  bool racy;                // Directory modified close to being scanned, so must be scanned again
+  pthread_mutex_t mutex;
+};
+
+static bool iot_file_index_match (const iot_file_index_t * index, const char * name)
+{
+  return ! index->has_regex || regexec (&index->regex, name, 0, NULL, 0) == 0;
+}
+
+static void iot_file_index_scan (iot_file_index_t * index)
+{
+  struct stat st;
+  struct timespec now;
+  iot_data_free (index->names);
+  index->names = NULL;
+  DIR * d = opendir (index->directory);
+  if (d == NULL) return;
+  if (fstat (dirfd (d), &st) == 0)
+  {
+    index->mtime = st.st_mtim;
+    clock_gettime (CLOCK_REALTIME, &now);
+    uint64_t modified = (uint64_t) st.st_mtim.tv_sec * 1000000000u + (uint64_t) st.st_mtim.tv_nsec;
+    index->racy = (modified + IOT_FILE_INDEX_RACY_NS) >= ((uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec);
+  }
+  index->names = iot_data_alloc_map (IOT_DATA_STRING);
+  const struct dirent * dir;
+  while ((dir = readdir (d)))
+  {
+    if (dir->d_type == DT_REG && iot_file_index_match (index, dir->d_name))
+    {
+      iot_data_map_add (index->names, iot_data_alloc_string (dir->d_name, IOT_DATA_COPY), iot_data_alloc_bool (true));
+    }
+  }
+  closedir (d);
+}
+
+#ifdef IOT_FILE_INOTIFY
+// Apply pending inotify events, returns false if the directory must be scanned again
+
+static bool iot_file_index_events (iot_file_index_t * index)
+{
+  char buff[IOT_FILE_INDEX_EVENT_BUFF] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  ssize_t len;
+  while ((len = read (index->fd, buff, sizeof (buff))) > 0)
+  {
+    for (const char * ptr = buff; ptr < buff + len; )
+    {
+      const struct inotify_event * event = (const struct inotify_event*) ptr;
+      ptr += sizeof (*event) + event->len;
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) // Watch removed, so scan on modification
+      {
+        close (index->fd);
+        index->fd = -1;
+        iot_data_free (index->names);
+        index->names = NULL;
+        return false;
+      }
+      if (event->mask & IN_Q_OVERFLOW) return false;
+      if (event->len == 0 || (event->mask & IN_ISDIR) || ! iot_file_index_match (index, event->name)) continue;
+      if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+      {
+        iot_data_string_map_remove (index->names, event->name);
+      }
+      else
+      {
+        struct stat st;
+        size_t plen = strlen (index->directory) + event->len + 2u;
+        char * full = malloc (plen);
+        snprintf (full, plen, "%s/%s", index->directory, event->name);
+        if (lstat (full, &st) == 0 && S_ISREG (st.st_mode))
+        {
+          iot_data_map_add (index->names, iot_data_alloc_string (event->name, IOT_DATA_COPY), iot_data_alloc_bool (true));
+        }
+        free (full);
+      }
+    }
+  }
+  return (len < 0 && errno == EAGAIN);
+}
+#endif
+
+static void iot_file_index_refresh (iot_file_index_t * index)
+{
+#ifdef IOT_FILE_INOTIFY
+  if (index->fd != -1)
+  {
+    if (index->names && iot_file_index_events (index)) return;
+    if (index->fd != -1)
+    {
+      iot_file_index_scan (index);
+      return;
+    }
+  }
+#endif
+  struct stat st;
+  if (stat (index->directory, &st) != 0)
+  {
+    iot_data_free (index->names);
+    index->names = NULL;
+  }
+  else if (index->racy || index->names == NULL || st.st_mtim.tv_sec != index->mtime.tv_sec || st.st_mtim.tv_nsec != index->mtime.tv_nsec)
+  {
+    iot_file_index_scan (index);
+  }
+}
+
+iot_file_index_t * iot_file_index_alloc (const char * directory, const char * regex_str)
+{
+  assert (directory);
+  iot_file_index_t * index = calloc (1u, sizeof (*index));
+  if (regex_str)
+  {
+    if (regcomp (&index->regex, regex_str, REG_NOSUB) != 0)
+    {
+      free (index);
+      return NULL;
+    }
+    index->has_regex = true;
+  }
+  index->directory = strdup (directory);
+  index->fd = -1;
+#ifdef IOT_FILE_INOTIFY
+  index->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (index->fd != -1 && inotify_add_watch (index->fd, directory, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR) == -1)
+  {
+    close (index->fd);
+    index->fd = -1;
+  }
+#endif
+  iot_mutex_init (&index->mutex);
+  iot_file_index_scan (index);
+  return index;
+}
+
+iot_data_t * iot_file_index_list (iot_file_index_t * index)
+{
+  assert (index);
+  iot_data_t * list = NULL;
+  iot_data_map_iter_t iter;
+  pthread_mutex_lock (&index->mutex);
+  iot_file_index_refresh (index);
+  if (index->names)
+  {
+    list = iot_data_alloc_list ();
+    iot_data_map_iter (index->names, &iter);
+    while (iot_data_map_iter_next (&iter)) iot_data_list_tail_push (list, iot_data_add_ref (iot_data_map_iter_key (&iter)));
+  }
+  pthread_mutex_unlock (&index->mutex);
+  return list;
+}
+
+void iot_file_index_free (iot_file_index_t * index)
+{
+  if (index)
+  {
+    if (index->fd != -1) close (index->fd);
+    if (index->has_regex) regfree (&index->regex);
+    iot_data_free (index->names);
+    pthread_mutex_destroy (&index->mutex);
+    free (index->directory);
+    free (index);
+  }
+}
+
 #endif
 #endif
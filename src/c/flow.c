@@ -0,0 +1,80 @@
+//
+// Copyright (c) 2024 IOTech
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+
+#include "iot/flow.h"
+
+struct iot_flow_t
+{
+  uint32_t high;                     // High watermark
+  uint32_t low;                      // Low watermark
+  iot_flow_fn_t fn;                  // Congestion callback, NULL if none
+  void * arg;                        // Callback argument
+  atomic_bool congested;             // Whether congested
+  _Atomic uint32_t level;            // Last level
+  _Atomic uint64_t congestions;      // Number of times congested
+  atomic_int_fast32_t refs;          // Current reference count
+};
+
+iot_flow_t * iot_flow_alloc (uint32_t high, uint32_t low, iot_flow_fn_t fn, void * arg)
+{
+  assert (low < high);
+  iot_flow_t * flow = (iot_flow_t*) calloc (1u, sizeof (*flow));
+  flow->high = high;
+  flow->low = low;
+  flow->fn = fn;
+  flow->arg = arg;
+  atomic_store (&flow->refs, 1u);
+  return flow;
+}
+
+void iot_flow_update (iot_flow_t * flow, uint32_t level)
+{
+  assert (flow);
+  atomic_store_explicit (&flow->level, level, memory_order_relaxed);
+  bool congested = atomic_load_explicit (&flow->congested, memory_order_relaxed);
+  if (! congested && level >= flow->high)
+  {
+    // Only the thread making the change calls back, so calls alternate between congested and not
+    if (atomic_compare_exchange_strong (&flow->congested, &congested, true))
+    {
+      atomic_fetch_add_explicit (&flow->congestions, 1u, memory_order_relaxed);
+      if (flow->fn) flow->fn (flow->arg, true);
+    }
+  }
+  else if (congested && level <= flow->low)
+  {
+    if (atomic_compare_exchange_strong (&flow->congested, &congested, false))
+    {
+      if (flow->fn) flow->fn (flow->arg, false);
+    }
+  }
+}
+
+bool iot_flow_congested (const iot_flow_t * flow)
+{
+  assert (flow);
+  return atomic_load (&flow->congested);
+}
+
+iot_data_t * iot_flow_stats (const iot_flow_t * flow)
+{
+  assert (flow);
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_data_string_map_add (map, "level", iot_data_alloc_ui32 (atomic_load (&flow->level)));
+  iot_data_string_map_add (map, "congested", iot_data_alloc_bool (atomic_load (&flow->congested)));
+  iot_data_string_map_add (map, "congestions", iot_data_alloc_ui64 (atomic_load (&flow->congestions)));
+  return map;
+}
+
+void iot_flow_add_ref (iot_flow_t * flow)
+{
+  if (flow) atomic_fetch_add (&flow->refs, 1u);
+}
+
+void iot_flow_free (iot_flow_t * flow)
+{
+  if (flow && (atomic_fetch_sub (&flow->refs, 1u) <= 1u)) free (flow);
+}
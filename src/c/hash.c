@@ -7,19 +7,131 @@
 
 #include "iot/hash.h"
 
-/* Version 2 of the Bernstein djb2 hash function. */
+/* Word at a time hash after wyhash (final version 4) by Wang Yi, folded to 32 bits. */
 
-uint32_t iot_hash (const char * str)
+static const uint64_t iot_hash_secret[4] = { 0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull };
+
+static inline void iot_hash_mum (uint64_t * a, uint64_t * b)
 {
-  uint32_t hash = 538u;
-  while (*str)
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = (__uint128_t) *a * *b;
+  *a = (uint64_t) r;
+  *b = (uint64_t) (r >> 64);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t) *a, lb = (uint32_t) *b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32), lo = t + (rm1 << 32);
+  uint64_t c = (t < rl) + (lo < t);
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t iot_hash_mix (uint64_t a, uint64_t b)
+{
+  iot_hash_mum (&a, &b);
+  return a ^ b;
+}
+
+static inline uint64_t iot_hash_read8 (const uint8_t * p)
+{
+  uint64_t v;
+  memcpy (&v, p, sizeof (v));
+  return v;
+}
+
+static inline uint64_t iot_hash_read4 (const uint8_t * p)
+{
+  uint32_t v;
+  memcpy (&v, p, sizeof (v));
+  return v;
+}
+
+static inline uint64_t iot_hash_read3 (const uint8_t * p, size_t k)
+{
+  return (((uint64_t) p[0]) << 16) | (((uint64_t) p[k >> 1]) << 8) | p[k - 1];
+}
+
+static uint64_t iot_hash_wy (const uint8_t * p, size_t len, uint64_t seed)
+{
+  const uint64_t * s = iot_hash_secret;
+  uint64_t a, b;
+  seed ^= iot_hash_mix (seed ^ s[0], s[1]);
+  if (len <= 16u)
   {
-    hash = ((hash << 5u) + hash) ^ (uint8_t) *str++;
+    if (len >= 4u)
+    {
+      a = (iot_hash_read4 (p) << 32) | iot_hash_read4 (p + ((len >> 3) << 2));
+      b = (iot_hash_read4 (p + len - 4) << 32) | iot_hash_read4 (p + len - 4 - ((len >> 3) << 2));
+    }
+    else if (len > 0u)
+    {
+      a = iot_hash_read3 (p, len);
+      b = 0u;
+    }
+    else
+    {
+      a = b = 0u;
+    }
   }
-  return hash;
+  else
+  {
+    size_t i = len;
+    if (i > 48u)
+    {
+      uint64_t see1 = seed, see2 = seed;
+      do
+      {
+        seed = iot_hash_mix (iot_hash_read8 (p) ^ s[1], iot_hash_read8 (p + 8) ^ seed);
+        see1 = iot_hash_mix (iot_hash_read8 (p + 16) ^ s[2], iot_hash_read8 (p + 24) ^ see1);
+        see2 = iot_hash_mix (iot_hash_read8 (p + 32) ^ s[3], iot_hash_read8 (p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48u);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16u)
+    {
+      seed = iot_hash_mix (iot_hash_read8 (p) ^ s[1], iot_hash_read8 (p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = iot_hash_read8 (p + i - 16);
+    b = iot_hash_read8 (p + i - 8);
+  }
+  a ^= s[1];
+  b ^= seed;
+  iot_hash_mum (&a, &b);
+  return iot_hash_mix (a ^ s[0] ^ len, b ^ s[1]);
+}
+
+static inline uint32_t iot_hash_fold (uint64_t hash)
+{
+  return (uint32_t) (hash ^ (hash >> 32));
+}
+
+uint32_t iot_hash (const char * str)
+{
+  return iot_hash_fold (iot_hash_wy ((const uint8_t*) str, strlen (str), 0u));
 }
 
 uint32_t iot_hash_data (const uint8_t * data, size_t len)
+{
+  return iot_hash_fold (iot_hash_wy (data, len, 0u));
+}
+
+uint32_t iot_hash_seeded (const char * str, uint64_t seed)
+{
+  return iot_hash_fold (iot_hash_wy ((const uint8_t*) str, strlen (str), seed));
+}
+
+uint32_t iot_hash_data_seeded (const uint8_t * data, size_t len, uint64_t seed)
+{
+  return iot_hash_fold (iot_hash_wy (data, len, seed));
+}
+
+/* Version 2 of the Bernstein djb2 hash function. */
+
+uint32_t iot_hash_djb2 (const uint8_t * data, size_t len)
 {
   uint32_t hash = 538u;
   while (len--)
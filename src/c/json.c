@@ -9,6 +9,136 @@
 //   Copyright (c) 2010 Serge A. Zaitsev SPDX-License-Identifier: MIT
 //
 #include "iot/json.h"
+
+/* Stage one structural scanning, after simdjson. Input is classified eight bytes at a time using word
+ * (SWAR) operations, giving a bit mask per character class for each 64 byte block. Portable in place of
+ * SIMD instructions.
+ */
+
+#define IOT_JSON_BLOCK 64u
+#define IOT_JSON_ONES 0x0101010101010101ull
+#define IOT_JSON_HIGH 0x8080808080808080ull
+#define IOT_JSON_LOW 0x7f7f7f7f7f7f7f7full
+#define IOT_JSON_GATHER 0x0102040810204080ull
+
+typedef struct iot_json_block_t
+{
+  uint64_t quote;      /**< Quote characters */
+  uint64_t backslash;  /**< Backslash characters */
+  uint64_t open;       /**< Object or array start */
+  uint64_t other;      /**< Object or array end, comma, colon and whitespace */
+} iot_json_block_t;
+
+static inline uint64_t iot_json_load (const char * ptr)
+{
+  uint64_t word;
+  memcpy (&word, ptr, sizeof (word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64 (word);
+#endif
+  return word;
+}
+
+/* High bit set in each byte equal to c */
+static inline uint64_t iot_json_eq (uint64_t word, uint8_t c)
+{
+  uint64_t t = word ^ (IOT_JSON_ONES * c);
+  return ~(((t & IOT_JSON_LOW) + IOT_JSON_LOW) | t) & IOT_JSON_HIGH;
+}
+
+/* High bit set in each byte less than c (c <= 0x80) */
+static inline uint64_t iot_json_lt (uint64_t word, uint8_t c)
+{
+  return ~(((word & IOT_JSON_LOW) + (IOT_JSON_ONES * (uint8_t) (0x80u - c))) | word) & IOT_JSON_HIGH;
+}
+
+/* Gather byte high bits into one bit per byte */
+static inline uint64_t iot_json_bits (uint64_t mask)
+{
+  return ((mask >> 7) * IOT_JSON_GATHER) >> 56;
+}
+
+static inline bool iot_json_plain_word (uint64_t word)
+{
+  return (iot_json_eq (word, '"') | iot_json_eq (word, '\\') | iot_json_eq (word, 0u)) == 0u;
+}
+
+static void iot_json_classify (const char * ptr, iot_json_block_t * block)
+{
+  memset (block, 0, sizeof (*block));
+  for (uint32_t i = 0; i < IOT_JSON_BLOCK; i += 8u)
+  {
+    uint64_t word = iot_json_load (ptr + i);
+    uint64_t folded = word | (IOT_JSON_ONES * 0x20u); /* Maps '[' to '{' and ']' to '}' */
+    block->quote |= iot_json_bits (iot_json_eq (word, '"')) << i;
+    block->backslash |= iot_json_bits (iot_json_eq (word, '\\')) << i;
+    block->open |= iot_json_bits (iot_json_eq (folded, '{')) << i;
+    block->other |= iot_json_bits (iot_json_eq (folded, '}') | iot_json_eq (word, ',') | iot_json_eq (word, ':') | iot_json_lt (word, 0x21u)) << i;
+  }
+}
+
+/* Characters escaped by a preceding (unescaped) backslash. Backslashes are rare, so handled in turn. */
+static inline uint64_t iot_json_escaped (uint64_t backslash, uint64_t * carry)
+{
+  uint64_t escaped = *carry;
+  backslash &= ~escaped;
+  *carry = 0u;
+  while (backslash)
+  {
+    uint64_t bit = backslash & (~backslash + 1u);
+    if (bit >> 63) *carry = 1u;
+    escaped |= bit << 1;
+    backslash &= ~(bit | (bit << 1));
+  }
+  return escaped;
+}
+
+/* Prefix xor, setting bits from an opening quote up to (not including) the closing quote */
+static inline uint64_t iot_json_prefix_xor (uint64_t bits)
+{
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+}
+
+uint32_t iot_json_count (const char * json, size_t len)
+{
+  uint32_t count = 0u;
+  uint64_t escape_carry = 0u;
+  uint64_t string_carry = 0u;
+  uint64_t scalar_carry = 0u;
+  char buff[IOT_JSON_BLOCK];
+  iot_json_block_t block;
+
+  for (size_t pos = 0u; pos < len; pos += IOT_JSON_BLOCK)
+  {
+    uint64_t valid = UINT64_MAX;
+    if ((len - pos) < IOT_JSON_BLOCK) /* Copy final partial block */
+    {
+      memset (buff, ' ', sizeof (buff));
+      memcpy (buff, json + pos, len - pos);
+      iot_json_classify (buff, &block);
+      valid = (1ull << (len - pos)) - 1u;
+    }
+    else
+    {
+      iot_json_classify (json + pos, &block);
+    }
+    uint64_t quote = block.quote & ~iot_json_escaped (block.backslash, &escape_carry);
+    uint64_t in_string = iot_json_prefix_xor (quote) ^ string_carry;
+    string_carry = (uint64_t) 0u - (in_string >> 63);
+    uint64_t scalar = ~(in_string | quote | block.open | block.other) & valid;
+    count += (uint32_t) __builtin_popcountll (quote & in_string); /* Strings */
+    count += (uint32_t) __builtin_popcountll (block.open & ~in_string & valid); /* Objects and arrays */
+    count += (uint32_t) __builtin_popcountll (scalar & ~((scalar << 1) | scalar_carry)); /* Primitives */
+    scalar_carry = scalar >> 63;
+  }
+  return count;
+}
 /**
  * Allocates a fresh unused token from the token pool.
  */
@@ -104,6 +234,8 @@ static int iot_json_parse_string (iot_json_parser *parser, const char *js, size_
   /* Skip starting quote */
   for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++)
   {
+    /* Skip a word at a time while no quote, backslash or terminator */
+    while ((parser->pos + 8u) < len && iot_json_plain_word (iot_json_load (js + parser->pos))) parser->pos += 8u;
     char c = js[parser->pos];
 
     /* Quote: end of string */
@@ -7,10 +7,15 @@
 #include "iot/logger.h"
 #include "iot/container.h"
 #include "iot/time.h"
+#include "iot/thread.h"
+#include "iot/file.h"
 #include <stdarg.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #ifdef IOT_HAS_PRCTL
 #include <sys/prctl.h>
@@ -28,6 +33,19 @@ static time_t time (time_t *t)
 
 #define IOT_PRCTL_NAME_MAX 16
 #define IOT_LOG_LEVELS 6
+#define IOT_LOG_ASYNC_BATCH 64u
+#define IOT_LOG_UDP_MAX 1472u
+#define IOT_LOG_SPEC_MAX 32u
+#define IOT_LOG_DEFERRED ((size_t) 1u << (sizeof (size_t) * 8u - 1u)) // Ring entry length flag for deferred records
+#define IOT_LOG_BIN_MAGIC "IOTBLOG1"     // Binary log file magic, followed by byte order and argument sizes
+#define IOT_LOG_BIN_MAGIC_LEN 8u
+#define IOT_LOG_BIN_HEADER (IOT_LOG_BIN_MAGIC_LEN + IOT_LOG_ARG_STR) // Binary log file header size
+#define IOT_LOG_BIN_HEAD 24u             // Space reserved for a binary message record header
+#define IOT_LOG_BIN_FORMATS 64u          // Initial binary logger format table size
+#define IOT_LOG_BIN_SESSION 1u           // Binary record kinds, message kinds or'ed with level
+#define IOT_LOG_BIN_FORMAT 2u
+#define IOT_LOG_BIN_THREAD 3u
+#define IOT_LOG_BIN_MESSAGE 0x10u
 
 #ifdef IOT_BUILD_COMPONENTS
 #define IOT_LOGGER_FACTORY iot_logger_factory ()
@@ -44,14 +62,149 @@ typedef struct iot_logger_impl_t
   iot_log_free_fn_t freectx;          // Function to free log context
   void *ctx;                          // Context for custom loggers
   struct iot_logger_impl_t * next;    // Pointer to next logger (can be chained in config)
-  char buff [IOT_LOG_MSG_MAX];        // Log format buffer
+  struct iot_logger_impl_t * list;    // Next allocated logger, for threshold updates
+  bool deferred;                      // Whether message formatting deferred to asynchronous writer thread
+  volatile uint32_t rate_limit;       // Maximum messages per second, 0 if not limited
+  iot_log_ratelimit_t limit;          // Rate limit state
 }
 iot_logger_impl_t;
 
+// Deferred message record, format arguments are held by value following the record, strings copied
+
+typedef struct iot_log_record_t
+{
+  const char * fmt;                   // Message format, must remain valid until written
+  uint64_t timestamp;                 // Message time
+  iot_loglevel_t level;               // Message level
+  char tname[IOT_PRCTL_NAME_MAX];     // Logging thread name
+} iot_log_record_t;
+
+typedef enum iot_log_arg_t
+{
+  IOT_LOG_ARG_NONE,
+  IOT_LOG_ARG_INT,
+  IOT_LOG_ARG_LONG,
+  IOT_LOG_ARG_LLONG,
+  IOT_LOG_ARG_SIZE,
+  IOT_LOG_ARG_INTMAX,
+  IOT_LOG_ARG_PTRDIFF,
+  IOT_LOG_ARG_DOUBLE,
+  IOT_LOG_ARG_LDOUBLE,
+  IOT_LOG_ARG_PTR,
+  IOT_LOG_ARG_STR
+} iot_log_arg_t;
+
+typedef struct iot_log_spec_t
+{
+  iot_log_arg_t type;                 // Argument type
+  uint32_t stars;                     // Number of '*' width and precision arguments
+  size_t len;                         // Length of conversion specification, including '%'
+} iot_log_spec_t;
+
 static const char * iot_log_levels[IOT_LOG_LEVELS] = {"", "ERROR", "WARN", "Info", "Debug", "Trace"};
 static iot_logger_impl_t iot_logger_dfl;
+static iot_logger_impl_t * iot_logger_list = NULL;                    // Allocated loggers
+static pthread_mutex_t iot_logger_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local char iot_logger_tname[IOT_PRCTL_NAME_MAX];
+static _Thread_local bool iot_logger_tname_cached = false;
+static _Thread_local uint32_t iot_logger_tid = 0u;
+static _Atomic uint32_t iot_logger_tids = 0u;
+static _Thread_local char iot_logger_buff[IOT_LOG_MSG_MAX]; // Per thread format buffer, so loggers format in parallel
 
 static void iot_log_console (iot_logger_t * logger, iot_loglevel_t level, uint64_t timestamp, const char * message, const void *ctx);
+static bool iot_log_deferred (iot_logger_impl_t * logger, iot_loglevel_t level, uint64_t timestamp, const char * fmt, va_list args);
+#if defined (IOT_HAS_FILE) && !defined (_AZURESPHERE_)
+static void iot_log_binary (iot_logger_t * logger, iot_loglevel_t level, uint64_t timestamp, const char * message, const void *ctx);
+static bool iot_log_binary_deferred (iot_logger_impl_t * logger, iot_loglevel_t level, uint64_t timestamp, const char * fmt, va_list args);
+#endif
+
+// Thread name, cached on first use. Library threads are named before they first log.
+
+static inline const char * iot_logger_thread_name (void)
+{
+  if (! iot_logger_tname_cached)
+  {
+#ifdef IOT_HAS_PRCTL
+    prctl (PR_GET_NAME, iot_logger_tname);
+#endif
+    iot_logger_tname_cached = true;
+  }
+  return iot_logger_tname;
+}
+
+// Process wide thread id, from one, allocated on first use
+
+static inline uint32_t iot_logger_thread_id (void)
+{
+  if (iot_logger_tid == 0u) iot_logger_tid = atomic_fetch_add (&iot_logger_tids, 1u) + 1u;
+  return iot_logger_tid;
+}
+
+// Count a message against a per second limit. Returns the number of messages suppressed in previous windows,
+// when the message is the first counted in a new window.
+
+static uint64_t iot_log_ratelimit_count (iot_log_ratelimit_t * limit, uint64_t per_sec, uint64_t ts, bool * allow)
+{
+  uint64_t sec = ts / 1000000u;
+  uint64_t window = atomic_load_explicit (&limit->window, memory_order_relaxed);
+  uint64_t suppressed = 0u;
+  if ((window != sec) && atomic_compare_exchange_strong (&limit->window, &window, sec))
+  {
+    atomic_store (&limit->count, 0u);
+    suppressed = atomic_exchange (&limit->suppressed, 0u);
+  }
+  *allow = (atomic_fetch_add (&limit->count, 1u) < per_sec);
+  if (! *allow) atomic_fetch_add (&limit->suppressed, 1u);
+  return suppressed;
+}
+
+static bool iot_logger_admit (iot_logger_impl_t * logger, iot_loglevel_t level, uint64_t ts)
+{
+  bool allow;
+  uint64_t suppressed = iot_log_ratelimit_count (&logger->limit, logger->rate_limit, ts, &allow);
+  if (suppressed)
+  {
+    char note[64];
+    snprintf (note, sizeof (note), "%" PRIu64 " log messages suppressed by rate limit", suppressed);
+    (logger->impl) (&logger->base, level, ts, note, logger->ctx);
+  }
+  return allow;
+}
+
+// Recalculate the threshold of every logger, as the maximum level of the logger and those chained to it. Levels and
+// chains change rarely, so all thresholds are updated rather than tracking which loggers chain to which.
+
+static void iot_logger_update_thresholds (void)
+{
+  pthread_mutex_lock (&iot_logger_list_mutex);
+  for (iot_logger_impl_t * logger = iot_logger_list; logger; logger = logger->list)
+  {
+    iot_loglevel_t threshold = IOT_LOG_NONE;
+    for (const iot_logger_impl_t * chained = logger; chained; chained = chained->next)
+    {
+      if (chained->base.level > threshold) threshold = chained->base.level;
+    }
+    logger->base.threshold = threshold;
+  }
+  pthread_mutex_unlock (&iot_logger_list_mutex);
+}
+
+static void iot_logger_list_add (iot_logger_impl_t * logger)
+{
+  pthread_mutex_lock (&iot_logger_list_mutex);
+  logger->list = iot_logger_list;
+  iot_logger_list = logger;
+  pthread_mutex_unlock (&iot_logger_list_mutex);
+}
+
+static void iot_logger_list_remove (const iot_logger_impl_t * logger)
+{
+  pthread_mutex_lock (&iot_logger_list_mutex);
+  iot_logger_impl_t ** prev = &iot_logger_list;
+  while (*prev != logger) prev = &(*prev)->list;
+  *prev = logger->list;
+  pthread_mutex_unlock (&iot_logger_list_mutex);
+}
 
 iot_logger_t * iot_logger_default (void)
 {
@@ -61,8 +214,9 @@ iot_logger_t * iot_logger_default (void)
     logger = &iot_logger_dfl.base;
     memset (&iot_logger_dfl, 0, sizeof (iot_logger_dfl));
     iot_component_init (&logger->component, IOT_LOGGER_FACTORY, (iot_component_start_fn_t) iot_logger_start, (iot_component_stop_fn_t) iot_logger_stop);
-    iot_logger_dfl.base.level = iot_logger_dfl.save = IOT_LOGLEVEL_DEFAULT;
+    iot_logger_dfl.base.level = iot_logger_dfl.base.threshold = iot_logger_dfl.save = IOT_LOGLEVEL_DEFAULT;
     iot_logger_dfl.impl = iot_log_console;
+    iot_logger_list_add (&iot_logger_dfl);
   }
   return logger;
 }
@@ -71,11 +225,32 @@ void iot_log__va_log (iot_logger_t * l, iot_loglevel_t level, const char* fmt, v
 {
   iot_logger_impl_t *logger = (iot_logger_impl_t*) l;
   char str[1024];
-  vsnprintf (str, sizeof (str), fmt, args);
-  uint64_t ts = iot_time_usecs ();
+  bool formatted = false;
+  uint64_t ts = iot_time_cached_usecs ();
+  va_list copy;
   do
   {
-    if (logger->base.level >= level) (logger->impl) (&logger->base, level, ts, str, logger->ctx);
+    if ((logger->base.level >= level) && ((logger->rate_limit == 0u) || iot_logger_admit (logger, level, ts)))
+    {
+      bool deferred = false;
+      if (logger->deferred)
+      {
+        va_copy (copy, args);
+        deferred = iot_log_deferred (logger, level, ts, fmt, copy);
+        va_end (copy);
+      }
+      if (! deferred)
+      {
+        if (! formatted) // Format once for all non deferred loggers
+        {
+          va_copy (copy, args);
+          vsnprintf (str, sizeof (str), fmt, copy);
+          va_end (copy);
+          formatted = true;
+        }
+        (logger->impl) (&logger->base, level, ts, str, logger->ctx);
+      }
+    }
   } while ((logger = logger->next));
 }
 
@@ -88,10 +263,32 @@ void iot_log__log (iot_logger_t * l, iot_loglevel_t level, ...)
   va_end (args);
 }
 
+bool iot_log__ratelimit (iot_logger_t * logger, iot_loglevel_t level, iot_log_ratelimit_t * limit, uint32_t per_sec)
+{
+  assert (logger && limit && per_sec);
+  bool allow;
+  uint64_t suppressed = iot_log_ratelimit_count (limit, per_sec, iot_time_usecs (), &allow);
+  if (suppressed) iot_log__log (logger, level, "%" PRIu64 " similar log messages suppressed", suppressed);
+  return allow;
+}
+
+bool iot_log__every (iot_log_ratelimit_t * limit, uint32_t n)
+{
+  assert (limit && n);
+  return (atomic_fetch_add_explicit (&limit->count, 1u, memory_order_relaxed) % n) == 0u;
+}
+
+void iot_logger_set_rate_limit (iot_logger_t * logger, uint32_t per_sec)
+{
+  assert (logger);
+  ((iot_logger_impl_t*) logger)->rate_limit = per_sec;
+}
+
 void iot_logger_set_level (iot_logger_t * logger, iot_loglevel_t level)
 {
   assert (logger);
   logger->level = level;
+  iot_logger_update_thresholds ();
 }
 
 iot_logger_t * iot_logger_alloc_custom (const char * name, iot_loglevel_t level, bool start, iot_logger_t * next, iot_log_function_t impl, void * ctx, iot_log_free_fn_t freectx)
@@ -106,6 +303,7 @@ iot_logger_t * iot_logger_alloc_custom (const char * name, iot_loglevel_t level,
   logger->ctx = ctx;
   logger->freectx = freectx;
   iot_component_init (&logger->base.component, IOT_LOGGER_FACTORY, (iot_component_start_fn_t) iot_logger_start, (iot_component_stop_fn_t) iot_logger_stop);
+  iot_logger_list_add (logger);
   if (start) iot_logger_start (&logger->base);
   return &logger->base;
 }
@@ -120,6 +318,7 @@ void iot_logger_free (iot_logger_t * logger)
   iot_logger_impl_t * impl = (iot_logger_impl_t*) logger;
   if (impl && (impl != &iot_logger_dfl) && iot_component_dec_ref (&logger->component))
   {
+    iot_logger_list_remove (impl);
     free (impl->name);
     iot_logger_free ((iot_logger_t*) impl->next);
     if (impl->freectx) (impl->freectx) (impl->ctx);
@@ -139,6 +338,7 @@ void iot_logger_start (iot_logger_t * logger)
   const iot_logger_impl_t * impl = (const iot_logger_impl_t*) logger;
   iot_component_set_running (&logger->component);
   logger->level = impl->save;
+  iot_logger_update_thresholds ();
 }
 
 void iot_logger_stop (iot_logger_t * logger)
@@ -148,29 +348,29 @@ void iot_logger_stop (iot_logger_t * logger)
   iot_component_set_stopped (&logger->component);
   impl->save = logger->level;
   logger->level = IOT_LOG_NONE;
+  iot_logger_update_thresholds ();
 }
 
-static inline size_t iot_logger_format_log (iot_logger_impl_t * logger, iot_loglevel_t level, uint64_t timestamp, const char * message)
+static inline size_t iot_logger_format_log (const iot_logger_impl_t * logger, char * buff, size_t size, iot_loglevel_t level, uint64_t timestamp, const char * message)
 {
-  char tname[IOT_PRCTL_NAME_MAX] = { 0 };
-#ifdef IOT_HAS_PRCTL
-  prctl (PR_GET_NAME, tname);
-#endif
-  return (size_t) snprintf (logger->buff, sizeof (logger->buff), "[%s:%" PRIu64 ":%s:%s] %s\n", tname, timestamp, logger->name, iot_log_levels[level], message);
+  int len = snprintf (buff, size, "[%s:%" PRIu64 ":%s:%s] %s\n", iot_logger_thread_name (), timestamp, logger->name, iot_log_levels[level], message);
+  return (len < 0) ? 0u : (((size_t) len < size) ? (size_t) len : (size - 1u)); // Length excluding any truncation
 }
 
-static inline void iot_logger_log_to_fd (iot_logger_impl_t * logger, FILE * fd, iot_loglevel_t level, uint64_t timestamp, const char *message)
+// Messages are written with a single call, so are not interleaved without a logger lock
+
+static inline void iot_logger_log_to_fd (const iot_logger_impl_t * logger, FILE * fd, iot_loglevel_t level, uint64_t timestamp, const char *message)
 {
-  iot_component_lock (&logger->base.component);
-  if (iot_logger_format_log (logger, level, timestamp, message))
+  size_t len = iot_logger_format_log (logger, iot_logger_buff, sizeof (iot_logger_buff), level, timestamp, message);
+  if (len)
   {
 #ifdef _AZURESPHERE_
-    Log_Debug ("%s", logger->buff);
+    (void) fd;
+    Log_Debug ("%s", iot_logger_buff);
 #else
-    fprintf (fd, "%s", logger->buff);
+    fwrite (iot_logger_buff, 1u, len, fd);
 #endif
   }
-  iot_component_unlock (&logger->base.component);
 }
 
 static void iot_log_console (iot_logger_t * logger, iot_loglevel_t level, uint64_t timestamp, const char * message, const void *ctx)
@@ -189,15 +389,13 @@ typedef struct iot_logger_udp_ctx_t
 
 static void iot_log_udp (iot_logger_t * logger, iot_loglevel_t level, uint64_t timestamp, const char * message, const void *ctx)
 {
-  iot_logger_impl_t * logimpl = (iot_logger_impl_t*) logger;
+  const iot_logger_impl_t * logimpl = (const iot_logger_impl_t*) logger;
   const iot_logger_udp_ctx_t  *impl = ctx;
-  iot_component_lock (&logger->component);
   if (impl->sock != -1)
   {
-    size_t len = iot_logger_format_log (logimpl, level, timestamp, message);
-    if (len > 0) sendto (impl->sock, logimpl->buff, len, 0, (struct sockaddr *) &impl->addr, sizeof (struct sockaddr_in));
+    size_t len = iot_logger_format_log (logimpl, iot_logger_buff, sizeof (iot_logger_buff), level, timestamp, message);
+    if (len > 0) sendto (impl->sock, iot_logger_buff, len, 0, (struct sockaddr *) &impl->addr, sizeof (struct sockaddr_in));
   }
-  iot_component_unlock (&logger->component);
 }
 
 static void iot_logger_udp_ctx_free (void *ctx)
@@ -225,27 +423,1073 @@ iot_logger_t * iot_logger_alloc_udp (const char * name, iot_loglevel_t level, bo
   return iot_logger_alloc_custom (name, level, self_start, next, iot_log_udp, ctx, iot_logger_udp_ctx_free);
 }
 
+/********* Asynchronous Logger Implementations: File and UDP *********/
+
+typedef struct iot_logger_async_t
+{
+  pthread_mutex_t mutex;              // Ring mutex
+  pthread_cond_t cond;                // Ring not empty condition
+  pthread_t tid;                      // Writer thread
+  char * ring;                        // Ring of formatted messages, IOT_LOG_MSG_MAX bytes per entry
+  size_t * lens;                      // Ring message lengths
+  uint32_t size;                      // Number of ring entries
+  uint32_t head;                      // Count of messages added
+  uint32_t tail;                      // Count of messages written
+  uint64_t dropped;                   // Messages dropped since last reported
+  _Atomic uint64_t total_dropped;     // Messages dropped in total
+  bool running;                       // Whether writer thread is to continue
+  bool waiting;                       // Whether writer thread is waiting for messages
+  int fd;                             // File descriptor, -1 if not a file logger
+  int sock;                           // Socket, -1 if not a UDP logger
+  struct sockaddr_in addr;            // UDP address
+  char * name;                        // Logger name, for deferred records
+  char * out;                         // Formatted deferred records, IOT_LOG_MSG_MAX bytes per batch entry
+} iot_logger_async_t;
+
+// Parse a conversion specification, from the '%'. Returns false if not supported.
+
+static bool iot_log_spec (const char * fmt, iot_log_spec_t * spec)
+{
+  const char * p = fmt + 1;
+  int lng = 0;
+  bool half = false;
+  char mod = 0;
+  spec->stars = 0u;
+  spec->type = IOT_LOG_ARG_NONE;
+  p += strspn (p, "-+ #0'");
+  if (*p == '*') { spec->stars++; p++; } else p += strspn (p, "0123456789");
+  if (*p == '.')
+  {
+    p++;
+    if (*p == '*') { spec->stars++; p++; } else p += strspn (p, "0123456789");
+  }
+  while (*p == 'h') { half = true; p++; }
+  while (*p == 'l') { lng++; p++; }
+  if (*p == 'L' || *p == 'z' || *p == 'j' || *p == 't') mod = *p++;
+  switch (*p)
+  {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+      if (mod == 'z') spec->type = IOT_LOG_ARG_SIZE;
+      else if (mod == 'j') spec->type = IOT_LOG_ARG_INTMAX;
+      else if (mod == 't') spec->type = IOT_LOG_ARG_PTRDIFF;
+      else if (mod == 0) spec->type = (lng == 0) ? IOT_LOG_ARG_INT : ((lng == 1) ? IOT_LOG_ARG_LONG : IOT_LOG_ARG_LLONG);
+      break;
+    case 'c': if (mod == 0 && lng == 0 && ! half) spec->type = IOT_LOG_ARG_INT; break;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+      if (! half && (mod == 0 || mod == 'L')) spec->type = (mod == 'L') ? IOT_LOG_ARG_LDOUBLE : IOT_LOG_ARG_DOUBLE;
+      break;
+    case 'p': if (mod == 0 && lng == 0 && ! half) spec->type = IOT_LOG_ARG_PTR; break;
+    case 's': if (mod == 0 && lng == 0 && ! half) spec->type = IOT_LOG_ARG_STR; break;
+    case '%': spec->type = IOT_LOG_ARG_NONE; spec->len = 2u; return (p == fmt + 1);
+    default: break;
+  }
+  spec->len = (size_t) (p - fmt) + 1u;
+  return (spec->type != IOT_LOG_ARG_NONE) && (spec->len < IOT_LOG_SPEC_MAX);
+}
+
+#define IOT_LOG_CAPTURE(T,V) \
+{ \
+  T v = (V); \
+  if ((size_t) (end - pos) < sizeof (v)) return 0u; \
+  memcpy (pos, &v, sizeof (v)); \
+  pos += sizeof (v); \
+}
+
+// Copy a string argument, returning the position following or NULL if no space
+
+static inline char * iot_log_capture_str (char * pos, const char * end, const char * str)
+{
+  if (str == NULL) str = "(null)";
+  size_t len = strlen (str);
+  if ((size_t) (end - pos) <= len) return NULL;
+  memcpy (pos, str, len + 1u);
+  return pos + len + 1u;
+}
+
+// Capture message format arguments into a record. Returns the record size or 0 if not possible.
+
+static size_t iot_log_capture (char * buff, size_t size, const char * fmt, va_list args)
+{
+  char * pos = buff + sizeof (iot_log_record_t);
+  const char * end = buff + size;
+  iot_log_spec_t spec;
+  while ((fmt = strchr (fmt, '%')))
+  {
+    if (! iot_log_spec (fmt, &spec)) return 0u;
+    for (uint32_t i = 0; i < spec.stars; i++) IOT_LOG_CAPTURE (int, va_arg (args, int))
+    switch (spec.type)
+    {
+      case IOT_LOG_ARG_INT: IOT_LOG_CAPTURE (int, va_arg (args, int)) break;
+      case IOT_LOG_ARG_LONG: IOT_LOG_CAPTURE (long, va_arg (args, long)) break;
+      case IOT_LOG_ARG_LLONG: IOT_LOG_CAPTURE (long long, va_arg (args, long long)) break;
+      case IOT_LOG_ARG_SIZE: IOT_LOG_CAPTURE (size_t, va_arg (args, size_t)) break;
+      case IOT_LOG_ARG_INTMAX: IOT_LOG_CAPTURE (intmax_t, va_arg (args, intmax_t)) break;
+      case IOT_LOG_ARG_PTRDIFF: IOT_LOG_CAPTURE (ptrdiff_t, va_arg (args, ptrdiff_t)) break;
+      case IOT_LOG_ARG_DOUBLE: IOT_LOG_CAPTURE (double, va_arg (args, double)) break;
+      case IOT_LOG_ARG_LDOUBLE: IOT_LOG_CAPTURE (long double, va_arg (args, long double)) break;
+      case IOT_LOG_ARG_PTR: IOT_LOG_CAPTURE (void*, va_arg (args, void*)) break;
+      case IOT_LOG_ARG_STR: if (! (pos = iot_log_capture_str (pos, end, va_arg (args, const char*)))) return 0u; break;
+      default: break;
+    }
+    fmt += spec.len;
+  }
+  return (size_t) (pos - buff);
+}
+
+#define IOT_LOG_FORMAT(T) \
+{ \
+  T v; \
+  memcpy (&v, arg, sizeof (v)); \
+  arg += sizeof (v); \
+  ret = (spec.stars == 2u) ? snprintf (pos, rem, cspec, stars[0], stars[1], v) : \
+    ((spec.stars == 1u) ? snprintf (pos, rem, cspec, stars[0], v) : snprintf (pos, rem, cspec, v)); \
+}
+
+// Format a message from its format and captured arguments, following a prefix of len bytes
+
+static size_t iot_log_args_format (char * buff, size_t len, const char * fmt, const char * arg)
+{
+  char cspec[IOT_LOG_SPEC_MAX];
+  iot_log_spec_t spec;
+  int stars[2];
+  while (*fmt && len < (IOT_LOG_MSG_MAX - 1u))
+  {
+    int ret = 0;
+    char * pos = buff + len;
+    size_t rem = IOT_LOG_MSG_MAX - len;
+    const char * next = strchr (fmt, '%');
+    if (next != fmt)
+    {
+      size_t n = next ? (size_t) (next - fmt) : strlen (fmt);
+      ret = (int) ((n < rem) ? n : rem - 1u);
+      memcpy (pos, fmt, (size_t) ret);
+      fmt += n;
+    }
+    else
+    {
+      iot_log_spec (fmt, &spec);
+      memcpy (cspec, fmt, spec.len);
+      cspec[spec.len] = 0;
+      for (uint32_t i = 0; i < spec.stars; i++)
+      {
+        memcpy (&stars[i], arg, sizeof (int));
+        arg += sizeof (int);
+      }
+      switch (spec.type)
+      {
+        case IOT_LOG_ARG_NONE: pos[0] = '%'; ret = 1; break;
+        case IOT_LOG_ARG_INT: IOT_LOG_FORMAT (int) break;
+        case IOT_LOG_ARG_LONG: IOT_LOG_FORMAT (long) break;
+        case IOT_LOG_ARG_LLONG: IOT_LOG_FORMAT (long long) break;
+        case IOT_LOG_ARG_SIZE: IOT_LOG_FORMAT (size_t) break;
+        case IOT_LOG_ARG_INTMAX: IOT_LOG_FORMAT (intmax_t) break;
+        case IOT_LOG_ARG_PTRDIFF: IOT_LOG_FORMAT (ptrdiff_t) break;
+        case IOT_LOG_ARG_DOUBLE: IOT_LOG_FORMAT (double) break;
+        case IOT_LOG_ARG_LDOUBLE: IOT_LOG_FORMAT (long double) break;
+        case IOT_LOG_ARG_PTR: IOT_LOG_FORMAT (void*) break;
+        case IOT_LOG_ARG_STR:
+        {
+          const char * v = arg;
+          arg += strlen (v) + 1u;
+          ret = (spec.stars == 2u) ? snprintf (pos, rem, cspec, stars[0], stars[1], v) :
+            ((spec.stars == 1u) ? snprintf (pos, rem, cspec, stars[0], v) : snprintf (pos, rem, cspec, v));
+          break;
+        }
+      }
+      fmt += spec.len;
+    }
+    if (ret > 0) len += ((size_t) ret < rem) ? (size_t) ret : (rem - 1u);
+  }
+  if (len < (IOT_LOG_MSG_MAX - 1u)) buff[len++] = '\n';
+  return len;
+}
+
+// Format a deferred record as for iot_logger_format_log
+
+static size_t iot_log_record_format (const iot_logger_async_t * async, const char * rec, char * buff)
+{
+  const iot_log_record_t * record = (const iot_log_record_t*) rec;
+  int ret = snprintf (buff, IOT_LOG_MSG_MAX, "[%s:%" PRIu64 ":%s:%s] ", record->tname, record->timestamp, async->name, iot_log_levels[record->level]);
+  return iot_log_args_format (buff, (ret < 0) ? 0u : (size_t) ret, record->fmt, rec + sizeof (*record));
+}
+
+static void iot_log_async_add (iot_logger_async_t * async, const char * buff, size_t len)
+{
+  pthread_mutex_lock (&async->mutex);
+  if ((async->head - async->tail) < async->size)
+  {
+    uint32_t index = async->head++ % async->size;
+    memcpy (async->ring + (size_t) index * IOT_LOG_MSG_MAX, buff, len & ~IOT_LOG_DEFERRED);
+    async->lens[index] = len;
+    if (async->waiting) pthread_cond_signal (&async->cond);
+  }
+  else // Ring full
+  {
+    async->dropped++;
+    atomic_fetch_add (&async->total_dropped, 1u);
+  }
+  pthread_mutex_unlock (&async->mutex);
+}
+
+static void iot_log_async (iot_logger_t * logger, iot_loglevel_t level, uint64_t timestamp, const char * message, const void *ctx)
+{
+  iot_logger_async_t * async = (iot_logger_async_t*) ctx;
+  size_t len = iot_logger_format_log ((iot_logger_impl_t*) logger, iot_logger_buff, sizeof (iot_logger_buff), level, timestamp, message);
+  iot_log_async_add (async, iot_logger_buff, len);
+}
+
+// Capture a message for formatting by the writer thread. Returns false if the format is not supported.
+
+static bool iot_log_deferred (iot_logger_impl_t * logger, iot_loglevel_t level, uint64_t timestamp, const char * fmt, va_list args)
+{
+#if defined (IOT_HAS_FILE) && !defined (_AZURESPHERE_)
+  if (logger->impl == iot_log_binary) return iot_log_binary_deferred (logger, level, timestamp, fmt, args);
+#endif
+  _Alignas (iot_log_record_t) char buff[IOT_LOG_MSG_MAX];
+  iot_log_record_t * record = (iot_log_record_t*) buff;
+  size_t len = iot_log_capture (buff, sizeof (buff), fmt, args);
+  if (len == 0u) return false;
+  record->fmt = fmt;
+  record->timestamp = timestamp;
+  record->level = level;
+  memcpy (record->tname, iot_logger_thread_name (), IOT_PRCTL_NAME_MAX);
+  iot_log_async_add ((iot_logger_async_t*) logger->ctx, buff, len | IOT_LOG_DEFERRED);
+  return true;
+}
+
+static void iot_logger_async_write (const iot_logger_async_t * async, struct iovec * iov, uint32_t count)
+{
+  if (async->sock == -1)
+  {
+    if (async->fd != -1)
+    {
+      ssize_t ret = writev (async->fd, iov, (int) count);
+      (void) ret; // Nowhere to report error
+    }
+    return;
+  }
+  uint32_t first = 0u;
+  size_t len = 0u;
+  for (uint32_t i = 0u; i <= count; i++)
+  {
+    if ((i > first) && ((i == count) || ((len + iov[i].iov_len) > IOT_LOG_UDP_MAX))) // Send coalesced datagram
+    {
+      struct msghdr msg = { 0 };
+      msg.msg_name = (void*) &async->addr;
+      msg.msg_namelen = sizeof (async->addr);
+      msg.msg_iov = &iov[first];
+      msg.msg_iovlen = i - first;
+      sendmsg (async->sock, &msg, 0);
+      first = i;
+      len = 0u;
+    }
+    if (i < count) len += iov[i].iov_len;
+  }
+}
+
+static void * iot_logger_async_thread (void * arg)
+{
+  iot_logger_async_t * async = (iot_logger_async_t*) arg;
+  struct iovec iov[IOT_LOG_ASYNC_BATCH];
+  char note[IOT_LOG_MSG_MAX];
+#ifdef IOT_HAS_PRCTL
+  prctl (PR_SET_NAME, "iot-logger");
+#endif
+  pthread_mutex_lock (&async->mutex);
+  while (true)
+  {
+    while ((async->head == async->tail) && (async->dropped == 0u) && async->running)
+    {
+      async->waiting = true;
+      pthread_cond_wait (&async->cond, &async->mutex);
+      async->waiting = false;
+    }
+    uint32_t start = async->tail;
+    uint32_t count = async->head - start;
+    uint64_t dropped = async->dropped;
+    if ((count == 0u) && (dropped == 0u)) break; // Stopped and all messages written
+    if (count > IOT_LOG_ASYNC_BATCH) count = IOT_LOG_ASYNC_BATCH;
+    async->dropped = 0u;
+    pthread_mutex_unlock (&async->mutex);
+
+    /* Ring entries from tail are not reused until tail is updated, so can be written unlocked */
+    for (uint32_t i = 0u; i < count; i++)
+    {
+      uint32_t index = (start + i) % async->size;
+      char * entry = async->ring + (size_t) index * IOT_LOG_MSG_MAX;
+      size_t len = async->lens[index];
+      if (len & IOT_LOG_DEFERRED)
+      {
+        iov[i].iov_base = async->out + (size_t) i * IOT_LOG_MSG_MAX;
+        iov[i].iov_len = iot_log_record_format (async, entry, iov[i].iov_base);
+      }
+      else
+      {
+        iov[i].iov_base = entry;
+        iov[i].iov_len = len;
+      }
+    }
+    if (count) iot_logger_async_write (async, iov, count);
+    if (dropped)
+    {
+      int len = snprintf (note, sizeof (note), "[iot-logger:%" PRIu64 "] %" PRIu64 " log messages dropped\n", iot_time_usecs (), dropped);
+      iov[0].iov_base = note;
+      iov[0].iov_len = (size_t) len;
+      iot_logger_async_write (async, iov, 1u);
+    }
+    pthread_mutex_lock (&async->mutex);
+    async->tail += count;
+  }
+  pthread_mutex_unlock (&async->mutex);
+  return NULL;
+}
+
+static void iot_logger_async_free (void * ctx)
+{
+  iot_logger_async_t * async = (iot_logger_async_t*) ctx;
+  pthread_mutex_lock (&async->mutex);
+  async->running = false;
+  pthread_cond_signal (&async->cond);
+  pthread_mutex_unlock (&async->mutex);
+  pthread_join (async->tid, NULL);
+  if (async->fd != -1) close (async->fd);
+  if (async->sock != -1) close (async->sock);
+  pthread_cond_destroy (&async->cond);
+  pthread_mutex_destroy (&async->mutex);
+  free (async->ring);
+  free (async->lens);
+  free (async->out);
+  free (async->name);
+  free (async);
+}
+
+static iot_logger_t * iot_logger_alloc_async (const char * name, iot_loglevel_t level, bool self_start, iot_logger_t * next, iot_logger_async_t * async, uint32_t entries)
+{
+  assert (entries);
+  async->size = entries;
+  async->ring = malloc ((size_t) entries * IOT_LOG_MSG_MAX);
+  async->lens = calloc (entries, sizeof (*async->lens));
+  async->out = malloc ((size_t) IOT_LOG_ASYNC_BATCH * IOT_LOG_MSG_MAX);
+  async->name = strdup (name);
+  async->running = true;
+  atomic_store (&async->total_dropped, 0u);
+  iot_mutex_init (&async->mutex);
+  pthread_cond_init (&async->cond, NULL);
+  pthread_create (&async->tid, NULL, iot_logger_async_thread, async);
+  return iot_logger_alloc_custom (name, level, self_start, next, iot_log_async, async, iot_logger_async_free);
+}
+
+iot_logger_t * iot_logger_alloc_udp_async (const char * name, iot_loglevel_t level, bool self_start, iot_logger_t * next, const char *host, uint16_t port, uint32_t entries)
+{
+  static const int yes = 1;
+  iot_logger_async_t * async = calloc (1, sizeof (*async));
+  if (host)
+  {
+    inet_aton (host, &async->addr.sin_addr);
+  }
+  else
+  {
+    async->addr.sin_addr.s_addr = htonl (INADDR_BROADCAST);
+  }
+  async->addr.sin_family = AF_INET;
+  async->addr.sin_port = htons (port);
+  async->fd = -1;
+  async->sock = socket (AF_INET, SOCK_DGRAM, 0);
+  if (host == NULL) setsockopt (async->sock, SOL_SOCKET, SO_BROADCAST, (const void*) &yes, sizeof (yes));
+  return iot_logger_alloc_async (name, level, self_start, next, async, entries);
+}
+
+bool iot_logger_set_deferred (iot_logger_t * logger, bool enable)
+{
+  assert (logger);
+  iot_logger_impl_t * impl = (iot_logger_impl_t*) logger;
+  bool ok = (impl->impl == iot_log_async);
+#if defined (IOT_HAS_FILE) && !defined (_AZURESPHERE_)
+  ok = ok || (impl->impl == iot_log_binary);
+#endif
+  if (ok) impl->deferred = enable;
+  return ok;
+}
+
+uint64_t iot_logger_dropped (const iot_logger_t * logger)
+{
+  const iot_logger_impl_t * impl = (const iot_logger_impl_t*) logger;
+  return (impl && impl->impl == iot_log_async) ? atomic_load (&((iot_logger_async_t*) impl->ctx)->total_dropped) : 0u;
+}
+
 /********* Standard Logger Implementations: File *********/
 
 #if defined (IOT_HAS_FILE) && !defined (_AZURESPHERE_)
 
+// File opened with O_APPEND, so each message write is atomic without a logger lock
+
+typedef struct iot_logger_file_ctx_t
+{
+  int fd;                             // File descriptor, -1 if file could not be opened
+} iot_logger_file_ctx_t;
+
 static void iot_log_file (iot_logger_t * logger, iot_loglevel_t level, uint64_t timestamp, const char * message, const void *ctx)
 {
-  if (ctx) iot_logger_log_to_fd ((iot_logger_impl_t*) logger, (FILE *)ctx, level, timestamp, message);
+  const iot_logger_file_ctx_t * file = ctx;
+  if (file->fd != -1)
+  {
+    size_t len = iot_logger_format_log ((const iot_logger_impl_t*) logger, iot_logger_buff, sizeof (iot_logger_buff), level, timestamp, message);
+    if (len > 0)
+    {
+      ssize_t ret = write (file->fd, iot_logger_buff, len);
+      (void) ret; // Nowhere to report error
+    }
+  }
 }
 
 static void iot_logger_file_ctx_free (void *ctx)
 {
-  if (ctx)
+  iot_logger_file_ctx_t * file = ctx;
+  if (file->fd != -1) close (file->fd);
+  free (file);
+}
+
+iot_logger_t * iot_logger_alloc_file (const char * name, iot_loglevel_t level, bool self_start, iot_logger_t * next, const char *pathname)
+{
+  iot_logger_file_ctx_t * file = malloc (sizeof (*file));
+  file->fd = open (pathname, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  return iot_logger_alloc_custom (name, level, self_start, next, iot_log_file, file, iot_logger_file_ctx_free);
+}
+
+// Rotating and buffered file logger. Writes, rotation and the write buffer are serialized by the mutex.
+
+typedef struct iot_logger_rotate_t
+{
+  pthread_mutex_t mutex;              // File and buffer mutex
+  pthread_cond_t cond;                // Flush thread stop condition
+  pthread_t tid;                      // Flush thread, if buffered
+  iot_logger_file_options_t opts;     // Rotation, buffering and sync options
+  char * path;                        // File pathname
+  int fd;                             // File descriptor, -1 if file could not be opened
+  uint64_t size;                      // Current file size
+  uint64_t opened;                    // Time file opened or last rotated, in nanoseconds
+  char * buff;                        // Write buffer, NULL if unbuffered
+  size_t used;                        // Bytes held in write buffer
+  bool running;                       // Whether flush thread is to continue
+} iot_logger_rotate_t;
+
+static void iot_logger_rotate_open (iot_logger_rotate_t * rot)
+{
+  struct stat st;
+  rot->fd = open (rot->path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  rot->size = ((rot->fd != -1) && (fstat (rot->fd, &st) == 0)) ? (uint64_t) st.st_size : 0u;
+  rot->opened = iot_time_nsecs ();
+}
+
+static void iot_logger_rotate_sync (const iot_logger_rotate_t * rot)
+{
+#ifdef __APPLE__
+  fsync (rot->fd);
+#else
+  fdatasync (rot->fd);
+#endif
+}
+
+static void iot_logger_rotate_file (iot_logger_rotate_t * rot)
+{
+  size_t len = strlen (rot->path) + 12u;
+  char * from = malloc (len);
+  char * to = malloc (len);
+  if (rot->opts.sync != IOT_LOG_SYNC_NONE) iot_logger_rotate_sync (rot);
+  close (rot->fd);
+  if (rot->opts.max_files)
+  {
+    for (uint32_t i = rot->opts.max_files - 1u; i > 0u; i--)
+    {
+      snprintf (from, len, "%s.%" PRIu32, rot->path, i);
+      snprintf (to, len, "%s.%" PRIu32, rot->path, i + 1u);
+      rename (from, to);
+    }
+    snprintf (to, len, "%s.1", rot->path);
+    rename (rot->path, to);
+  }
+  else
   {
-    fclose (ctx);
+    unlink (rot->path);
   }
+  free (from);
+  free (to);
+  iot_logger_rotate_open (rot);
 }
 
-iot_logger_t * iot_logger_alloc_file (const char * name, iot_loglevel_t level, bool self_start, iot_logger_t * next, const char *pathname)
+// Write to the file, first rotating it if the write would exceed the maximum size, or it has reached the maximum age
+
+static void iot_logger_rotate_write (iot_logger_rotate_t * rot, const char * data, size_t len)
+{
+  if (rot->fd == -1) return;
+  if ((rot->opts.max_size && rot->size && (rot->size + len > rot->opts.max_size)) ||
+    (rot->opts.max_age && ((iot_time_nsecs () - rot->opened) >= (uint64_t) rot->opts.max_age * 1000000000u)))
+  {
+    iot_logger_rotate_file (rot);
+    if (rot->fd == -1) return;
+  }
+  ssize_t ret = write (rot->fd, data, len);
+  if (ret > 0) rot->size += (uint64_t) ret;
+  if (rot->opts.sync == IOT_LOG_SYNC_FLUSH) iot_logger_rotate_sync (rot);
+}
+
+static inline void iot_logger_rotate_flush (iot_logger_rotate_t * rot)
 {
-  FILE *fd = fopen (pathname, "a");
-  return iot_logger_alloc_custom (name, level, self_start, next, iot_log_file, fd, iot_logger_file_ctx_free);
+  if (rot->used)
+  {
+    iot_logger_rotate_write (rot, rot->buff, rot->used);
+    rot->used = 0u;
+  }
+}
+
+static void iot_log_file_rotate (iot_logger_t * logger, iot_loglevel_t level, uint64_t timestamp, const char * message, const void *ctx)
+{
+  iot_logger_rotate_t * rot = (iot_logger_rotate_t*) ctx;
+  size_t len = iot_logger_format_log ((const iot_logger_impl_t*) logger, iot_logger_buff, sizeof (iot_logger_buff), level, timestamp, message);
+  if (len == 0u) return;
+  pthread_mutex_lock (&rot->mutex);
+  if (rot->buff)
+  {
+    if (rot->used + len > rot->opts.buffer_size) iot_logger_rotate_flush (rot);
+    if (len <= rot->opts.buffer_size)
+    {
+      memcpy (rot->buff + rot->used, iot_logger_buff, len);
+      rot->used += len;
+    }
+    else
+    {
+      iot_logger_rotate_write (rot, iot_logger_buff, len);
+    }
+  }
+  else
+  {
+    iot_logger_rotate_write (rot, iot_logger_buff, len);
+  }
+  pthread_mutex_unlock (&rot->mutex);
+}
+
+static void * iot_logger_rotate_thread (void * arg)
+{
+  iot_logger_rotate_t * rot = (iot_logger_rotate_t*) arg;
+  uint64_t interval = (uint64_t) (rot->opts.flush_interval ? rot->opts.flush_interval : 1000u) * 1000000u;
+#ifdef IOT_HAS_PRCTL
+  prctl (PR_SET_NAME, "iot-logger");
+#endif
+  pthread_mutex_lock (&rot->mutex);
+  while (rot->running)
+  {
+    iot_cond_timedwait (&rot->cond, &rot->mutex, iot_cond_deadline (interval));
+    iot_logger_rotate_flush (rot);
+  }
+  pthread_mutex_unlock (&rot->mutex);
+  return NULL;
+}
+
+static void iot_logger_rotate_free (void * ctx)
+{
+  iot_logger_rotate_t * rot = (iot_logger_rotate_t*) ctx;
+  if (rot->buff)
+  {
+    pthread_mutex_lock (&rot->mutex);
+    rot->running = false;
+    pthread_cond_signal (&rot->cond);
+    pthread_mutex_unlock (&rot->mutex);
+    pthread_join (rot->tid, NULL);
+  }
+  if (rot->fd != -1)
+  {
+    if (rot->opts.sync != IOT_LOG_SYNC_NONE) iot_logger_rotate_sync (rot);
+    close (rot->fd);
+  }
+  pthread_cond_destroy (&rot->cond);
+  pthread_mutex_destroy (&rot->mutex);
+  free (rot->buff);
+  free (rot->path);
+  free (rot);
+}
+
+iot_logger_t * iot_logger_alloc_file_options (const char * name, iot_loglevel_t level, bool self_start, iot_logger_t * next, const char *pathname, const iot_logger_file_options_t * options)
+{
+  assert (pathname && options);
+  iot_logger_rotate_t * rot = calloc (1, sizeof (*rot));
+  rot->opts = *options;
+  rot->path = strdup (pathname);
+  iot_mutex_init (&rot->mutex);
+  iot_cond_init (&rot->cond);
+  iot_logger_rotate_open (rot);
+  if (rot->opts.buffer_size)
+  {
+    rot->buff = malloc (rot->opts.buffer_size);
+    rot->running = true;
+    pthread_create (&rot->tid, NULL, iot_logger_rotate_thread, rot);
+  }
+  return iot_logger_alloc_custom (name, level, self_start, next, iot_log_file_rotate, rot, iot_logger_rotate_free);
+}
+
+iot_logger_t * iot_logger_alloc_file_async (const char * name, iot_loglevel_t level, bool self_start, iot_logger_t * next, const char *pathname, uint32_t entries)
+{
+  iot_logger_async_t * async = calloc (1, sizeof (*async));
+  async->fd = open (pathname, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  async->sock = -1;
+  return iot_logger_alloc_async (name, level, self_start, next, async, entries);
+}
+
+/********* Binary File Logger Implementation *********/
+
+// A binary log file starts with IOT_LOG_BIN_MAGIC, the byte order and the sizes of captured argument types. Records
+// follow, each a kind byte and the varint length of the remainder. A session record, written as a logger opens the file,
+// holds the base timestamp and logger name, and restarts thread and format ids. Thread and format records define an id,
+// and are written before first use. Message records hold the zigzag timestamp relative to the base, thread and format
+// ids, then the packed arguments. Format id 0 is a message formatted by the logging thread, held as a string argument.
+
+typedef struct iot_logger_binary_t
+{
+  pthread_mutex_t mutex;              // Thread and format table mutex
+  int fd;                             // File descriptor, -1 if file could not be opened
+  uint64_t base;                      // Session start time, message timestamps are relative to this
+  const char ** fmts;                 // Open addressed table of format strings written
+  uint32_t * ids;                     // Format ids, by format table index
+  uint32_t size;                      // Format table size, a power of two
+  uint32_t count;                     // Number of format strings written
+  bool * threads;                     // Whether thread names written, by thread id
+  uint32_t nthreads;                  // Thread table size
+} iot_logger_binary_t;
+
+static const uint8_t iot_log_arg_sizes[IOT_LOG_ARG_STR] =
+{
+  0u, sizeof (int), sizeof (long), sizeof (long long), sizeof (size_t), sizeof (intmax_t), sizeof (ptrdiff_t), sizeof (double), sizeof (long double), sizeof (void*)
+};
+
+static inline size_t iot_log_varint (uint8_t * buff, uint64_t v)
+{
+  size_t n = 0u;
+  while (v >= 0x80u)
+  {
+    buff[n++] = (uint8_t) (v | 0x80u);
+    v >>= 7u;
+  }
+  buff[n++] = (uint8_t) v;
+  return n;
+}
+
+static inline uint64_t iot_log_zigzag (int64_t v)
+{
+  return ((uint64_t) v << 1u) ^ (uint64_t) (v >> 63u);
+}
+
+#define IOT_LOG_PACK(V) \
+{ \
+  if ((size_t) (end - pos) < 10u) return 0u; \
+  pos += iot_log_varint ((uint8_t*) pos, (V)); \
+}
+
+#define IOT_LOG_PACK_INT(T,U) \
+{ \
+  T v = va_arg (args, T); \
+  IOT_LOG_PACK (sign ? iot_log_zigzag ((int64_t) v) : (uint64_t) (U) v) \
+}
+
+// Capture message format arguments into a binary record, following a header of offset bytes. Integers are packed as
+// varints, zigzag encoded for signed conversions. Returns the record size or 0 if not possible.
+
+static size_t iot_log_binary_capture (char * buff, size_t offset, size_t size, const char * fmt, va_list args)
+{
+  char * pos = buff + offset;
+  const char * end = buff + size;
+  iot_log_spec_t spec;
+  while ((fmt = strchr (fmt, '%')))
+  {
+    if (! iot_log_spec (fmt, &spec)) return 0u;
+    bool sign = (strchr ("dic", fmt[spec.len - 1u]) != NULL);
+    for (uint32_t i = 0; i < spec.stars; i++) IOT_LOG_PACK (iot_log_zigzag (va_arg (args, int)))
+    switch (spec.type)
+    {
+      case IOT_LOG_ARG_INT: IOT_LOG_PACK_INT (int, unsigned) break;
+      case IOT_LOG_ARG_LONG: IOT_LOG_PACK_INT (long, unsigned long) break;
+      case IOT_LOG_ARG_LLONG: IOT_LOG_PACK_INT (long long, unsigned long long) break;
+      case IOT_LOG_ARG_SIZE: IOT_LOG_PACK_INT (size_t, size_t) break;
+      case IOT_LOG_ARG_INTMAX: IOT_LOG_PACK_INT (intmax_t, uintmax_t) break;
+      case IOT_LOG_ARG_PTRDIFF: IOT_LOG_PACK_INT (ptrdiff_t, size_t) break;
+      case IOT_LOG_ARG_PTR: IOT_LOG_PACK ((uintptr_t) va_arg (args, void*)) break;
+      case IOT_LOG_ARG_DOUBLE: IOT_LOG_CAPTURE (double, va_arg (args, double)) break;
+      case IOT_LOG_ARG_LDOUBLE: IOT_LOG_CAPTURE (long double, va_arg (args, long double)) break;
+      case IOT_LOG_ARG_STR: if (! (pos = iot_log_capture_str (pos, end, va_arg (args, const char*)))) return 0u; break;
+      default: break;
+    }
+    fmt += spec.len;
+  }
+  return (size_t) (pos - buff);
+}
+
+static inline uint8_t iot_log_binary_order (void)
+{
+  const uint16_t one = 1u;
+  return *((const uint8_t*) &one); // 1 if little endian
+}
+
+// Write a session, thread or format record, holding a value and string
+
+static void iot_log_binary_define (const iot_logger_binary_t * bin, uint8_t kind, uint64_t value, const char * str)
+{
+  uint8_t val[10];
+  size_t vlen = iot_log_varint (val, value);
+  size_t slen = strlen (str) + 1u;
+  uint8_t * buff = malloc (slen + sizeof (val) * 2u + 1u);
+  buff[0] = kind;
+  size_t len = 1u + iot_log_varint (buff + 1, vlen + slen);
+  memcpy (buff + len, val, vlen);
+  memcpy (buff + len + vlen, str, slen);
+  ssize_t ret = write (bin->fd, buff, len + vlen + slen);
+  (void) ret; // Nowhere to report error
+  free (buff);
+}
+
+static inline uint32_t iot_log_binary_slot (const iot_logger_binary_t * bin, const char * fmt)
+{
+  uint32_t index = (uint32_t) (((uint64_t) (uintptr_t) fmt * 0x9e3779b97f4a7c15u) >> 32u) & (bin->size - 1u);
+  while (bin->fmts[index] && (bin->fmts[index] != fmt)) index = (index + 1u) & (bin->size - 1u);
+  return index;
+}
+
+static void iot_log_binary_grow (iot_logger_binary_t * bin)
+{
+  const char ** fmts = bin->fmts;
+  uint32_t * ids = bin->ids;
+  uint32_t size = bin->size;
+  bin->size *= 2u;
+  bin->fmts = calloc (bin->size, sizeof (*bin->fmts));
+  bin->ids = calloc (bin->size, sizeof (*bin->ids));
+  for (uint32_t i = 0; i < size; i++)
+  {
+    if (fmts[i])
+    {
+      uint32_t index = iot_log_binary_slot (bin, fmts[i]);
+      bin->fmts[index] = fmts[i];
+      bin->ids[index] = ids[i];
+    }
+  }
+  free (fmts);
+  free (ids);
+}
+
+// Get the id of a format string (0 if NULL), writing the format and calling thread records if not yet written
+
+static uint32_t iot_log_binary_ids (iot_logger_binary_t * bin, const char * fmt, uint32_t tid)
+{
+  uint32_t id = 0u;
+  pthread_mutex_lock (&bin->mutex);
+  if (tid >= bin->nthreads)
+  {
+    uint32_t size = tid * 2u;
+    bin->threads = realloc (bin->threads, size * sizeof (*bin->threads));
+    memset (bin->threads + bin->nthreads, 0, (size - bin->nthreads) * sizeof (*bin->threads));
+    bin->nthreads = size;
+  }
+  if (! bin->threads[tid])
+  {
+    iot_log_binary_define (bin, IOT_LOG_BIN_THREAD, tid, iot_logger_thread_name ());
+    bin->threads[tid] = true;
+  }
+  if (fmt)
+  {
+    uint32_t index = iot_log_binary_slot (bin, fmt);
+    if (bin->fmts[index] == NULL)
+    {
+      if ((bin->count + 1u) * 4u > bin->size * 3u)
+      {
+        iot_log_binary_grow (bin);
+        index = iot_log_binary_slot (bin, fmt);
+      }
+      bin->fmts[index] = fmt;
+      bin->ids[index] = ++bin->count;
+      iot_log_binary_define (bin, IOT_LOG_BIN_FORMAT, bin->count, fmt);
+    }
+    id = bin->ids[index];
+  }
+  pthread_mutex_unlock (&bin->mutex);
+  return id;
+}
+
+// Write a message record, buff holding IOT_LOG_BIN_HEAD bytes reserved for the record header then len bytes of arguments.
+// File opened with O_APPEND, so each record write is atomic.
+
+static void iot_log_binary_message (iot_logger_binary_t * bin, char * buff, size_t len, iot_loglevel_t level, uint64_t timestamp, const char * fmt)
+{
+  uint8_t ids[IOT_LOG_BIN_HEAD];
+  uint8_t head[IOT_LOG_BIN_HEAD];
+  uint32_t tid = iot_logger_thread_id ();
+  uint32_t id = iot_log_binary_ids (bin, fmt, tid);
+  int64_t delta = (int64_t) (timestamp - bin->base);
+  size_t n = iot_log_varint (ids, iot_log_zigzag (delta));
+  n += iot_log_varint (ids + n, tid);
+  n += iot_log_varint (ids + n, id);
+  head[0] = (uint8_t) (IOT_LOG_BIN_MESSAGE | level);
+  size_t hlen = 1u + iot_log_varint (head + 1, n + len);
+  char * start = buff + IOT_LOG_BIN_HEAD - n - hlen;
+  memcpy (start, head, hlen);
+  memcpy (start + hlen, ids, n);
+  ssize_t ret = write (bin->fd, start, hlen + n + len);
+  (void) ret; // Nowhere to report error
+}
+
+static void iot_log_binary (iot_logger_t * logger, iot_loglevel_t level, uint64_t timestamp, const char * message, const void *ctx)
+{
+  (void) logger;
+  iot_logger_binary_t * bin = (iot_logger_binary_t*) ctx;
+  if (bin->fd != -1)
+  {
+    char buff[IOT_LOG_BIN_HEAD + IOT_LOG_MSG_MAX];
+    size_t len = strlen (message);
+    if (len >= IOT_LOG_MSG_MAX) len = IOT_LOG_MSG_MAX - 1u;
+    memcpy (buff + IOT_LOG_BIN_HEAD, message, len);
+    buff[IOT_LOG_BIN_HEAD + len] = 0;
+    iot_log_binary_message (bin, buff, len + 1u, level, timestamp, NULL);
+  }
+}
+
+// Capture a message for formatting by the decoder. Returns false if the format is not supported.
+
+static bool iot_log_binary_deferred (iot_logger_impl_t * logger, iot_loglevel_t level, uint64_t timestamp, const char * fmt, va_list args)
+{
+  iot_logger_binary_t * bin = (iot_logger_binary_t*) logger->ctx;
+  char buff[IOT_LOG_MSG_MAX];
+  size_t len = iot_log_binary_capture (buff, IOT_LOG_BIN_HEAD, sizeof (buff), fmt, args);
+  if (len == 0u) return false;
+  if (bin->fd != -1) iot_log_binary_message (bin, buff, len - IOT_LOG_BIN_HEAD, level, timestamp, fmt);
+  return true;
+}
+
+static void iot_logger_binary_free (void * ctx)
+{
+  iot_logger_binary_t * bin = (iot_logger_binary_t*) ctx;
+  if (bin->fd != -1) close (bin->fd);
+  pthread_mutex_destroy (&bin->mutex);
+  free (bin->fmts);
+  free (bin->ids);
+  free (bin->threads);
+  free (bin);
+}
+
+iot_logger_t * iot_logger_alloc_file_binary (const char * name, iot_loglevel_t level, bool self_start, iot_logger_t * next, const char *pathname)
+{
+  iot_logger_binary_t * bin = calloc (1, sizeof (*bin));
+  struct stat st;
+  iot_mutex_init (&bin->mutex);
+  bin->size = IOT_LOG_BIN_FORMATS;
+  bin->fmts = calloc (bin->size, sizeof (*bin->fmts));
+  bin->ids = calloc (bin->size, sizeof (*bin->ids));
+  bin->base = iot_time_usecs ();
+  bin->fd = open (pathname, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (bin->fd != -1)
+  {
+    if ((fstat (bin->fd, &st) == 0) && (st.st_size == 0))
+    {
+      uint8_t header[IOT_LOG_BIN_HEADER];
+      memcpy (header, IOT_LOG_BIN_MAGIC, IOT_LOG_BIN_MAGIC_LEN);
+      memcpy (header + IOT_LOG_BIN_MAGIC_LEN, iot_log_arg_sizes, IOT_LOG_ARG_STR);
+      header[IOT_LOG_BIN_MAGIC_LEN] = iot_log_binary_order ();
+      ssize_t ret = write (bin->fd, header, sizeof (header));
+      (void) ret; // Nowhere to report error
+    }
+    iot_log_binary_define (bin, IOT_LOG_BIN_SESSION, bin->base, name);
+  }
+  iot_logger_t * logger = iot_logger_alloc_custom (name, level, self_start, next, iot_log_binary, bin, iot_logger_binary_free);
+  ((iot_logger_impl_t*) logger)->deferred = true;
+  return logger;
+}
+
+/********* Binary File Logger Decoder *********/
+
+static bool iot_log_varint_read (const uint8_t ** pos, const uint8_t * end, uint64_t * v)
+{
+  *v = 0u;
+  for (uint32_t shift = 0u; (*pos < end) && (shift < 64u); shift += 7u)
+  {
+    uint8_t b = *(*pos)++;
+    *v |= (uint64_t) (b & 0x7fu) << shift;
+    if ((b & 0x80u) == 0u) return true;
+  }
+  return false;
+}
+
+// Read a varint integer, zigzag decoded if signed
+
+static bool iot_log_decode_int (const uint8_t ** pos, const uint8_t * end, bool sign, int64_t * v)
+{
+  uint64_t u;
+  if (! iot_log_varint_read (pos, end, &u)) return false;
+  *v = sign ? ((int64_t) (u >> 1u) ^ -(int64_t) (u & 1u)) : (int64_t) u;
+  return true;
+}
+
+#define IOT_LOG_DECODE(T,V) \
+{ \
+  T v = (T) (V); \
+  if ((size_t) (limit - out) < sizeof (v)) return false; \
+  memcpy (out, &v, sizeof (v)); \
+  out += sizeof (v); \
+}
+
+#define IOT_LOG_DECODE_INT(T) \
+{ \
+  if (! iot_log_decode_int (&pos, end, sign, &val)) return false; \
+  IOT_LOG_DECODE (T, val) \
+}
+
+// Convert arguments packed by iot_log_binary_capture to those captured for deferred formatting on this platform
+
+static bool iot_log_decode_args (const uint8_t * pos, const uint8_t * end, const uint8_t * sizes, const char * fmt, char * out, size_t size)
+{
+  const char * limit = out + size;
+  iot_log_spec_t spec;
+  int64_t val;
+  while ((fmt = strchr (fmt, '%')))
+  {
+    if (! iot_log_spec (fmt, &spec)) return false;
+    bool sign = (strchr ("dic", fmt[spec.len - 1u]) != NULL);
+    for (uint32_t i = 0; i < spec.stars; i++)
+    {
+      if (! iot_log_decode_int (&pos, end, true, &val)) return false;
+      IOT_LOG_DECODE (int, val)
+    }
+    switch (spec.type)
+    {
+      case IOT_LOG_ARG_INT: IOT_LOG_DECODE_INT (int) break;
+      case IOT_LOG_ARG_LONG: IOT_LOG_DECODE_INT (long) break;
+      case IOT_LOG_ARG_LLONG: IOT_LOG_DECODE_INT (long long) break;
+      case IOT_LOG_ARG_SIZE: IOT_LOG_DECODE_INT (size_t) break;
+      case IOT_LOG_ARG_INTMAX: IOT_LOG_DECODE_INT (intmax_t) break;
+      case IOT_LOG_ARG_PTRDIFF: IOT_LOG_DECODE_INT (ptrdiff_t) break;
+      case IOT_LOG_ARG_PTR:
+        if (! iot_log_decode_int (&pos, end, false, &val)) return false;
+        IOT_LOG_DECODE (void*, (uintptr_t) val)
+        break;
+      case IOT_LOG_ARG_DOUBLE:
+      {
+        double d;
+        if ((size_t) (end - pos) < sizeof (d)) return false;
+        memcpy (&d, pos, sizeof (d));
+        pos += sizeof (d);
+        IOT_LOG_DECODE (double, d)
+        break;
+      }
+      case IOT_LOG_ARG_LDOUBLE:
+      {
+        long double ld = 0.0L;
+        double d;
+        if ((size_t) (end - pos) < sizes[IOT_LOG_ARG_LDOUBLE]) return false;
+        if (sizes[IOT_LOG_ARG_LDOUBLE] == sizeof (ld))
+        {
+          memcpy (&ld, pos, sizeof (ld));
+        }
+        else if (sizes[IOT_LOG_ARG_LDOUBLE] == sizeof (d)) // Logging platform long double is double
+        {
+          memcpy (&d, pos, sizeof (d));
+          ld = d;
+        }
+        pos += sizes[IOT_LOG_ARG_LDOUBLE];
+        IOT_LOG_DECODE (long double, ld)
+        break;
+      }
+      case IOT_LOG_ARG_STR:
+      {
+        const uint8_t * nul = memchr (pos, 0, (size_t) (end - pos));
+        if (nul == NULL) return false;
+        size_t len = (size_t) (nul - pos) + 1u;
+        if ((size_t) (limit - out) < len) return false;
+        memcpy (out, pos, len);
+        out += len;
+        pos += len;
+        break;
+      }
+      default: break;
+    }
+    fmt += spec.len;
+  }
+  return true;
+}
+
+// Add a thread name or format string to a decoder table, by id
+
+static bool iot_log_decode_define (const char *** table, size_t * count, uint64_t id, const uint8_t * str, size_t max)
+{
+  if (id >= max) return false; // Ids cannot exceed the number of records
+  if (id >= *count)
+  {
+    size_t size = (size_t) id * 2u + 1u;
+    *table = realloc (*table, size * sizeof (**table));
+    memset (*table + *count, 0, (size - *count) * sizeof (**table));
+    *count = size;
+  }
+  (*table)[id] = (const char*) str;
+  return true;
+}
+
+bool iot_logger_decode_binary (const char * pathname, FILE * out)
+{
+  assert (pathname && out);
+  size_t size = 0u;
+  uint8_t * data = iot_file_read_binary (pathname, &size);
+  bool ok = data && (size >= IOT_LOG_BIN_HEADER) && (memcmp (data, IOT_LOG_BIN_MAGIC, IOT_LOG_BIN_MAGIC_LEN) == 0);
+  const uint8_t * sizes = ok ? (data + IOT_LOG_BIN_MAGIC_LEN) : NULL; // Indexed by argument type, first the byte order
+  const uint8_t * pos = ok ? (data + IOT_LOG_BIN_HEADER) : NULL;
+  const uint8_t * end = ok ? (data + size) : NULL;
+  const char ** threads = NULL;
+  const char ** fmts = NULL;
+  size_t nthreads = 0u;
+  size_t nfmts = 0u;
+  const char * name = "";
+  uint64_t base = 0u;
+  char args[IOT_LOG_MSG_MAX * 2u];
+  char line[IOT_LOG_MSG_MAX];
+
+  ok = ok && (sizes[0] == iot_log_binary_order ()) && (sizes[IOT_LOG_ARG_DOUBLE] == sizeof (double));
+  while (ok && (pos < end))
+  {
+    uint8_t kind = *pos++;
+    uint64_t len, value;
+    int64_t delta = 0;
+    ok = iot_log_varint_read (&pos, end, &len) && (len <= (uint64_t) (end - pos));
+    if (! ok) break;
+    const uint8_t * next = pos + len;
+    if (kind >= IOT_LOG_BIN_MESSAGE)
+    {
+      iot_loglevel_t level = (iot_loglevel_t) (kind & 0x0fu);
+      uint64_t tid = 0u;
+      uint64_t id = 0u;
+      const char * fmt = NULL;
+      ok = (level < IOT_LOG_LEVELS) && iot_log_decode_int (&pos, next, true, &delta) && iot_log_varint_read (&pos, next, &tid) && iot_log_varint_read (&pos, next, &id);
+      if (ok) fmt = (id == 0u) ? "%s" : ((id < nfmts) ? fmts[id] : NULL);
+      ok = ok && fmt && iot_log_decode_args (pos, next, sizes, fmt, args, sizeof (args));
+      if (ok)
+      {
+        const char * tname = ((tid < nthreads) && threads[tid]) ? threads[tid] : "";
+        int ret = snprintf (line, sizeof (line), "[%s:%" PRIu64 ":%s:%s] ", tname, base + (uint64_t) delta, name, iot_log_levels[level]);
+        size_t prefix = (ret < 0) ? 0u : (((size_t) ret < sizeof (line)) ? (size_t) ret : (sizeof (line) - 1u));
+        fwrite (line, 1u, iot_log_args_format (line, prefix, fmt, args), out);
+      }
+    }
+    else if ((kind >= IOT_LOG_BIN_SESSION) && (kind <= IOT_LOG_BIN_THREAD))
+    {
+      ok = iot_log_varint_read (&pos, next, &value) && (pos < next) && (next[-1] == 0u);
+      if (ok && (kind == IOT_LOG_BIN_SESSION))
+      {
+        base = value;
+        name = (const char*) pos;
+        if (threads) memset (threads, 0, nthreads * sizeof (*threads));
+        if (fmts) memset (fmts, 0, nfmts * sizeof (*fmts));
+      }
+      else if (ok)
+      {
+        ok = (kind == IOT_LOG_BIN_FORMAT) ? iot_log_decode_define (&fmts, &nfmts, value, pos, size) : iot_log_decode_define (&threads, &nthreads, value, pos, size);
+      }
+    }
+    pos = next; // Records of unknown kind are skipped
+  }
+  free (threads);
+  free (fmts);
+  free (data);
+  return ok;
 }
 
 #endif
@@ -279,6 +1523,7 @@ void iot_logger_set_next (iot_logger_t * logger, iot_logger_t * next)
   iot_logger_free ((iot_logger_t*) logimpl->next);
   iot_logger_add_ref (next);
   logimpl->next = (iot_logger_impl_t*) next;
+  iot_logger_update_thresholds ();
 }
 
 #ifdef IOT_BUILD_COMPONENTS
@@ -288,6 +1533,21 @@ static iot_loglevel_t iot_logger_config_level (const iot_data_t * map)
   return iot_logger_level_from_string (iot_data_string_map_get_string (map, "Level"));
 }
 
+#if defined (IOT_HAS_FILE) && !defined (_AZURESPHERE_)
+static void iot_logger_config_file_options (const iot_data_t * map, iot_logger_file_options_t * opts)
+{
+  const char * sync = iot_data_string_map_get_string (map, "Sync");
+  opts->max_size = (uint64_t) iot_data_string_map_get_i64 (map, "MaxSize", 0);
+  opts->max_age = (uint32_t) iot_data_string_map_get_i64 (map, "MaxAge", 0);
+  opts->max_files = (uint32_t) iot_data_string_map_get_i64 (map, "MaxFiles", 1);
+  opts->buffer_size = (uint32_t) iot_data_string_map_get_i64 (map, "BufferSize", 0);
+  opts->flush_interval = (uint32_t) iot_data_string_map_get_i64 (map, "FlushInterval", 0);
+  opts->sync = IOT_LOG_SYNC_NONE;
+  if (sync && strcmp (sync, "Rotate") == 0) opts->sync = IOT_LOG_SYNC_ROTATE;
+  if (sync && strcmp (sync, "Flush") == 0) opts->sync = IOT_LOG_SYNC_FLUSH;
+}
+#endif
+
 static iot_component_t * iot_logger_config (iot_container_t * cont, const iot_data_t * map)
 {
   iot_logger_t *result;
@@ -296,11 +1556,32 @@ static iot_component_t * iot_logger_config (iot_container_t * cont, const iot_da
   bool start = iot_data_string_map_get_bool (map, "Start", true);
   const char * name = iot_data_string_map_get_string (map, "Name");
   const char * to = iot_data_string_map_get_string (map, "To");
+  uint32_t entries = (uint32_t) iot_data_string_map_get_i64 (map, "AsyncEntries", 0);
+  bool deferred = iot_data_string_map_get_bool (map, "Deferred", false);
+  uint32_t rate_limit = (uint32_t) iot_data_string_map_get_i64 (map, "RateLimit", 0);
 
 #if defined (IOT_HAS_FILE) && !defined (_AZURESPHERE_)
   if (to && strncmp (to, "file:", 5) == 0 && strlen (to) > 5)
   {
-    result = iot_logger_alloc_file (name, level, start, next, to + 5);
+    iot_logger_file_options_t opts;
+    iot_logger_config_file_options (map, &opts);
+    if (entries)
+    {
+      result = iot_logger_alloc_file_async (name, level, start, next, to + 5, entries);
+    }
+    else if (opts.max_size || opts.max_age || opts.buffer_size || (opts.sync != IOT_LOG_SYNC_NONE))
+    {
+      result = iot_logger_alloc_file_options (name, level, start, next, to + 5, &opts);
+    }
+    else
+    {
+      result = iot_logger_alloc_file (name, level, start, next, to + 5);
+    }
+  }
+  else
+  if (to && strncmp (to, "binary:", 7) == 0 && strlen (to) > 7)
+  {
+    result = iot_logger_alloc_file_binary (name, level, start, next, to + 7);
   }
   else
 #endif
@@ -319,20 +1600,23 @@ static iot_component_t * iot_logger_config (iot_container_t * cont, const iot_da
         to = sep + 1;
       }
       port = (uint16_t) atoi (to);
-      result = iot_logger_alloc_udp (name, level, start, next, host, port);
+      result = entries ? iot_logger_alloc_udp_async (name, level, start, next, host, port, entries) : iot_logger_alloc_udp (name, level, start, next, host, port);
     }
     else
     {
       result = iot_logger_alloc_custom (name, level, start, next, iot_log_console, NULL, NULL);
     }
   }
+  if (deferred) iot_logger_set_deferred (result, true);
+  iot_logger_set_rate_limit (result, rate_limit);
   return (iot_component_t*) result;
 }
 
 static bool iot_logger_reconfig (iot_component_t * comp, iot_container_t * cont, const iot_data_t * map)
 {
   (void) cont;
-  ((iot_logger_t*) comp)->level = iot_logger_config_level (map);
+  iot_logger_set_level ((iot_logger_t*) comp, iot_logger_config_level (map));
+  iot_logger_set_rate_limit ((iot_logger_t*) comp, (uint32_t) iot_data_string_map_get_i64 (map, "RateLimit", 0));
   return true;
 }
 
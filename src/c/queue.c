@@ -5,26 +5,327 @@
 //
 
 #include "iot/queue.h"
+#include "iot/time.h"
+#include "iot/thread.h"
+#include "trace-impl.h"
+
+#define IOT_QUEUE_CACHE_LINE 64u
+
+// Bounded multi producer, multi consumer ring (after D. Vyukov). Each cell sequence number
+// indicates whether the cell is free for the producer or filled for the consumer at a position.
+
+typedef struct iot_queue_cell_t
+{
+  _Atomic uint64_t seq;
+  iot_data_t *data;
+} iot_queue_cell_t;
+
+typedef struct iot_queue_ring_t
+{
+  _Alignas (IOT_QUEUE_CACHE_LINE) _Atomic uint64_t head;  // Next position to enqueue
+  _Alignas (IOT_QUEUE_CACHE_LINE) _Atomic uint64_t tail;  // Next position to dequeue
+  _Alignas (IOT_QUEUE_CACHE_LINE) _Atomic uint32_t consumers; // Number of parked consumers
+  _Atomic uint32_t producers; // Number of parked producers
+  uint32_t size;
+  iot_queue_cell_t cells[];
+} iot_queue_ring_t;
 
 struct iot_queue_t
 {
   iot_data_t *queue;
+  iot_data_t *priority;   // Priority elements, dequeued before those in queue (list queue)
+  iot_queue_ring_t *ring;
+  iot_flow_t *flow;       // Flow control updated with the queue size, NULL if none
   pthread_mutex_t mtx;
   pthread_cond_t added;
   pthread_cond_t removed;
   uint32_t maxsize;
-  bool running;
+  atomic_bool running;
+  uint64_t enqueued;      // Number of elements enqueued (list queue)
+  uint64_t dequeued;      // Number of elements dequeued (list queue)
+  uint32_t high_water;    // Maximum number of queued elements (list queue)
+  uint64_t enq_blocked;   // Number of blocking enqueues
+  uint64_t enq_wait;      // Total blocked enqueue time, in ns
+  uint64_t deq_blocked;   // Number of blocking dequeues
+  uint64_t deq_wait;      // Total blocked dequeue time, in ns
 };
 
-iot_queue_t *iot_queue_alloc (uint32_t maxsize)
+// Blocked operation counts and times are updated with the mutex held
+
+static inline void iot_queue_blocked (uint64_t *count, uint64_t *wait, uint64_t start)
+{
+  (*count)++;
+  *wait += iot_time_nsecs () - start;
+}
+
+// List queue length, including priority elements
+
+static inline uint32_t iot_queue_length (const iot_queue_t *q)
+{
+  return iot_data_list_length (q->queue) + iot_data_list_length (q->priority);
+}
+
+static inline iot_data_t *iot_queue_pop (iot_queue_t *q)
+{
+  iot_data_t *result = iot_data_list_tail_pop (q->priority);
+  return result ? result : iot_data_list_tail_pop (q->queue);
+}
+
+static inline void iot_queue_pushed (iot_queue_t *q)
+{
+  uint32_t len = iot_queue_length (q);
+  q->enqueued++;
+  if (len > q->high_water) q->high_water = len;
+  if (q->flow) iot_flow_update (q->flow, len);
+  IOT_TRACE (IOT_TRACE_QUEUE_ENQUEUE, (uintptr_t) q);
+}
+
+// Update flow control with the ring size, after an element is added or removed
+
+static inline void iot_queue_ring_flow (iot_queue_t *q)
+{
+  if (q->flow)
+  {
+    uint64_t tail = atomic_load (&q->ring->tail);
+    uint64_t head = atomic_load (&q->ring->head);
+    iot_flow_update (q->flow, (head > tail) ? (uint32_t) (head - tail) : 0u);
+  }
+}
+
+static iot_queue_t *iot_queue_init (uint32_t maxsize)
 {
   iot_queue_t *result = calloc (1, sizeof (iot_queue_t));
-  result->queue = iot_data_alloc_list ();
   result->maxsize = maxsize;
-  result->running = true;
-  pthread_mutex_init (&result->mtx, NULL);
-  pthread_cond_init (&result->added, NULL);
-  pthread_cond_init (&result->removed, NULL);
+  atomic_store (&result->running, true);
+  iot_mutex_init (&result->mtx);
+  iot_cond_init (&result->added);
+  iot_cond_init (&result->removed);
+  return result;
+}
+
+iot_queue_t *iot_queue_alloc (uint32_t maxsize)
+{
+  iot_queue_t *result = iot_queue_init (maxsize);
+  result->queue = iot_data_alloc_list ();
+  result->priority = iot_data_alloc_list ();
+  return result;
+}
+
+iot_queue_t *iot_queue_alloc_ring (uint32_t size)
+{
+  assert (size);
+  iot_queue_t *result = iot_queue_init (size);
+  iot_queue_ring_t *ring = aligned_alloc (IOT_QUEUE_CACHE_LINE, ((sizeof (*ring) + size * sizeof (iot_queue_cell_t) + IOT_QUEUE_CACHE_LINE - 1) / IOT_QUEUE_CACHE_LINE) * IOT_QUEUE_CACHE_LINE);
+  atomic_store (&ring->head, 0u);
+  atomic_store (&ring->tail, 0u);
+  atomic_store (&ring->consumers, 0u);
+  atomic_store (&ring->producers, 0u);
+  ring->size = size;
+  for (uint32_t i = 0; i < size; i++)
+  {
+    atomic_store_explicit (&ring->cells[i].seq, i, memory_order_relaxed);
+    ring->cells[i].data = NULL;
+  }
+  result->ring = ring;
+  return result;
+}
+
+static bool iot_queue_ring_push (iot_queue_ring_t *ring, iot_data_t *element)
+{
+  uint64_t pos = atomic_load_explicit (&ring->head, memory_order_relaxed);
+  while (true)
+  {
+    iot_queue_cell_t *cell = &ring->cells[pos % ring->size];
+    uint64_t seq = atomic_load_explicit (&cell->seq, memory_order_acquire);
+    int64_t diff = (int64_t) (seq - pos);
+    if (diff == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit (&ring->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+      {
+        cell->data = element;
+        atomic_store_explicit (&cell->seq, pos + 1, memory_order_release);
+        return true;
+      }
+    }
+    else if (diff < 0)
+    {
+      return false; // Full
+    }
+    else
+    {
+      pos = atomic_load_explicit (&ring->head, memory_order_relaxed);
+    }
+  }
+}
+
+static iot_data_t *iot_queue_ring_pop (iot_queue_ring_t *ring)
+{
+  uint64_t pos = atomic_load_explicit (&ring->tail, memory_order_relaxed);
+  while (true)
+  {
+    iot_queue_cell_t *cell = &ring->cells[pos % ring->size];
+    uint64_t seq = atomic_load_explicit (&cell->seq, memory_order_acquire);
+    int64_t diff = (int64_t) (seq - (pos + 1));
+    if (diff == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit (&ring->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+      {
+        iot_data_t *element = cell->data;
+        atomic_store_explicit (&cell->seq, pos + ring->size, memory_order_release);
+        return element;
+      }
+    }
+    else if (diff < 0)
+    {
+      return NULL; // Empty
+    }
+    else
+    {
+      pos = atomic_load_explicit (&ring->tail, memory_order_relaxed);
+    }
+  }
+}
+
+// Wake parked threads. Waiters register before re-checking the ring under the mutex, so
+// with the fence either the waiter sees the change, or the waker sees the waiter.
+
+static inline void iot_queue_ring_wake (iot_queue_t *q, _Atomic uint32_t *waiters, pthread_cond_t *cond, bool all)
+{
+  atomic_thread_fence (memory_order_seq_cst);
+  if (atomic_load_explicit (waiters, memory_order_relaxed))
+  {
+    pthread_mutex_lock (&q->mtx);
+    if (all)
+    {
+      pthread_cond_broadcast (cond);
+    }
+    else
+    {
+      pthread_cond_signal (cond);
+    }
+    pthread_mutex_unlock (&q->mtx);
+  }
+}
+
+// Pop an element from a ring, waiting until timeout_ns if none available (0 to not wait, UINT64_MAX for no timeout)
+
+static iot_data_t *iot_queue_ring_wait (iot_queue_t *q, uint64_t timeout_ns)
+{
+  iot_queue_ring_t *ring = q->ring;
+  iot_data_t *result = iot_queue_ring_pop (ring);
+  if (result == NULL && timeout_ns)
+  {
+    uint64_t start = iot_time_nsecs ();
+    uint64_t deadline = iot_cond_deadline (timeout_ns);
+    pthread_mutex_lock (&q->mtx);
+    atomic_fetch_add (&ring->consumers, 1u);
+    while (true)
+    {
+      atomic_thread_fence (memory_order_seq_cst);
+      if ((result = iot_queue_ring_pop (ring)) || !atomic_load (&q->running)) break;
+      if (!iot_cond_timedwait (&q->added, &q->mtx, deadline))
+      {
+        result = iot_queue_ring_pop (ring);
+        break;
+      }
+    }
+    atomic_fetch_sub (&ring->consumers, 1u);
+    iot_queue_blocked (&q->deq_blocked, &q->deq_wait, start);
+    pthread_mutex_unlock (&q->mtx);
+  }
+  return result;
+}
+
+static iot_data_t *iot_queue_ring_dequeue (iot_queue_t *q, uint64_t timeout_ns)
+{
+  iot_data_t *result = iot_queue_ring_wait (q, timeout_ns);
+  if (result)
+  {
+    IOT_TRACE (IOT_TRACE_QUEUE_DEQUEUE, (uintptr_t) q);
+    iot_queue_ring_flow (q);
+    iot_queue_ring_wake (q, &q->ring->producers, &q->removed, false);
+  }
+  return result;
+}
+
+static bool iot_queue_ring_enqueue (iot_queue_t *q, iot_data_t *element, bool wait)
+{
+  iot_queue_ring_t *ring = q->ring;
+  bool result = iot_queue_ring_push (ring, element);
+  if (!result && wait)
+  {
+    uint64_t start = iot_time_nsecs ();
+    pthread_mutex_lock (&q->mtx);
+    atomic_fetch_add (&ring->producers, 1u);
+    while (true)
+    {
+      atomic_thread_fence (memory_order_seq_cst);
+      if ((result = iot_queue_ring_push (ring, element)) || !atomic_load (&q->running)) break;
+      pthread_cond_wait (&q->removed, &q->mtx);
+    }
+    atomic_fetch_sub (&ring->producers, 1u);
+    iot_queue_blocked (&q->enq_blocked, &q->enq_wait, start);
+    pthread_mutex_unlock (&q->mtx);
+  }
+  if (result)
+  {
+    IOT_TRACE (IOT_TRACE_QUEUE_ENQUEUE, (uintptr_t) q);
+    iot_queue_ring_flow (q);
+    iot_queue_ring_wake (q, &ring->consumers, &q->added, false);
+  }
+  return result;
+}
+
+// Pop up to max elements from a ring, waiting until timeout_ns for the first if none available
+
+static uint32_t iot_queue_ring_dequeue_batch (iot_queue_t *q, uint32_t max, uint64_t timeout_ns, iot_data_t *list)
+{
+  iot_data_t *element = iot_queue_ring_wait (q, timeout_ns);
+  uint32_t count = 0u;
+  while (element)
+  {
+    iot_data_list_tail_push (list, element);
+    IOT_TRACE (IOT_TRACE_QUEUE_DEQUEUE, (uintptr_t) q);
+    element = (++count < max) ? iot_queue_ring_pop (q->ring) : NULL;
+  }
+  if (count)
+  {
+    iot_queue_ring_flow (q);
+    iot_queue_ring_wake (q, &q->ring->producers, &q->removed, true);
+  }
+  return count;
+}
+
+// Wait until the list queue is not empty, or until a deadline. Called with the mutex held.
+
+static void iot_queue_list_wait (iot_queue_t *q, uint64_t timeout_ns)
+{
+  if (timeout_ns && iot_queue_length (q) == 0u && q->running)
+  {
+    uint64_t start = iot_time_nsecs ();
+    uint64_t deadline = iot_cond_deadline (timeout_ns);
+    while (iot_queue_length (q) == 0u && q->running)
+    {
+      if (!iot_cond_timedwait (&q->added, &q->mtx, deadline)) break;
+    }
+    iot_queue_blocked (&q->deq_blocked, &q->deq_wait, start);
+  }
+}
+
+static iot_data_t *iot_queue_list_dequeue (iot_queue_t *q, uint64_t timeout_ns)
+{
+  iot_data_t *result;
+  pthread_mutex_lock (&q->mtx);
+  iot_queue_list_wait (q, timeout_ns);
+  result = iot_queue_pop (q);
+  if (result)
+  {
+    q->dequeued++;
+    IOT_TRACE (IOT_TRACE_QUEUE_DEQUEUE, (uintptr_t) q);
+    if (q->flow) iot_flow_update (q->flow, iot_queue_length (q));
+    pthread_cond_signal (&q->removed);
+  }
+  pthread_mutex_unlock (&q->mtx);
   return result;
 }
 
@@ -32,7 +333,7 @@ void iot_queue_stop (iot_queue_t *q)
 {
   assert (q);
   pthread_mutex_lock (&q->mtx);
-  q->running = false;
+  atomic_store (&q->running, false);
   pthread_cond_broadcast (&q->added);
   pthread_cond_broadcast (&q->removed);
   pthread_mutex_unlock (&q->mtx);
@@ -42,7 +343,15 @@ void iot_queue_free (iot_queue_t *q)
 {
   if (q)
   {
+    if (q->ring)
+    {
+      iot_data_t *element;
+      while ((element = iot_queue_ring_pop (q->ring))) iot_data_free (element);
+      free (q->ring);
+    }
     iot_data_free (q->queue);
+    iot_data_free (q->priority);
+    iot_flow_free (q->flow);
     pthread_cond_destroy (&q->added);
     pthread_cond_destroy (&q->removed);
     pthread_mutex_destroy (&q->mtx);
@@ -52,48 +361,33 @@ void iot_queue_free (iot_queue_t *q)
 
 iot_data_t *iot_queue_try_dequeue (iot_queue_t *q)
 {
-  iot_data_t *result = NULL;
   assert (q);
-  pthread_mutex_lock (&q->mtx);
-  result = iot_data_list_tail_pop (q->queue);
-  if (result)
-  {
-    pthread_cond_signal (&q->removed);
-  }
-  pthread_mutex_unlock (&q->mtx);
-  return result;
+  return q->ring ? iot_queue_ring_dequeue (q, 0u) : iot_queue_list_dequeue (q, 0u);
 }
 
 iot_data_t *iot_queue_dequeue (iot_queue_t *q)
 {
-  iot_data_t *result;
   assert (q);
-  pthread_mutex_lock (&q->mtx);
-  result = iot_data_list_tail_pop (q->queue);
-  while (result == NULL)
-  {
-    if (!q->running)
-    {
-      pthread_mutex_unlock (&q->mtx);
-      return NULL;
-    }
-    pthread_cond_wait (&q->added, &q->mtx);
-    result = iot_data_list_tail_pop (q->queue);
-  }
-  pthread_cond_signal (&q->removed);
-  pthread_mutex_unlock (&q->mtx);
-  return result;
+  return q->ring ? iot_queue_ring_dequeue (q, UINT64_MAX) : iot_queue_list_dequeue (q, UINT64_MAX);
+}
+
+iot_data_t *iot_queue_dequeue_timed (iot_queue_t *q, uint64_t timeout_ns)
+{
+  assert (q);
+  return q->ring ? iot_queue_ring_dequeue (q, timeout_ns) : iot_queue_list_dequeue (q, timeout_ns);
 }
 
 bool iot_queue_try_enqueue (iot_queue_t *q, iot_data_t *element)
 {
   bool result = false;
   assert (q && element);
+  if (q->ring) return iot_queue_ring_enqueue (q, element, false);
   pthread_mutex_lock (&q->mtx);
-  if (q->maxsize == 0 || iot_data_list_length (q->queue) < q->maxsize)
+  if (q->maxsize == 0 || iot_queue_length (q) < q->maxsize)
   {
     result = true;
     iot_data_list_head_push (q->queue, element);
+    iot_queue_pushed (q);
     pthread_cond_signal (&q->added);
   }
   pthread_mutex_unlock (&q->mtx);
@@ -103,28 +397,81 @@ bool iot_queue_try_enqueue (iot_queue_t *q, iot_data_t *element)
 void iot_queue_enqueue (iot_queue_t *q, iot_data_t *element)
 {
   assert (q && element);
+  if (q->ring)
+  {
+    iot_queue_ring_enqueue (q, element, true);
+    return;
+  }
   pthread_mutex_lock (&q->mtx);
-  while (q->maxsize && iot_data_list_length (q->queue) >= q->maxsize)
+  if (q->maxsize && iot_queue_length (q) >= q->maxsize)
   {
+    uint64_t start = iot_time_nsecs ();
+    while (q->maxsize && iot_queue_length (q) >= q->maxsize && q->running)
+    {
+      pthread_cond_wait (&q->removed, &q->mtx);
+    }
+    iot_queue_blocked (&q->enq_blocked, &q->enq_wait, start);
     if (!q->running)
     {
       pthread_mutex_unlock (&q->mtx);
       return;
     }
-    pthread_cond_wait (&q->removed, &q->mtx);
   }
   iot_data_list_head_push (q->queue, element);
+  iot_queue_pushed (q);
   pthread_cond_signal (&q->added);
   pthread_mutex_unlock (&q->mtx);
 }
 
+uint32_t iot_queue_dequeue_batch (iot_queue_t *q, uint32_t max, uint64_t timeout_ns, iot_data_t *list)
+{
+  uint32_t count = 0u;
+  iot_data_t *element;
+  assert (q && list && max);
+  if (q->ring) return iot_queue_ring_dequeue_batch (q, max, timeout_ns, list);
+  pthread_mutex_lock (&q->mtx);
+  iot_queue_list_wait (q, timeout_ns);
+  while (count < max && (element = iot_queue_pop (q)))
+  {
+    iot_data_list_tail_push (list, element);
+    IOT_TRACE (IOT_TRACE_QUEUE_DEQUEUE, (uintptr_t) q);
+    count++;
+  }
+  if (count)
+  {
+    q->dequeued += count;
+    if (q->flow) iot_flow_update (q->flow, iot_queue_length (q));
+    pthread_cond_broadcast (&q->removed);
+  }
+  pthread_mutex_unlock (&q->mtx);
+  return count;
+}
+
+bool iot_queue_enqueue_priority (iot_queue_t *q, iot_data_t *element)
+{
+  assert (q && element);
+  if (q->ring) return iot_queue_ring_enqueue (q, element, false);
+  pthread_mutex_lock (&q->mtx);
+  iot_data_list_head_push (q->priority, element);
+  iot_queue_pushed (q);
+  pthread_cond_signal (&q->added);
+  pthread_mutex_unlock (&q->mtx);
+  return true;
+}
+
 uint32_t iot_queue_size (const iot_queue_t *q)
 {
   uint32_t result;
   pthread_mutex_t *mtx = (pthread_mutex_t *)&q->mtx;
   assert (q);
+  if (q->ring)
+  {
+    uint64_t tail = atomic_load (&q->ring->tail);
+    uint64_t head = atomic_load (&q->ring->head);
+    return (head > tail) ? (uint32_t) (head - tail) : 0u;
+  }
   pthread_mutex_lock (mtx);
-  result = iot_data_list_length (q->queue);
+  result = iot_queue_length (q);
   pthread_mutex_unlock (mtx);
   return result;
 }
@@ -143,6 +490,7 @@ uint32_t iot_queue_maxsize (const iot_queue_t *q)
 void iot_queue_setmaxsize (iot_queue_t *q, uint32_t maxsize)
 {
   assert (q);
+  if (q->ring) return; // Ring size fixed on allocation
   pthread_mutex_lock (&q->mtx);
   if (maxsize > q->maxsize || maxsize == 0)
   {
@@ -151,3 +499,45 @@ void iot_queue_setmaxsize (iot_queue_t *q, uint32_t maxsize)
   q->maxsize = maxsize;
   pthread_mutex_unlock (&q->mtx);
 }
+
+void iot_queue_set_flow (iot_queue_t *q, iot_flow_t *flow)
+{
+  assert (q);
+  iot_flow_add_ref (flow);
+  pthread_mutex_lock (&q->mtx);
+  iot_flow_t *prev = q->flow;
+  q->flow = flow;
+  pthread_mutex_unlock (&q->mtx);
+  iot_flow_free (prev);
+}
+
+iot_data_t *iot_queue_stats (const iot_queue_t *q)
+{
+  iot_data_t *map = iot_data_alloc_map (IOT_DATA_STRING);
+  pthread_mutex_t *mtx = (pthread_mutex_t *)&q->mtx;
+  uint64_t enqueued, dequeued;
+  assert (q);
+  pthread_mutex_lock (mtx);
+  if (q->ring)
+  {
+    dequeued = atomic_load (&q->ring->tail);
+    enqueued = atomic_load (&q->ring->head);
+    if (enqueued < dequeued) enqueued = dequeued;
+  }
+  else
+  {
+    enqueued = q->enqueued;
+    dequeued = q->dequeued;
+    iot_data_string_map_add (map, "high_water", iot_data_alloc_ui32 (q->high_water));
+  }
+  iot_data_string_map_add (map, "size", iot_data_alloc_ui32 ((uint32_t) (enqueued - dequeued)));
+  iot_data_string_map_add (map, "max_size", iot_data_alloc_ui32 (q->maxsize));
+  iot_data_string_map_add (map, "enqueued", iot_data_alloc_ui64 (enqueued));
+  iot_data_string_map_add (map, "dequeued", iot_data_alloc_ui64 (dequeued));
+  iot_data_string_map_add (map, "enqueue_blocked", iot_data_alloc_ui64 (q->enq_blocked));
+  iot_data_string_map_add (map, "enqueue_wait_ns", iot_data_alloc_ui64 (q->enq_wait));
+  iot_data_string_map_add (map, "dequeue_blocked", iot_data_alloc_ui64 (q->deq_blocked));
+  iot_data_string_map_add (map, "dequeue_wait_ns", iot_data_alloc_ui64 (q->deq_wait));
+  pthread_mutex_unlock (mtx);
+  return map;
+}
@@ -0,0 +1,649 @@
+//
+// Copyright (c) 2024 IOTech
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+
+#include "iot/reactor.h"
+#include "iot/container.h"
+#include "iot/thread.h"
+#include "iot/time.h"
+
+#ifdef __linux__
+#define IOT_REACTOR_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#else
+#include <poll.h>
+#endif
+
+#define IOT_REACTOR_EVENTS 64u        // Maximum number of events handled per wait
+#define IOT_REACTOR_POLL_MAX 100u     // Maximum poll wait in ms, bounds latency of changes when no wake descriptor
+
+#ifdef IOT_BUILD_COMPONENTS
+#define IOT_REACTOR_FACTORY iot_reactor_factory ()
+#else
+#define IOT_REACTOR_FACTORY NULL
+#endif
+
+// A watched descriptor or timer. Sources are reference counted, as dispatched callbacks may still be running
+// when a source is removed. Sources are only watched when not dispatched, so each callback runs on one thread at a time.
+
+typedef struct iot_reactor_source_t
+{
+  iot_reactor_t * reactor;           // Owning reactor
+  iot_reactor_fn_t function;         // Readiness callback
+  void * arg;                        // Callback argument
+  int fd;                            // Watched descriptor, timerfd or (for poll) negative timer identifier
+  uint32_t seq;                      // Source sequence number, detects events for removed descriptors
+  uint32_t events;                   // Events watched for
+  uint32_t ready;                    // Events ready when dispatched
+  uint64_t period;                   // Timer period in ns, zero if one shot
+  uint64_t due;                      // Timer expiry time (poll only)
+  bool timer;                        // Whether source is a timer
+  bool busy;                         // Whether callback dispatched and not yet completed
+  bool removed;                      // Whether removed from reactor
+  atomic_int_fast32_t refs;          // Current reference count
+  iot_data_static_t key;             // Data wrapper for descriptor used as key for sources map
+  iot_data_static_t self;            // Data wrapper for self pointer used as value for sources map
+} iot_reactor_source_t;
+
+struct iot_reactor_t
+{
+  iot_component_t component;         // Component base type
+  iot_data_t * sources;              // Map of sources, keyed by descriptor or timer identifier
+  iot_threadpool_t * pool;           // Thread pool running callbacks, NULL to run on reactor thread
+  iot_logger_t * logger;             // Optional logger
+  atomic_bool active;                // Whether reactor thread is running
+  int wake_fd;                       // Descriptor written to wake reactor thread, -1 if none
+  uint32_t seq;                      // Next source sequence number
+  uint32_t batch_size;               // Allocated size of dispatch batch
+  iot_threadpool_job_t * batch;      // Batch of callbacks for thread pool
+  _Atomic uint64_t waits;            // Number of waits returning events
+  _Atomic uint64_t dispatched;       // Number of callbacks run
+#ifdef IOT_REACTOR_EPOLL
+  int epoll_fd;                      // Epoll instance
+#else
+  int wake_read;                     // Wake descriptor read end, -1 if none
+  int next_timer;                    // Next timer identifier
+  uint32_t poll_size;                // Allocated size of poll set
+  struct pollfd * polls;             // Poll set
+  iot_reactor_source_t ** polled;    // Sources polled, in poll set order
+#endif
+};
+
+static inline void iot_reactor_source_add_ref (iot_reactor_source_t * src)
+{
+  atomic_fetch_add (&src->refs, 1u);
+}
+
+static void iot_reactor_source_free (iot_reactor_source_t * src)
+{
+  if (atomic_fetch_sub (&src->refs, 1u) <= 1u)
+  {
+#ifdef IOT_REACTOR_EPOLL
+    if (src->timer) close (src->fd);
+#endif
+    free (src);
+  }
+}
+
+static inline iot_reactor_source_t * iot_reactor_find (iot_reactor_t * reactor, int fd)
+{
+  iot_data_static_t key;
+  return (iot_reactor_source_t*) iot_data_map_get_pointer (reactor->sources, iot_data_alloc_const_i32 (&key, fd));
+}
+
+static void iot_reactor_wake (iot_reactor_t * reactor)
+{
+  if (reactor->wake_fd >= 0)
+  {
+    uint64_t val = 1u;
+    ssize_t ret = write (reactor->wake_fd, &val, sizeof (val));
+    (void) ret;
+  }
+}
+
+#ifdef IOT_REACTOR_EPOLL
+
+static inline uint32_t iot_reactor_to_epoll (uint32_t events)
+{
+  return ((events & IOT_REACTOR_READ) ? EPOLLIN : 0u) | ((events & IOT_REACTOR_WRITE) ? EPOLLOUT : 0u) | EPOLLONESHOT;
+}
+
+static inline uint32_t iot_reactor_from_epoll (uint32_t events)
+{
+  return ((events & EPOLLIN) ? IOT_REACTOR_READ : 0u) | ((events & EPOLLOUT) ? IOT_REACTOR_WRITE : 0u) | ((events & (EPOLLERR | EPOLLHUP)) ? IOT_REACTOR_ERROR : 0u);
+}
+
+// Watch a source, called with reactor locked. Sources are watched one shot, so rearmed after each dispatch
+
+static bool iot_reactor_arm (iot_reactor_t * reactor, iot_reactor_source_t * src, bool add)
+{
+  struct epoll_event ev = { .events = iot_reactor_to_epoll (src->events), .data.u64 = ((uint64_t) src->seq << 32) | (uint32_t) src->fd };
+  return epoll_ctl (reactor->epoll_fd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, src->fd, &ev) == 0;
+}
+
+static inline void iot_reactor_unwatch (iot_reactor_t * reactor, iot_reactor_source_t * src)
+{
+  epoll_ctl (reactor->epoll_fd, EPOLL_CTL_DEL, src->fd, NULL);
+}
+
+static int iot_reactor_timer_create (iot_reactor_t * reactor, uint64_t delay, uint64_t period)
+{
+  (void) reactor;
+  int fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd >= 0)
+  {
+    if (delay == 0u) delay = 1u; // Zero disarms a timerfd
+    struct itimerspec spec =
+    {
+      .it_value = { .tv_sec = (time_t) (delay / 1000000000u), .tv_nsec = (long) (delay % 1000000000u) },
+      .it_interval = { .tv_sec = (time_t) (period / 1000000000u), .tv_nsec = (long) (period % 1000000000u) }
+    };
+    if (timerfd_settime (fd, 0, &spec, NULL) != 0)
+    {
+      close (fd);
+      fd = -1;
+    }
+  }
+  return fd;
+}
+
+static inline void iot_reactor_timer_read (iot_reactor_source_t * src)
+{
+  uint64_t expired;
+  ssize_t ret = read (src->fd, &expired, sizeof (expired));
+  (void) ret;
+}
+
+#else
+
+// Poll set is rebuilt for each wait from sources not dispatched, so a source is watched by waking the reactor thread.
+// Missed timer expiries are coalesced, as with timerfd
+
+static bool iot_reactor_arm (iot_reactor_t * reactor, iot_reactor_source_t * src, bool add)
+{
+  if (src->timer && ! add)
+  {
+    uint64_t now = iot_time_nsecs ();
+    src->due = (src->due + src->period > now) ? src->due + src->period : now + src->period;
+  }
+  iot_reactor_wake (reactor);
+  return true;
+}
+
+static inline void iot_reactor_unwatch (iot_reactor_t * reactor, iot_reactor_source_t * src)
+{
+  (void) src;
+  iot_reactor_wake (reactor);
+}
+
+// Timers have negative identifiers, so do not clash with descriptors
+
+static int iot_reactor_timer_create (iot_reactor_t * reactor, uint64_t delay, uint64_t period)
+{
+  (void) delay;
+  (void) period;
+  if (reactor->next_timer == INT32_MIN) reactor->next_timer = -2;
+  return reactor->next_timer--;
+}
+
+static inline void iot_reactor_timer_read (iot_reactor_source_t * src)
+{
+  (void) src;
+}
+
+#endif
+
+// Run a source callback, then watch the source again unless removed or a one shot timer
+
+static void * iot_reactor_dispatch (void * arg)
+{
+  iot_reactor_source_t * src = (iot_reactor_source_t*) arg;
+  iot_reactor_t * reactor = src->reactor;
+  if (src->timer) iot_reactor_timer_read (src);
+  (src->function) (src->fd, src->ready, src->arg);
+  atomic_fetch_add (&reactor->dispatched, 1u);
+  iot_component_lock (&reactor->component);
+  src->busy = false;
+  if (! src->removed)
+  {
+    if (src->timer && src->period == 0u)
+    {
+      iot_data_map_remove (reactor->sources, IOT_DATA_STATIC (&src->key));
+      src->removed = true;
+      iot_reactor_unwatch (reactor, src);
+      iot_reactor_source_free (src);
+    }
+    else if (! iot_reactor_arm (reactor, src, false))
+    {
+      iot_log_warn (reactor->logger, "Failed to rearm reactor descriptor %d", src->fd);
+    }
+  }
+  iot_component_unlock (&reactor->component);
+  iot_reactor_source_free (src);
+  return NULL;
+}
+
+// Pool dispatch holds a reactor reference until the callback completes
+
+static void * iot_reactor_pool_dispatch (void * arg)
+{
+  iot_reactor_t * reactor = ((iot_reactor_source_t*) arg)->reactor;
+  iot_reactor_dispatch (arg);
+  iot_reactor_free (reactor);
+  return NULL;
+}
+
+// Add source to dispatch batch, called with reactor locked
+
+static uint32_t iot_reactor_batch_add (iot_reactor_t * reactor, uint32_t count, iot_reactor_source_t * src, uint32_t ready)
+{
+  if (count == reactor->batch_size)
+  {
+    reactor->batch_size = reactor->batch_size ? reactor->batch_size * 2u : IOT_REACTOR_EVENTS;
+    reactor->batch = realloc (reactor->batch, reactor->batch_size * sizeof (*reactor->batch));
+  }
+  src->ready = ready;
+  src->busy = true;
+  iot_reactor_source_add_ref (src);
+  if (reactor->pool) iot_component_add_ref (&reactor->component);
+  reactor->batch[count] = (iot_threadpool_job_t) { reactor->pool ? iot_reactor_pool_dispatch : iot_reactor_dispatch, src, IOT_THREAD_NO_PRIORITY };
+  return count + 1u;
+}
+
+// Run dispatch batch, called with reactor unlocked
+
+static void iot_reactor_batch_run (iot_reactor_t * reactor, uint32_t count)
+{
+  if (count == 0u) return;
+  atomic_fetch_add (&reactor->waits, 1u);
+  if (reactor->pool)
+  {
+    iot_threadpool_add_work_batch (reactor->pool, reactor->batch, count);
+  }
+  else
+  {
+    for (uint32_t i = 0; i < count; i++) iot_reactor_dispatch (reactor->batch[i].arg);
+  }
+}
+
+#ifdef IOT_REACTOR_EPOLL
+
+// Wait for events and batch ready sources, returns batch size
+
+static uint32_t iot_reactor_wait (iot_reactor_t * reactor)
+{
+  struct epoll_event events[IOT_REACTOR_EVENTS];
+  uint32_t count = 0u;
+  int ret = epoll_wait (reactor->epoll_fd, events, IOT_REACTOR_EVENTS, -1);
+  iot_component_state_t state = iot_component_lock (&reactor->component);
+  for (int i = 0; i < ret; i++)
+  {
+    int fd = (int) (uint32_t) events[i].data.u64;
+    if (fd == reactor->wake_fd)
+    {
+      uint64_t val;
+      ssize_t rd = read (fd, &val, sizeof (val));
+      (void) rd;
+      continue;
+    }
+    iot_reactor_source_t * src = iot_reactor_find (reactor, fd);
+    if (src && src->seq == (uint32_t) (events[i].data.u64 >> 32)) // Ignore events for removed sources
+    {
+      if (state == IOT_COMPONENT_RUNNING)
+      {
+        count = iot_reactor_batch_add (reactor, count, src, src->timer ? IOT_REACTOR_READ : iot_reactor_from_epoll (events[i].events));
+      }
+      else if (state != IOT_COMPONENT_DELETED)
+      {
+        iot_reactor_arm (reactor, src, false); // Stopped while waiting, rearm to dispatch when restarted
+      }
+    }
+  }
+  iot_component_unlock (&reactor->component);
+  return count;
+}
+
+#else
+
+static inline short iot_reactor_to_poll (uint32_t events)
+{
+  return (short) (((events & IOT_REACTOR_READ) ? POLLIN : 0) | ((events & IOT_REACTOR_WRITE) ? POLLOUT : 0));
+}
+
+static inline uint32_t iot_reactor_from_poll (short events)
+{
+  return ((events & POLLIN) ? IOT_REACTOR_READ : 0u) | ((events & POLLOUT) ? IOT_REACTOR_WRITE : 0u) | ((events & (POLLERR | POLLHUP | POLLNVAL)) ? IOT_REACTOR_ERROR : 0u);
+}
+
+// Rebuild poll set from sources not dispatched, returning the poll timeout for the earliest timer. Called with reactor locked
+
+static int iot_reactor_poll_set (iot_reactor_t * reactor, uint32_t * size)
+{
+  uint32_t count = 1u;
+  uint64_t now = iot_time_nsecs ();
+  uint64_t next = UINT64_MAX;
+  uint32_t needed = iot_data_map_size (reactor->sources) + 1u;
+  if (needed > reactor->poll_size)
+  {
+    reactor->poll_size = needed;
+    reactor->polls = realloc (reactor->polls, needed * sizeof (*reactor->polls));
+    reactor->polled = realloc (reactor->polled, needed * sizeof (*reactor->polled));
+  }
+  reactor->polls[0] = (struct pollfd) { .fd = reactor->wake_read, .events = POLLIN };
+  iot_data_map_iter_t iter;
+  iot_data_map_iter (reactor->sources, &iter);
+  while (iot_data_map_iter_next (&iter))
+  {
+    iot_reactor_source_t * src = (iot_reactor_source_t*) iot_data_map_iter_pointer_value (&iter);
+    if (src->busy) continue;
+    if (src->timer)
+    {
+      if (src->due < next) next = src->due;
+      continue;
+    }
+    iot_reactor_source_add_ref (src); // Held while polled, as may be removed during poll
+    reactor->polls[count] = (struct pollfd) { .fd = src->fd, .events = iot_reactor_to_poll (src->events) };
+    reactor->polled[count++] = src;
+  }
+  *size = count;
+  uint64_t wait = (next == UINT64_MAX) ? UINT64_MAX : ((next > now) ? (next - now + 999999u) / 1000000u : 0u);
+  if (reactor->wake_read >= 0 && wait == UINT64_MAX) return -1;
+  if (reactor->wake_read < 0 && wait > IOT_REACTOR_POLL_MAX) wait = IOT_REACTOR_POLL_MAX;
+  return (int) ((wait < INT32_MAX) ? wait : INT32_MAX);
+}
+
+// Wait for events and expired timers and batch ready sources, returns batch size
+
+static uint32_t iot_reactor_wait (iot_reactor_t * reactor)
+{
+  uint32_t size;
+  uint32_t count = 0u;
+  iot_component_lock (&reactor->component);
+  int timeout = iot_reactor_poll_set (reactor, &size);
+  iot_component_unlock (&reactor->component);
+  int ret = poll (reactor->polls, size, timeout);
+  bool running = (iot_component_lock (&reactor->component) == IOT_COMPONENT_RUNNING);
+  if (ret > 0 && (reactor->polls[0].revents & POLLIN))
+  {
+    uint64_t val;
+    ssize_t rd = read (reactor->wake_read, &val, sizeof (val));
+    (void) rd;
+  }
+  for (uint32_t i = 1u; i < size; i++)
+  {
+    iot_reactor_source_t * src = reactor->polled[i];
+    if (running && ret > 0 && reactor->polls[i].revents && ! src->removed && ! src->busy)
+    {
+      count = iot_reactor_batch_add (reactor, count, src, iot_reactor_from_poll (reactor->polls[i].revents));
+    }
+    iot_reactor_source_free (src);
+  }
+  uint64_t now = iot_time_nsecs ();
+  iot_data_map_iter_t iter;
+  iot_data_map_iter (reactor->sources, &iter);
+  while (iot_data_map_iter_next (&iter))
+  {
+    iot_reactor_source_t * src = (iot_reactor_source_t*) iot_data_map_iter_pointer_value (&iter);
+    if (running && src->timer && ! src->busy && src->due <= now)
+    {
+      count = iot_reactor_batch_add (reactor, count, src, IOT_REACTOR_READ);
+    }
+  }
+  iot_component_unlock (&reactor->component);
+  return count;
+}
+
+#endif
+
+static void * iot_reactor_thread (void * arg)
+{
+  iot_reactor_t * reactor = (iot_reactor_t*) arg;
+  while (true)
+  {
+    iot_component_state_t state = iot_component_wait (&reactor->component, (uint32_t) IOT_COMPONENT_DELETED | (uint32_t) IOT_COMPONENT_RUNNING);
+    if (state == IOT_COMPONENT_DELETED) break; // Exit thread on deletion
+    uint32_t count = iot_reactor_wait (reactor);
+    iot_reactor_batch_run (reactor, count);
+  }
+  atomic_store (&reactor->active, false);
+  return NULL;
+}
+
+iot_reactor_t * iot_reactor_alloc (iot_threadpool_t * pool, int priority, int affinity, iot_logger_t * logger)
+{
+  iot_reactor_t * reactor = (iot_reactor_t*) calloc (1u, sizeof (*reactor));
+  reactor->wake_fd = -1;
+#ifdef IOT_REACTOR_EPOLL
+  reactor->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+  reactor->wake_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (reactor->epoll_fd < 0 || reactor->wake_fd < 0)
+  {
+    iot_log_error (logger, "iot_reactor_alloc: failed to create epoll instance (%s)", strerror (errno));
+    if (reactor->epoll_fd >= 0) close (reactor->epoll_fd);
+    if (reactor->wake_fd >= 0) close (reactor->wake_fd);
+    free (reactor);
+    return NULL;
+  }
+  struct epoll_event ev = { .events = EPOLLIN, .data.u64 = (uint32_t) reactor->wake_fd };
+  epoll_ctl (reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd, &ev);
+#else
+  reactor->wake_read = -1;
+  reactor->next_timer = -2;
+#ifndef __ZEPHYR__
+  int fds[2];
+  if (pipe (fds) == 0)
+  {
+    reactor->wake_read = fds[0];
+    reactor->wake_fd = fds[1];
+  }
+#endif
+#endif
+  iot_component_init (&reactor->component, IOT_REACTOR_FACTORY, (iot_component_start_fn_t) iot_reactor_start, (iot_component_stop_fn_t) iot_reactor_stop);
+  iot_component_set_stats_callback (&reactor->component, (iot_component_stats_fn_t) iot_reactor_stats);
+  reactor->sources = iot_data_alloc_map (IOT_DATA_INT32);
+  reactor->pool = pool;
+  reactor->logger = logger;
+  iot_threadpool_add_ref (pool);
+  iot_logger_add_ref (logger);
+  iot_log_info (logger, "iot_reactor_alloc (priority: %d affinity: %d)", priority, affinity);
+  atomic_store (&reactor->active, true);
+  if (! iot_thread_create (NULL, iot_reactor_thread, reactor, priority, affinity, logger)) atomic_store (&reactor->active, false);
+  return reactor;
+}
+
+void iot_reactor_add_ref (iot_reactor_t * reactor)
+{
+  if (reactor) iot_component_add_ref (&reactor->component);
+}
+
+void iot_reactor_start (iot_reactor_t * reactor)
+{
+  assert (reactor);
+  iot_log_trace (reactor->logger, "iot_reactor_start");
+  iot_component_set_running (&reactor->component);
+}
+
+void iot_reactor_stop (iot_reactor_t * reactor)
+{
+  assert (reactor);
+  iot_log_trace (reactor->logger, "iot_reactor_stop");
+  iot_component_set_stopped (&reactor->component);
+  iot_reactor_wake (reactor);
+}
+
+static iot_reactor_source_t * iot_reactor_source_alloc (iot_reactor_t * reactor, int fd, uint32_t events, iot_reactor_fn_t fn, void * arg)
+{
+  iot_reactor_source_t * src = (iot_reactor_source_t*) calloc (1u, sizeof (*src));
+  src->reactor = reactor;
+  src->function = fn;
+  src->arg = arg;
+  src->fd = fd;
+  src->events = events;
+  atomic_store (&src->refs, 1u);
+  iot_data_alloc_const_i32 (&src->key, fd);
+  iot_data_alloc_const_pointer (&src->self, src);
+  return src;
+}
+
+bool iot_reactor_add (iot_reactor_t * reactor, int fd, uint32_t events, iot_reactor_fn_t fn, void * arg)
+{
+  assert (reactor && fn);
+  bool ok = false;
+  iot_log_trace (reactor->logger, "iot_reactor_add (fd: %d events: %" PRIu32 ")", fd, events);
+  if (fd < 0) return false;
+  iot_reactor_source_t * src = iot_reactor_source_alloc (reactor, fd, events, fn, arg);
+  iot_component_lock (&reactor->component);
+  if (iot_reactor_find (reactor, fd) == NULL)
+  {
+    src->seq = reactor->seq++;
+    if ((ok = iot_reactor_arm (reactor, src, true)))
+    {
+      iot_data_map_add (reactor->sources, IOT_DATA_STATIC (&src->key), IOT_DATA_STATIC (&src->self));
+    }
+  }
+  iot_component_unlock (&reactor->component);
+  if (! ok)
+  {
+    iot_log_warn (reactor->logger, "iot_reactor_add: could not watch descriptor %d", fd);
+    free (src);
+  }
+  return ok;
+}
+
+bool iot_reactor_modify (iot_reactor_t * reactor, int fd, uint32_t events)
+{
+  assert (reactor);
+  iot_component_lock (&reactor->component);
+  iot_reactor_source_t * src = iot_reactor_find (reactor, fd);
+  if (src && ! src->timer)
+  {
+    src->events = events;
+    if (! src->busy) iot_reactor_arm (reactor, src, false); // Otherwise rearmed with new events once dispatched
+  }
+  iot_component_unlock (&reactor->component);
+  return src != NULL;
+}
+
+int iot_reactor_add_timer (iot_reactor_t * reactor, uint64_t delay, uint64_t period, iot_reactor_fn_t fn, void * arg)
+{
+  assert (reactor && fn);
+  iot_log_trace (reactor->logger, "iot_reactor_add_timer (delay: %" PRIu64 " period: %" PRIu64 ")", delay, period);
+  iot_component_lock (&reactor->component);
+  int id = iot_reactor_timer_create (reactor, delay, period);
+  if (id != -1)
+  {
+    iot_reactor_source_t * src = iot_reactor_source_alloc (reactor, id, IOT_REACTOR_READ, fn, arg);
+    src->timer = true;
+    src->period = period;
+    src->due = iot_time_nsecs () + delay;
+    src->seq = reactor->seq++;
+    if (iot_reactor_arm (reactor, src, true))
+    {
+      iot_data_map_add (reactor->sources, IOT_DATA_STATIC (&src->key), IOT_DATA_STATIC (&src->self));
+    }
+    else
+    {
+      iot_reactor_source_free (src);
+      id = -1;
+    }
+  }
+  iot_component_unlock (&reactor->component);
+  if (id == -1) iot_log_warn (reactor->logger, "iot_reactor_add_timer: could not create timer");
+  return id;
+}
+
+bool iot_reactor_remove (iot_reactor_t * reactor, int fd)
+{
+  assert (reactor);
+  iot_log_trace (reactor->logger, "iot_reactor_remove (fd: %d)", fd);
+  iot_component_lock (&reactor->component);
+  iot_reactor_source_t * src = iot_reactor_find (reactor, fd);
+  if (src)
+  {
+    iot_data_map_remove (reactor->sources, IOT_DATA_STATIC (&src->key));
+    src->removed = true;
+    iot_reactor_unwatch (reactor, src);
+    iot_reactor_source_free (src);
+  }
+  iot_component_unlock (&reactor->component);
+  return src != NULL;
+}
+
+iot_data_t * iot_reactor_stats (iot_reactor_t * reactor)
+{
+  assert (reactor);
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_component_lock (&reactor->component);
+  uint32_t sources = iot_data_map_size (reactor->sources);
+  iot_component_unlock (&reactor->component);
+  iot_data_string_map_add (map, "sources", iot_data_alloc_ui32 (sources));
+  iot_data_string_map_add (map, "waits", iot_data_alloc_ui64 (atomic_load (&reactor->waits)));
+  iot_data_string_map_add (map, "dispatched", iot_data_alloc_ui64 (atomic_load (&reactor->dispatched)));
+  return map;
+}
+
+void iot_reactor_free (iot_reactor_t * reactor)
+{
+  if (reactor && iot_component_dec_ref (&reactor->component))
+  {
+    iot_log_trace (reactor->logger, "iot_reactor_free");
+    iot_component_set_stopped (&reactor->component);
+    iot_component_set_deleted (&reactor->component); // Break reactor thread out of state wait
+    iot_reactor_wake (reactor);
+    while (atomic_load (&reactor->active)) iot_wait_msecs (1u); // Reactor thread is detached
+    iot_data_map_iter_t iter;
+    iot_data_map_iter (reactor->sources, &iter);
+    while (iot_data_map_iter_next (&iter))
+    {
+      iot_reactor_source_t * src = (iot_reactor_source_t*) iot_data_map_iter_pointer_value (&iter);
+      iot_data_map_remove (reactor->sources, iot_data_map_iter_key (&iter));
+      iot_reactor_source_free (src);
+      iot_data_map_iter (reactor->sources, &iter);
+    }
+    iot_data_free (reactor->sources);
+#ifdef IOT_REACTOR_EPOLL
+    close (reactor->epoll_fd);
+#else
+    if (reactor->wake_read >= 0) close (reactor->wake_read);
+    free (reactor->polls);
+    free (reactor->polled);
+#endif
+    if (reactor->wake_fd >= 0) close (reactor->wake_fd);
+    free (reactor->batch);
+    iot_threadpool_free (reactor->pool);
+    iot_logger_free (reactor->logger);
+    iot_component_fini (&reactor->component);
+    free (reactor);
+  }
+}
+
+#ifdef IOT_BUILD_COMPONENTS
+
+static iot_component_t * iot_reactor_config (iot_container_t * cont, const iot_data_t * map)
+{
+  iot_logger_t * logger = (iot_logger_t*) iot_container_find_component (cont, iot_data_string_map_get_string (map, "Logger"));
+  iot_threadpool_t * pool = (iot_threadpool_t*) iot_container_find_component (cont, iot_data_string_map_get_string (map, "ThreadPool"));
+  int affinity = (int) iot_data_string_map_get_i64 (map, "Affinity", IOT_THREAD_NO_AFFINITY);
+  int prio = (int) iot_data_string_map_get_i64 (map, "Priority", IOT_THREAD_NO_PRIORITY);
+  return (iot_component_t*) iot_reactor_alloc (pool, prio, affinity, logger);
+}
+
+const iot_component_factory_t * iot_reactor_factory (void)
+{
+  static iot_component_factory_t factory =
+  {
+    IOT_REACTOR_TYPE,
+    IOT_CATEGORY_CORE,
+    iot_reactor_config,
+    (iot_component_free_fn_t) iot_reactor_free,
+    NULL,
+    NULL
+  };
+  return &factory;
+}
+
+#endif
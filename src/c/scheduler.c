@@ -8,10 +8,20 @@
 #include "iot/scheduler.h"
 #include "iot/thread.h"
 #include "iot/time.h"
+#include "stats-impl.h"
+#include "trace-impl.h"
 
 #define IOT_NS_TO_SEC(s) ((s) / IOT_BILLION)
 #define IOT_NS_REMAINING(s) ((s) % IOT_BILLION)
 #define IOT_SCHEDULER_DEFAULT_WAKE (IOT_HOUR_TO_NS (24))
+#define IOT_SCHEDULER_PRECISE_WAKE (IOT_MS_TO_NS (1))
+#define IOT_SCHEDULER_EXECUTOR_THREADS 4u
+#define IOT_SCHEDULER_EXECUTOR_IDLE 10000u
+#define IOT_SCHEDULE_GROUP_MIN_SIZE 8u
+#define IOT_WHEEL_BITS 6u
+#define IOT_WHEEL_SLOTS (1u << IOT_WHEEL_BITS)
+#define IOT_WHEEL_MASK (IOT_WHEEL_SLOTS - 1u)
+#define IOT_WHEEL_LEVELS 11u
 
 #ifdef IOT_BUILD_COMPONENTS
 #define IOT_SCHEDULER_FACTORY iot_scheduler_factory ()
@@ -35,20 +45,93 @@ struct iot_schedule_t
   _Atomic uint64_t dropped;          /* Number of events dropped */
   _Atomic bool concurrent;           /* Whether a schedule can be concurrently executed */
   _Atomic bool sync;                 /* Whether schedule called synchronously by the scheduler thread */
+  _Atomic bool precise;              /* Whether scheduler thread waits precisely for schedule start */
+  _Atomic bool thread;               /* Whether schedule without thread pool run in new thread */
+  iot_flow_t * _Atomic flow;         /* Flow control slowing the schedule when congested, NULL if none */
+  _Atomic uint32_t backoff;          /* Period multiplier applied while the flow control is congested */
   bool scheduled;                    /* A flag to indicate schedule status */
   iot_data_static_t start_key;       /* Data wrapper for schedule start time used as key for queue map */
   iot_data_static_t id_key;          /* Data wrapper for schedule id used as key for idle map */
   iot_data_static_t self_static;     /* Data wrapper for self pointer used as value for idle and queue maps */
   atomic_int_fast32_t refs;          /* Current reference count */
+  iot_schedule_t * wheel_next;       /* Next schedule in timer wheel slot */
+  iot_schedule_t * wheel_prev;       /* Previous schedule in timer wheel slot */
+  uint16_t wheel_slot;               /* Timer wheel level and slot index */
 };
 
+/*
+ * Hierarchical timer wheel. Each level has 64 slots, a slot at level n covering 64^n ticks. A schedule
+ * is held at the lowest level whose current block contains its start tick, so all level 0 schedules
+ * are due within 64 ticks in slot order. When level 0 is exhausted, the wheel advances to the next
+ * occupied slot of the lowest occupied level and cascades its schedules down, so each schedule moves
+ * at most once per level. The wheel only advances on lookup, and never past the current time, so a
+ * schedule added later for a sooner time is not held behind later schedules. Until its slot is reached,
+ * the earliest schedule of a higher level slot is found by scanning the slot. Schedules already due are
+ * held in the current level 0 slot. Schedules within a slot are not ordered, so the resolution sets the accuracy.
+ */
+
+typedef struct iot_timer_wheel_t
+{
+  uint64_t resolution;                                         /* Tick length in ns */
+  uint64_t base;                                               /* Current tick */
+  uint64_t occupied[IOT_WHEEL_LEVELS];                         /* Bitmap of non empty slots per level */
+  iot_schedule_t * slots[IOT_WHEEL_LEVELS][IOT_WHEEL_SLOTS];   /* Circular list of schedules per slot */
+} iot_timer_wheel_t;
+
+typedef struct iot_schedule_member_t
+{
+  iot_schedule_fn_t function;        /* The member function */
+  void * arg;                        /* The member function argument */
+} iot_schedule_member_t;
+
+/* Group members, shared by group runs in progress and only updated in place when not shared */
+typedef struct iot_schedule_members_t
+{
+  atomic_int_fast32_t refs;          /* Current reference count */
+  uint32_t count;                    /* Number of members */
+  uint32_t size;                     /* Allocated number of members */
+  iot_schedule_member_t members[];   /* Members in order of addition */
+} iot_schedule_members_t;
+
+struct iot_schedule_group_t
+{
+  iot_schedule_t * schedule;         /* The schedule running the group */
+  iot_threadpool_t * threadpool;     /* Thread pool used to run member chunks, NULL to run all in one job */
+  int priority;                      /* Member chunk priority */
+  uint32_t chunk;                    /* Number of members run per job, 0 for all */
+  pthread_mutex_t mutex;             /* Member update mutex */
+  iot_schedule_members_t * members;  /* Current members, NULL if none */
+};
+
+/* Range of group members run as one job */
+typedef struct iot_schedule_chunk_t
+{
+  iot_schedule_members_t * members;
+  uint32_t start;
+  uint32_t end;
+} iot_schedule_chunk_t;
+
 struct iot_scheduler_t
 {
   iot_component_t component;      /* Component base type */
   iot_data_t * queue;             /* Map of active schedules, keyed by unique schedule time */
+  iot_timer_wheel_t * wheel;      /* Timer wheel of active schedules, replaces queue if set */
   iot_data_t * idle;              /* Map of idle schedules, keyed by unique schedule id */
   iot_logger_t * logger;          /* Optional logger */
   struct timespec schd_time;      /* Time for next schedule */
+  uint32_t active;                /* Number of active schedules */
+  _Atomic uint64_t fired;         /* Number of schedule runs started */
+  _Atomic uint64_t dropped;       /* Number of schedule runs dropped */
+  _Atomic uint64_t skipped;       /* Number of schedule runs skipped as still running */
+  _Atomic uint64_t batches;       /* Number of batch submissions to thread pools */
+  bool batch;                     /* Whether all due schedules dispatched per wakeup */
+  uint32_t batch_max;             /* Largest batch submitted */
+  uint32_t batch_count;           /* Number of jobs in batch */
+  uint32_t batch_size;            /* Allocated size of batch jobs */
+  iot_threadpool_job_t * batch_jobs; /* Batch of schedule runs for thread pools */
+  iot_threadpool_t * executor;    /* Elastic pool for schedules without a thread pool, created on first use */
+  iot_stats_hist_t lateness;      /* Schedule start to run time histogram */
+  atomic_bool running;            /* Whether scheduler thread is running */
 };
 
 static inline void iot_schedule_add_ref (iot_schedule_t * schedule)
@@ -67,6 +150,7 @@ static void iot_schedule_free (iot_schedule_t * schedule)
   {
     (schedule->free_cb) ? schedule->free_cb (schedule->arg) : 0;
     iot_threadpool_free (schedule->threadpool);
+    iot_flow_free (atomic_load (&schedule->flow));
     free (schedule);
   }
 }
@@ -77,25 +161,124 @@ static inline void iot_schedule_update_start (iot_schedule_t * schedule, uint64_
   iot_data_alloc_const_ui64 (&schedule->start_key, start);
 }
 
-static inline iot_schedule_t * iot_schedule_queue_next (iot_data_t * map)
+static void iot_wheel_insert (iot_timer_wheel_t * wheel, iot_schedule_t * schedule)
 {
-  return (iot_schedule_t*) iot_data_map_start_pointer (map);
+  uint64_t tick = schedule->start / wheel->resolution;
+  uint32_t level = 0u;
+  if (tick < wheel->base) tick = wheel->base; // Already due
+  while (((level + 1u) * IOT_WHEEL_BITS < 64u) && ((tick >> ((level + 1u) * IOT_WHEEL_BITS)) != (wheel->base >> ((level + 1u) * IOT_WHEEL_BITS))))
+  {
+    level++;
+  }
+  uint32_t slot = (uint32_t) (tick >> (level * IOT_WHEEL_BITS)) & IOT_WHEEL_MASK;
+  iot_schedule_t * head = wheel->slots[level][slot];
+  if (head)
+  {
+    schedule->wheel_next = head;
+    schedule->wheel_prev = head->wheel_prev;
+    head->wheel_prev->wheel_next = schedule;
+    head->wheel_prev = schedule;
+  }
+  else
+  {
+    schedule->wheel_next = schedule;
+    schedule->wheel_prev = schedule;
+    wheel->slots[level][slot] = schedule;
+    wheel->occupied[level] |= (1ull << slot);
+  }
+  schedule->wheel_slot = (uint16_t) (level * IOT_WHEEL_SLOTS + slot);
 }
 
-static inline bool iot_schedule_is_next (iot_data_t * map, const iot_schedule_t * schedule)
+static void iot_wheel_remove (iot_timer_wheel_t * wheel, iot_schedule_t * schedule)
 {
-  return (iot_schedule_queue_next (map) == schedule);
+  uint32_t level = schedule->wheel_slot / IOT_WHEEL_SLOTS;
+  uint32_t slot = schedule->wheel_slot % IOT_WHEEL_SLOTS;
+  if (schedule->wheel_next == schedule)
+  {
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~(1ull << slot);
+  }
+  else
+  {
+    schedule->wheel_prev->wheel_next = schedule->wheel_next;
+    schedule->wheel_next->wheel_prev = schedule->wheel_prev;
+    if (wheel->slots[level][slot] == schedule) wheel->slots[level][slot] = schedule->wheel_next;
+  }
+  schedule->wheel_next = NULL;
+  schedule->wheel_prev = NULL;
+}
+
+static iot_schedule_t * iot_wheel_next (iot_timer_wheel_t * wheel)
+{
+  uint64_t now = iot_time_nsecs () / wheel->resolution;
+  while (true)
+  {
+    uint32_t level;
+    uint64_t mask = wheel->occupied[0];
+    if (mask) return wheel->slots[0][__builtin_ctzll (mask)];
+    for (level = 1u; level < IOT_WHEEL_LEVELS; level++) // Find next occupied slot, always after current slot
+    {
+      uint32_t current = (uint32_t) (wheel->base >> (level * IOT_WHEEL_BITS)) & IOT_WHEEL_MASK;
+      mask = (current == IOT_WHEEL_MASK) ? 0u : (wheel->occupied[level] & (UINT64_MAX << (current + 1u)));
+      if (mask) break;
+    }
+    if (level == IOT_WHEEL_LEVELS) return NULL;
+
+    /* Advance to start of slot and cascade slot schedules to lower levels */
+    uint32_t slot = (uint32_t) __builtin_ctzll (mask);
+    uint32_t shift = level * IOT_WHEEL_BITS;
+    uint64_t high = (shift + IOT_WHEEL_BITS < 64u) ? ((wheel->base >> (shift + IOT_WHEEL_BITS)) << (shift + IOT_WHEEL_BITS)) : 0u;
+    uint64_t start = high | ((uint64_t) slot << shift);
+    iot_schedule_t * list = wheel->slots[level][slot];
+    if (start > now) // Slot not yet reached, so find its earliest schedule without advancing past the current tick
+    {
+      iot_schedule_t * first = list;
+      for (iot_schedule_t * iter = list->wheel_next; iter != list; iter = iter->wheel_next)
+      {
+        if (iter->start < first->start) first = iter;
+      }
+      return first;
+    }
+    wheel->base = start;
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~(1ull << slot);
+    list->wheel_prev->wheel_next = NULL;
+    while (list)
+    {
+      iot_schedule_t * schedule = list;
+      list = schedule->wheel_next;
+      iot_wheel_insert (wheel, schedule);
+    }
+  }
+}
+
+static inline iot_schedule_t * iot_schedule_queue_next (iot_scheduler_t * scheduler)
+{
+  return scheduler->wheel ? iot_wheel_next (scheduler->wheel) : (iot_schedule_t*) iot_data_map_start_pointer (scheduler->queue);
+}
+
+static inline bool iot_schedule_is_next (iot_scheduler_t * scheduler, const iot_schedule_t * schedule)
+{
+  return (iot_schedule_queue_next (scheduler) == schedule);
 }
 
 static bool iot_schedule_queue_add (iot_scheduler_t * scheduler, iot_schedule_t * schedule)
 {
+  if (scheduler->wheel)
+  {
+    iot_wheel_insert (scheduler->wheel, schedule);
+    schedule->scheduled = true;
+    scheduler->active++;
+    return iot_schedule_is_next (scheduler, schedule);
+  }
   while (iot_data_map_get (scheduler->queue, IOT_DATA_STATIC (&schedule->start_key)))
   {
     iot_schedule_update_start (schedule, schedule->start + 1u); // Need unique start as used as map key
   }
   iot_data_map_add (scheduler->queue, IOT_DATA_STATIC (&schedule->start_key), IOT_DATA_STATIC (&schedule->self_static));
   schedule->scheduled = true;
-  return iot_schedule_is_next (scheduler->queue, schedule);
+  scheduler->active++;
+  return iot_schedule_is_next (scheduler, schedule);
 }
 
 static inline void iot_schedule_idle_add (iot_scheduler_t * scheduler, const iot_schedule_t * schedule)
@@ -110,14 +293,29 @@ static inline void iot_schedule_idle_remove (iot_scheduler_t * scheduler, const
 
 static inline void iot_schedule_queue_remove (iot_scheduler_t * scheduler, iot_schedule_t * schedule)
 {
-  iot_data_map_remove (scheduler->queue, IOT_DATA_STATIC (&schedule->start_key));
+  if (scheduler->wheel)
+  {
+    iot_wheel_remove (scheduler->wheel, schedule);
+  }
+  else
+  {
+    iot_data_map_remove (scheduler->queue, IOT_DATA_STATIC (&schedule->start_key));
+  }
   schedule->scheduled = false;
+  scheduler->active--;
 }
 
 static bool iot_schedule_queue_update (iot_scheduler_t * scheduler, iot_schedule_t * schedule, uint64_t next)
 {
   iot_schedule_queue_remove (scheduler, schedule);
-  iot_schedule_update_start (schedule, next);
+  if (scheduler->wheel)
+  {
+    schedule->start = next; // No map key to update
+  }
+  else
+  {
+    iot_schedule_update_start (schedule, next);
+  }
   return iot_schedule_queue_add (scheduler, schedule);
 }
 
@@ -134,6 +332,32 @@ void iot_schedule_set_concurrent (iot_schedule_t * schedule, bool enable)
   if (ok) atomic_store (&schedule->concurrent, enable);
 }
 
+void iot_schedule_set_thread (iot_schedule_t * schedule, bool enable)
+{
+  assert (schedule);
+  atomic_store (&schedule->thread, enable);
+}
+
+void iot_schedule_set_precise (iot_schedule_t * schedule, bool enable)
+{
+  assert (schedule);
+  atomic_store (&schedule->precise, enable);
+}
+
+void iot_schedule_set_flow (iot_schedule_t * schedule, iot_flow_t * flow, uint32_t backoff)
+{
+  assert (schedule && (backoff > 0u));
+  iot_flow_add_ref (flow);
+  atomic_store (&schedule->backoff, backoff);
+  iot_flow_free (atomic_exchange (&schedule->flow, flow));
+}
+
+static inline uint64_t iot_schedule_period (const iot_schedule_t * schedule)
+{
+  iot_flow_t * flow = atomic_load (&schedule->flow);
+  return (flow && iot_flow_congested (flow)) ? schedule->period * atomic_load (&schedule->backoff) : schedule->period;
+}
+
 bool iot_schedule_set_sync (iot_schedule_t * schedule, bool enable)
 {
   assert (schedule);
@@ -150,36 +374,112 @@ static void * schedule_fn (void * data)
   return ret;
 }
 
+/* Get thread pool for a schedule, the scheduler executor if none set, called with scheduler locked */
+static iot_threadpool_t * iot_scheduler_pool (iot_scheduler_t * scheduler, iot_schedule_t * schedule)
+{
+  if (schedule->threadpool) return schedule->threadpool;
+  if (scheduler->executor == NULL)
+  {
+    iot_log_debug (scheduler->logger, "Creating scheduler executor");
+    scheduler->executor = iot_threadpool_alloc_elastic (0u, IOT_SCHEDULER_EXECUTOR_THREADS, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, IOT_SCHEDULER_EXECUTOR_IDLE, scheduler->logger);
+    iot_threadpool_start (scheduler->executor);
+  }
+  return scheduler->executor;
+}
+
+/* Handle schedule run not accepted by its thread pool, called with scheduler locked */
+static void iot_scheduler_drop (iot_scheduler_t * scheduler, iot_schedule_t * schedule)
+{
+  /* Notify that the run is aborted */
+  if (schedule->abort_cb)
+  {
+    iot_component_unlock (&scheduler->component);
+    schedule->abort_cb (schedule->arg);
+    iot_component_lock (&scheduler->component);
+  }
+  atomic_fetch_add (&scheduler->dropped, 1u);
+  if (atomic_fetch_add (&schedule->dropped, 1u) == 0u)
+  {
+    iot_log_warn (scheduler->logger, "Scheduled event dropped for schedule #%" PRIu64, schedule->id);
+  }
+}
+
+static void iot_scheduler_batch_add (iot_scheduler_t * scheduler, iot_schedule_t * schedule)
+{
+  if (scheduler->batch_count == scheduler->batch_size)
+  {
+    scheduler->batch_size = scheduler->batch_size ? scheduler->batch_size * 2u : 64u;
+    scheduler->batch_jobs = realloc (scheduler->batch_jobs, scheduler->batch_size * sizeof (*scheduler->batch_jobs));
+  }
+  scheduler->batch_jobs[scheduler->batch_count++] = (iot_threadpool_job_t) { schedule_fn, schedule, schedule->priority };
+}
+
+/* Submit batched schedule runs, one batch per run of schedules using the same thread pool */
+static void iot_scheduler_batch_flush (iot_scheduler_t * scheduler)
+{
+  uint32_t count = scheduler->batch_count;
+  iot_threadpool_job_t * jobs = scheduler->batch_jobs;
+  if (count > scheduler->batch_max) scheduler->batch_max = count;
+  scheduler->batch_count = 0u;
+  for (uint32_t i = 0; i < count;)
+  {
+    iot_threadpool_t * pool = iot_scheduler_pool (scheduler, jobs[i].arg);
+    uint32_t end = i + 1u;
+    while (end < count && iot_scheduler_pool (scheduler, jobs[end].arg) == pool) end++;
+    iot_log_trace (scheduler->logger, "Running %" PRIu32 " schedules from threadpool", end - i);
+    atomic_fetch_add (&scheduler->batches, 1u);
+    for (uint32_t added = i + iot_threadpool_try_work_batch (pool, &jobs[i], end - i); added < end; added++)
+    {
+      iot_schedule_t * schedule = jobs[added].arg;
+      iot_scheduler_drop (scheduler, schedule);
+      iot_schedule_free (schedule);
+    }
+    i = end;
+  }
+}
+
 /* Scheduler thread function */
 static void * iot_scheduler_thread (void * arg)
 {
   iot_component_state_t state;
   uint64_t next = iot_time_nsecs ();
   iot_scheduler_t * scheduler = (iot_scheduler_t*) arg;
-  iot_data_t * queue = scheduler->queue;
 
   nsToTimespec (next, &scheduler->schd_time);
+  iot_component_lock (&scheduler->component); // Lock held between iterations, released while waiting
   while (true)
   {
-    state = iot_component_wait_and_lock (&scheduler->component, (uint32_t) IOT_COMPONENT_DELETED | (uint32_t) IOT_COMPONENT_RUNNING); // State wait
+    state = iot_component_wait_locked (&scheduler->component, (uint32_t) IOT_COMPONENT_DELETED | (uint32_t) IOT_COMPONENT_RUNNING); // State wait
     if (state == IOT_COMPONENT_DELETED) break; // Exit thread on deletion
     pthread_cond_timedwait (&scheduler->component.cond, &scheduler->component.mutex, &scheduler->schd_time); // Schedule wait
-    state = scheduler->component.state;
+    state = iot_component_get_state (&scheduler->component);
     if (state != IOT_COMPONENT_RUNNING)
     {
       iot_log_debug (scheduler->logger, "Scheduler thread %s", (state == IOT_COMPONENT_DELETED) ? "terminating" : "stopping");
       if (state == IOT_COMPONENT_DELETED) break; // Exit thread on deletion
-      iot_component_unlock (&scheduler->component);
       continue; // Wait for thread to be restarted or deleted
     }
 
     /* Get the schedule at the front of the queue */
-    iot_schedule_t * current = iot_schedule_queue_next (queue);
-    if (current && current->start < iot_time_nsecs ()) // If a schedule and ready to run
+    iot_schedule_t * current = iot_schedule_queue_next (scheduler);
+    uint64_t now = iot_time_nsecs ();
+    if (current && atomic_load (&current->precise) && current->start >= now && (current->start - now) <= IOT_SCHEDULER_PRECISE_WAKE)
+    {
+      /* Woken early for precise schedule, wait for start time then recheck queue */
+      iot_component_unlock (&scheduler->component);
+      iot_wait_precise_nsecs (current->start - now + 1u);
+      iot_component_lock (&scheduler->component);
+      current = (scheduler->component.state == IOT_COMPONENT_RUNNING) ? iot_schedule_queue_next (scheduler) : NULL;
+      now = iot_time_nsecs ();
+    }
+    while (current && current->start < now) // If a schedule and ready to run
     {
       bool valid_current = atomic_load (&current->scheduled);
       if (atomic_load (&current->concurrent) || (atomic_load (&current->refs) == 1u)) // Check for concurrent execution
       {
+        iot_stats_hist_record (&scheduler->lateness, now - current->start);
+        atomic_fetch_add (&scheduler->fired, 1u);
+        IOT_TRACE (IOT_TRACE_SCHEDULE_FIRE, current->id);
         iot_schedule_add_ref (current);
         /* Notify that the schedule is about to run */
         if (current->run_cb)
@@ -194,24 +494,21 @@ static void * iot_scheduler_thread (void * arg)
           iot_log_trace (scheduler->logger, "Running sync schedule #%" PRIu64 "", current->id);
           schedule_fn (current);
         }
-        else if (current->threadpool) // Run schedule from threadpool
+        else if (current->threadpool || ! atomic_load (&current->thread)) // Run schedule from threadpool or executor
         {
-          iot_log_trace (scheduler->logger, "Running schedule #%" PRIu64 " from threadpool", current->id);
-          if (! iot_threadpool_try_work (current->threadpool, schedule_fn, current, current->priority))
+          if (scheduler->batch) // Submit with other due schedules
           {
-            /* Notify that the run is aborted */
-            if (current->abort_cb)
-            {
-              iot_component_unlock (&scheduler->component);
-              current->abort_cb (current->arg);
-              iot_component_lock (&scheduler->component);
-            }
-            if (atomic_fetch_add (&current->dropped, 1u) == 0u)
+            iot_scheduler_batch_add (scheduler, current);
+          }
+          else
+          {
+            iot_log_trace (scheduler->logger, "Running schedule #%" PRIu64 " from threadpool", current->id);
+            if (! iot_threadpool_try_work (iot_scheduler_pool (scheduler, current), schedule_fn, current, current->priority))
             {
-              iot_log_warn (scheduler->logger, "Scheduled event dropped for schedule #%" PRIu64, current->id);
+              iot_scheduler_drop (scheduler, current);
+              valid_current = atomic_load (&current->refs) > 1u && atomic_load (&current->scheduled);;
+              iot_schedule_free (current);
             }
-            valid_current = atomic_load (&current->refs) > 1u && atomic_load (&current->scheduled);;
-            iot_schedule_free (current);
           }
         }
         else // Run schedule in new thread
@@ -227,12 +524,13 @@ static void * iot_scheduler_thread (void * arg)
       else
       {
         iot_log_trace (scheduler->logger, "Skipping schedule #%" PRIu64 " as running", current->id);
+        atomic_fetch_add (&scheduler->skipped, 1u);
       }
 
       if (valid_current)
       {
         /* Recalculate the next start time for the schedule */
-        next = current->period + iot_time_nsecs ();
+        next = iot_schedule_period (current) + iot_time_nsecs ();
 
         if ((current->repeat > 0u) && (--(current->repeat) == 0u)) // Last repetition
         {
@@ -250,29 +548,79 @@ static void * iot_scheduler_thread (void * arg)
       {
         iot_log_trace (scheduler->logger, "Current schedule deleted");
       }
-      current = iot_schedule_queue_next (queue);
+      current = iot_schedule_queue_next (scheduler);
+      if (! scheduler->batch) break;
     }
+    if (scheduler->batch_count) iot_scheduler_batch_flush (scheduler);
     next = current ? current->start : (iot_time_nsecs () + IOT_SCHEDULER_DEFAULT_WAKE);
+    if (current && atomic_load (&current->precise)) next -= IOT_SCHEDULER_PRECISE_WAKE;
     nsToTimespec (next, &scheduler->schd_time); /* Calculate next execution time */
-    iot_component_unlock (&scheduler->component);
   }
   iot_component_unlock (&scheduler->component);
+  atomic_store (&scheduler->running, false);
   return NULL;
 }
 
-iot_scheduler_t * iot_scheduler_alloc (int priority, int affinity, iot_logger_t * logger)
+iot_data_t * iot_scheduler_stats (iot_scheduler_t * scheduler)
+{
+  assert (scheduler);
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_component_lock (&scheduler->component);
+  uint32_t active = scheduler->active;
+  uint32_t idle = iot_data_map_size (scheduler->idle);
+  bool batch = scheduler->batch;
+  uint32_t batch_max = scheduler->batch_max;
+  iot_threadpool_t * executor = scheduler->executor;
+  iot_threadpool_add_ref (executor);
+  iot_component_unlock (&scheduler->component);
+  iot_data_string_map_add (map, "active", iot_data_alloc_ui32 (active));
+  iot_data_string_map_add (map, "idle", iot_data_alloc_ui32 (idle));
+  iot_data_string_map_add (map, "fired", iot_data_alloc_ui64 (atomic_load (&scheduler->fired)));
+  iot_data_string_map_add (map, "dropped", iot_data_alloc_ui64 (atomic_load (&scheduler->dropped)));
+  iot_data_string_map_add (map, "skipped", iot_data_alloc_ui64 (atomic_load (&scheduler->skipped)));
+  if (batch)
+  {
+    iot_data_string_map_add (map, "batches", iot_data_alloc_ui64 (atomic_load (&scheduler->batches)));
+    iot_data_string_map_add (map, "batch_max", iot_data_alloc_ui32 (batch_max));
+  }
+  if (executor)
+  {
+    iot_data_string_map_add (map, "executor", iot_threadpool_stats (executor));
+    iot_threadpool_free (executor);
+  }
+  iot_data_string_map_add (map, "lateness", iot_stats_hist_data (&scheduler->lateness));
+  return map;
+}
+
+iot_scheduler_t * iot_scheduler_alloc_wheel (int priority, int affinity, uint64_t resolution, iot_logger_t * logger)
 {
   iot_scheduler_t * scheduler = (iot_scheduler_t*) calloc (1u, sizeof (*scheduler));
   iot_component_init (&scheduler->component, IOT_SCHEDULER_FACTORY, (iot_component_start_fn_t) iot_scheduler_start, (iot_component_stop_fn_t) iot_scheduler_stop);
+  iot_component_set_stats_callback (&scheduler->component, (iot_component_stats_fn_t) iot_scheduler_stats);
   scheduler->logger = logger;
   scheduler->idle = iot_data_alloc_map (IOT_DATA_UINT64);
-  scheduler->queue = iot_data_alloc_map (IOT_DATA_UINT64);
+  if (resolution)
+  {
+    scheduler->wheel = (iot_timer_wheel_t*) calloc (1u, sizeof (*scheduler->wheel));
+    scheduler->wheel->resolution = resolution;
+    scheduler->wheel->base = iot_time_nsecs () / resolution;
+  }
+  else
+  {
+    scheduler->queue = iot_data_alloc_map (IOT_DATA_UINT64);
+  }
   iot_logger_add_ref (logger);
-  iot_log_info (logger, "iot_scheduler_alloc (priority: %d affinity: %d)", priority, affinity);
-  iot_thread_create (NULL, iot_scheduler_thread, scheduler, priority, affinity, logger);
+  iot_log_info (logger, "iot_scheduler_alloc (priority: %d affinity: %d resolution: %" PRIu64 ")", priority, affinity, resolution);
+  atomic_store (&scheduler->running, true);
+  if (! iot_thread_create (NULL, iot_scheduler_thread, scheduler, priority, affinity, logger)) atomic_store (&scheduler->running, false);
   return scheduler;
 }
 
+iot_scheduler_t * iot_scheduler_alloc (int priority, int affinity, iot_logger_t * logger)
+{
+  return iot_scheduler_alloc_wheel (priority, affinity, 0u, logger);
+}
+
 void iot_scheduler_add_ref (iot_scheduler_t * scheduler)
 {
   if (scheduler) iot_component_add_ref (&scheduler->component);
@@ -285,6 +633,14 @@ void iot_scheduler_start (iot_scheduler_t * scheduler)
   iot_component_set_running (&scheduler->component);
 }
 
+void iot_scheduler_set_batch (iot_scheduler_t * scheduler, bool enable)
+{
+  assert (scheduler);
+  iot_component_lock (&scheduler->component);
+  scheduler->batch = enable;
+  iot_component_unlock (&scheduler->component);
+}
+
 void iot_scheduler_stop (iot_scheduler_t * scheduler)
 {
   assert (scheduler);
@@ -381,6 +737,184 @@ void iot_schedule_reset (iot_scheduler_t * scheduler, iot_schedule_t * schedule,
   iot_component_unlock (&scheduler->component);
 }
 
+/* Deterministic per schedule jitter, a splitmix64 hash of the schedule id */
+static inline uint64_t iot_schedule_jitter (const iot_schedule_t * schedule, uint64_t jitter)
+{
+  uint64_t z = schedule->id + 0x9e3779b97f4a7c15u;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+  return (z ^ (z >> 31)) % jitter;
+}
+
+void iot_schedule_spread (iot_scheduler_t * scheduler, iot_schedule_t * const * schedules, uint32_t count, uint64_t jitter)
+{
+  assert (scheduler && (schedules || count == 0u));
+  bool front = false;
+  iot_log_trace (scheduler->logger, "iot_schedule_spread (count: %" PRIu32 " jitter: %" PRIu64 ")", count, jitter);
+  iot_component_lock (&scheduler->component);
+  uint64_t now = iot_time_nsecs ();
+  for (uint32_t i = 0; i < count; i++)
+  {
+    iot_schedule_t * schedule = schedules[i];
+    uint64_t offset = (schedule->period / count) * i + (jitter ? iot_schedule_jitter (schedule, jitter) : 0u);
+    uint64_t next = now + (schedule->period ? (offset % schedule->period) : offset);
+    if (schedule->scheduled)
+    {
+      front = iot_schedule_queue_update (scheduler, schedule, next) || front;
+    }
+    else
+    {
+      iot_schedule_update_start (schedule, next);
+    }
+  }
+  if (front && (scheduler->component.state == IOT_COMPONENT_RUNNING))
+  {
+    pthread_cond_signal (&scheduler->component.cond);
+  }
+  iot_component_unlock (&scheduler->component);
+}
+
+static void iot_schedule_members_free (iot_schedule_members_t * members)
+{
+  if (members && (atomic_fetch_sub (&members->refs, 1u) <= 1u)) free (members);
+}
+
+static void * iot_schedule_chunk_fn (void * arg)
+{
+  iot_schedule_chunk_t * chunk = arg;
+  for (uint32_t i = chunk->start; i < chunk->end; i++)
+  {
+    chunk->members->members[i].function (chunk->members->members[i].arg);
+  }
+  iot_schedule_members_free (chunk->members);
+  free (chunk);
+  return NULL;
+}
+
+/* Group schedule function, runs the first chunk of members and submits the rest to the group thread pool */
+static void * iot_schedule_group_fn (void * arg)
+{
+  iot_schedule_group_t * group = arg;
+  pthread_mutex_lock (&group->mutex);
+  iot_schedule_members_t * members = group->members;
+  if (members) atomic_fetch_add (&members->refs, 1u);
+  pthread_mutex_unlock (&group->mutex);
+  if (members)
+  {
+    uint32_t chunk = (group->chunk && group->threadpool) ? group->chunk : members->count;
+    for (uint32_t start = chunk; start < members->count; start += chunk)
+    {
+      iot_schedule_chunk_t * job = malloc (sizeof (*job));
+      uint32_t end = start + chunk;
+      *job = (iot_schedule_chunk_t) { members, start, (end < members->count) ? end : members->count };
+      atomic_fetch_add (&members->refs, 1u);
+      if (! iot_threadpool_try_work (group->threadpool, iot_schedule_chunk_fn, job, group->priority))
+      {
+        iot_schedule_chunk_fn (job); // Pool full, run chunk from this job
+      }
+    }
+    uint32_t end = (chunk < members->count) ? chunk : members->count;
+    for (uint32_t i = 0; i < end; i++)
+    {
+      members->members[i].function (members->members[i].arg);
+    }
+    iot_schedule_members_free (members);
+  }
+  return NULL;
+}
+
+static void iot_schedule_group_free (void * arg)
+{
+  iot_schedule_group_t * group = arg;
+  iot_schedule_members_free (group->members);
+  iot_threadpool_free (group->threadpool);
+  pthread_mutex_destroy (&group->mutex);
+  free (group);
+}
+
+/* Get group members that can be updated in place with room for size members, called with group locked */
+static iot_schedule_members_t * iot_schedule_group_members (iot_schedule_group_t * group, uint32_t size)
+{
+  iot_schedule_members_t * members = group->members;
+  if (members && (members->size >= size) && (atomic_load (&members->refs) == 1u)) return members;
+  uint32_t count = members ? members->count : 0u;
+  uint32_t alloc = (count * 2u > size) ? count * 2u : size;
+  if (alloc < IOT_SCHEDULE_GROUP_MIN_SIZE) alloc = IOT_SCHEDULE_GROUP_MIN_SIZE;
+  iot_schedule_members_t * copy = malloc (sizeof (*copy) + alloc * sizeof (iot_schedule_member_t));
+  atomic_store (&copy->refs, 1u);
+  copy->count = count;
+  copy->size = alloc;
+  if (count) memcpy (copy->members, members->members, count * sizeof (iot_schedule_member_t));
+  iot_schedule_members_free (members);
+  group->members = copy;
+  return copy;
+}
+
+iot_schedule_group_t * iot_schedule_group_create (iot_scheduler_t * scheduler, uint64_t period, uint64_t delay, uint64_t repeat, iot_threadpool_t * pool, int priority, uint32_t chunk)
+{
+  assert (scheduler);
+  iot_schedule_group_t * group = (iot_schedule_group_t*) calloc (1, sizeof (*group));
+  group->threadpool = pool;
+  group->priority = priority;
+  group->chunk = chunk;
+  iot_mutex_init (&group->mutex);
+  iot_threadpool_add_ref (pool);
+  group->schedule = iot_schedule_create (scheduler, iot_schedule_group_fn, iot_schedule_group_free, group, period, delay, repeat, pool, priority);
+  iot_log_trace (scheduler->logger, "iot_schedule_group_create #%" PRIu64 " (chunk: %" PRIu32 ")", group->schedule->id, chunk);
+  return group;
+}
+
+iot_schedule_t * iot_schedule_group_schedule (const iot_schedule_group_t * group)
+{
+  assert (group);
+  return group->schedule;
+}
+
+void iot_schedule_group_add (iot_schedule_group_t * group, iot_schedule_fn_t func, void * arg)
+{
+  assert (group && func);
+  pthread_mutex_lock (&group->mutex);
+  iot_schedule_members_t * members = iot_schedule_group_members (group, group->members ? group->members->count + 1u : 1u);
+  members->members[members->count++] = (iot_schedule_member_t) { func, arg };
+  pthread_mutex_unlock (&group->mutex);
+}
+
+bool iot_schedule_group_remove (iot_schedule_group_t * group, iot_schedule_fn_t func, const void * arg)
+{
+  assert (group && func);
+  bool ret = false;
+  pthread_mutex_lock (&group->mutex);
+  uint32_t count = group->members ? group->members->count : 0u;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (group->members->members[i].function == func && group->members->members[i].arg == arg)
+    {
+      iot_schedule_members_t * members = iot_schedule_group_members (group, count);
+      memmove (&members->members[i], &members->members[i + 1u], (count - i - 1u) * sizeof (iot_schedule_member_t));
+      members->count--;
+      ret = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock (&group->mutex);
+  return ret;
+}
+
+uint32_t iot_schedule_group_size (iot_schedule_group_t * group)
+{
+  assert (group);
+  pthread_mutex_lock (&group->mutex);
+  uint32_t size = group->members ? group->members->count : 0u;
+  pthread_mutex_unlock (&group->mutex);
+  return size;
+}
+
+void iot_schedule_group_delete (iot_scheduler_t * scheduler, iot_schedule_group_t * group)
+{
+  assert (scheduler && group);
+  iot_schedule_delete (scheduler, group->schedule); // Group freed with schedule
+}
+
 void iot_schedule_add_run_callback (iot_scheduler_t * scheduler, iot_schedule_t * schedule, iot_schedule_fn_t func)
 {
   assert (scheduler && schedule);
@@ -434,17 +968,66 @@ static void iot_scheduler_free_schedules (iot_data_t * map)
   iot_data_free (map);
 }
 
+static void iot_scheduler_free_wheel (iot_timer_wheel_t * wheel)
+{
+  iot_schedule_t * schedule;
+  while ((schedule = iot_wheel_next (wheel)))
+  {
+    iot_wheel_remove (wheel, schedule);
+    iot_schedule_free (schedule);
+  }
+  free (wheel);
+}
+
+static void * iot_scheduler_time_cache_fn (void * arg)
+{
+  (void) arg;
+  iot_time_cache_update ();
+  return NULL;
+}
+
+static void iot_scheduler_time_cache_free (void * arg)
+{
+  (void) arg;
+  iot_time_cache_disable ();
+}
+
+iot_schedule_t * iot_scheduler_time_cache (iot_scheduler_t * scheduler, uint64_t interval)
+{
+  assert (scheduler && interval);
+  iot_schedule_t * schedule = iot_schedule_create (scheduler, iot_scheduler_time_cache_fn, iot_scheduler_time_cache_free, NULL, interval, 0u, 0u, NULL, IOT_THREAD_NO_PRIORITY);
+  if (schedule)
+  {
+    iot_time_cache_update ();
+    iot_schedule_set_sync (schedule, true);
+    if (! iot_schedule_add (scheduler, schedule))
+    {
+      iot_schedule_delete (scheduler, schedule);
+      schedule = NULL;
+    }
+  }
+  return schedule;
+}
+
 void iot_scheduler_free (iot_scheduler_t * scheduler)
 {
   if (scheduler && iot_component_dec_ref (&scheduler->component))
   {
     iot_log_trace (scheduler->logger, "iot_scheduler_free");
     iot_component_set_stopped (&scheduler->component); // Break schedule thread out of schedule wait
-    iot_wait_usecs (500u);
     iot_component_set_deleted (&scheduler->component); // Break schedule thread out of state wait
-    iot_wait_usecs (500u);
-    iot_scheduler_free_schedules (scheduler->queue);
+    while (atomic_load (&scheduler->running)) iot_wait_msecs (1u); // Scheduler thread is detached
+    iot_threadpool_free (scheduler->executor);
+    if (scheduler->wheel)
+    {
+      iot_scheduler_free_wheel (scheduler->wheel);
+    }
+    else
+    {
+      iot_scheduler_free_schedules (scheduler->queue);
+    }
     iot_scheduler_free_schedules (scheduler->idle);
+    free (scheduler->batch_jobs);
     iot_logger_free (scheduler->logger);
     iot_component_fini (&scheduler->component);
     free (scheduler);
@@ -458,7 +1041,10 @@ static iot_component_t * iot_scheduler_config (iot_container_t * cont, const iot
   iot_logger_t * logger = (iot_logger_t*) iot_container_find_component (cont, iot_data_string_map_get_string (map, "Logger"));
   int affinity = (int) iot_data_string_map_get_i64 (map, "Affinity", IOT_THREAD_NO_AFFINITY);
   int prio = (int) iot_data_string_map_get_i64 (map, "Priority", IOT_THREAD_NO_PRIORITY);
-  return (iot_component_t*) iot_scheduler_alloc (prio, affinity, logger);
+  uint64_t resolution = (uint64_t) iot_data_string_map_get_i64 (map, "WheelResolution", 0);
+  iot_scheduler_t * scheduler = iot_scheduler_alloc_wheel (prio, affinity, resolution, logger);
+  iot_scheduler_set_batch (scheduler, iot_data_string_map_get_bool (map, "Batch", false));
+  return (iot_component_t*) scheduler;
 }
 
 const iot_component_factory_t * iot_scheduler_factory (void)
@@ -0,0 +1,44 @@
+//
+// Copyright (c) 2023 IOTech Ltd
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+
+#ifndef _IOT_STATS_IMPL_H_
+#define _IOT_STATS_IMPL_H_
+
+#include "iot/data.h"
+
+// Duration histogram for component statistics. Bucket zero counts durations under one microsecond,
+// bucket n durations from 2^(n-1) up to 2^n microseconds, with the last bucket counting all longer.
+
+#define IOT_STATS_BUCKETS 24u
+
+typedef struct iot_stats_hist_t
+{
+  _Atomic uint64_t buckets[IOT_STATS_BUCKETS];
+  _Atomic uint64_t total;  // Total duration in nanoseconds
+  _Atomic uint64_t max;    // Maximum duration in nanoseconds
+} iot_stats_hist_t;
+
+static inline void iot_stats_max (_Atomic uint64_t * max, uint64_t val)
+{
+  uint64_t current = atomic_load_explicit (max, memory_order_relaxed);
+  while (val > current && ! atomic_compare_exchange_weak_explicit (max, &current, val, memory_order_relaxed, memory_order_relaxed));
+}
+
+static inline void iot_stats_hist_record (iot_stats_hist_t * hist, uint64_t ns)
+{
+  uint64_t us = ns / 1000u;
+  uint32_t bucket = us ? (64u - (uint32_t) __builtin_clzll (us)) : 0u;
+  if (bucket >= IOT_STATS_BUCKETS) bucket = IOT_STATS_BUCKETS - 1u;
+  atomic_fetch_add_explicit (&hist->buckets[bucket], 1u, memory_order_relaxed);
+  atomic_fetch_add_explicit (&hist->total, ns, memory_order_relaxed);
+  iot_stats_max (&hist->max, ns);
+}
+
+// Returns map with "count", "total_ns", "max_ns" and "buckets" (UINT64 array) entries
+
+extern iot_data_t * iot_stats_hist_data (const iot_stats_hist_t * hist);
+
+#endif
@@ -0,0 +1,456 @@
+/*
+ * Copyright (c) 2024
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "iot/iot.h"
+
+#if defined (IOT_HAS_FILE) && !defined (_AZURESPHERE_)
+#include "iot/file.h"
+#include "iot/hash.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/*
+ * Log structured key-value store. Records are appended to a single segment file, which starts with a magic
+ * number. Each record is a header (checksum, key length, value length) followed by the key and value. A
+ * delete appends a tombstone record, with no value. The checksum covers the record after the checksum
+ * itself, so a record torn by a crash is detected and the segment truncated to the last complete record
+ * when opened. An in-memory hash index maps each key to the offset and length of its latest value.
+ * Once superseded records exceed both IOT_STORE_KV_COMPACT_MIN and the live data, a background thread
+ * compacts the segment, copying live records to a new segment which then replaces it.
+ */
+
+#define IOT_STORE_KV_MAGIC "IOTKVS01"
+#define IOT_STORE_KV_MAGIC_LEN 8u
+#define IOT_STORE_KV_TOMBSTONE UINT32_MAX
+#define IOT_STORE_KV_COMPACT_MIN 65536u
+#define IOT_STORE_KV_KEY_MAX 4096u
+
+typedef struct iot_store_kv_header_t
+{
+  uint32_t checksum;
+  uint32_t key_len;
+  uint32_t val_len;
+} iot_store_kv_header_t;
+
+typedef struct iot_store_kv_entry_t
+{
+  uint64_t offset;  // Record offset in segment
+  uint32_t len;     // Value length
+} iot_store_kv_entry_t;
+
+typedef struct iot_store_kv_t
+{
+  char * path;
+  int fd;
+  uint64_t end;     // Segment length
+  uint64_t live;    // Bytes of live records
+  uint64_t garbage; // Bytes of superseded records and tombstones
+  iot_data_t * index;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bool running;
+  bool active;      // Whether the (detached) compaction thread is running
+  bool compact;     // Set when compaction due
+} iot_store_kv_t;
+
+static iot_store_kv_t * iot_store_kv = NULL;
+
+static inline uint64_t iot_store_kv_record_size (uint32_t key_len, uint32_t val_len)
+{
+  return sizeof (iot_store_kv_header_t) + key_len + ((val_len == IOT_STORE_KV_TOMBSTONE) ? 0u : val_len);
+}
+
+static uint32_t iot_store_kv_checksum (const uint8_t * record, size_t len)
+{
+  return iot_hash_data (record + sizeof (uint32_t), len - sizeof (uint32_t));
+}
+
+static bool iot_store_kv_pread (int fd, void * buff, size_t len, uint64_t offset)
+{
+  return pread (fd, buff, len, (off_t) offset) == (ssize_t) len;
+}
+
+static bool iot_store_kv_pwrite (int fd, const void * buff, size_t len, uint64_t offset)
+{
+  return pwrite (fd, buff, len, (off_t) offset) == (ssize_t) len;
+}
+
+static void iot_store_kv_sync (int fd)
+{
+#ifdef __APPLE__
+  fsync (fd);
+#else
+  fdatasync (fd);
+#endif
+}
+
+// Allocate a record, returning its size
+
+static uint8_t * iot_store_kv_record_alloc (const char * key, const uint8_t * value, uint32_t val_len, size_t * size)
+{
+  iot_store_kv_header_t header = { .key_len = (uint32_t) strlen (key), .val_len = val_len };
+  *size = iot_store_kv_record_size (header.key_len, val_len);
+  uint8_t * record = malloc (*size);
+  memcpy (record + sizeof (header), key, header.key_len);
+  if (value) memcpy (record + sizeof (header) + header.key_len, value, val_len);
+  memcpy (record, &header, sizeof (header));
+  header.checksum = iot_store_kv_checksum (record, *size);
+  memcpy (record, &header.checksum, sizeof (header.checksum));
+  return record;
+}
+
+// Read and verify the record at an offset, returning its size or zero if incomplete or corrupt
+
+static uint64_t iot_store_kv_record_read (int fd, uint64_t offset, uint64_t end, iot_store_kv_header_t * header, uint8_t ** record)
+{
+  *record = NULL;
+  if (! iot_store_kv_pread (fd, header, sizeof (*header), offset)) return 0u;
+  if (header->key_len == 0u || header->key_len > IOT_STORE_KV_KEY_MAX) return 0u;
+  uint64_t size = iot_store_kv_record_size (header->key_len, header->val_len);
+  if (offset + size > end) return 0u;
+  *record = malloc (size + 1u);
+  if (! iot_store_kv_pread (fd, *record, size, offset) || iot_store_kv_checksum (*record, size) != header->checksum)
+  {
+    free (*record);
+    *record = NULL;
+    return 0u;
+  }
+  return size;
+}
+
+static void iot_store_kv_index_add (iot_store_kv_t * kv, const char * key, uint64_t offset, uint32_t len)
+{
+  iot_store_kv_entry_t * entry = malloc (sizeof (*entry));
+  entry->offset = offset;
+  entry->len = len;
+  iot_data_map_add (kv->index, iot_data_alloc_string (key, IOT_DATA_COPY), iot_data_alloc_pointer (entry, free));
+}
+
+// Remove key from index, with mutex held, accounting for the superseded record
+
+static void iot_store_kv_index_remove (iot_store_kv_t * kv, const char * key)
+{
+  iot_data_static_t skey;
+  const iot_data_t * k = iot_data_alloc_const_string (&skey, key);
+  const iot_store_kv_entry_t * entry = iot_data_map_get_pointer (kv->index, k);
+  if (entry)
+  {
+    uint64_t size = iot_store_kv_record_size ((uint32_t) strlen (key), entry->len);
+    kv->live -= size;
+    kv->garbage += size;
+    iot_data_map_remove (kv->index, k);
+  }
+}
+
+// Rebuild index from segment, truncating any incomplete or corrupt trailing record
+
+static bool iot_store_kv_load (iot_store_kv_t * kv)
+{
+  char magic[IOT_STORE_KV_MAGIC_LEN];
+  struct stat st;
+  if (fstat (kv->fd, &st) != 0) return false;
+  uint64_t end = (uint64_t) st.st_size;
+  if (end < IOT_STORE_KV_MAGIC_LEN) // New (or torn) segment
+  {
+    kv->end = IOT_STORE_KV_MAGIC_LEN;
+    return (ftruncate (kv->fd, 0) == 0) && iot_store_kv_pwrite (kv->fd, IOT_STORE_KV_MAGIC, IOT_STORE_KV_MAGIC_LEN, 0u);
+  }
+  if (! iot_store_kv_pread (kv->fd, magic, IOT_STORE_KV_MAGIC_LEN, 0u) || memcmp (magic, IOT_STORE_KV_MAGIC, IOT_STORE_KV_MAGIC_LEN) != 0) return false;
+
+  uint64_t offset = IOT_STORE_KV_MAGIC_LEN;
+  iot_store_kv_header_t header;
+  uint8_t * record;
+  uint64_t size;
+  while ((size = iot_store_kv_record_read (kv->fd, offset, end, &header, &record)))
+  {
+    char * key = (char*) record + sizeof (header);
+    key[header.key_len] = '\0'; // Overwrites first value byte, not used
+    iot_store_kv_index_remove (kv, key);
+    if (header.val_len == IOT_STORE_KV_TOMBSTONE)
+    {
+      kv->garbage += size;
+    }
+    else
+    {
+      iot_store_kv_index_add (kv, key, offset, header.val_len);
+      kv->live += size;
+    }
+    free (record);
+    offset += size;
+  }
+  kv->end = offset;
+  return (offset == end) || (ftruncate (kv->fd, (off_t) offset) == 0);
+}
+
+static bool iot_store_kv_compact_locked (iot_store_kv_t * kv)
+{
+  size_t len = strlen (kv->path) + 9u;
+  char * tmp = malloc (len);
+  snprintf (tmp, len, "%s.compact", kv->path);
+  int fd = open (tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  bool ok = (fd != -1) && iot_store_kv_pwrite (fd, IOT_STORE_KV_MAGIC, IOT_STORE_KV_MAGIC_LEN, 0u);
+  uint64_t offset = IOT_STORE_KV_MAGIC_LEN;
+  uint32_t count = iot_data_map_size (kv->index);
+  uint64_t * offsets = calloc (count + 1u, sizeof (*offsets));
+  iot_data_map_iter_t iter;
+  uint32_t i = 0u;
+
+  iot_data_map_iter (kv->index, &iter);
+  while (ok && iot_data_map_iter_next (&iter))
+  {
+    const iot_store_kv_entry_t * entry = iot_data_map_iter_pointer_value (&iter);
+    uint64_t size = iot_store_kv_record_size ((uint32_t) strlen (iot_data_map_iter_string_key (&iter)), entry->len);
+    uint8_t * record = malloc (size);
+    ok = iot_store_kv_pread (kv->fd, record, size, entry->offset) && iot_store_kv_pwrite (fd, record, size, offset);
+    free (record);
+    offsets[i++] = offset;
+    offset += size;
+  }
+  if (ok)
+  {
+    iot_store_kv_sync (fd);
+    ok = (rename (tmp, kv->path) == 0);
+  }
+  if (ok) // Segment replaced, so update index offsets
+  {
+    i = 0u;
+    iot_data_map_iter (kv->index, &iter);
+    while (iot_data_map_iter_next (&iter)) ((iot_store_kv_entry_t*) iot_data_map_iter_pointer_value (&iter))->offset = offsets[i++];
+    close (kv->fd);
+    kv->fd = fd;
+    kv->end = offset;
+    kv->live = offset - IOT_STORE_KV_MAGIC_LEN;
+    kv->garbage = 0u;
+  }
+  else
+  {
+    if (fd != -1) close (fd);
+    unlink (tmp);
+  }
+  free (offsets);
+  free (tmp);
+  return ok;
+}
+
+static void * iot_store_kv_thread (void * arg)
+{
+  iot_store_kv_t * kv = (iot_store_kv_t*) arg;
+  pthread_mutex_lock (&kv->mutex);
+  while (kv->running)
+  {
+    if (kv->compact)
+    {
+      kv->compact = false;
+      iot_store_kv_compact_locked (kv);
+    }
+    else
+    {
+      pthread_cond_wait (&kv->cond, &kv->mutex);
+    }
+  }
+  kv->active = false;
+  pthread_cond_broadcast (&kv->cond); // Signal thread exit to close
+  pthread_mutex_unlock (&kv->mutex);
+  return NULL;
+}
+
+// Append record, with mutex held
+
+static bool iot_store_kv_append (iot_store_kv_t * kv, const char * key, const uint8_t * value, uint32_t val_len)
+{
+  size_t size;
+  uint8_t * record = iot_store_kv_record_alloc (key, value, val_len, &size);
+  bool ok = iot_store_kv_pwrite (kv->fd, record, size, kv->end);
+  free (record);
+  if (ok)
+  {
+    iot_store_kv_index_remove (kv, key);
+    if (val_len == IOT_STORE_KV_TOMBSTONE)
+    {
+      kv->garbage += size;
+    }
+    else
+    {
+      iot_store_kv_index_add (kv, key, kv->end, val_len);
+      kv->live += size;
+    }
+    kv->end += size;
+    if (kv->garbage > IOT_STORE_KV_COMPACT_MIN && kv->garbage > kv->live && ! kv->compact)
+    {
+      kv->compact = true;
+      pthread_cond_signal (&kv->cond);
+    }
+  }
+  return ok;
+}
+
+static uint8_t * iot_store_kv_read (const char * path, size_t * len)
+{
+  iot_store_kv_t * kv = iot_store_kv;
+  uint8_t * value = NULL;
+  if (kv == NULL) return NULL;
+  pthread_mutex_lock (&kv->mutex);
+  const iot_store_kv_entry_t * entry = iot_data_string_map_get_pointer (kv->index, path);
+  if (entry)
+  {
+    value = malloc (entry->len + 1u);
+    if (iot_store_kv_pread (kv->fd, value, entry->len, entry->offset + sizeof (iot_store_kv_header_t) + strlen (path)))
+    {
+      value[entry->len] = '\0';
+      if (len) *len = entry->len;
+    }
+    else
+    {
+      free (value);
+      value = NULL;
+    }
+  }
+  pthread_mutex_unlock (&kv->mutex);
+  return value;
+}
+
+static bool iot_store_kv_write (const char * path, const uint8_t * binary, size_t len)
+{
+  iot_store_kv_t * kv = iot_store_kv;
+  bool ok = false;
+  size_t key_len = strlen (path);
+  if (kv == NULL || key_len == 0u || key_len > IOT_STORE_KV_KEY_MAX || len >= IOT_STORE_KV_TOMBSTONE) return false;
+  pthread_mutex_lock (&kv->mutex);
+  ok = iot_store_kv_append (kv, path, binary, (uint32_t) len);
+  pthread_mutex_unlock (&kv->mutex);
+  return ok;
+}
+
+static bool iot_store_kv_delete (const char * path)
+{
+  iot_store_kv_t * kv = iot_store_kv;
+  bool ok = false;
+  if (kv == NULL) return false;
+  pthread_mutex_lock (&kv->mutex);
+  if (iot_data_string_map_get (kv->index, path))
+  {
+    ok = iot_store_kv_append (kv, path, NULL, IOT_STORE_KV_TOMBSTONE);
+  }
+  pthread_mutex_unlock (&kv->mutex);
+  return ok;
+}
+
+// List keys in a directory with a .json extension, with the extension removed
+
+static iot_data_t * iot_store_kv_list (const char * directory)
+{
+  iot_store_kv_t * kv = iot_store_kv;
+  iot_data_t * list = iot_data_alloc_list ();
+  size_t dir_len = strlen (directory);
+  iot_data_map_iter_t iter;
+  if (kv == NULL) return list;
+  pthread_mutex_lock (&kv->mutex);
+  iot_data_map_iter (kv->index, &iter);
+  while (iot_data_map_iter_next (&iter))
+  {
+    const char * key = iot_data_map_iter_string_key (&iter);
+    size_t len = strlen (key);
+    if (len > dir_len + 6u && strncmp (key, directory, dir_len) == 0 && key[dir_len] == '/' && strcmp (key + len - 5u, ".json") == 0 && ! strchr (key + dir_len + 1u, '/'))
+    {
+      iot_data_list_tail_push (list, iot_data_alloc_string (strndup (key + dir_len + 1u, len - dir_len - 6u), IOT_DATA_TAKE));
+    }
+  }
+  pthread_mutex_unlock (&kv->mutex);
+  return list;
+}
+
+bool iot_store_kv_open (const char * path)
+{
+  assert (path && iot_store_kv == NULL);
+  iot_store_kv_t * kv = calloc (1u, sizeof (*kv));
+  kv->fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  kv->path = strdup (path);
+  kv->index = iot_data_alloc_typed_hash_map (IOT_DATA_STRING, IOT_DATA_POINTER);
+  bool ok = (kv->fd != -1) && iot_store_kv_load (kv);
+  if (ok)
+  {
+    iot_mutex_init (&kv->mutex);
+    iot_cond_init (&kv->cond);
+    kv->running = true;
+    kv->active = true;
+    ok = iot_thread_create (NULL, iot_store_kv_thread, kv, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+    if (! ok)
+    {
+      pthread_cond_destroy (&kv->cond);
+      pthread_mutex_destroy (&kv->mutex);
+    }
+  }
+  if (ok)
+  {
+    iot_store_kv = kv;
+    iot_store_config (iot_store_kv_read, iot_store_kv_write, iot_store_kv_delete);
+    iot_store_config_lister (iot_store_kv_list);
+  }
+  else
+  {
+    if (kv->fd != -1) close (kv->fd);
+    iot_data_free (kv->index);
+    free (kv->path);
+    free (kv);
+  }
+  return ok;
+}
+
+bool iot_store_kv_compact (void)
+{
+  iot_store_kv_t * kv = iot_store_kv;
+  bool ok = false;
+  if (kv)
+  {
+    pthread_mutex_lock (&kv->mutex);
+    ok = iot_store_kv_compact_locked (kv);
+    pthread_mutex_unlock (&kv->mutex);
+  }
+  return ok;
+}
+
+iot_data_t * iot_store_kv_stats (void)
+{
+  iot_store_kv_t * kv = iot_store_kv;
+  iot_data_t * stats = NULL;
+  if (kv)
+  {
+    stats = iot_data_alloc_map (IOT_DATA_STRING);
+    pthread_mutex_lock (&kv->mutex);
+    iot_data_string_map_add (stats, "keys", iot_data_alloc_ui32 (iot_data_map_size (kv->index)));
+    iot_data_string_map_add (stats, "size", iot_data_alloc_ui64 (kv->end));
+    iot_data_string_map_add (stats, "live", iot_data_alloc_ui64 (kv->live));
+    iot_data_string_map_add (stats, "garbage", iot_data_alloc_ui64 (kv->garbage));
+    pthread_mutex_unlock (&kv->mutex);
+  }
+  return stats;
+}
+
+void iot_store_kv_close (void)
+{
+  iot_store_kv_t * kv = iot_store_kv;
+  if (kv)
+  {
+    iot_store_config (iot_file_read_binary, iot_file_write_binary, iot_file_delete);
+    iot_store_config_lister (NULL);
+    pthread_mutex_lock (&kv->mutex);
+    kv->running = false;
+    pthread_cond_signal (&kv->cond);
+    while (kv->active) pthread_cond_wait (&kv->cond, &kv->mutex);
+    pthread_mutex_unlock (&kv->mutex);
+    iot_store_kv = NULL;
+    iot_store_kv_sync (kv->fd);
+    close (kv->fd);
+    pthread_cond_destroy (&kv->cond);
+    pthread_mutex_destroy (&kv->mutex);
+    iot_data_free (kv->index);
+    free (kv->path);
+    free (kv);
+  }
+}
+
+#endif
@@ -9,6 +9,13 @@
 
 #ifdef IOT_HAS_FILE
 #include "iot/file.h"
+#ifndef _AZURESPHERE_
+#include <sys/stat.h>
+#define IOT_STORE_CACHE
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+#endif
 static iot_store_read_fn iot_store_reader = iot_file_read_binary;
 static iot_store_write_fn iot_store_writer = iot_file_write_binary;
 static iot_store_delete_fn iot_store_deleter = iot_file_delete;
@@ -17,6 +24,363 @@ static iot_store_read_fn iot_store_reader = NULL;
 static iot_store_write_fn iot_store_writer = NULL;
 static iot_store_delete_fn iot_store_deleter = NULL;
 #endif
+static iot_store_list_fn iot_store_lister = NULL;
+
+#ifdef IOT_STORE_CACHE
+
+// Parsed configurations of files read by iot_file_read_binary, keyed by path and valid while file modification time and size unchanged
+
+typedef struct iot_store_cached_t
+{
+  iot_data_t * config;
+  struct timespec mtime;
+  off_t size;
+} iot_store_cached_t;
+
+static iot_data_t * iot_store_cache = NULL;
+static iot_file_index_t * iot_store_index = NULL; // Index of configuration files in last listed directory
+static char * iot_store_index_dir = NULL;
+static pthread_mutex_t iot_store_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void iot_store_cached_free (void * ptr)
+{
+  iot_store_cached_t * cached = ptr;
+  iot_data_free (cached->config);
+  free (cached);
+}
+
+static iot_data_t * iot_store_cache_get (const char * path, const struct stat * st)
+{
+  iot_data_t * config = NULL;
+  pthread_mutex_lock (&iot_store_mutex);
+  const iot_store_cached_t * cached = iot_store_cache ? iot_data_string_map_get_pointer (iot_store_cache, path) : NULL;
+  if (cached && cached->size == st->st_size && cached->mtime.tv_sec == st->st_mtim.tv_sec && cached->mtime.tv_nsec == st->st_mtim.tv_nsec)
+  {
+    config = iot_data_copy (cached->config);
+  }
+  pthread_mutex_unlock (&iot_store_mutex);
+  return config;
+}
+
+static void iot_store_cache_add (const char * path, const struct stat * st, const iot_data_t * config, bool copy)
+{
+  iot_store_cached_t * cached = malloc (sizeof (*cached));
+  cached->config = copy ? iot_data_copy (config) : iot_data_add_ref (config);
+  cached->mtime = st->st_mtim;
+  cached->size = st->st_size;
+  pthread_mutex_lock (&iot_store_mutex);
+  if (iot_store_cache == NULL) iot_store_cache = iot_data_alloc_typed_hash_map (IOT_DATA_STRING, IOT_DATA_POINTER);
+  iot_data_map_add (iot_store_cache, iot_data_alloc_string (path, IOT_DATA_COPY), iot_data_alloc_pointer (cached, iot_store_cached_free));
+  pthread_mutex_unlock (&iot_store_mutex);
+}
+#endif
+
+// Snapshot of cached configurations, a CBOR vector of [path, mtime seconds, mtime nanoseconds, size, configuration] vectors
+
+#if defined (IOT_STORE_CACHE) && defined (IOT_HAS_CBOR)
+#define IOT_STORE_SNAPSHOT
+#define IOT_STORE_SNAPSHOT_ENTRY 5u
+#endif
+
+bool iot_store_config_snapshot_save (const char * path)
+{
+  assert (path);
+  bool ok = false;
+#ifdef IOT_STORE_SNAPSHOT
+  iot_data_map_iter_t iter;
+  uint32_t i = 0u;
+  pthread_mutex_lock (&iot_store_mutex);
+  iot_data_t * vector = iot_data_alloc_vector (iot_store_cache ? iot_data_map_size (iot_store_cache) : 0u);
+  if (iot_store_cache)
+  {
+    iot_data_map_iter (iot_store_cache, &iter);
+    while (iot_data_map_iter_next (&iter))
+    {
+      const iot_store_cached_t * cached = iot_data_map_iter_pointer_value (&iter);
+      iot_data_t * entry = iot_data_alloc_vector (IOT_STORE_SNAPSHOT_ENTRY);
+      iot_data_vector_add (entry, 0u, iot_data_add_ref (iot_data_map_iter_key (&iter)));
+      iot_data_vector_add (entry, 1u, iot_data_alloc_i64 ((int64_t) cached->mtime.tv_sec));
+      iot_data_vector_add (entry, 2u, iot_data_alloc_i64 ((int64_t) cached->mtime.tv_nsec));
+      iot_data_vector_add (entry, 3u, iot_data_alloc_i64 ((int64_t) cached->size));
+      iot_data_vector_add (entry, 4u, iot_data_add_ref (cached->config));
+      iot_data_vector_add (vector, i++, entry);
+    }
+  }
+  pthread_mutex_unlock (&iot_store_mutex);
+  iot_data_t * cbor = iot_data_to_cbor (vector);
+  ok = iot_store_write_binary (path, iot_data_address (cbor), iot_data_array_size (cbor));
+  iot_data_free (cbor);
+  iot_data_free (vector);
+#endif
+  return ok;
+}
+
+bool iot_store_config_snapshot_load (const char * path)
+{
+  assert (path);
+  bool ok = false;
+#ifdef IOT_STORE_SNAPSHOT
+  size_t len = 0;
+  uint8_t * cbor = iot_store_read_binary (path, &len);
+  iot_data_t * vector = (cbor && len <= UINT32_MAX) ? iot_data_from_cbor (cbor, (uint32_t) len) : NULL;
+  free (cbor);
+  ok = (vector && iot_data_type (vector) == IOT_DATA_VECTOR);
+  if (ok)
+  {
+    iot_data_vector_iter_t iter;
+    iot_data_vector_iter (vector, &iter);
+    while (iot_data_vector_iter_next (&iter))
+    {
+      const iot_data_t * entry = iot_data_vector_iter_value (&iter);
+      const iot_data_t * key = (iot_data_type (entry) == IOT_DATA_VECTOR && iot_data_vector_size (entry) == IOT_STORE_SNAPSHOT_ENTRY) ? iot_data_vector_get (entry, 0u) : NULL;
+      const iot_data_t * config = key ? iot_data_vector_get (entry, 4u) : NULL;
+      if (! (config && iot_data_type (key) == IOT_DATA_STRING && iot_data_type (config) == IOT_DATA_MAP)) continue; // Skip malformed entries
+      struct stat st;
+      st.st_mtim.tv_sec = (time_t) iot_data_i64 (iot_data_vector_get (entry, 1u));
+      st.st_mtim.tv_nsec = (long) iot_data_i64 (iot_data_vector_get (entry, 2u));
+      st.st_size = (off_t) iot_data_i64 (iot_data_vector_get (entry, 3u));
+      iot_store_cache_add (iot_data_string (key), &st, config, false);
+    }
+  }
+  iot_data_free (vector);
+#endif
+  return ok;
+}
+
+void iot_store_config_cache_clear (void)
+{
+#ifdef IOT_STORE_CACHE
+  pthread_mutex_lock (&iot_store_mutex);
+  iot_data_free (iot_store_cache);
+  iot_store_cache = NULL;
+  iot_file_index_free (iot_store_index);
+  iot_store_index = NULL;
+  free (iot_store_index_dir);
+  iot_store_index_dir = NULL;
+  pthread_mutex_unlock (&iot_store_mutex);
+#endif
+}
+
+// Write-behind, pending writes held per path and written by a background thread once the delay after the first write passes
+
+typedef struct iot_store_pending_t
+{
+  struct iot_store_pending_t * next;
+  char * path;
+  uint8_t * binary;
+  size_t len;
+  uint64_t due;   // Write deadline, as from iot_cond_deadline
+} iot_store_pending_t;
+
+static iot_store_pending_t * iot_store_pending = NULL;
+static iot_store_pending_t * iot_store_writing = NULL; // Pending write being written, still read until written
+static uint64_t iot_store_delay = 0u;
+static bool iot_store_running = false;
+static bool iot_store_active = false; // Whether the (detached) write thread is running
+static pthread_mutex_t iot_store_pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t iot_store_write_mutex = PTHREAD_MUTEX_INITIALIZER; // Serialises writes of pending data, so later contents always written last
+static pthread_cond_t iot_store_cond;
+
+static void iot_store_pending_free (iot_store_pending_t * pending)
+{
+  free (pending->path);
+  free (pending->binary);
+  free (pending);
+}
+
+// Find pending write for a path, with pending mutex held, optionally removing it from the pending list
+
+static iot_store_pending_t * iot_store_pending_find (const char * path, bool remove)
+{
+  iot_store_pending_t ** prev = &iot_store_pending;
+  while (*prev && strcmp ((*prev)->path, path) != 0) prev = &(*prev)->next;
+  iot_store_pending_t * pending = *prev;
+  if (pending && remove) *prev = pending->next;
+  return pending;
+}
+
+// Pending contents for a path, with pending mutex held, including a write in progress
+
+static const iot_store_pending_t * iot_store_pending_get (const char * path)
+{
+  const iot_store_pending_t * pending = iot_store_pending ? iot_store_pending_find (path, false) : NULL;
+  if (pending == NULL && iot_store_writing && strcmp (iot_store_writing->path, path) == 0) pending = iot_store_writing;
+  return pending;
+}
+
+// Remove first pending write, with pending mutex held, only if due unless flushing
+
+static iot_store_pending_t * iot_store_pending_take (bool flush)
+{
+  iot_store_pending_t ** prev = &iot_store_pending;
+  iot_store_pending_t ** first = NULL;
+  for (; *prev; prev = &(*prev)->next)
+  {
+    if (first == NULL || (*prev)->due < (*first)->due) first = prev;
+  }
+  iot_store_pending_t * pending = first ? *first : NULL;
+  if (pending && (flush || pending->due <= iot_cond_deadline (0u)))
+  {
+    *first = pending->next;
+    return pending;
+  }
+  return NULL;
+}
+
+// Write one pending write, returns false if none or write failed
+
+static bool iot_store_pending_write (bool flush, bool * ok)
+{
+  pthread_mutex_lock (&iot_store_write_mutex);
+  pthread_mutex_lock (&iot_store_pending_mutex);
+  iot_store_pending_t * pending = iot_store_pending_take (flush);
+  iot_store_writing = pending;
+  pthread_mutex_unlock (&iot_store_pending_mutex);
+  if (pending)
+  {
+    if (! (iot_store_writer && iot_store_writer (pending->path, pending->binary, pending->len))) *ok = false;
+    pthread_mutex_lock (&iot_store_pending_mutex);
+    iot_store_writing = NULL;
+    pthread_mutex_unlock (&iot_store_pending_mutex);
+    iot_store_pending_free (pending);
+  }
+  pthread_mutex_unlock (&iot_store_write_mutex);
+  return pending != NULL;
+}
+
+static void * iot_store_write_thread (void * arg)
+{
+  (void) arg;
+  bool ok = true;
+  pthread_mutex_lock (&iot_store_pending_mutex);
+  while (iot_store_running)
+  {
+    uint64_t deadline = IOT_COND_NO_DEADLINE;
+    for (const iot_store_pending_t * pending = iot_store_pending; pending; pending = pending->next)
+    {
+      if (pending->due < deadline) deadline = pending->due;
+    }
+    if (deadline != IOT_COND_NO_DEADLINE && deadline <= iot_cond_deadline (0u))
+    {
+      pthread_mutex_unlock (&iot_store_pending_mutex);
+      while (iot_store_pending_write (false, &ok));
+      pthread_mutex_lock (&iot_store_pending_mutex);
+    }
+    else
+    {
+      iot_cond_timedwait (&iot_store_cond, &iot_store_pending_mutex, deadline);
+    }
+  }
+  iot_store_active = false;
+  pthread_cond_broadcast (&iot_store_cond); // Signal thread exit to write-behind stop
+  pthread_mutex_unlock (&iot_store_pending_mutex);
+  return NULL;
+}
+
+// Hold write as pending if write-behind enabled, replacing any pending write for the same path
+
+static bool iot_store_pending_add (const char * path, const uint8_t * binary, size_t len)
+{
+  bool added = false;
+  pthread_mutex_lock (&iot_store_pending_mutex);
+  iot_store_pending_t * pending = iot_store_pending ? iot_store_pending_find (path, false) : NULL;
+  if (iot_store_running || pending) // Once stopped, still replace pending data not yet flushed, so written in order
+  {
+    if (pending == NULL)
+    {
+      pending = calloc (1u, sizeof (*pending));
+      pending->path = strdup (path);
+      pending->due = iot_cond_deadline (iot_store_delay);
+      pending->next = iot_store_pending;
+      iot_store_pending = pending;
+      pthread_cond_signal (&iot_store_cond);
+    }
+    free (pending->binary);
+    pending->binary = malloc (len + 1u);
+    memcpy (pending->binary, binary, len);
+    pending->binary[len] = '\0';
+    pending->len = len;
+    added = true;
+  }
+  pthread_mutex_unlock (&iot_store_pending_mutex);
+  return added;
+}
+
+#ifdef IOT_STORE_CACHE
+static bool iot_store_is_pending (const char * path)
+{
+  pthread_mutex_lock (&iot_store_pending_mutex);
+  bool found = iot_store_pending_get (path) != NULL;
+  pthread_mutex_unlock (&iot_store_pending_mutex);
+  return found;
+}
+#endif
+
+// Copy of pending contents for a path, terminated as for iot_file_read_binary, or NULL if no pending write
+
+static uint8_t * iot_store_pending_read (const char * path, size_t * len)
+{
+  uint8_t * binary = NULL;
+  pthread_mutex_lock (&iot_store_pending_mutex);
+  const iot_store_pending_t * pending = iot_store_pending_get (path);
+  if (pending)
+  {
+    binary = malloc (pending->len + 1u);
+    memcpy (binary, pending->binary, pending->len + 1u);
+    if (len) *len = pending->len;
+  }
+  pthread_mutex_unlock (&iot_store_pending_mutex);
+  return binary;
+}
+
+bool iot_store_flush (void)
+{
+  bool ok = true;
+  while (iot_store_pending_write (true, &ok));
+  return ok;
+}
+
+bool iot_store_write_behind (uint32_t delay)
+{
+  bool ok = true;
+  pthread_mutex_lock (&iot_store_pending_mutex);
+  bool running = iot_store_running;
+  iot_store_delay = (uint64_t) delay * 1000000u;
+  iot_store_running = (delay > 0u);
+  if (running != iot_store_running)
+  {
+    if (running)
+    {
+      pthread_cond_signal (&iot_store_cond);
+    }
+    else
+    {
+      iot_cond_init (&iot_store_cond);
+      iot_store_active = true;
+    }
+  }
+  pthread_mutex_unlock (&iot_store_pending_mutex);
+  if (running && delay == 0u) // Stop write thread and write any pending data
+  {
+    pthread_mutex_lock (&iot_store_pending_mutex);
+    while (iot_store_active) pthread_cond_wait (&iot_store_cond, &iot_store_pending_mutex);
+    pthread_mutex_unlock (&iot_store_pending_mutex);
+    pthread_cond_destroy (&iot_store_cond);
+    ok = iot_store_flush ();
+  }
+  else if (! running && delay > 0u)
+  {
+    ok = iot_thread_create (NULL, iot_store_write_thread, NULL, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+    if (! ok)
+    {
+      pthread_mutex_lock (&iot_store_pending_mutex);
+      iot_store_running = false;
+      iot_store_active = false;
+      pthread_mutex_unlock (&iot_store_pending_mutex);
+    }
+  }
+  return ok;
+}
 
 void iot_store_config (iot_store_read_fn read_fn, iot_store_write_fn write_fn, iot_store_delete_fn del_fn)
 {
@@ -25,6 +389,11 @@ void iot_store_config (iot_store_read_fn read_fn, iot_store_write_fn write_fn, i
   iot_store_deleter = del_fn;
 }
 
+void iot_store_config_lister (iot_store_list_fn list_fn)
+{
+  iot_store_lister = list_fn;
+}
+
 char * iot_store_read (const char * path)
 {
   return (char*) iot_store_read_binary (path, NULL);
@@ -39,19 +408,33 @@ bool iot_store_write (const char * path, const char * str)
 uint8_t * iot_store_read_binary (const char * path, size_t * len)
 {
   assert (path);
+  uint8_t * binary = iot_store_pending_read (path, len);
+  if (binary) return binary;
   return iot_store_reader ? iot_store_reader (path, len) : NULL;
 }
 
 bool iot_store_write_binary (const char * path, const uint8_t * binary, size_t len)
 {
   assert (path && binary && len);
+  if (iot_store_writer && iot_store_pending_add (path, binary, len)) return true;
   return iot_store_writer ? iot_store_writer (path, binary, len) : false;
 }
 
 bool iot_store_delete (const char * path)
 {
   assert (path);
-  return iot_store_deleter ? iot_store_deleter (path) : false;
+  pthread_mutex_lock (&iot_store_write_mutex); // Not overwritten by a pending write in progress
+  pthread_mutex_lock (&iot_store_pending_mutex);
+  iot_store_pending_t * pending = iot_store_pending ? iot_store_pending_find (path, true) : NULL;
+  pthread_mutex_unlock (&iot_store_pending_mutex);
+  bool ok = iot_store_deleter ? iot_store_deleter (path) : false;
+  pthread_mutex_unlock (&iot_store_write_mutex);
+  if (pending)
+  {
+    iot_store_pending_free (pending);
+    ok = true;
+  }
+  return ok;
 }
 
 static char * iot_store_config_path (const char * name, const char * uri)
@@ -77,6 +460,28 @@ char * iot_store_config_load (const char * name, const char * uri)
   return ret;
 }
 
+iot_data_t * iot_store_config_load_map (const char * name, const char * uri)
+{
+  char * path = iot_store_config_path (name, uri);
+  iot_data_t * config = NULL;
+#ifdef IOT_STORE_CACHE
+  struct stat st;
+  bool cache = (iot_store_reader == iot_file_read_binary) && ! iot_store_is_pending (path) && (stat (path, &st) == 0);
+  if (cache) config = iot_store_cache_get (path, &st);
+#endif
+  if (config == NULL)
+  {
+    char * str = iot_store_read (path);
+    config = iot_config_from_json (str, iot_logger_default ());
+#ifdef IOT_STORE_CACHE
+    if (config && cache) iot_store_cache_add (path, &st, config, true);
+#endif
+    free (str);
+  }
+  free (path);
+  return config;
+}
+
 bool iot_store_config_save (const char * name, const char * uri, const char * config)
 {
   char * path = iot_store_config_path (name, uri);
@@ -95,9 +500,23 @@ bool iot_store_config_delete (const char * name, const char * uri)
 
 iot_data_t * iot_store_config_list (const char * directory)
 {
+  if (iot_store_lister) return iot_store_lister (directory);
 #ifndef _AZURESPHERE_
   static const char extension_regex[] = ".json$";
+#ifdef IOT_STORE_CACHE
+  pthread_mutex_lock (&iot_store_mutex);
+  if (iot_store_index == NULL || strcmp (iot_store_index_dir, directory) != 0)
+  {
+    iot_file_index_free (iot_store_index);
+    free (iot_store_index_dir);
+    iot_store_index = iot_file_index_alloc (directory, extension_regex);
+    iot_store_index_dir = strdup (directory);
+  }
+  iot_data_t * file_list = iot_file_index_list (iot_store_index);
+  pthread_mutex_unlock (&iot_store_mutex);
+#else
   iot_data_t * file_list = iot_file_list (directory, extension_regex);
+#endif
   iot_data_list_iter_t list_iter;
   iot_data_list_iter (file_list, &list_iter);
   while (iot_data_list_iter_next (&list_iter))
@@ -0,0 +1,477 @@
+#include "iot/iot.h"
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// Throughput and latency benchmarks for data, JSON, CBOR, queue and thread pool hot paths. Each benchmark
+// is sampled repeatedly, per sample setup and teardown are not timed. Latency percentiles are per operation,
+// from the mean operation time of each sample. Reports a table, or one JSON object per line with -j.
+//
+// With -p (Linux only), hardware counters are also collected over the timed runs, and cycles, instructions,
+// cache misses and branch misses are reported per operation. Counters are for the benchmark thread only,
+// so exclude work done by thread pool threads. Counters may be unavailable, depending on the processor,
+// virtualisation and the perf_event_paranoid setting, in which case they are not reported.
+
+#define BENCH_MIN_SAMPLES 20u
+#define BENCH_MAX_SAMPLES 10000u
+#define BENCH_MIN_NSECS 200000000u
+#define BENCH_MAP_SIZES 3u
+#define BENCH_LIST_SIZE 1024u
+#define BENCH_REPEAT 16u
+#define BENCH_POOL_JOBS 256u
+#define BENCH_COUNTERS 4u
+
+typedef struct bench_t bench_t;
+
+typedef void (*bench_setup_fn) (bench_t * bench);
+typedef void (*bench_run_fn) (bench_t * bench);
+
+struct bench_t
+{
+  const char * name;
+  bench_setup_fn setup;       // Per sample setup, may be NULL
+  bench_run_fn run;           // Timed function
+  bench_setup_fn teardown;    // Per sample teardown, may be NULL
+  uint32_t size;              // Benchmark specific size
+  uint64_t ops;               // Operations per run
+  uint64_t bytes;             // Bytes processed per run
+  iot_data_t * data;          // Benchmark input
+  iot_data_t * result;        // Benchmark output, freed by teardown
+  iot_data_t * items[BENCH_REPEAT];
+  char * json;
+};
+
+static volatile uint32_t bench_sink;
+static iot_data_t * bench_sample;
+static iot_threadpool_t * bench_pool;
+static const char * const bench_counter_names[BENCH_COUNTERS] = { "cycles", "instructions", "cache_misses", "branch_misses" };
+
+#ifdef __linux__
+
+// Hardware counters are opened as a group, so are enabled, disabled and read together
+
+static int bench_counter_fds[BENCH_COUNTERS] = { -1, -1, -1, -1 };
+
+static void bench_counters_close (void)
+{
+  for (uint32_t i = 0; i < BENCH_COUNTERS; i++)
+  {
+    if (bench_counter_fds[i] >= 0) close (bench_counter_fds[i]);
+    bench_counter_fds[i] = -1;
+  }
+}
+
+static bool bench_counters_open (void)
+{
+  static const uint64_t configs[BENCH_COUNTERS] =
+    { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+  for (uint32_t i = 0; i < BENCH_COUNTERS; i++)
+  {
+    struct perf_event_attr attr;
+    memset (&attr, 0, sizeof (attr));
+    attr.size = sizeof (attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[i];
+    attr.disabled = (i == 0u);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    bench_counter_fds[i] = (int) syscall (SYS_perf_event_open, &attr, 0, -1, (i == 0u) ? -1 : bench_counter_fds[0], 0);
+    if (bench_counter_fds[i] < 0)
+    {
+      fprintf (stderr, "Hardware counter %s unavailable: %s\n", bench_counter_names[i], strerror (errno));
+      bench_counters_close ();
+      return false;
+    }
+  }
+  return true;
+}
+
+static void bench_counters_start (void)
+{
+  ioctl (bench_counter_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl (bench_counter_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void bench_counters_stop (uint64_t * totals)
+{
+  struct { uint64_t count; uint64_t values[BENCH_COUNTERS]; } group;
+  ioctl (bench_counter_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  if (read (bench_counter_fds[0], &group, sizeof (group)) == (ssize_t) sizeof (group))
+  {
+    for (uint32_t i = 0; i < BENCH_COUNTERS; i++) totals[i] += group.values[i];
+  }
+}
+
+#else
+
+static bool bench_counters_open (void)
+{
+  fprintf (stderr, "Hardware counters only supported on Linux\n");
+  return false;
+}
+
+static void bench_counters_close (void) {}
+static void bench_counters_start (void) {}
+static void bench_counters_stop (uint64_t * totals) { (void) totals; }
+
+#endif
+
+// Sample data as for a device reading, a map of scalars, strings, arrays and nested maps
+
+static iot_data_t * bench_sample_alloc (void)
+{
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+  char key[32];
+  for (uint32_t i = 0; i < 64u; i++)
+  {
+    iot_data_t * value;
+    snprintf (key, sizeof (key), "Resource_%02" PRIu32, i);
+    switch (i % 6u)
+    {
+      case 0: value = iot_data_alloc_i32 ((int32_t) (i * 1000u)); break;
+      case 1: value = iot_data_alloc_f64 (i * 1.5); break;
+      case 2: value = iot_data_alloc_string ("Some string data for the resource", IOT_DATA_REF); break;
+      case 3: value = iot_data_alloc_bool ((i % 2u) == 0u); break;
+      case 4:
+      {
+        float * floats = malloc (16u * sizeof (float));
+        for (uint32_t j = 0; j < 16u; j++) floats[j] = (float) j * 0.25f;
+        value = iot_data_alloc_array (floats, 16u, IOT_DATA_FLOAT32, IOT_DATA_TAKE);
+        break;
+      }
+      default:
+      {
+        value = iot_data_alloc_map (IOT_DATA_STRING);
+        iot_data_string_map_add (value, "units", iot_data_alloc_string ("degC", IOT_DATA_REF));
+        iot_data_string_map_add (value, "min", iot_data_alloc_i64 (-40));
+        iot_data_string_map_add (value, "max", iot_data_alloc_i64 (125));
+        iot_data_string_map_add (value, "origin", iot_data_alloc_ui64 (1600000000000000000ull + i));
+        break;
+      }
+    }
+    iot_data_map_add (map, iot_data_alloc_string (key, IOT_DATA_COPY), value);
+  }
+  return map;
+}
+
+static void bench_free_result (bench_t * bench)
+{
+  iot_data_free (bench->result);
+  bench->result = NULL;
+}
+
+static void bench_free_items (bench_t * bench)
+{
+  for (uint32_t i = 0; i < BENCH_REPEAT; i++)
+  {
+    iot_data_free (bench->items[i]);
+    bench->items[i] = NULL;
+  }
+}
+
+static void bench_map_data (bench_t * bench)
+{
+  if (bench->data == NULL)
+  {
+    bench->data = iot_data_alloc_map (IOT_DATA_UINT32);
+    for (uint32_t i = 0; i < bench->size; i++) iot_data_map_add (bench->data, iot_data_alloc_ui32 (i * 2654435761u), iot_data_alloc_ui32 (i));
+  }
+  bench->ops = bench->size;
+}
+
+static void bench_map_insert (bench_t * bench)
+{
+  bench->result = iot_data_alloc_map (IOT_DATA_UINT32);
+  for (uint32_t i = 0; i < bench->size; i++) iot_data_map_add (bench->result, iot_data_alloc_ui32 (i * 2654435761u), iot_data_alloc_ui32 (i));
+}
+
+static void bench_map_lookup (bench_t * bench)
+{
+  uint32_t found = 0u;
+  for (uint32_t i = 0; i < bench->size; i++)
+  {
+    iot_data_t * k = iot_data_alloc_ui32 (i * 2654435761u);
+    if (iot_data_map_get (bench->data, k)) found++;
+    iot_data_free (k);
+  }
+  bench_sink = found;
+}
+
+static void bench_map_iterate (bench_t * bench)
+{
+  iot_data_map_iter_t iter;
+  uint32_t sum = 0u;
+  iot_data_map_iter (bench->data, &iter);
+  while (iot_data_map_iter_next (&iter)) sum += iot_data_ui32 (iot_data_map_iter_value (&iter));
+  bench_sink = sum;
+}
+
+// String keyed map, looked up with keys equal to but not the same instances as those in the map
+
+static void bench_string_map_data (bench_t * bench)
+{
+  if (bench->data == NULL)
+  {
+    char key[32];
+    bench->data = iot_data_alloc_map (IOT_DATA_STRING);
+    bench->items[0] = iot_data_alloc_vector (bench->size);
+    for (uint32_t i = 0; i < bench->size; i++)
+    {
+      snprintf (key, sizeof (key), "sensor/%08" PRIx32, i * 2654435761u);
+      iot_data_map_add (bench->data, iot_data_alloc_string (key, IOT_DATA_COPY), iot_data_alloc_ui32 (i));
+      iot_data_vector_add (bench->items[0], i, iot_data_alloc_string (key, IOT_DATA_COPY));
+    }
+  }
+  bench->ops = bench->size;
+}
+
+static void bench_string_map_lookup (bench_t * bench)
+{
+  uint32_t found = 0u;
+  for (uint32_t i = 0; i < bench->size; i++)
+  {
+    if (iot_data_map_get (bench->data, iot_data_vector_get (bench->items[0], i))) found++;
+  }
+  bench_sink = found;
+}
+
+static void bench_list_setup (bench_t * bench)
+{
+  bench->ops = 2u * BENCH_LIST_SIZE;
+  if (bench->data == NULL) bench->data = iot_data_alloc_list ();
+}
+
+static void bench_list_push_pop (bench_t * bench)
+{
+  for (uint32_t i = 0; i < BENCH_LIST_SIZE; i++) iot_data_list_tail_push (bench->data, iot_data_alloc_ui32 (i));
+  for (uint32_t i = 0; i < BENCH_LIST_SIZE; i++) iot_data_free (iot_data_list_head_pop (bench->data));
+}
+
+static void bench_json_setup (bench_t * bench)
+{
+  bench->ops = BENCH_REPEAT;
+  if (bench->json == NULL)
+  {
+    bench->json = iot_data_to_json (bench_sample);
+    bench->data = iot_data_alloc_map (IOT_DATA_STRING);
+  }
+  bench->bytes = BENCH_REPEAT * strlen (bench->json);
+}
+
+static void bench_to_json (bench_t * bench)
+{
+  for (uint32_t i = 0; i < BENCH_REPEAT; i++) free (iot_data_to_json (bench_sample));
+}
+
+static void bench_from_json (bench_t * bench)
+{
+  for (uint32_t i = 0; i < BENCH_REPEAT; i++) bench->items[i] = iot_data_from_json_with_cache (bench->json, false, bench->data);
+}
+
+#ifdef IOT_HAS_CBOR
+static void bench_cbor_setup (bench_t * bench)
+{
+  bench->ops = BENCH_REPEAT;
+}
+
+static void bench_to_cbor (bench_t * bench)
+{
+  uint64_t bytes = 0u;
+  for (uint32_t i = 0; i < BENCH_REPEAT; i++)
+  {
+    iot_data_t * cbor = iot_data_to_cbor (bench_sample);
+    bytes += iot_data_array_size (cbor);
+    iot_data_free (cbor);
+  }
+  bench->bytes = bytes;
+}
+#endif
+
+static void bench_copy_setup (bench_t * bench)
+{
+  bench->ops = BENCH_REPEAT;
+}
+
+static void bench_copy (bench_t * bench)
+{
+  for (uint32_t i = 0; i < BENCH_REPEAT; i++) bench->items[i] = iot_data_copy (bench_sample);
+}
+
+// Hashes are maintained as data is built, so hash copies of a list of the sample values from which an
+// element has been removed, forcing the list hash to be recomputed
+
+static void bench_hash_setup (bench_t * bench)
+{
+  bench->ops = BENCH_REPEAT;
+  if (bench->data == NULL)
+  {
+    iot_data_map_iter_t iter;
+    bench->data = iot_data_alloc_list ();
+    iot_data_map_iter (bench_sample, &iter);
+    while (iot_data_map_iter_next (&iter)) iot_data_list_tail_push (bench->data, iot_data_add_ref (iot_data_map_iter_value (&iter)));
+  }
+  for (uint32_t i = 0; i < BENCH_REPEAT; i++)
+  {
+    bench->items[i] = iot_data_copy (bench->data);
+    iot_data_free (iot_data_list_head_pop (bench->items[i]));
+  }
+}
+
+static void bench_hash (bench_t * bench)
+{
+  uint32_t hash = 0u;
+  for (uint32_t i = 0; i < BENCH_REPEAT; i++) hash ^= iot_data_hash (bench->items[i]);
+  bench_sink = hash;
+}
+
+static void * bench_pool_job (void * arg)
+{
+  bench_sink = (uint32_t) (uintptr_t) arg;
+  return NULL;
+}
+
+static void bench_pool_setup (bench_t * bench)
+{
+  bench->ops = BENCH_POOL_JOBS;
+  if (bench_pool == NULL)
+  {
+    bench_pool = iot_threadpool_alloc (2u, BENCH_POOL_JOBS, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+    iot_threadpool_start (bench_pool);
+  }
+}
+
+static void bench_pool_add_work (bench_t * bench)
+{
+  (void) bench;
+  for (uint32_t i = 0; i < BENCH_POOL_JOBS; i++) iot_threadpool_add_work (bench_pool, bench_pool_job, (void*) (uintptr_t) i, IOT_THREAD_NO_PRIORITY);
+  iot_threadpool_wait (bench_pool);
+}
+
+static int bench_cmp (const void * a, const void * b)
+{
+  double d1 = *(const double*) a;
+  double d2 = *(const double*) b;
+  return (d1 < d2) ? -1 : (d1 > d2) ? 1 : 0;
+}
+
+static double bench_percentile (const double * sorted, uint32_t count, double pc)
+{
+  uint32_t idx = (uint32_t) (pc * (count - 1u) / 100.0 + 0.5);
+  return sorted[idx];
+}
+
+static void bench_exec (bench_t * bench, bool json, bool counters)
+{
+  double * lat = malloc (BENCH_MAX_SAMPLES * sizeof (*lat));
+  uint64_t counts[BENCH_COUNTERS] = { 0u };
+  uint64_t total = 0u;
+  uint64_t ops = 0u;
+  uint64_t bytes = 0u;
+  uint32_t samples = 0u;
+
+  while (samples < BENCH_MAX_SAMPLES && (samples < BENCH_MIN_SAMPLES || total < BENCH_MIN_NSECS))
+  {
+    if (bench->setup) (bench->setup) (bench);
+    if (counters) bench_counters_start ();
+    uint64_t start = iot_time_nsecs ();
+    (bench->run) (bench);
+    uint64_t elapsed = iot_time_nsecs () - start;
+    if (counters) bench_counters_stop (counts);
+    if (bench->teardown) (bench->teardown) (bench);
+    total += elapsed;
+    ops += bench->ops;
+    bytes += bench->bytes;
+    lat[samples++] = (double) elapsed / (double) bench->ops;
+  }
+  qsort (lat, samples, sizeof (*lat), bench_cmp);
+  double secs = (double) total / 1e9;
+  if (json)
+  {
+    printf ("{\"name\":\"%s\",\"samples\":%" PRIu32 ",\"ops\":%" PRIu64 ",\"ops_per_sec\":%.1f,\"bytes_per_sec\":%.1f,"
+      "\"p50_ns\":%.1f,\"p90_ns\":%.1f,\"p99_ns\":%.1f,\"max_ns\":%.1f", bench->name, samples, ops, ops / secs, bytes / secs,
+      bench_percentile (lat, samples, 50.0), bench_percentile (lat, samples, 90.0), bench_percentile (lat, samples, 99.0), lat[samples - 1u]);
+    for (uint32_t i = 0; counters && i < BENCH_COUNTERS; i++) printf (",\"%s_per_op\":%.2f", bench_counter_names[i], (double) counts[i] / ops);
+    printf ("}\n");
+  }
+  else
+  {
+    printf ("%-24s %14.0f %12.2f %10.1f %10.1f %10.1f %10.1f", bench->name, ops / secs, bytes / secs / 1e6,
+      bench_percentile (lat, samples, 50.0), bench_percentile (lat, samples, 90.0), bench_percentile (lat, samples, 99.0), lat[samples - 1u]);
+    for (uint32_t i = 0; counters && i < BENCH_COUNTERS; i++) printf (" %10.2f", (double) counts[i] / ops);
+    printf ("\n");
+  }
+  fflush (stdout);
+  free (lat);
+}
+
+int main (int argc, char ** argv)
+{
+  static const uint32_t map_sizes[BENCH_MAP_SIZES] = { 16u, 1024u, 65536u };
+  bench_t benches[2u * BENCH_MAP_SIZES + 10u];
+  char names[2u * BENCH_MAP_SIZES][32];
+  uint32_t count = 0u;
+  bool json = false;
+  bool counters = false;
+  const char * filter = NULL;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp (argv[i], "-j") == 0) json = true;
+    else if (strcmp (argv[i], "-p") == 0) counters = true;
+    else if (filter == NULL && argv[i][0] != '-') filter = argv[i];
+    else
+    {
+      fprintf (stderr, "Usage: %s [-j] [-p] [<name filter>]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  memset (benches, 0, sizeof (benches));
+  for (uint32_t i = 0; i < BENCH_MAP_SIZES; i++)
+  {
+    snprintf (names[2u * i], sizeof (names[0]), "map_insert_%" PRIu32, map_sizes[i]);
+    snprintf (names[2u * i + 1u], sizeof (names[0]), "map_lookup_%" PRIu32, map_sizes[i]);
+    benches[count++] = (bench_t) { .name = names[2u * i], .setup = bench_map_data, .run = bench_map_insert, .teardown = bench_free_result, .size = map_sizes[i] };
+    benches[count++] = (bench_t) { .name = names[2u * i + 1u], .setup = bench_map_data, .run = bench_map_lookup, .size = map_sizes[i] };
+  }
+  benches[count++] = (bench_t) { .name = "map_iterate_65536", .setup = bench_map_data, .run = bench_map_iterate, .size = 65536u };
+  benches[count++] = (bench_t) { .name = "map_string_lookup_1024", .setup = bench_string_map_data, .run = bench_string_map_lookup, .size = 1024u };
+  benches[count++] = (bench_t) { .name = "list_push_pop", .setup = bench_list_setup, .run = bench_list_push_pop };
+  benches[count++] = (bench_t) { .name = "to_json", .setup = bench_json_setup, .run = bench_to_json };
+  benches[count++] = (bench_t) { .name = "from_json_with_cache", .setup = bench_json_setup, .run = bench_from_json, .teardown = bench_free_items };
+#ifdef IOT_HAS_CBOR
+  benches[count++] = (bench_t) { .name = "to_cbor", .setup = bench_cbor_setup, .run = bench_to_cbor };
+#endif
+  benches[count++] = (bench_t) { .name = "copy", .setup = bench_copy_setup, .run = bench_copy, .teardown = bench_free_items };
+  benches[count++] = (bench_t) { .name = "hash", .setup = bench_hash_setup, .run = bench_hash, .teardown = bench_free_items };
+  benches[count++] = (bench_t) { .name = "threadpool_add_work", .setup = bench_pool_setup, .run = bench_pool_add_work };
+
+  if (counters) counters = bench_counters_open ();
+  bench_sample = bench_sample_alloc ();
+  if (! json)
+  {
+    printf ("%-24s %14s %12s %10s %10s %10s %10s", "benchmark", "ops/s", "MB/s", "p50 ns", "p90 ns", "p99 ns", "max ns");
+    if (counters) printf (" %10s %10s %10s %10s", "cycles/op", "instr/op", "cmiss/op", "bmiss/op");
+    printf ("\n");
+  }
+  for (uint32_t i = 0; i < count; i++)
+  {
+    bench_t * bench = &benches[i];
+    if (filter && strstr (bench->name, filter) == NULL) continue;
+    bench_exec (bench, json, counters);
+    bench_free_items (bench);
+    iot_data_free (bench->data);
+    free (bench->json);
+  }
+  if (bench_pool)
+  {
+    iot_threadpool_stop (bench_pool);
+    iot_threadpool_free (bench_pool);
+  }
+  if (counters) bench_counters_close ();
+  iot_data_free (bench_sample);
+  return 0;
+}
@@ -27,13 +27,14 @@ int main (int argc, char ** argv)
   uint32_t dup_maps = 0u;
   uint32_t dup_vectors = 0u;
   uint32_t dup_ints = 0u;
+  size_t total = 0u;
+  size_t compressed = 0u;
 
   if (argc == 1)
   {
     printf ("Usage: %s <json_file(s)>\n", argv[0]);
     exit (1);
   }
-  iot_data_alloc_heap (true);
   iot_data_t *cache = iot_data_alloc_typed_map (IOT_DATA_MULTI, IOT_DATA_MULTI);
   for (count = 1; count < argc; count++)
   {
@@ -41,8 +42,13 @@ int main (int argc, char ** argv)
     json = iot_store_read (argv[count]);
     map = iot_data_from_json (json);
     free (json);
+    size_t size = iot_data_memory_size (map);
     iot_data_compress_with_cache (map, cache);
     cache_purge (&cache);
+    size_t csize = iot_data_memory_size (map);
+    printf ("Memory: %zu bytes, compressed %zu bytes\n", size, csize);
+    total += size;
+    compressed += csize;
 //    iot_data_free (map);
   }
 
@@ -73,6 +79,8 @@ int main (int argc, char ** argv)
   printf ("Cached Maps: # %" PRIu32 "\n", dup_maps);
   printf ("Cached Ints: # %" PRIu32 "\n", dup_ints);
   printf ("Cached Vectors: # %" PRIu32 "\n", dup_vectors);
+  printf ("Block size: %" PRIu32 " bytes\n", iot_data_block_size ());
+  printf ("Total memory: %zu bytes, compressed %zu bytes (%.1f%% reduction)\n", total, compressed, total ? 100.0 * (double) (total - compressed) / (double) total : 0.0);
 
   //iot_data_free (cache);
   /*
@@ -1,13 +1,89 @@
 #include "iot/hash.h"
+#include "iot/time.h"
+#include <math.h>
+
+#define BENCH_BYTES (256u * 1024u * 1024u)
+#define DIST_KEYS 65536u
+#define DIST_BUCKETS 65536u
+
+typedef uint32_t (*hash_fn) (const uint8_t * data, size_t len);
+
+static volatile uint32_t sink;
+
+static void throughput (const char * name, hash_fn fn)
+{
+  static const size_t sizes[] = { 4u, 8u, 16u, 32u, 64u, 256u, 4096u };
+  uint8_t * buff = malloc (4096u);
+  for (uint32_t i = 0; i < 4096u; i++) buff[i] = (uint8_t) (i * 31u);
+  printf ("%-8s", name);
+  for (uint32_t s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s++)
+  {
+    size_t count = BENCH_BYTES / sizes[s];
+    uint32_t hash = 0u;
+    uint64_t start = iot_time_nsecs ();
+    for (size_t i = 0; i < count; i++)
+    {
+      buff[0] = (uint8_t) i;
+      hash ^= (fn) (buff, sizes[s]);
+    }
+    uint64_t elapsed = iot_time_nsecs () - start;
+    sink = hash;
+    printf (" %6zuB: %8.1f MB/s", sizes[s], (double) BENCH_BYTES * 1000.0 / (double) (elapsed ? elapsed : 1u));
+  }
+  printf ("\n");
+  free (buff);
+}
+
+static void distribution (const char * name, hash_fn fn, const char * format)
+{
+  uint32_t * buckets = calloc (DIST_BUCKETS, sizeof (uint32_t));
+  uint32_t used = 0u;
+  uint32_t max = 0u;
+  char key[64];
+  for (uint32_t i = 0; i < DIST_KEYS; i++)
+  {
+    int len = snprintf (key, sizeof (key), format, i);
+    uint32_t * bucket = &buckets[(fn) ((const uint8_t*) key, (size_t) len) & (DIST_BUCKETS - 1u)];
+    if ((*bucket)++ == 0u) used++;
+    if (*bucket > max) max = *bucket;
+  }
+  // For a uniform hash, expected used buckets is B * (1 - (1 - 1/B)^N)
+  double expected = DIST_BUCKETS * (1.0 - pow (1.0 - 1.0 / DIST_BUCKETS, DIST_KEYS));
+  printf ("%-8s %-24s buckets used %5u (uniform %5.0f), collisions %5u, max load %u\n", name, format, used, expected, DIST_KEYS - used, max);
+  free (buckets);
+}
+
+static uint32_t hash_wy (const uint8_t * data, size_t len)
+{
+  return iot_hash_data (data, len);
+}
+
+static uint32_t hash_djb2 (const uint8_t * data, size_t len)
+{
+  return iot_hash_djb2 (data, len);
+}
 
 int main (int argc, char ** argv)
 {
-  if (argc != 2)
+  static const char * formats[] = { "%u", "key%u", "device/sensor-%08u/value", "Temperature_%u" };
+  if (argc == 2)
+  {
+    printf ("%u\n", iot_hash (argv[1]));
+    return 0;
+  }
+  if (argc != 1)
   {
-    fprintf (stderr, "Usage: %s <string>\n", argv[0]);
+    fprintf (stderr, "Usage: %s [<string>]\n", argv[0]);
     return 1;
   }
-  uint32_t hash = iot_hash (argv[1]);
-  printf ("%u\n", hash);
+  printf ("Throughput\n");
+  throughput ("wyhash", hash_wy);
+  throughput ("djb2", hash_djb2);
+  printf ("\nDistribution of %u keys over %u buckets (low bits of hash)\n", DIST_KEYS, DIST_BUCKETS);
+  for (uint32_t f = 0; f < sizeof (formats) / sizeof (formats[0]); f++)
+  {
+    distribution ("wyhash", hash_wy, formats[f]);
+    distribution ("djb2", hash_djb2, formats[f]);
+  }
   return 0;
 }
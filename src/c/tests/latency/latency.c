@@ -0,0 +1,274 @@
+#include "iot/iot.h"
+
+// Thread pool dispatch latency and scheduler jitter measurements. Latencies are recorded in log linear
+// histograms (four buckets per power of two), percentiles are reported as bucket midpoints. Reports a
+// table, or one JSON object per configuration with -j, including non empty histogram buckets.
+//
+// Thread pool: submit to start latency of iot_threadpool_add_work jobs, submitted in bursts with the
+// pool drained between bursts, for standard and work stealing pools, thread counts and job priorities.
+//
+// Scheduler: fire time error of repeating synchronous schedules, as the difference between the interval
+// between runs and the schedule period, for standard and timer wheel schedulers. Schedule starts are
+// spread over one period. Drift is the mean lateness per run against the nominal start + n * period.
+
+#define LAT_SUB_BITS 2u
+#define LAT_BUCKETS (64u << LAT_SUB_BITS)
+#define LAT_POOL_JOBS 20000u
+#define LAT_POOL_BURST_JOBS 5000u
+#define LAT_SCHED_MIN_NSECS IOT_MS_TO_NS (250u)
+#define LAT_SCHED_MIN_RUNS 10u
+#define LAT_WHEEL_RESOLUTION IOT_US_TO_NS (100u)
+
+typedef struct lat_hist_t
+{
+  _Atomic uint64_t buckets[LAT_BUCKETS];
+  _Atomic uint64_t count;
+  _Atomic uint64_t max;
+} lat_hist_t;
+
+typedef struct lat_job_t
+{
+  uint64_t submit;            // Submit time
+  lat_hist_t * hist;          // Histogram for job priority
+} lat_job_t;
+
+typedef struct lat_sched_t
+{
+  uint64_t nominal;           // Nominal first start time
+  uint64_t last;              // Time of last run, zero if not yet run
+  uint64_t runs;              // Number of runs
+  uint64_t period;            // Schedule period
+  int64_t lateness;           // Lateness of last run against nominal start + runs * period
+  lat_hist_t * hist;          // Interval error histogram
+} lat_sched_t;
+
+static bool lat_json = false;
+
+static uint32_t lat_bucket (uint64_t v)
+{
+  if (v < (1u << LAT_SUB_BITS)) return (uint32_t) v;
+  uint32_t msb = 63u - (uint32_t) __builtin_clzll (v);
+  uint32_t sub = (uint32_t) (v >> (msb - LAT_SUB_BITS)) & ((1u << LAT_SUB_BITS) - 1u);
+  return ((msb - LAT_SUB_BITS + 1u) << LAT_SUB_BITS) + sub;
+}
+
+static uint64_t lat_bucket_low (uint32_t b)
+{
+  if (b < (1u << LAT_SUB_BITS)) return b;
+  uint32_t msb = (b >> LAT_SUB_BITS) + LAT_SUB_BITS - 1u;
+  return (1ull << msb) | ((uint64_t) (b & ((1u << LAT_SUB_BITS) - 1u)) << (msb - LAT_SUB_BITS));
+}
+
+static uint64_t lat_bucket_mid (uint32_t b)
+{
+  uint64_t low = lat_bucket_low (b);
+  return (b < (1u << LAT_SUB_BITS)) ? low : low + ((lat_bucket_low (b + 1u) - low) / 2u);
+}
+
+static void lat_hist_record (lat_hist_t * hist, uint64_t v)
+{
+  uint64_t max = atomic_load (&hist->max);
+  atomic_fetch_add (&hist->buckets[lat_bucket (v)], 1u);
+  atomic_fetch_add (&hist->count, 1u);
+  while (v > max && ! atomic_compare_exchange_weak (&hist->max, &max, v));
+}
+
+static uint64_t lat_hist_percentile (lat_hist_t * hist, double pc)
+{
+  uint64_t count = atomic_load (&hist->count);
+  uint64_t target = (uint64_t) (pc * (double) count / 100.0 + 0.5);
+  uint64_t max = atomic_load (&hist->max);
+  uint64_t total = 0u;
+  if (target == 0u) target = 1u;
+  for (uint32_t b = 0; b < LAT_BUCKETS; b++)
+  {
+    total += atomic_load (&hist->buckets[b]);
+    if (total >= target) return (lat_bucket_mid (b) < max) ? lat_bucket_mid (b) : max;
+  }
+  return max;
+}
+
+static void lat_report (const char * config, lat_hist_t * hist, const char * const * names, const double * values, uint32_t extras)
+{
+  uint64_t count = atomic_load (&hist->count);
+  if (lat_json)
+  {
+    printf ("{\"config\":\"%s\",\"count\":%" PRIu64 ",\"p50_ns\":%" PRIu64 ",\"p90_ns\":%" PRIu64 ",\"p99_ns\":%" PRIu64 ",\"p999_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64,
+      config, count, lat_hist_percentile (hist, 50.0), lat_hist_percentile (hist, 90.0), lat_hist_percentile (hist, 99.0), lat_hist_percentile (hist, 99.9), atomic_load (&hist->max));
+    for (uint32_t i = 0; i < extras; i++) printf (",\"%s\":%.1f", names[i], values[i]);
+    printf (",\"histogram\":[");
+    const char * sep = "";
+    for (uint32_t b = 0; b < LAT_BUCKETS; b++)
+    {
+      uint64_t n = atomic_load (&hist->buckets[b]);
+      if (n)
+      {
+        printf ("%s[%" PRIu64 ",%" PRIu64 "]", sep, lat_bucket_low (b), n);
+        sep = ",";
+      }
+    }
+    printf ("]}\n");
+  }
+  else
+  {
+    printf ("%-48s %9" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %11" PRIu64, config, count, lat_hist_percentile (hist, 50.0),
+      lat_hist_percentile (hist, 90.0), lat_hist_percentile (hist, 99.0), lat_hist_percentile (hist, 99.9), atomic_load (&hist->max));
+    for (uint32_t i = 0; i < extras; i++) printf ("  %s %.1f", names[i], values[i]);
+    printf ("\n");
+  }
+  fflush (stdout);
+}
+
+static void lat_header (void)
+{
+  if (! lat_json) printf ("%-48s %9s %10s %10s %10s %10s %11s\n", "configuration", "count", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns");
+}
+
+static void * lat_job_fn (void * arg)
+{
+  lat_job_t * job = arg;
+  lat_hist_record (job->hist, iot_time_nsecs () - job->submit);
+  return NULL;
+}
+
+static void lat_pool (bool stealing, uint16_t threads, bool mixed, uint32_t burst)
+{
+  static const int prios[2] = { 10, 20 };
+  lat_hist_t * hists = calloc (2, sizeof (*hists));
+  uint32_t jobs = (burst == 1u) ? LAT_POOL_BURST_JOBS : LAT_POOL_JOBS;
+  lat_job_t * work = calloc (jobs, sizeof (*work));
+  iot_threadpool_t * pool = stealing ? iot_threadpool_alloc_stealing (threads, burst, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL) :
+    iot_threadpool_alloc (threads, burst, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  char config[64];
+
+  iot_threadpool_start (pool);
+  for (uint32_t i = 0; i < jobs; i += burst)
+  {
+    for (uint32_t j = i; j < jobs && j < (i + burst); j++)
+    {
+      int prio = mixed ? prios[j % 2u] : IOT_THREAD_NO_PRIORITY;
+      work[j].hist = &hists[mixed ? (j % 2u) : 0u];
+      work[j].submit = iot_time_nsecs ();
+      iot_threadpool_add_work (pool, lat_job_fn, &work[j], prio);
+    }
+    iot_threadpool_wait (pool);
+  }
+  iot_threadpool_stop (pool);
+  iot_threadpool_free (pool);
+
+  for (uint32_t i = 0; i < (mixed ? 2u : 1u); i++)
+  {
+    snprintf (config, sizeof (config), "pool %s threads=%" PRIu16 " prio=%s burst=%" PRIu32, stealing ? "stealing" : "standard", threads, mixed ? (i ? "high" : "low") : "none", burst);
+    lat_report (config, &hists[i], NULL, NULL, 0u);
+  }
+  free (work);
+  free (hists);
+}
+
+static void * lat_sched_fn (void * arg)
+{
+  lat_sched_t * sched = arg;
+  uint64_t now = iot_time_nsecs ();
+  if (sched->last)
+  {
+    uint64_t interval = now - sched->last;
+    lat_hist_record (sched->hist, (interval > sched->period) ? (interval - sched->period) : (sched->period - interval));
+  }
+  sched->last = now;
+  sched->lateness = (int64_t) (now - (sched->nominal + sched->runs * sched->period));
+  sched->runs++;
+  return NULL;
+}
+
+static void lat_scheduler (bool wheel, uint64_t period, uint32_t count)
+{
+  lat_hist_t * hist = calloc (1, sizeof (*hist));
+  lat_sched_t * scheds = calloc (count, sizeof (*scheds));
+  iot_schedule_t ** schedules = calloc (count, sizeof (*schedules));
+  uint64_t duration = period * LAT_SCHED_MIN_RUNS;
+  iot_scheduler_t * scheduler = wheel ? iot_scheduler_alloc_wheel (IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, LAT_WHEEL_RESOLUTION, NULL) :
+    iot_scheduler_alloc (IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  static const char * const names[] = { "runs", "expected_runs", "drift_ns" };
+  double values[3] = { 0.0 };
+  uint64_t ran = 0u;
+  char config[64];
+
+  if (duration < LAT_SCHED_MIN_NSECS) duration = LAT_SCHED_MIN_NSECS;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    uint64_t delay = period + (period * i) / count;
+    scheds[i].period = period;
+    scheds[i].hist = hist;
+    scheds[i].nominal = iot_time_nsecs () + delay;
+    schedules[i] = iot_schedule_create (scheduler, lat_sched_fn, NULL, &scheds[i], period, delay, 0, NULL, IOT_THREAD_NO_PRIORITY);
+    iot_schedule_set_sync (schedules[i], true);
+    iot_schedule_add (scheduler, schedules[i]);
+  }
+  iot_scheduler_start (scheduler);
+  iot_wait_usecs (duration / 1000u);
+  iot_scheduler_stop (scheduler);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    values[0] += (double) scheds[i].runs;
+    if (scheds[i].runs)
+    {
+      values[2] += (double) scheds[i].lateness / (double) scheds[i].runs;
+      ran++;
+    }
+  }
+  values[1] = (double) count * (double) (duration - period) / (double) period;
+  if (ran) values[2] /= (double) ran;
+  iot_scheduler_free (scheduler);
+
+  snprintf (config, sizeof (config), "scheduler %s period=%" PRIu64 "ms schedules=%" PRIu32, wheel ? "wheel" : "standard", (uint64_t) (period / IOT_MILLION), count);
+  lat_report (config, hist, names, values, 3u);
+  free (schedules);
+  free (scheds);
+  free (hist);
+}
+
+int main (int argc, char ** argv)
+{
+  static const uint16_t threads[] = { 1u, 2u, 4u, 8u };
+  static const uint32_t bursts[] = { 1u, 64u };
+  static const uint64_t periods[] = { IOT_MS_TO_NS (1u), IOT_MS_TO_NS (10u), IOT_MS_TO_NS (100u) };
+  static const uint32_t counts[] = { 1u, 100u, 10000u, 100000u };
+  bool pool = true;
+  bool sched = true;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp (argv[i], "-j") == 0) lat_json = true;
+    else if (strcmp (argv[i], "pool") == 0) sched = false;
+    else if (strcmp (argv[i], "scheduler") == 0) pool = false;
+    else
+    {
+      fprintf (stderr, "Usage: %s [-j] [pool|scheduler]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  lat_header ();
+  for (uint32_t s = 0; pool && s < 2u; s++)
+  {
+    for (uint32_t t = 0; t < sizeof (threads) / sizeof (threads[0]); t++)
+    {
+      for (uint32_t b = 0; b < sizeof (bursts) / sizeof (bursts[0]); b++)
+      {
+        lat_pool (s == 1u, threads[t], false, bursts[b]);
+        lat_pool (s == 1u, threads[t], true, bursts[b]);
+      }
+    }
+  }
+  for (uint32_t w = 0; sched && w < 2u; w++)
+  {
+    for (uint32_t p = 0; p < sizeof (periods) / sizeof (periods[0]); p++)
+    {
+      for (uint32_t c = 0; c < sizeof (counts) / sizeof (counts[0]); c++)
+      {
+        lat_scheduler (w == 1u, periods[p], counts[c]);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,22 @@
+#include "iot/iot.h"
+
+// Render binary log files, written by iot_logger_alloc_file_binary loggers, as text on stdout
+
+int main (int argc, char ** argv)
+{
+  int ret = 0;
+  if (argc < 2)
+  {
+    fprintf (stderr, "Usage: %s <binary log file> ...\n", argv[0]);
+    return 1;
+  }
+  for (int i = 1; i < argc; i++)
+  {
+    if (! iot_logger_decode_binary (argv[i], stdout))
+    {
+      fprintf (stderr, "%s: failed to decode %s\n", argv[0], argv[i]);
+      ret = 1;
+    }
+  }
+  return ret;
+}
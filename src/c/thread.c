@@ -9,6 +9,14 @@
 #define geteuid() (0)
 #endif
 
+#ifdef IOT_HAS_PTHREAD_CONDATTR_SETCLOCK
+#define IOT_COND_CLOCK CLOCK_MONOTONIC
+#else
+#define IOT_COND_CLOCK CLOCK_REALTIME
+#endif
+
+static bool iot_mutex_prio_inherit = true;
+
 #ifdef __ZEPHYR__
 
 typedef struct zephyr_thread_wrap
@@ -160,16 +168,67 @@ bool iot_thread_current_set_priority (int priority)
 }
 
 void iot_mutex_init (pthread_mutex_t * mutex)
+{
+  iot_mutex_init_type (mutex, IOT_MUTEX_DEFAULT);
+}
+
+void iot_mutex_init_type (pthread_mutex_t * mutex, iot_mutex_type_t type)
 {
   assert (mutex);
   pthread_mutexattr_t attr;
   pthread_mutexattr_init (&attr);
+  if (type == IOT_MUTEX_ADAPTIVE)
+  {
+#ifdef IOT_HAS_PTHREAD_MUTEX_ADAPTIVE
+    pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_ADAPTIVE_NP); // Spinning is not supported for priority inheritance mutexes
+#endif
+  }
+  else
+  {
 #ifndef NDEBUG
-  pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_ERRORCHECK);
+    pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_ERRORCHECK);
 #endif
 #ifdef IOT_HAS_PTHREAD_MUTEXATTR_SETPROTOCOL
-  pthread_mutexattr_setprotocol (&attr, PTHREAD_PRIO_INHERIT); // Note: Supported on Alpine but broken
+    if (iot_mutex_prio_inherit) pthread_mutexattr_setprotocol (&attr, PTHREAD_PRIO_INHERIT); // Note: Supported on Alpine but broken
 #endif
+  }
   pthread_mutex_init (mutex, &attr);
   pthread_mutexattr_destroy (&attr);
 }
+
+void iot_mutex_set_priority_inherit (bool enable)
+{
+  iot_mutex_prio_inherit = enable;
+}
+
+void iot_cond_init (pthread_cond_t * cond)
+{
+  assert (cond);
+  pthread_condattr_t attr;
+  pthread_condattr_init (&attr);
+#ifdef IOT_HAS_PTHREAD_CONDATTR_SETCLOCK
+  pthread_condattr_setclock (&attr, IOT_COND_CLOCK);
+#endif
+  pthread_cond_init (cond, &attr);
+  pthread_condattr_destroy (&attr);
+}
+
+uint64_t iot_cond_deadline (uint64_t timeout_ns)
+{
+  struct timespec ts;
+  clock_gettime (IOT_COND_CLOCK, &ts);
+  uint64_t now = (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+  return (timeout_ns < (IOT_COND_NO_DEADLINE - now)) ? now + timeout_ns : IOT_COND_NO_DEADLINE;
+}
+
+bool iot_cond_timedwait (pthread_cond_t * cond, pthread_mutex_t * mutex, uint64_t deadline)
+{
+  assert (cond && mutex);
+  if (deadline == IOT_COND_NO_DEADLINE)
+  {
+    pthread_cond_wait (cond, mutex);
+    return true;
+  }
+  struct timespec ts = { .tv_sec = (time_t) (deadline / 1000000000u), .tv_nsec = (long) (deadline % 1000000000u) };
+  return pthread_cond_timedwait (cond, mutex, &ts) != ETIMEDOUT;
+}
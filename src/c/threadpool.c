@@ -8,6 +8,8 @@
 #include "iot/thread.h"
 #include "iot/data.h"
 #include "iot/time.h"
+#include "stats-impl.h"
+#include "trace-impl.h"
 
 #ifdef IOT_HAS_PRCTL
 #include <sys/prctl.h>
@@ -17,6 +19,13 @@
 #define IOT_TP_THREADS_DEFAULT 2
 #define IOT_TP_JOBS_DEFAULT 0
 #define IOT_TP_SHUTDOWN_MIN 200
+#define IOT_TP_IDLE_DEFAULT 5000
+#define IOT_TP_STRAND_BUCKETS 64u
+#define IOT_TP_STRAND_BATCH 8u
+#define IOT_TP_CPUS_MAX 1024u
+#define IOT_TP_NUMA_JOBS 32u
+#define IOT_TP_SLAB_MAX 4096u
+#define IOT_TP_SLAB_DEFAULT 64u
 
 #ifdef IOT_BUILD_COMPONENTS
 #define IOT_THREADPOOL_FACTORY iot_threadpool_factory ()
@@ -31,8 +40,61 @@ typedef struct iot_job_t
   void * arg;                        // Function's argument
   int priority;                      // Job priority
   uint32_t id;                       // Job id
+  uint64_t queued;                   // Time job queued
+  uint64_t deadline;                 // Absolute deadline, zero if none
 } iot_job_t;
 
+// Keyed jobs are queued per key on a strand. A strand is held in the pool strand table while it has jobs, during
+// which a single pool job runs them in order.
+
+typedef struct iot_strand_job_t
+{
+  struct iot_strand_job_t * next;    // Next job in strand
+  void * (*function) (void * arg);   // Function to run
+  void * arg;                        // Function's argument
+  int priority;                      // Job priority
+} iot_strand_job_t;
+
+typedef struct iot_strand_t
+{
+  struct iot_strand_t * next;        // Next strand in table bucket
+  struct iot_threadpool_t * pool;    // Thread pool
+  uint64_t key;                      // Strand key
+  iot_strand_job_t * front;          // First job in strand
+  iot_strand_job_t * rear;           // Last job in strand
+} iot_strand_t;
+
+#if defined (__ZEPHYR__) && (IOT_ZEPHYR_JOBS > 0)
+
+// Statically sized pool of jobs (and strand jobs), avoiding heap allocation latency and fragmentation. The heap is used if exhausted.
+
+#define IOT_TP_JOB_SIZE ((((sizeof (iot_job_t) > sizeof (iot_strand_job_t)) ? sizeof (iot_job_t) : sizeof (iot_strand_job_t)) + 7u) & ~7u)
+
+K_MEM_SLAB_DEFINE (iot_threadpool_job_slab, IOT_TP_JOB_SIZE, IOT_ZEPHYR_JOBS, 8);
+
+static void * iot_threadpool_job_new (size_t size)
+{
+  void * job;
+  return (k_mem_slab_alloc (&iot_threadpool_job_slab, &job, K_NO_WAIT) == 0) ? job : malloc (size);
+}
+
+static void iot_threadpool_job_delete (void * job)
+{
+  const uint8_t * start = (const uint8_t*) iot_threadpool_job_slab.buffer;
+  if ((const uint8_t*) job >= start && (const uint8_t*) job < start + (IOT_ZEPHYR_JOBS * IOT_TP_JOB_SIZE))
+  {
+    k_mem_slab_free (&iot_threadpool_job_slab, &job);
+  }
+  else
+  {
+    free (job);
+  }
+}
+#else
+#define iot_threadpool_job_new(s) malloc (s)
+#define iot_threadpool_job_delete(j) free (j)
+#endif
+
 typedef struct iot_thread_t
 {
   uint16_t id;                       // Thread number
@@ -40,6 +102,11 @@ typedef struct iot_thread_t
   struct iot_threadpool_t * pool;    // Thread pool
   bool pending_delete;               // Finalise thread pool deletion on thread exit
   bool deleted;                      // Mark thread as exited
+  bool active;                       // Whether a thread is running in this slot
+  pthread_mutex_t mutex;             // Local job queue mutex (work stealing)
+  iot_job_t * front;                 // Front of local job queue (work stealing)
+  iot_job_t * rear;                  // Rear of local job queue (work stealing)
+  iot_job_t * cache;                 // Local free job cache (work stealing)
 } iot_thread_t;
 
 typedef struct iot_threadpool_t
@@ -49,28 +116,98 @@ typedef struct iot_threadpool_t
   const uint32_t max_jobs;           // Maximum number of queued jobs
   const uint16_t id;                 // Thread pool id
   uint16_t working;                  // Number of threads currently working
-  uint16_t threads;                  // Number of threads allocated
+  uint16_t threads;                  // Number of threads allocated, maximum number of threads if elastic
+  uint16_t live;                     // Number of threads running
+  uint16_t min_threads;              // Minimum number of threads (elastic)
+  uint32_t idle_timeout;             // Time in milliseconds after which idle threads above minimum exit, 0 if not elastic
+  int default_prio;                  // Default thread priority
   _Atomic uint16_t created;          // Number of threads created
   uint32_t jobs;                     // Number of jobs in queue
-  uint32_t delay;                    // Shutdown delay in milliseconds
-  uint32_t next_id;                  // Job id counter
+  uint32_t delay;                    // Interval in milliseconds at which waits for thread exit on shutdown are logged
+  _Atomic uint32_t next_id;          // Job id counter
   iot_job_t * front;                 // Front of job queue
   iot_job_t * rear;                  // Rear of job queue
   iot_job_t * cache;                 // Free job cache
+  iot_job_t * slab;                  // Preallocated jobs, held in the job caches when free
+  uint32_t slab_size;                // Number of preallocated jobs
   int affinity;                      // Pool threads processor affinity
+  int * cpus;                        // Processors to which pool threads are pinned round robin, NULL if not set
+  uint32_t ncpus;                    // Number of processors in cpus
+  bool numa_local;                   // Thread local job caches allocated by pool threads (work stealing)
+  bool stealing;                     // Per thread job queues with work stealing
+  _Atomic uint32_t queued;           // Number of jobs queued or being queued (work stealing)
+  _Atomic uint16_t busy;             // Number of threads currently working (work stealing)
+  _Atomic uint16_t sleepers;         // Number of threads waiting for a job (work stealing)
+  _Atomic uint32_t blocked;          // Number of threads waiting in add_work or wait (work stealing)
+  _Atomic uint32_t next_thread;      // Round robin local queue selection (work stealing)
   pthread_cond_t work_cond;          // Work control condition
   pthread_cond_t job_cond;           // Job control condition
   pthread_cond_t queue_cond;         // Job queue control condition
+  pthread_cond_t exit_cond;          // Thread exit condition
   iot_logger_t * logger;             // Optional logger
+  _Atomic uint64_t high_water;       // Maximum number of queued jobs
+  _Atomic uint64_t run;              // Number of jobs run
+  _Atomic uint64_t missed;           // Number of jobs started after their deadline
+  _Atomic uint64_t dropped;          // Number of jobs dropped as started after their deadline
+  _Atomic bool drop_expired;         // Whether jobs past their deadline are dropped rather than run
+  iot_flow_t * _Atomic flow;         // Flow control updated with the number of queued jobs, NULL if none
+  iot_stats_hist_t wait_hist;        // Job queue to start time histogram
+  iot_stats_hist_t run_hist;         // Job run time histogram
+  pthread_mutex_t strand_mutex;      // Strand table mutex
+  iot_strand_t * strands[IOT_TP_STRAND_BUCKETS]; // Strand table, hashed by key
 } iot_threadpool_t;
 
+static _Thread_local iot_thread_t * iot_threadpool_current = NULL;
+
+static bool iot_threadpool_stealing_run (iot_thread_t * th, pthread_t tid, int * priority);
+static void iot_future_discard (const iot_job_t * job);
+
+static inline void iot_threadpool_flow (iot_threadpool_t * pool, uint32_t jobs)
+{
+  iot_flow_t * flow = atomic_load_explicit (&pool->flow, memory_order_acquire);
+  if (flow) iot_flow_update (flow, jobs);
+}
+
+static void iot_threadpool_run_job (iot_threadpool_t * pool, const iot_job_t * job)
+{
+  uint64_t start = iot_time_nsecs ();
+  if (job->deadline && (start > job->deadline))
+  {
+    if (atomic_load (&pool->drop_expired))
+    {
+      atomic_fetch_add_explicit (&pool->dropped, 1u, memory_order_relaxed);
+      return;
+    }
+    atomic_fetch_add_explicit (&pool->missed, 1u, memory_order_relaxed);
+  }
+  IOT_TRACE (IOT_TRACE_JOB_START, (uintptr_t) job->function);
+  (job->function) (job->arg); // Run job
+  IOT_TRACE (IOT_TRACE_JOB_END, (uintptr_t) job->function);
+  uint64_t end = iot_time_nsecs ();
+  iot_stats_hist_record (&pool->wait_hist, start - job->queued);
+  iot_stats_hist_record (&pool->run_hist, end - start);
+  atomic_fetch_add_explicit (&pool->run, 1u, memory_order_relaxed);
+}
+
 static void iot_threadpool_final_free (iot_threadpool_t * pool)
 {
+  if (pool->stealing)
+  {
+    for (uint16_t i = 0; i < pool->threads; i++)
+    {
+      pthread_mutex_destroy (&pool->thread_array[i].mutex);
+    }
+  }
   pthread_cond_destroy (&pool->work_cond);
   pthread_cond_destroy (&pool->queue_cond);
+  pthread_cond_destroy (&pool->exit_cond);
   pthread_cond_destroy (&pool->job_cond);
+  pthread_mutex_destroy (&pool->strand_mutex);
   iot_logger_free (pool->logger);
+  iot_flow_free (atomic_load (&pool->flow));
   free (pool->thread_array);
+  free (pool->cpus);
+  free (pool->slab);
   iot_component_fini (&pool->component);
   free (pool);
 }
@@ -92,10 +229,23 @@ static void * iot_threadpool_thread (void * arg)
 #endif
   iot_log_debug (pool->logger, "Thread %s #%" PRIu16 " starting", name, th->id);
 
+  iot_threadpool_current = th;
+  if (pool->stealing && pool->numa_local) // Allocate local job cache from this thread, so memory is node local on first touch
+  {
+    pthread_mutex_lock (&th->mutex);
+    for (uint32_t i = 0; i < IOT_TP_NUMA_JOBS; i++)
+    {
+      iot_job_t * job = iot_threadpool_job_new (sizeof (*job));
+      job->prev = th->cache;
+      th->cache = job;
+    }
+    pthread_mutex_unlock (&th->mutex);
+  }
   atomic_fetch_add (&pool->created, 1u);
-  while (true)
+  if (! pool->stealing) iot_component_lock (comp); // Lock held between jobs, only released to run a job or wait
+  while (! pool->stealing)
   {
-    state = iot_component_wait_and_lock (comp, (uint32_t) IOT_COMPONENT_DELETED | (uint32_t) IOT_COMPONENT_RUNNING);
+    state = iot_component_wait_locked (comp, (uint32_t) IOT_COMPONENT_DELETED | (uint32_t) IOT_COMPONENT_RUNNING);
 
     if (state == IOT_COMPONENT_DELETED) // Exit thread on deletion
     {
@@ -122,6 +272,7 @@ static void * iot_threadpool_thread (void * arg)
       {
         pthread_cond_broadcast (&pool->queue_cond); // Signal now space in job queue
       }
+      iot_threadpool_flow (pool, pool->jobs);
       pool->working++;
       iot_component_unlock (comp);
       if ((job.priority != IOT_THREAD_NO_PRIORITY) && (job.priority != priority)) // If required, set thread priority
@@ -131,7 +282,7 @@ static void * iot_threadpool_thread (void * arg)
           priority = job.priority;
         }
       }
-      (job.function) (job.arg); // Run job
+      iot_threadpool_run_job (pool, &job);
       iot_log_trace (pool->logger, "Thread %" PRIu16 " completed job %" PRIu32, th->id, job.id);
       iot_component_lock (comp);
       if (--pool->working == 0)
@@ -139,86 +290,272 @@ static void * iot_threadpool_thread (void * arg)
         pthread_cond_signal (&pool->work_cond); // Signal when no threads working
       }
     }
+    else if (pool->idle_timeout && (pool->live > pool->min_threads))
+    {
+      iot_log_trace (pool->logger, "Thread %" PRIu16 " waiting for new job", th->id);
+      if (! iot_cond_timedwait (&pool->job_cond, &comp->mutex, iot_cond_deadline ((uint64_t) pool->idle_timeout * 1000000u)) &&
+        (pool->front == NULL) && (pool->live > pool->min_threads) && (iot_component_get_state (comp) == IOT_COMPONENT_RUNNING)) // Exit thread when idle
+      {
+        pool->live--;
+        th->active = false;
+        th->deleted = true;
+        iot_component_unlock (comp);
+        iot_log_debug (pool->logger, "Thread %" PRIu16 " idle", th->id);
+        break;
+      }
+    }
     else
     {
       iot_log_trace (pool->logger, "Thread %" PRIu16 " waiting for new job", th->id);
       pthread_cond_wait (&pool->job_cond, &comp->mutex); // Wait for new job
     }
-    iot_component_unlock (comp);
   }
+  if (pool->stealing) pending_delete = iot_threadpool_stealing_run (th, tid, &priority);
   iot_log_debug (pool->logger, "Thread %" PRIu16 " exiting", th->id);
+  iot_component_lock (comp);
   atomic_fetch_sub (&pool->created, 1u);
+  pthread_cond_broadcast (&pool->exit_cond); // Signal thread exit to shutdown
+  iot_component_unlock (comp);
   if (pending_delete) iot_threadpool_final_free (pool);
   return NULL;
 }
 
-iot_threadpool_t * iot_threadpool_alloc (uint16_t threads, uint32_t max_jobs, int default_prio, int affinity, iot_logger_t * logger)
+iot_data_t * iot_threadpool_stats (iot_threadpool_t * pool)
+{
+  assert (pool);
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_component_lock (&pool->component);
+  uint32_t depth = pool->stealing ? atomic_load (&pool->queued) : pool->jobs;
+  uint16_t busy = pool->stealing ? atomic_load (&pool->busy) : pool->working;
+  uint16_t live = pool->live;
+  iot_component_unlock (&pool->component);
+  iot_data_string_map_add (map, "threads", iot_data_alloc_ui16 (live));
+  iot_data_string_map_add (map, "max_threads", iot_data_alloc_ui16 (pool->threads));
+  iot_data_string_map_add (map, "max_jobs", iot_data_alloc_ui32 ((pool->max_jobs == UINT32_MAX) ? 0u : pool->max_jobs));
+  iot_data_string_map_add (map, "busy", iot_data_alloc_ui16 (busy));
+  iot_data_string_map_add (map, "queue_depth", iot_data_alloc_ui32 (depth));
+  iot_data_string_map_add (map, "queue_high_water", iot_data_alloc_ui64 (atomic_load (&pool->high_water)));
+  iot_data_string_map_add (map, "jobs_run", iot_data_alloc_ui64 (atomic_load (&pool->run)));
+  iot_data_string_map_add (map, "deadline_missed", iot_data_alloc_ui64 (atomic_load (&pool->missed)));
+  iot_data_string_map_add (map, "deadline_dropped", iot_data_alloc_ui64 (atomic_load (&pool->dropped)));
+  iot_data_string_map_add (map, "wait", iot_stats_hist_data (&pool->wait_hist));
+  iot_data_string_map_add (map, "run", iot_stats_hist_data (&pool->run_hist));
+  return map;
+}
+
+// Parse a processor list, as "0-3,8,10-11". Returns NULL if not valid.
+
+static int * iot_threadpool_cpus (const char * str, uint32_t * count)
+{
+  int * cpus = NULL;
+  uint32_t n = 0u;
+  bool ok = (*str != '\0');
+  while (ok && *str)
+  {
+    char * end;
+    long first = strtol (str, &end, 10);
+    long last = first;
+    ok = (end != str) && (first >= 0);
+    if (ok && *end == '-')
+    {
+      str = end + 1;
+      last = strtol (str, &end, 10);
+      ok = (end != str) && (last >= first);
+    }
+    ok = ok && ((uint64_t) (last - first) < (uint64_t) (IOT_TP_CPUS_MAX - n)) && (*end == ',' || *end == '\0');
+    if (ok)
+    {
+      cpus = realloc (cpus, (n + (size_t) (last - first) + 1u) * sizeof (*cpus));
+      for (long cpu = first; cpu <= last; cpu++) cpus[n++] = (int) cpu;
+      str = (*end == ',') ? end + 1 : end;
+      ok = (*end == '\0') || (*str != '\0');
+    }
+  }
+  if (! ok)
+  {
+    free (cpus);
+    cpus = NULL;
+    n = 0u;
+  }
+  *count = n;
+  return cpus;
+}
+
+// Preallocate jobs in a single slab, sized from the maximum number of queued jobs, so that adding work only
+// allocates once more jobs are queued. In work stealing mode, the jobs are spread over the thread job caches.
+
+static void iot_threadpool_prealloc (iot_threadpool_t * pool)
+{
+  uint32_t count = (pool->max_jobs == UINT32_MAX) ? IOT_TP_SLAB_DEFAULT : ((pool->max_jobs < IOT_TP_SLAB_MAX) ? pool->max_jobs : IOT_TP_SLAB_MAX);
+  pool->slab = calloc (count, sizeof (*pool->slab));
+  pool->slab_size = count;
+  for (uint32_t i = count; i-- > 0;) // Lowest addresses at head of caches
+  {
+    iot_job_t ** cache = pool->stealing ? &pool->thread_array[i % pool->threads].cache : &pool->cache;
+    pool->slab[i].prev = *cache;
+    *cache = &pool->slab[i];
+  }
+}
+
+static inline void iot_threadpool_job_release (iot_threadpool_t * pool, iot_job_t * job)
+{
+  uintptr_t addr = (uintptr_t) job;
+  if (addr < (uintptr_t) pool->slab || addr >= (uintptr_t) (pool->slab + pool->slab_size)) iot_threadpool_job_delete (job);
+}
+
+static iot_threadpool_t * iot_threadpool_create (uint16_t threads, uint32_t max_jobs, int default_prio, int affinity, const char * cpus, bool numa_local, iot_logger_t * logger, bool stealing)
 {
   static _Atomic uint16_t pool_id = ATOMIC_VAR_INIT (0);
 
-  uint16_t created;
   iot_threadpool_t * pool = (iot_threadpool_t*) calloc (1, sizeof (*pool));
   pool->affinity = affinity;
   pool->logger = logger;
   *((uint16_t*) &pool->id) = (uint16_t) atomic_fetch_add (&pool_id, 1u);
   iot_logger_add_ref (logger);
-  iot_log_info (logger, "iot_threadpool_alloc (threads: %" PRIu16 " max_jobs: %u default_priority: %d affinity: %d)", threads, max_jobs, default_prio, affinity);
+  iot_log_info (logger, "iot_threadpool_alloc (threads: %" PRIu16 " max_jobs: %u default_priority: %d affinity: %d cpus: %s stealing: %s)", threads, max_jobs, default_prio, affinity, cpus ? cpus : "", stealing ? "true" : "false");
+  if (cpus && (pool->cpus = iot_threadpool_cpus (cpus, &pool->ncpus)) == NULL)
+  {
+    iot_log_warn (logger, "iot_threadpool_alloc invalid processor list: %s", cpus);
+  }
+  pool->numa_local = numa_local;
   pool->thread_array = (iot_thread_t*) calloc (threads, sizeof (iot_thread_t));
+  pool->stealing = stealing;
+  if (stealing)
+  {
+    for (uint16_t i = 0; i < threads; i++)
+    {
+      iot_mutex_init (&pool->thread_array[i].mutex);
+    }
+  }
   *((uint32_t*) &pool->max_jobs) = max_jobs ? max_jobs : UINT32_MAX;
   pool->delay = IOT_TP_SHUTDOWN_MIN;
   atomic_store (&pool->created, 0u);
-  pthread_cond_init (&pool->work_cond, NULL);
+  iot_cond_init (&pool->work_cond);
   pthread_cond_init (&pool->queue_cond, NULL);
-  pthread_cond_init (&pool->job_cond, NULL);
+  iot_cond_init (&pool->job_cond);
+  iot_cond_init (&pool->exit_cond);
+  iot_mutex_init (&pool->strand_mutex);
   iot_component_init (&pool->component, IOT_THREADPOOL_FACTORY, (iot_component_start_fn_t) iot_threadpool_start, (iot_component_stop_fn_t) iot_threadpool_stop);
+  iot_component_set_stats_callback (&pool->component, (iot_component_stats_fn_t) iot_threadpool_stats);
   pool->threads = threads;
-  for (created = 0; created < threads; created++)
+  pool->default_prio = default_prio;
+  if (! (stealing && numa_local)) iot_threadpool_prealloc (pool); // Else local job caches allocated by pool threads
+  for (uint16_t i = 0; i < threads; i++)
   {
-    iot_thread_t * th = &pool->thread_array[created];
-    th->pool = pool;
-    th->id = created;
-    if (! iot_thread_create (&th->tid, iot_threadpool_thread, th, default_prio, affinity, logger))
-    {
-      break;
-    }
+    pool->thread_array[i].pool = pool;
+    pool->thread_array[i].id = i;
+  }
+  return pool;
+}
+
+static bool iot_threadpool_spawn (iot_threadpool_t * pool, iot_thread_t * th)
+{
+  int cpu = pool->cpus ? pool->cpus[th->id % pool->ncpus] : pool->affinity;
+  th->deleted = false;
+  th->pending_delete = false;
+  th->active = iot_thread_create (&th->tid, iot_threadpool_thread, th, pool->default_prio, cpu, pool->logger);
+  if (th->active) pool->live++;
+  return th->active;
+}
+
+// Create threads for queued jobs not taken by threads already running, up to the maximum. Called with pool locked.
+
+static void iot_threadpool_grow (iot_threadpool_t * pool)
+{
+  for (uint16_t i = 0; (i < pool->threads) && (pool->live < pool->threads) && (pool->jobs > (uint32_t) (pool->live - pool->working)); i++)
+  {
+    iot_thread_t * th = &pool->thread_array[i];
+    if (! th->active && ! iot_threadpool_spawn (pool, th)) break;
   }
-  while (atomic_load (&pool->created) != created)
+}
+
+static iot_threadpool_t * iot_threadpool_run_threads (iot_threadpool_t * pool, uint16_t count)
+{
+  for (uint16_t i = 0; i < count; i++)
+  {
+    if (! iot_threadpool_spawn (pool, &pool->thread_array[i])) break;
+  }
+  while (atomic_load (&pool->created) != pool->live)
   {
     iot_wait_usecs (100); /* Wait until all threads running */
   }
   return pool;
 }
 
+iot_threadpool_t * iot_threadpool_alloc (uint16_t threads, uint32_t max_jobs, int default_prio, int affinity, iot_logger_t * logger)
+{
+  return iot_threadpool_run_threads (iot_threadpool_create (threads, max_jobs, default_prio, affinity, NULL, false, logger, false), threads);
+}
+
+iot_threadpool_t * iot_threadpool_alloc_stealing (uint16_t threads, uint32_t max_jobs, int default_prio, int affinity, iot_logger_t * logger)
+{
+  assert (threads);
+  return iot_threadpool_run_threads (iot_threadpool_create (threads, max_jobs, default_prio, affinity, NULL, false, logger, true), threads);
+}
+
+iot_threadpool_t * iot_threadpool_alloc_cpus (uint16_t threads, uint32_t max_jobs, int default_prio, const char * cpus, bool stealing, bool numa_local, iot_logger_t * logger)
+{
+  assert (cpus && (threads || ! stealing));
+  return iot_threadpool_run_threads (iot_threadpool_create (threads, max_jobs, default_prio, IOT_THREAD_NO_AFFINITY, cpus, numa_local, logger, stealing), threads);
+}
+
+iot_threadpool_t * iot_threadpool_alloc_elastic (uint16_t min_threads, uint16_t max_threads, uint32_t max_jobs, int default_prio, int affinity, uint32_t idle_timeout, iot_logger_t * logger)
+{
+  assert (max_threads && (min_threads <= max_threads) && idle_timeout);
+  iot_log_info (logger, "iot_threadpool_alloc_elastic (min_threads: %" PRIu16 " idle_timeout: %" PRIu32 ")", min_threads, idle_timeout);
+  iot_threadpool_t * pool = iot_threadpool_create (max_threads, max_jobs, default_prio, affinity, NULL, false, logger, false);
+  pool->min_threads = min_threads;
+  pool->idle_timeout = idle_timeout;
+  return iot_threadpool_run_threads (pool, min_threads);
+}
+
 void iot_threadpool_add_ref (iot_threadpool_t * pool)
 {
   if (pool) iot_component_add_ref (&pool->component);
 }
 
-static void iot_threadpool_add_work_locked (iot_threadpool_t * pool, void * (*func) (void*), void * arg, int prio)
+static iot_job_t * iot_threadpool_alloc_job (iot_threadpool_t * pool, iot_job_t ** cache, const iot_threadpool_job_t * desc, uint64_t deadline)
 {
-  iot_job_t * job = pool->cache;
+  iot_job_t * job = *cache;
   if (job)
   {
-    pool->cache = job->prev;
+    *cache = job->prev;
   }
   else
   {
-    job = malloc (sizeof (*job));
+    job = iot_threadpool_job_new (sizeof (*job));
   }
-  job->function = func;
-  job->arg = arg;
-  job->priority = prio;
+  job->function = desc->function;
+  job->arg = desc->arg;
+  job->priority = desc->priority;
+  job->deadline = deadline;
   job->prev = NULL;
   job->id = pool->next_id++;
+  job->queued = iot_time_nsecs ();
   iot_log_trace (pool->logger, "Added new job #%u", job->id);
+  return job;
+}
+
+// Jobs are ordered by priority, then earliest deadline first within a priority (jobs without a deadline last), then in order added
 
-  if (job->priority != IOT_THREAD_NO_PRIORITY) // Order job by priority
+static inline bool iot_threadpool_job_before (const iot_job_t * job, const iot_job_t * iter)
+{
+  if (job->priority != iter->priority)
   {
-    iot_job_t * iter = pool->front;
+    return (job->priority != IOT_THREAD_NO_PRIORITY) && (iter->priority == IOT_THREAD_NO_PRIORITY || iter->priority < job->priority);
+  }
+  return job->deadline && (iter->deadline == 0u || iter->deadline > job->deadline);
+}
+
+static void iot_threadpool_queue_job (iot_job_t ** front, iot_job_t ** rear, iot_job_t * job)
+{
+  if (job->priority != IOT_THREAD_NO_PRIORITY || job->deadline) // Order job by priority and deadline
+  {
+    iot_job_t * iter = *front;
     iot_job_t * prev = NULL;
     while (iter)
     {
-      if (iter->priority == IOT_THREAD_NO_PRIORITY || iter->priority < job->priority)
+      if (iot_threadpool_job_before (job, iter))
       {
         job->prev = iter;
         if (prev)
@@ -227,72 +564,425 @@ static void iot_threadpool_add_work_locked (iot_threadpool_t * pool, void * (*fu
         }
         else
         {
-          pool->front = job;
+          *front = job;
         }
-        goto DONE;
+        return;
       }
       prev = iter;
       iter = iter->prev;
     }
   }
   job->prev = NULL; // Add job to back of queue
-  if (pool->rear)
+  if (*rear)
+  {
+    (*rear)->prev = job;
+  }
+  *rear = job;
+  if (*front == NULL)
+  {
+    *front = job;
+  }
+}
+
+static void iot_threadpool_add_work_locked (iot_threadpool_t * pool, const iot_threadpool_job_t * jobs, uint32_t count, uint64_t deadline)
+{
+  for (uint32_t i = 0; i < count; i++)
+  {
+    iot_threadpool_queue_job (&pool->front, &pool->rear, iot_threadpool_alloc_job (pool, &pool->cache, &jobs[i], deadline));
+  }
+  pool->jobs += count;
+  iot_stats_max (&pool->high_water, pool->jobs);
+  iot_threadpool_flow (pool, pool->jobs);
+  if (pool->idle_timeout) iot_threadpool_grow (pool);
+  if (count > 1u)
   {
-    pool->rear->prev = job;
+    pthread_cond_broadcast (&pool->job_cond); // Signal new jobs added
   }
-  pool->rear = job;
-  if (pool->front == NULL)
+  else
   {
-    pool->front = job;
+    pthread_cond_signal (&pool->job_cond); // Signal new job added
   }
+}
+
+/*
+ * Work stealing mode. Each thread has a local job queue, ordered by priority and protected by
+ * its own mutex. Jobs added from a pool thread go to that thread's queue, otherwise queues are
+ * selected round robin. Idle threads take the highest priority job from their own queue, then
+ * steal from the other threads' queues. The component mutex is only taken to park or wake
+ * threads, which is only done when a thread is known to be waiting.
+ */
 
-DONE:
+static void iot_threadpool_notify (iot_threadpool_t * pool, _Atomic uint32_t * waiters, pthread_cond_t * cond)
+{
+  atomic_thread_fence (memory_order_seq_cst);
+  if (atomic_load (waiters))
+  {
+    iot_component_lock (&pool->component);
+    pthread_cond_broadcast (cond);
+    iot_component_unlock (&pool->component);
+  }
+}
 
-  pool->jobs++;
-  pthread_cond_signal (&pool->job_cond); // Signal new job added
+static uint32_t iot_threadpool_reserve (iot_threadpool_t * pool, uint32_t count)
+{
+  uint32_t queued = atomic_load (&pool->queued);
+  while (queued < pool->max_jobs)
+  {
+    uint32_t reserved = (pool->max_jobs - queued) < count ? (pool->max_jobs - queued) : count;
+    if (atomic_compare_exchange_weak (&pool->queued, &queued, queued + reserved))
+    {
+      iot_stats_max (&pool->high_water, queued + reserved);
+      iot_threadpool_flow (pool, queued + reserved);
+      return reserved;
+    }
+  }
+  return 0u;
 }
 
-bool iot_threadpool_try_work (iot_threadpool_t * pool, void * (*func) (void*), void * arg, int prio)
+static void iot_threadpool_wait_reserve (iot_threadpool_t * pool)
 {
-  assert (pool && func);
-  iot_log_trace (pool->logger, "iot_threadpool_try_work");
-  bool ret = false;
+  iot_log_debug (pool->logger, "iot_threadpool_add_work jobs at max (%u), waiting for job completion", pool->max_jobs);
   iot_component_lock (&pool->component);
-  if (pool->jobs < pool->max_jobs)
+  atomic_fetch_add (&pool->blocked, 1u);
+  if (atomic_load (&pool->queued) >= pool->max_jobs)
   {
-    iot_threadpool_add_work_locked (pool, func, arg, prio);
-    ret = true;
+    pthread_cond_wait (&pool->queue_cond, &pool->component.mutex); // Wait until space in job queue
   }
+  atomic_fetch_sub (&pool->blocked, 1u);
   iot_component_unlock (&pool->component);
-  return ret;
 }
 
-void iot_threadpool_add_work (iot_threadpool_t * pool, void * (*func) (void*), void * arg, int prio)
+static void iot_threadpool_add_work_stealing (iot_threadpool_t * pool, const iot_threadpool_job_t * jobs, uint32_t count, uint64_t deadline)
+{
+  iot_thread_t * th = iot_threadpool_current;
+  if (th == NULL || th->pool != pool)
+  {
+    th = &pool->thread_array[atomic_fetch_add (&pool->next_thread, 1u) % pool->threads];
+  }
+  pthread_mutex_lock (&th->mutex);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    iot_threadpool_queue_job (&th->front, &th->rear, iot_threadpool_alloc_job (pool, &th->cache, &jobs[i], deadline));
+  }
+  pthread_mutex_unlock (&th->mutex);
+  atomic_thread_fence (memory_order_seq_cst);
+  if (atomic_load (&pool->sleepers))
+  {
+    iot_component_lock (&pool->component);
+    if (count > 1u)
+    {
+      pthread_cond_broadcast (&pool->job_cond); // Signal new jobs added, idle threads steal from local queue
+    }
+    else
+    {
+      pthread_cond_signal (&pool->job_cond); // Signal new job added
+    }
+    iot_component_unlock (&pool->component);
+  }
+}
+
+static bool iot_threadpool_steal (iot_threadpool_t * pool, iot_thread_t * th, iot_job_t * job)
+{
+  for (uint16_t i = 0; i < pool->threads; i++)
+  {
+    iot_thread_t * victim = &pool->thread_array[(th->id + i) % pool->threads];
+    pthread_mutex_lock (&victim->mutex);
+    iot_job_t * first = victim->front;
+    if (first && iot_component_get_state (&pool->component) == IOT_COMPONENT_RUNNING) // State checked with queue locked, see iot_threadpool_stop
+    {
+      *job = *first;
+      victim->front = first->prev;
+      if (victim->front == NULL)
+      {
+        victim->rear = NULL;
+      }
+      first->prev = victim->cache;
+      victim->cache = first;
+      atomic_fetch_add (&pool->busy, 1u);
+      pthread_mutex_unlock (&victim->mutex);
+      uint32_t queued = atomic_fetch_sub (&pool->queued, 1u);
+      if (queued == pool->max_jobs)
+      {
+        iot_threadpool_notify (pool, &pool->blocked, &pool->queue_cond); // Signal now space in job queue
+      }
+      iot_threadpool_flow (pool, queued - 1u);
+      return true;
+    }
+    pthread_mutex_unlock (&victim->mutex);
+  }
+  return false;
+}
+
+static bool iot_threadpool_stealing_run (iot_thread_t * th, pthread_t tid, int * priority)
+{
+  iot_threadpool_t * pool = th->pool;
+  iot_component_t * comp = &pool->component;
+  bool pending_delete = false;
+  iot_job_t job;
+
+  while (true)
+  {
+    if (iot_threadpool_steal (pool, th, &job))
+    {
+      iot_log_trace (pool->logger, "Thread %" PRIu16 " processing job %" PRIu32, th->id, job.id);
+      if ((job.priority != IOT_THREAD_NO_PRIORITY) && (job.priority != *priority)) // If required, set thread priority
+      {
+        if (iot_thread_set_priority (tid, job.priority))
+        {
+          *priority = job.priority;
+        }
+      }
+      iot_threadpool_run_job (pool, &job);
+      iot_log_trace (pool->logger, "Thread %" PRIu16 " completed job %" PRIu32, th->id, job.id);
+      if (atomic_fetch_sub (&pool->busy, 1u) == 1u && atomic_load (&pool->queued) == 0u)
+      {
+        iot_threadpool_notify (pool, &pool->blocked, &pool->work_cond); // Signal when no jobs or threads working
+      }
+      continue;
+    }
+    iot_component_state_t state = iot_component_lock (comp);
+    if (state == IOT_COMPONENT_DELETED) // Exit thread on deletion
+    {
+      pending_delete = th->pending_delete;
+      th->deleted = true;
+      iot_component_unlock (comp);
+      break;
+    }
+    if (state == IOT_COMPONENT_RUNNING)
+    {
+      atomic_fetch_add (&pool->sleepers, 1u);
+      if (atomic_load (&pool->queued) == 0u)
+      {
+        iot_log_trace (pool->logger, "Thread %" PRIu16 " waiting for new job", th->id);
+        pthread_cond_wait (&pool->job_cond, &comp->mutex); // Wait for new job
+      }
+      atomic_fetch_sub (&pool->sleepers, 1u);
+    }
+    else
+    {
+      pthread_cond_wait (&comp->cond, &comp->mutex); // Wait for state change
+    }
+    iot_component_unlock (comp);
+  }
+  return pending_delete;
+}
+
+uint32_t iot_threadpool_try_work_batch (iot_threadpool_t * pool, const iot_threadpool_job_t * jobs, uint32_t count)
+{
+  assert (pool && (jobs || count == 0u));
+  iot_log_trace (pool->logger, "iot_threadpool_try_work_batch");
+  uint32_t added;
+  if (pool->stealing)
+  {
+    added = iot_threadpool_reserve (pool, count);
+    if (added) iot_threadpool_add_work_stealing (pool, jobs, added, 0u);
+    return added;
+  }
+  iot_component_lock (&pool->component);
+  added = (pool->max_jobs - pool->jobs) < count ? (pool->max_jobs - pool->jobs) : count;
+  if (added)
+  {
+    iot_threadpool_add_work_locked (pool, jobs, added, 0u);
+  }
+  iot_component_unlock (&pool->component);
+  return added;
+}
+
+bool iot_threadpool_try_work (iot_threadpool_t * pool, void * (*func) (void*), void * arg, int prio)
 {
   assert (pool && func);
-  iot_log_trace (pool->logger, "iot_threadpool_add_work");
+  iot_threadpool_job_t job = { func, arg, prio };
+  return iot_threadpool_try_work_batch (pool, &job, 1u) == 1u;
+}
+
+// Add jobs with a common deadline (zero if none), waiting while the job queue is full
+
+static void iot_threadpool_add_jobs (iot_threadpool_t * pool, const iot_threadpool_job_t * jobs, uint32_t count, uint64_t deadline)
+{
+  if (pool->stealing)
+  {
+    while (count)
+    {
+      uint32_t added = iot_threadpool_reserve (pool, count);
+      if (added)
+      {
+        iot_threadpool_add_work_stealing (pool, jobs, added, deadline);
+        jobs += added;
+        count -= added;
+      }
+      else
+      {
+        iot_threadpool_wait_reserve (pool);
+      }
+    }
+    return;
+  }
   iot_component_lock (&pool->component);
-  while (pool->jobs == pool->max_jobs)
+  while (count)
   {
-    iot_log_debug (pool->logger, "iot_threadpool_add_work jobs at max (%u), waiting for job completion", pool->max_jobs);
-    pthread_cond_wait (&pool->queue_cond, &pool->component.mutex); // Wait until space in job queue
+    while (pool->jobs == pool->max_jobs)
+    {
+      iot_log_debug (pool->logger, "iot_threadpool_add_work jobs at max (%u), waiting for job completion", pool->max_jobs);
+      pthread_cond_wait (&pool->queue_cond, &pool->component.mutex); // Wait until space in job queue
+    }
+    uint32_t added = (pool->max_jobs - pool->jobs) < count ? (pool->max_jobs - pool->jobs) : count;
+    iot_threadpool_add_work_locked (pool, jobs, added, deadline);
+    jobs += added;
+    count -= added;
   }
-  iot_threadpool_add_work_locked (pool, func, arg, prio);
   iot_log_debug (pool->logger, "iot_threadpool_add_work jobs/max: %u/%u", pool->jobs, pool->max_jobs);
   iot_component_unlock (&pool->component);
 }
 
-void iot_threadpool_wait (iot_threadpool_t * pool)
+void iot_threadpool_add_work_batch (iot_threadpool_t * pool, const iot_threadpool_job_t * jobs, uint32_t count)
+{
+  assert (pool && (jobs || count == 0u));
+  iot_log_trace (pool->logger, "iot_threadpool_add_work_batch");
+  iot_threadpool_add_jobs (pool, jobs, count, 0u);
+}
+
+void iot_threadpool_add_work (iot_threadpool_t * pool, void * (*func) (void*), void * arg, int prio)
+{
+  assert (pool && func);
+  iot_threadpool_job_t job = { func, arg, prio };
+  iot_threadpool_add_work_batch (pool, &job, 1u);
+}
+
+void iot_threadpool_add_work_deadline (iot_threadpool_t * pool, void * (*func) (void*), void * arg, int prio, uint64_t deadline)
+{
+  assert (pool && func);
+  iot_threadpool_job_t job = { func, arg, prio };
+  iot_log_trace (pool->logger, "iot_threadpool_add_work_deadline");
+  iot_threadpool_add_jobs (pool, &job, 1u, deadline);
+}
+
+void iot_threadpool_set_drop_expired (iot_threadpool_t * pool, bool drop)
 {
   assert (pool);
-  iot_log_trace (pool->logger, "iot_threadpool_wait");
+  atomic_store (&pool->drop_expired, drop);
+}
+
+void iot_threadpool_set_flow (iot_threadpool_t * pool, iot_flow_t * flow)
+{
+  assert (pool);
+  iot_flow_add_ref (flow);
+  iot_flow_free (atomic_exchange (&pool->flow, flow));
+}
+
+static inline iot_strand_t ** iot_threadpool_strand_bucket (iot_threadpool_t * pool, uint64_t key)
+{
+  return &pool->strands[(key ^ (key >> 32u)) % IOT_TP_STRAND_BUCKETS];
+}
+
+// Run strand jobs in order, requeueing the strand after a batch so other jobs are not blocked
+
+static void * iot_threadpool_strand_run (void * arg)
+{
+  iot_strand_t * strand = (iot_strand_t*) arg;
+  iot_threadpool_t * pool = strand->pool;
+  for (uint32_t count = 1u; ; count++)
+  {
+    pthread_mutex_lock (&pool->strand_mutex);
+    iot_strand_job_t * job = strand->front;
+    strand->front = job->next;
+    pthread_mutex_unlock (&pool->strand_mutex);
+    (job->function) (job->arg);
+    iot_threadpool_job_delete (job);
+    pthread_mutex_lock (&pool->strand_mutex);
+    if (strand->front == NULL) // Strand complete, remove from table
+    {
+      iot_strand_t ** prev = iot_threadpool_strand_bucket (pool, strand->key);
+      while (*prev != strand) prev = &(*prev)->next;
+      *prev = strand->next;
+      pthread_mutex_unlock (&pool->strand_mutex);
+      free (strand);
+      break;
+    }
+    int priority = strand->front->priority;
+    pthread_mutex_unlock (&pool->strand_mutex);
+    if ((count % IOT_TP_STRAND_BATCH) == 0u && iot_threadpool_try_work (pool, iot_threadpool_strand_run, strand, priority)) break;
+  }
+  return NULL;
+}
+
+void iot_threadpool_add_keyed_work (iot_threadpool_t * pool, uint64_t key, void * (*func) (void*), void * arg, int prio)
+{
+  assert (pool && func);
+  iot_strand_job_t * job = iot_threadpool_job_new (sizeof (*job));
+  job->next = NULL;
+  job->function = func;
+  job->arg = arg;
+  job->priority = prio;
+  pthread_mutex_lock (&pool->strand_mutex);
+  iot_strand_t ** bucket = iot_threadpool_strand_bucket (pool, key);
+  iot_strand_t * strand = *bucket;
+  while (strand && strand->key != key) strand = strand->next;
+  if (strand) // Strand queued or running, append job
+  {
+    if (strand->front)
+    {
+      strand->rear->next = job;
+    }
+    else
+    {
+      strand->front = job;
+    }
+    strand->rear = job;
+    pthread_mutex_unlock (&pool->strand_mutex);
+    return;
+  }
+  strand = malloc (sizeof (*strand));
+  strand->pool = pool;
+  strand->key = key;
+  strand->front = strand->rear = job;
+  strand->next = *bucket;
+  *bucket = strand;
+  pthread_mutex_unlock (&pool->strand_mutex);
+  iot_threadpool_add_work (pool, iot_threadpool_strand_run, strand, prio);
+}
+
+static bool iot_threadpool_wait_until (iot_threadpool_t * pool, uint64_t deadline)
+{
+  bool done = true;
   iot_component_lock (&pool->component);
-  while (pool->jobs || pool->working)
+  if (pool->stealing)
+  {
+    atomic_fetch_add (&pool->blocked, 1u);
+    while (atomic_load (&pool->queued) || atomic_load (&pool->busy))
+    {
+      iot_log_debug (pool->logger, "iot_threadpool_wait (jobs:%u active threads:%u)", atomic_load (&pool->queued), atomic_load (&pool->busy));
+      if (! iot_cond_timedwait (&pool->work_cond, &pool->component.mutex, deadline)) // Wait until all jobs processed
+      {
+        done = ! (atomic_load (&pool->queued) || atomic_load (&pool->busy));
+        break;
+      }
+    }
+    atomic_fetch_sub (&pool->blocked, 1u);
+  }
+  while (done && (pool->jobs || pool->working))
   {
     iot_log_debug (pool->logger, "iot_threadpool_wait (jobs:%u active threads:%u)", pool->jobs, pool->working);
-    pthread_cond_wait (&pool->work_cond, &pool->component.mutex); // Wait until all jobs processed
+    if (! iot_cond_timedwait (&pool->work_cond, &pool->component.mutex, deadline)) // Wait until all jobs processed
+    {
+      done = ! (pool->jobs || pool->working);
+    }
   }
   iot_component_unlock (&pool->component);
+  return done;
+}
+
+void iot_threadpool_wait (iot_threadpool_t * pool)
+{
+  assert (pool);
+  iot_log_trace (pool->logger, "iot_threadpool_wait");
+  iot_threadpool_wait_until (pool, IOT_COND_NO_DEADLINE);
+}
+
+bool iot_threadpool_wait_timed (iot_threadpool_t * pool, uint64_t timeout_ns)
+{
+  assert (pool);
+  iot_log_trace (pool->logger, "iot_threadpool_wait_timed");
+  return iot_threadpool_wait_until (pool, iot_cond_deadline (timeout_ns));
 }
 
 void iot_threadpool_stop (iot_threadpool_t * pool)
@@ -300,6 +990,11 @@ void iot_threadpool_stop (iot_threadpool_t * pool)
   assert (pool);
   iot_log_trace (pool->logger, "iot_threadpool_stop");
   iot_component_set_stopped (&pool->component);
+  for (uint16_t i = 0; pool->stealing && i < pool->threads; i++) // Wait out any steal that saw running, so no job starts after return
+  {
+    pthread_mutex_lock (&pool->thread_array[i].mutex);
+    pthread_mutex_unlock (&pool->thread_array[i].mutex);
+  }
   iot_component_lock (&pool->component);
   pthread_cond_broadcast (&pool->job_cond);
   iot_component_unlock (&pool->component);
@@ -315,6 +1010,32 @@ void iot_threadpool_start (iot_threadpool_t * pool)
   iot_component_unlock (&pool->component);
 }
 
+// Delete the pool component, so that threads exit once any job being run finishes, and wait for all threads but self to exit
+
+static void iot_threadpool_join (iot_threadpool_t * pool, bool self_delete)
+{
+  iot_component_t * comp = &pool->component;
+  iot_threadpool_stop (pool);
+  iot_component_set_deleted (comp);
+  iot_component_lock (comp);
+  while (atomic_load (&pool->created) > (self_delete ? 1u : 0u))
+  {
+    if (! iot_cond_timedwait (&pool->exit_cond, &comp->mutex, iot_cond_deadline ((uint64_t) pool->delay * 1000000u)))
+    {
+      iot_log_debug (pool->logger, "pool %p waiting for %" PRIu16 " threads to exit", pool, atomic_load (&pool->created));
+    }
+  }
+  iot_component_unlock (comp);
+}
+
+void iot_threadpool_shutdown (iot_threadpool_t * pool, bool cancel)
+{
+  assert (pool && (iot_threadpool_current == NULL || iot_threadpool_current->pool != pool));
+  iot_log_trace (pool->logger, "iot_threadpool_shutdown (cancel: %s)", cancel ? "true" : "false");
+  if (! cancel) iot_threadpool_wait (pool);
+  iot_threadpool_join (pool, false);
+}
+
 void iot_threadpool_free (iot_threadpool_t * pool)
 {
   if (pool && iot_component_dec_ref (&pool->component))
@@ -335,26 +1056,398 @@ void iot_threadpool_free (iot_threadpool_t * pool)
     }
     iot_component_unlock (&pool->component);
     if (self_delete) iot_log_debug (pool->logger, "pool %p self delete", pool);
-    iot_threadpool_stop (pool);
-    iot_component_set_deleted (&pool->component);
-    while (atomic_load (&pool->created) > (self_delete ? 1 : 0))
-    {
-      iot_wait_msecs (pool->delay);
-    }
+    iot_threadpool_join (pool, self_delete);
     while ((job = pool->cache))
     {
       pool->cache = job->prev;
-      free (job);
+      iot_threadpool_job_release (pool, job);
     }
     while ((job = pool->front))
     {
       pool->front = job->prev;
-      free (job);
+      iot_future_discard (job);
+      iot_threadpool_job_release (pool, job);
+    }
+    for (uint32_t i = 0; i < IOT_TP_STRAND_BUCKETS; i++)
+    {
+      iot_strand_t * strand;
+      while ((strand = pool->strands[i]))
+      {
+        iot_strand_job_t * sjob;
+        pool->strands[i] = strand->next;
+        while ((sjob = strand->front))
+        {
+          strand->front = sjob->next;
+          iot_threadpool_job_delete (sjob);
+        }
+        free (strand);
+      }
+    }
+    for (uint16_t i = 0; pool->stealing && i < pool->threads; i++)
+    {
+      iot_thread_t * th = &pool->thread_array[i];
+      while ((job = th->cache))
+      {
+        th->cache = job->prev;
+        iot_threadpool_job_release (pool, job);
+      }
+      while ((job = th->front))
+      {
+        th->front = job->prev;
+        iot_future_discard (job);
+        iot_threadpool_job_release (pool, job);
+      }
     }
     if (!self_delete) iot_threadpool_final_free (pool);
   }
 }
 
+/*
+ * Futures. Continuations are held in a lock free stack, which is swapped for a marker when the result is set, the
+ * continuations then being run in the order added. A continuation added once the marker is set runs immediately.
+ * Each continuation is embedded in the future it completes, with one link per combined future for combinators.
+ */
+
+typedef struct iot_future_link_t
+{
+  struct iot_future_link_t * next;   // Next continuation added to preceding future
+  struct iot_future_t * owner;       // Future completed by continuation
+} iot_future_link_t;
+
+struct iot_future_t
+{
+  iot_future_link_t * _Atomic links; // Continuations, iot_future_done once result set
+  _Atomic uint32_t refs;             // Reference count
+  void * result;                     // Result, valid once links set to iot_future_done
+  void (*run) (iot_future_t * future, iot_future_t * from); // Continuation, called when preceding future complete
+  void * (*function) (void * arg);   // Submitted function
+  iot_future_fn fn;                  // Continuation function
+  void * arg;                        // Function argument
+  void * input;                      // Preceding future result
+  iot_threadpool_t * pool;           // Pool for continuation, NULL if run directly
+  _Atomic uint32_t pending;          // Number of links still to run (combinators)
+  _Atomic bool claimed;              // Whether result set by a preceding future (when any)
+  iot_future_link_t link[];          // Continuation links, one per preceding future
+};
+
+typedef struct iot_future_waiter_t
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bool done;
+} iot_future_waiter_t;
+
+static iot_future_link_t iot_future_done_marker;
+#define iot_future_done (&iot_future_done_marker)
+
+static iot_future_t * iot_future_create (uint32_t links, uint32_t refs)
+{
+  iot_future_t * future = calloc (1u, sizeof (*future) + links * sizeof (iot_future_link_t));
+  atomic_store (&future->refs, refs);
+  for (uint32_t i = 0; i < links; i++) future->link[i].owner = future;
+  return future;
+}
+
+void iot_future_free (iot_future_t * future)
+{
+  if (future && atomic_fetch_sub (&future->refs, 1u) == 1u) free (future);
+}
+
+iot_future_t * iot_future_alloc (void)
+{
+  return iot_future_create (0u, 1u);
+}
+
+void iot_future_set (iot_future_t * future, void * result)
+{
+  assert (future);
+  future->result = result;
+  iot_future_link_t * link = atomic_exchange_explicit (&future->links, iot_future_done, memory_order_acq_rel);
+  assert (link != iot_future_done);
+  iot_future_link_t * order = NULL;
+  while (link) // Reverse to order added
+  {
+    iot_future_link_t * next = link->next;
+    link->next = order;
+    order = link;
+    link = next;
+  }
+  while (order)
+  {
+    iot_future_link_t * next = order->next; // Link may be freed by continuation
+    order->owner->run (order->owner, future);
+    order = next;
+  }
+}
+
+// Add continuation link to a future, running the continuation if the future result already set
+
+static void iot_future_link (iot_future_t * future, iot_future_link_t * link)
+{
+  iot_future_link_t * head = atomic_load_explicit (&future->links, memory_order_acquire);
+  do
+  {
+    if (head == iot_future_done)
+    {
+      link->owner->run (link->owner, future);
+      return;
+    }
+    link->next = head;
+  } while (! atomic_compare_exchange_weak_explicit (&future->links, &head, link, memory_order_release, memory_order_acquire));
+}
+
+bool iot_future_ready (const iot_future_t * future)
+{
+  assert (future);
+  return atomic_load_explicit (&((iot_future_t*) future)->links, memory_order_acquire) == iot_future_done;
+}
+
+static void * iot_future_submitted (void * arg)
+{
+  iot_future_t * future = arg;
+  iot_future_set (future, (future->function) (future->arg));
+  iot_future_free (future);
+  return NULL;
+}
+
+iot_future_t * iot_threadpool_submit (iot_threadpool_t * pool, void * (*function) (void*), void * arg, int priority)
+{
+  assert (pool && function);
+  iot_future_t * future = iot_future_create (0u, 2u); // Held by caller and job
+  future->function = function;
+  future->arg = arg;
+  iot_threadpool_add_work (pool, iot_future_submitted, future, priority);
+  return future;
+}
+
+static void * iot_future_continue (void * arg)
+{
+  iot_future_t * future = arg;
+  iot_future_set (future, (future->fn) (future->input, future->arg));
+  iot_future_free (future);
+  return NULL;
+}
+
+// Complete the future of a discarded job with a NULL result, releasing the job reference
+
+static void iot_future_cancel (iot_future_t * future)
+{
+  iot_future_set (future, NULL);
+  iot_future_free (future);
+}
+
+static void iot_future_discard (const iot_job_t * job)
+{
+  if (job->function == iot_future_submitted || job->function == iot_future_continue) iot_future_cancel (job->arg);
+}
+
+static void iot_future_run_then (iot_future_t * future, iot_future_t * from)
+{
+  future->input = from->result;
+  if (future->pool && iot_component_get_state (&future->pool->component) == IOT_COMPONENT_DELETED)
+  {
+    iot_future_cancel (future); // Pool shut down, so continuation not run
+  }
+  else if (future->pool)
+  {
+    iot_threadpool_add_work (future->pool, iot_future_continue, future, IOT_THREAD_NO_PRIORITY);
+  }
+  else
+  {
+    iot_future_continue (future);
+  }
+}
+
+iot_future_t * iot_future_then (iot_future_t * future, iot_threadpool_t * pool, iot_future_fn fn, void * arg)
+{
+  assert (future && fn);
+  iot_future_t * next = iot_future_create (1u, 2u); // Held by caller and continuation
+  next->run = iot_future_run_then;
+  next->fn = fn;
+  next->arg = arg;
+  next->pool = pool;
+  iot_future_link (future, &next->link[0]);
+  return next;
+}
+
+static void iot_future_run_all (iot_future_t * future, iot_future_t * from)
+{
+  (void) from;
+  if (atomic_fetch_sub (&future->pending, 1u) == 1u)
+  {
+    iot_future_set (future, NULL);
+    iot_future_free (future);
+  }
+}
+
+iot_future_t * iot_future_when_all (iot_future_t * const * futures, uint32_t count)
+{
+  assert (futures || count == 0u);
+  iot_future_t * all = iot_future_create (count, 2u); // Held by caller and last completion
+  all->run = iot_future_run_all;
+  atomic_store (&all->pending, count + 1u); // Extra count so not completed while linking
+  for (uint32_t i = 0; i < count; i++) iot_future_link (futures[i], &all->link[i]);
+  iot_future_run_all (all, NULL);
+  return all;
+}
+
+static void iot_future_run_any (iot_future_t * future, iot_future_t * from)
+{
+  if (from && ! atomic_exchange (&future->claimed, true)) iot_future_set (future, from);
+  if (atomic_fetch_sub (&future->pending, 1u) == 1u) iot_future_free (future); // Links no longer in use
+}
+
+iot_future_t * iot_future_when_any (iot_future_t * const * futures, uint32_t count)
+{
+  assert (futures && count);
+  iot_future_t * any = iot_future_create (count, 2u); // Held by caller and links
+  any->run = iot_future_run_any;
+  atomic_store (&any->pending, count + 1u); // Extra count so not freed while linking
+  for (uint32_t i = 0; i < count; i++) iot_future_link (futures[i], &any->link[i]);
+  iot_future_run_any (any, NULL);
+  return any;
+}
+
+static void iot_future_waken (iot_future_t * future, iot_future_t * from)
+{
+  (void) from;
+  iot_future_waiter_t * waiter = future->arg;
+  pthread_mutex_lock (&waiter->mutex);
+  waiter->done = true;
+  pthread_cond_signal (&waiter->cond);
+  pthread_mutex_unlock (&waiter->mutex);
+}
+
+void * iot_future_wait (iot_future_t * future)
+{
+  assert (future);
+  if (! iot_future_ready (future))
+  {
+    iot_future_waiter_t waiter = { .done = false };
+    iot_future_t * wait = iot_future_create (1u, 1u);
+    wait->run = iot_future_waken;
+    wait->arg = &waiter;
+    iot_mutex_init (&waiter.mutex);
+    iot_cond_init (&waiter.cond);
+    iot_future_link (future, &wait->link[0]);
+    pthread_mutex_lock (&waiter.mutex);
+    while (! waiter.done) pthread_cond_wait (&waiter.cond, &waiter.mutex);
+    pthread_mutex_unlock (&waiter.mutex);
+    pthread_cond_destroy (&waiter.cond);
+    pthread_mutex_destroy (&waiter.mutex);
+    iot_future_free (wait);
+  }
+  return future->result;
+}
+
+// Parallel for. Ranges are claimed in turn by the calling thread and helper jobs. The context is reference counted,
+// so the caller returns once all ranges are complete, without waiting for helper jobs which have not yet started.
+
+#define IOT_TP_PARALLEL_BATCH 16u // Helper jobs added in each batch
+
+typedef struct iot_parallel_for_t
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  _Atomic uint32_t refs;      // Caller and helper job references
+  _Atomic uint32_t next;      // Next range to claim
+  _Atomic uint32_t done;      // Number of ranges complete
+  uint32_t ranges;            // Number of ranges
+  uint32_t begin;
+  uint32_t end;
+  uint32_t grain;
+  iot_threadpool_range_fn fn;
+  void * ctx;
+} iot_parallel_for_t;
+
+static void iot_parallel_for_release (iot_parallel_for_t * pf, uint32_t refs)
+{
+  if (atomic_fetch_sub (&pf->refs, refs) == refs)
+  {
+    pthread_cond_destroy (&pf->cond);
+    pthread_mutex_destroy (&pf->mutex);
+    free (pf);
+  }
+}
+
+static void iot_parallel_for_ranges (iot_parallel_for_t * pf)
+{
+  uint32_t range;
+  uint32_t count = 0u;
+  while ((range = atomic_fetch_add (&pf->next, 1u)) < pf->ranges)
+  {
+    uint32_t start = pf->begin + range * pf->grain;
+    (pf->fn) (start, (pf->end - start > pf->grain) ? start + pf->grain : pf->end, pf->ctx);
+    count++;
+  }
+  if (count && (atomic_fetch_add (&pf->done, count) + count == pf->ranges))
+  {
+    pthread_mutex_lock (&pf->mutex);
+    pthread_cond_signal (&pf->cond);
+    pthread_mutex_unlock (&pf->mutex);
+  }
+}
+
+static void * iot_parallel_for_helper (void * arg)
+{
+  iot_parallel_for_ranges (arg);
+  iot_parallel_for_release (arg, 1u);
+  return NULL;
+}
+
+void iot_threadpool_parallel_for (iot_threadpool_t * pool, uint32_t begin, uint32_t end, uint32_t grain, iot_threadpool_range_fn fn, void * ctx)
+{
+  assert (fn && (begin <= end));
+  uint32_t size = end - begin;
+  uint32_t threads = pool ? pool->threads : 0u;
+  if (grain == 0u) grain = threads ? (uint32_t) (((uint64_t) size + 4u * threads - 1u) / (4u * threads)) : size;
+  if (grain == 0u) grain = 1u;
+  uint32_t ranges = (uint32_t) (((uint64_t) size + grain - 1u) / grain);
+  uint32_t helpers = (ranges > 1u) ? ((ranges - 1u) < threads ? (ranges - 1u) : threads) : 0u;
+  if (helpers == 0u)
+  {
+    for (uint32_t start = begin; start < end; )
+    {
+      uint32_t stop = (end - start > grain) ? start + grain : end;
+      fn (start, stop, ctx);
+      start = stop;
+    }
+    return;
+  }
+  iot_threadpool_job_t jobs[IOT_TP_PARALLEL_BATCH];
+  iot_parallel_for_t * pf = malloc (sizeof (*pf));
+  iot_mutex_init (&pf->mutex);
+  iot_cond_init (&pf->cond);
+  atomic_store (&pf->refs, 1u + helpers);
+  atomic_store (&pf->next, 0u);
+  atomic_store (&pf->done, 0u);
+  pf->ranges = ranges;
+  pf->begin = begin;
+  pf->end = end;
+  pf->grain = grain;
+  pf->fn = fn;
+  pf->ctx = ctx;
+  for (uint32_t i = 0; i < IOT_TP_PARALLEL_BATCH; i++)
+  {
+    jobs[i].function = iot_parallel_for_helper;
+    jobs[i].arg = pf;
+    jobs[i].priority = IOT_THREAD_NO_PRIORITY;
+  }
+  uint32_t remaining = helpers;
+  while (remaining)
+  {
+    uint32_t count = (remaining < IOT_TP_PARALLEL_BATCH) ? remaining : IOT_TP_PARALLEL_BATCH;
+    uint32_t added = iot_threadpool_try_work_batch (pool, jobs, count);
+    remaining -= added;
+    if (added < count) break;
+  }
+  if (remaining) iot_parallel_for_release (pf, remaining); // Drop references of jobs not queued
+  iot_parallel_for_ranges (pf);
+  pthread_mutex_lock (&pf->mutex);
+  while (atomic_load (&pf->done) < ranges) pthread_cond_wait (&pf->cond, &pf->mutex);
+  pthread_mutex_unlock (&pf->mutex);
+  iot_parallel_for_release (pf, 1u);
+}
 #ifdef IOT_BUILD_COMPONENTS
 
 static iot_component_t * iot_threadpool_config (iot_container_t * cont, const iot_data_t * map)
@@ -363,9 +1456,22 @@ static iot_component_t * iot_threadpool_config (iot_container_t * cont, const io
   uint16_t threads = (uint16_t) iot_data_string_map_get_i64 (map, "Threads", IOT_TP_THREADS_DEFAULT);
   uint32_t jobs = (uint32_t) iot_data_string_map_get_i64 (map, "MaxJobs", IOT_TP_JOBS_DEFAULT);
   int prio = (int) iot_data_string_map_get_i64 (map, "Priority", IOT_THREAD_NO_PRIORITY);
-  int affinity = (int) iot_data_string_map_get_i64 (map, "Affinity", IOT_THREAD_NO_AFFINITY);
+  const iot_data_t * value = iot_data_string_map_get (map, "Affinity");
+  const char * cpus = (value && iot_data_type (value) == IOT_DATA_STRING) ? iot_data_string (value) : NULL;
+  int affinity = cpus ? IOT_THREAD_NO_AFFINITY : (int) iot_data_string_map_get_i64 (map, "Affinity", IOT_THREAD_NO_AFFINITY);
+  bool numa_local = iot_data_string_map_get_bool (map, "NumaLocal", false);
+  uint16_t min_threads = (uint16_t) iot_data_string_map_get_i64 (map, "MinThreads", threads);
+  uint32_t idle_timeout = (uint32_t) iot_data_string_map_get_i64 (map, "IdleTimeout", IOT_TP_IDLE_DEFAULT);
   uint32_t delay = (uint32_t) iot_data_string_map_get_i64 (map, "ShutdownDelay", IOT_TP_SHUTDOWN_MIN);
-  iot_threadpool_t * pool = iot_threadpool_alloc (threads, jobs, prio, affinity, logger);
+  bool stealing = iot_data_string_map_get_bool (map, "WorkStealing", false);
+  stealing = stealing && threads;
+  iot_threadpool_t * pool = iot_threadpool_create (threads, jobs, prio, affinity, cpus, numa_local, logger, stealing);
+  if (! stealing && (min_threads < threads) && idle_timeout) // Elastic
+  {
+    pool->min_threads = min_threads;
+    pool->idle_timeout = idle_timeout;
+  }
+  iot_threadpool_run_threads (pool, pool->idle_timeout ? min_threads : threads);
   pool->delay = (delay < IOT_TP_SHUTDOWN_MIN) ? IOT_TP_SHUTDOWN_MIN : delay;
   return &pool->component;
 }
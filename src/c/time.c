@@ -10,13 +10,41 @@
 #define IOT_TIME_NANOS_PER_MIL 1000000U
 #define IOT_TIME_NANOS_PER_SEC 1000000000U
 
-static inline uint64_t iot_time_nanosecs (void)
+#ifdef CLOCK_REALTIME_COARSE
+#define IOT_TIME_COARSE_CLOCK CLOCK_REALTIME_COARSE
+#else
+#define IOT_TIME_COARSE_CLOCK CLOCK_REALTIME
+#endif
+
+#define IOT_TIME_SPIN_MIN 5000U
+#define IOT_TIME_SPIN_MAX 1000000U
+
+// Unix time in ns of last cache update, zero if no cache maintained
+
+static _Atomic uint64_t iot_time_cache = 0u;
+
+// Precise wait spin period in ns, adapted to twice the average observed sleep overrun
+
+static _Atomic uint64_t iot_time_spin = 50000U;
+
+static inline uint64_t iot_time_clock_nsecs (clockid_t clock)
 {
   struct timespec ts = { 0 };
-  clock_gettime (CLOCK_REALTIME, &ts);
+  clock_gettime (clock, &ts);
   return ((uint64_t) ts.tv_sec * IOT_TIME_NANOS_PER_SEC) + (uint64_t) ts.tv_nsec;
 }
 
+static inline uint64_t iot_time_nanosecs (void)
+{
+  return iot_time_clock_nsecs (CLOCK_REALTIME);
+}
+
+static inline uint64_t iot_time_cached (void)
+{
+  uint64_t ns = atomic_load_explicit (&iot_time_cache, memory_order_relaxed);
+  return ns ? ns : iot_time_nanosecs ();
+}
+
 uint64_t iot_time_msecs (void)
 {
   return iot_time_nanosecs () / IOT_TIME_NANOS_PER_MIL;
@@ -47,6 +75,48 @@ uint64_t iot_time_nsecs (void)
   return result;
 }
 
+uint64_t iot_time_coarse_msecs (void)
+{
+  return iot_time_clock_nsecs (IOT_TIME_COARSE_CLOCK) / IOT_TIME_NANOS_PER_MIL;
+}
+
+uint64_t iot_time_coarse_usecs (void)
+{
+  return iot_time_clock_nsecs (IOT_TIME_COARSE_CLOCK) / IOT_TIME_NANOS_PER_MIC;
+}
+
+uint64_t iot_time_coarse_nsecs (void)
+{
+  return iot_time_clock_nsecs (IOT_TIME_COARSE_CLOCK);
+}
+
+uint64_t iot_time_cache_update (void)
+{
+  uint64_t ns = iot_time_nanosecs ();
+  atomic_store_explicit (&iot_time_cache, ns, memory_order_relaxed);
+  return ns;
+}
+
+void iot_time_cache_disable (void)
+{
+  atomic_store (&iot_time_cache, 0u);
+}
+
+uint64_t iot_time_cached_msecs (void)
+{
+  return iot_time_cached () / IOT_TIME_NANOS_PER_MIL;
+}
+
+uint64_t iot_time_cached_usecs (void)
+{
+  return iot_time_cached () / IOT_TIME_NANOS_PER_MIC;
+}
+
+uint64_t iot_time_cached_nsecs (void)
+{
+  return iot_time_cached ();
+}
+
 static void iot_wait (struct timespec * tm)
 {
   struct timespec rem;
@@ -65,6 +135,31 @@ void iot_wait_msecs (uint64_t interval)
   iot_wait (&tm);
 }
 
+// Sleep until the spin period before the deadline, then spin to the deadline
+
+void iot_wait_precise_nsecs (uint64_t interval)
+{
+  uint64_t now = iot_time_clock_nsecs (CLOCK_MONOTONIC);
+  uint64_t deadline = now + interval;
+  uint64_t spin = atomic_load_explicit (&iot_time_spin, memory_order_relaxed);
+  if (interval > spin)
+  {
+    uint64_t wake = deadline - spin;
+    struct timespec tm = { .tv_sec = (time_t) (wake / IOT_TIME_NANOS_PER_SEC), .tv_nsec = (long) (wake % IOT_TIME_NANOS_PER_SEC) };
+    while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &tm, NULL) == EINTR);
+    now = iot_time_clock_nsecs (CLOCK_MONOTONIC);
+    spin = (spin * 7U + 2U * (now - wake)) / 8U;
+    spin = (spin < IOT_TIME_SPIN_MIN) ? IOT_TIME_SPIN_MIN : ((spin > IOT_TIME_SPIN_MAX) ? IOT_TIME_SPIN_MAX : spin);
+    atomic_store_explicit (&iot_time_spin, spin, memory_order_relaxed);
+  }
+  while (now < deadline) now = iot_time_clock_nsecs (CLOCK_MONOTONIC);
+}
+
+void iot_wait_precise_usecs (uint64_t interval)
+{
+  iot_wait_precise_nsecs (interval * IOT_TIME_NANOS_PER_MIC);
+}
+
 void iot_wait_usecs (uint64_t interval)
 {
   struct timespec tm = { .tv_sec = (time_t) (interval / 1000000), .tv_nsec = (long) (1000 * (interval % 1000000)) };
@@ -0,0 +1,22 @@
+//
+// Copyright (c) 2023 IOTech Ltd
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+
+#ifndef _IOT_TRACE_IMPL_H_
+#define _IOT_TRACE_IMPL_H_
+
+#include "iot/defs.h"
+#include "iot/trace.h"
+
+// Library tracepoints, a relaxed load and branch when recording disabled, removed if IOT_HAS_TRACE not defined
+
+#ifdef IOT_HAS_TRACE
+extern _Atomic bool iot_trace_active;
+#define IOT_TRACE(e,a) do { if (atomic_load_explicit (&iot_trace_active, memory_order_relaxed)) iot_trace_event ((e), (uint64_t) (a)); } while (0)
+#else
+#define IOT_TRACE(e,a)
+#endif
+
+#endif
@@ -0,0 +1,257 @@
+//
+// Copyright (c) 2023 IOTech Ltd
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+#include "iot/thread.h"
+#include "trace-impl.h"
+#ifndef __ZEPHYR__
+#include <signal.h>
+#endif
+
+// Each thread records into its own ring, so recording needs no atomic read-modify-write operations.
+// Each record holds a sequence number, cleared while the record is written, so a dump can discard
+// records overwritten while copied. Rings are held on a global list, from which rings of exited
+// threads are reclaimed.
+
+#define IOT_TRACE_RING_MASK (IOT_TRACE_RING_SIZE - 1u)
+#define IOT_TRACE_EVENTS (IOT_TRACE_DATA_BLOCK_ALLOC + 1)
+
+typedef struct iot_trace_record_t
+{
+  _Atomic uint64_t seq;                 // Record index in ring, UINT64_MAX while written
+  _Atomic uint64_t ts;                  // Monotonic time, in ns
+  _Atomic uint64_t arg;                 // Event argument
+  _Atomic uint32_t event;               // Event type
+  _Atomic uint32_t tid;                 // Recording thread id
+} iot_trace_record_t;
+
+typedef struct iot_trace_ring_t
+{
+  struct iot_trace_ring_t * next;       // Next ring in global list
+  _Atomic bool owned;                   // Whether in use by a thread
+  _Atomic uint64_t head;                // Number of records written
+  _Atomic uint64_t start;               // Number of records written when last cleared
+  iot_trace_record_t records[IOT_TRACE_RING_SIZE];
+} iot_trace_ring_t;
+
+typedef struct iot_trace_info_t
+{
+  const char * name;
+  const char * cat;
+  const char * ph;
+} iot_trace_info_t;
+
+static const iot_trace_info_t iot_trace_info[IOT_TRACE_EVENTS] =
+{
+  { "job", "threadpool", "B" },
+  { "job", "threadpool", "E" },
+  { "schedule", "scheduler", "i" },
+  { "enqueue", "queue", "i" },
+  { "dequeue", "queue", "i" },
+  { "block_alloc", "data", "i" }
+};
+
+_Atomic bool iot_trace_active = false;
+static _Atomic (iot_trace_ring_t*) iot_trace_rings = NULL;
+static _Atomic uint32_t iot_trace_tids = 0u;
+static _Thread_local iot_trace_ring_t * iot_trace_ring = NULL;
+static _Thread_local uint32_t iot_trace_tid = 0u;
+static pthread_key_t iot_trace_key;
+#ifndef __ZEPHYR__
+static pthread_mutex_t iot_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int iot_trace_pipe[2] = { -1, -1 };
+static char * iot_trace_path = NULL;
+#endif
+
+static void iot_trace_ring_release (void * arg)
+{
+  atomic_store (&((iot_trace_ring_t*) arg)->owned, false);
+}
+
+__attribute__((constructor)) static void iot_trace_init (void)
+{
+  pthread_key_create (&iot_trace_key, iot_trace_ring_release);
+}
+
+static iot_trace_ring_t * iot_trace_ring_claim (void)
+{
+  iot_trace_ring_t * ring;
+  for (ring = atomic_load (&iot_trace_rings); ring; ring = ring->next)
+  {
+    bool owned = false;
+    if (atomic_compare_exchange_strong (&ring->owned, &owned, true)) break;
+  }
+  if (ring == NULL)
+  {
+    ring = calloc (1, sizeof (*ring));
+    atomic_store (&ring->owned, true);
+    ring->next = atomic_load (&iot_trace_rings);
+    while (! atomic_compare_exchange_weak (&iot_trace_rings, &ring->next, ring));
+  }
+  iot_trace_tid = atomic_fetch_add (&iot_trace_tids, 1u) + 1u;
+  pthread_setspecific (iot_trace_key, ring);
+  return ring;
+}
+
+static inline uint64_t iot_trace_nsecs (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+void iot_trace_enable (bool enable)
+{
+  atomic_store (&iot_trace_active, enable);
+}
+
+bool iot_trace_enabled (void)
+{
+  return atomic_load (&iot_trace_active);
+}
+
+void iot_trace_event (iot_trace_event_t event, uint64_t arg)
+{
+  assert (event < IOT_TRACE_EVENTS);
+  if (! atomic_load_explicit (&iot_trace_active, memory_order_relaxed)) return;
+  iot_trace_ring_t * ring = iot_trace_ring ? iot_trace_ring : (iot_trace_ring = iot_trace_ring_claim ());
+  uint64_t head = atomic_load_explicit (&ring->head, memory_order_relaxed);
+  iot_trace_record_t * rec = &ring->records[head & IOT_TRACE_RING_MASK];
+  atomic_store_explicit (&rec->seq, UINT64_MAX, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);
+  atomic_store_explicit (&rec->ts, iot_trace_nsecs (), memory_order_relaxed);
+  atomic_store_explicit (&rec->arg, arg, memory_order_relaxed);
+  atomic_store_explicit (&rec->event, (uint32_t) event, memory_order_relaxed);
+  atomic_store_explicit (&rec->tid, iot_trace_tid, memory_order_relaxed);
+  atomic_store_explicit (&rec->seq, head, memory_order_release);
+  atomic_store_explicit (&ring->head, head + 1u, memory_order_release);
+}
+
+void iot_trace_clear (void)
+{
+  for (iot_trace_ring_t * ring = atomic_load (&iot_trace_rings); ring; ring = ring->next)
+  {
+    atomic_store (&ring->start, atomic_load (&ring->head));
+  }
+}
+
+// Copy the records of a ring not overwritten during the copy
+
+static uint32_t iot_trace_ring_copy (iot_trace_ring_t * ring, iot_trace_record_t * out)
+{
+  uint32_t count = 0u;
+  uint64_t head = atomic_load_explicit (&ring->head, memory_order_acquire);
+  uint64_t from = atomic_load (&ring->start);
+  if (head > IOT_TRACE_RING_SIZE && from < head - IOT_TRACE_RING_SIZE) from = head - IOT_TRACE_RING_SIZE;
+  for (uint64_t i = from; i < head; i++)
+  {
+    iot_trace_record_t * rec = &ring->records[i & IOT_TRACE_RING_MASK];
+    iot_trace_record_t * copy = &out[count];
+    if (atomic_load_explicit (&rec->seq, memory_order_acquire) != i) continue;
+    atomic_store_explicit (&copy->ts, atomic_load_explicit (&rec->ts, memory_order_relaxed), memory_order_relaxed);
+    atomic_store_explicit (&copy->arg, atomic_load_explicit (&rec->arg, memory_order_relaxed), memory_order_relaxed);
+    atomic_store_explicit (&copy->event, atomic_load_explicit (&rec->event, memory_order_relaxed), memory_order_relaxed);
+    atomic_store_explicit (&copy->tid, atomic_load_explicit (&rec->tid, memory_order_relaxed), memory_order_relaxed);
+    atomic_thread_fence (memory_order_acquire);
+    if (atomic_load_explicit (&rec->seq, memory_order_relaxed) == i) count++;
+  }
+  return count;
+}
+
+bool iot_trace_dump (FILE * file)
+{
+  assert (file);
+  iot_trace_record_t * buff = malloc (IOT_TRACE_RING_SIZE * sizeof (*buff));
+  const char * sep = "\n";
+  long pid = (long) getpid ();
+
+  fprintf (file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  for (iot_trace_ring_t * ring = atomic_load (&iot_trace_rings); ring; ring = ring->next)
+  {
+    uint32_t count = iot_trace_ring_copy (ring, buff);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      const iot_trace_record_t * rec = &buff[i];
+      const iot_trace_info_t * info = &iot_trace_info[atomic_load_explicit (&rec->event, memory_order_relaxed)];
+      uint64_t ts = atomic_load_explicit (&rec->ts, memory_order_relaxed);
+      fprintf (file, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\",%s\"ts\":%" PRIu64 ".%03u,\"pid\":%ld,\"tid\":%" PRIu32 ",\"args\":{\"arg\":%" PRIu64 "}}",
+        sep, info->name, info->cat, info->ph, (info->ph[0] == 'i') ? "\"s\":\"t\"," : "", ts / 1000u, (unsigned) (ts % 1000u), pid,
+        atomic_load_explicit (&rec->tid, memory_order_relaxed), atomic_load_explicit (&rec->arg, memory_order_relaxed));
+      sep = ",\n";
+    }
+  }
+  fprintf (file, "\n]}\n");
+  free (buff);
+  return (fflush (file) == 0) && ! ferror (file);
+}
+
+bool iot_trace_dump_path (const char * path)
+{
+  assert (path);
+  FILE * file = fopen (path, "w");
+  bool ok = (file != NULL);
+  if (ok)
+  {
+    ok = iot_trace_dump (file);
+    ok = (fclose (file) == 0) && ok;
+  }
+  return ok;
+}
+
+#ifndef __ZEPHYR__
+static void iot_trace_signal (int signum)
+{
+  (void) signum;
+  int err = errno;
+  ssize_t ret = write (iot_trace_pipe[1], "", 1u);
+  (void) ret;
+  errno = err;
+}
+
+static void * iot_trace_signal_thread (void * arg)
+{
+  char c;
+  (void) arg;
+  while (read (iot_trace_pipe[0], &c, 1u) == 1)
+  {
+    pthread_mutex_lock (&iot_trace_mutex);
+    iot_trace_dump_path (iot_trace_path);
+    pthread_mutex_unlock (&iot_trace_mutex);
+  }
+  return NULL;
+}
+#endif
+
+bool iot_trace_dump_on_signal (int signum, const char * path)
+{
+  assert (path);
+#ifdef __ZEPHYR__
+  (void) signum;
+  return false;
+#else
+  struct sigaction action = { .sa_handler = iot_trace_signal, .sa_flags = SA_RESTART };
+  bool ok = true;
+  pthread_mutex_lock (&iot_trace_mutex);
+  if (iot_trace_pipe[0] == -1)
+  {
+    ok = (pipe (iot_trace_pipe) == 0);
+    if (ok && ! iot_thread_create (NULL, iot_trace_signal_thread, NULL, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL))
+    {
+      close (iot_trace_pipe[0]);
+      close (iot_trace_pipe[1]);
+      iot_trace_pipe[0] = iot_trace_pipe[1] = -1;
+      ok = false;
+    }
+  }
+  if (ok)
+  {
+    free (iot_trace_path);
+    iot_trace_path = strdup (path);
+    sigemptyset (&action.sa_mask);
+    ok = (sigaction (signum, &action, NULL) == 0);
+  }
+  pthread_mutex_unlock (&iot_trace_mutex);
+  return ok;
+#endif
+}
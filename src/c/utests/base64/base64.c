@@ -7,6 +7,8 @@
 
 #include "base64.h"
 #include "CUnit.h"
+#include "../../base64-impl.h"
+#include "../../cpu-impl.h"
 
 static int suite_init (void)
 {
@@ -46,8 +48,149 @@ static void test_rtrip1 (void)
   }
 }
 
+#define BASE64_LONG_LEN 1000
+
+static void test_reference_encode (const uint8_t * in, size_t len, char * out)
+{
+  static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  for (size_t i = 0; i < len; i += 3)
+  {
+    uint32_t n = (uint32_t) in[i] << 16;
+    if ((i + 1) < len) n |= (uint32_t) in[i + 1] << 8;
+    if ((i + 2) < len) n |= in[i + 2];
+    *out++ = chars[(n >> 18) & 63];
+    *out++ = chars[(n >> 12) & 63];
+    *out++ = ((i + 1) < len) ? chars[(n >> 6) & 63] : '=';
+    *out++ = ((i + 2) < len) ? chars[n & 63] : '=';
+  }
+  *out = '\0';
+}
+
+static void test_long (void)
+{
+  uint8_t * input = malloc (BASE64_LONG_LEN);
+  uint8_t * decoded = malloc (BASE64_LONG_LEN);
+  char * encoded = malloc (iot_b64_encodesize (BASE64_LONG_LEN));
+  char * expected = malloc (iot_b64_encodesize (BASE64_LONG_LEN));
+  char * lines = malloc (2 * iot_b64_encodesize (BASE64_LONG_LEN));
+  size_t outlen;
+
+  srandom (11);
+  for (unsigned i = 0; i < BASE64_LONG_LEN; i++)
+  {
+    input[i] = (uint8_t) (random () % 256);
+  }
+
+  for (size_t size = 0; size <= BASE64_LONG_LEN; size += (size < 200) ? 1 : 37)
+  {
+    test_reference_encode (input, size, expected);
+    CU_ASSERT (iot_b64_encode (input, size, encoded, iot_b64_encodesize (size)))
+    CU_ASSERT (strcmp (encoded, expected) == 0)
+    outlen = size;
+    CU_ASSERT (iot_b64_decode (encoded, decoded, &outlen))
+    CU_ASSERT (size == outlen)
+    CU_ASSERT (memcmp (input, decoded, size) == 0)
+
+    // Output buffer one byte too small
+
+    if (size)
+    {
+      outlen = size - 1;
+      CU_ASSERT (! iot_b64_decode (encoded, decoded, &outlen))
+    }
+
+    // Line breaks every 76 characters
+
+    char * dst = lines;
+    for (size_t i = 0; encoded[i]; i++)
+    {
+      if (i && (i % 76) == 0) *dst++ = '\n';
+      *dst++ = encoded[i];
+    }
+    *dst = '\0';
+    outlen = size;
+    CU_ASSERT (iot_b64_decode (lines, decoded, &outlen))
+    CU_ASSERT (size == outlen)
+    CU_ASSERT (memcmp (input, decoded, size) == 0)
+
+    CU_ASSERT (iot_b64_decode_in_place (lines, &outlen))
+    CU_ASSERT (size == outlen)
+    CU_ASSERT (memcmp (input, lines, size) == 0)
+
+    // Invalid character
+
+    if (size > 100)
+    {
+      encoded[size / 2] = '!';
+      outlen = size;
+      CU_ASSERT (! iot_b64_decode (encoded, decoded, &outlen))
+    }
+  }
+  free (lines);
+  free (expected);
+  free (encoded);
+  free (decoded);
+  free (input);
+}
+
+#define BASE64_VARIANT_LEN 600
+
+static void test_variants (void)
+{
+  static const uint32_t variants[] = { IOT_CPU_SSSE3, IOT_CPU_SSSE3 | IOT_CPU_AVX2, IOT_CPU_NEON };
+  uint8_t * input = malloc (BASE64_VARIANT_LEN + 3);
+  uint8_t * decoded = malloc (BASE64_VARIANT_LEN);
+  uint8_t * portable_decoded = malloc (BASE64_VARIANT_LEN);
+  char * encoded = malloc (iot_b64_encodesize (BASE64_VARIANT_LEN) + 3);
+  char * portable = malloc (iot_b64_encodesize (BASE64_VARIANT_LEN) + 3);
+  size_t outlen;
+  size_t portable_len;
+
+  srandom (17);
+  for (unsigned i = 0; i < BASE64_VARIANT_LEN + 3; i++)
+  {
+    input[i] = (uint8_t) (random () % 256);
+  }
+
+  for (unsigned v = 0; v < sizeof (variants) / sizeof (variants[0]); v++)
+  {
+    if (! iot_cpu_has (variants[v])) continue;
+    for (size_t size = 0; size <= BASE64_VARIANT_LEN; size += (size < 130) ? 1 : 47)
+    {
+      for (size_t offset = 0; offset < 3; offset++) // Unaligned input
+      {
+        size_t enclen = iot_b64_encodesize (size);
+        iot_b64_select (0u);
+        CU_ASSERT (iot_b64_encode (input + offset, size, portable, enclen))
+        iot_b64_select (variants[v]);
+        CU_ASSERT (iot_b64_encode (input + offset, size, encoded + offset, enclen))
+        CU_ASSERT (strcmp (encoded + offset, portable) == 0)
+
+        if (size > 64) // Invalid, whitespace and padding characters within vector blocks
+        {
+          portable[(size * 7) % (enclen - 5)] = (offset == 0) ? '!' : ((offset == 1) ? '\n' : '=');
+        }
+        outlen = portable_len = size;
+        iot_b64_select (0u);
+        bool portable_ok = iot_b64_decode (portable, portable_decoded, &portable_len);
+        iot_b64_select (variants[v]);
+        CU_ASSERT (iot_b64_decode (portable, decoded, &outlen) == portable_ok)
+        CU_ASSERT (! portable_ok || (outlen == portable_len && memcmp (decoded, portable_decoded, outlen) == 0))
+      }
+    }
+  }
+  iot_b64_select (iot_cpu_features ());
+  free (portable);
+  free (encoded);
+  free (portable_decoded);
+  free (decoded);
+  free (input);
+}
+
 void cunit_base64_test_init (void)
 {
   CU_pSuite suite = CU_add_suite ("base64", suite_init, suite_clean);
   CU_add_test (suite, "test_rtrip1", test_rtrip1);
+  CU_add_test (suite, "test_long", test_long);
+  CU_add_test (suite, "test_variants", test_variants);
 }
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2024
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "bus.h"
+#include "CUnit.h"
+#include "iot/bus.h"
+#include "iot/container.h"
+#include "iot/thread.h"
+#include "iot/time.h"
+
+#define BUS_PUSHES 1000u
+
+typedef struct bus_sub_t
+{
+  atomic_uint count;
+  atomic_uint errors;
+  _Atomic int32_t last;
+  const iot_data_t * expected;
+  const char * topic;
+} bus_sub_t;
+
+static const char * bus_config =
+"{"
+  "\"pool\":\"IOT::ThreadPool\","
+  "\"sched\":\"IOT::Scheduler\","
+  "\"bus\":\"IOT::Bus\""
+"}";
+
+static const char * bus_pool_config =
+"{"
+  "\"Threads\":2"
+"}";
+
+static const char * bus_sched_config =
+"{"
+"}";
+
+static const char * bus_bus_config =
+"{"
+  "\"ThreadPool\":\"pool\","
+  "\"Scheduler\":\"sched\","
+  "\"Interval\":10,"
+  "\"QueueSize\":16"
+"}";
+
+static int suite_init (void)
+{
+  return 0;
+}
+
+static int suite_clean (void)
+{
+  return 0;
+}
+
+static char * bus_loader (const char * name, const char * uri)
+{
+  (void) uri;
+  if (strcmp (name, "bus") == 0) return strdup (bus_bus_config);
+  if (strcmp (name, "pool") == 0) return strdup (bus_pool_config);
+  if (strcmp (name, "sched") == 0) return strdup (bus_sched_config);
+  return strdup (bus_config);
+}
+
+static void bus_count (iot_data_t * data, void * self, const char * match)
+{
+  bus_sub_t * sub = (bus_sub_t*) self;
+  if (sub->expected && data != sub->expected) atomic_fetch_add (&sub->errors, 1u); // Delivered by reference
+  if (sub->topic && strcmp (match, sub->topic) != 0) atomic_fetch_add (&sub->errors, 1u);
+  atomic_fetch_add (&sub->count, 1u);
+}
+
+static void bus_order (iot_data_t * data, void * self, const char * match)
+{
+  (void) match;
+  bus_sub_t * sub = (bus_sub_t*) self;
+  int32_t val = iot_data_i32 (data);
+  if (val != atomic_load (&sub->last) + 1) atomic_fetch_add (&sub->errors, 1u);
+  atomic_store (&sub->last, val);
+  atomic_fetch_add (&sub->count, 1u);
+}
+
+static iot_data_t * bus_poll (void * self)
+{
+  atomic_fetch_add ((atomic_uint*) self, 1u);
+  return iot_data_alloc_i32 (1);
+}
+
+static bool bus_wait_count (atomic_uint * count, uint32_t expected)
+{
+  for (uint32_t i = 0; i < 200u && atomic_load (count) < expected; i++) iot_wait_msecs (10u);
+  return atomic_load (count) >= expected;
+}
+
+static void cunit_bus_topics (void)
+{
+  bus_sub_t sub = { .count = 0u };
+  iot_bus_t * bus = iot_bus_alloc (NULL, NULL, 0u);
+  CU_ASSERT (iot_bus_sub_alloc (bus, &sub, bus_count, "") == NULL)
+  CU_ASSERT (iot_bus_sub_alloc (bus, &sub, bus_count, "a/#/b") == NULL)
+  CU_ASSERT (iot_bus_sub_alloc (bus, &sub, bus_count, "a/b+") == NULL)
+  CU_ASSERT (iot_bus_sub_alloc (bus, &sub, bus_count, "a/##") == NULL)
+  CU_ASSERT (iot_bus_pub_alloc (bus, NULL, NULL, "a/+") == NULL)
+  CU_ASSERT (iot_bus_pub_alloc (bus, NULL, NULL, "a/#") == NULL)
+  CU_ASSERT (iot_bus_pub_alloc (bus, NULL, NULL, NULL) == NULL)
+  iot_bus_sub_t * s = iot_bus_sub_alloc (bus, &sub, bus_count, "+/b/#");
+  CU_ASSERT (s != NULL)
+  iot_bus_sub_free (s);
+  iot_bus_free (bus);
+}
+
+static void cunit_bus_match (void)
+{
+  static const char * patterns[] = { "a/b", "a/+", "a/#", "#", "+/c", "+/+", "x/y", "a/b/c", "+", "a/+/c" };
+  static const uint32_t expected[] = { 1u, 2u, 4u, 5u, 1u, 2u, 0u, 1u, 2u, 1u };
+  static const char * topics[] = { "a/b", "a/c", "a", "a/b/c", "q" };
+  bus_sub_t subs[10];
+  iot_bus_pub_t * pubs[5];
+  memset (subs, 0, sizeof (subs));
+  iot_bus_t * bus = iot_bus_alloc (NULL, NULL, 0u);
+  iot_bus_start (bus);
+  for (uint32_t i = 0; i < 5u; i++) pubs[i] = iot_bus_pub_alloc (bus, NULL, NULL, topics[i]);
+  for (uint32_t i = 0; i < 10u; i++) CU_ASSERT (iot_bus_sub_alloc (bus, &subs[i], bus_count, patterns[i]) != NULL)
+  for (uint32_t i = 0; i < 5u; i++)
+  {
+    CU_ASSERT (iot_bus_pub_push (pubs[i], iot_data_alloc_i32 ((int32_t) i), false))
+  }
+  for (uint32_t i = 0; i < 10u; i++)
+  {
+    CU_ASSERT (atomic_load (&subs[i].count) == expected[i])
+  }
+  iot_data_t * stats = iot_bus_stats (bus);
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "publishers")) == 5u)
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "subscribers")) == 10u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "published")) == 5u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "delivered")) == 19u)
+  iot_data_free (stats);
+  iot_bus_pub_free (pubs[0]);
+  iot_bus_free (bus); // Frees remaining publishers and subscribers
+}
+
+static void cunit_bus_sub_free (void)
+{
+  bus_sub_t sub1 = { .count = 0u };
+  bus_sub_t sub2 = { .count = 0u };
+  iot_bus_t * bus = iot_bus_alloc (NULL, NULL, 0u);
+  iot_bus_start (bus);
+  iot_bus_pub_t * pub = iot_bus_pub_alloc (bus, NULL, NULL, "a/b");
+  iot_bus_sub_t * s1 = iot_bus_sub_alloc (bus, &sub1, bus_count, "a/+");
+  CU_ASSERT (iot_bus_pub_push (pub, iot_data_alloc_i32 (1), false))
+  iot_bus_sub_alloc (bus, &sub2, bus_count, "a/+"); // Match cache updated
+  CU_ASSERT (iot_bus_pub_push (pub, iot_data_alloc_i32 (2), false))
+  iot_bus_sub_free (s1);
+  CU_ASSERT (iot_bus_pub_push (pub, iot_data_alloc_i32 (3), false))
+  CU_ASSERT (atomic_load (&sub1.count) == 2u)
+  CU_ASSERT (atomic_load (&sub2.count) == 2u)
+  iot_bus_stop (bus);
+  CU_ASSERT (! iot_bus_pub_push (pub, iot_data_alloc_i32 (4), false))
+  CU_ASSERT (atomic_load (&sub2.count) == 2u)
+  iot_bus_free (bus);
+}
+
+static void cunit_bus_pool (void)
+{
+  bus_sub_t sub1 = { .count = 0u, .errors = 0u, .last = 0 };
+  bus_sub_t sub2 = { .count = 0u, .errors = 0u, .last = 0 };
+  iot_threadpool_t * pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_bus_t * bus = iot_bus_alloc (NULL, pool, 0u);
+  iot_bus_set_queue_size (bus, 8u);
+  iot_threadpool_start (pool);
+  iot_bus_start (bus);
+  iot_bus_pub_t * pub = iot_bus_pub_alloc (bus, NULL, NULL, "data/seq");
+  iot_bus_sub_alloc (bus, &sub1, bus_order, "data/seq");
+  iot_bus_sub_alloc (bus, &sub2, bus_order, "data/#");
+  for (uint32_t i = 1; i <= BUS_PUSHES; i++)
+  {
+    CU_ASSERT (iot_bus_pub_push (pub, iot_data_alloc_i32 ((int32_t) i), true)) // Waits for space
+  }
+  CU_ASSERT (bus_wait_count (&sub1.count, BUS_PUSHES))
+  CU_ASSERT (bus_wait_count (&sub2.count, BUS_PUSHES))
+  CU_ASSERT (atomic_load (&sub1.count) == BUS_PUSHES)
+  CU_ASSERT (atomic_load (&sub1.errors) == 0u) // Delivered in order
+  CU_ASSERT (atomic_load (&sub2.errors) == 0u)
+  iot_data_t * stats = iot_bus_stats (bus);
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "delivered")) == 2u * BUS_PUSHES)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "dropped")) == 0u)
+  iot_data_free (stats);
+  iot_bus_free (bus);
+  iot_threadpool_free (pool);
+}
+
+static void cunit_bus_shared (void)
+{
+  bus_sub_t sub1 = { .count = 0u, .errors = 0u, .topic = "shared/data" };
+  bus_sub_t sub2 = { .count = 0u, .errors = 0u, .topic = "shared/data" };
+  iot_threadpool_t * pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_bus_t * bus = iot_bus_alloc (NULL, pool, 0u);
+  iot_threadpool_start (pool);
+  iot_bus_start (bus);
+  iot_bus_pub_t * pub = iot_bus_pub_alloc (bus, NULL, NULL, "shared/data");
+  iot_bus_sub_alloc (bus, &sub1, bus_count, "shared/+");
+  iot_bus_sub_alloc (bus, &sub2, bus_count, "+/data");
+  iot_data_t * data = iot_data_alloc_string ("payload", IOT_DATA_REF);
+  sub1.expected = data;
+  sub2.expected = data;
+  iot_data_add_ref (data);
+  CU_ASSERT (iot_bus_pub_push (pub, data, false))
+  CU_ASSERT (bus_wait_count (&sub1.count, 1u))
+  CU_ASSERT (bus_wait_count (&sub2.count, 1u))
+  CU_ASSERT (atomic_load (&sub1.errors) == 0u)
+  CU_ASSERT (atomic_load (&sub2.errors) == 0u)
+  iot_data_free (data);
+  iot_bus_free (bus);
+  iot_threadpool_free (pool);
+}
+
+static void cunit_bus_drop (void)
+{
+  bus_sub_t sub = { .count = 0u };
+  iot_threadpool_t * pool = iot_threadpool_alloc (1u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_bus_t * bus = iot_bus_alloc (NULL, pool, 0u);
+  iot_bus_set_queue_size (bus, 4u);
+  iot_bus_start (bus);
+  iot_bus_pub_t * pub = iot_bus_pub_alloc (bus, NULL, NULL, "drop");
+  iot_bus_sub_alloc (bus, &sub, bus_count, "drop");
+  for (uint32_t i = 0; i < 10u; i++)
+  {
+    CU_ASSERT (iot_bus_pub_push (pub, iot_data_alloc_i32 ((int32_t) i), false) == (i < 4u)) // Pool not started
+  }
+  iot_data_t * stats = iot_bus_stats (bus);
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "dropped")) == 6u)
+  iot_data_free (stats);
+  iot_threadpool_start (pool);
+  CU_ASSERT (bus_wait_count (&sub.count, 4u))
+  iot_wait_msecs (20u);
+  CU_ASSERT (atomic_load (&sub.count) == 4u)
+  iot_bus_free (bus);
+  iot_threadpool_free (pool);
+}
+
+static void cunit_bus_poll (void)
+{
+  bus_sub_t sub = { .count = 0u };
+  atomic_uint polls = 0u;
+  iot_scheduler_t * scheduler = iot_scheduler_alloc (IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_bus_t * bus = iot_bus_alloc (scheduler, NULL, IOT_MS_TO_NS (10u));
+  iot_bus_sub_alloc (bus, &sub, bus_count, "poll/#");
+  iot_bus_pub_t * pub = iot_bus_pub_alloc (bus, &polls, bus_poll, "poll/value");
+  iot_scheduler_start (scheduler);
+  iot_wait_msecs (50u);
+  CU_ASSERT (atomic_load (&polls) == 0u) // Not polled until bus started
+  iot_bus_start (bus);
+  CU_ASSERT (bus_wait_count (&sub.count, 5u))
+  iot_bus_pub_free (pub);
+  uint32_t count = atomic_load (&sub.count);
+  iot_wait_msecs (50u);
+  CU_ASSERT (atomic_load (&sub.count) == count)
+  iot_bus_free (bus);
+  iot_scheduler_free (scheduler);
+}
+
+static void cunit_bus_component (void)
+{
+  static iot_container_config_t config = { .load = bus_loader, .uri = NULL, .save = NULL };
+  bus_sub_t sub = { .count = 0u };
+  atomic_uint polls = 0u;
+  iot_container_t * cont = iot_container_alloc ("buses");
+  iot_component_factory_add (iot_threadpool_factory ());
+  iot_component_factory_add (iot_scheduler_factory ());
+  iot_component_factory_add (iot_bus_factory ());
+  iot_container_config (&config);
+  CU_ASSERT (iot_container_init (cont))
+  iot_bus_t * bus = (iot_bus_t*) iot_container_find_component (cont, "bus");
+  CU_ASSERT (bus != NULL)
+  if (bus)
+  {
+    iot_bus_sub_alloc (bus, &sub, bus_count, "comp/+");
+    iot_bus_pub_alloc (bus, &polls, bus_poll, "comp/poll");
+    iot_container_start (cont);
+    CU_ASSERT (((iot_component_t*) bus)->state == IOT_COMPONENT_RUNNING)
+    CU_ASSERT (bus_wait_count (&sub.count, 3u))
+    iot_container_stop (cont);
+  }
+  iot_container_free (cont);
+}
+
+void cunit_bus_test_init (void)
+{
+  CU_pSuite suite = CU_add_suite ("bus", suite_init, suite_clean);
+  CU_add_test (suite, "bus_topics", cunit_bus_topics);
+  CU_add_test (suite, "bus_match", cunit_bus_match);
+  CU_add_test (suite, "bus_sub_free", cunit_bus_sub_free);
+  CU_add_test (suite, "bus_pool", cunit_bus_pool);
+  CU_add_test (suite, "bus_shared", cunit_bus_shared);
+  CU_add_test (suite, "bus_drop", cunit_bus_drop);
+  CU_add_test (suite, "bus_poll", cunit_bus_poll);
+  CU_add_test (suite, "bus_component", cunit_bus_component);
+}
@@ -0,0 +1,13 @@
+/*
+ * Copyright (c) 2024
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _CUTIL_UTEST_BUS_H_
+#define _CUTIL_UTEST_BUS_H_
+
+extern void cunit_bus_test_init (void);
+
+#endif
@@ -8,6 +8,8 @@
 #include "cont.h"
 #include "CUnit.h"
 #include "iot/config.h"
+#include "iot/scheduler.h"
+#include "iot/thread.h"
 
 static const char * main_config =
 "{"
@@ -44,6 +46,47 @@ static const char * bad_logger_config_4 =
   "\"Level\":\"Info\""
   "}";
 
+static const char * parallel_config =
+"{"
+  "\"logger\":\"IOT::Logger\","
+  "\"pool\":\"IOT::ThreadPool\","
+  "\"scheduler\":\"IOT::Scheduler\","
+  "\"other\":\"IOT::Logger\""
+"}";
+
+static const char * parallel_pool_config =
+"{"
+  "\"Threads\":2,"
+  "\"Logger\":\"logger\""
+"}";
+
+static const char * parallel_scheduler_config =
+"{"
+  "\"Logger\":\"other\""
+"}";
+
+static const char * parallel_logger_config =
+"{"
+  "\"Name\":\"other\","
+  "\"Level\":\"Info\","
+  "\"Next\":\"logger\""
+"}";
+
+static atomic_uint parallel_loads;
+static bool parallel_done = false;
+
+static char * parallel_loader (const char * name, const char * uri)
+{
+  (void) uri;
+  atomic_fetch_add (&parallel_loads, 1u);
+  if (parallel_done) return strdup ("{}");
+  if (strcmp (name, "parallel") == 0) return strdup (parallel_config);
+  if (strcmp (name, "pool") == 0) return strdup (parallel_pool_config);
+  if (strcmp (name, "scheduler") == 0) return strdup (parallel_scheduler_config);
+  if (strcmp (name, "other") == 0) return strdup (parallel_logger_config);
+  return strdup (logger_config);
+}
+
 static bool running_called = false;
 static bool stopping_called = false;
 
@@ -143,6 +186,273 @@ static void test_delete_component (void)
   iot_container_free (cont);
 }
 
+static void test_many_components (void)
+{
+  char name[16];
+  iot_container_t * cont = iot_container_alloc ("test");
+  iot_component_factory_add (iot_logger_factory ());
+  CU_ASSERT (iot_component_factory_find (IOT_LOGGER_TYPE) == iot_logger_factory ())
+  CU_ASSERT (iot_component_factory_find ("Nope") == NULL)
+  for (int i = 0; i < 300; i++)
+  {
+    snprintf (name, sizeof (name), "logger%d", i);
+    iot_container_add_component (cont, IOT_LOGGER_TYPE, name, logger_config);
+  }
+  for (int i = 0; i < 300; i++)
+  {
+    snprintf (name, sizeof (name), "logger%d", i);
+    const iot_component_t * comp = iot_container_find_component (cont, name);
+    CU_ASSERT (comp && strcmp (comp->name, name) == 0)
+  }
+  iot_container_add_component (cont, IOT_LOGGER_TYPE, "logger7", logger_config);
+  iot_component_t * comp = iot_container_find_component (cont, "logger7");
+  iot_container_delete_component (cont, "logger7");
+  iot_component_t * prev = iot_container_find_component (cont, "logger7");
+  CU_ASSERT (prev != NULL)
+  CU_ASSERT (prev != comp)
+  iot_container_delete_component (cont, "logger7");
+  CU_ASSERT (iot_container_find_component (cont, "logger7") == NULL)
+  CU_ASSERT (iot_container_find_component (cont, "logger8") != NULL)
+  iot_data_t * list = iot_container_list_components (cont, NULL);
+  CU_ASSERT (iot_data_list_length (list) == 299u)
+  iot_data_free (list);
+  iot_container_free (cont);
+}
+
+static iot_data_t * delta_seen = NULL;
+static unsigned delta_calls = 0u;
+
+static void delta_start (iot_component_t * comp)
+{
+  iot_component_set_running (comp);
+}
+
+static void delta_stop (iot_component_t * comp)
+{
+  iot_component_set_stopped (comp);
+}
+
+static void delta_free (iot_component_t * comp)
+{
+  iot_component_fini (comp);
+  free (comp);
+}
+
+static bool delta_reconfig (iot_component_t * comp, iot_container_t * cont, const iot_data_t * config, const iot_data_t * delta)
+{
+  (void) comp;
+  (void) cont;
+  CU_ASSERT (iot_data_string_map_get_i64 (config, "Count", 0) == 2)
+  iot_data_free (delta_seen);
+  delta_seen = iot_data_add_ref (delta);
+  delta_calls++;
+  return true;
+}
+
+static iot_component_t * delta_config (iot_container_t * cont, const iot_data_t * map)
+{
+  (void) cont;
+  (void) map;
+  iot_component_t * comp = calloc (1, sizeof (*comp));
+  iot_component_init (comp, iot_component_factory_find ("Test::Delta"), delta_start, delta_stop);
+  return comp;
+}
+
+static void test_reconfig_delta (void)
+{
+  static iot_component_factory_t factory = { "Test::Delta", IOT_CATEGORY_USER, delta_config, delta_free, NULL, NULL, delta_reconfig };
+  iot_container_t * cont = iot_container_alloc ("delta");
+  iot_component_factory_add (&factory);
+  iot_container_add_component (cont, "Test::Delta", "delta", "{\"Count\":1,\"Name\":\"one\"}");
+  iot_component_t * comp = iot_container_find_component (cont, "delta");
+  CU_ASSERT (comp != NULL)
+  if (comp)
+  {
+    iot_data_t * map = iot_data_from_json ("{\"Count\":2,\"Name\":\"one\",\"Extra\":true}");
+    CU_ASSERT (iot_component_reconfig (comp, cont, map))
+    CU_ASSERT (delta_calls == 1u)
+    CU_ASSERT (iot_data_list_length (iot_data_string_map_get (delta_seen, "changed")) == 1u)
+    CU_ASSERT (iot_data_list_length (iot_data_string_map_get (delta_seen, "added")) == 1u)
+    CU_ASSERT (iot_data_string_map_get_i64 (comp->config, "Count", 0) == 2)
+    CU_ASSERT (iot_component_reconfig (comp, cont, map)) // No change, so component not reconfigured
+    CU_ASSERT (delta_calls == 1u)
+    iot_data_free (map);
+  }
+  iot_data_free (delta_seen);
+  delta_seen = NULL;
+  iot_container_free (cont);
+}
+
+static void * state_waiter (void * arg)
+{
+  iot_component_state_t state = iot_component_wait (arg, (uint32_t) IOT_COMPONENT_DELETED);
+  return (void*) (uintptr_t) state;
+}
+
+static void test_component_state (void)
+{
+  iot_component_t comp = { .name = NULL };
+  void * result = NULL;
+  pthread_t tid;
+  iot_component_init (&comp, NULL, delta_start, delta_stop);
+  CU_ASSERT (iot_component_get_state (&comp) == IOT_COMPONENT_INITIAL)
+  CU_ASSERT (iot_component_set_running (&comp))
+  CU_ASSERT (iot_component_get_state (&comp) == IOT_COMPONENT_RUNNING)
+  CU_ASSERT (iot_component_wait (&comp, (uint32_t) IOT_COMPONENT_RUNNING) == IOT_COMPONENT_RUNNING) // Fast path
+  CU_ASSERT (iot_component_wait_and_lock (&comp, (uint32_t) IOT_COMPONENT_RUNNING) == IOT_COMPONENT_RUNNING)
+  CU_ASSERT (iot_component_wait_locked (&comp, (uint32_t) IOT_COMPONENT_RUNNING | (uint32_t) IOT_COMPONENT_STOPPED) == IOT_COMPONENT_RUNNING)
+  iot_component_unlock (&comp);
+  CU_ASSERT (! iot_component_set_deleted (&comp)) // Running component cannot be deleted
+  pthread_create (&tid, NULL, state_waiter, &comp);
+  CU_ASSERT (iot_component_set_stopped (&comp))
+  CU_ASSERT (iot_component_set_deleted (&comp))
+  pthread_join (tid, &result);
+  CU_ASSERT ((uintptr_t) result == IOT_COMPONENT_DELETED)
+  CU_ASSERT (iot_component_get_state (&comp) == IOT_COMPONENT_DELETED)
+  iot_component_fini (&comp);
+}
+
+static iot_data_t * map_loader (const char * name, const char * uri)
+{
+  (void) uri;
+  return iot_data_from_json ((strcmp (name, "mapped") == 0) ? "{\"logger\":\"IOT::Logger\"}" : "{\"Name\":\"mapped\"}");
+}
+
+static void test_load_map (void)
+{
+  static iot_container_config_t config = { .load = NULL, .uri = NULL, .save = NULL, .load_map = map_loader };
+  iot_container_t * cont = iot_container_alloc ("mapped");
+  iot_component_factory_add (iot_logger_factory ());
+  iot_container_config (&config);
+  CU_ASSERT (iot_container_init (cont))
+  iot_component_t * comp = iot_container_find_component (cont, "logger");
+  CU_ASSERT (comp != NULL)
+  CU_ASSERT (comp && strcmp (iot_data_string_map_get_string (comp->config, "Name"), "mapped") == 0)
+  iot_container_free (cont);
+}
+
+static void test_parallel (void)
+{
+  static iot_container_config_t config = { .load = parallel_loader, .uri = NULL, .save = NULL };
+  iot_threadpool_t * pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_container_t * cont = iot_container_alloc ("parallel");
+  iot_component_factory_add (iot_logger_factory ());
+  iot_component_factory_add (iot_threadpool_factory ());
+  iot_component_factory_add (iot_scheduler_factory ());
+  iot_threadpool_start (pool);
+  iot_container_config (&config);
+  iot_container_set_threadpool (cont, pool);
+  atomic_store (&parallel_loads, 0u);
+  CU_ASSERT (iot_container_init (cont))
+  CU_ASSERT (atomic_load (&parallel_loads) == 5u) // Each configuration loaded once
+  iot_component_t * logger = iot_container_find_component (cont, "logger");
+  iot_component_t * tpool = iot_container_find_component (cont, "pool");
+  iot_component_t * other = iot_container_find_component (cont, "other");
+  iot_component_t * sched = iot_container_find_component (cont, "scheduler");
+  CU_ASSERT (logger && tpool && other && sched)
+  if (logger && tpool && other && sched)
+  {
+    CU_ASSERT (logger->level == 0u)
+    CU_ASSERT (tpool->level == 1u)
+    CU_ASSERT (other->level == 1u)
+    CU_ASSERT (sched->level == 2u)
+    iot_container_start (cont);
+    CU_ASSERT (logger->state == IOT_COMPONENT_RUNNING)
+    CU_ASSERT (tpool->state == IOT_COMPONENT_RUNNING)
+    CU_ASSERT (other->state == IOT_COMPONENT_RUNNING)
+    CU_ASSERT (sched->state == IOT_COMPONENT_RUNNING)
+    iot_container_stop (cont);
+  }
+  iot_container_free (cont);
+  iot_threadpool_free (pool);
+  parallel_done = true;
+}
+
+static atomic_uint preload_loads;
+
+static char * preload_loader (const char * name, const char * uri)
+{
+  (void) uri;
+  atomic_fetch_add (&preload_loads, 1u);
+  if (strcmp (name, "preload") == 0) return strdup ("{\"logger\":\"IOT::Logger\",\"missing\":\"Test::Missing\"}");
+  if (strcmp (name, "missing") == 0) return strdup ("{\"Library\":\"libcunitmissing.so\",\"Factory\":\"cunit_missing_factory\"}");
+  return strdup (logger_config);
+}
+
+static void test_preload (void)
+{
+  static iot_container_config_t config = { .load = preload_loader, .uri = NULL, .save = NULL };
+  iot_threadpool_t * pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_container_t * cont = iot_container_alloc ("preload");
+  iot_component_factory_add (iot_logger_factory ());
+  iot_threadpool_start (pool);
+  iot_container_config (&config);
+  iot_container_set_threadpool (cont, pool);
+  atomic_store (&preload_loads, 0u);
+  CU_ASSERT (iot_container_init (cont))
+  CU_ASSERT (atomic_load (&preload_loads) == 3u) // Prefetched configurations used by factory preload and creation
+  CU_ASSERT (iot_container_find_component (cont, "logger") != NULL)
+  iot_container_free (cont);
+  iot_threadpool_free (pool);
+}
+
+#if defined (IOT_BUILD_DYNAMIC_LOAD) && defined (__GLIBC__)
+
+extern const iot_component_factory_t * cunit_cont_plugin_factory (void);
+
+static atomic_uint plugin_calls;
+static bool plugin_valid = false;
+
+static iot_component_t * plugin_config (iot_container_t * cont, const iot_data_t * map)
+{
+  (void) cont;
+  (void) map;
+  iot_component_t * comp = calloc (1, sizeof (*comp));
+  iot_component_init (comp, iot_component_factory_find ("Test::Plugin"), delta_start, delta_stop);
+  return comp;
+}
+
+const iot_component_factory_t * cunit_cont_plugin_factory (void) // Loaded from the runner, an empty library name being the main program
+{
+  static iot_component_factory_t factory = { "Test::Plugin", IOT_CATEGORY_USER, plugin_config, delta_free, NULL, NULL, NULL };
+  atomic_fetch_add (&plugin_calls, 1u);
+  return &factory;
+}
+
+static char * plugin_loader (const char * name, const char * uri)
+{
+  (void) uri;
+  if (strcmp (name, "plugin") == 0) return strdup ("{\"one\":\"Test::Plugin\",\"two\":\"Test::Plugin\"}");
+  return strdup (plugin_valid ? "{\"Library\":\"\",\"Factory\":\"cunit_cont_plugin_factory\"}" : "{\"Library\":\"\",\"Factory\":\"cunit_cont_no_factory\"}");
+}
+
+static void test_plugin_cache (void)
+{
+  static iot_container_config_t config = { .load = plugin_loader, .uri = NULL, .save = NULL };
+  iot_container_config (&config);
+  atomic_store (&plugin_calls, 0u);
+  iot_container_t * cont = iot_container_alloc ("plugin");
+  CU_ASSERT (iot_container_init (cont))
+  CU_ASSERT (iot_container_find_component (cont, "one") == NULL) // Factory not found, so nothing cached
+  iot_container_free (cont);
+
+  plugin_valid = true;
+  cont = iot_container_alloc ("plugin");
+  CU_ASSERT (iot_container_init (cont))
+  CU_ASSERT (iot_container_find_component (cont, "one") != NULL)
+  CU_ASSERT (iot_container_find_component (cont, "two") != NULL)
+  CU_ASSERT (atomic_load (&plugin_calls) == 1u) // Library loaded once for both components
+  iot_container_t * other = iot_container_alloc ("plugin");
+  CU_ASSERT (iot_container_init (other))
+  iot_component_t * one = iot_container_find_component (cont, "one");
+  iot_component_t * copy = iot_container_find_component (other, "one");
+  CU_ASSERT (one && copy && one->factory == copy->factory)
+  CU_ASSERT (atomic_load (&plugin_calls) == 1u) // Not reloaded for another container
+  iot_container_free (other);
+  iot_container_free (cont);
+}
+#endif
+
 static void test_state_name (void)
 {
   CU_ASSERT (strcmp (iot_component_state_name (IOT_COMPONENT_INITIAL), "Initial") == 0)
@@ -160,6 +470,15 @@ void cunit_cont_test_init (void)
   CU_add_test (suite, "container_state_name", test_state_name);
   CU_add_test (suite, "container_add_component", test_add_component);
   CU_add_test (suite, "container_delete_component", test_delete_component);
+  CU_add_test (suite, "container_many_components", test_many_components);
   CU_add_test (suite, "bad_enviroment_variables_in_config", test_bad_env_vars_in_config);
+  CU_add_test (suite, "container_reconfig_delta", test_reconfig_delta);
+  CU_add_test (suite, "container_component_state", test_component_state);
+  CU_add_test (suite, "container_load_map", test_load_map);
+  CU_add_test (suite, "container_parallel", test_parallel);
+  CU_add_test (suite, "container_preload", test_preload);
+#if defined (IOT_BUILD_DYNAMIC_LOAD) && defined (__GLIBC__)
+  CU_add_test (suite, "container_plugin_cache", test_plugin_cache);
+#endif
 
 }
@@ -8,9 +8,14 @@
 #include "iot/logger.h"
 #include "iot/config.h"
 #include "iot/data.h"
+#include "iot/threadpool.h"
+#include "iot/thread.h"
+#include "iot/file.h"
 #include "data-io.h"
 #include "CUnit.h"
 #include <float.h>
+#include <math.h>
+#include <sys/uio.h>
 
 static int suite_init (void)
 {
@@ -241,6 +246,20 @@ static void test_data_from_json (void)
   CU_ASSERT (vec!= NULL)
   iot_data_free (key);
 
+  static iot_config_key_t interval_key;
+  static iot_config_key_t topics_key;
+  static iot_config_key_t missing_key;
+  CU_ASSERT (iot_data_map_get (map, iot_config_key_init (&interval_key, "Interval")) != NULL)
+  iot_config_key_init (&topics_key, "Topics");
+  iot_config_key_init (&missing_key, "Missing");
+  uival32 = 0u;
+  CU_ASSERT (iot_config_key_ui32 (map, &interval_key, &uival32, NULL))
+  CU_ASSERT (uival32 == 1000)
+  CU_ASSERT (! iot_config_key_i64 (map, &missing_key, &ival64, NULL))
+  CU_ASSERT (iot_config_key_vector (map, &topics_key, NULL) == iot_config_vector (map, "Topics", NULL))
+  CU_ASSERT (iot_config_key_map (map, &topics_key, NULL) == NULL)
+  CU_ASSERT (iot_config_key_string (map, &missing_key, false, NULL) == NULL)
+
   const char * ustr = iot_data_string_map_get_string (map, "Unicode");
   CU_ASSERT (strcmp (ustr, "\003HELLO\006HI") == 0)
   const char *u2str = iot_data_string_map_get_string (map, "Unicode2");
@@ -328,6 +347,731 @@ static void test_data_from_json3 (void)
   free (new_json);
 }
 
+static void test_data_from_json_malformed (void)
+{
+  static const char * json = "{\"i:\"\",\"a\"b\":\"\\\\\\/\\b\\f0\\r\\t\"}"; // Object entry counts not matching tokens
+  iot_data_t * data = iot_data_from_json (json);
+  CU_ASSERT (iot_data_type (data) == IOT_DATA_NULL)
+  iot_data_free (data);
+  data = iot_data_from_json ("{\"a\":1,\"b\"}");
+  CU_ASSERT (iot_data_type (data) == IOT_DATA_NULL)
+  iot_data_free (data);
+  data = iot_data_from_json ("[{\"a\" 1 2},3]");
+  CU_ASSERT (iot_data_type (data) == IOT_DATA_NULL)
+  iot_data_free (data);
+}
+
+static void test_data_from_json_in_place (void)
+{
+  static const char * json =
+    "{\"Name\":\"A long device name that does not fit inline\",\"Escaped\":\"Tab\\tNewline\\nQuote\\\" and some more text\","
+    "\"Values\":[1,-2,3.5,true,null,\"Another string long enough to reference the source\"],"
+    "\"Nested\":{\"A long key name for a short value\":\"x\",\"Unicode\":\"\\u0041BC\"}}";
+  iot_data_t * expected = iot_data_from_json_with_ordering (json, true);
+  iot_data_t * data = iot_data_from_json_in_place (strdup (json), true, NULL);
+  CU_ASSERT (iot_data_equal (data, expected))
+  char * out1 = iot_data_to_json (data);
+  char * out2 = iot_data_to_json (expected);
+  CU_ASSERT (strcmp (out1, out2) == 0)
+  const iot_data_t * name = iot_data_string_map_get (data, "Name");
+  iot_data_t * copy = iot_data_copy (name);
+  iot_data_t * ref = iot_data_add_ref (name);
+  iot_data_free (data); // Source buffer remains referenced by name
+  CU_ASSERT (strcmp (iot_data_string (ref), "A long device name that does not fit inline") == 0)
+  CU_ASSERT (iot_data_equal (ref, copy))
+  iot_data_free (ref);
+  CU_ASSERT (strcmp (iot_data_string (copy), "A long device name that does not fit inline") == 0)
+  iot_data_free (copy);
+  data = iot_data_from_json_in_place (strdup ("42"), false, NULL);
+  CU_ASSERT (iot_data_i64 (data) == 42)
+  iot_data_free (data);
+  data = iot_data_from_json_in_place (NULL, false, NULL);
+  CU_ASSERT (iot_data_type (data) == IOT_DATA_NULL)
+  iot_data_free (data);
+  data = iot_data_from_json_in_place (strdup ("{\"i:\"\",\"a\"b\":\"\\\\\\/\\b\\f0\\r\\t\"}"), false, NULL); // Malformed
+  CU_ASSERT (iot_data_type (data) == IOT_DATA_NULL)
+  iot_data_free (data);
+  iot_data_free (expected);
+  free (out1);
+  free (out2);
+}
+
+typedef struct test_json_sink_t
+{
+  char * buff;
+  size_t len;
+  uint32_t calls;
+} test_json_sink_t;
+
+static bool test_json_sink_write (void * ctx, const char * str, size_t len)
+{
+  test_json_sink_t * sink = (test_json_sink_t*) ctx;
+  memcpy (sink->buff + sink->len, str, len);
+  sink->len += len;
+  sink->calls++;
+  return true;
+}
+
+static bool test_json_sink_fail (void * ctx, const char * str, size_t len)
+{
+  (void) str;
+  (void) len;
+  (*(uint32_t*) ctx)++;
+  return false;
+}
+
+static void test_data_json_sink (void)
+{
+  char text[3000];
+  uint8_t bin[2000];
+  uint32_t calls = 0u;
+  for (uint32_t i = 0; i < sizeof (text) - 1; i++) text[i] = (i % 50u) ? 'a' + (char) (i % 26u) : '\n';
+  text[sizeof (text) - 1] = '\0';
+  for (uint32_t i = 0; i < sizeof (bin); i++) bin[i] = (uint8_t) i;
+  iot_data_t * map = test_sample_map1 ();
+  iot_data_string_map_add (map, "Long", iot_data_alloc_string (text, IOT_DATA_REF));
+  iot_data_string_map_add (map, "LongBinary", iot_data_alloc_binary (bin, sizeof (bin), IOT_DATA_REF));
+  iot_data_string_map_add (map, "Float", iot_data_alloc_f64 (DBL_MAX));
+  char * json = iot_data_to_json (map);
+  size_t size = iot_data_json_size (map);
+  CU_ASSERT (size == strlen (json))
+
+  test_json_sink_t sink = { .buff = malloc (size), .len = 0u, .calls = 0u };
+  CU_ASSERT (iot_data_to_json_sink (map, test_json_sink_write, &sink))
+  CU_ASSERT (sink.len == size)
+  CU_ASSERT (sink.calls > 1u)
+  CU_ASSERT (memcmp (sink.buff, json, size) == 0)
+  CU_ASSERT (! iot_data_to_json_sink (map, test_json_sink_fail, &calls))
+  CU_ASSERT (calls == 1u)
+
+  iot_data_t * val = iot_data_alloc_bool (false);
+  CU_ASSERT (iot_data_json_size (val) == 5u)
+  iot_data_free (val);
+  free (sink.buff);
+  free (json);
+  iot_data_free (map);
+}
+
+static bool test_json_stream_push (iot_data_json_stream_t * stream, const char * json)
+{
+  return iot_data_json_stream_push (stream, json, strlen (json));
+}
+
+static void test_data_json_stream (void)
+{
+  static const char * json = "{\"name\":\"se\\\"n\\u0041sor\",\"values\":[1,-2,3.5,true,false,null,[],{}],"
+    "\"nested\":{\"a\":{\"b\":[{\"c\":18446744073709551615}]}},\"empty\":\"\"}";
+  iot_data_t * expected = iot_data_from_json_with_ordering (json, true);
+  char * exp_json = iot_data_to_json (expected);
+  size_t len = strlen (json);
+  iot_data_json_stream_t * stream = iot_data_json_stream_alloc (true, NULL);
+
+  for (size_t chunk = 1u; chunk <= len; chunk++) // Push json in all chunk sizes
+  {
+    for (size_t pos = 0u; pos < len; pos += chunk)
+    {
+      size_t size = ((len - pos) < chunk) ? (len - pos) : chunk;
+      CU_ASSERT (iot_data_json_stream_push (stream, json + pos, size))
+    }
+    iot_data_t * data = iot_data_json_stream_finish (stream);
+    CU_ASSERT (data != NULL)
+    CU_ASSERT (iot_data_equal (data, expected))
+    char * res_json = iot_data_to_json (data);
+    CU_ASSERT (strcmp (res_json, exp_json) == 0)
+    free (res_json);
+    iot_data_free (data);
+  }
+
+  CU_ASSERT (test_json_stream_push (stream, " 42 "))
+  iot_data_t * data = iot_data_json_stream_finish (stream);
+  CU_ASSERT (data && (iot_data_i64 (data) == 42))
+  iot_data_free (data);
+  CU_ASSERT (test_json_stream_push (stream, "-7"))
+  data = iot_data_json_stream_finish (stream);
+  CU_ASSERT (data && (iot_data_i64 (data) == -7))
+  iot_data_free (data);
+
+  CU_ASSERT (test_json_stream_push (stream, "{\"a\":[1,2"))
+  CU_ASSERT (iot_data_json_stream_finish (stream) == NULL) // Incomplete
+  CU_ASSERT (! test_json_stream_push (stream, "[1,]"))
+  CU_ASSERT (iot_data_json_stream_finish (stream) == NULL)
+  CU_ASSERT (! test_json_stream_push (stream, "{\"a\" 1}"))
+  CU_ASSERT (iot_data_json_stream_finish (stream) == NULL)
+  CU_ASSERT (! test_json_stream_push (stream, "[1]]"))
+  CU_ASSERT (iot_data_json_stream_finish (stream) == NULL)
+  CU_ASSERT (! test_json_stream_push (stream, "\"\\x\""))
+  CU_ASSERT (iot_data_json_stream_finish (stream) == NULL)
+
+  iot_data_json_stream_free (stream);
+  iot_data_free (expected);
+  free (exp_json);
+}
+
+typedef struct test_struct_t
+{
+  uint32_t interval;
+  int16_t offset;
+  double scale;
+  bool enabled;
+  char * name;
+  char * mode;
+} test_struct_t;
+
+static const iot_data_field_t test_struct_fields[] =
+{
+  { "Interval", offsetof (test_struct_t, interval), IOT_DATA_UINT32, true, NULL },
+  { "Offset", offsetof (test_struct_t, offset), IOT_DATA_INT16, false, "-5" },
+  { "Scale", offsetof (test_struct_t, scale), IOT_DATA_FLOAT64, false, "1.5" },
+  { "Enabled", offsetof (test_struct_t, enabled), IOT_DATA_BOOL, false, "true" },
+  { "Name", offsetof (test_struct_t, name), IOT_DATA_STRING, true, NULL },
+  { "Mode", offsetof (test_struct_t, mode), IOT_DATA_STRING, false, "tcp" }
+};
+
+static void test_data_to_struct (void)
+{
+  static const char * json = "{\"Name\":\"dev\\\"1\",\"Other\":{\"Interval\":7},\"Interval\":200,\"Scale\":2,\"Extra\":[1,2]}";
+  const uint32_t count = sizeof (test_struct_fields) / sizeof (test_struct_fields[0]);
+  test_struct_t st;
+  test_struct_t st2;
+
+  CU_ASSERT (iot_data_json_to_struct (json, test_struct_fields, count, &st))
+  CU_ASSERT (st.interval == 200u && st.offset == -5 && st.scale == 2.0 && st.enabled)
+  CU_ASSERT (strcmp (st.name, "dev\"1") == 0 && strcmp (st.mode, "tcp") == 0)
+  iot_data_t * map = iot_data_from_json (json);
+  CU_ASSERT (iot_data_map_to_struct (map, test_struct_fields, count, &st2))
+  CU_ASSERT (st2.interval == st.interval && st2.offset == st.offset && st2.scale == st.scale && st2.enabled == st.enabled)
+  CU_ASSERT (strcmp (st2.name, st.name) == 0 && strcmp (st2.mode, st.mode) == 0)
+  iot_data_struct_free (test_struct_fields, count, &st);
+  iot_data_struct_free (test_struct_fields, count, &st2);
+  iot_data_free (map);
+
+  CU_ASSERT (! iot_data_json_to_struct ("{\"Interval\":1}", test_struct_fields, count, &st)) // Missing Name
+  CU_ASSERT (st.interval == 1u && st.name == NULL)
+  iot_data_struct_free (test_struct_fields, count, &st);
+  CU_ASSERT (! iot_data_json_to_struct ("{\"Interval\":-1,\"Name\":\"x\"}", test_struct_fields, count, &st)) // Out of range
+  iot_data_struct_free (test_struct_fields, count, &st);
+  CU_ASSERT (! iot_data_json_to_struct ("{\"Interval\":1,\"Name\":2}", test_struct_fields, count, &st)) // Wrong type
+  iot_data_struct_free (test_struct_fields, count, &st);
+  CU_ASSERT (iot_data_json_to_struct ("{\"Interval\":1,\"Name\":\"a\",\"Name\":\"b\",\"Enabled\":false}", test_struct_fields, count, &st))
+  CU_ASSERT (strcmp (st.name, "b") == 0 && ! st.enabled)
+  iot_data_struct_free (test_struct_fields, count, &st);
+  CU_ASSERT (! iot_data_json_to_struct ("[1]", test_struct_fields, count, &st))
+  iot_data_struct_free (test_struct_fields, count, &st);
+}
+
+static void test_data_json_context (void)
+{
+  static const char * jsons[] = { "{\"name\":\"a\",\"value\":1}", "[1,2,{\"name\":\"b\",\"x\":[\"y\",\"z\"]},3]", "42", "{\"a\":" };
+  iot_data_json_context_t * context = iot_data_json_context_alloc (true);
+  char buff[32];
+  for (uint32_t j = 0; j < 2u; j++)
+  {
+    for (uint32_t i = 0; i < sizeof (jsons) / sizeof (jsons[0]); i++)
+    {
+      iot_data_t * data = iot_data_from_json_with_context (context, jsons[i]);
+      iot_data_t * expected = iot_data_from_json_with_ordering (jsons[i], true);
+      CU_ASSERT (iot_data_equal (data, expected))
+      iot_data_free (expected);
+      iot_data_free (data);
+    }
+  }
+  for (uint32_t i = 0; i < 2000u; i++) // Unique strings, cache bounded
+  {
+    snprintf (buff, sizeof (buff), "{\"k\":\"v%u\"}", i);
+    iot_data_t * data = iot_data_from_json_with_context (context, buff);
+    CU_ASSERT (iot_data_type (data) == IOT_DATA_MAP)
+    iot_data_free (data);
+  }
+  iot_data_json_context_free (context);
+  iot_data_json_context_free (NULL);
+}
+
+static void test_data_json_doc (void)
+{
+  static const char * json = "{\"name\":\"se\\\"nsor\",\"values\":[1,-2,3.5,true,[7,8]],\"k\\u0041\":\"esc\","
+    "\"nested\":{\"a\":{\"b\":[{\"c\":42}]}},\"name\":\"last\"}";
+  iot_data_json_doc_t * doc = iot_data_json_doc_alloc (json, false);
+  iot_data_t * path = iot_data_alloc_list ();
+  CU_ASSERT (doc != NULL)
+  iot_data_list_tail_push (path, iot_data_alloc_string ("nested", IOT_DATA_REF));
+  iot_data_list_tail_push (path, iot_data_alloc_string ("a", IOT_DATA_REF));
+  iot_data_list_tail_push (path, iot_data_alloc_string ("b", IOT_DATA_REF));
+  iot_data_list_tail_push (path, iot_data_alloc_ui32 (0u));
+  iot_data_list_tail_push (path, iot_data_alloc_string ("c", IOT_DATA_REF));
+  const iot_data_t * val = iot_data_json_doc_get_at (doc, path);
+  CU_ASSERT (val && iot_data_type (val) == IOT_DATA_INT64 && iot_data_i64 (val) == 42)
+  CU_ASSERT (iot_data_json_doc_get_at (doc, path) == val) // Retained on first access
+  iot_data_list_empty (path);
+  iot_data_list_tail_push (path, iot_data_alloc_string ("values", IOT_DATA_REF));
+  iot_data_list_tail_push (path, iot_data_alloc_ui32 (4u));
+  iot_data_list_tail_push (path, iot_data_alloc_ui32 (1u));
+  val = iot_data_json_doc_get_at (doc, path);
+  CU_ASSERT (val && iot_data_i64 (val) == 8)
+  iot_data_list_empty (path);
+  iot_data_list_tail_push (path, iot_data_alloc_string ("values", IOT_DATA_REF));
+  iot_data_list_tail_push (path, iot_data_alloc_ui32 (5u));
+  CU_ASSERT (iot_data_json_doc_get_at (doc, path) == NULL)
+  iot_data_list_empty (path);
+  iot_data_list_tail_push (path, iot_data_alloc_string ("name", IOT_DATA_REF));
+  val = iot_data_json_doc_get_at (doc, path);
+  CU_ASSERT (val && strcmp (iot_data_string (val), "last") == 0)
+  iot_data_list_tail_push (path, iot_data_alloc_string ("x", IOT_DATA_REF));
+  CU_ASSERT (iot_data_json_doc_get_at (doc, path) == NULL)
+  iot_data_list_empty (path);
+  iot_data_list_tail_push (path, iot_data_alloc_string ("kA", IOT_DATA_REF));
+  val = iot_data_json_doc_get_at (doc, path);
+  CU_ASSERT (val && strcmp (iot_data_string (val), "esc") == 0)
+  iot_data_list_empty (path);
+  iot_data_t * expected = iot_data_from_json (json);
+  CU_ASSERT (iot_data_equal (iot_data_json_doc_get_at (doc, path), expected))
+  CU_ASSERT (iot_data_json_doc_data (doc) == iot_data_json_doc_get_at (doc, path))
+  iot_data_free (expected);
+  iot_data_free (path);
+  iot_data_json_doc_free (doc);
+  CU_ASSERT (iot_data_json_doc_alloc ("{\"a\":", false) == NULL)
+  CU_ASSERT (iot_data_json_doc_alloc ("", false) == NULL)
+}
+
+static void test_data_shaped_array (void)
+{
+  int16_t frame[2][3] = { { 1, -2, 3 }, { 4, 5, -6 } };
+  bool flags[2][2] = { { true, false }, { false, true } };
+  uint32_t dims[2] = { 2u, 3u };
+  uint32_t bdims[3] = { 2u, 2u, 1u };
+  iot_data_t * array = iot_data_alloc_shaped_array (frame, dims, 2u, IOT_DATA_INT16, IOT_DATA_COPY);
+  iot_data_t * barray = iot_data_alloc_shaped_array (flags, bdims, 3u, IOT_DATA_BOOL, IOT_DATA_COPY);
+  const iot_data_t * shape = iot_data_array_shape (array);
+  char * json;
+
+  CU_ASSERT (iot_data_array_length (array) == 6u)
+  CU_ASSERT (shape && iot_data_array_length (shape) == 2u)
+  CU_ASSERT (shape && ((const uint32_t*) iot_data_address (shape))[1] == 3u)
+  json = iot_data_to_json (array);
+  CU_ASSERT (strcmp (json, "[[1,-2,3],[4,5,-6]]") == 0)
+  free (json);
+  json = iot_data_to_json (barray);
+  CU_ASSERT (strcmp (json, "[[[true],[false]],[[false],[true]]]") == 0)
+  free (json);
+#ifdef IOT_HAS_CBOR
+  iot_data_t * cbor = iot_data_to_cbor (array);
+  iot_data_t * result = iot_data_from_cbor (iot_data_address (cbor), iot_data_array_size (cbor));
+  CU_ASSERT (result && iot_data_equal (result, array))
+  CU_ASSERT (result && iot_data_equal (iot_data_array_shape (result), shape))
+  iot_data_free (result);
+  iot_data_free (cbor);
+  cbor = iot_data_to_cbor (barray);
+  result = iot_data_from_cbor (iot_data_address (cbor), iot_data_array_size (cbor));
+  CU_ASSERT (result && iot_data_type (result) == IOT_DATA_VECTOR)
+  iot_data_free (result);
+  iot_data_free (cbor);
+  static const uint8_t bad[] = { 0xd8, 0x28, 0x82, 0x81, 0x03, 0xd8, 0x40, 0x42, 0x01, 0x02 }; // Dimension inconsistent with element count
+  CU_ASSERT (iot_data_from_cbor (bad, sizeof (bad)) == NULL)
+#endif
+  iot_data_free (barray);
+  iot_data_free (array);
+}
+
+static void test_data_canonical (void)
+{
+  iot_data_encode_cache_t * cache = iot_data_encode_cache_alloc (16u);
+  iot_data_t * map = iot_data_from_json_with_ordering ("{\"z\":1,\"a\":{\"y\":[1,2],\"b\":true}}", true);
+  iot_data_t * state = (iot_data_t*) iot_data_string_map_get (map, "a");
+  char * json;
+
+  json = iot_data_to_json (map);
+  CU_ASSERT (strcmp (json, "{\"z\":1,\"a\":{\"y\":[1,2],\"b\":true}}") == 0)
+  free (json);
+  json = iot_data_to_json_canonical (map, NULL);
+  CU_ASSERT (strcmp (json, "{\"a\":{\"b\":true,\"y\":[1,2]},\"z\":1}") == 0)
+  free (json);
+  iot_data_freeze (state);
+  for (int i = 0; i < 2; i++) // Second pass uses cached encoding of frozen map
+  {
+    json = iot_data_to_json_canonical (map, cache);
+    CU_ASSERT (strcmp (json, "{\"a\":{\"b\":true,\"y\":[1,2]},\"z\":1}") == 0)
+    free (json);
+  }
+  iot_data_string_map_add (map, "z", iot_data_alloc_i64 (2));
+  json = iot_data_to_json_canonical (map, cache);
+  CU_ASSERT (strcmp (json, "{\"a\":{\"b\":true,\"y\":[1,2]},\"z\":2}") == 0)
+  free (json);
+#ifdef IOT_HAS_CBOR
+  iot_data_t * cbor = iot_data_to_cbor (map);
+  for (int i = 0; i < 2; i++)
+  {
+    iot_data_t * canonical = iot_data_to_cbor_canonical (map, cache);
+    CU_ASSERT (iot_data_equal (canonical, cbor))
+    iot_data_free (canonical);
+  }
+  iot_data_free (cbor);
+#endif
+  iot_data_thaw (state);
+  iot_data_free (map);
+  iot_data_encode_cache_free (cache);
+}
+
+static void test_data_json_numbers (void)
+{
+  static const double f64s[] = { 1.0, 0.1, -2000.0, 5e-324, 1.7976931348623157e308, 123.456, -0.0 };
+  static const char * expected = "[1e+00,1e-01,-2e+03,5e-324,1.7976931348623157e+308,1.23456e+02,-0e+00,1e-01,5e+00,1e400,-128,255,-9223372036854775808,18446744073709551615]";
+  iot_data_t * vector = iot_data_alloc_vector (14u);
+  for (uint32_t i = 0; i < 7u; i++) iot_data_vector_add (vector, i, iot_data_alloc_f64 (f64s[i]));
+  iot_data_vector_add (vector, 7u, iot_data_alloc_f32 (0.1f));
+  iot_data_vector_add (vector, 8u, iot_data_alloc_f32 (5.0f));
+  iot_data_vector_add (vector, 9u, iot_data_alloc_f32 (INFINITY));
+  iot_data_vector_add (vector, 10u, iot_data_alloc_i8 (INT8_MIN));
+  iot_data_vector_add (vector, 11u, iot_data_alloc_ui8 (UINT8_MAX));
+  iot_data_vector_add (vector, 12u, iot_data_alloc_i64 (INT64_MIN));
+  iot_data_vector_add (vector, 13u, iot_data_alloc_ui64 (UINT64_MAX));
+  char * json = iot_data_to_json (vector);
+  CU_ASSERT_STRING_EQUAL (json, expected)
+  free (json);
+  iot_data_free (vector);
+
+  // Grisu2 digits round-trip, but are not always the shortest
+  iot_data_t * value = iot_data_alloc_f64 (1e23);
+  json = iot_data_to_json (value);
+  CU_ASSERT_STRING_EQUAL (json, "9.999999999999999e+22")
+  iot_data_t * parsed = iot_data_from_json (json);
+  CU_ASSERT (iot_data_type (parsed) == IOT_DATA_FLOAT64 && iot_data_f64 (parsed) == 1e23)
+  iot_data_free (parsed);
+  iot_data_free (value);
+  free (json);
+
+  // Random values read back exactly, and parse as strtod
+  uint64_t seed = 88172645463325252u;
+  char buff[32];
+  bool ok = true;
+  for (uint32_t i = 0; i < 10000u && ok; i++)
+  {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    double d;
+    float f;
+    uint32_t fbits = (uint32_t) seed;
+    memcpy (&d, &seed, sizeof (d));
+    memcpy (&f, &fbits, sizeof (f));
+    if (isfinite (d))
+    {
+      iot_data_t * value = iot_data_alloc_f64 (d);
+      json = iot_data_to_json (value);
+      iot_data_t * parsed = iot_data_from_json (json);
+      ok = (iot_data_type (parsed) == IOT_DATA_FLOAT64) && (memcmp (iot_data_address (parsed), &d, sizeof (d)) == 0);
+      snprintf (buff, sizeof (buff), "%.*e", (int) (i % 19u), d);
+      double expect = strtod (buff, NULL);
+      iot_data_free (parsed);
+      parsed = iot_data_from_json (buff);
+      ok = ok && (memcmp (iot_data_address (parsed), &expect, sizeof (expect)) == 0);
+      iot_data_free (parsed);
+      iot_data_free (value);
+      free (json);
+    }
+    if (ok && isfinite (f))
+    {
+      iot_data_t * value = iot_data_alloc_f32 (f);
+      json = iot_data_to_json (value);
+      iot_data_t * parsed = iot_data_from_json (json);
+      ok = ((float) iot_data_f64 (parsed) == f);
+      iot_data_free (parsed);
+      iot_data_free (value);
+      free (json);
+    }
+  }
+  CU_ASSERT (ok)
+}
+
+static bool test_escape_sink (void * ctx, const char * str, size_t len)
+{
+  strncat (ctx, str, len);
+  return true;
+}
+
+static void test_data_json_escape (void)
+{
+  static const char specials[] = { '"', '\\', '\n', '\t', 0x01, 0x1f, 0x7f, ' ' };
+  static const char * escaped[] = { "\\\"", "\\\\", "\\n", "\\t", "\\u0001", "\\u001f", "\x7f", " " };
+  char str[24];
+  char expected[48];
+  bool ok = true;
+  for (uint32_t c = 0; c < sizeof (specials); c++)
+  {
+    for (uint32_t pos = 0; pos < 20u; pos++) // Special character at each position in and across words
+    {
+      memset (str, 'a', 20u);
+      str[20] = '\0';
+      str[pos] = specials[c];
+      snprintf (expected, sizeof (expected), "\"%.*s%s%s\"", (int) pos, str, escaped[c], str + pos + 1);
+      iot_data_t * data = iot_data_alloc_string (str, IOT_DATA_COPY);
+      for (uint32_t i = 0; i < 2u; i++) // Second conversion may use cached escape status
+      {
+        char * json = iot_data_to_json (data);
+        ok = ok && (strcmp (json, expected) == 0);
+        free (json);
+      }
+      iot_data_free (data);
+    }
+  }
+  CU_ASSERT (ok)
+
+  // Long string, with escapes, split when written to a sink
+  char * long_str = calloc (1u, 2001u);
+  for (uint32_t i = 0; i < 2000u; i++) long_str[i] = (i % 97u) ? 'x' : '\n';
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_data_string_map_add (map, "key", iot_data_alloc_string (long_str, IOT_DATA_TAKE));
+  char * json = iot_data_to_json (map);
+  char * sunk = calloc (1u, strlen (json) + 1u);
+  CU_ASSERT (iot_data_to_json_sink (map, test_escape_sink, sunk))
+  CU_ASSERT_STRING_EQUAL (sunk, json)
+  iot_data_t * parsed = iot_data_from_json (json);
+  CU_ASSERT (iot_data_equal (parsed, map))
+  iot_data_free (parsed);
+  free (sunk);
+  free (json);
+  iot_data_free (map);
+}
+
+static void test_data_array_json (void)
+{
+  static const iot_data_type_t types[] = { IOT_DATA_INT8, IOT_DATA_UINT8, IOT_DATA_INT16, IOT_DATA_UINT16, IOT_DATA_INT32, IOT_DATA_UINT32, IOT_DATA_INT64, IOT_DATA_UINT64, IOT_DATA_FLOAT32, IOT_DATA_FLOAT64, IOT_DATA_BOOL };
+  uint8_t buff[2000u * sizeof (uint64_t)];
+  uint64_t seed = 88172645463325252u;
+  for (uint32_t i = 0; i < sizeof (buff); i++)
+  {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    buff[i] = (uint8_t) seed;
+  }
+  for (uint32_t t = 0; t < sizeof (types) / sizeof (types[0]); t++) // Array json as json of vector of same elements
+  {
+    uint32_t esize = iot_data_type_size (types[t]);
+    iot_data_t * array = iot_data_alloc_array (buff, 2000u, types[t], IOT_DATA_REF);
+    iot_data_t * vector = iot_data_alloc_vector (2000u);
+    for (uint32_t i = 0; i < 2000u; i++)
+    {
+      const uint8_t * ptr = buff + i * esize;
+      iot_data_t * elem;
+      switch (types[t])
+      {
+        case IOT_DATA_INT8: elem = iot_data_alloc_i8 (*(const int8_t*) ptr); break;
+        case IOT_DATA_UINT8: elem = iot_data_alloc_ui8 (*ptr); break;
+        case IOT_DATA_INT16: elem = iot_data_alloc_i16 (*(const int16_t*) ptr); break;
+        case IOT_DATA_UINT16: elem = iot_data_alloc_ui16 (*(const uint16_t*) ptr); break;
+        case IOT_DATA_INT32: elem = iot_data_alloc_i32 (*(const int32_t*) ptr); break;
+        case IOT_DATA_UINT32: elem = iot_data_alloc_ui32 (*(const uint32_t*) ptr); break;
+        case IOT_DATA_INT64: elem = iot_data_alloc_i64 (*(const int64_t*) ptr); break;
+        case IOT_DATA_UINT64: elem = iot_data_alloc_ui64 (*(const uint64_t*) ptr); break;
+        case IOT_DATA_FLOAT32: elem = iot_data_alloc_f32 (*(const float*) ptr); break;
+        case IOT_DATA_FLOAT64: elem = iot_data_alloc_f64 (*(const double*) ptr); break;
+        default: elem = iot_data_alloc_bool (*ptr & 1u); buff[i] &= 1u; break;
+      }
+      iot_data_vector_add (vector, i, elem);
+    }
+    char * json = iot_data_to_json (array);
+    char * expected = iot_data_to_json (vector);
+    CU_ASSERT_STRING_EQUAL (json, expected)
+    char * sunk = calloc (1u, strlen (expected) + 1u);
+    CU_ASSERT (iot_data_to_json_sink (array, test_escape_sink, sunk))
+    CU_ASSERT_STRING_EQUAL (sunk, expected)
+    free (sunk);
+    free (expected);
+    free (json);
+    iot_data_free (vector);
+    iot_data_free (array);
+  }
+
+  iot_threadpool_t * pool = iot_threadpool_alloc (4u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_threadpool_start (pool);
+  float * floats = malloc (100000u * sizeof (float));
+  for (uint32_t i = 0; i < 100000u; i++) floats[i] = (float) i / 7.0f;
+  iot_data_t * array = iot_data_alloc_array (floats, 100000u, IOT_DATA_FLOAT32, IOT_DATA_TAKE);
+  char * json = iot_data_to_json_parallel (array, pool);
+  char * expected = iot_data_to_json (array);
+  CU_ASSERT_STRING_EQUAL (json, expected)
+  free (expected);
+  free (json);
+  iot_data_free (array);
+  iot_threadpool_free (pool);
+}
+
+static void test_data_from_json_parallel (void)
+{
+  iot_threadpool_t * pool = iot_threadpool_alloc (4u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_threadpool_start (pool);
+  iot_data_t * vector = iot_data_alloc_vector (5000u);
+  char name[32];
+  for (uint32_t i = 0; i < 5000u; i++)
+  {
+    iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+    snprintf (name, sizeof (name), "device-%" PRIu32, i % 10u);
+    iot_data_string_map_add (map, "name", iot_data_alloc_string (name, IOT_DATA_COPY));
+    iot_data_string_map_add (map, "id", iot_data_alloc_i64 (i));
+    iot_data_string_map_add (map, "tags", iot_data_from_json ("[{\"a\":[1,2]},\"b\",null]"));
+    iot_data_vector_add (vector, i, map);
+  }
+  char * json = iot_data_to_json (vector);
+  iot_data_t * data = iot_data_from_json_parallel (json, false, NULL, pool);
+  CU_ASSERT (iot_data_equal (data, vector))
+  const iot_data_t * name1 = iot_data_string_map_get (iot_data_vector_get (data, 1u), "name");
+  const iot_data_t * name2 = iot_data_string_map_get (iot_data_vector_get (data, 4001u), "name");
+  CU_ASSERT (name1 == name2) // Strings shared across jobs
+  iot_data_free (data);
+  iot_data_intern_t * intern = iot_data_intern_alloc (0u);
+  data = iot_data_from_json_parallel (json, true, intern, pool);
+  CU_ASSERT (iot_data_equal (data, vector))
+  iot_data_free (data);
+  iot_data_intern_free (intern);
+  data = iot_data_from_json_parallel ("{\"a\":[1,2]}", false, NULL, pool); // Not an array
+  CU_ASSERT (data && iot_data_type (data) == IOT_DATA_MAP)
+  iot_data_free (data);
+  data = iot_data_from_json_parallel ("[1,2", false, NULL, pool);
+  CU_ASSERT (data && iot_data_type (data) == IOT_DATA_NULL)
+  iot_data_free (data);
+  free (json);
+  iot_data_free (vector);
+  iot_threadpool_free (pool);
+}
+
+static bool test_seq_sink (void * ctx, const char * str, size_t len)
+{
+  iot_data_t * chunks = ctx;
+  iot_data_list_tail_push (chunks, iot_data_alloc_binary ((void*) str, (uint32_t) len, IOT_DATA_COPY));
+  return true;
+}
+
+static void test_data_seq_json (void)
+{
+  static const char * lines = "{\"id\":1,\"name\":\"a\"}\n\n  \r\n[1,2]\r\n\"str\"\n{\"id\":2,\"name\":\"a\"}";
+  iot_data_seq_reader_t * reader = iot_data_seq_reader_alloc (IOT_DATA_SEQ_JSON, (const uint8_t*) lines, strlen (lines));
+  iot_data_t * data;
+  uint32_t count = 0u;
+  while ((data = iot_data_seq_reader_next (reader)))
+  {
+    char * json = iot_data_to_json (data);
+    if (count == 0u) CU_ASSERT_STRING_EQUAL (json, "{\"id\":1,\"name\":\"a\"}")
+    if (count == 1u) CU_ASSERT_STRING_EQUAL (json, "[1,2]")
+    if (count == 2u) CU_ASSERT_STRING_EQUAL (json, "\"str\"")
+    if (count == 3u) CU_ASSERT_STRING_EQUAL (json, "{\"id\":2,\"name\":\"a\"}")
+    free (json);
+    iot_data_free (data);
+    count++;
+  }
+  CU_ASSERT (count == 4u)
+  CU_ASSERT (! iot_data_seq_reader_failed (reader))
+  iot_data_seq_reader_free (reader);
+
+  // Invalid record stops reading
+  reader = iot_data_seq_reader_alloc (IOT_DATA_SEQ_JSON, (const uint8_t*) "1\n{\"a\":\n2\n", 11u);
+  data = iot_data_seq_reader_next (reader);
+  CU_ASSERT (data != NULL)
+  iot_data_free (data);
+  CU_ASSERT (iot_data_seq_reader_next (reader) == NULL)
+  CU_ASSERT (iot_data_seq_reader_failed (reader))
+  iot_data_seq_reader_free (reader);
+
+  // Write to a sink, then read back in batches through a pipe, decoding in parallel
+  iot_threadpool_t * pool = iot_threadpool_alloc (4u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_threadpool_start (pool);
+  iot_data_t * chunks = iot_data_alloc_list ();
+  iot_data_seq_writer_t * writer = iot_data_seq_writer_alloc (IOT_DATA_SEQ_JSON, test_seq_sink, chunks);
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+  for (uint32_t i = 0; i < 1000u; i++)
+  {
+    iot_data_string_map_add (map, "id", iot_data_alloc_ui32 (i));
+    CU_ASSERT (iot_data_seq_writer_put (writer, map))
+  }
+  CU_ASSERT (iot_data_seq_writer_flush (writer))
+  iot_data_seq_writer_free (writer);
+  iot_data_free (map);
+  char path[] = "/tmp/iot-seq-XXXXXX";
+  int fd = mkstemp (path);
+  CU_ASSERT (fd >= 0)
+  iot_data_list_iter_t iter;
+  iot_data_list_iter (chunks, &iter);
+  while (iot_data_list_iter_next (&iter))
+  {
+    const iot_data_t * chunk = iot_data_list_iter_value (&iter);
+    CU_ASSERT (write (fd, iot_data_address (chunk), iot_data_array_length (chunk)) == (ssize_t) iot_data_array_length (chunk))
+  }
+  iot_data_free (chunks);
+  lseek (fd, 0, SEEK_SET);
+  reader = iot_data_seq_reader_alloc_fd (IOT_DATA_SEQ_JSON, fd);
+  count = 0u;
+  while ((data = iot_data_seq_reader_batch (reader, 300u, pool)))
+  {
+    for (uint32_t i = 0; i < iot_data_vector_size (data); i++)
+    {
+      CU_ASSERT (iot_data_i64 (iot_data_string_map_get (iot_data_vector_get (data, i), "id")) == count++)
+    }
+    iot_data_free (data);
+  }
+  CU_ASSERT (count == 1000u)
+  CU_ASSERT (! iot_data_seq_reader_failed (reader))
+  iot_data_seq_reader_free (reader);
+  close (fd);
+  unlink (path);
+  iot_threadpool_free (pool);
+}
+
+#if defined (IOT_HAS_FILE) && !defined (_AZURESPHERE_)
+static void test_data_image (void)
+{
+  static const char * json = "{\"devices\":[{\"name\":\"d1\",\"id\":1,\"scale\":0.5,\"on\":true,\"tags\":[\"a\",\"b\"]},"
+    "{\"name\":\"d2\",\"id\":-2,\"scale\":1e10,\"on\":false,\"tags\":[],\"spare\":null}],\"version\":\"1.0\",\"empty\":{}}";
+  static const uint32_t dims[] = { 2u, 3u };
+  int16_t values[] = { 1, -2, 3, -4, 5, -6 };
+  char path[] = "/tmp/iot-image-XXXXXX";
+  int fd = mkstemp (path);
+  CU_ASSERT (fd >= 0)
+  close (fd);
+  iot_data_t * data = iot_data_from_json_with_ordering (json, true);
+  iot_data_string_map_add (data, "matrix", iot_data_alloc_shaped_array (values, dims, 2u, IOT_DATA_INT16, IOT_DATA_COPY));
+  iot_data_string_map_add (data, "blob", iot_data_alloc_binary (values, sizeof (values), IOT_DATA_COPY));
+  iot_data_t * ids = iot_data_alloc_map (IOT_DATA_INT32);
+  for (int32_t i = -8; i < 8; i++) iot_data_map_add (ids, iot_data_alloc_i32 (i * 3), iot_data_alloc_i32 (i));
+  iot_data_string_map_add (data, "ids", ids);
+  CU_ASSERT (iot_data_image_save (data, path))
+  char * expected = iot_data_to_json (data);
+
+  iot_data_image_t * image = iot_data_image_open (path); // Relocated if base address not available
+  iot_data_image_t * image2 = iot_data_image_open (path);
+  CU_ASSERT_FATAL (image != NULL && image2 != NULL)
+  if (iot_data_image_is_shared (image)) CU_ASSERT (! iot_data_image_is_shared (image2)) // Base address in use, so relocated
+  for (uint32_t i = 0; i < 2u; i++)
+  {
+    const iot_data_t * root = iot_data_image_root (i ? image2 : image);
+    CU_ASSERT (iot_data_equal (root, data))
+    CU_ASSERT (iot_data_hash (root) == iot_data_hash (data))
+    char * out = iot_data_to_json (root); // Ordering retained
+    CU_ASSERT_STRING_EQUAL (out, expected)
+    free (out);
+    const iot_data_t * devices = iot_data_string_map_get (root, "devices");
+    CU_ASSERT (iot_data_vector_size (devices) == 2u)
+    CU_ASSERT_STRING_EQUAL (iot_data_string_map_get_string (iot_data_vector_get (devices, 1u), "name"), "d2")
+    CU_ASSERT (iot_data_array_length (iot_data_array_shape (iot_data_string_map_get (root, "matrix"))) == 2u)
+    iot_data_t * id = iot_data_alloc_i32 (-9);
+    CU_ASSERT (iot_data_i32 (iot_data_map_get (iot_data_string_map_get (root, "ids"), id)) == -3)
+    iot_data_free (id);
+    CU_ASSERT (iot_data_copy (root) == root)
+    iot_data_t * ref = iot_data_add_ref (root); // Constant data not reference counted
+    iot_data_free (ref);
+    CU_ASSERT (iot_data_ref_count (root) == 1u)
+  }
+  iot_data_image_close (image2);
+  iot_data_image_close (image);
+  free (expected);
+
+  iot_data_string_map_add (data, "list", iot_data_alloc_list ()); // Lists not supported
+  CU_ASSERT (! iot_data_image_save (data, path))
+  iot_data_free (data);
+  CU_ASSERT (iot_data_image_open ("/tmp/iot-image-missing") == NULL)
+  CU_ASSERT (iot_file_write (path, json))
+  CU_ASSERT (iot_data_image_open (path) == NULL)
+  unlink (path);
+}
+#endif
+
 #ifdef IOT_HAS_XML
 static void test_data_from_xml (void)
 {
@@ -360,6 +1104,102 @@ static void test_data_from_xml (void)
   free (json);
   iot_data_free (xml);
 }
+
+typedef struct test_xml_events_t
+{
+  uint32_t materialise;
+  uint32_t elements;
+  uint32_t attributes;
+  char * json;
+} test_xml_events_t;
+
+static bool test_xml_event (void * arg, iot_data_xml_event_t event, uint32_t depth, const char * name, const char * value, const iot_data_t * element)
+{
+  test_xml_events_t * events = arg;
+  switch (event)
+  {
+    case IOT_DATA_XML_ELEMENT_START: events->elements++; break;
+    case IOT_DATA_XML_ATTRIBUTE: CU_ASSERT (name && value) events->attributes++; break;
+    case IOT_DATA_XML_ELEMENT_END:
+    {
+      CU_ASSERT ((element != NULL) == (depth == events->materialise))
+      if (element && events->json == NULL) events->json = iot_data_to_json (element);
+      if (strcmp (name, "fubar") == 0) CU_ASSERT (value && strcmp (value, "Some text!") == 0)
+      break;
+    }
+  }
+  return depth == events->materialise;
+}
+
+static void test_data_xml_stream (void)
+{
+  const char * test_xml = "<?xml version=\"1.0\"?>\n"
+  "<busmaster busId=\"main_bus\">\n"
+  "  <device name=\"Random-Integer-Device\" profile=\"Random-Integer-Device\">\n"
+  "    <resource name=\"RandomValue_Int8\" schedule=\"500000000\" />\n"
+  "    <protocol name=\"Other\"><protocolAttribute name=\"Address\" value=\"device-virtual-int-01\" />Any &amp; old rubbish</protocol>\n"
+  "  </device>\n"
+  "  <fubar>Some text!</fubar>\n"
+  "</busmaster>";
+  size_t len = strlen (test_xml);
+  iot_data_t * xml = iot_data_from_xml (test_xml);
+  char * expected = iot_data_to_json (xml);
+  test_xml_events_t events = { .materialise = 1u };
+  iot_data_xml_stream_t * stream = iot_data_xml_stream_alloc (test_xml_event, &events);
+
+  // Materialise root element, pushed in chunks of all sizes
+
+  for (size_t chunk = 1; chunk <= len; chunk++)
+  {
+    bool ok = true;
+    for (size_t pos = 0; pos < len; pos += chunk)
+    {
+      ok = ok && iot_data_xml_stream_push (stream, test_xml + pos, (len - pos) < chunk ? (len - pos) : chunk);
+    }
+    CU_ASSERT (ok)
+    CU_ASSERT (iot_data_xml_stream_finish (stream))
+    CU_ASSERT (events.json && strcmp (events.json, expected) == 0)
+    CU_ASSERT (events.elements == 1u)
+    CU_ASSERT (events.attributes == 0u)
+    free (events.json);
+    events.json = NULL;
+    events.elements = 0u;
+  }
+
+  // No materialisation, events for all elements and attributes
+
+  events.materialise = 0u;
+  CU_ASSERT (iot_data_xml_stream_push (stream, test_xml, len))
+  CU_ASSERT (iot_data_xml_stream_finish (stream))
+  CU_ASSERT (events.elements == 6u)
+  CU_ASSERT (events.attributes == 8u)
+  CU_ASSERT (events.json == NULL)
+
+  // Materialise second level element only
+
+  events.materialise = 2u;
+  events.elements = events.attributes = 0u;
+  CU_ASSERT (iot_data_xml_stream_push (stream, test_xml, len))
+  CU_ASSERT (iot_data_xml_stream_finish (stream))
+  CU_ASSERT (events.elements == 3u)
+  CU_ASSERT (events.attributes == 1u)
+  CU_ASSERT (events.json && strstr (events.json, "\"name\":\"device\"") && strstr (events.json, "Any & old rubbish"))
+  free (events.json);
+  events.json = NULL;
+
+  // Invalid and incomplete XML
+
+  CU_ASSERT (! iot_data_xml_stream_push (stream, "<a></b>", 7u))
+  CU_ASSERT (! iot_data_xml_stream_finish (stream))
+  CU_ASSERT (iot_data_xml_stream_push (stream, "<a><b>", 6u))
+  CU_ASSERT (! iot_data_xml_stream_finish (stream))
+  CU_ASSERT (iot_data_xml_stream_push (stream, "<a/>", 4u))
+  CU_ASSERT (iot_data_xml_stream_finish (stream))
+
+  iot_data_xml_stream_free (stream);
+  free (expected);
+  iot_data_free (xml);
+}
 #endif
 
 #ifdef IOT_HAS_CBOR
@@ -372,7 +1212,7 @@ static void test_data_to_cbor (void)
   {
     // printf ("CBOR: %s\n", iot_data_to_json (cbor));
     // printf ("CBOR hash: %u\n", iot_data_hash (cbor));
-    CU_ASSERT (iot_data_hash (cbor) == 2529945693U)
+    CU_ASSERT (iot_data_hash (cbor) == 3125368439U)
   }
   iot_data_free (cbor);
   iot_data_free (map);
@@ -384,7 +1224,7 @@ static void test_data_to_cbor (void)
   {
     // printf ("CBOR: %s\n", iot_data_to_json (cbor));
     // printf ("CBOR hash: %u\n", iot_data_hash (cbor));
-    CU_ASSERT (iot_data_hash (cbor) == 2695702783U)
+    CU_ASSERT (iot_data_hash (cbor) == 3605130856U)
   }
   iot_data_free (cbor);
   iot_data_free (map);
@@ -413,8 +1253,201 @@ static void test_data_to_cbor (void)
   {
     // printf ("CBOR: %s\n", iot_data_to_json (cbor));
     // printf ("CBOR hash: %u\n", iot_data_hash (cbor));
-    CU_ASSERT (iot_data_hash (cbor) == 2072572302U)
+    CU_ASSERT (iot_data_hash (cbor) == 2757342679U)
+  }
+  iot_data_free (cbor);
+  iot_data_free (map);
+}
+
+static void test_data_from_cbor (void)
+{
+  static const char * json = "{\"UInt\":12345678901,\"Neg\":-12,\"Min\":-9223372036854775808,\"Max\":18446744073709551615,"
+    "\"F64\":1.5,\"Zero\":0.0,\"True\":true,\"False\":false,\"Null\":null,\"Str\":\"Hello\",\"Empty\":\"\","
+    "\"Vec\":[1,\"two\",[3.25],{}],\"Map\":{\"a\":{\"b\":[]}}}";
+  iot_data_t * map = iot_data_from_json (json);
+  iot_data_t * cbor = iot_data_to_cbor (map);
+  iot_data_t * cache = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_data_t * result = iot_data_from_cbor (iot_data_address (cbor), iot_data_array_size (cbor));
+  CU_ASSERT (result != NULL)
+  CU_ASSERT (iot_data_equal (result, map))
+  CU_ASSERT (iot_data_map_key_is_of_type (result, IOT_DATA_STRING))
+  iot_data_free (result);
+  result = iot_data_from_cbor_with_cache (iot_data_address (cbor), iot_data_array_size (cbor), cache);
+  CU_ASSERT (iot_data_equal (result, map))
+  CU_ASSERT (iot_data_map_size (cache) > 0u)
+  CU_ASSERT (iot_data_string_map_get (cache, "Hello") == iot_data_string_map_get (result, "Str"))
+  CU_ASSERT (iot_data_from_cbor (iot_data_address (cbor), iot_data_array_size (cbor) - 1u) == NULL) // Truncated
+  iot_data_free (result);
+  iot_data_free (cbor);
+  iot_data_free (map);
+
+  map = test_sample_map1 (); // Binary and arrays round trip as binary and vectors
+  cbor = iot_data_to_cbor (map);
+  result = iot_data_from_cbor (iot_data_address (cbor), iot_data_array_size (cbor));
+  CU_ASSERT (result != NULL)
+  CU_ASSERT (iot_data_type (iot_data_string_map_get (result, "Binary")) == IOT_DATA_BINARY)
+  CU_ASSERT (iot_data_vector_size (iot_data_string_map_get (result, "Array")) == 4u)
+  CU_ASSERT (strcmp (iot_data_string_map_get_string (result, "Escaped"), "abc\t\n123\x0b\x1fxyz") == 0)
+  iot_data_free (result);
+  iot_data_free (cbor);
+  iot_data_free (map);
+
+  map = test_sample_map2 ();
+  cbor = iot_data_to_cbor (map);
+  result = iot_data_from_cbor (iot_data_address (cbor), iot_data_array_size (cbor));
+  CU_ASSERT (iot_data_map_key_is_of_type (result, IOT_DATA_INT64))
+  iot_data_free (result);
+  iot_data_free (cbor);
+  iot_data_free (map);
+
+  // Indefinite length map, array and string, half float, typed array (RFC 8746 uint16 big endian) and tagged item
+
+  static const uint8_t indef[] = { 0xbf, 0x61, 'a', 0x9f, 0x01, 0xf9, 0x3c, 0x00, 0xff, 0x61, 'b', 0x7f, 0x62, 'h', 'e', 0x63, 'l', 'l', 'o', 0xff,
+    0x61, 'c', 0xd8, 0x41, 0x44, 0x00, 0x01, 0x01, 0x00, 0x61, 'd', 0xc1, 0x1a, 0x00, 0x00, 0x00, 0x10, 0xff };
+  result = iot_data_from_cbor (indef, sizeof (indef));
+  CU_ASSERT (result != NULL)
+  if (result)
+  {
+    const iot_data_t * vec = iot_data_string_map_get (result, "a");
+    CU_ASSERT (iot_data_vector_size (vec) == 2u)
+    CU_ASSERT (iot_data_f32 (iot_data_vector_get (vec, 1u)) == 1.0f)
+    CU_ASSERT (strcmp (iot_data_string_map_get_string (result, "b"), "hello") == 0)
+    const iot_data_t * array = iot_data_string_map_get (result, "c");
+    CU_ASSERT (iot_data_array_type (array) == IOT_DATA_UINT16)
+    CU_ASSERT (iot_data_array_length (array) == 2u)
+    CU_ASSERT (((const uint16_t*) iot_data_address (array))[0] == 1u && ((const uint16_t*) iot_data_address (array))[1] == 256u)
+    CU_ASSERT (iot_data_string_map_get_i64 (result, "d", 0) == 16)
+  }
+  iot_data_free (result);
+
+  // Empty typed array (RFC 8746 float32 little endian) and empty multi dimensional array
+
+  static const uint8_t empty[] = { 0xa2, 0x61, 'e', 0xd8, 0x55, 0x40, 0x61, 's', 0xd8, 0x28, 0x82, 0x82, 0x02, 0x00, 0xd8, 0x55, 0x40 };
+  result = iot_data_from_cbor (empty, sizeof (empty));
+  CU_ASSERT (result != NULL)
+  if (result)
+  {
+    CU_ASSERT (iot_data_array_is_of_type (iot_data_string_map_get (result, "e"), IOT_DATA_FLOAT32))
+    CU_ASSERT (iot_data_array_length (iot_data_string_map_get (result, "e")) == 0u)
+    CU_ASSERT (iot_data_array_is_of_type (iot_data_string_map_get (result, "s"), IOT_DATA_FLOAT32))
+    CU_ASSERT (iot_data_array_length (iot_data_string_map_get (result, "s")) == 0u)
+    cbor = iot_data_to_cbor (result);
+    map = iot_data_from_cbor (iot_data_address (cbor), iot_data_array_size (cbor));
+    CU_ASSERT (map != NULL)
+    CU_ASSERT (iot_data_map_size (map) == 2u)
+    iot_data_free (map);
+    iot_data_free (cbor);
+  }
+  iot_data_free (result);
+
+  // Negative integers below INT64_MIN decoded as Float64
+
+  static const uint8_t negs[] = { 0x82, 0x3b, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3b, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+  result = iot_data_from_cbor (negs, sizeof (negs));
+  CU_ASSERT (result != NULL)
+  if (result)
+  {
+    CU_ASSERT (iot_data_type (iot_data_vector_get (result, 0u)) == IOT_DATA_FLOAT64)
+    CU_ASSERT (iot_data_f64 (iot_data_vector_get (result, 0u)) == -9223372036854775809.0)
+    CU_ASSERT (iot_data_f64 (iot_data_vector_get (result, 1u)) == -18446744073709551616.0)
+  }
+  iot_data_free (result);
+  static const uint8_t bad[] = { 0x82, 0x01 };
+  CU_ASSERT (iot_data_from_cbor (bad, sizeof (bad)) == NULL)
+  iot_data_free (cache);
+}
+
+static void test_data_seq_cbor (void)
+{
+  iot_data_t * vector = iot_data_alloc_vector (2u);
+  iot_data_vector_add (vector, 0u, iot_data_alloc_string ("x", IOT_DATA_REF));
+  iot_data_vector_add (vector, 1u, iot_data_alloc_f64 (1.5));
+  int fds[2];
+  CU_ASSERT (pipe (fds) == 0)
+  iot_data_seq_writer_t * writer = iot_data_seq_writer_alloc_fd (IOT_DATA_SEQ_CBOR, fds[1]);
+  for (uint32_t i = 0; i < 100u; i++)
+  {
+    iot_data_t * value = iot_data_alloc_ui32 (i);
+    CU_ASSERT (iot_data_seq_writer_put (writer, value))
+    CU_ASSERT (iot_data_seq_writer_put (writer, vector))
+    iot_data_free (value);
+  }
+  iot_data_seq_writer_free (writer);
+  close (fds[1]);
+  iot_data_seq_reader_t * reader = iot_data_seq_reader_alloc_fd (IOT_DATA_SEQ_CBOR, fds[0]);
+  iot_data_t * data;
+  uint32_t count = 0u;
+  while ((data = iot_data_seq_reader_next (reader)))
+  {
+    if (count % 2u)
+    {
+      CU_ASSERT (iot_data_equal (data, vector))
+    }
+    else
+    {
+      CU_ASSERT (iot_data_i64 (data) == count / 2u)
+    }
+    iot_data_free (data);
+    count++;
+  }
+  CU_ASSERT (count == 200u)
+  CU_ASSERT (! iot_data_seq_reader_failed (reader))
+  iot_data_seq_reader_free (reader);
+  close (fds[0]);
+
+  // Truncated final item
+  iot_data_t * cbor = iot_data_to_cbor (vector);
+  uint32_t len = iot_data_array_length (cbor);
+  uint8_t * buff = malloc (2u * len);
+  memcpy (buff, iot_data_address (cbor), len);
+  memcpy (buff + len, iot_data_address (cbor), len);
+  reader = iot_data_seq_reader_alloc (IOT_DATA_SEQ_CBOR, buff, 2u * len - 1u);
+  data = iot_data_seq_reader_batch (reader, 10u, NULL);
+  CU_ASSERT (data && iot_data_vector_size (data) == 1u)
+  CU_ASSERT (iot_data_seq_reader_failed (reader))
+  iot_data_free (data);
+  iot_data_seq_reader_free (reader);
+  free (buff);
+  iot_data_free (cbor);
+  iot_data_free (vector);
+}
+
+static void test_data_cbor_iovec (void)
+{
+  uint8_t * bytes = calloc (1, 1024u);
+  bytes[0] = 1u;
+  bytes[1023] = 2u;
+  iot_data_t * bin = iot_data_alloc_binary (bytes, 1024u, IOT_DATA_TAKE);
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_data_string_map_add (map, "Bin", bin);
+  iot_data_string_map_add (map, "Int", iot_data_alloc_i32 (-42));
+  iot_data_string_map_add (map, "Str", iot_data_alloc_string ("Hello", IOT_DATA_REF));
+  iot_data_t * cbor = iot_data_to_cbor (map);
+  uint32_t len = iot_data_array_size (cbor);
+  uint8_t * buff = malloc (len);
+  uint8_t * flat = malloc (len);
+  uint32_t count = 0u;
+  size_t offset = 0u;
+  bool referenced = false;
+
+  CU_ASSERT (iot_data_cbor_size (map) == len)
+  CU_ASSERT (iot_data_to_cbor_buffer (map, buff, len - 1u) == 0u)
+  CU_ASSERT (iot_data_to_cbor_buffer (map, buff, len) == len)
+  CU_ASSERT (memcmp (buff, iot_data_address (cbor), len) == 0)
+  struct iovec * iov = iot_data_to_cbor_iovec (map, &count);
+  CU_ASSERT (count == 3u)
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (iov[i].iov_base == iot_data_address (bin)) referenced = true;
+    if (offset + iov[i].iov_len <= len) memcpy (flat + offset, iov[i].iov_base, iov[i].iov_len);
+    offset += iov[i].iov_len;
   }
+  CU_ASSERT (referenced)
+  CU_ASSERT (offset == len)
+  CU_ASSERT (memcmp (flat, iot_data_address (cbor), len) == 0)
+  free (iov);
+  free (flat);
+  free (buff);
   iot_data_free (cbor);
   iot_data_free (map);
 }
@@ -462,6 +1495,68 @@ static void test_data_from_yaml (void)
   free (json);
   iot_data_free (yaml);
 }
+
+static void test_data_from_yaml_scalars (void)
+{
+  static const char * test_yaml = "[ true, false, null, 42, -42, 0x1F, 017, 09, 1.5, -2e3, .5, inf, nan, 18446744073709551615,"
+    " truex, nulls, name, \"12\", 1.2.3, 12:30, -, +7, macs, mac ]";
+  static const char * expected = "[true,false,null,42,-42,31,15,9e+00,1.5e+00,-2e+03,"
+    "5e-01,1e800,nan,18446744073709551615,\"truex\",\"nulls\",\"name\",\"12\",\"1.2.3\",\"12:30\",\"-\",7,\"macs\",\"mac\"]";
+  iot_data_t * ex;
+  iot_data_t * cache = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_data_t * yaml = iot_data_from_yaml_with_cache (test_yaml, cache, &ex);
+  CU_ASSERT (yaml != NULL && ex == NULL)
+  char * json = iot_data_to_json (yaml);
+  CU_ASSERT (strcmp (json, expected) == 0)
+  free (json);
+  CU_ASSERT (iot_data_map_size (cache) == 9u)
+  iot_data_t * yaml2 = iot_data_from_yaml_with_cache ("{ name: mac }", cache, &ex);
+  CU_ASSERT (iot_data_string_map_get (yaml2, "name") == iot_data_vector_get (yaml, 23u)) // Shared via cache
+  CU_ASSERT (iot_data_map_size (cache) == 9u)
+  iot_data_free (yaml2);
+  iot_data_free (yaml);
+  iot_data_free (cache);
+}
+
+static void test_data_from_yaml_fd (void)
+{
+  static const char * test_yaml = "name: \"Example Sensor\"\nlabels:\n  - sensor\n  - 10\n";
+  int fds[2];
+  iot_data_t * ex;
+  CU_ASSERT (pipe (fds) == 0)
+  CU_ASSERT (write (fds[1], test_yaml, strlen (test_yaml)) == (ssize_t) strlen (test_yaml))
+  close (fds[1]);
+  iot_data_t * yaml = iot_data_from_yaml_fd (fds[0], NULL, &ex);
+  close (fds[0]);
+  CU_ASSERT (yaml != NULL && ex == NULL)
+  char * json = iot_data_to_json (yaml);
+  CU_ASSERT (strcmp (json, "{\"labels\":[\"sensor\",10],\"name\":\"Example Sensor\"}") == 0)
+  free (json);
+  iot_data_free (yaml);
+  yaml = iot_data_from_yaml_fd (99, NULL, &ex); // Invalid descriptor
+  CU_ASSERT (yaml == NULL && ex != NULL)
+  iot_data_free (ex);
+}
+
+static char * test_yaml_substitute (const char * str, void * arg)
+{
+  (void) arg;
+  return (strcmp (str, "${COUNT}") == 0) ? strdup ("12") : (strcmp (str, "id-${ID}") == 0) ? strdup ("id-3") : NULL;
+}
+
+static void test_data_from_yaml_substitute (void)
+{
+  iot_data_t * ex;
+  iot_data_t * yaml = iot_data_from_yaml_with_substitute ("name: id-${ID}\ncount: ${COUNT}\nquoted: \"${COUNT}\"\n", test_yaml_substitute, NULL, &ex);
+  CU_ASSERT (yaml != NULL && ex == NULL)
+  char * json = iot_data_to_json (yaml);
+  CU_ASSERT (strcmp (json, "{\"count\":12,\"name\":\"id-3\",\"quoted\":\"12\"}") == 0) // Plain scalars typed after substitution
+  free (json);
+  iot_data_free (yaml);
+  yaml = iot_data_from_yaml_with_substitute ("name: ${UNKNOWN}\n", test_yaml_substitute, NULL, &ex);
+  CU_ASSERT (yaml == NULL && ex != NULL)
+  iot_data_free (ex);
+}
 #endif
 
 void cunit_data_io_test_init (void)
@@ -472,13 +1567,37 @@ void cunit_data_io_test_init (void)
   CU_add_test (suite, "data_from_json", test_data_from_json);
   CU_add_test (suite, "data_from_json2", test_data_from_json2);
   CU_add_test (suite, "data_from_json3", test_data_from_json3);
+  CU_add_test (suite, "data_from_json_malformed", test_data_from_json_malformed);
+  CU_add_test (suite, "data_from_json_in_place", test_data_from_json_in_place);
+  CU_add_test (suite, "data_json_stream", test_data_json_stream);
+  CU_add_test (suite, "data_json_doc", test_data_json_doc);
+  CU_add_test (suite, "data_json_context", test_data_json_context);
+  CU_add_test (suite, "data_to_struct", test_data_to_struct);
+  CU_add_test (suite, "data_json_sink", test_data_json_sink);
+  CU_add_test (suite, "data_shaped_array", test_data_shaped_array);
+  CU_add_test (suite, "data_canonical", test_data_canonical);
+  CU_add_test (suite, "data_json_numbers", test_data_json_numbers);
+  CU_add_test (suite, "data_json_escape", test_data_json_escape);
+  CU_add_test (suite, "data_array_json", test_data_array_json);
+  CU_add_test (suite, "data_from_json_parallel", test_data_from_json_parallel);
+  CU_add_test (suite, "data_seq_json", test_data_seq_json);
+#if defined (IOT_HAS_FILE) && !defined (_AZURESPHERE_)
+  CU_add_test (suite, "data_image", test_data_image);
+#endif
 #ifdef IOT_HAS_XML
   CU_add_test (suite, "data_from_xml", test_data_from_xml);
+  CU_add_test (suite, "data_xml_stream", test_data_xml_stream);
 #endif
 #ifdef IOT_HAS_CBOR
   CU_add_test (suite, "data_to_cbor", test_data_to_cbor);
+  CU_add_test (suite, "data_from_cbor", test_data_from_cbor);
+  CU_add_test (suite, "data_cbor_iovec", test_data_cbor_iovec);
+  CU_add_test (suite, "data_seq_cbor", test_data_seq_cbor);
 #endif
 #ifdef IOT_HAS_YAML
   CU_add_test (suite, "data_from_yaml", test_data_from_yaml);
+  CU_add_test (suite, "data_from_yaml_scalars", test_data_from_yaml_scalars);
+  CU_add_test (suite, "data_from_yaml_fd", test_data_from_yaml_fd);
+  CU_add_test (suite, "data_from_yaml_substitute", test_data_from_yaml_substitute);
 #endif
 }
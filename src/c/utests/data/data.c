@@ -7,10 +7,15 @@
 
 #include "data.h"
 #include "CUnit.h"
+#include "iot/base64.h"
 #include "iot/config.h"
 #include "iot/logger.h"
+#include "iot/thread.h"
+#include "iot/threadpool.h"
 #include "iot/time.h"
 #include "iot/uuid.h"
+#include "../../data-impl.h"
+#include "../../cpu-impl.h"
 #include <float.h>
 #include <math.h>
 
@@ -953,6 +958,28 @@ static void test_data_map_base64_to_array (void)
   len = iot_data_array_size (data);
   CU_ASSERT (len == 13)
   CU_ASSERT (strncmp ((char *) bytes, "Hello World!\n", len) == 0)
+
+  // Owned strings decoded in place, left unchanged if invalid
+
+  uint8_t raw[300];
+  char * str = malloc (iot_b64_encodesize (sizeof (raw)));
+  for (uint32_t i = 0; i < sizeof (raw); i++) raw[i] = (uint8_t) (i * 7u);
+  iot_b64_encode (raw, sizeof (raw), str, iot_b64_encodesize (sizeof (raw)));
+  iot_data_string_map_add (map, "key2", iot_data_alloc_string (str, IOT_DATA_TAKE));
+  iot_data_string_map_add (map, "key3", iot_data_alloc_string (strdup ("SGVsbG8!V29ybGQhCg=="), IOT_DATA_TAKE));
+  key = iot_data_alloc_string ("key2", IOT_DATA_REF);
+  CU_ASSERT (iot_data_map_base64_to_array (map, key))
+  iot_data_free (key);
+  data = iot_data_string_map_get (map, "key2");
+  CU_ASSERT (iot_data_type (data) == IOT_DATA_ARRAY)
+  CU_ASSERT (iot_data_array_size (data) == sizeof (raw))
+  CU_ASSERT (memcmp (iot_data_address (data), raw, sizeof (raw)) == 0)
+  key = iot_data_alloc_string ("key3", IOT_DATA_REF);
+  CU_ASSERT (! iot_data_map_base64_to_array (map, key))
+  data = iot_data_map_get (map, key);
+  CU_ASSERT (iot_data_type (data) == IOT_DATA_STRING)
+  CU_ASSERT (strcmp (iot_data_string (data), "SGVsbG8!V29ybGQhCg==") == 0)
+  iot_data_free (key);
   iot_data_free (map);
 }
 
@@ -1761,6 +1788,38 @@ static void test_data_multi_metadata (void)
   iot_data_free (data);
 }
 
+static void test_data_metadata_promote (void)
+{
+  iot_data_t * data = iot_data_alloc_ui32 (1u);
+  iot_data_t * key = iot_data_alloc_string ("units", IOT_DATA_REF);
+  iot_data_t * same = iot_data_alloc_string ("units", IOT_DATA_COPY);
+  iot_data_set_metadata (data, iot_data_alloc_string ("mV", IOT_DATA_REF), key);
+  CU_ASSERT (strcmp (iot_data_string (iot_data_get_metadata (data, same)), "mV") == 0) // Equal key, not same instance
+  iot_data_set_metadata (data, iot_data_alloc_string ("V", IOT_DATA_REF), same); // Replaces value
+  CU_ASSERT (strcmp (iot_data_string (iot_data_get_metadata (data, key)), "V") == 0)
+  for (uint32_t i = 0; i < 8u; i++) // Beyond inline slots
+  {
+    iot_data_t * k = iot_data_alloc_ui32 (i);
+    CU_ASSERT (iot_data_get_metadata (data, k) == NULL)
+    iot_data_set_metadata (data, iot_data_alloc_ui32 (i * 10u), k);
+    iot_data_free (k);
+    for (uint32_t j = 0; j <= i; j++)
+    {
+      k = iot_data_alloc_ui32 (j);
+      const iot_data_t * md = iot_data_get_metadata (data, k);
+      CU_ASSERT (md && iot_data_ui32 (md) == j * 10u)
+      iot_data_free (k);
+    }
+    CU_ASSERT (strcmp (iot_data_string (iot_data_get_metadata (data, key)), "V") == 0)
+  }
+  iot_data_t * copy = iot_data_copy (data);
+  CU_ASSERT (strcmp (iot_data_string (iot_data_get_metadata (copy, key)), "V") == 0)
+  iot_data_free (copy);
+  iot_data_free (same);
+  iot_data_free (key);
+  iot_data_free (data);
+}
+
 static bool string_match (const iot_data_t * data, const void * arg)
 {
   const char * target = (const char *) arg;
@@ -1895,6 +1954,79 @@ static void test_data_vector_resize (void)
   iot_data_free (vector);
 }
 
+static void test_data_vector_resize_small (void)
+{
+  iot_data_t * vector = iot_data_alloc_vector (0u);
+  iot_data_vector_resize (vector, 2u);
+  iot_data_vector_add (vector, 0u, iot_data_alloc_ui32 (0u));
+  iot_data_vector_add (vector, 1u, iot_data_alloc_ui32 (1u));
+  iot_data_vector_resize (vector, 1u);
+  iot_data_vector_resize (vector, 4u); // Grow within block
+  CU_ASSERT (iot_data_vector_get (vector, 1u) == NULL)
+  CU_ASSERT (iot_data_vector_get (vector, 3u) == NULL)
+  iot_data_vector_add (vector, 3u, iot_data_alloc_ui32 (3u));
+  iot_data_vector_resize (vector, 100u); // Move from block to heap
+  CU_ASSERT (iot_data_ui32 (iot_data_vector_get (vector, 0u)) == 0u)
+  CU_ASSERT (iot_data_ui32 (iot_data_vector_get (vector, 3u)) == 3u)
+  CU_ASSERT (iot_data_vector_get (vector, 99u) == NULL)
+  iot_data_vector_add (vector, 99u, iot_data_alloc_ui32 (99u));
+  iot_data_t * copy = iot_data_copy (vector);
+  CU_ASSERT (iot_data_equal (vector, copy))
+  iot_data_free (copy);
+  iot_data_free (vector);
+}
+
+static void test_data_vector_append (void)
+{
+  iot_data_t * vector = iot_data_alloc_vector (0u);
+  iot_data_t * expected = iot_data_alloc_vector (1000u);
+  for (uint32_t i = 0; i < 1000u; i++)
+  {
+    iot_data_vector_append (vector, iot_data_alloc_ui32 (i));
+    iot_data_vector_add (expected, i, iot_data_alloc_ui32 (i));
+    CU_ASSERT (iot_data_vector_size (vector) == i + 1u)
+    CU_ASSERT (iot_data_vector_capacity (vector) >= i + 1u)
+  }
+  CU_ASSERT (iot_data_vector_capacity (vector) < 2000u)
+  CU_ASSERT (iot_data_equal (vector, expected))
+  CU_ASSERT (iot_data_hash (vector) == iot_data_hash (expected))
+  uint32_t capacity = iot_data_vector_capacity (vector);
+  iot_data_vector_resize (vector, 10u);
+  CU_ASSERT (iot_data_vector_capacity (vector) == capacity)
+  iot_data_vector_resize (vector, 20u);
+  CU_ASSERT (iot_data_vector_get (vector, 10u) == NULL)
+  iot_data_vector_add (vector, 15u, iot_data_alloc_ui32 (15u));
+  CU_ASSERT (iot_data_vector_compact (vector) == 11u)
+  iot_data_free (vector);
+  vector = iot_data_alloc_vector (0u);
+  iot_data_vector_reserve (vector, 100u);
+  CU_ASSERT (iot_data_vector_capacity (vector) == 100u)
+  CU_ASSERT (iot_data_vector_size (vector) == 0u)
+  iot_data_vector_append (vector, iot_data_alloc_ui32 (0u));
+  iot_data_vector_reserve (vector, 10u);
+  CU_ASSERT (iot_data_vector_capacity (vector) == 100u)
+  CU_ASSERT (iot_data_ui32 (iot_data_vector_get (vector, 0u)) == 0u)
+  iot_data_free (vector);
+  iot_data_free (expected);
+}
+
+static void test_data_memory_size (void)
+{
+  iot_data_t * str = iot_data_alloc_string ("A string long enough not to fit in the value buffer", IOT_DATA_COPY);
+  iot_data_t * vector = iot_data_alloc_vector (2u);
+  CU_ASSERT (iot_data_memory_size (NULL) == 0u)
+  CU_ASSERT (iot_data_memory_size (iot_data_alloc_null ()) == 0u)
+  CU_ASSERT (iot_data_memory_size (str) > iot_data_block_size ())
+  size_t size = iot_data_memory_size (str);
+  iot_data_vector_add (vector, 0u, str);
+  iot_data_vector_add (vector, 1u, iot_data_alloc_string ("A string long enough not to fit in the value buffer", IOT_DATA_COPY));
+  size_t vsize = iot_data_memory_size (vector);
+  CU_ASSERT (vsize >= 2u * size)
+  iot_data_vector_add (vector, 1u, iot_data_add_ref (str)); // Share string
+  CU_ASSERT (iot_data_memory_size (vector) == vsize - size)
+  iot_data_free (vector);
+}
+
 static void test_data_vector_compact (void)
 {
   uint32_t size;
@@ -1937,6 +2069,32 @@ static void test_data_vector_find (void)
   iot_data_free (vector);
 }
 
+static int test_data_vector_reverse (const iot_data_t * data1, const iot_data_t * data2)
+{
+  return iot_data_compare_value (data2, data1);
+}
+
+static void test_data_vector_sort (void)
+{
+  iot_data_t * vector = iot_data_alloc_vector (0u);
+  uint32_t index;
+  for (uint32_t i = 0; i < 100u; i++) iot_data_vector_append (vector, iot_data_alloc_ui32 ((i * 37u) % 100u));
+  iot_data_vector_sort (vector, NULL);
+  for (uint32_t i = 0; i < 100u; i++) CU_ASSERT (iot_data_ui32 (iot_data_vector_get (vector, i)) == i)
+  iot_data_t * val = iot_data_alloc_ui64 (42u);
+  CU_ASSERT (iot_data_vector_search (vector, val, NULL, &index) && index == 42u)
+  iot_data_free (val);
+  val = iot_data_alloc_ui32 (100u);
+  CU_ASSERT (! iot_data_vector_search (vector, val, NULL, &index) && index == 100u)
+  iot_data_free (val);
+  iot_data_vector_sort (vector, test_data_vector_reverse);
+  CU_ASSERT (iot_data_ui32 (iot_data_vector_get (vector, 0u)) == 99u)
+  val = iot_data_alloc_ui32 (0u);
+  CU_ASSERT (iot_data_vector_search (vector, val, test_data_vector_reverse, &index) && index == 99u)
+  iot_data_free (val);
+  iot_data_free (vector);
+}
+
 static void test_data_vector_get_pointer (void)
 {
   iot_data_t *vector = iot_data_alloc_vector (2);
@@ -2643,6 +2801,43 @@ static void test_list_iter_remove_all (void)
   iot_data_free (list);
 }
 
+static void test_list_unrolled (void)
+{
+  iot_data_t * list = iot_data_alloc_list ();
+  iot_data_list_iter_t iter;
+  uint32_t expected = 0u;
+  for (uint32_t i = 0; i < 50u; i++) // Values 0 to 99, pushed at both ends
+  {
+    iot_data_list_tail_push (list, iot_data_alloc_ui32 (49u - i));
+    iot_data_list_head_push (list, iot_data_alloc_ui32 (50u + i));
+  }
+  CU_ASSERT (iot_data_list_length (list) == 100u)
+  iot_data_list_iter (list, &iter);
+  while (iot_data_list_iter_next (&iter))
+  {
+    CU_ASSERT (iot_data_ui32 (iot_data_list_iter_value (&iter)) == expected++)
+    if (expected % 3u == 0u) CU_ASSERT (iot_data_list_iter_remove (&iter)) // Remove every third value
+  }
+  CU_ASSERT (expected == 100u)
+  CU_ASSERT (iot_data_list_length (list) == 67u)
+  iot_data_list_iter (list, &iter);
+  while (iot_data_list_iter_prev (&iter))
+  {
+    CU_ASSERT ((iot_data_ui32 (iot_data_list_iter_value (&iter)) + 1u) % 3u != 0u)
+  }
+  for (uint32_t i = 0; i < 67u; i++)
+  {
+    iot_data_t * value = (i % 2u) ? iot_data_list_head_pop (list) : iot_data_list_tail_pop (list);
+    CU_ASSERT (value != NULL)
+    iot_data_free (value);
+  }
+  CU_ASSERT (iot_data_list_length (list) == 0u)
+  CU_ASSERT (iot_data_list_tail_pop (list) == NULL)
+  iot_data_list_head_push (list, iot_data_alloc_ui32 (1u));
+  CU_ASSERT (iot_data_list_length (list) == 1u)
+  iot_data_free (list);
+}
+
 static bool test_list_cmp_fn (const iot_data_t * value, const void * arg)
 {
   return (iot_data_ui32 (value) == *((const uint32_t *) arg));
@@ -3699,6 +3894,35 @@ static void test_data_add_ref (void)
   CU_ASSERT (ref == NULL)
 }
 
+static void test_data_freeze (void)
+{
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_data_t * vec = iot_data_alloc_vector (2u);
+  iot_data_vector_add (vec, 0u, iot_data_alloc_string ("frozen", IOT_DATA_REF));
+  iot_data_string_map_add (map, "vec", vec);
+  iot_data_string_map_add (map, "null", iot_data_alloc_null ());
+  CU_ASSERT (iot_data_freeze (map) == map)
+  CU_ASSERT (iot_data_is_frozen (map))
+  CU_ASSERT (iot_data_is_frozen (vec))
+  CU_ASSERT (iot_data_is_frozen (iot_data_vector_get (vec, 0u)))
+  CU_ASSERT (! iot_data_is_frozen (iot_data_string_map_get (map, "null")))
+  CU_ASSERT (! iot_data_is_frozen (NULL))
+  for (uint32_t i = 0; i < 10u; i++) iot_data_add_ref (map);
+  CU_ASSERT (iot_data_ref_count (map) == 1u)
+  for (uint32_t i = 0; i < 20u; i++) iot_data_free (map);
+  CU_ASSERT (iot_data_ref_count (map) == 1u)
+  iot_data_t * mutable = iot_data_make_mutable (map);
+  CU_ASSERT (mutable != map)
+  CU_ASSERT (! iot_data_is_frozen (mutable))
+  CU_ASSERT (iot_data_equal (mutable, map))
+  iot_data_free (mutable);
+  CU_ASSERT (iot_data_thaw (map) == map)
+  CU_ASSERT (! iot_data_is_frozen (map))
+  CU_ASSERT (! iot_data_is_frozen (vec))
+  CU_ASSERT (iot_data_ref_count (vec) == 1u)
+  iot_data_free (map);
+}
+
 static void test_data_alloc_uuid (void)
 {
   iot_data_t * data = iot_data_alloc_uuid_string ();
@@ -3792,6 +4016,30 @@ static void test_data_string_from_binary (void)
   iot_data_free (bin);
 }
 
+static void test_data_string_fmt (void)
+{
+  const char * topic = "devices/pump/0123456789abcdef/readings/temperature";
+  iot_data_t * str = iot_data_alloc_string_fmt ("dev-%u", 42u);
+  iot_data_t * cmp = iot_data_alloc_string ("dev-42", IOT_DATA_REF);
+  CU_ASSERT (strcmp (iot_data_string (str), "dev-42") == 0)
+  CU_ASSERT (iot_data_equal (str, cmp))
+  CU_ASSERT (iot_data_hash (str) == iot_data_hash (cmp))
+  iot_data_free (cmp);
+  iot_data_free (str);
+  str = iot_data_alloc_string_fmt ("devices/%s/%s/readings/%s", "pump", "0123456789abcdef", "temperature");
+  CU_ASSERT (strcmp (iot_data_string (str), topic) == 0)
+  iot_data_free (str);
+  str = iot_data_alloc_string_fmt_n (strlen (topic), "devices/%s/%s/readings/%s", "pump", "0123456789abcdef", "temperature");
+  CU_ASSERT (strcmp (iot_data_string (str), topic) == 0)
+  iot_data_free (str);
+  str = iot_data_alloc_string_fmt_n (40u, "devices/%s/%s/readings/%s", "pump", "0123456789abcdef", "temperature");
+  CU_ASSERT (strcmp (iot_data_string (str), topic) == 0)
+  iot_data_free (str);
+  str = iot_data_alloc_string_fmt_n (100u, "dev-%u", 42u);
+  CU_ASSERT (strcmp (iot_data_string (str), "dev-42") == 0)
+  iot_data_free (str);
+}
+
 static void test_data_alloc_heap (void)
 {
   iot_data_alloc_heap (true);
@@ -3800,6 +4048,90 @@ static void test_data_alloc_heap (void)
   iot_data_alloc_heap (false);
 }
 
+static void test_data_arena (void)
+{
+  char text[2048];
+  iot_data_arena_t * arena = iot_data_arena_alloc (4u);
+  CU_ASSERT (iot_data_arena_set_current (arena) == NULL)
+  iot_data_t * map = iot_data_from_json (test_config);
+  CU_ASSERT (map != NULL)
+  memset (text, 'x', sizeof (text) - 1);
+  text[sizeof (text) - 1] = '\0';
+  iot_data_t * list = iot_data_alloc_list ();
+  iot_data_list_head_push (list, iot_data_alloc_string (text, IOT_DATA_COPY));
+  iot_data_list_head_push (list, iot_data_alloc_string (text + 2000, IOT_DATA_COPY));
+  iot_data_string_map_add (map, "List", list);
+  iot_data_string_map_add (map, "Vector", iot_data_alloc_vector (100u));
+  iot_data_string_map_add (map, "Binary", iot_data_alloc_binary (calloc (1, 100u), 100u, IOT_DATA_TAKE));
+  CU_ASSERT (iot_data_arena_set_current (NULL) == arena)
+  iot_data_t * copy = iot_data_copy (map);
+  CU_ASSERT (iot_data_equal (map, copy))
+  iot_data_free (map); // No effect for arena data
+  CU_ASSERT (iot_data_equal (iot_data_string_map_get (map, "Interval"), iot_data_string_map_get (copy, "Interval")))
+  iot_data_arena_free (arena);
+  iot_data_free (copy);
+  iot_data_arena_free (NULL);
+}
+
+static void * test_data_intern_thread (void * arg)
+{
+  char key[32];
+  for (uint32_t i = 0; i < 1000u; i++)
+  {
+    snprintf (key, sizeof (key), "key%u", i % 100u);
+    iot_data_free (iot_data_intern_string (arg, key));
+  }
+  return NULL;
+}
+
+static void test_data_intern (void)
+{
+  pthread_t threads[4];
+  iot_data_intern_t * pool = iot_data_intern_alloc (0u);
+  iot_data_t * s1 = iot_data_intern_string (pool, "Hello");
+  iot_data_t * s2 = iot_data_intern (pool, iot_data_alloc_string ("Hello", IOT_DATA_COPY));
+  iot_data_t * s3 = iot_data_intern (pool, iot_data_alloc_string ("World", IOT_DATA_COPY));
+  iot_data_t * s4 = iot_data_intern (pool, iot_data_alloc_string ("Constant", IOT_DATA_REF));
+  CU_ASSERT (s1 == s2)
+  CU_ASSERT (s1 != s3)
+  CU_ASSERT (strcmp (iot_data_string (s3), "World") == 0)
+  CU_ASSERT (iot_data_intern_size (pool) == 3u)
+  CU_ASSERT (iot_data_intern_purge (pool) == 0u)
+  iot_data_free (s1);
+  iot_data_free (s2);
+  iot_data_free (s4);
+  CU_ASSERT (iot_data_intern_purge (pool) == 2u)
+  CU_ASSERT (iot_data_intern_size (pool) == 1u)
+
+  iot_data_t * map = iot_data_from_json_with_pool ("{\"Name\":\"World\",\"List\":[\"World\",\"Name\"]}", false, pool);
+  const iot_data_t * vec = iot_data_string_map_get (map, "List");
+  CU_ASSERT (iot_data_string_map_get (map, "Name") == s3)
+  CU_ASSERT (iot_data_vector_get (vec, 0u) == s3)
+  CU_ASSERT (iot_data_intern_size (pool) == 3u)
+  iot_data_t * copy = iot_data_from_json ("{\"Name\":\"World\"}");
+  CU_ASSERT (iot_data_string_map_get (copy, "Name") != s3)
+  iot_data_compress_with_pool (copy, pool);
+  CU_ASSERT (iot_data_string_map_get (copy, "Name") == s3)
+  CU_ASSERT (iot_data_equal (iot_data_string_map_get (map, "Name"), iot_data_string_map_get (copy, "Name")))
+  iot_data_free (copy);
+  iot_data_free (map);
+  iot_data_free (s3);
+  CU_ASSERT (iot_data_intern_purge (pool) == 3u)
+  CU_ASSERT (iot_data_intern_size (pool) == 0u)
+  iot_data_intern_free (pool);
+
+  pool = iot_data_intern_alloc (16u);
+  for (uint32_t i = 0; i < 4u; i++) pthread_create (&threads[i], NULL, test_data_intern_thread, pool);
+  for (uint32_t i = 0; i < 4u; i++) pthread_join (threads[i], NULL);
+  CU_ASSERT (iot_data_intern_size (pool) <= 100u)
+  iot_data_intern_free (pool);
+  s1 = iot_data_intern_string (iot_data_intern_global (), "Global");
+  s2 = iot_data_intern_string (iot_data_intern_global (), "Global");
+  CU_ASSERT (s1 == s2)
+  iot_data_free (s1);
+  iot_data_free (s2);
+}
+
 static void test_data_cast (void)
 {
   static const int8_t i8_val = -8;
@@ -4250,6 +4582,63 @@ static void test_data_const_list (void)
   iot_data_free (list_non_static);
 }
 
+static void test_data_const_map (void)
+{
+  static const char * const units[] = { "m", "metre", "s", "second", "kg", "kilogram", "A", "ampere", "K", "kelvin", "mol", "mole", "cd", "candela" };
+  static iot_data_map_static_t block;
+  static iot_data_map_node_static_t nodes[7];
+  static iot_data_static_t strs[14];
+  static iot_data_vector_static_t vblock;
+  static iot_data_static_t vstrs[3];
+  static iot_data_t * values[3];
+  iot_data_t * map = iot_data_alloc_const_string_map (&block, nodes, strs, units, 7u);
+  CU_ASSERT (map == IOT_DATA_STATIC (&block))
+  CU_ASSERT (iot_data_is_static (map))
+  CU_ASSERT (iot_data_type (map) == IOT_DATA_MAP)
+  CU_ASSERT (iot_data_map_size (map) == 7u)
+  CU_ASSERT_STRING_EQUAL (iot_data_string_map_get_string (map, "kg"), "kilogram")
+  CU_ASSERT_STRING_EQUAL (iot_data_string_map_get_string (map, "cd"), "candela")
+  CU_ASSERT (iot_data_string_map_get (map, "g") == NULL)
+  iot_data_t * dyn = iot_data_alloc_map (IOT_DATA_STRING);
+  for (uint32_t i = 0; i < 7u; i++) iot_data_string_map_add (dyn, units[2u * i], iot_data_alloc_string (units[2u * i + 1u], IOT_DATA_REF));
+  CU_ASSERT (iot_data_equal (map, dyn))
+  CU_ASSERT (iot_data_hash (map) == iot_data_hash (dyn))
+  iot_data_map_iter_t iter;
+  const char * prev = "";
+  uint32_t count = 0u;
+  iot_data_map_iter (map, &iter);
+  while (iot_data_map_iter_next (&iter))
+  {
+    CU_ASSERT (strcmp (prev, iot_data_map_iter_string_key (&iter)) < 0)
+    prev = iot_data_map_iter_string_key (&iter);
+    count++;
+  }
+  CU_ASSERT (count == 7u)
+  CU_ASSERT (iot_data_copy (map) == map)
+  iot_data_add_ref (map);
+  iot_data_free (map);
+  iot_data_free (map);
+  iot_data_free (dyn);
+
+  for (uint32_t i = 0; i < 3u; i++) values[i] = iot_data_alloc_const_string (&vstrs[i], units[i]);
+  iot_data_t * vector = iot_data_alloc_const_vector (&vblock, values, 3u);
+  CU_ASSERT (vector == IOT_DATA_STATIC (&vblock))
+  CU_ASSERT (iot_data_is_static (vector))
+  CU_ASSERT (iot_data_vector_size (vector) == 3u)
+  CU_ASSERT_STRING_EQUAL (iot_data_string (iot_data_vector_get (vector, 1u)), "metre")
+  iot_data_free (vector);
+  CU_ASSERT (iot_data_vector_size (vector) == 3u)
+
+  static iot_data_map_static_t nblock;
+  static iot_data_map_node_static_t nnodes[2];
+  static iot_data_static_t keys[2];
+  iot_data_t * pairs[] = { iot_data_alloc_const_ui32 (&keys[0], 2u), vector, iot_data_alloc_const_ui32 (&keys[1], 1u), map };
+  iot_data_t * nested = iot_data_alloc_const_map (&nblock, nnodes, pairs, 2u, IOT_DATA_UINT32);
+  CU_ASSERT (iot_data_map_size (nested) == 2u)
+  CU_ASSERT (iot_data_map_get (nested, pairs[0]) == vector)
+  CU_ASSERT (iot_data_map_get (nested, pairs[2]) == map)
+}
+
 static void test_data_const_types (void)
 {
   const iot_data_t * b1 = iot_data_alloc_bool (true);
@@ -4275,13 +4664,13 @@ static void test_data_hash (void)
   iot_data_free (data);
   CU_ASSERT (iot_data_hash (NULL) == 0u)
   data = iot_data_alloc_string ("Dummy", IOT_DATA_REF);
-  CU_ASSERT (iot_data_hash (data) == 3802084562u)
+  CU_ASSERT (iot_data_hash (data) == 2196366783u)
   iot_data_free (data);
   data = iot_data_alloc_array ((uint8_t *) "binary", strlen ("binary"), IOT_DATA_UINT8, IOT_DATA_REF);
-  CU_ASSERT (iot_data_hash (data) == 2016023253u)
+  CU_ASSERT (iot_data_hash (data) == 283231397u)
   iot_data_free (data);
   data = iot_data_alloc_binary ((uint8_t *) "bool", strlen ("bool"), IOT_DATA_REF);
-  CU_ASSERT (iot_data_hash (data) == 636838452u)
+  CU_ASSERT (iot_data_hash (data) == 2771760077u)
   iot_data_free (data);
 }
 
@@ -4324,6 +4713,114 @@ static void test_data_map_empty (void)
   iot_data_free (map);
 }
 
+static void test_data_map_range (void)
+{
+  iot_data_t * map = iot_data_alloc_typed_map (IOT_DATA_UINT32, IOT_DATA_UINT32);
+  iot_data_map_iter_t iter;
+  iot_data_t * key;
+  const iot_data_t * bound;
+  uint32_t i;
+  uint32_t count = 0u;
+
+  for (i = 0; i < 20u; i += 2u) iot_data_map_add (map, iot_data_alloc_ui32 (i), iot_data_alloc_ui32 (i * 10u));
+
+  key = iot_data_alloc_ui32 (7u);
+  bound = iot_data_map_lower_bound (map, key);
+  CU_ASSERT (bound && iot_data_ui32 (bound) == 8u)
+  bound = iot_data_map_upper_bound (map, key);
+  CU_ASSERT (bound && iot_data_ui32 (bound) == 8u)
+  iot_data_free (key);
+  key = iot_data_alloc_ui32 (8u);
+  bound = iot_data_map_lower_bound (map, key);
+  CU_ASSERT (bound && iot_data_ui32 (bound) == 8u)
+  bound = iot_data_map_upper_bound (map, key);
+  CU_ASSERT (bound && iot_data_ui32 (bound) == 10u)
+
+  iot_data_map_iter (map, &iter);
+  CU_ASSERT (iot_data_map_iter_seek (&iter, key))
+  i = 8u;
+  while (iot_data_map_iter_next (&iter))
+  {
+    CU_ASSERT (iot_data_ui32 (iot_data_map_iter_key (&iter)) == i)
+    CU_ASSERT (iot_data_map_iter_has_next (&iter) == (i < 18u))
+    i += 2u;
+    count++;
+  }
+  CU_ASSERT (count == 6u)
+  iot_data_free (key);
+
+  key = iot_data_alloc_ui32 (0u);
+  iot_data_map_iter (map, &iter);
+  CU_ASSERT (iot_data_map_iter_seek (&iter, key))
+  CU_ASSERT (iot_data_map_iter_has_next (&iter))
+  CU_ASSERT (iot_data_map_iter_next (&iter))
+  CU_ASSERT (iot_data_ui32 (iot_data_map_iter_key (&iter)) == 0u)
+  iot_data_free (key);
+
+  key = iot_data_alloc_ui32 (19u);
+  CU_ASSERT (iot_data_map_lower_bound (map, key) == NULL)
+  CU_ASSERT (iot_data_map_upper_bound (map, key) == NULL)
+  iot_data_map_iter (map, &iter);
+  CU_ASSERT (! iot_data_map_iter_seek (&iter, key))
+  CU_ASSERT (! iot_data_map_iter_has_next (&iter))
+  CU_ASSERT (! iot_data_map_iter_next (&iter))
+  iot_data_free (key);
+  iot_data_free (map);
+}
+
+static void test_data_map_int_keys (void)
+{
+  iot_data_t * i8map = iot_data_alloc_typed_map (IOT_DATA_INT8, IOT_DATA_INT32);
+  iot_data_t * i64map = iot_data_alloc_typed_map (IOT_DATA_INT64, IOT_DATA_INT32);
+  iot_data_t * u64map = iot_data_alloc_typed_map (IOT_DATA_UINT64, IOT_DATA_INT32);
+  iot_data_map_iter_t iter;
+  iot_data_t * key;
+  int32_t prev;
+
+  for (int32_t i = -100; i < 100; i += 3) // Insert out of order
+  {
+    int32_t k = (i * 37) % 100;
+    iot_data_map_add (i8map, iot_data_alloc_i8 ((int8_t) k), iot_data_alloc_i32 (k));
+    iot_data_map_add (i64map, iot_data_alloc_i64 ((int64_t) k * 1000000000000), iot_data_alloc_i32 (k));
+    iot_data_map_add (u64map, iot_data_alloc_ui64 (UINT64_MAX - (uint64_t) (k + 100)), iot_data_alloc_i32 (k));
+  }
+  CU_ASSERT (iot_data_map_size (i8map) == iot_data_map_size (i64map))
+  CU_ASSERT (iot_data_map_size (i8map) == iot_data_map_size (u64map))
+  iot_data_map_iter (i8map, &iter);
+  prev = INT32_MIN;
+  while (iot_data_map_iter_next (&iter)) // Signed keys ordered with negatives first
+  {
+    int32_t k = iot_data_i8 (iot_data_map_iter_key (&iter));
+    CU_ASSERT (k > prev)
+    CU_ASSERT (iot_data_i32 (iot_data_map_iter_value (&iter)) == k)
+    key = iot_data_alloc_i64 ((int64_t) k * 1000000000000);
+    CU_ASSERT (iot_data_i32 (iot_data_map_get (i64map, key)) == k)
+    iot_data_free (key);
+    key = iot_data_alloc_ui64 (UINT64_MAX - (uint64_t) (k + 100));
+    CU_ASSERT (iot_data_i32 (iot_data_map_get (u64map, key)) == k)
+    iot_data_free (key);
+    prev = k;
+  }
+  CU_ASSERT (iot_data_map_size (i8map) == 67u)
+  key = iot_data_alloc_i8 (-5);
+  CU_ASSERT (iot_data_map_get (i8map, key) == NULL)
+  CU_ASSERT (iot_data_i8 (iot_data_map_lower_bound (i8map, key)) == -3)
+  CU_ASSERT (iot_data_i8 (iot_data_map_upper_bound (i8map, key)) == -3)
+  iot_data_free (key);
+  key = iot_data_alloc_i8 (-3);
+  CU_ASSERT (iot_data_i8 (iot_data_map_lower_bound (i8map, key)) == -3)
+  CU_ASSERT (iot_data_i8 (iot_data_map_upper_bound (i8map, key)) == -2)
+  CU_ASSERT (iot_data_map_remove (i8map, key))
+  CU_ASSERT (iot_data_map_get (i8map, key) == NULL)
+  iot_data_free (key);
+  key = iot_data_alloc_i16 (2); // Key of other type not found
+  CU_ASSERT (iot_data_map_get (i8map, key) == NULL)
+  iot_data_free (key);
+  iot_data_free (u64map);
+  iot_data_free (i64map);
+  iot_data_free (i8map);
+}
+
 static void test_data_map_struct_key (void)
 {
   iot_data_t * map = iot_data_alloc_typed_map (IOT_DATA_MAP, IOT_DATA_UINT32);
@@ -4616,6 +5113,177 @@ static void test_data_array_transform (void)
   iot_data_free (data2);
 }
 
+static void test_data_array_reduce (void)
+{
+  int16_t samples[1001];
+  float fsamples[13];
+  double sum, mean, min, max;
+  for (int i = 0; i < 1001; i++) samples[i] = (int16_t) (i - 500);
+  for (int i = 0; i < 13; i++) fsamples[i] = (float) i * 0.5f;
+  iot_data_t * data = iot_data_alloc_array (samples, 1001u, IOT_DATA_INT16, IOT_DATA_REF);
+  CU_ASSERT (iot_data_array_sum (data, &sum) && sum == 0.0)
+  CU_ASSERT (iot_data_array_mean (data, &mean) && mean == 0.0)
+  CU_ASSERT (iot_data_array_min (data, &min) && min == -500.0)
+  CU_ASSERT (iot_data_array_max (data, &max) && max == 500.0)
+  iot_data_free (data);
+  data = iot_data_alloc_array (fsamples, 13u, IOT_DATA_FLOAT32, IOT_DATA_REF);
+  CU_ASSERT (iot_data_array_sum (data, &sum) && sum == 39.0)
+  CU_ASSERT (iot_data_array_range (data, &min, &max) && min == 0.0 && max == 6.0)
+  iot_data_free (data);
+  data = iot_data_alloc_array (NULL, 0u, IOT_DATA_UINT32, IOT_DATA_REF);
+  CU_ASSERT (! iot_data_array_sum (data, &sum))
+  CU_ASSERT (! iot_data_array_range (data, &min, &max))
+  iot_data_free (data);
+}
+
+#define DATA_ARRAY_VARIANT_LEN 1003u
+#define DATA_ARRAY_SAME(a,b) (((a) == (b)) || ((a) != (a) && (b) != (b)))
+
+static void test_data_array_variants (void)
+{
+  static const uint32_t variants[] = { IOT_CPU_AVX2 };
+  uint8_t * samples = malloc (DATA_ARRAY_VARIANT_LEN * sizeof (double) + 8u);
+  double sum, min, max, portable_sum, portable_min, portable_max;
+
+  srandom (19);
+  for (unsigned i = 0; i < DATA_ARRAY_VARIANT_LEN * sizeof (double) + 8u; i++)
+  {
+    samples[i] = (uint8_t) (random () % 256);
+  }
+  for (unsigned v = 0; v < sizeof (variants) / sizeof (variants[0]); v++)
+  {
+    if (! iot_cpu_has (variants[v])) continue;
+    for (iot_data_type_t type = IOT_DATA_INT8; type <= IOT_DATA_FLOAT64; type++)
+    {
+      for (uint32_t len = 1u; len <= DATA_ARRAY_VARIANT_LEN; len += (len < 40u) ? 1u : 97u)
+      {
+        iot_data_t * data = iot_data_alloc_array (samples + (len % 8u), len, type, IOT_DATA_REF); // Unaligned, random bits include NaNs for floats
+        iot_data_array_select (0u);
+        CU_ASSERT (iot_data_array_sum (data, &portable_sum) && iot_data_array_range (data, &portable_min, &portable_max))
+        iot_data_array_select (variants[v]);
+        CU_ASSERT (iot_data_array_sum (data, &sum) && iot_data_array_range (data, &min, &max))
+        CU_ASSERT (DATA_ARRAY_SAME (sum, portable_sum) && DATA_ARRAY_SAME (min, portable_min) && DATA_ARRAY_SAME (max, portable_max))
+        iot_data_free (data);
+      }
+    }
+  }
+  iot_data_array_select (iot_cpu_features ());
+  free (samples);
+}
+
+static void test_data_array_sort (void)
+{
+  int32_t samples[1000];
+  double dsamples[6] = { 2.5, -0.5, 1e300, -1e300, 0.0, -3.0 };
+  uint32_t index;
+  for (int i = 0; i < 1000; i++) samples[i] = (int32_t) ((i * 7919) % 1000) - 500;
+  iot_data_t * data = iot_data_alloc_array (samples, 1000u, IOT_DATA_INT32, IOT_DATA_REF);
+  CU_ASSERT (iot_data_array_sort (data))
+  for (int i = 0; i < 1000; i++) CU_ASSERT (samples[i] == i - 500)
+  iot_data_t * val = iot_data_alloc_i32 (-100);
+  CU_ASSERT (iot_data_array_search (data, val, &index) && index == 400u)
+  iot_data_free (val);
+  val = iot_data_alloc_ui8 (7u);
+  CU_ASSERT (iot_data_array_search (data, val, &index) && index == 507u)
+  iot_data_free (val);
+  val = iot_data_alloc_i32 (600);
+  CU_ASSERT (! iot_data_array_search (data, val, &index) && index == 1000u)
+  iot_data_free (val);
+  iot_data_free (data);
+  data = iot_data_alloc_array (dsamples, 6u, IOT_DATA_FLOAT64, IOT_DATA_REF);
+  CU_ASSERT (iot_data_array_sort (data))
+  CU_ASSERT (dsamples[0] == -1e300 && dsamples[1] == -3.0 && dsamples[2] == -0.5 && dsamples[3] == 0.0 && dsamples[4] == 2.5 && dsamples[5] == 1e300)
+  val = iot_data_alloc_f64 (1.0);
+  CU_ASSERT (! iot_data_array_search (data, val, &index) && index == 4u)
+  iot_data_free (val);
+  iot_data_free (data);
+  data = iot_data_alloc_array (NULL, 0u, IOT_DATA_BOOL, IOT_DATA_REF);
+  CU_ASSERT (! iot_data_array_sort (data))
+  iot_data_free (data);
+}
+
+static void test_data_array_scale (void)
+{
+  int16_t samples[300];
+  double dsamples[5] = { 1e300, -1e300, NAN, 3.7, -3.7 };
+  for (int i = 0; i < 300; i++) samples[i] = (int16_t) (i - 20);
+  iot_data_t * data = iot_data_alloc_array (samples, 300u, IOT_DATA_INT16, IOT_DATA_REF);
+  iot_data_t * conv = iot_data_array_convert (data, IOT_DATA_UINT8);
+  const uint8_t * u8 = iot_data_address (conv);
+  CU_ASSERT (iot_data_array_type (conv) == IOT_DATA_UINT8 && iot_data_array_length (conv) == 300u)
+  CU_ASSERT (u8[0] == 0u && u8[20] == 0u && u8[21] == 1u && u8[275] == 255u && u8[299] == 255u)
+  iot_data_free (conv);
+  conv = iot_data_array_scale (data, 0.5, 10.0, IOT_DATA_FLOAT64);
+  const double * f64 = iot_data_address (conv);
+  CU_ASSERT (f64[0] == 0.0 && f64[299] == 149.5)
+  iot_data_free (conv);
+  conv = iot_data_array_convert (data, IOT_DATA_INT16);
+  CU_ASSERT (iot_data_equal (data, conv))
+  iot_data_free (conv);
+  iot_data_free (data);
+  data = iot_data_alloc_array (dsamples, 5u, IOT_DATA_FLOAT64, IOT_DATA_REF);
+  conv = iot_data_array_convert (data, IOT_DATA_INT32);
+  const int32_t * i32 = iot_data_address (conv);
+  CU_ASSERT (i32[0] == INT32_MAX && i32[1] == INT32_MIN && i32[2] == 0 && i32[3] == 3 && i32[4] == -3)
+  iot_data_free (conv);
+  conv = iot_data_array_convert (data, IOT_DATA_UINT64);
+  const uint64_t * u64 = iot_data_address (conv);
+  CU_ASSERT (u64[0] == UINT64_MAX && u64[1] == 0u && u64[3] == 3u)
+  iot_data_free (conv);
+  conv = iot_data_array_convert (data, IOT_DATA_FLOAT32);
+  const float * f32 = iot_data_address (conv);
+  CU_ASSERT (f32[0] == FLT_MAX && f32[1] == -FLT_MAX)
+  iot_data_free (conv);
+  iot_data_free (data);
+}
+
+static void test_data_batch (void)
+{
+  static const char * names[] = { "ts", "value" };
+  static const iot_data_type_t types[] = { IOT_DATA_UINT64, IOT_DATA_FLOAT32 };
+  iot_data_t * batch = iot_data_alloc_batch (names, types, 2u);
+  iot_data_t * copy;
+  char * json;
+  CU_ASSERT (iot_data_batch_columns (batch) == 2u && iot_data_batch_rows (batch) == 0u)
+  json = iot_data_to_json (batch);
+  CU_ASSERT (strcmp (json, "{\"ts\":[],\"value\":[]}") == 0)
+  free (json);
+  for (uint32_t i = 0; i < 100u; i++)
+  {
+    iot_data_t * values[2] = { iot_data_alloc_ui64 (1000u + i), iot_data_alloc_i32 ((int32_t) i) };
+    CU_ASSERT (iot_data_batch_append (batch, (const iot_data_t * const *) values))
+    iot_data_free (values[0]);
+    iot_data_free (values[1]);
+  }
+  CU_ASSERT (iot_data_batch_rows (batch) == 100u)
+  const iot_data_t * ts = iot_data_batch_column (batch, 0u);
+  const float * value = iot_data_address (iot_data_batch_column (batch, 1u));
+  CU_ASSERT (iot_data_array_type (ts) == IOT_DATA_UINT64 && iot_data_array_length (ts) == 100u)
+  CU_ASSERT (((const uint64_t*) iot_data_address (ts))[99] == 1099u && value[0] == 0.0f && value[99] == 99.0f)
+  copy = iot_data_copy (batch);
+  CU_ASSERT (iot_data_equal (batch, copy))
+  uint32_t row = iot_data_batch_add_row (copy);
+  CU_ASSERT (row == 100u && ! iot_data_equal (batch, copy))
+  iot_data_t * val = iot_data_alloc_string ("bad", IOT_DATA_REF);
+  CU_ASSERT (! iot_data_batch_set (copy, 1u, row, val))
+  iot_data_free (val);
+  val = iot_data_alloc_f64 (2.5);
+  CU_ASSERT (iot_data_batch_set (copy, 1u, row, val))
+  CU_ASSERT (((const float*) iot_data_address (iot_data_batch_column (copy, 1u)))[100] == 2.5f)
+  iot_data_free (val);
+  iot_data_free (copy);
+  iot_data_free (batch);
+  static const char * rnames[] = { "value", "ts" };
+  batch = iot_data_alloc_batch (rnames, types, 2u);
+  val = iot_data_alloc_ui64 (5u);
+  CU_ASSERT (iot_data_batch_append (batch, (const iot_data_t * const []) { NULL, val }))
+  iot_data_free (val);
+  json = iot_data_to_json (batch);
+  CU_ASSERT (strcmp (json, "{\"value\":[0],\"ts\":[5e+00]}") == 0)
+  free (json);
+  iot_data_free (batch);
+}
+
 static void test_data_transform (void)
 {
   iot_data_t * data = iot_data_alloc_i8 (1);
@@ -5062,6 +5730,45 @@ static void test_get_at (void)
   iot_data_free (map);
 }
 
+static iot_data_t * test_path (const char * key1, const char * key2, int32_t index)
+{
+  iot_data_t * path = iot_data_alloc_list ();
+  iot_data_list_tail_push (path, iot_data_alloc_string (key1, IOT_DATA_REF));
+  if (index >= 0) iot_data_list_tail_push (path, iot_data_alloc_ui32 ((uint32_t) index));
+  if (key2) iot_data_list_tail_push (path, iot_data_alloc_string (key2, IOT_DATA_REF));
+  return path;
+}
+
+static void test_path_get (void)
+{
+  iot_data_t * map = iot_data_from_json (test_config);
+  iot_data_t * vec = iot_data_alloc_vector (7u);
+  const iot_data_t * results[7];
+  iot_data_vector_add (vec, 0, test_path ("Topics", "Priority", 0));
+  iot_data_vector_add (vec, 1, test_path ("Numbers", "Two", -1));
+  iot_data_vector_add (vec, 2, test_path ("Topics", "Topic", 0));
+  iot_data_vector_add (vec, 3, test_path ("Topics", "Missing", 0));
+  iot_data_vector_add (vec, 4, test_path ("Topics", "Priority", 1));
+  iot_data_vector_add (vec, 5, test_path ("Interval", "Sub", -1));
+  iot_data_vector_add (vec, 6, iot_data_alloc_list ());
+  iot_data_paths_t * paths = iot_data_paths_alloc (vec);
+  CU_ASSERT (iot_data_paths_size (paths) == 7u)
+  iot_data_paths_get (map, paths, results);
+  for (uint32_t i = 0; i < 7u; i++)
+  {
+    const iot_data_t * path = iot_data_vector_get (vec, i);
+    iot_data_path_t * compiled = iot_data_path_alloc (path);
+    const iot_data_t * expected = (i < 3u) ? iot_data_get_at (map, path) : ((i == 6u) ? map : NULL);
+    CU_ASSERT (results[i] == expected)
+    CU_ASSERT (iot_data_path_get (map, compiled) == expected)
+    iot_data_path_free (compiled);
+  }
+  CU_ASSERT (iot_data_i64 (results[0]) == 10 && iot_data_i64 (results[1]) == 2)
+  iot_data_paths_free (paths);
+  iot_data_free (vec);
+  iot_data_free (map);
+}
+
 static void test_add_at (void)
 {
   iot_data_t * map = iot_data_from_json (test_config);
@@ -5106,6 +5813,56 @@ static iot_data_t * add_fn (const iot_data_t * data, void * arg)
   return iot_data_alloc_i64 (iot_data_i64 (data) + *((uint64_t *) arg));
 }
 
+static void test_add_at_cow (void)
+{
+  iot_data_t * map = iot_data_from_json (test_config);
+  iot_data_t * path = iot_data_alloc_list ();
+  iot_data_list_tail_push (path, iot_data_alloc_string ("Topics", IOT_DATA_REF));
+  iot_data_list_tail_push (path, iot_data_alloc_ui32 (0));
+  iot_data_list_tail_push (path, iot_data_alloc_string ("Priority", IOT_DATA_REF));
+  const iot_data_t * topics = iot_data_string_map_get (map, "Topics");
+  const iot_data_t * topic = iot_data_vector_get (topics, 0);
+  iot_data_t * val = iot_data_alloc_ui32 (1);
+
+  // Unshared data updated in place
+
+  iot_data_t * modified = iot_data_add_at_cow (map, path, val);
+  CU_ASSERT (modified == map)
+  CU_ASSERT (iot_data_string_map_get (map, "Topics") == topics)
+  CU_ASSERT (iot_data_vector_get (topics, 0) == topic)
+  CU_ASSERT (iot_data_get_at (map, path) == val)
+
+  // Shared data copied along path only, snapshot unchanged
+
+  iot_data_t * snapshot = iot_data_add_ref (map);
+  uint32_t hash = iot_data_hash (snapshot);
+  val = iot_data_alloc_i64 (2);
+  modified = iot_data_add_at_cow (map, path, val);
+  CU_ASSERT (modified != snapshot)
+  CU_ASSERT (iot_data_ui32 (iot_data_get_at (snapshot, path)) == 1u)
+  CU_ASSERT (iot_data_get_at (modified, path) == val)
+  CU_ASSERT (iot_data_string_map_get (modified, "Topics") != topics)
+  CU_ASSERT (iot_data_string_map_get (modified, "Interval") == iot_data_string_map_get (snapshot, "Interval"))
+  CU_ASSERT (iot_data_hash (snapshot) == hash)
+  CU_ASSERT (! iot_data_equal (snapshot, modified))
+
+  // Removal and update of now unshared copy
+
+  uint64_t inc = 2;
+  iot_data_t * updated = iot_data_update_at_cow (modified, path, add_fn, &inc);
+  CU_ASSERT (updated == modified)
+  CU_ASSERT (iot_data_i64 (iot_data_get_at (updated, path)) == 4)
+  iot_data_t * removed = iot_data_remove_at_cow (updated, path);
+  CU_ASSERT (removed == updated)
+  CU_ASSERT (iot_data_string_map_get (iot_data_vector_get (iot_data_string_map_get (removed, "Topics"), 0), "Priority") == NULL)
+  iot_data_t * empty = iot_data_alloc_list ();
+  CU_ASSERT (iot_data_remove_at_cow (removed, empty) == removed)
+  iot_data_free (empty);
+  iot_data_free (removed);
+  iot_data_free (snapshot);
+  iot_data_free (path);
+}
+
 static void test_update_at (void)
 {
   iot_data_t * map = iot_data_from_json (test_config);
@@ -5195,6 +5952,71 @@ static void test_data_map_int (void)
   iot_data_free (map);
 }
 
+static void test_data_hash_map (void)
+{
+  char name[16];
+  iot_data_t * map = iot_data_alloc_hash_map (IOT_DATA_STRING);
+  iot_data_t * tree = iot_data_alloc_map (IOT_DATA_STRING);
+  CU_ASSERT (iot_data_map_is_hashed (map))
+  CU_ASSERT (! iot_data_map_is_hashed (tree))
+  for (uint32_t i = 0; i < 200u; i++)
+  {
+    snprintf (name, sizeof (name), "Key%u", i);
+    iot_data_map_add (map, iot_data_alloc_string (name, IOT_DATA_COPY), iot_data_alloc_ui64 (i));
+    iot_data_map_add (tree, iot_data_alloc_string (name, IOT_DATA_COPY), iot_data_alloc_ui64 (i));
+  }
+  iot_data_string_map_add (map, "Key10", iot_data_alloc_ui64 (1000u));
+  iot_data_string_map_add (tree, "Key10", iot_data_alloc_ui64 (1000u));
+  CU_ASSERT (iot_data_map_size (map) == 200u)
+  CU_ASSERT (iot_data_equal (map, tree))
+  CU_ASSERT (iot_data_string_map_get_ui64 (map, "Key10", 0u) == 1000u)
+  for (uint32_t i = 0; i < 200u; i += 2u)
+  {
+    snprintf (name, sizeof (name), "Key%u", i);
+    CU_ASSERT (iot_data_string_map_remove (map, name))
+    CU_ASSERT (! iot_data_string_map_remove (map, name))
+    iot_data_string_map_remove (tree, name);
+  }
+  CU_ASSERT (iot_data_map_size (map) == 100u)
+  for (uint32_t i = 0; i < 200u; i++)
+  {
+    snprintf (name, sizeof (name), "Key%u", i);
+    const iot_data_t * val = iot_data_string_map_get (map, name);
+    CU_ASSERT ((i % 2u) ? (val != NULL) : (val == NULL))
+  }
+  iot_data_map_iter_t iter1;
+  iot_data_map_iter_t iter2;
+  iot_data_map_iter (map, &iter1);
+  iot_data_map_iter (tree, &iter2);
+  while (iot_data_map_iter_next (&iter1) && iot_data_map_iter_next (&iter2)) // Ordered iteration as per tree map
+  {
+    CU_ASSERT (strcmp (iot_data_map_iter_string_key (&iter1), iot_data_map_iter_string_key (&iter2)) == 0)
+  }
+  iot_data_t * copy = iot_data_copy (map);
+  CU_ASSERT (iot_data_map_is_hashed (copy))
+  CU_ASSERT (iot_data_equal (copy, tree))
+  CU_ASSERT (iot_data_string_map_get_ui64 (copy, "Key199", 0u) == 199u)
+  iot_data_map_empty (copy);
+  CU_ASSERT (iot_data_map_size (copy) == 0u)
+  iot_data_string_map_add (copy, "Key1", iot_data_alloc_ui64 (1u));
+  CU_ASSERT (iot_data_string_map_get_ui64 (copy, "Key1", 0u) == 1u)
+  iot_data_free (copy);
+  iot_data_free (tree);
+  iot_data_free (map);
+
+  map = iot_data_alloc_typed_hash_map (IOT_DATA_UINT32, IOT_DATA_UINT64);
+  for (uint32_t i = 0; i < 1000u; i++)
+  {
+    iot_data_map_add (map, iot_data_alloc_ui32 (i), iot_data_alloc_ui64 (i * 2u));
+  }
+  iot_data_t * key = iot_data_alloc_ui32 (500u);
+  CU_ASSERT (iot_data_map_get_ui64 (map, key, 0u) == 1000u)
+  CU_ASSERT (iot_data_map_remove (map, key))
+  CU_ASSERT (iot_data_map_get (map, key) == NULL)
+  iot_data_free (key);
+  iot_data_free (map);
+}
+
 static void test_data_map_merge (void)
 {
   iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
@@ -5217,6 +6039,264 @@ static void test_data_map_merge (void)
   iot_data_free (add);
 }
 
+static void test_data_map_add_all (void)
+{
+  iot_data_t * keys[1000];
+  iot_data_t * values[1000];
+  for (uint32_t existing = 0; existing <= 1000u; existing += 250u)
+  {
+    iot_data_t * map = iot_data_alloc_map_with_capacity (IOT_DATA_UINT32, existing + 1000u);
+    iot_data_t * expected = iot_data_alloc_map (IOT_DATA_UINT32);
+    for (uint32_t i = 0; i < existing; i++)
+    {
+      iot_data_map_add (map, iot_data_alloc_ui32 (i * 3u), iot_data_alloc_ui32 (i));
+      iot_data_map_add (expected, iot_data_alloc_ui32 (i * 3u), iot_data_alloc_ui32 (i));
+    }
+    for (uint32_t i = 0; i < 1000u; i++) // Unordered keys, some duplicated and some already in the map
+    {
+      uint32_t k = (i * 7919u) % 800u;
+      keys[i] = iot_data_alloc_ui32 (k);
+      values[i] = iot_data_alloc_ui32 (i + 10000u);
+      iot_data_map_add (expected, iot_data_alloc_ui32 (k), iot_data_alloc_ui32 (i + 10000u));
+    }
+    iot_data_map_add_all (map, keys, values, 1000u);
+    CU_ASSERT (iot_data_map_size (map) == iot_data_map_size (expected))
+    CU_ASSERT (iot_data_equal (map, expected))
+    CU_ASSERT (iot_data_hash (map) == iot_data_hash (expected))
+    iot_data_map_add (map, iot_data_alloc_ui32 (100001u), iot_data_alloc_ui32 (1u)); // Check tree usable after rebuild
+    iot_data_map_add (expected, iot_data_alloc_ui32 (100001u), iot_data_alloc_ui32 (1u));
+    CU_ASSERT (iot_data_equal (map, expected))
+    iot_data_free (map);
+    iot_data_free (expected);
+  }
+
+  iot_data_t * map = iot_data_alloc_hash_map (IOT_DATA_STRING);
+  keys[0] = iot_data_alloc_string ("B", IOT_DATA_REF);
+  keys[1] = iot_data_alloc_string ("A", IOT_DATA_REF);
+  keys[2] = iot_data_alloc_string ("B", IOT_DATA_REF);
+  values[0] = iot_data_alloc_ui32 (1u);
+  values[1] = iot_data_alloc_ui32 (2u);
+  values[2] = iot_data_alloc_ui32 (3u);
+  iot_data_map_add_all (map, keys, values, 3u);
+  iot_data_map_add_all (map, keys, values, 0u);
+  CU_ASSERT (iot_data_map_size (map) == 2u)
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (map, "A")) == 2u)
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (map, "B")) == 3u)
+  iot_data_free (map);
+}
+
+static void test_data_map_build_sorted (void)
+{
+  iot_data_t * keys[100];
+  iot_data_t * values[100];
+  for (uint32_t count = 0; count <= 100u; count += 7u)
+  {
+    iot_data_t * map = iot_data_alloc_map (IOT_DATA_UINT32);
+    iot_data_t * expected = iot_data_alloc_map (IOT_DATA_UINT32);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      keys[i] = iot_data_alloc_ui32 (i * 2u);
+      values[i] = iot_data_alloc_ui32 (i);
+      iot_data_map_add (expected, iot_data_add_ref (keys[i]), iot_data_add_ref (values[i]));
+    }
+    iot_data_map_build_sorted (map, keys, values, count);
+    CU_ASSERT (iot_data_map_size (map) == count)
+    CU_ASSERT (iot_data_equal (map, expected))
+    CU_ASSERT (iot_data_hash (map) == iot_data_hash (expected))
+    for (uint32_t i = 0; i < count; i++) // Check tree remains balanced on update
+    {
+      iot_data_t * key = iot_data_alloc_ui32 (i * 2u + 1u);
+      iot_data_map_add (map, iot_data_add_ref (key), iot_data_alloc_ui32 (i));
+      iot_data_map_add (expected, key, iot_data_alloc_ui32 (i));
+      if (i % 3u == 0u)
+      {
+        iot_data_t * rkey = iot_data_alloc_ui32 (i * 2u);
+        iot_data_map_remove (map, rkey);
+        iot_data_map_remove (expected, rkey);
+        iot_data_free (rkey);
+      }
+    }
+    CU_ASSERT (iot_data_equal (map, expected))
+    iot_data_free (map);
+    iot_data_free (expected);
+  }
+
+  iot_data_t * map = iot_data_alloc_hash_map (IOT_DATA_STRING); // Unsorted keys added one at a time
+  keys[0] = iot_data_alloc_string ("B", IOT_DATA_REF);
+  keys[1] = iot_data_alloc_string ("A", IOT_DATA_REF);
+  values[0] = iot_data_alloc_ui32 (2u);
+  values[1] = iot_data_alloc_ui32 (1u);
+  iot_data_map_build_sorted (map, keys, values, 2u);
+  CU_ASSERT (iot_data_map_size (map) == 2u)
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (map, "A")) == 1u)
+  iot_data_t * copy = iot_data_copy (map);
+  CU_ASSERT (iot_data_map_is_hashed (copy))
+  CU_ASSERT (iot_data_equal (map, copy))
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (copy, "B")) == 2u)
+  iot_data_free (copy);
+  iot_data_free (map);
+}
+
+static void test_data_map_merge_large (void)
+{
+  iot_data_t * map = iot_data_alloc_hash_map (IOT_DATA_UINT32);
+  iot_data_t * add = iot_data_alloc_map (IOT_DATA_UINT32);
+  iot_data_t * expected = iot_data_alloc_map (IOT_DATA_UINT32);
+  for (uint32_t i = 0; i < 50u; i++)
+  {
+    iot_data_map_add (map, iot_data_alloc_ui32 (i * 3u), iot_data_alloc_ui32 (0u));
+    iot_data_map_add (expected, iot_data_alloc_ui32 (i * 3u), iot_data_alloc_ui32 (0u));
+  }
+  for (uint32_t i = 0; i < 100u; i++)
+  {
+    iot_data_map_add (add, iot_data_alloc_ui32 (i * 2u), iot_data_alloc_ui32 (1u));
+    iot_data_map_add (expected, iot_data_alloc_ui32 (i * 2u), iot_data_alloc_ui32 (1u));
+  }
+  iot_data_map_merge (map, add);
+  iot_data_map_merge (map, map);
+  CU_ASSERT (iot_data_map_size (map) == iot_data_map_size (expected))
+  CU_ASSERT (iot_data_equal (map, expected))
+  CU_ASSERT (iot_data_hash (map) == iot_data_hash (expected))
+  iot_data_static_t skey;
+  CU_ASSERT (iot_data_ui32 (iot_data_map_get (map, iot_data_alloc_const_ui32 (&skey, 6u))) == 1u)
+  CU_ASSERT (iot_data_ui32 (iot_data_map_get (map, iot_data_alloc_const_ui32 (&skey, 3u))) == 0u)
+  iot_data_free (map);
+  iot_data_free (add);
+  iot_data_free (expected);
+}
+
+static void test_data_parallel (void)
+{
+  iot_threadpool_t * pool = iot_threadpool_alloc (4u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_data_t * vector = iot_data_alloc_vector (1000u);
+  char key[32];
+  iot_threadpool_start (pool);
+  for (uint32_t i = 0; i < 1000u; i++)
+  {
+    iot_data_t * inner = iot_data_alloc_map (IOT_DATA_STRING);
+    iot_data_string_map_add (inner, "Value", iot_data_alloc_ui32 (i));
+    snprintf (key, sizeof (key), "Key%04u", i);
+    iot_data_map_add (map, iot_data_alloc_string (key, IOT_DATA_COPY), inner);
+    iot_data_vector_add (vector, i, iot_data_alloc_string (key, IOT_DATA_COPY));
+  }
+  iot_data_t * mcopy = iot_data_copy_parallel (map, pool);
+  iot_data_t * vcopy = iot_data_copy_parallel (vector, pool);
+  CU_ASSERT (iot_data_map_size (mcopy) == 1000u)
+  CU_ASSERT (iot_data_equal (map, mcopy))
+  CU_ASSERT (iot_data_equal (vector, vcopy))
+  CU_ASSERT (iot_data_equal_parallel (map, mcopy, pool))
+  CU_ASSERT (iot_data_equal_parallel (vector, vcopy, pool))
+  CU_ASSERT (iot_data_compare_parallel (vector, vcopy, pool) == 0)
+  CU_ASSERT (iot_data_string_map_get (map, "Key0500") != iot_data_string_map_get (mcopy, "Key0500"))
+
+  iot_data_t * inner = (iot_data_t*) iot_data_string_map_get (mcopy, "Key0700");
+  iot_data_string_map_add (inner, "Value", iot_data_alloc_ui32 (1u));
+  CU_ASSERT (! iot_data_equal_parallel (map, mcopy, pool))
+  CU_ASSERT (iot_data_compare_parallel (map, mcopy, pool) == iot_data_compare (map, mcopy))
+  iot_data_vector_add (vcopy, 10u, iot_data_alloc_string ("A", IOT_DATA_REF));
+  iot_data_vector_add (vcopy, 900u, iot_data_alloc_string ("Z", IOT_DATA_REF));
+  CU_ASSERT (! iot_data_equal_parallel (vector, vcopy, pool))
+  CU_ASSERT (iot_data_compare_parallel (vector, vcopy, pool) == iot_data_compare (vector, vcopy))
+  CU_ASSERT (iot_data_compare_parallel (vector, vcopy, NULL) == iot_data_compare (vector, vcopy))
+  iot_data_free (mcopy);
+  iot_data_free (vcopy);
+
+  mcopy = iot_data_copy_parallel (map, NULL);
+  CU_ASSERT (iot_data_equal_parallel (map, mcopy, NULL))
+  iot_data_free (mcopy);
+  iot_data_free (map);
+  iot_data_free (vector);
+  iot_threadpool_free (pool);
+}
+
+static void test_data_compress_parallel (void)
+{
+  iot_threadpool_t * pool = iot_threadpool_alloc (4u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_data_t * vector = iot_data_alloc_vector (1000u);
+  char str[32];
+  iot_threadpool_start (pool);
+  for (uint32_t i = 0; i < 1000u; i++)
+  {
+    iot_data_t * inner = iot_data_alloc_map (IOT_DATA_STRING);
+    snprintf (str, sizeof (str), "Sensor%u", i % 10u);
+    iot_data_string_map_add (inner, "Type", iot_data_alloc_string (str, IOT_DATA_COPY));
+    iot_data_string_map_add (inner, "Value", iot_data_alloc_ui32 (i % 5u));
+    snprintf (str, sizeof (str), "Key%04u", i);
+    iot_data_map_add (map, iot_data_alloc_string (str, IOT_DATA_COPY), inner);
+    snprintf (str, sizeof (str), "Value%u", i % 7u);
+    iot_data_vector_add (vector, i, iot_data_alloc_string (str, IOT_DATA_COPY));
+  }
+  iot_data_t * mcopy = iot_data_copy (map);
+  iot_data_t * vcopy = iot_data_copy (vector);
+  size_t msize = iot_data_memory_size (map);
+  size_t saved = iot_data_compress_parallel (map, pool);
+  CU_ASSERT (saved > 0u)
+  CU_ASSERT (iot_data_memory_size (map) < msize)
+  CU_ASSERT (iot_data_equal (map, mcopy))
+  CU_ASSERT (iot_data_string_map_get (map, "Key0001") == iot_data_string_map_get (map, "Key0011"))
+  CU_ASSERT (iot_data_string_map_get (map, "Key0001") != iot_data_string_map_get (map, "Key0002"))
+  CU_ASSERT (iot_data_compress_parallel (map, pool) == 0u) // Nothing left to share
+  CU_ASSERT (iot_data_compress_parallel (vector, NULL) > 0u)
+  CU_ASSERT (iot_data_equal (vector, vcopy))
+  CU_ASSERT (iot_data_vector_get (vector, 0u) == iot_data_vector_get (vector, 7u))
+  iot_data_free (mcopy);
+  iot_data_free (vcopy);
+  iot_data_free (map);
+  iot_data_free (vector);
+  iot_threadpool_free (pool);
+}
+
+static iot_data_t * test_parallel_map_double (const iot_data_t * data, void * arg)
+{
+  uint64_t val = 0u;
+  (void) arg;
+  if (! iot_data_cast (data, IOT_DATA_UINT64, &val) || (val % 3u) == 1u) return NULL;
+  return iot_data_alloc_ui64 (val * 2u);
+}
+
+static void test_data_parallel_map (void)
+{
+  iot_threadpool_t * pool = iot_threadpool_alloc (4u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_data_t * map = iot_data_alloc_map (IOT_DATA_UINT32);
+  iot_data_t * vector = iot_data_alloc_vector (1000u);
+  uint16_t * values = malloc (1000u * sizeof (uint16_t));
+  iot_threadpool_start (pool);
+  for (uint32_t i = 0; i < 1000u; i++)
+  {
+    iot_data_map_add (map, iot_data_alloc_ui32 (i), iot_data_alloc_ui32 (i));
+    iot_data_vector_add (vector, i, iot_data_alloc_ui32 (i));
+    values[i] = (uint16_t) i;
+  }
+  iot_data_t * array = iot_data_alloc_array (values, 1000u, IOT_DATA_UINT16, IOT_DATA_TAKE);
+  iot_data_t * mres = iot_data_parallel_map (map, test_parallel_map_double, NULL, pool);
+  iot_data_t * vres = iot_data_parallel_map (vector, test_parallel_map_double, NULL, pool);
+  iot_data_t * ares = iot_data_parallel_map (array, test_parallel_map_double, NULL, pool);
+  iot_data_t * inline_res = iot_data_parallel_map (array, test_parallel_map_double, NULL, NULL);
+  CU_ASSERT (iot_data_map_size (mres) == 667u)
+  CU_ASSERT (iot_data_vector_size (vres) == 1000u)
+  CU_ASSERT (iot_data_equal (vres, ares))
+  CU_ASSERT (iot_data_equal (ares, inline_res))
+  for (uint32_t i = 0; i < 1000u; i++)
+  {
+    const iot_data_t * val = iot_data_vector_get (vres, i);
+    iot_data_t * key = iot_data_alloc_ui32 (i);
+    CU_ASSERT ((i % 3u == 1u) ? (val == NULL) : (val && iot_data_ui64 (val) == 2u * i))
+    CU_ASSERT (iot_data_equal (iot_data_map_get (mres, key), val))
+    iot_data_free (key);
+  }
+  CU_ASSERT (iot_data_parallel_map (iot_data_alloc_null (), test_parallel_map_double, NULL, pool) == NULL)
+  iot_data_free (inline_res);
+  iot_data_free (ares);
+  iot_data_free (vres);
+  iot_data_free (mres);
+  iot_data_free (array);
+  iot_data_free (vector);
+  iot_data_free (map);
+  iot_threadpool_free (pool);
+}
+
 static void test_array_to_binary (void)
 {
   uint8_t data[4] = {1, 2, 3, 4};
@@ -5333,6 +6413,140 @@ static void test_data_block (void)
   CU_ASSERT_PTR_NULL (ptr)
 }
 
+#if defined (__ZEPHYR__) && (IOT_ZEPHYR_DATA_BLOCKS > 0)
+#define TEST_DATA_BLOCKS (IOT_ZEPHYR_DATA_BLOCKS + 8) // Exhausts static block pool, so heap also used
+#else
+#define TEST_DATA_BLOCKS 64
+#endif
+
+static void test_data_block_pool (void)
+{
+  static uint8_t * blocks[TEST_DATA_BLOCKS];
+  uint32_t size = iot_data_block_size ();
+  for (uint32_t round = 0; round < 2u; round++) // Freed blocks reused
+  {
+    for (uint32_t i = 0; i < TEST_DATA_BLOCKS; i++)
+    {
+      blocks[i] = iot_data_block_alloc (size);
+      CU_ASSERT_FATAL (blocks[i] != NULL)
+      CU_ASSERT (blocks[i][0] == 0u && blocks[i][size - 1] == 0u)
+      memset (blocks[i], (int) (i + 1u), size);
+    }
+    for (uint32_t i = 0; i < TEST_DATA_BLOCKS; i++) // Blocks not shared
+    {
+      CU_ASSERT (blocks[i][0] == (uint8_t) (i + 1u) && blocks[i][size - 1] == (uint8_t) (i + 1u))
+      iot_data_block_free (blocks[i]);
+    }
+  }
+}
+
+static void * test_data_cache_fn (void * arg)
+{
+  iot_data_t ** values = arg;
+  for (uint32_t i = 0; i < 1000u; i++) // Free blocks allocated by another thread
+  {
+    iot_data_free (values[i]);
+  }
+  for (uint32_t i = 0; i < 1000u; i++)
+  {
+    values[i] = iot_data_alloc_ui32 (i);
+  }
+  for (uint32_t i = 0; i < 1000u; i++)
+  {
+    iot_data_free (values[i]);
+  }
+  return NULL;
+}
+
+static void test_data_cache_stats (void)
+{
+  iot_data_cache_stats_t stats;
+  iot_data_t * values[1000];
+  pthread_t tid;
+  bool enabled = iot_data_cache_stats (&stats);
+  uint64_t allocs = stats.allocs;
+  for (uint32_t i = 0; i < 1000u; i++)
+  {
+    values[i] = iot_data_alloc_ui32 (i);
+  }
+  pthread_create (&tid, NULL, test_data_cache_fn, values);
+  pthread_join (tid, NULL);
+  CU_ASSERT (iot_data_cache_stats (&stats) == enabled)
+  if (enabled)
+  {
+    CU_ASSERT (stats.allocs >= allocs + 2000u)
+    CU_ASSERT (stats.hits <= stats.allocs)
+    CU_ASSERT (stats.refills > 0u)
+    CU_ASSERT (stats.drains > 0u)
+    CU_ASSERT (stats.chunks > 0u)
+  }
+  else
+  {
+    CU_ASSERT (stats.allocs == 0u)
+  }
+}
+
+static void test_data_cache_trim (void)
+{
+  iot_data_cache_stats_t before;
+  iot_data_cache_stats_t stats;
+  iot_data_t ** values = calloc (10000u, sizeof (iot_data_t*));
+  bool enabled = iot_data_cache_stats (&before);
+  for (uint32_t i = 0; i < 10000u; i++) values[i] = iot_data_alloc_ui32 (i);
+  iot_data_cache_stats (&stats);
+  if (enabled)
+  {
+    CU_ASSERT (stats.live[IOT_DATA_UINT32] >= before.live[IOT_DATA_UINT32] + 10000)
+    CU_ASSERT (stats.allocs - stats.frees >= 10000u)
+  }
+  for (uint32_t i = 0; i < 10000u; i++) iot_data_free (values[i]);
+  uint32_t released = iot_data_cache_trim ();
+  iot_data_cache_stats (&stats);
+  if (enabled)
+  {
+    CU_ASSERT (stats.live[IOT_DATA_UINT32] == before.live[IOT_DATA_UINT32])
+    CU_ASSERT (released > 0u)
+    CU_ASSERT (stats.released == before.released + released)
+  }
+  else
+  {
+    CU_ASSERT (released == 0u)
+  }
+
+  iot_data_cache_set_limit (1u);
+  iot_data_cache_stats (&before);
+  for (uint32_t i = 0; i < 10000u; i++) values[i] = iot_data_alloc_ui32 (i);
+  for (uint32_t i = 0; i < 10000u; i++) iot_data_free (values[i]);
+  iot_data_cache_stats (&stats);
+  if (enabled) CU_ASSERT (stats.released > before.released)
+  iot_data_cache_set_limit (0u);
+  free (values);
+}
+
+static void test_data_cache_slab (void)
+{
+  iot_data_cache_stats_t before;
+  iot_data_cache_stats_t stats;
+  iot_data_t ** values = calloc (20000u, sizeof (iot_data_t*));
+  iot_data_cache_trim ();
+  bool enabled = iot_data_cache_stats (&before);
+  iot_data_cache_set_slab_size (0x200000u);
+  for (uint32_t i = 0; i < 20000u; i++) values[i] = iot_data_alloc_ui32 (i);
+  for (uint32_t i = 0; i < 20000u; i++) CU_ASSERT (iot_data_ui32 (values[i]) == i)
+  iot_data_cache_stats (&stats);
+  if (enabled) CU_ASSERT (stats.slabs > before.slabs)
+  for (uint32_t i = 0; i < 20000u; i += 2u) iot_data_free (values[i]);
+  iot_data_cache_trim ();
+  for (uint32_t i = 1; i < 20000u; i += 2u) iot_data_free (values[i]);
+  uint32_t released = iot_data_cache_trim ();
+  iot_data_cache_stats (&stats);
+  if (enabled) CU_ASSERT (released > 0u && stats.released == before.released + released)
+  iot_data_cache_set_slab_size (0u);
+  for (uint32_t i = 0; i < 100u; i++) values[i] = iot_data_alloc_ui32 (i);
+  for (uint32_t i = 0; i < 100u; i++) iot_data_free (values[i]);
+  free (values);
+}
+
 static void test_data_iter (void)
 {
   iot_data_iter_t iter;
@@ -5416,6 +6630,114 @@ static void test_data_iter (void)
   iot_data_free (map_data);
 }
 
+static bool test_diff_has (const iot_data_t * diff, const char * kind, const char * path)
+{
+  iot_data_list_iter_t iter;
+  iot_data_list_iter (iot_data_string_map_get (diff, kind), &iter);
+  while (iot_data_list_iter_next (&iter))
+  {
+    char * json = iot_data_to_json (iot_data_list_iter_value (&iter));
+    bool found = (strcmp (json, path) == 0);
+    free (json);
+    if (found) return true;
+  }
+  return false;
+}
+
+static void test_data_diff (void)
+{
+  iot_data_t * from = iot_data_from_json ("{\"A\":1,\"B\":{\"C\":\"x\",\"D\":[1,2,3]},\"E\":true,\"F\":{\"G\":1}}");
+  iot_data_t * to = iot_data_from_json ("{\"A\":2,\"B\":{\"C\":\"x\",\"D\":[1,5]},\"F\":{\"G\":1},\"H\":null}");
+  iot_data_t * diff = iot_data_diff (from, to);
+  CU_ASSERT (! iot_data_diff_empty (diff))
+  CU_ASSERT (iot_data_list_length (iot_data_string_map_get (diff, "added")) == 1u)
+  CU_ASSERT (iot_data_list_length (iot_data_string_map_get (diff, "removed")) == 2u)
+  CU_ASSERT (iot_data_list_length (iot_data_string_map_get (diff, "changed")) == 2u)
+  CU_ASSERT (test_diff_has (diff, "added", "[\"H\"]"))
+  CU_ASSERT (test_diff_has (diff, "removed", "[\"E\"]"))
+  CU_ASSERT (test_diff_has (diff, "removed", "[\"B\",\"D\",2]"))
+  CU_ASSERT (test_diff_has (diff, "changed", "[\"A\"]"))
+  CU_ASSERT (test_diff_has (diff, "changed", "[\"B\",\"D\",1]"))
+  iot_data_free (diff);
+  iot_data_t * copy = iot_data_copy (from);
+  diff = iot_data_diff (from, copy);
+  CU_ASSERT (iot_data_diff_empty (diff))
+  iot_data_free (diff);
+  iot_data_t * str = iot_data_alloc_string ("x", IOT_DATA_REF);
+  diff = iot_data_diff (from, str);
+  CU_ASSERT (test_diff_has (diff, "changed", "[]"))
+  iot_data_free (diff);
+  iot_data_free (str);
+  iot_data_free (copy);
+  iot_data_free (to);
+  iot_data_free (from);
+}
+
+static void test_data_delta (void)
+{
+  iot_data_t * from = iot_data_from_json ("{\"A\":1,\"B\":{\"C\":\"x\",\"D\":[1,2,3]},\"E\":true,\"F\":{\"G\":1},\"a/b\":[1]}");
+  iot_data_t * to = iot_data_from_json ("{\"A\":2,\"B\":{\"C\":\"x\",\"D\":[1,5]},\"F\":{\"G\":1},\"H\":null,\"a/b\":[1,2]}");
+  iot_data_t * delta = iot_data_delta (from, to);
+  CU_ASSERT (iot_data_list_length (delta) == 6u)
+  char * json = iot_data_to_json (delta);
+  CU_ASSERT (strstr (json, "{\"op\":\"replace\",\"path\":\"/A\",\"value\":2}") != NULL)
+  CU_ASSERT (strstr (json, "{\"op\":\"replace\",\"path\":\"/B/D/1\",\"value\":5}") != NULL)
+  CU_ASSERT (strstr (json, "{\"op\":\"remove\",\"path\":\"/B/D/2\"}") != NULL)
+  CU_ASSERT (strstr (json, "{\"op\":\"remove\",\"path\":\"/E\"}") != NULL)
+  CU_ASSERT (strstr (json, "{\"op\":\"add\",\"path\":\"/a~1b/-\",\"value\":2}") != NULL)
+  CU_ASSERT (strstr (json, "\"path\":\"/H\"") != NULL)
+  CU_ASSERT (strstr (json, "/F") == NULL)
+
+  // Apply the delta, as created and after a JSON round trip
+  iot_data_t * copy = iot_data_copy (from);
+  CU_ASSERT (iot_data_apply_delta (copy, delta))
+  CU_ASSERT (iot_data_equal (copy, to))
+  iot_data_free (copy);
+  iot_data_t * decoded = iot_data_from_json (json);
+  copy = iot_data_copy (from);
+  CU_ASSERT (iot_data_apply_delta (copy, decoded))
+  CU_ASSERT (iot_data_equal (copy, to))
+  iot_data_free (copy);
+  iot_data_free (decoded);
+  free (json);
+  iot_data_free (delta);
+
+  // Equal data gives an empty delta
+  copy = iot_data_copy (from);
+  delta = iot_data_delta (from, copy);
+  CU_ASSERT (iot_data_list_length (delta) == 0u)
+  iot_data_free (delta);
+
+  // Vector insert and remove, and invalid operations
+  decoded = iot_data_from_json ("[{\"op\":\"add\",\"path\":\"/B/D/0\",\"value\":0},{\"op\":\"remove\",\"path\":\"/B/D/2\"}]");
+  CU_ASSERT (iot_data_apply_delta (copy, decoded))
+  json = iot_data_to_json (iot_data_string_map_get (iot_data_string_map_get (copy, "B"), "D"));
+  CU_ASSERT_STRING_EQUAL (json, "[0,1,3]")
+  free (json);
+  iot_data_free (decoded);
+  decoded = iot_data_from_json ("[{\"op\":\"replace\",\"path\":\"/X\",\"value\":0}]");
+  CU_ASSERT (! iot_data_apply_delta (copy, decoded))
+  iot_data_free (decoded);
+  decoded = iot_data_from_json ("[{\"op\":\"remove\",\"path\":\"/B/D/3\"}]");
+  CU_ASSERT (! iot_data_apply_delta (copy, decoded))
+  iot_data_free (decoded);
+  decoded = iot_data_from_json ("[{\"op\":\"move\",\"path\":\"/A\",\"from\":\"/E\"}]");
+  CU_ASSERT (! iot_data_apply_delta (copy, decoded))
+  iot_data_free (decoded);
+  iot_data_free (copy);
+
+  // Differing top level type is replaced
+  iot_data_t * str = iot_data_alloc_string ("x", IOT_DATA_REF);
+  delta = iot_data_delta (from, str);
+  json = iot_data_to_json (delta);
+  CU_ASSERT_STRING_EQUAL (json, "[{\"op\":\"replace\",\"path\":\"\",\"value\":\"x\"}]")
+  free (json);
+  iot_data_free (delta);
+  iot_data_free (str);
+  iot_data_free (to);
+  iot_data_free (from);
+}
+
 void cunit_data_test_init (void)
 {
   CU_pSuite suite = CU_add_suite ("data", suite_init, suite_clean);
@@ -5427,6 +6749,7 @@ void cunit_data_test_init (void)
   CU_add_test (suite, "data_binary", test_data_binary);
   CU_add_test (suite, "data_binary_from_string", test_data_binary_from_string);
   CU_add_test (suite, "data_string_from_binary", test_data_string_from_binary);
+  CU_add_test (suite, "data_string_fmt", test_data_string_fmt);
   CU_add_test (suite, "data_array_get_uint8", test_data_array_get_uint8);
   CU_add_test (suite, "data_array_get_int8", test_data_array_get_int8);
   CU_add_test (suite, "data_array_get_uint16", test_data_array_get_uint16);
@@ -5465,6 +6788,7 @@ void cunit_data_test_init (void)
   CU_add_test (suite, "data_list_iter_replace", test_list_iter_replace);
   CU_add_test (suite, "data_list_iter_remove", test_list_iter_remove);
   CU_add_test (suite, "data_list_iter_remove_all", test_list_iter_remove_all);
+  CU_add_test (suite, "data_list_unrolled", test_list_unrolled);
   CU_add_test (suite, "data_list_remove", test_list_remove);
   CU_add_test (suite, "data_list_find", test_list_find);
   CU_add_test (suite, "data_list_equal", test_list_equal);
@@ -5502,6 +6826,8 @@ void cunit_data_test_init (void)
   CU_add_test (suite, "data_check_equal_array", test_data_equal_array);
   CU_add_test (suite, "data_check_equal_map", test_data_equal_map);
   CU_add_test (suite, "data_map_empty", test_data_map_empty);
+  CU_add_test (suite, "data_map_range", test_data_map_range);
+  CU_add_test (suite, "data_map_int_keys", test_data_map_int_keys);
   CU_add_test (suite, "data_check_map_null_ret", test_data_check_map_null_ret);
   CU_add_test (suite, "data_check_equal_map_refcount", test_data_equal_map_refcount);
   CU_add_test (suite, "data_check_unequal_map_size", test_data_unequal_map_size);
@@ -5531,8 +6857,12 @@ void cunit_data_test_init (void)
   CU_add_test (suite, "data_vector_iter_prev", test_data_vector_iter_prev);
   CU_add_test (suite, "data_vector_iters", test_data_vector_iters);
   CU_add_test (suite, "data_vector_resize", test_data_vector_resize);
+  CU_add_test (suite, "data_vector_resize_small", test_data_vector_resize_small);
+  CU_add_test (suite, "data_vector_append", test_data_vector_append);
+  CU_add_test (suite, "data_memory_size", test_data_memory_size);
   CU_add_test (suite, "data_vector_compact", test_data_vector_compact);
   CU_add_test (suite, "data_vector_find", test_data_vector_find);
+  CU_add_test (suite, "data_vector_sort", test_data_vector_sort);
   CU_add_test (suite, "data_vector_get_pointer", test_data_vector_get_pointer);
   CU_add_test (suite, "data_copy_map_base64_to_array", test_data_copy_map_base64_to_array);
   CU_add_test (suite, "data_check_equal_nested_vector", test_data_equal_nested_vector);
@@ -5543,6 +6873,7 @@ void cunit_data_test_init (void)
   CU_add_test (suite, "data_raw_equal_different_types", test_data_raw_equal_different_types);
   CU_add_test (suite, "data_metadata", test_data_metadata);
   CU_add_test (suite, "data_multi_metadata", test_data_multi_metadata);
+  CU_add_test (suite, "data_metadata_promote", test_data_metadata_promote);
   CU_add_test (suite, "data_alloc_array_int8", test_data_alloc_array_i8);
   CU_add_test (suite, "data_alloc_array_uint8", test_data_alloc_array_ui8);
   CU_add_test (suite, "data_alloc_array_int16", test_data_alloc_array_i16);
@@ -5563,9 +6894,12 @@ void cunit_data_test_init (void)
   CU_add_test (suite, "data_map_perf", test_data_map_perf);
   CU_add_test (suite, "data_int_map", test_data_int_map);
   CU_add_test (suite, "data_add_ref", test_data_add_ref);
+  CU_add_test (suite, "data_freeze", test_data_freeze);
   CU_add_test (suite, "data_alloc_uuid", test_data_alloc_uuid);
   CU_add_test (suite, "data_alloc_pointer", test_data_alloc_pointer);
   CU_add_test (suite, "data_alloc_heap", test_data_alloc_heap);
+  CU_add_test (suite, "data_arena", test_data_arena);
+  CU_add_test (suite, "data_intern", test_data_intern);
   CU_add_test (suite, "data_cast", test_data_cast);
   CU_add_test (suite, "data_const_string", test_data_const_string);
   CU_add_test (suite, "data_const_ui64", test_data_const_ui64);
@@ -5578,6 +6912,7 @@ void cunit_data_test_init (void)
   CU_add_test (suite, "data_const_i8", test_data_const_i8);
   CU_add_test (suite, "data_const_pointer", test_data_const_pointer);
   CU_add_test (suite, "data_const_list", test_data_const_list);
+  CU_add_test (suite, "data_const_map", test_data_const_map);
   CU_add_test (suite, "data_const_types", test_data_const_types);
   CU_add_test (suite, "data_hash", test_data_hash);
   CU_add_test (suite, "data_multi_key_map", test_data_multi_key_map);
@@ -5589,11 +6924,23 @@ void cunit_data_test_init (void)
   CU_add_test (suite, "data_map_number", test_data_map_number);
   CU_add_test (suite, "data_map_int", test_data_map_int);
   CU_add_test (suite, "data_map_merge", test_data_map_merge);
+  CU_add_test (suite, "data_map_build_sorted", test_data_map_build_sorted);
+  CU_add_test (suite, "data_map_add_all", test_data_map_add_all);
+  CU_add_test (suite, "data_map_merge_large", test_data_map_merge_large);
+  CU_add_test (suite, "data_parallel", test_data_parallel);
+  CU_add_test (suite, "data_compress_parallel", test_data_compress_parallel);
+  CU_add_test (suite, "data_parallel_map", test_data_parallel_map);
+  CU_add_test (suite, "data_hash_map", test_data_hash_map);
   CU_add_test (suite, "data_vector_to_array", test_data_vector_to_array);
   CU_add_test (suite, "data_vector_to_vector", test_data_vector_to_vector);
   CU_add_test (suite, "data_nested_vector_to_array", test_data_nested_vector_to_array);
   CU_add_test (suite, "data_ref_count", test_data_ref_count);
   CU_add_test (suite, "data_array_transform", test_data_array_transform);
+  CU_add_test (suite, "data_array_reduce", test_data_array_reduce);
+  CU_add_test (suite, "data_array_variants", test_data_array_variants);
+  CU_add_test (suite, "data_array_sort", test_data_array_sort);
+  CU_add_test (suite, "data_array_scale", test_data_array_scale);
+  CU_add_test (suite, "data_batch", test_data_batch);
   CU_add_test (suite, "data_transform", test_data_transform);
   CU_add_test (suite, "vector_elements", test_vector_elements);
   CU_add_test (suite, "array_dimensions", test_array_dimensions);
@@ -5603,7 +6950,9 @@ void cunit_data_test_init (void)
   CU_add_test (suite, "shallow_copy_vector", test_shallow_copy_vector);
   CU_add_test (suite, "shallow_copy_list", test_shallow_copy_list);
   CU_add_test (suite, "get_at", test_get_at);
+  CU_add_test (suite, "path_get", test_path_get);
   CU_add_test (suite, "add_at", test_add_at);
+  CU_add_test (suite, "add_at_cow", test_add_at_cow);
   CU_add_test (suite, "remove_at", test_remove_at);
   CU_add_test (suite, "update_at", test_update_at);
   CU_add_test (suite, "array_to_binary", test_array_to_binary);
@@ -5612,5 +6961,11 @@ void cunit_data_test_init (void)
   CU_add_test (suite, "data_is_nan", test_data_is_nan);
   CU_add_test (suite, "data_tags", test_data_tags);
   CU_add_test (suite, "data_block", test_data_block);
+  CU_add_test (suite, "data_block_pool", test_data_block_pool);
+  CU_add_test (suite, "data_cache_stats", test_data_cache_stats);
+  CU_add_test (suite, "data_cache_trim", test_data_cache_trim);
+  CU_add_test (suite, "data_cache_slab", test_data_cache_slab);
   CU_add_test (suite, "data_iter", test_data_iter);
+  CU_add_test (suite, "data_diff", test_data_diff);
+  CU_add_test (suite, "data_delta", test_data_delta);
 }
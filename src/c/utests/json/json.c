@@ -183,6 +183,35 @@ static void cunit_json_parse_config (void)
   printf (" ");
 }
 
+static void cunit_json_count (void)
+{
+  static const char * jsons[] =
+  {
+    "4321", " true ", "\"str\"", "[]", "{}", "[1,2.5,-3e4,null,false]", "{\"a\":{\"b\":[{\"c\":1},\"{[,]}\"]}}",
+    "{\"esc\\\"aped\":\"\\\\\",\"x\":\"\\u0041\\n\"}",
+    "{\"Interval\": 200000000,\n\t\"Threads\": 10,\r\n\"Topics\": [{ \"Topic\": \"test/tube\", \"Priority\": 10 }]}",
+    "[\"0123456789012345678901234567890123456789012345678901234567890\\\\\",\"0123456789012345678901234567890123456789012345678901234567\\\"\",1234567890]",
+  };
+  char buff[512];
+  iot_json_parser parser;
+
+  for (uint32_t i = 0; i < sizeof (jsons) / sizeof (jsons[0]); i++)
+  {
+    iot_json_init (&parser);
+    int count = iot_json_parse (&parser, jsons[i], strlen (jsons[i]), NULL, 0);
+    CU_ASSERT (count > 0 && iot_json_count (jsons[i], strlen (jsons[i])) == (uint32_t) count)
+  }
+  // Escape sequences and strings crossing block boundaries
+  for (uint32_t pad = 0; pad < 130u; pad++)
+  {
+    int len = snprintf (buff, sizeof (buff), "[%*s\"a\\\\\",\"b\\\"c\",10,{\"%*s\":[]}]", (int) pad, "", (int) (pad % 67u), "k");
+    iot_json_init (&parser);
+    int count = iot_json_parse (&parser, buff, (size_t) len, NULL, 0);
+    CU_ASSERT (count == 7 && iot_json_count (buff, (size_t) len) == (uint32_t) count)
+  }
+  CU_ASSERT (iot_json_count ("", 0u) == 0u)
+}
+
 void cunit_json_test_init (void)
 {
   CU_pSuite suite = CU_add_suite ("json", suite_init, suite_clean);
@@ -192,4 +221,5 @@ void cunit_json_test_init (void)
   CU_add_test (suite, "json_parse_array", cunit_json_parse_array);
   CU_add_test (suite, "json_parse_nested", cunit_json_parse_nested);
   CU_add_test (suite, "json_parse_config", cunit_json_parse_config);
+  CU_add_test (suite, "json_count", cunit_json_count);
 }
@@ -6,7 +6,10 @@
  */
 
 #include "logger.h"
+#include "iot/time.h"
+#include "iot/file.h"
 #include "CUnit.h"
+#include <wchar.h>
 
 static int suite_init (void)
 {
@@ -107,6 +110,38 @@ static void cunit_logger_file (void)
   iot_logger_free (logger);
 }
 
+static void * cunit_logger_file_writer (void * arg)
+{
+  for (uint32_t i = 0; i < 200u; i++)
+  {
+    iot_log_warn ((iot_logger_t*) arg, "Concurrent warning %" PRIu32 " from a logging thread", i);
+  }
+  return NULL;
+}
+
+static void cunit_logger_file_threads (void)
+{
+  char line[IOT_LOG_MSG_MAX];
+  uint32_t count = 0;
+  pthread_t threads[4];
+  remove ("./test-threads.log");
+  iot_logger_t * logger = iot_logger_alloc_file ("FileThreads", IOT_LOG_WARN, true, NULL, "./test-threads.log");
+  for (uint32_t i = 0; i < 4u; i++) pthread_create (&threads[i], NULL, cunit_logger_file_writer, logger);
+  for (uint32_t i = 0; i < 4u; i++) pthread_join (threads[i], NULL);
+  iot_logger_free (logger);
+  FILE * fd = fopen ("./test-threads.log", "r");
+  CU_ASSERT (fd != NULL)
+  while (fd && fgets (line, sizeof (line), fd))
+  {
+    CU_ASSERT (line[0] == '[')
+    CU_ASSERT (strstr (line, ":FileThreads:WARN] Concurrent warning ") != NULL)
+    CU_ASSERT (strstr (line, " from a logging thread\n") != NULL)
+    count++;
+  }
+  CU_ASSERT (count == 800u)
+  if (fd) fclose (fd);
+}
+
 static void cunit_logger_udp (void)
 {
   iot_logger_t * logger = iot_logger_alloc_udp ("udp", IOT_LOG_WARN, false, NULL, "localhost", 22222);
@@ -123,6 +158,207 @@ static void cunit_logger_udp_broadcast (void)
   iot_logger_free (logger);
 }
 
+static void cunit_logger_file_async (void)
+{
+  char line[IOT_LOG_MSG_MAX];
+  uint32_t count = 0;
+  remove ("./test-async.log");
+  iot_logger_t * logger = iot_logger_alloc_file_async ("FileAsync", IOT_LOG_WARN, true, NULL, "./test-async.log", 4096u);
+  for (uint32_t i = 0; i < 100u; i++)
+  {
+    iot_log_warn (logger, "Async warning %" PRIu32, i);
+  }
+  CU_ASSERT (iot_logger_dropped (logger) == 0u)
+  iot_logger_free (logger);
+  FILE * fd = fopen ("./test-async.log", "r");
+  CU_ASSERT (fd != NULL)
+  while (fd && fgets (line, sizeof (line), fd))
+  {
+    CU_ASSERT (strstr (line, ":FileAsync:WARN] Async warning ") != NULL)
+    count++;
+  }
+  CU_ASSERT (count == 100u)
+  if (fd) fclose (fd);
+}
+
+// Message format and arguments covering each argument type, as recorded for deferred and binary logging
+
+#define CUNIT_LOG_ARGS_FORMAT "%" PRIu32 " %-5s|%*d|%.*f|%c|%zu|%" PRIi64 "|%Lg|%x|%%|%s"
+#define CUNIT_LOG_ARGS(i) (i), "str", 6, -(int) (i), 2, (i) / 3.0, 'a' + (int) ((i) % 26u), (size_t) (i) * 1000u, -(int64_t) (i) * ((int64_t) 1 << 40), (long double) (i) / 7.0L, (i)
+
+static void cunit_logger_deferred (void)
+{
+  char line[IOT_LOG_MSG_MAX];
+  char expect[IOT_LOG_MSG_MAX];
+  uint32_t count = 0;
+  remove ("./test-deferred.log");
+  iot_logger_t * logger = iot_logger_alloc_file_async ("Deferred", IOT_LOG_WARN, true, NULL, "./test-deferred.log", 4096u);
+  CU_ASSERT (iot_logger_set_deferred (logger, true))
+  for (uint32_t i = 0; i < 100u; i++)
+  {
+    iot_log_warn (logger, "Deferred " CUNIT_LOG_ARGS_FORMAT, CUNIT_LOG_ARGS (i), NULL);
+  }
+  iot_log_warn (logger, "Not deferred %ls", L"wide");
+  CU_ASSERT (iot_logger_dropped (logger) == 0u)
+  iot_logger_free (logger);
+  iot_logger_t * sync = iot_logger_alloc ("Sync", IOT_LOG_WARN, true);
+  CU_ASSERT (! iot_logger_set_deferred (sync, true))
+  iot_logger_free (sync);
+  FILE * fd = fopen ("./test-deferred.log", "r");
+  CU_ASSERT (fd != NULL)
+  while (fd && fgets (line, sizeof (line), fd))
+  {
+    CU_ASSERT (strstr (line, ":Deferred:WARN] ") != NULL)
+    if (count < 100u)
+    {
+      snprintf (expect, sizeof (expect), "Deferred " CUNIT_LOG_ARGS_FORMAT "\n", CUNIT_LOG_ARGS (count), "(null)");
+      CU_ASSERT (strcmp (strstr (line, "] ") + 2, expect) == 0)
+    }
+    else
+    {
+      CU_ASSERT (strstr (line, "] Not deferred wide") != NULL)
+    }
+    count++;
+  }
+  CU_ASSERT (count == 101u)
+  if (fd) fclose (fd);
+}
+
+static size_t cunit_logger_file_size (const char * path)
+{
+  size_t size = 0;
+  uint8_t * data = iot_file_read_binary (path, &size);
+  free (data);
+  return data ? size : 0u;
+}
+
+static void cunit_logger_file_rotate (void)
+{
+  iot_logger_file_options_t opts = { 0 };
+  opts.max_size = 1000u;
+  opts.max_files = 2u;
+  opts.sync = IOT_LOG_SYNC_ROTATE;
+  remove ("./test-rotate.log");
+  remove ("./test-rotate.log.1");
+  remove ("./test-rotate.log.2");
+  remove ("./test-rotate.log.3");
+  iot_logger_t * logger = iot_logger_alloc_file_options ("Rotate", IOT_LOG_WARN, true, NULL, "./test-rotate.log", &opts);
+  for (uint32_t i = 0; i < 100u; i++) iot_log_warn (logger, "Rotated message %" PRIu32, i);
+  iot_logger_free (logger);
+  CU_ASSERT (cunit_logger_file_size ("./test-rotate.log") > 0u)
+  CU_ASSERT (cunit_logger_file_size ("./test-rotate.log") <= 1000u)
+  CU_ASSERT (cunit_logger_file_size ("./test-rotate.log.1") > 900u)
+  CU_ASSERT (cunit_logger_file_size ("./test-rotate.log.1") <= 1000u)
+  CU_ASSERT (cunit_logger_file_size ("./test-rotate.log.2") > 900u)
+  CU_ASSERT (cunit_logger_file_size ("./test-rotate.log.3") == 0u)
+  char * text = iot_file_read ("./test-rotate.log");
+  CU_ASSERT (text && strstr (text, "] Rotated message 99\n") != NULL)
+  free (text);
+}
+
+static void cunit_logger_file_buffered (void)
+{
+  iot_logger_file_options_t opts = { 0 };
+  opts.buffer_size = 4096u;
+  opts.flush_interval = 50u;
+  remove ("./test-buffered.log");
+  iot_logger_t * logger = iot_logger_alloc_file_options ("Buffered", IOT_LOG_WARN, true, NULL, "./test-buffered.log", &opts);
+  for (uint32_t i = 0; i < 10u; i++) iot_log_warn (logger, "Buffered message %" PRIu32, i);
+  CU_ASSERT (cunit_logger_file_size ("./test-buffered.log") == 0u)
+  iot_wait_msecs (250u);
+  size_t size = cunit_logger_file_size ("./test-buffered.log");
+  CU_ASSERT (size > 0u)
+  for (uint32_t i = 0; i < 1000u; i++) iot_log_warn (logger, "Buffered message %" PRIu32, i);
+  iot_logger_free (logger);
+  char * text = iot_file_read ("./test-buffered.log");
+  CU_ASSERT (text && strstr (text, "] Buffered message 9\n") && strstr (text, "] Buffered message 999\n"))
+  free (text);
+}
+
+static void cunit_logger_binary (void)
+{
+  char line[IOT_LOG_MSG_MAX];
+  char expect[IOT_LOG_MSG_MAX];
+  uint32_t count = 0;
+  size_t size = 0;
+  remove ("./test-binary.log");
+  remove ("./test-binary.txt");
+  iot_logger_t * logger = iot_logger_alloc_file_binary ("Binary", IOT_LOG_WARN, true, NULL, "./test-binary.log");
+  for (uint32_t i = 0; i < 100u; i++)
+  {
+    iot_log_warn (logger, "Binary " CUNIT_LOG_ARGS_FORMAT, CUNIT_LOG_ARGS (i), NULL);
+  }
+  for (uint32_t i = 0; i < 100u; i++)
+  {
+    iot_log_warn (logger, "Schedule %" PRIu32 " started, next run in %" PRIu64 " ms", i, (uint64_t) i * 100u);
+  }
+  iot_log_error (logger, "Not captured %ls", L"wide");
+  iot_log_info (logger, "Not logged");
+  iot_logger_free (logger);
+  logger = iot_logger_alloc_file_binary ("Appended", IOT_LOG_WARN, true, NULL, "./test-binary.log");
+  iot_log_warn (logger, "Appended %d", 1);
+  iot_logger_free (logger);
+  uint8_t * data = iot_file_read_binary ("./test-binary.log", &size);
+  FILE * fd = fopen ("./test-binary.txt", "w");
+  CU_ASSERT (iot_logger_decode_binary ("./test-binary.log", fd))
+  if (fd) fclose (fd);
+  char * text = iot_file_read ("./test-binary.txt");
+  CU_ASSERT (data && text && (size * 2u < strlen (text)))
+  free (data);
+  free (text);
+  fd = fopen ("./test-binary.txt", "r");
+  CU_ASSERT (fd != NULL)
+  while (fd && fgets (line, sizeof (line), fd))
+  {
+    if (count < 100u)
+    {
+      CU_ASSERT (strstr (line, ":Binary:WARN] ") != NULL)
+      snprintf (expect, sizeof (expect), "Binary " CUNIT_LOG_ARGS_FORMAT "\n", CUNIT_LOG_ARGS (count), "(null)");
+      CU_ASSERT (strcmp (strstr (line, "] ") + 2, expect) == 0)
+    }
+    else if (count < 200u)
+    {
+      snprintf (expect, sizeof (expect), ":Binary:WARN] Schedule %" PRIu32 " started, next run in %" PRIu32 " ms\n", count - 100u, (count - 100u) * 100u);
+      CU_ASSERT (strstr (line, expect) != NULL)
+    }
+    else if (count == 200u)
+    {
+      CU_ASSERT (strstr (line, ":Binary:ERROR] Not captured wide\n") != NULL)
+    }
+    else
+    {
+      CU_ASSERT (strstr (line, ":Appended:WARN] Appended 1\n") != NULL)
+    }
+    count++;
+  }
+  CU_ASSERT (count == 202u)
+  if (fd) fclose (fd);
+  CU_ASSERT (! iot_logger_decode_binary ("./test-binary.txt", stdout))
+  CU_ASSERT (! iot_logger_decode_binary ("./missing-binary.log", stdout))
+}
+
+static void cunit_logger_async_dropped (void)
+{
+  iot_logger_t * logger = iot_logger_alloc_file_async ("FileAsync", IOT_LOG_WARN, true, NULL, "./test-async.log", 1u);
+  for (uint32_t i = 0; i < 1000u; i++)
+  {
+    iot_log_warn (logger, "Async warning %" PRIu32, i);
+  }
+  CU_ASSERT (iot_logger_dropped (logger) > 0u)
+  iot_logger_free (logger);
+  logger = iot_logger_alloc ("Sync", IOT_LOG_WARN, true);
+  CU_ASSERT (iot_logger_dropped (logger) == 0u)
+  iot_logger_free (logger);
+}
+
+static void cunit_logger_udp_async (void)
+{
+  iot_logger_t * logger = iot_logger_alloc_udp_async ("udp-async", IOT_LOG_WARN, false, NULL, "127.0.0.1", 22222, 64u);
+  iot_logger_start (logger);
+  cunit_test_logs (logger);
+  iot_logger_free (logger);
+}
+
 static void cunit_logger_null (void)
 {
   cunit_test_logs (NULL); // Should be able to have logger as NULL
@@ -186,6 +422,130 @@ static void cunit_logger_set_next (void)
   iot_logger_free (next);
 }
 
+static void cunit_logger_threshold (void)
+{
+  iot_logger_t * next = iot_logger_alloc_custom ("Next", IOT_LOG_DEBUG, true, NULL, cunit_custom_log_fn, NULL, NULL);
+  iot_logger_t * logger = iot_logger_alloc_custom ("Head", IOT_LOG_WARN, true, next, cunit_custom_log_fn, NULL, NULL);
+  cunit_custom_log_count = 0u;
+  CU_ASSERT (logger->threshold == IOT_LOG_DEBUG)
+  iot_log_debug (logger, "Debug: chained");
+  CU_ASSERT (cunit_custom_log_count == 1u)
+  iot_logger_set_level (next, IOT_LOG_ERROR);
+  CU_ASSERT (logger->threshold == IOT_LOG_WARN)
+  iot_log_debug (logger, "Debug: dropped");
+  iot_log_warn (logger, "Warn: head only");
+  CU_ASSERT (cunit_custom_log_count == 2u)
+  iot_logger_stop (logger);
+  CU_ASSERT (logger->threshold == IOT_LOG_ERROR)
+  iot_logger_set_next (logger, NULL);
+  CU_ASSERT (logger->threshold == IOT_LOG_NONE)
+  iot_logger_start (logger);
+  CU_ASSERT (logger->threshold == IOT_LOG_WARN)
+  iot_logger_free (logger);
+  iot_logger_free (next);
+}
+
+// Wait for the start of a second, so a test logs within one rate limit window
+
+static void cunit_logger_next_second (void)
+{
+  uint64_t sec = iot_time_usecs () / 1000000u;
+  while ((iot_time_usecs () / 1000000u) == sec) iot_wait_msecs (1u);
+}
+
+static void cunit_logger_ratelimit (void)
+{
+  iot_logger_t * logger = iot_logger_alloc_custom ("RateLimit", IOT_LOG_WARN, true, NULL, cunit_custom_log_fn, NULL, NULL);
+  static iot_log_ratelimit_t shared;
+  cunit_custom_log_count = 0u;
+  for (uint32_t round = 0; round < 2u; round++)
+  {
+    cunit_logger_next_second ();
+    for (uint32_t i = 0; i < 100u; i++)
+    {
+      iot_log_warn_ratelimit (logger, 10u, "Warn: rate limited %u", i);
+      iot_log_info_ratelimit (logger, 10u, "Info: not logged %u", i);
+    }
+  }
+  CU_ASSERT (cunit_custom_log_count == 21u) // Includes count of suppressed messages
+  for (uint32_t i = 0; i < 10u; i++)
+  {
+    iot_log_log_ratelimit (logger, IOT_LOG_ERROR, &shared, 5u, "Error: shared rate limit %u", i);
+    iot_log_log_ratelimit (logger, IOT_LOG_WARN, &shared, 5u, "Warn: shared rate limit %u", i);
+  }
+  CU_ASSERT (cunit_custom_log_count == 26u)
+  iot_logger_free (logger);
+}
+
+static void cunit_logger_every (void)
+{
+  iot_logger_t * logger = iot_logger_alloc_custom ("Every", IOT_LOG_WARN, true, NULL, cunit_custom_log_fn, NULL, NULL);
+  cunit_custom_log_count = 0u;
+  for (uint32_t i = 0; i < 100u; i++)
+  {
+    iot_log_warn_every (logger, 10u, "Warn: sampled %u", i);
+    iot_log_debug_every (logger, 10u, "Debug: not logged %u", i);
+  }
+  CU_ASSERT (cunit_custom_log_count == 10u)
+  iot_logger_free (logger);
+}
+
+static void cunit_logger_rate_limit (void)
+{
+  iot_logger_t * next = iot_logger_alloc_custom ("Next", IOT_LOG_WARN, true, NULL, cunit_custom_log_fn, NULL, NULL);
+  iot_logger_t * logger = iot_logger_alloc_custom ("Limited", IOT_LOG_WARN, true, next, cunit_custom_log_fn, NULL, NULL);
+  iot_logger_set_rate_limit (logger, 5u);
+  cunit_custom_log_count = 0u;
+  cunit_logger_next_second ();
+  for (uint32_t i = 0; i < 20u; i++)
+  {
+    iot_log_warn (logger, "Warn: logger rate limited %u", i);
+  }
+  CU_ASSERT (cunit_custom_log_count == 25u) // Next logger not limited
+  cunit_logger_next_second ();
+  iot_log_warn (logger, "Warn: logger rate limited");
+  CU_ASSERT (cunit_custom_log_count == 28u)
+  iot_logger_set_rate_limit (logger, 0u);
+  for (uint32_t i = 0; i < 20u; i++)
+  {
+    iot_log_warn (logger, "Warn: logger not rate limited %u", i);
+  }
+  CU_ASSERT (cunit_custom_log_count == 68u)
+  iot_logger_free (logger);
+  iot_logger_free (next);
+}
+
+static uint32_t cunit_logger_evaluated = 0u;
+
+static uint32_t cunit_logger_evaluate (void)
+{
+  return ++cunit_logger_evaluated;
+}
+
+#pragma push_macro ("IOT_LOG_MIN_LEVEL")
+#undef IOT_LOG_MIN_LEVEL
+#define IOT_LOG_MIN_LEVEL IOT_LOG_INFO
+
+static void cunit_logger_min_level (void)
+{
+  iot_logger_t * logger = iot_logger_alloc_custom ("MinLevel", IOT_LOG_TRACE, true, NULL, cunit_custom_log_fn, NULL, NULL);
+  cunit_custom_log_count = 0u;
+  cunit_logger_evaluated = 0u;
+  iot_log_trace (logger, "Trace: compiled out %u", cunit_logger_evaluate ());
+  iot_log_debug (logger, "Debug: compiled out %u", cunit_logger_evaluate ());
+  iot_log_log (logger, IOT_LOG_DEBUG, "Debug: compiled out %u", cunit_logger_evaluate ());
+  iot_log_debug_every (logger, 1u, "Debug: compiled out %u", cunit_logger_evaluate ());
+  CU_ASSERT (cunit_logger_evaluated == 0u) // Arguments not evaluated, although logger threshold is trace
+  CU_ASSERT (cunit_custom_log_count == 0u)
+  iot_log_info (logger, "Info: logged %u", cunit_logger_evaluate ());
+  iot_log_warn (logger, "Warn: logged %u", cunit_logger_evaluate ());
+  CU_ASSERT (cunit_logger_evaluated == 2u)
+  CU_ASSERT (cunit_custom_log_count == 2u)
+  iot_logger_free (logger);
+}
+
+#pragma pop_macro ("IOT_LOG_MIN_LEVEL")
+
 static void cunit_logger_level_name (void)
 {
   CU_ASSERT (strcmp ("", iot_logger_level_to_string (IOT_LOG_NONE)) == 0)
@@ -204,13 +564,26 @@ void cunit_logger_test_init (void)
   CU_add_test (suite, "logger_impl", cunit_logger_impl);
   CU_add_test (suite, "logger_sub", cunit_logger_sub);
   CU_add_test (suite, "logger_file", cunit_logger_file);
+  CU_add_test (suite, "logger_file_threads", cunit_logger_file_threads);
   CU_add_test (suite, "logger_udp", cunit_logger_udp);
   CU_add_test (suite, "logger_udp_broadcast", cunit_logger_udp_broadcast);
+  CU_add_test (suite, "logger_file_async", cunit_logger_file_async);
+  CU_add_test (suite, "logger_deferred", cunit_logger_deferred);
+  CU_add_test (suite, "logger_file_rotate", cunit_logger_file_rotate);
+  CU_add_test (suite, "logger_file_buffered", cunit_logger_file_buffered);
+  CU_add_test (suite, "logger_binary", cunit_logger_binary);
+  CU_add_test (suite, "logger_async_dropped", cunit_logger_async_dropped);
+  CU_add_test (suite, "logger_udp_async", cunit_logger_udp_async);
   CU_add_test (suite, "logger_null", cunit_logger_null);
   CU_add_test (suite, "logger_start_stop", cunit_logger_start_stop);
   CU_add_test (suite, "logger_refcount", cunit_logger_refcount);
   CU_add_test (suite, "logger_selfstart", cunit_logger_selfstart);
   CU_add_test (suite, "logger_format", cunit_logger_format);
   CU_add_test (suite, "logger_set_next", cunit_logger_set_next);
+  CU_add_test (suite, "logger_threshold", cunit_logger_threshold);
+  CU_add_test (suite, "logger_ratelimit", cunit_logger_ratelimit);
+  CU_add_test (suite, "logger_every", cunit_logger_every);
+  CU_add_test (suite, "logger_rate_limit", cunit_logger_rate_limit);
+  CU_add_test (suite, "logger_min_level", cunit_logger_min_level);
   CU_add_test (suite, "logger_level_name", cunit_logger_level_name);
 }
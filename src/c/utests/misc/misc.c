@@ -6,8 +6,14 @@
  */
 
 #include "iot/iot.h"
+#include "iot/queue.h"
+#include "iot/uuid.h"
 #include "misc.h"
 #include "CUnit.h"
+#ifdef IOT_HAS_FILE
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
 
 #define MAX_COUNTER 1000
 #define MAX_SECS_COUNTER 4
@@ -69,6 +75,38 @@ static void test_time_nsecs (void)
   }
 }
 
+static void test_time_coarse (void)
+{
+  uint64_t coarse = iot_time_coarse_nsecs ();
+  uint64_t now = iot_time_nsecs ();
+  CU_ASSERT (coarse <= now)
+  CU_ASSERT (now - coarse < IOT_SEC_TO_NS (1))
+  CU_ASSERT (iot_time_coarse_usecs () <= iot_time_usecs ())
+  CU_ASSERT (iot_time_coarse_msecs () <= iot_time_msecs ())
+}
+
+static void test_time_cached (void)
+{
+  uint64_t cached = iot_time_cache_update ();
+  iot_wait_msecs (2u);
+  CU_ASSERT (iot_time_cached_nsecs () == cached)
+  CU_ASSERT (iot_time_cached_usecs () == cached / 1000u)
+  CU_ASSERT (iot_time_cached_msecs () == cached / 1000000u)
+  iot_time_cache_disable ();
+  CU_ASSERT (iot_time_cached_nsecs () > cached)
+  CU_ASSERT (iot_time_cached_msecs () >= cached / 1000000u + 2u)
+}
+
+static void test_wait_precise (void)
+{
+  for (uint64_t interval = 1u; interval < 2000u; interval *= 3u)
+  {
+    uint64_t start = iot_time_nsecs ();
+    iot_wait_precise_usecs (interval);
+    CU_ASSERT (iot_time_nsecs () - start >= interval * 1000u)
+  }
+}
+
 static void test_wait (void)
 {
   iot_wait_secs (1u);
@@ -78,32 +116,37 @@ static void test_wait (void)
 
 static void test_hash (void)
 {
-  CU_ASSERT ( iot_hash ("Dummy") == 3802084562)
-  CU_ASSERT ( iot_hash ("int8") == 636741937)
-  CU_ASSERT ( iot_hash ("int8array") == 3352350152)
-  CU_ASSERT ( iot_hash ("uint8") == 3827140740)
-  CU_ASSERT ( iot_hash ("uint8array") == 1993633373)
-  CU_ASSERT ( iot_hash ("int16") == 3832614926)
-  CU_ASSERT ( iot_hash ("int16array") == 3293575959)
-  CU_ASSERT ( iot_hash ("uint16") == 1741593115)
-  CU_ASSERT ( iot_hash ("uint16array") == 3942928418)
-  CU_ASSERT ( iot_hash ("int32") == 3832614984)
-  CU_ASSERT ( iot_hash ("int32array") == 1264005137)
-  CU_ASSERT ( iot_hash ("uint32") == 1741593181)
-  CU_ASSERT ( iot_hash ("uint32array") == 2235632164)
-  CU_ASSERT ( iot_hash ("int64") == 3832615211)
-  CU_ASSERT ( iot_hash ("int64array") == 1709245714)
-  CU_ASSERT ( iot_hash ("uint64") == 1741593086)
-  CU_ASSERT ( iot_hash ("uint64array") == 2964325927)
-  CU_ASSERT ( iot_hash ("float32") == 2863538027)
-  CU_ASSERT ( iot_hash ("float32array") == 3463494610)
-  CU_ASSERT ( iot_hash ("float64") == 2863538056)
-  CU_ASSERT ( iot_hash ("float64array") == 464521169)
-  CU_ASSERT ( iot_hash ("bool") == 636838452)
-  CU_ASSERT ( iot_hash ("boolarray") == 1007050925)
-  CU_ASSERT ( iot_hash ("string") == 1386610095)
-  CU_ASSERT ( iot_hash ("binary") == 2016023253)
-  CU_ASSERT ( iot_hash_data ((uint8_t*) "binary", strlen ("binary")) == 2016023253)
+  CU_ASSERT ( iot_hash ("Dummy") == 2196366783)
+  CU_ASSERT ( iot_hash ("int8") == 2821142843)
+  CU_ASSERT ( iot_hash ("int8array") == 1327893246)
+  CU_ASSERT ( iot_hash ("uint8") == 52706541)
+  CU_ASSERT ( iot_hash ("uint8array") == 1128194793)
+  CU_ASSERT ( iot_hash ("int16") == 152043231)
+  CU_ASSERT ( iot_hash ("int16array") == 790182129)
+  CU_ASSERT ( iot_hash ("uint16") == 1326213148)
+  CU_ASSERT ( iot_hash ("uint16array") == 447190620)
+  CU_ASSERT ( iot_hash ("int32") == 1722897027)
+  CU_ASSERT ( iot_hash ("int32array") == 35250357)
+  CU_ASSERT ( iot_hash ("uint32") == 2979165614)
+  CU_ASSERT ( iot_hash ("uint32array") == 483007712)
+  CU_ASSERT ( iot_hash ("int64") == 4150340867)
+  CU_ASSERT ( iot_hash ("int64array") == 3105797824)
+  CU_ASSERT ( iot_hash ("uint64") == 1570338904)
+  CU_ASSERT ( iot_hash ("uint64array") == 3113560945)
+  CU_ASSERT ( iot_hash ("float32") == 1859029372)
+  CU_ASSERT ( iot_hash ("float32array") == 1383912043)
+  CU_ASSERT ( iot_hash ("float64") == 1153979112)
+  CU_ASSERT ( iot_hash ("float64array") == 2101771718)
+  CU_ASSERT ( iot_hash ("bool") == 2771760077)
+  CU_ASSERT ( iot_hash ("boolarray") == 1133178889)
+  CU_ASSERT ( iot_hash ("string") == 3942533832)
+  CU_ASSERT ( iot_hash ("binary") == 283231397)
+  CU_ASSERT ( iot_hash_data ((uint8_t*) "binary", strlen ("binary")) == 283231397)
+  CU_ASSERT ( iot_hash_seeded ("binary", 0u) == 283231397)
+  CU_ASSERT ( iot_hash_seeded ("binary", 1u) != 283231397)
+  CU_ASSERT ( iot_hash_data_seeded ((uint8_t*) "binary", strlen ("binary"), 1u) == iot_hash_seeded ("binary", 1u))
+  CU_ASSERT ( iot_hash_djb2 ((uint8_t*) "binary", strlen ("binary")) == 2016023253)
+  CU_ASSERT ( iot_hash_data (NULL, 0u) == iot_hash (""))
 }
 
 static void test_uuid_string (void)
@@ -119,6 +162,166 @@ static void test_uuid_string (void)
   CU_ASSERT (! iot_util_string_is_uuid ("e79ebe07-0774-4a91-a33b-6a011539014y"))
 }
 
+static void * uuid_job (void * arg)
+{
+  iot_uuid_generate_n (arg, 100u);
+  return NULL;
+}
+
+static void test_uuid_generate (void)
+{
+  iot_uuid_t uuids[200];
+  char str[UUID_STR_LEN];
+  char ref[UUID_STR_LEN];
+  iot_threadpool_t * pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_threadpool_start (pool);
+  iot_threadpool_add_work (pool, uuid_job, uuids, IOT_THREAD_NO_PRIORITY);
+  iot_threadpool_add_work (pool, uuid_job, uuids + 100, IOT_THREAD_NO_PRIORITY);
+  iot_threadpool_wait (pool);
+  iot_threadpool_free (pool);
+  iot_uuid_generate (uuids[0]);
+  for (unsigned i = 0; i < 200u; i++)
+  {
+    const uint8_t * u = uuids[i];
+    iot_uuid_unparse (uuids[i], str);
+    snprintf (ref, sizeof (ref), "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+      u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7], u[8], u[9], u[10], u[11], u[12], u[13], u[14], u[15]);
+    CU_ASSERT (strcmp (str, ref) == 0)
+    CU_ASSERT (iot_util_string_is_uuid (str))
+    CU_ASSERT ((u[6] & 0xf0) == 0x40)
+    CU_ASSERT ((u[8] & 0xc0) == 0x80)
+    for (unsigned j = 0; j < i; j++) CU_ASSERT (memcmp (uuids[i], uuids[j], sizeof (iot_uuid_t)) != 0)
+  }
+  iot_uuid_generate_n (uuids, 0u);
+}
+
+static void test_uuid_v7 (void)
+{
+  iot_uuid_t uuids[1000];
+  char str[UUID_STR_LEN];
+  uint64_t start = iot_time_msecs ();
+  for (unsigned i = 0; i < 1000u; i++) iot_uuid_generate_v7 (uuids[i]);
+  uint64_t end = iot_time_msecs ();
+  for (unsigned i = 0; i < 1000u; i++)
+  {
+    const uint8_t * u = uuids[i];
+    uint64_t msecs = 0u;
+    for (unsigned j = 0; j < 6u; j++) msecs = (msecs << 8) | u[j];
+    CU_ASSERT (msecs >= start && msecs <= end + 1u)
+    CU_ASSERT ((u[6] & 0xf0) == 0x70)
+    CU_ASSERT ((u[8] & 0xc0) == 0x80)
+    if (i) CU_ASSERT (memcmp (uuids[i - 1], uuids[i], sizeof (iot_uuid_t)) < 0)
+  }
+  iot_uuid_unparse (uuids[0], str);
+  CU_ASSERT (iot_util_string_is_uuid (str))
+  iot_data_t * d1 = iot_data_alloc_uuid_v7_string ();
+  iot_data_t * d2 = iot_data_alloc_uuid_v7_string ();
+  CU_ASSERT (strcmp (iot_data_string (d1), iot_data_string (d2)) < 0)
+  iot_data_free (d1);
+  iot_data_free (d2);
+  d1 = iot_data_alloc_uuid_v7 ();
+  CU_ASSERT (iot_data_array_length (d1) == sizeof (iot_uuid_t))
+  iot_data_free (d1);
+}
+
+static iot_data_t * trace_events (void)
+{
+  FILE * file = tmpfile ();
+  CU_ASSERT (iot_trace_dump (file))
+  long len = ftell (file);
+  char * json = calloc (1, (size_t) len + 1u);
+  rewind (file);
+  CU_ASSERT (fread (json, 1, (size_t) len, file) == (size_t) len)
+  fclose (file);
+  iot_data_t * trace = iot_data_from_json (json);
+  free (json);
+  CU_ASSERT (trace != NULL)
+  iot_data_t * events = iot_data_add_ref (iot_data_string_map_get (trace, "traceEvents"));
+  iot_data_free (trace);
+  return events;
+}
+
+static uint32_t trace_count (const iot_data_t * events, const char * name, const char * ph)
+{
+  uint32_t count = 0u;
+  iot_data_vector_iter_t iter;
+  iot_data_vector_iter (events, &iter);
+  while (iot_data_vector_iter_next (&iter))
+  {
+    const iot_data_t * event = iot_data_vector_iter_value (&iter);
+    if (strcmp (iot_data_string_map_get_string (event, "name"), name) == 0 && strcmp (iot_data_string_map_get_string (event, "ph"), ph) == 0) count++;
+  }
+  return count;
+}
+
+static void * trace_job (void * arg)
+{
+  (void) arg;
+  return NULL;
+}
+
+static void test_trace (void)
+{
+  iot_data_t * events;
+  iot_queue_t * q = iot_queue_alloc (0u);
+  iot_threadpool_t * pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_threadpool_start (pool);
+
+  CU_ASSERT (! iot_trace_enabled ())
+  iot_trace_event (IOT_TRACE_JOB_START, 1u);
+  iot_trace_enable (true);
+  CU_ASSERT (iot_trace_enabled ())
+  iot_trace_clear ();
+  events = trace_events ();
+  CU_ASSERT (iot_data_vector_size (events) == 0u)
+  iot_data_free (events);
+
+  iot_queue_enqueue (q, iot_data_alloc_ui32 (1u));
+  iot_data_free (iot_queue_dequeue (q));
+  for (uint32_t i = 0; i < 10u; i++) iot_threadpool_add_work (pool, trace_job, NULL, IOT_THREAD_NO_PRIORITY);
+  iot_threadpool_wait (pool);
+  events = trace_events ();
+#ifdef IOT_HAS_TRACE
+  CU_ASSERT (trace_count (events, "enqueue", "i") == 1u)
+  CU_ASSERT (trace_count (events, "dequeue", "i") == 1u)
+  CU_ASSERT (trace_count (events, "job", "B") == 10u)
+  CU_ASSERT (trace_count (events, "job", "E") == 10u)
+#endif
+  iot_data_free (events);
+
+  iot_trace_clear ();
+  for (uint32_t i = 0; i < 3u * IOT_TRACE_RING_SIZE; i++) iot_trace_event (IOT_TRACE_SCHEDULE_FIRE, i);
+  events = trace_events ();
+  CU_ASSERT (trace_count (events, "schedule", "i") == IOT_TRACE_RING_SIZE)
+  const iot_data_t * last = iot_data_vector_get (events, iot_data_vector_size (events) - 1u);
+  CU_ASSERT (iot_data_i64 (iot_data_string_map_get (iot_data_string_map_get (last, "args"), "arg")) == 3 * IOT_TRACE_RING_SIZE - 1)
+  iot_data_free (events);
+
+  iot_trace_enable (false);
+  iot_trace_clear ();
+  iot_threadpool_free (pool);
+  iot_queue_free (q);
+}
+
+static void test_config_from_json (void)
+{
+  setenv ("IOT_TEST_NAME", "sensor \"1\"", 1);
+  setenv ("IOT_TEST_COUNT", "7", 1);
+  iot_data_t * map = iot_config_from_json ("{\"Name\":\"${IOT_TEST_NAME}\",\"Path\":\"/${IOT_TEST_COUNT}/x\",\"${IOT_TEST_COUNT}\":1}", NULL);
+  CU_ASSERT (map && iot_data_type (map) == IOT_DATA_MAP)
+  CU_ASSERT (iot_data_string_map_get_string (map, "Name") && strcmp (iot_data_string_map_get_string (map, "Name"), "sensor \"1\"") == 0) // Not reparsed as JSON
+  CU_ASSERT (iot_data_string_map_get_string (map, "Path") && strcmp (iot_data_string_map_get_string (map, "Path"), "/7/x") == 0)
+  CU_ASSERT (iot_data_string_map_get_i64 (map, "7", 0) == 1)
+  iot_data_free (map);
+  map = iot_config_from_json ("{\"Count\":${IOT_TEST_COUNT}}", NULL); // Reference outside a string
+  CU_ASSERT (map && iot_data_string_map_get_i64 (map, "Count", 0) == 7)
+  iot_data_free (map);
+  CU_ASSERT (iot_config_from_json ("{\"Name\":\"${IOT_TEST_UNSET}\"}", NULL) == NULL)
+  CU_ASSERT (iot_config_from_json (NULL, NULL) == NULL)
+  unsetenv ("IOT_TEST_NAME");
+  unsetenv ("IOT_TEST_COUNT");
+}
+
 #ifdef IOT_HAS_FILE
 
 #define TEST_FILE_NAME "/tmp/iot_test.json"
@@ -161,6 +364,36 @@ static void test_list_file (void)
   CU_ASSERT_TRUE (file_found)
 }
 
+static void test_file_index (void)
+{
+  static const char * dir = "/tmp/iot_test_index";
+  mkdir (dir, 0755);
+  CU_ASSERT (iot_file_write ("/tmp/iot_test_index/a.json", "{}"))
+  CU_ASSERT (iot_file_write ("/tmp/iot_test_index/b.txt", "b"))
+  CU_ASSERT (iot_file_index_alloc (dir, "[") == NULL) // Invalid regex
+  iot_file_index_t * index = iot_file_index_alloc (dir, ".json$");
+  iot_data_t * list = iot_file_index_list (index);
+  CU_ASSERT (iot_data_list_length (list) == 1u)
+  iot_data_free (list);
+  CU_ASSERT (iot_file_write ("/tmp/iot_test_index/c.json", "{}"))
+  list = iot_file_index_list (index);
+  CU_ASSERT (iot_data_list_length (list) == 2u)
+  iot_data_free (list);
+  CU_ASSERT (iot_file_delete ("/tmp/iot_test_index/a.json"))
+  CU_ASSERT (rename ("/tmp/iot_test_index/c.json", "/tmp/iot_test_index/d.json") == 0)
+  list = iot_file_index_list (index);
+  CU_ASSERT (iot_data_list_length (list) == 1u)
+  iot_data_t * name = iot_data_list_head_pop (list);
+  CU_ASSERT (name && strcmp (iot_data_string (name), "d.json") == 0)
+  iot_data_free (name);
+  iot_data_free (list);
+  CU_ASSERT (iot_file_delete ("/tmp/iot_test_index/b.txt"))
+  CU_ASSERT (iot_file_delete ("/tmp/iot_test_index/d.json"))
+  CU_ASSERT (rmdir (dir) == 0)
+  CU_ASSERT (iot_file_index_list (index) == NULL) // Directory removed
+  iot_file_index_free (index);
+}
+
 static void test_list_config_file (void)
 {
   iot_data_t *file_list = iot_store_config_list ("/tmp");
@@ -180,6 +413,240 @@ static void test_list_config_file (void)
   CU_ASSERT_TRUE (file_found)
 }
 
+#ifndef _AZURESPHERE_
+#define TEST_LARGE_FILE_NAME "/tmp/iot_test_large.bin"
+#define TEST_LARGE_FILE_SIZE 100000u
+
+static void test_read_large_file (void)
+{
+  uint8_t * data = malloc (TEST_LARGE_FILE_SIZE);
+  for (uint32_t i = 0; i < TEST_LARGE_FILE_SIZE; i++) data[i] = (uint8_t) (i * 7u);
+  CU_ASSERT (iot_store_write_binary (TEST_LARGE_FILE_NAME, data, TEST_LARGE_FILE_SIZE))
+  size_t len = 0;
+  uint8_t * ret = iot_store_read_binary (TEST_LARGE_FILE_NAME, &len);
+  CU_ASSERT (ret != NULL)
+  CU_ASSERT (len == TEST_LARGE_FILE_SIZE)
+  CU_ASSERT (ret && memcmp (ret, data, TEST_LARGE_FILE_SIZE) == 0 && ret[len] == 0)
+  free (ret);
+  const uint8_t * addr = iot_file_map (TEST_LARGE_FILE_NAME, &len);
+  CU_ASSERT (addr != NULL)
+  CU_ASSERT (len == TEST_LARGE_FILE_SIZE)
+  CU_ASSERT (addr && memcmp (addr, data, TEST_LARGE_FILE_SIZE) == 0)
+  iot_file_unmap (addr, len);
+  CU_ASSERT (iot_file_map ("/tmp/iot_does_not_exist", &len) == NULL)
+  CU_ASSERT (len == 0u)
+  CU_ASSERT (iot_store_delete (TEST_LARGE_FILE_NAME))
+  free (data);
+}
+
+static void test_config_load_map (void)
+{
+  CU_ASSERT (iot_store_write ("/tmp/iot_test_cfg.json", "{\"Name\":\"${USER}\",\"Count\":1}"))
+  iot_data_t * map1 = iot_store_config_load_map ("iot_test_cfg", "/tmp");
+  iot_data_t * map2 = iot_store_config_load_map ("iot_test_cfg", "/tmp");
+  CU_ASSERT (map1 != NULL)
+  CU_ASSERT (map2 != NULL)
+  CU_ASSERT (map1 != map2)
+  CU_ASSERT (iot_data_equal (map1, map2))
+  CU_ASSERT (iot_data_string_map_get_i64 (map1, "Count", 0) == 1)
+  CU_ASSERT (iot_data_string_map_get_string (map1, "Name") && strcmp (iot_data_string_map_get_string (map1, "Name"), "${USER}") != 0)
+  iot_data_string_map_add (map1, "Extra", iot_data_alloc_bool (true)); // Modifying a loaded map does not change cached map
+  iot_data_free (map1);
+  iot_data_free (map2);
+  map1 = iot_store_config_load_map ("iot_test_cfg", "/tmp");
+  CU_ASSERT (map1 && iot_data_string_map_get (map1, "Extra") == NULL)
+  iot_data_free (map1);
+  CU_ASSERT (iot_store_write ("/tmp/iot_test_cfg.json", "{\"Count\":22}"))
+  map1 = iot_store_config_load_map ("iot_test_cfg", "/tmp");
+  CU_ASSERT (iot_data_string_map_get_i64 (map1, "Count", 0) == 22)
+  iot_data_free (map1);
+  iot_store_config_cache_clear ();
+  CU_ASSERT (iot_store_config_delete ("iot_test_cfg", "/tmp"))
+  CU_ASSERT (iot_store_config_load_map ("iot_test_cfg", "/tmp") == NULL)
+}
+
+static atomic_uint test_store_writes;
+
+static bool test_store_count_write (const char * path, const uint8_t * binary, size_t len)
+{
+  atomic_fetch_add (&test_store_writes, 1u);
+  return iot_file_write_binary (path, binary, len);
+}
+
+static void test_store_write_behind (void)
+{
+  static const char * path = "/tmp/iot_test_behind.json";
+  iot_store_delete (path);
+  atomic_store (&test_store_writes, 0u);
+  iot_store_config (iot_file_read_binary, test_store_count_write, iot_file_delete);
+  CU_ASSERT (iot_store_write_behind (100u))
+  CU_ASSERT (iot_store_write (path, "{\"Count\":1}"))
+  CU_ASSERT (iot_store_write (path, "{\"Count\":2}"))
+  CU_ASSERT (iot_store_config_save ("iot_test_behind", "/tmp", "{\"Count\":3}"))
+  char * str = iot_store_read (path); // Pending contents read
+  CU_ASSERT (str && strcmp (str, "{\"Count\":3}") == 0)
+  free (str);
+  iot_data_t * map = iot_store_config_load_map ("iot_test_behind", "/tmp");
+  CU_ASSERT (map && iot_data_string_map_get_i64 (map, "Count", 0) == 3)
+  iot_data_free (map);
+  CU_ASSERT (iot_file_read (path) == NULL) // Not yet written
+  for (uint32_t i = 0; i < 100u && atomic_load (&test_store_writes) == 0u; i++) iot_wait_msecs (10u);
+  CU_ASSERT (atomic_load (&test_store_writes) == 1u) // Writes coalesced
+  str = iot_file_read (path);
+  CU_ASSERT (str && strcmp (str, "{\"Count\":3}") == 0)
+  free (str);
+  CU_ASSERT (iot_store_write (path, "{\"Count\":4}"))
+  CU_ASSERT (iot_store_flush ())
+  CU_ASSERT (atomic_load (&test_store_writes) == 2u)
+  str = iot_file_read (path);
+  CU_ASSERT (str && strcmp (str, "{\"Count\":4}") == 0)
+  free (str);
+  CU_ASSERT (iot_store_write (path, "{\"Count\":5}"))
+  CU_ASSERT (iot_store_delete (path)) // Pending write discarded
+  CU_ASSERT (iot_store_read (path) == NULL)
+  CU_ASSERT (iot_store_write (path, "{\"Count\":6}"))
+  CU_ASSERT (iot_store_write_behind (0u)) // Writes pending data
+  CU_ASSERT (atomic_load (&test_store_writes) == 3u)
+  CU_ASSERT (iot_store_write (path, "{\"Count\":7}")) // Written directly
+  CU_ASSERT (atomic_load (&test_store_writes) == 4u)
+  iot_store_config (iot_file_read_binary, iot_file_write_binary, iot_file_delete);
+  iot_store_config_cache_clear ();
+  CU_ASSERT (iot_store_delete (path))
+}
+
+static atomic_bool test_store_writing;
+static atomic_bool test_store_release;
+
+static bool test_store_slow_write (const char * path, const uint8_t * binary, size_t len)
+{
+  atomic_store (&test_store_writing, true);
+  while (! atomic_load (&test_store_release)) iot_wait_msecs (1u);
+  return iot_file_write_binary (path, binary, len);
+}
+
+static void test_store_write_behind_read (void)
+{
+  static const char * path = "/tmp/iot_test_behind_read.json";
+  iot_store_delete (path);
+  atomic_store (&test_store_writing, false);
+  atomic_store (&test_store_release, false);
+  iot_store_config (iot_file_read_binary, test_store_slow_write, iot_file_delete);
+  CU_ASSERT (iot_store_write_behind (10u))
+  CU_ASSERT (iot_store_write (path, "{\"Count\":1}"))
+  for (uint32_t i = 0; i < 500u && ! atomic_load (&test_store_writing); i++) iot_wait_msecs (2u);
+  CU_ASSERT (atomic_load (&test_store_writing))
+  char * str = iot_store_read (path); // Written contents read while write in progress
+  CU_ASSERT (str && strcmp (str, "{\"Count\":1}") == 0)
+  free (str);
+  CU_ASSERT (iot_file_read (path) == NULL)
+  atomic_store (&test_store_release, true);
+  CU_ASSERT (iot_store_write_behind (0u))
+  str = iot_store_read (path);
+  CU_ASSERT (str && strcmp (str, "{\"Count\":1}") == 0)
+  free (str);
+  iot_store_config (iot_file_read_binary, iot_file_write_binary, iot_file_delete);
+  CU_ASSERT (iot_store_delete (path))
+}
+
+static void test_store_kv (void)
+{
+  static const char * path = "/tmp/iot_test_store.kv";
+  char value[1024];
+  unlink (path);
+  CU_ASSERT (iot_store_kv_open (path))
+  CU_ASSERT (iot_store_config_save ("a", "/tmp/kv", "{\"Count\":1}"))
+  CU_ASSERT (iot_store_config_save ("b", "/tmp/kv", "{\"Count\":2}"))
+  CU_ASSERT (iot_store_write ("/tmp/kv/sub/c.json", "{}"))
+  CU_ASSERT (iot_store_write ("/tmp/kv/d.txt", "d"))
+  iot_data_t * list = iot_store_config_list ("/tmp/kv");
+  CU_ASSERT (iot_data_list_length (list) == 2u)
+  iot_data_free (list);
+  CU_ASSERT (iot_store_config_save ("a", "/tmp/kv", "{\"Count\":3}"))
+  iot_data_t * map = iot_store_config_load_map ("a", "/tmp/kv");
+  CU_ASSERT (map && iot_data_string_map_get_i64 (map, "Count", 0) == 3)
+  iot_data_free (map);
+  CU_ASSERT (iot_store_config_delete ("b", "/tmp/kv"))
+  CU_ASSERT (! iot_store_config_delete ("b", "/tmp/kv"))
+  CU_ASSERT (iot_store_config_load ("b", "/tmp/kv") == NULL)
+  iot_data_t * stats = iot_store_kv_stats ();
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "keys")) == 3u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "garbage")) > 0u)
+  iot_data_free (stats);
+  CU_ASSERT (iot_store_kv_compact ())
+  stats = iot_store_kv_stats ();
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "garbage")) == 0u)
+  iot_data_free (stats);
+  iot_store_kv_close ();
+
+  // Torn trailing record discarded on open
+  FILE * fh = fopen (path, "a");
+  CU_ASSERT (fh && fwrite ("torn", 4u, 1u, fh) == 1u)
+  if (fh) fclose (fh);
+  CU_ASSERT (iot_store_kv_open (path))
+  char * str = iot_store_config_load ("a", "/tmp/kv");
+  CU_ASSERT (str && strcmp (str, "{\"Count\":3}") == 0)
+  free (str);
+  CU_ASSERT (iot_store_config_load ("b", "/tmp/kv") == NULL)
+
+  // Background compaction once superseded records exceed live data
+  memset (value, 'x', sizeof (value) - 1u);
+  value[sizeof (value) - 1u] = '\0';
+  for (uint32_t i = 0; i < 200u; i++) CU_ASSERT (iot_store_write ("/tmp/kv/big", value))
+  uint64_t garbage = UINT64_MAX;
+  for (uint32_t i = 0; i < 100u && garbage > 65536u; i++)
+  {
+    stats = iot_store_kv_stats ();
+    garbage = iot_data_ui64 (iot_data_string_map_get (stats, "garbage"));
+    iot_data_free (stats);
+    if (garbage > 65536u) iot_wait_msecs (10u);
+  }
+  CU_ASSERT (garbage <= 65536u)
+  str = iot_store_read ("/tmp/kv/big");
+  CU_ASSERT (str && strcmp (str, value) == 0)
+  free (str);
+  iot_store_kv_close ();
+  CU_ASSERT (iot_store_read ("/tmp/kv/big") == NULL) // Default file store
+  unlink (path);
+}
+
+#ifdef IOT_HAS_CBOR
+static void test_config_snapshot (void)
+{
+  const char * json = "{\"Name\":\"${USER}\",\"Count\":3,\"Ratio\":0.5,\"List\":[1,\"two\",true]}";
+  struct stat st;
+  CU_ASSERT (iot_store_write ("/tmp/iot_test_snap1.json", json))
+  CU_ASSERT (iot_store_write ("/tmp/iot_test_snap2.json", "{\"Count\":2}"))
+  iot_store_config_cache_clear ();
+  iot_data_t * map1 = iot_store_config_load_map ("iot_test_snap1", "/tmp");
+  iot_data_t * map2 = iot_store_config_load_map ("iot_test_snap2", "/tmp");
+  CU_ASSERT (iot_store_config_snapshot_save ("/tmp/iot_test_snap.cbor"))
+  iot_store_config_cache_clear ();
+  CU_ASSERT (iot_store_config_snapshot_load ("/tmp/iot_test_snap.cbor"))
+
+  // Snapshot used if file modification time and size unchanged, even if contents changed
+  CU_ASSERT (stat ("/tmp/iot_test_snap1.json", &st) == 0)
+  CU_ASSERT (iot_store_write ("/tmp/iot_test_snap1.json", "{\"Name\":\"${USER}\",\"Count\":4,\"Ratio\":0.5,\"List\":[1,\"two\",true]}"))
+  struct timespec times[2] = { st.st_atim, st.st_mtim };
+  CU_ASSERT (utimensat (AT_FDCWD, "/tmp/iot_test_snap1.json", times, 0) == 0)
+  CU_ASSERT (iot_store_write ("/tmp/iot_test_snap2.json", "{\"Count\":22}"))
+  iot_data_t * snap1 = iot_store_config_load_map ("iot_test_snap1", "/tmp");
+  iot_data_t * snap2 = iot_store_config_load_map ("iot_test_snap2", "/tmp");
+  CU_ASSERT (iot_data_equal (map1, snap1))
+  CU_ASSERT (snap1 && iot_data_string_map_get_i64 (snap1, "Count", 0) == 3)
+  CU_ASSERT (snap2 && iot_data_string_map_get_i64 (snap2, "Count", 0) == 22)
+  iot_data_free (snap1);
+  iot_data_free (snap2);
+  iot_data_free (map1);
+  iot_data_free (map2);
+  CU_ASSERT (! iot_store_config_snapshot_load ("/tmp/iot_does_not_exist.cbor"))
+  iot_store_config_cache_clear ();
+  CU_ASSERT (iot_store_delete ("/tmp/iot_test_snap.cbor"))
+  CU_ASSERT (iot_store_delete ("/tmp/iot_test_snap1.json"))
+  CU_ASSERT (iot_store_delete ("/tmp/iot_test_snap2.json"))
+}
+#endif
+#endif
+
 static void test_delete_file (void)
 {
   CU_ASSERT (iot_store_delete (TEST_FILE_NAME))
@@ -194,15 +661,31 @@ void cunit_misc_test_init (void)
   CU_add_test (suite, "time_msecs", test_time_msecs);
   CU_add_test (suite, "time_usecs", test_time_usecs);
   CU_add_test (suite, "time_nsecs", test_time_nsecs);
+  CU_add_test (suite, "time_coarse", test_time_coarse);
+  CU_add_test (suite, "time_cached", test_time_cached);
   CU_add_test (suite, "wait", test_wait);
+  CU_add_test (suite, "wait_precise", test_wait_precise);
   CU_add_test (suite, "hash", test_hash);
   CU_add_test (suite, "uuid_string", test_uuid_string);
+  CU_add_test (suite, "uuid_generate", test_uuid_generate);
+  CU_add_test (suite, "uuid_v7", test_uuid_v7);
+  CU_add_test (suite, "trace", test_trace);
+  CU_add_test (suite, "config_from_json", test_config_from_json);
 #ifdef IOT_HAS_FILE
   CU_add_test (suite, "write_file", test_write_file);
   CU_add_test (suite, "read_file", test_read_file);
 #ifndef _AZURESPHERE_
   CU_add_test (suite, "list_file", test_list_file);
+  CU_add_test (suite, "file_index", test_file_index);
   CU_add_test (suite, "list_config_file", test_list_config_file);
+  CU_add_test (suite, "read_large_file", test_read_large_file);
+  CU_add_test (suite, "config_load_map", test_config_load_map);
+  CU_add_test (suite, "store_write_behind", test_store_write_behind);
+  CU_add_test (suite, "store_write_behind_read", test_store_write_behind_read);
+  CU_add_test (suite, "store_kv", test_store_kv);
+#ifdef IOT_HAS_CBOR
+  CU_add_test (suite, "config_snapshot", test_config_snapshot);
+#endif
 #endif
   CU_add_test (suite, "delete_file", test_delete_file);
 #endif
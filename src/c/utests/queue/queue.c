@@ -8,12 +8,15 @@
 #include "queue.h"
 #include "CUnit.h"
 #include "iot/queue.h"
+#include "iot/time.h"
 
 #define SINGLE_SIZE 5
 #define MULTI_SIZE 1000
 #define MULTI_THREADS 2
+#define RING_SIZE 16
 
 static bool jobs[MULTI_SIZE];
+static atomic_uint multi_next;
 
 static int suite_init (void)
 {
@@ -38,12 +41,189 @@ static void test_alloc (void)
   iot_queue_free (q);
 }
 
-static void test_run_single (void)
+static void test_ring_alloc (void)
+{
+  iot_queue_t *q = iot_queue_alloc_ring (10);
+  CU_ASSERT (q != NULL)
+  CU_ASSERT (iot_queue_size (q) == 0)
+  CU_ASSERT (iot_queue_maxsize (q) == 10)
+  iot_queue_setmaxsize (q, 20);
+  CU_ASSERT (iot_queue_maxsize (q) == 10)
+  iot_queue_try_enqueue (q, iot_data_alloc_ui32 (1));
+  iot_queue_try_enqueue (q, iot_data_alloc_ui32 (2));
+  CU_ASSERT (iot_queue_size (q) == 2)
+  iot_queue_free (q);
+}
+
+static void check_stats (iot_queue_t *q, uint32_t size, uint64_t enqueued, uint64_t dequeued)
+{
+  iot_data_t *stats = iot_queue_stats (q);
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "size")) == size)
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "max_size")) == 2u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "enqueued")) == enqueued)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "dequeued")) == dequeued)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "enqueue_blocked")) == 0u)
+  iot_data_free (stats);
+}
+
+static void run_stats (iot_queue_t *q)
+{
+  iot_data_t *element;
+  check_stats (q, 0u, 0u, 0u);
+  CU_ASSERT (iot_queue_try_enqueue (q, iot_data_alloc_ui32 (1)))
+  CU_ASSERT (iot_queue_try_enqueue (q, iot_data_alloc_ui32 (2)))
+  element = iot_data_alloc_ui32 (3);
+  CU_ASSERT (!iot_queue_try_enqueue (q, element))
+  iot_data_free (element);
+  check_stats (q, 2u, 2u, 0u);
+  iot_data_free (iot_queue_dequeue (q));
+  check_stats (q, 1u, 2u, 1u);
+  iot_data_free (iot_queue_try_dequeue (q));
+  CU_ASSERT (iot_queue_try_dequeue (q) == NULL)
+  check_stats (q, 0u, 2u, 2u);
+  iot_queue_free (q);
+}
+
+static void test_stats (void)
+{
+  run_stats (iot_queue_alloc (2));
+  run_stats (iot_queue_alloc_ring (2));
+}
+
+static void run_batch (iot_queue_t *q)
+{
+  iot_data_t *list = iot_data_alloc_list ();
+  iot_data_t *stats;
+  for (uint32_t i = 0; i < SINGLE_SIZE; i++)
+  {
+    CU_ASSERT (iot_queue_try_enqueue (q, iot_data_alloc_ui32 (i)))
+  }
+  CU_ASSERT (iot_queue_dequeue_batch (q, 3u, 0u, list) == 3u)
+  CU_ASSERT (iot_data_list_length (list) == 3u)
+  CU_ASSERT (iot_queue_size (q) == SINGLE_SIZE - 3u)
+  CU_ASSERT (iot_queue_dequeue_batch (q, RING_SIZE, 0u, list) == SINGLE_SIZE - 3u)
+  for (uint32_t i = 0; i < SINGLE_SIZE; i++)
+  {
+    iot_data_t *e = iot_data_list_head_pop (list);
+    CU_ASSERT (iot_data_ui32 (e) == i)
+    iot_data_free (e);
+  }
+  CU_ASSERT (iot_queue_dequeue_batch (q, RING_SIZE, 1000000u, list) == 0u)
+  CU_ASSERT (iot_data_list_length (list) == 0u)
+  stats = iot_queue_stats (q);
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "dequeued")) == SINGLE_SIZE)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "dequeue_blocked")) == 1u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "dequeue_wait_ns")) >= 1000000u)
+  iot_data_free (stats);
+  iot_data_free (list);
+  iot_queue_free (q);
+}
+
+static void test_batch (void)
+{
+  run_batch (iot_queue_alloc (SINGLE_SIZE));
+  run_batch (iot_queue_alloc_ring (SINGLE_SIZE));
+}
+
+static void run_timed (iot_queue_t *q)
+{
+  iot_data_t *e;
+  uint64_t start = iot_time_nsecs ();
+  CU_ASSERT (iot_queue_dequeue_timed (q, 10000000u) == NULL)
+  CU_ASSERT ((iot_time_nsecs () - start) >= 10000000u)
+  CU_ASSERT (iot_queue_dequeue_timed (q, 0u) == NULL)
+  iot_queue_enqueue (q, iot_data_alloc_ui32 (1u));
+  e = iot_queue_dequeue_timed (q, 10000000u);
+  CU_ASSERT (iot_data_ui32 (e) == 1u)
+  iot_data_free (e);
+  iot_queue_stop (q);
+  CU_ASSERT (iot_queue_dequeue_timed (q, UINT64_MAX) == NULL)
+  iot_queue_free (q);
+}
+
+static void test_timed (void)
+{
+  run_timed (iot_queue_alloc (SINGLE_SIZE));
+  run_timed (iot_queue_alloc_ring (SINGLE_SIZE));
+}
+
+static void flow_cb (void *arg, bool congested)
+{
+  *((int*) arg) += congested ? 1 : -1;
+}
+
+static void run_flow (iot_queue_t *q)
+{
+  int changes = 0;
+  iot_flow_t *flow = iot_flow_alloc (3u, 1u, flow_cb, &changes);
+  iot_queue_set_flow (q, flow);
+  iot_queue_enqueue (q, iot_data_alloc_ui32 (1u));
+  iot_queue_enqueue (q, iot_data_alloc_ui32 (2u));
+  CU_ASSERT (! iot_flow_congested (flow))
+  iot_queue_enqueue (q, iot_data_alloc_ui32 (3u));
+  CU_ASSERT (iot_flow_congested (flow))
+  CU_ASSERT (changes == 1)
+  iot_data_free (iot_queue_dequeue (q));
+  CU_ASSERT (iot_flow_congested (flow))
+  iot_data_free (iot_queue_dequeue (q));
+  CU_ASSERT (! iot_flow_congested (flow))
+  CU_ASSERT (changes == 0)
+  iot_queue_enqueue (q, iot_data_alloc_ui32 (4u));
+  iot_queue_enqueue (q, iot_data_alloc_ui32 (5u));
+  CU_ASSERT (iot_flow_congested (flow))
+  iot_data_t *list = iot_data_alloc_list ();
+  CU_ASSERT (iot_queue_dequeue_batch (q, 3u, 0u, list) == 3u)
+  CU_ASSERT (! iot_flow_congested (flow))
+  iot_data_t *stats = iot_flow_stats (flow);
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "level")) == 0u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "congestions")) == 2u)
+  iot_data_free (stats);
+  iot_data_free (list);
+  iot_queue_free (q);
+  iot_flow_free (flow);
+}
+
+static void test_flow (void)
+{
+  run_flow (iot_queue_alloc (SINGLE_SIZE));
+  run_flow (iot_queue_alloc_ring (SINGLE_SIZE));
+}
+
+static void test_priority (void)
+{
+  iot_data_t *e;
+  iot_queue_t *q = iot_queue_alloc (2u);
+  iot_data_t *list = iot_data_alloc_list ();
+  iot_queue_enqueue (q, iot_data_alloc_ui32 (1u));
+  iot_queue_enqueue (q, iot_data_alloc_ui32 (2u));
+  CU_ASSERT (iot_queue_enqueue_priority (q, iot_data_alloc_ui32 (3u)))
+  CU_ASSERT (iot_queue_enqueue_priority (q, iot_data_alloc_ui32 (4u)))
+  CU_ASSERT (iot_queue_size (q) == 4u)
+  e = iot_data_alloc_ui32 (5u);
+  CU_ASSERT (!iot_queue_try_enqueue (q, e))
+  iot_data_free (e);
+  e = iot_queue_dequeue (q);
+  CU_ASSERT (iot_data_ui32 (e) == 3u)
+  iot_data_free (e);
+  CU_ASSERT (iot_queue_dequeue_batch (q, 2u, 0u, list) == 2u)
+  e = iot_data_list_head_pop (list);
+  CU_ASSERT (iot_data_ui32 (e) == 4u)
+  iot_data_free (e);
+  e = iot_data_list_head_pop (list);
+  CU_ASSERT (iot_data_ui32 (e) == 1u)
+  iot_data_free (e);
+  e = iot_queue_try_dequeue (q);
+  CU_ASSERT (iot_data_ui32 (e) == 2u)
+  iot_data_free (e);
+  iot_data_free (list);
+  iot_queue_free (q);
+}
+
+static void run_single (iot_queue_t *q)
 {
   bool ok;
   uint32_t size;
   iot_data_t *e;
-  iot_queue_t *q = iot_queue_alloc (SINGLE_SIZE);
   iot_queue_enqueue (q, iot_data_alloc_ui32 (10));
   for (unsigned i = 1; i < SINGLE_SIZE; i++)
   {
@@ -70,6 +250,16 @@ static void test_run_single (void)
   iot_queue_free (q);
 }
 
+static void test_run_single (void)
+{
+  run_single (iot_queue_alloc (SINGLE_SIZE));
+}
+
+static void test_ring_single (void)
+{
+  run_single (iot_queue_alloc_ring (SINGLE_SIZE));
+}
+
 static void *multi_processor (void *arg)
 {
   iot_queue_t *q = (iot_queue_t *)arg;
@@ -92,22 +282,48 @@ static void *multi_processor (void *arg)
   return NULL;
 }
 
-static void test_run_multi (void)
+static void *multi_producer (void *arg)
+{
+  iot_queue_t *q = (iot_queue_t *)arg;
+  uint32_t i;
+  while ((i = atomic_fetch_add (&multi_next, 1u)) < MULTI_SIZE)
+  {
+    iot_queue_enqueue (q, iot_data_alloc_ui32 (i));
+  }
+  return NULL;
+}
+
+static void run_multi (iot_queue_t *q, unsigned producers)
 {
   unsigned missed;
   pthread_t workers[MULTI_THREADS];
-  iot_queue_t *q = iot_queue_alloc (0);
+  pthread_t senders[MULTI_THREADS];
   for (unsigned i = 0; i < MULTI_SIZE; i++)
   {
     jobs[i] = false;
   }
+  atomic_store (&multi_next, 0u);
   for (unsigned i = 0; i < MULTI_THREADS; i++)
   {
     pthread_create (&workers[i], NULL, multi_processor, q);
   }
-  for (unsigned i = 0; i < MULTI_SIZE; i++)
+  if (producers)
   {
-    iot_queue_enqueue (q, iot_data_alloc_ui32 (i));
+    for (unsigned i = 0; i < producers; i++)
+    {
+      pthread_create (&senders[i], NULL, multi_producer, q);
+    }
+    for (unsigned i = 0; i < producers; i++)
+    {
+      pthread_join (senders[i], NULL);
+    }
+  }
+  else
+  {
+    for (unsigned i = 0; i < MULTI_SIZE; i++)
+    {
+      iot_queue_enqueue (q, iot_data_alloc_ui32 (i));
+    }
   }
   printf ("residual queue size %u/%u ...", iot_queue_size (q), MULTI_SIZE);
   while (iot_queue_size (q))
@@ -135,10 +351,28 @@ static void test_run_multi (void)
   iot_queue_free (q);
 }
 
+static void test_run_multi (void)
+{
+  run_multi (iot_queue_alloc (0), 0);
+}
+
+static void test_ring_multi (void)
+{
+  run_multi (iot_queue_alloc_ring (RING_SIZE), MULTI_THREADS);
+}
+
 void cunit_queue_test_init (void)
 {
   CU_pSuite suite = CU_add_suite ("queue", suite_init, suite_clean);
   CU_add_test (suite, "queue_alloc", test_alloc);
   CU_add_test (suite, "queue_run_single", test_run_single);
   CU_add_test (suite, "queue_run_multi", test_run_multi);
+  CU_add_test (suite, "queue_ring_alloc", test_ring_alloc);
+  CU_add_test (suite, "queue_ring_single", test_ring_single);
+  CU_add_test (suite, "queue_ring_multi", test_ring_multi);
+  CU_add_test (suite, "queue_stats", test_stats);
+  CU_add_test (suite, "queue_batch", test_batch);
+  CU_add_test (suite, "queue_priority", test_priority);
+  CU_add_test (suite, "queue_timed", test_timed);
+  CU_add_test (suite, "queue_flow", test_flow);
 }
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2024
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "reactor.h"
+#include "CUnit.h"
+#include "iot/reactor.h"
+#include "iot/container.h"
+#include "iot/scheduler.h"
+#include "iot/thread.h"
+#include "iot/time.h"
+
+#define PIPE_WRITES 100u
+
+typedef struct reactor_pipe_t
+{
+  int fds[2];
+  atomic_uint reads;
+  atomic_uint active;
+  atomic_uint overlaps;
+} reactor_pipe_t;
+
+static const char * reactor_config =
+"{"
+  "\"pool\":\"IOT::ThreadPool\","
+  "\"reactor\":\"IOT::Reactor\""
+"}";
+
+static const char * reactor_pool_config =
+"{"
+  "\"Threads\":2"
+"}";
+
+static const char * reactor_reactor_config =
+"{"
+  "\"ThreadPool\":\"pool\""
+"}";
+
+static int suite_init (void)
+{
+  return 0;
+}
+
+static int suite_clean (void)
+{
+  return 0;
+}
+
+static char * reactor_loader (const char * name, const char * uri)
+{
+  (void) uri;
+  if (strcmp (name, "reactor") == 0) return strdup (reactor_reactor_config);
+  if (strcmp (name, "pool") == 0) return strdup (reactor_pool_config);
+  return strdup (reactor_config);
+}
+
+static void reactor_pipe_read (int fd, uint32_t events, void * arg)
+{
+  reactor_pipe_t * rp = (reactor_pipe_t*) arg;
+  char c;
+  if (atomic_fetch_add (&rp->active, 1u) != 0u) atomic_fetch_add (&rp->overlaps, 1u);
+  CU_ASSERT (events & IOT_REACTOR_READ)
+  if (read (fd, &c, 1u) == 1) atomic_fetch_add (&rp->reads, 1u);
+  atomic_fetch_sub (&rp->active, 1u);
+}
+
+static void reactor_count (int fd, uint32_t events, void * arg)
+{
+  (void) fd;
+  CU_ASSERT (events == IOT_REACTOR_READ)
+  atomic_fetch_add ((atomic_uint*) arg, 1u);
+}
+
+static bool reactor_wait_count (atomic_uint * count, uint32_t expected)
+{
+  for (uint32_t i = 0; i < 200u && atomic_load (count) < expected; i++) iot_wait_msecs (10u);
+  return atomic_load (count) == expected;
+}
+
+static void reactor_pipe_test (iot_reactor_t * reactor)
+{
+  reactor_pipe_t rp = { .reads = 0u, .active = 0u, .overlaps = 0u };
+  CU_ASSERT (pipe (rp.fds) == 0)
+  CU_ASSERT (iot_reactor_add (reactor, rp.fds[0], IOT_REACTOR_READ, reactor_pipe_read, &rp))
+  CU_ASSERT (! iot_reactor_add (reactor, rp.fds[0], IOT_REACTOR_READ, reactor_pipe_read, &rp))
+  for (uint32_t i = 0; i < PIPE_WRITES; i++)
+  {
+    CU_ASSERT (write (rp.fds[1], "x", 1u) == 1)
+  }
+  CU_ASSERT (reactor_wait_count (&rp.reads, PIPE_WRITES))
+  CU_ASSERT (atomic_load (&rp.overlaps) == 0u)
+  CU_ASSERT (iot_reactor_remove (reactor, rp.fds[0]))
+  CU_ASSERT (! iot_reactor_remove (reactor, rp.fds[0]))
+  CU_ASSERT (write (rp.fds[1], "x", 1u) == 1)
+  iot_wait_msecs (50u);
+  CU_ASSERT (atomic_load (&rp.reads) == PIPE_WRITES)
+  close (rp.fds[0]);
+  close (rp.fds[1]);
+}
+
+static void cunit_reactor_pipe (void)
+{
+  iot_threadpool_t * pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_reactor_t * reactor = iot_reactor_alloc (pool, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  CU_ASSERT (reactor != NULL)
+  iot_threadpool_start (pool);
+  iot_reactor_start (reactor);
+  reactor_pipe_test (reactor);
+  iot_data_t * stats = iot_reactor_stats (reactor);
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "sources")) == 0u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "dispatched")) >= PIPE_WRITES)
+  iot_data_free (stats);
+  iot_reactor_stop (reactor);
+  iot_reactor_free (reactor);
+  iot_threadpool_free (pool);
+}
+
+static void cunit_reactor_inline (void)
+{
+  iot_reactor_t * reactor = iot_reactor_alloc (NULL, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_reactor_start (reactor);
+  reactor_pipe_test (reactor);
+  iot_reactor_free (reactor);
+}
+
+static void cunit_reactor_stop_start (void)
+{
+  reactor_pipe_t rp = { .reads = 0u, .active = 0u, .overlaps = 0u };
+  CU_ASSERT (pipe (rp.fds) == 0)
+  iot_reactor_t * reactor = iot_reactor_alloc (NULL, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  CU_ASSERT (iot_reactor_add (reactor, rp.fds[0], IOT_REACTOR_READ, reactor_pipe_read, &rp))
+  CU_ASSERT (write (rp.fds[1], "x", 1u) == 1)
+  iot_wait_msecs (50u);
+  CU_ASSERT (atomic_load (&rp.reads) == 0u) // Not started
+  iot_reactor_start (reactor);
+  CU_ASSERT (reactor_wait_count (&rp.reads, 1u))
+  CU_ASSERT (iot_reactor_modify (reactor, rp.fds[0], 0u))
+  CU_ASSERT (write (rp.fds[1], "x", 1u) == 1)
+  iot_wait_msecs (50u);
+  CU_ASSERT (atomic_load (&rp.reads) == 1u) // No longer watched for reading
+  CU_ASSERT (iot_reactor_modify (reactor, rp.fds[0], IOT_REACTOR_READ))
+  CU_ASSERT (reactor_wait_count (&rp.reads, 2u))
+  iot_reactor_stop (reactor);
+  CU_ASSERT (write (rp.fds[1], "x", 1u) == 1)
+  iot_wait_msecs (50u);
+  CU_ASSERT (atomic_load (&rp.reads) == 2u) // Stopped
+  iot_reactor_start (reactor);
+  CU_ASSERT (reactor_wait_count (&rp.reads, 3u))
+  iot_reactor_free (reactor); // Frees watched descriptors
+  close (rp.fds[0]);
+  close (rp.fds[1]);
+}
+
+static void cunit_reactor_timer (void)
+{
+  atomic_uint periodic = 0u;
+  atomic_uint once = 0u;
+  iot_threadpool_t * pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_reactor_t * reactor = iot_reactor_alloc (pool, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_threadpool_start (pool);
+  iot_reactor_start (reactor);
+  int timer = iot_reactor_add_timer (reactor, IOT_MS_TO_NS (10u), IOT_MS_TO_NS (10u), reactor_count, &periodic);
+  CU_ASSERT (timer != -1)
+  CU_ASSERT (iot_reactor_add_timer (reactor, IOT_MS_TO_NS (20u), 0u, reactor_count, &once) != -1)
+  reactor_wait_count (&periodic, 5u);
+  CU_ASSERT (atomic_load (&periodic) >= 5u) // Periodic timer may fire again before checked
+  CU_ASSERT (atomic_load (&once) == 1u)
+  iot_data_t * stats = iot_reactor_stats (reactor);
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "sources")) == 1u) // One shot timer removed
+  iot_data_free (stats);
+  CU_ASSERT (iot_reactor_remove (reactor, timer))
+  iot_wait_msecs (50u);
+  uint32_t count = atomic_load (&periodic);
+  iot_wait_msecs (50u);
+  CU_ASSERT (atomic_load (&periodic) == count)
+  iot_reactor_free (reactor);
+  iot_threadpool_free (pool);
+}
+
+static void cunit_reactor_component (void)
+{
+  static iot_container_config_t config = { .load = reactor_loader, .uri = NULL, .save = NULL };
+  iot_container_t * cont = iot_container_alloc ("reactors");
+  iot_component_factory_add (iot_threadpool_factory ());
+  iot_component_factory_add (iot_reactor_factory ());
+  iot_container_config (&config);
+  CU_ASSERT (iot_container_init (cont))
+  iot_reactor_t * reactor = (iot_reactor_t*) iot_container_find_component (cont, "reactor");
+  CU_ASSERT (reactor != NULL)
+  if (reactor)
+  {
+    iot_container_start (cont);
+    CU_ASSERT (((iot_component_t*) reactor)->state == IOT_COMPONENT_RUNNING)
+    reactor_pipe_test (reactor);
+    iot_container_stop (cont);
+  }
+  iot_container_free (cont);
+}
+
+void cunit_reactor_test_init (void)
+{
+  CU_pSuite suite = CU_add_suite ("reactor", suite_init, suite_clean);
+  CU_add_test (suite, "reactor_pipe", cunit_reactor_pipe);
+  CU_add_test (suite, "reactor_inline", cunit_reactor_inline);
+  CU_add_test (suite, "reactor_stop_start", cunit_reactor_stop_start);
+  CU_add_test (suite, "reactor_timer", cunit_reactor_timer);
+  CU_add_test (suite, "reactor_component", cunit_reactor_component);
+}
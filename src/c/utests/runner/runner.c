@@ -18,6 +18,8 @@
 #include "../scheduler/scheduler.h"
 #include "../base64/base64.h"
 #include "../queue/queue.h"
+#include "../reactor/reactor.h"
+#include "../bus/bus.h"
 
 static void usage (void)
 {
@@ -73,6 +75,8 @@ int main (int argc, char* argv[])
   cunit_scheduler_test_init ();
   cunit_base64_test_init ();
   cunit_queue_test_init ();
+  cunit_reactor_test_init ();
+  cunit_bus_test_init ();
 
   CU_set_error_action (error_action);
 
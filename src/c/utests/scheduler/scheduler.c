@@ -489,6 +489,282 @@ static void cunit_scheduler_delete_with_user_data (void)
   iot_scheduler_free (scheduler);
 }
 
+static void * cunit_scheduler_record_time (void * arg)
+{
+  atomic_store ((_Atomic uint64_t*) arg, iot_time_msecs ());
+  return NULL;
+}
+
+static void cunit_scheduler_wheel_out_of_order (void)
+{
+  static _Atomic uint64_t fired[3];
+  static const uint64_t delays[3] = { IOT_HOUR_TO_NS (1), IOT_SEC_TO_NS (3), IOT_MS_TO_NS (100) }; // Far, middle then near
+  iot_scheduler_t * scheduler = iot_scheduler_alloc_wheel (IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, IOT_MS_TO_NS (1u), logger);
+  iot_scheduler_start (scheduler);
+  uint64_t start = iot_time_msecs ();
+  for (uint32_t i = 0; i < 3u; i++)
+  {
+    atomic_store (&fired[i], 0u);
+    iot_schedule_t * sched = iot_schedule_create (scheduler, cunit_scheduler_record_time, NULL, &fired[i], IOT_MS_TO_NS (10), delays[i], 1, NULL, IOT_THREAD_NO_PRIORITY);
+    CU_ASSERT (iot_schedule_add (scheduler, sched))
+    iot_wait_msecs (20u); // Scheduler thread looks up next schedule
+  }
+  iot_wait_msecs (500u);
+  CU_ASSERT (atomic_load (&fired[0]) == 0u)
+  CU_ASSERT (atomic_load (&fired[1]) == 0u)
+  CU_ASSERT (atomic_load (&fired[2]) != 0u && (atomic_load (&fired[2]) - start) < 400u)
+  iot_wait_msecs (3000u);
+  CU_ASSERT (atomic_load (&fired[0]) == 0u)
+  CU_ASSERT (atomic_load (&fired[1]) != 0u && (atomic_load (&fired[1]) - start) < 3400u)
+  iot_scheduler_stop (scheduler);
+  iot_scheduler_free (scheduler);
+}
+
+static void cunit_scheduler_wheel (void)
+{
+  iot_threadpool_t *pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_scheduler_t *scheduler = iot_scheduler_alloc_wheel (IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, IOT_MS_TO_NS (1u), logger);
+  CU_ASSERT (scheduler != NULL)
+
+  reset_counters ();
+  iot_schedule_t *sched1 = iot_schedule_create (scheduler, do_count, NULL, NULL, IOT_MS_TO_NS (100), 0, 5, pool, IOT_THREAD_NO_PRIORITY);
+  CU_ASSERT (iot_schedule_add (scheduler, sched1))
+  for (uint32_t i = 0; i < 500u; i++)
+  {
+    iot_schedule_t *sched = iot_schedule_create (scheduler, do_work4, NULL, NULL, IOT_MS_TO_NS (10), IOT_US_TO_NS (i * 1777u), 1, pool, IOT_THREAD_NO_PRIORITY);
+    CU_ASSERT (iot_schedule_add (scheduler, sched))
+  }
+  iot_schedule_t *sched2 = iot_schedule_create (scheduler, do_work5, NULL, NULL, IOT_MS_TO_NS (10), IOT_HOUR_TO_NS (1), 1, pool, IOT_THREAD_NO_PRIORITY);
+  CU_ASSERT (iot_schedule_add (scheduler, sched2))
+  iot_schedule_t *sched3 = iot_schedule_create (scheduler, do_work5, NULL, NULL, IOT_MS_TO_NS (10), IOT_SEC_TO_NS (1), 1, pool, IOT_THREAD_NO_PRIORITY);
+  CU_ASSERT (iot_schedule_add (scheduler, sched3))
+  CU_ASSERT (iot_schedule_remove (scheduler, sched3))
+  iot_schedule_t *sched4 = iot_schedule_create (scheduler, do_work1, NULL, NULL, IOT_MS_TO_NS (100), IOT_HOUR_TO_NS (1), 1, pool, IOT_THREAD_NO_PRIORITY);
+  CU_ASSERT (iot_schedule_add (scheduler, sched4))
+  iot_schedule_reset (scheduler, sched4, 0u);
+
+  iot_threadpool_start (pool);
+  iot_scheduler_start (scheduler);
+
+  iot_wait_secs (2);
+
+  iot_scheduler_stop (scheduler);
+  CU_ASSERT (atomic_load (&counter) == 5u)
+  CU_ASSERT (atomic_load (&sum_test) == 500u)
+  CU_ASSERT (atomic_load (&sum_work5) == 0u)
+  CU_ASSERT (atomic_load (&sum_work1) == 10u)
+
+  iot_data_t *stats = iot_scheduler_stats (scheduler);
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "active")) == 1u)
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "idle")) == 503u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "fired")) == 506u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "dropped")) == 0u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (iot_data_string_map_get (stats, "lateness"), "count")) == 506u)
+  iot_data_free (stats);
+
+  iot_threadpool_free (pool);
+  iot_scheduler_free (scheduler);
+}
+
+static void cunit_scheduler_batch (void)
+{
+  iot_threadpool_t *pool = iot_threadpool_alloc (4u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_scheduler_t *scheduler = iot_scheduler_alloc (IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_scheduler_set_batch (scheduler, true);
+  reset_counters ();
+  for (uint32_t i = 0; i < 2000u; i++)
+  {
+    iot_schedule_t *sched = iot_schedule_create (scheduler, do_count, NULL, NULL, IOT_MS_TO_NS (50), IOT_MS_TO_NS (50), 2, pool, IOT_THREAD_NO_PRIORITY);
+    CU_ASSERT (iot_schedule_add (scheduler, sched))
+  }
+  iot_threadpool_start (pool);
+  iot_scheduler_start (scheduler);
+  iot_wait_msecs (500u);
+  iot_scheduler_stop (scheduler);
+  iot_threadpool_wait (pool);
+  CU_ASSERT (atomic_load (&counter) == 4000u)
+
+  iot_data_t *stats = iot_scheduler_stats (scheduler);
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "fired")) == 4000u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "dropped")) == 0u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "batches")) < 4000u)
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "batch_max")) > 1u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (iot_data_string_map_get (stats, "lateness"), "count")) == 4000u)
+  iot_data_free (stats);
+  iot_scheduler_free (scheduler);
+  iot_threadpool_free (pool);
+}
+
+static void cunit_scheduler_batch_dropped (void)
+{
+  iot_threadpool_t *pool = iot_threadpool_alloc (1u, 10u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_scheduler_t *scheduler = iot_scheduler_alloc (IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_scheduler_set_batch (scheduler, true);
+  reset_counters ();
+  for (uint32_t i = 0; i < 100u; i++)
+  {
+    iot_schedule_t *sched = iot_schedule_create (scheduler, do_count, NULL, NULL, IOT_MS_TO_NS (10), 0, 1, pool, IOT_THREAD_NO_PRIORITY);
+    CU_ASSERT (iot_schedule_add (scheduler, sched))
+  }
+  iot_scheduler_start (scheduler);
+  iot_wait_msecs (100u);
+  iot_scheduler_stop (scheduler);
+  iot_threadpool_start (pool);
+  iot_threadpool_wait (pool);
+
+  iot_data_t *stats = iot_scheduler_stats (scheduler);
+  uint64_t dropped = iot_data_ui64 (iot_data_string_map_get (stats, "dropped"));
+  CU_ASSERT (dropped > 0u)
+  CU_ASSERT (atomic_load (&counter) + dropped == 100u)
+  iot_data_free (stats);
+  iot_scheduler_free (scheduler);
+  iot_threadpool_free (pool);
+}
+
+static void cunit_scheduler_executor (void)
+{
+  iot_scheduler_t *scheduler = iot_scheduler_alloc (IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  reset_counters ();
+  iot_schedule_t *sched1 = iot_schedule_create (scheduler, do_count, NULL, NULL, IOT_MS_TO_NS (10), 0, 10, NULL, IOT_THREAD_NO_PRIORITY);
+  iot_schedule_t *sched2 = iot_schedule_create (scheduler, do_work1, NULL, NULL, IOT_MS_TO_NS (10), 0, 5, NULL, IOT_THREAD_NO_PRIORITY);
+  iot_schedule_set_thread (sched2, true);
+  CU_ASSERT (iot_schedule_add (scheduler, sched1))
+  CU_ASSERT (iot_schedule_add (scheduler, sched2))
+  iot_scheduler_start (scheduler);
+  iot_wait_msecs (300u);
+  iot_scheduler_stop (scheduler);
+  CU_ASSERT (atomic_load (&counter) == 10u)
+  CU_ASSERT (atomic_load (&sum_work1) == 50u)
+
+  iot_data_t *stats = iot_scheduler_stats (scheduler);
+  const iot_data_t *executor = iot_data_string_map_get (stats, "executor");
+  CU_ASSERT (executor != NULL)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "dropped")) == 0u)
+  iot_data_free (stats);
+  iot_scheduler_free (scheduler);
+}
+
+static void cunit_scheduler_spread (void)
+{
+  iot_threadpool_t *pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_scheduler_t *scheduler = iot_scheduler_alloc (IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_schedule_t *schedules[100];
+  reset_counters ();
+  for (uint32_t i = 0; i < 100u; i++)
+  {
+    schedules[i] = iot_schedule_create (scheduler, do_count, NULL, NULL, IOT_MS_TO_NS (400), 0, 1, pool, IOT_THREAD_NO_PRIORITY);
+    CU_ASSERT (iot_schedule_add (scheduler, schedules[i]))
+  }
+  iot_schedule_spread (scheduler, schedules, 100u, IOT_MS_TO_NS (1));
+  iot_threadpool_start (pool);
+  iot_scheduler_start (scheduler);
+  iot_wait_msecs (200u);
+  uint32_t half = atomic_load (&counter);
+  CU_ASSERT (half > 20u && half < 80u)
+  iot_wait_msecs (400u);
+  CU_ASSERT (atomic_load (&counter) == 100u)
+  iot_scheduler_stop (scheduler);
+  iot_scheduler_free (scheduler);
+  iot_threadpool_free (pool);
+}
+
+static void cunit_scheduler_group (void)
+{
+  iot_threadpool_t *pool = iot_threadpool_alloc (4u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_scheduler_t *scheduler = iot_scheduler_alloc (IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_schedule_group_t *group = iot_schedule_group_create (scheduler, IOT_MS_TO_NS (100), 0, 2, pool, IOT_THREAD_NO_PRIORITY, 100u);
+  iot_schedule_group_t *single = iot_schedule_group_create (scheduler, IOT_MS_TO_NS (100), 0, 1, NULL, IOT_THREAD_NO_PRIORITY, 0u);
+  reset_counters ();
+  for (uintptr_t i = 0; i < 1000u; i++)
+  {
+    iot_schedule_group_add (group, do_count, (void*) i);
+  }
+  iot_schedule_group_add (single, do_work4, NULL);
+  CU_ASSERT (iot_schedule_group_size (group) == 1000u)
+  CU_ASSERT (iot_schedule_group_remove (group, do_count, (void*) 999u))
+  CU_ASSERT (! iot_schedule_group_remove (group, do_count, (void*) 1000u))
+  CU_ASSERT (iot_schedule_group_size (group) == 999u)
+  CU_ASSERT (iot_schedule_add (scheduler, iot_schedule_group_schedule (group)))
+  CU_ASSERT (iot_schedule_add (scheduler, iot_schedule_group_schedule (single)))
+  iot_threadpool_start (pool);
+  iot_scheduler_start (scheduler);
+  iot_wait_msecs (400u);
+  iot_threadpool_wait (pool);
+  CU_ASSERT (atomic_load (&counter) == 1998u)
+  CU_ASSERT (atomic_load (&sum_test) == 1u)
+  CU_ASSERT (iot_schedule_dropped (iot_schedule_group_schedule (group)) == 0u)
+  iot_scheduler_stop (scheduler);
+  iot_schedule_group_delete (scheduler, group);
+  iot_schedule_group_delete (scheduler, single);
+  iot_scheduler_free (scheduler);
+  iot_threadpool_free (pool);
+}
+
+static void cunit_scheduler_precise (void)
+{
+  iot_scheduler_t *scheduler = iot_scheduler_alloc (IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  reset_counters ();
+  iot_schedule_t *sched = iot_schedule_create (scheduler, do_count, NULL, NULL, IOT_US_TO_NS (250), IOT_MS_TO_NS (5), 100, NULL, IOT_THREAD_NO_PRIORITY);
+  iot_schedule_set_sync (sched, true);
+  iot_schedule_set_precise (sched, true);
+  CU_ASSERT (iot_schedule_add (scheduler, sched))
+  iot_scheduler_start (scheduler);
+  iot_wait_msecs (500u);
+  iot_scheduler_stop (scheduler);
+  CU_ASSERT (atomic_load (&counter) == 100u)
+
+  iot_data_t *stats = iot_scheduler_stats (scheduler);
+  const iot_data_t *lateness = iot_data_string_map_get (stats, "lateness");
+  uint64_t count = iot_data_ui64 (iot_data_string_map_get (lateness, "count"));
+  CU_ASSERT (count == 100u)
+  if (count) CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (lateness, "total_ns")) / count < IOT_US_TO_NS (200))
+  iot_data_free (stats);
+  iot_scheduler_free (scheduler);
+}
+
+static void cunit_scheduler_time_cache (void)
+{
+  iot_scheduler_t *scheduler = iot_scheduler_alloc (IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_schedule_t *cache = iot_scheduler_time_cache (scheduler, IOT_MS_TO_NS (1));
+  CU_ASSERT (cache != NULL)
+  iot_scheduler_start (scheduler);
+  iot_wait_msecs (50u);
+  uint64_t cached = iot_time_cached_nsecs ();
+  uint64_t now = iot_time_nsecs ();
+  CU_ASSERT (cached <= now)
+  CU_ASSERT (now - cached < IOT_MS_TO_NS (50))
+  iot_wait_msecs (20u);
+  CU_ASSERT (iot_time_cached_nsecs () > cached)
+  iot_scheduler_stop (scheduler);
+  iot_schedule_delete (scheduler, cache);
+  cached = iot_time_cached_nsecs ();
+  iot_wait_msecs (2u);
+  CU_ASSERT (iot_time_cached_nsecs () > cached)
+  iot_scheduler_free (scheduler);
+}
+
+static void cunit_scheduler_flow (void)
+{
+  iot_scheduler_t *scheduler = iot_scheduler_alloc (IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_flow_t *flow = iot_flow_alloc (10u, 5u, NULL, NULL);
+  reset_counters ();
+  iot_schedule_t *sched = iot_schedule_create (scheduler, do_count, NULL, NULL, IOT_MS_TO_NS (10), 0, 0, NULL, IOT_THREAD_NO_PRIORITY);
+  iot_schedule_set_sync (sched, true);
+  iot_schedule_set_flow (sched, flow, 10u);
+  iot_flow_update (flow, 10u);
+  CU_ASSERT (iot_schedule_add (scheduler, sched))
+  iot_scheduler_start (scheduler);
+  iot_wait_msecs (300u);
+  uint32_t slowed = atomic_load (&counter);
+  CU_ASSERT (slowed >= 1u && slowed <= 6u)
+  iot_flow_update (flow, 5u);
+  iot_wait_msecs (300u);
+  CU_ASSERT (atomic_load (&counter) >= slowed + 10u)
+  iot_scheduler_stop (scheduler);
+  iot_scheduler_free (scheduler);
+  iot_flow_free (flow);
+}
+
 extern void cunit_scheduler_test_init (void)
 {
   CU_pSuite suite = CU_add_suite ("scheduler", suite_init, suite_clean);
@@ -507,5 +783,15 @@ extern void cunit_scheduler_test_init (void)
   CU_add_test (suite, "scheduler_sync", cunit_scheduler_sync);
   CU_add_test (suite, "scheduler_serialized", cunit_scheduler_serialized);
   CU_add_test (suite, "scheduler_delete_with_user_data", cunit_scheduler_delete_with_user_data);
+  CU_add_test (suite, "scheduler_wheel", cunit_scheduler_wheel);
+  CU_add_test (suite, "scheduler_wheel_out_of_order", cunit_scheduler_wheel_out_of_order);
+  CU_add_test (suite, "scheduler_batch", cunit_scheduler_batch);
+  CU_add_test (suite, "scheduler_batch_dropped", cunit_scheduler_batch_dropped);
+  CU_add_test (suite, "scheduler_executor", cunit_scheduler_executor);
+  CU_add_test (suite, "scheduler_spread", cunit_scheduler_spread);
+  CU_add_test (suite, "scheduler_group", cunit_scheduler_group);
+  CU_add_test (suite, "scheduler_precise", cunit_scheduler_precise);
+  CU_add_test (suite, "scheduler_time_cache", cunit_scheduler_time_cache);
+  CU_add_test (suite, "scheduler_flow", cunit_scheduler_flow);
 }
 
@@ -8,6 +8,7 @@
 #include "threadpool.h"
 #include "iot/thread.h"
 #include "iot/time.h"
+#include "iot/scheduler.h"
 #include "CUnit.h"
 
 static int prio_min = -1;
@@ -159,6 +160,625 @@ static void cunit_threadpool_stop_start (void)
   iot_threadpool_free (pool);
 }
 
+static void * cunit_pool_atomic_counter (void * arg)
+{
+  atomic_fetch_add ((atomic_uint*) arg, 1u);
+  return NULL;
+}
+
+typedef struct cunit_pool_spawn_t
+{
+  iot_threadpool_t * pool;
+  atomic_uint count;
+} cunit_pool_spawn_t;
+
+static void * cunit_pool_spawner (void * arg)
+{
+  cunit_pool_spawn_t * spawn = (cunit_pool_spawn_t*) arg;
+  for (unsigned i = 0; i < 10; i++)
+  {
+    iot_threadpool_add_work (spawn->pool, cunit_pool_atomic_counter, &spawn->count, IOT_THREAD_NO_PRIORITY);
+  }
+  return NULL;
+}
+
+static void cunit_threadpool_stealing (void)
+{
+  atomic_uint count = 0;
+  cunit_pool_spawn_t spawn;
+  iot_threadpool_t * pool = iot_threadpool_alloc_stealing (4u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_threadpool_start (pool);
+  for (unsigned i = 0; i < 1000; i++)
+  {
+    iot_threadpool_add_work (pool, cunit_pool_atomic_counter, &count, IOT_THREAD_NO_PRIORITY);
+  }
+  iot_threadpool_wait (pool);
+  CU_ASSERT (atomic_load (&count) == 1000)
+  spawn.pool = pool;
+  atomic_store (&spawn.count, 0u);
+  for (unsigned i = 0; i < 100; i++)
+  {
+    iot_threadpool_add_work (pool, cunit_pool_spawner, &spawn, IOT_THREAD_NO_PRIORITY);
+  }
+  iot_threadpool_wait (pool);
+  CU_ASSERT (atomic_load (&spawn.count) == 1000)
+  atomic_store (&count, 0u);
+  for (unsigned i = 0; i < 1000; i++) // Stop while jobs queued, no further jobs may start until restarted
+  {
+    iot_threadpool_add_work (pool, cunit_pool_atomic_counter, &count, IOT_THREAD_NO_PRIORITY);
+  }
+  iot_threadpool_stop (pool);
+  iot_wait_msecs (100u);
+  unsigned stopped = atomic_load (&count);
+  iot_wait_msecs (200u);
+  CU_ASSERT (atomic_load (&count) == stopped)
+  iot_threadpool_start (pool);
+  iot_threadpool_wait (pool);
+  CU_ASSERT (atomic_load (&count) == 1000)
+  iot_threadpool_free (pool);
+}
+
+static void cunit_threadpool_prealloc (void)
+{
+  atomic_uint count = 0;
+  iot_threadpool_t * pools[3];
+  pools[0] = iot_threadpool_alloc (2u, 8u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  pools[1] = iot_threadpool_alloc_stealing (2u, 8u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  pools[2] = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  for (unsigned i = 0; i < 200; i++) // Queue more jobs than preallocated before starting
+  {
+    iot_threadpool_add_work (pools[2], cunit_pool_atomic_counter, &count, IOT_THREAD_NO_PRIORITY);
+  }
+  for (unsigned p = 0; p < 3; p++)
+  {
+    iot_threadpool_start (pools[p]);
+    for (unsigned i = 0; i < 1000; i++)
+    {
+      iot_threadpool_add_work (pools[p], cunit_pool_atomic_counter, &count, IOT_THREAD_NO_PRIORITY);
+    }
+    iot_threadpool_wait (pools[p]);
+  }
+  CU_ASSERT (atomic_load (&count) == 3200)
+  iot_threadpool_stop (pools[2]);
+  for (unsigned i = 0; i < 100; i++) // Freed with queued jobs
+  {
+    iot_threadpool_add_work (pools[2], cunit_pool_atomic_counter, &count, IOT_THREAD_NO_PRIORITY);
+  }
+  for (unsigned p = 0; p < 3; p++) iot_threadpool_free (pools[p]);
+}
+
+static void * cunit_future_square (void * arg)
+{
+  uintptr_t val = (uintptr_t) arg;
+  return (void*) (val * val);
+}
+
+static void * cunit_future_add (void * result, void * arg)
+{
+  return (void*) ((uintptr_t) result + (uintptr_t) arg);
+}
+
+static void cunit_threadpool_future (void)
+{
+  iot_future_t * futures[8];
+  iot_threadpool_t * pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_threadpool_t * other = iot_threadpool_alloc_stealing (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_threadpool_start (pool);
+  iot_threadpool_start (other);
+
+  iot_future_t * sq = iot_threadpool_submit (pool, cunit_future_square, (void*) 7u, IOT_THREAD_NO_PRIORITY);
+  iot_future_t * add1 = iot_future_then (sq, pool, cunit_future_add, (void*) 1u);
+  iot_future_t * add2 = iot_future_then (add1, other, cunit_future_add, (void*) 2u);
+  iot_future_t * add3 = iot_future_then (add2, NULL, cunit_future_add, (void*) 3u);
+  iot_future_free (add1);
+  iot_future_free (add2);
+  CU_ASSERT ((uintptr_t) iot_future_wait (add3) == 55u)
+  CU_ASSERT ((uintptr_t) iot_future_wait (sq) == 49u)
+  CU_ASSERT (iot_future_ready (sq))
+  iot_future_t * late = iot_future_then (sq, NULL, cunit_future_add, (void*) 4u); // Already complete
+  CU_ASSERT (iot_future_ready (late))
+  CU_ASSERT ((uintptr_t) iot_future_wait (late) == 53u)
+  iot_future_free (late);
+  iot_future_free (add3);
+  iot_future_free (sq);
+
+  for (uintptr_t i = 0; i < 8; i++)
+  {
+    futures[i] = iot_threadpool_submit ((i % 2) ? pool : other, cunit_future_square, (void*) i, IOT_THREAD_NO_PRIORITY);
+  }
+  iot_future_t * all = iot_future_when_all (futures, 8u);
+  iot_future_t * any = iot_future_when_any (futures, 8u);
+  CU_ASSERT (iot_future_wait (all) == NULL)
+  for (uintptr_t i = 0; i < 8; i++)
+  {
+    CU_ASSERT (iot_future_ready (futures[i]))
+    CU_ASSERT ((uintptr_t) iot_future_wait (futures[i]) == i * i)
+  }
+  iot_future_t * first = iot_future_wait (any);
+  bool found = false;
+  for (unsigned i = 0; i < 8; i++) found = found || (first == futures[i]);
+  CU_ASSERT (found)
+  iot_future_free (any);
+  iot_future_free (all);
+  for (unsigned i = 0; i < 8; i++) iot_future_free (futures[i]);
+
+  iot_future_t * manual = iot_future_alloc ();
+  iot_future_t * next = iot_future_then (manual, other, cunit_future_add, (void*) 5u);
+  futures[0] = manual;
+  futures[1] = next;
+  any = iot_future_when_any (futures, 2u);
+  all = iot_future_when_all (futures, 2u);
+  iot_future_free (next); // Freed before complete
+  CU_ASSERT (! iot_future_ready (manual))
+  CU_ASSERT (! iot_future_ready (all))
+  iot_future_set (manual, (void*) 10u);
+  first = iot_future_wait (any); // Continuation of manual may complete next on other pool before any is notified
+  CU_ASSERT (first == manual || first == next)
+  CU_ASSERT (iot_future_wait (all) == NULL)
+  iot_future_free (all);
+  iot_future_free (any);
+  iot_future_free (manual);
+
+  iot_threadpool_free (other);
+  iot_threadpool_free (pool);
+}
+
+typedef struct cunit_parallel_for_t
+{
+  _Atomic uint64_t sum;
+  _Atomic uint32_t calls;
+  iot_threadpool_t * pool;
+} cunit_parallel_for_t;
+
+static void cunit_parallel_for_sum (uint32_t begin, uint32_t end, void * ctx)
+{
+  cunit_parallel_for_t * pf = ctx;
+  uint64_t sum = 0u;
+  for (uint32_t i = begin; i < end; i++) sum += i;
+  atomic_fetch_add (&pf->sum, sum);
+  atomic_fetch_add (&pf->calls, 1u);
+}
+
+static void * cunit_parallel_for_nested (void * arg)
+{
+  iot_threadpool_parallel_for (((cunit_parallel_for_t*) arg)->pool, 0u, 1000u, 10u, cunit_parallel_for_sum, arg);
+  return NULL;
+}
+
+static void cunit_threadpool_parallel_for (void)
+{
+  cunit_parallel_for_t pf = { .sum = 0u, .calls = 0u };
+  iot_threadpool_t * pools[2];
+  pools[0] = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  pools[1] = iot_threadpool_alloc_stealing (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_threadpool_parallel_for (NULL, 10u, 20u, 0u, cunit_parallel_for_sum, &pf);
+  CU_ASSERT (atomic_load (&pf.sum) == 145u)
+  CU_ASSERT (atomic_load (&pf.calls) == 1u)
+  iot_threadpool_parallel_for (pools[0], 5u, 5u, 0u, cunit_parallel_for_sum, &pf); // Empty range
+  CU_ASSERT (atomic_load (&pf.calls) == 1u)
+  iot_threadpool_parallel_for (pools[0], 0u, 1000u, 100u, cunit_parallel_for_sum, &pf); // Pool not started, run by caller
+  CU_ASSERT (atomic_load (&pf.sum) == 145u + 499500u)
+  CU_ASSERT (atomic_load (&pf.calls) == 11u)
+  for (unsigned p = 0; p < 2; p++)
+  {
+    iot_threadpool_start (pools[p]);
+    atomic_store (&pf.sum, 0u);
+    atomic_store (&pf.calls, 0u);
+    iot_threadpool_parallel_for (pools[p], 0u, 100000u, 0u, cunit_parallel_for_sum, &pf);
+    CU_ASSERT (atomic_load (&pf.sum) == 4999950000u)
+    CU_ASSERT (atomic_load (&pf.calls) == 8u)
+    iot_threadpool_parallel_for (pools[p], 0u, 100001u, 1000u, cunit_parallel_for_sum, &pf);
+    CU_ASSERT (atomic_load (&pf.sum) == 2u * 4999950000u + 100000u)
+    CU_ASSERT (atomic_load (&pf.calls) == 8u + 101u)
+    pf.pool = pools[p];
+    atomic_store (&pf.sum, 0u);
+    for (unsigned i = 0; i < 4; i++) iot_threadpool_add_work (pools[p], cunit_parallel_for_nested, &pf, IOT_THREAD_NO_PRIORITY);
+    iot_threadpool_wait (pools[p]);
+    CU_ASSERT (atomic_load (&pf.sum) == 4u * 499500u)
+  }
+  for (unsigned p = 0; p < 2; p++) iot_threadpool_free (pools[p]);
+}
+
+static void cunit_threadpool_stealing_block (void)
+{
+  bool ret;
+  pthread_mutex_t mutex;
+  pthread_mutex_init (&mutex, NULL);
+  pthread_mutex_lock (&mutex);
+  iot_threadpool_t * pool = iot_threadpool_alloc_stealing (1u, 2u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_threadpool_start (pool);
+  iot_threadpool_add_work (pool, cunit_pool_blocker, &mutex, IOT_THREAD_NO_PRIORITY);
+  iot_threadpool_add_work (pool, cunit_pool_blocker, &mutex, IOT_THREAD_NO_PRIORITY);
+  iot_wait_msecs (100u);
+  ret = iot_threadpool_try_work (pool, cunit_pool_blocker, &mutex, IOT_THREAD_NO_PRIORITY);
+  CU_ASSERT (ret)
+  ret = iot_threadpool_try_work (pool, cunit_pool_blocker, &mutex, IOT_THREAD_NO_PRIORITY);
+  CU_ASSERT (! ret)
+  pthread_mutex_unlock (&mutex);
+  iot_threadpool_wait (pool);
+  counter = 0;
+  counter_max = 0;
+  for (unsigned i = 0; i < 4; i++)
+  {
+    iot_threadpool_add_work (pool, cunit_pool_sole_counter, NULL, IOT_THREAD_NO_PRIORITY);
+  }
+  iot_threadpool_wait (pool);
+  CU_ASSERT (counter_max == 1)
+  iot_threadpool_stop (pool);
+  counter = 0;
+  iot_threadpool_add_work (pool, cunit_pool_counter, NULL, IOT_THREAD_NO_PRIORITY);
+  iot_wait_msecs (200u);
+  CU_ASSERT (counter == 0)
+  iot_threadpool_start (pool);
+  iot_threadpool_wait (pool);
+  CU_ASSERT (counter == 1)
+  iot_threadpool_free (pool);
+  pthread_mutex_destroy (&mutex);
+}
+
+static void cunit_threadpool_stealing_priority (void)
+{
+  iot_threadpool_t * pool = iot_threadpool_alloc_stealing (1u, 0u, prio_min, IOT_THREAD_NO_AFFINITY, logger);
+  iot_threadpool_start (pool);
+  iot_threadpool_add_work (pool, cunit_pool_sleeper, NULL, IOT_THREAD_NO_PRIORITY);
+  iot_threadpool_add_work (pool, cunit_pool_prio_worker, &prio1, prio1);
+  iot_threadpool_add_work (pool, cunit_pool_prio_worker, &prio3, prio3);
+  iot_threadpool_add_work (pool, cunit_pool_prio_worker, &prio2, prio2);
+  iot_threadpool_wait (pool);
+  iot_threadpool_free (pool);
+}
+
+static void cunit_threadpool_batch_run (iot_threadpool_t * pool)
+{
+  atomic_uint count = 0;
+  uint32_t added;
+  pthread_mutex_t mutex;
+  iot_threadpool_job_t jobs[10];
+  pthread_mutex_init (&mutex, NULL);
+  for (unsigned i = 0; i < 10; i++)
+  {
+    jobs[i].function = cunit_pool_atomic_counter;
+    jobs[i].arg = &count;
+    jobs[i].priority = IOT_THREAD_NO_PRIORITY;
+  }
+  iot_threadpool_start (pool);
+  iot_threadpool_add_work_batch (pool, jobs, 10u);
+  iot_threadpool_add_work_batch (pool, jobs, 0u);
+  iot_threadpool_wait (pool);
+  CU_ASSERT (atomic_load (&count) == 10)
+  pthread_mutex_lock (&mutex);
+  iot_threadpool_add_work (pool, cunit_pool_blocker, &mutex, IOT_THREAD_NO_PRIORITY);
+  iot_wait_msecs (100u);
+  added = iot_threadpool_try_work_batch (pool, jobs, 10u);
+  CU_ASSERT (added == 4u)
+  added = iot_threadpool_try_work_batch (pool, jobs, 10u);
+  CU_ASSERT (added == 0u)
+  pthread_mutex_unlock (&mutex);
+  iot_threadpool_add_work_batch (pool, jobs, 10u);
+  iot_threadpool_wait (pool);
+  CU_ASSERT (atomic_load (&count) == 24)
+  iot_threadpool_free (pool);
+  pthread_mutex_destroy (&mutex);
+}
+
+static void cunit_threadpool_batch (void)
+{
+  cunit_threadpool_batch_run (iot_threadpool_alloc (1u, 4u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger));
+  cunit_threadpool_batch_run (iot_threadpool_alloc_stealing (1u, 4u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger));
+}
+
+static void cunit_threadpool_stats_run (iot_threadpool_t * pool)
+{
+  _Atomic uint32_t count = 0;
+  pthread_mutex_t mutex;
+  pthread_mutex_init (&mutex, NULL);
+  pthread_mutex_lock (&mutex);
+  iot_threadpool_start (pool);
+  iot_threadpool_add_work (pool, cunit_pool_blocker, &mutex, IOT_THREAD_NO_PRIORITY);
+  iot_wait_msecs (100u);
+  for (unsigned i = 0; i < 3; i++) iot_threadpool_add_work (pool, cunit_pool_atomic_counter, &count, IOT_THREAD_NO_PRIORITY);
+  iot_data_t * stats = iot_threadpool_stats (pool);
+  CU_ASSERT (iot_data_ui16 (iot_data_string_map_get (stats, "threads")) == 1u)
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "max_jobs")) == 4u)
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "queue_depth")) == 3u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "queue_high_water")) >= 3u)
+  iot_data_free (stats);
+  pthread_mutex_unlock (&mutex);
+  iot_threadpool_wait (pool);
+  stats = iot_threadpool_stats (pool);
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "queue_depth")) == 0u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "jobs_run")) == 4u)
+  const iot_data_t * wait = iot_data_string_map_get (stats, "wait");
+  const iot_data_t * run = iot_data_string_map_get (stats, "run");
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (wait, "count")) == 4u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (run, "count")) == 4u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (run, "max_ns")) >= 50000000u)
+  CU_ASSERT (iot_data_array_length (iot_data_string_map_get (run, "buckets")) == 24u)
+  iot_data_free (stats);
+  iot_threadpool_free (pool);
+  pthread_mutex_destroy (&mutex);
+}
+
+static void cunit_threadpool_stats (void)
+{
+  cunit_threadpool_stats_run (iot_threadpool_alloc (1u, 4u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger));
+  cunit_threadpool_stats_run (iot_threadpool_alloc_stealing (1u, 4u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger));
+}
+
+static void cunit_threadpool_wait_timed_run (iot_threadpool_t * pool)
+{
+  pthread_mutex_t mutex;
+  pthread_mutex_init (&mutex, NULL);
+  pthread_mutex_lock (&mutex);
+  iot_threadpool_start (pool);
+  CU_ASSERT (iot_threadpool_wait_timed (pool, 0u))
+  iot_threadpool_add_work (pool, cunit_pool_blocker, &mutex, IOT_THREAD_NO_PRIORITY);
+  uint64_t start = iot_time_nsecs ();
+  CU_ASSERT (! iot_threadpool_wait_timed (pool, 50000000u))
+  CU_ASSERT ((iot_time_nsecs () - start) >= 50000000u)
+  pthread_mutex_unlock (&mutex);
+  CU_ASSERT (iot_threadpool_wait_timed (pool, 5000000000u))
+  iot_threadpool_free (pool);
+  pthread_mutex_destroy (&mutex);
+}
+
+static void cunit_threadpool_wait_timed (void)
+{
+  cunit_threadpool_wait_timed_run (iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger));
+  cunit_threadpool_wait_timed_run (iot_threadpool_alloc_stealing (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger));
+}
+
+#ifdef IOT_HAS_CPU_AFFINITY
+static void * cunit_pool_cpu (void * arg)
+{
+  atomic_store ((_Atomic int*) arg, sched_getcpu ());
+  return NULL;
+}
+#endif
+
+static void cunit_threadpool_cpus_run (iot_threadpool_t * pool)
+{
+  _Atomic int cpu = -1;
+  iot_threadpool_start (pool);
+  for (unsigned i = 0; i < 4; i++)
+  {
+#ifdef IOT_HAS_CPU_AFFINITY
+    iot_threadpool_add_work (pool, cunit_pool_cpu, &cpu, IOT_THREAD_NO_PRIORITY);
+    iot_threadpool_wait (pool);
+    CU_ASSERT (atomic_load (&cpu) == 0)
+#else
+    (void) cpu;
+#endif
+  }
+  iot_threadpool_free (pool);
+}
+
+static void cunit_threadpool_cpus (void)
+{
+  cunit_threadpool_cpus_run (iot_threadpool_alloc_cpus (2u, 0u, IOT_THREAD_NO_PRIORITY, "0", false, false, logger));
+  cunit_threadpool_cpus_run (iot_threadpool_alloc_cpus (2u, 0u, IOT_THREAD_NO_PRIORITY, "0-0,0", true, true, logger));
+  iot_threadpool_t * pool = iot_threadpool_alloc_cpus (1u, 0u, IOT_THREAD_NO_PRIORITY, "1-0", true, true, logger);
+  _Atomic uint32_t count = 0;
+  iot_threadpool_start (pool);
+  for (unsigned i = 0; i < 64; i++) iot_threadpool_add_work (pool, cunit_pool_atomic_counter, &count, IOT_THREAD_NO_PRIORITY);
+  iot_threadpool_wait (pool);
+  CU_ASSERT (atomic_load (&count) == 64)
+  iot_threadpool_free (pool);
+}
+
+static uint16_t cunit_threadpool_threads (iot_threadpool_t * pool)
+{
+  iot_data_t * stats = iot_threadpool_stats (pool);
+  uint16_t threads = iot_data_ui16 (iot_data_string_map_get (stats, "threads"));
+  iot_data_free (stats);
+  return threads;
+}
+
+static void cunit_threadpool_elastic (void)
+{
+  _Atomic uint32_t count = 0;
+  pthread_mutex_t mutex;
+  pthread_mutex_init (&mutex, NULL);
+  iot_threadpool_t * pool = iot_threadpool_alloc_elastic (1u, 4u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, 100u, logger);
+  iot_threadpool_start (pool);
+  CU_ASSERT (cunit_threadpool_threads (pool) == 1u)
+  for (uint32_t round = 0; round < 2u; round++)
+  {
+    pthread_mutex_lock (&mutex);
+    for (unsigned i = 0; i < 6; i++) iot_threadpool_add_work (pool, cunit_pool_blocker, &mutex, IOT_THREAD_NO_PRIORITY);
+    CU_ASSERT (cunit_threadpool_threads (pool) == 4u)
+    pthread_mutex_unlock (&mutex);
+    iot_threadpool_wait (pool);
+    iot_wait_msecs (500u);
+    CU_ASSERT (cunit_threadpool_threads (pool) == 1u)
+  }
+  for (unsigned i = 0; i < 100; i++) iot_threadpool_add_work (pool, cunit_pool_atomic_counter, &count, IOT_THREAD_NO_PRIORITY);
+  iot_threadpool_wait (pool);
+  CU_ASSERT (atomic_load (&count) == 100u)
+  iot_threadpool_free (pool);
+  pthread_mutex_destroy (&mutex);
+}
+
+#define CUNIT_KEYS 4u
+#define CUNIT_KEYED_JOBS 200u
+
+typedef struct cunit_pool_keyed_t
+{
+  _Atomic uint32_t running;
+  _Atomic uint32_t next;
+  _Atomic uint32_t errors;
+} cunit_pool_keyed_t;
+
+typedef struct cunit_pool_keyed_job_t
+{
+  cunit_pool_keyed_t * key;
+  uint32_t seq;
+} cunit_pool_keyed_job_t;
+
+static void * cunit_pool_keyed (void * arg)
+{
+  cunit_pool_keyed_job_t * job = (cunit_pool_keyed_job_t*) arg;
+  if (atomic_fetch_add (&job->key->running, 1u) != 0u) atomic_fetch_add (&job->key->errors, 1u);
+  if (atomic_load (&job->key->next) != job->seq) atomic_fetch_add (&job->key->errors, 1u);
+  atomic_store (&job->key->next, job->seq + 1u);
+  atomic_fetch_sub (&job->key->running, 1u);
+  return NULL;
+}
+
+static void cunit_threadpool_keyed_run (iot_threadpool_t * pool)
+{
+  static cunit_pool_keyed_t keys[CUNIT_KEYS];
+  static cunit_pool_keyed_job_t jobs[CUNIT_KEYS][CUNIT_KEYED_JOBS];
+  memset (keys, 0, sizeof (keys));
+  iot_threadpool_start (pool);
+  for (uint32_t i = 0; i < CUNIT_KEYED_JOBS; i++)
+  {
+    for (uint32_t k = 0; k < CUNIT_KEYS; k++)
+    {
+      jobs[k][i].key = &keys[k];
+      jobs[k][i].seq = i;
+      iot_threadpool_add_keyed_work (pool, k * 1000u, cunit_pool_keyed, &jobs[k][i], IOT_THREAD_NO_PRIORITY);
+    }
+  }
+  iot_threadpool_wait (pool);
+  for (uint32_t k = 0; k < CUNIT_KEYS; k++)
+  {
+    CU_ASSERT (atomic_load (&keys[k].next) == CUNIT_KEYED_JOBS)
+    CU_ASSERT (atomic_load (&keys[k].errors) == 0u)
+  }
+  iot_threadpool_stop (pool);
+  iot_threadpool_add_keyed_work (pool, 1u, cunit_pool_keyed, &jobs[0][0], IOT_THREAD_NO_PRIORITY); // Freed with pool
+  iot_threadpool_free (pool);
+}
+
+static void cunit_threadpool_keyed (void)
+{
+  cunit_threadpool_keyed_run (iot_threadpool_alloc (4u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger));
+  cunit_threadpool_keyed_run (iot_threadpool_alloc_stealing (4u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger));
+  cunit_threadpool_keyed_run (iot_threadpool_alloc (2u, 4u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger));
+}
+
+#if defined (__ZEPHYR__) && (IOT_ZEPHYR_JOBS > 0)
+#define CUNIT_POOL_JOBS (IOT_ZEPHYR_JOBS + 8u) // Exhausts static job pool, so heap also used
+#else
+#define CUNIT_POOL_JOBS 64u
+#endif
+
+static void cunit_threadpool_job_pool (void)
+{
+  atomic_uint count = 0;
+  iot_threadpool_t * pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  for (uint32_t round = 1u; round <= 2u; round++) // Freed jobs reused
+  {
+    for (uint32_t i = 0; i < CUNIT_POOL_JOBS; i++) // Queued until started
+    {
+      iot_threadpool_add_work (pool, cunit_pool_atomic_counter, &count, IOT_THREAD_NO_PRIORITY);
+      iot_threadpool_add_keyed_work (pool, i % 4u, cunit_pool_atomic_counter, &count, IOT_THREAD_NO_PRIORITY);
+    }
+    iot_threadpool_start (pool);
+    iot_threadpool_wait (pool);
+    iot_threadpool_stop (pool);
+    CU_ASSERT (atomic_load (&count) == round * 2u * CUNIT_POOL_JOBS)
+  }
+  iot_threadpool_free (pool);
+}
+
+#define CUNIT_MUTEX_INCS 10000u
+
+typedef struct cunit_pool_mutex_t
+{
+  pthread_mutex_t mutex;
+  uint32_t count;
+} cunit_pool_mutex_t;
+
+static void * cunit_pool_mutex_inc (void * arg)
+{
+  cunit_pool_mutex_t * counter = (cunit_pool_mutex_t*) arg;
+  for (uint32_t i = 0; i < CUNIT_MUTEX_INCS; i++)
+  {
+    pthread_mutex_lock (&counter->mutex);
+    counter->count++;
+    pthread_mutex_unlock (&counter->mutex);
+  }
+  return NULL;
+}
+
+static void cunit_threadpool_mutex_types (void)
+{
+  static const iot_mutex_type_t types[] = { IOT_MUTEX_DEFAULT, IOT_MUTEX_ADAPTIVE, IOT_MUTEX_DEFAULT };
+  iot_threadpool_t * pool = iot_threadpool_alloc (4u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_threadpool_start (pool);
+  for (uint32_t t = 0; t < sizeof (types) / sizeof (types[0]); t++)
+  {
+    cunit_pool_mutex_t counter = { .count = 0u };
+    iot_mutex_set_priority_inherit (t != 2u);
+    iot_mutex_init_type (&counter.mutex, types[t]);
+    for (uint32_t i = 0; i < 4u; i++) iot_threadpool_add_work (pool, cunit_pool_mutex_inc, &counter, IOT_THREAD_NO_PRIORITY);
+    iot_threadpool_wait (pool);
+    CU_ASSERT (counter.count == 4u * CUNIT_MUTEX_INCS)
+    pthread_mutex_destroy (&counter.mutex);
+  }
+  iot_mutex_set_priority_inherit (true);
+  iot_threadpool_free (pool);
+}
+
+static uint32_t cunit_deadline_order[4];
+
+static void * cunit_pool_deadline_worker (void * arg)
+{
+  cunit_deadline_order[counter++] = (uint32_t) (uintptr_t) arg;
+  return NULL;
+}
+
+static void cunit_threadpool_deadline (void)
+{
+  pthread_mutex_t mutex;
+  pthread_mutex_init (&mutex, NULL);
+  pthread_mutex_lock (&mutex);
+  iot_threadpool_t * pool = iot_threadpool_alloc (1u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  iot_threadpool_start (pool);
+  iot_threadpool_add_work (pool, cunit_pool_blocker, &mutex, IOT_THREAD_NO_PRIORITY);
+  iot_wait_msecs (100u);
+  uint64_t now = iot_time_nsecs ();
+  counter = 0;
+  iot_threadpool_add_work (pool, cunit_pool_deadline_worker, (void*) 4u, IOT_THREAD_NO_PRIORITY);
+  iot_threadpool_add_work_deadline (pool, cunit_pool_deadline_worker, (void*) 3u, IOT_THREAD_NO_PRIORITY, now + IOT_SEC_TO_NS (3));
+  iot_threadpool_add_work_deadline (pool, cunit_pool_deadline_worker, (void*) 1u, IOT_THREAD_NO_PRIORITY, now + IOT_SEC_TO_NS (1));
+  iot_threadpool_add_work_deadline (pool, cunit_pool_deadline_worker, (void*) 2u, IOT_THREAD_NO_PRIORITY, now + IOT_SEC_TO_NS (2));
+  pthread_mutex_unlock (&mutex);
+  iot_threadpool_wait (pool);
+  CU_ASSERT (counter == 4u)
+  for (uint32_t i = 0; i < 4u; i++) CU_ASSERT (cunit_deadline_order[i] == i + 1u)
+
+  // Expired jobs are run and counted, or dropped if so set
+  counter = 0;
+  pthread_mutex_lock (&mutex);
+  iot_threadpool_add_work (pool, cunit_pool_blocker, &mutex, IOT_THREAD_NO_PRIORITY);
+  iot_wait_msecs (100u);
+  iot_threadpool_add_work_deadline (pool, cunit_pool_deadline_worker, (void*) 1u, IOT_THREAD_NO_PRIORITY, iot_time_nsecs () + IOT_MS_TO_NS (1));
+  iot_wait_msecs (100u);
+  pthread_mutex_unlock (&mutex);
+  iot_threadpool_wait (pool);
+  CU_ASSERT (counter == 1u)
+  iot_threadpool_set_drop_expired (pool, true);
+  pthread_mutex_lock (&mutex);
+  iot_threadpool_add_work (pool, cunit_pool_blocker, &mutex, IOT_THREAD_NO_PRIORITY);
+  iot_wait_msecs (100u);
+  iot_threadpool_add_work_deadline (pool, cunit_pool_deadline_worker, (void*) 2u, IOT_THREAD_NO_PRIORITY, iot_time_nsecs () + IOT_MS_TO_NS (1));
+  iot_threadpool_add_work_deadline (pool, cunit_pool_deadline_worker, (void*) 3u, IOT_THREAD_NO_PRIORITY, iot_time_nsecs () + IOT_SEC_TO_NS (60));
+  iot_wait_msecs (100u);
+  pthread_mutex_unlock (&mutex);
+  iot_threadpool_wait (pool);
+  CU_ASSERT (counter == 2u)
+  CU_ASSERT (cunit_deadline_order[1] == 3u)
+  iot_data_t * stats = iot_threadpool_stats (pool);
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "deadline_missed")) == 1u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "deadline_dropped")) == 1u)
+  iot_data_free (stats);
+  iot_threadpool_free (pool);
+  pthread_mutex_destroy (&mutex);
+}
+
 static void cunit_threadpool_refcount (void)
 {
   iot_threadpool_t * pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
@@ -169,6 +789,80 @@ static void cunit_threadpool_refcount (void)
   iot_threadpool_free (NULL);
 }
 
+static void cunit_threadpool_flow_run (iot_threadpool_t * pool)
+{
+  iot_flow_t * flow = iot_flow_alloc (3u, 1u, NULL, NULL);
+  iot_threadpool_set_flow (pool, flow);
+  iot_threadpool_add_work (pool, cunit_pool_counter, NULL, IOT_THREAD_NO_PRIORITY);
+  iot_threadpool_add_work (pool, cunit_pool_counter, NULL, IOT_THREAD_NO_PRIORITY);
+  CU_ASSERT (! iot_flow_congested (flow))
+  iot_threadpool_add_work (pool, cunit_pool_counter, NULL, IOT_THREAD_NO_PRIORITY);
+  iot_threadpool_add_work (pool, cunit_pool_counter, NULL, IOT_THREAD_NO_PRIORITY);
+  CU_ASSERT (iot_flow_congested (flow))
+  iot_threadpool_start (pool);
+  iot_threadpool_wait (pool);
+  CU_ASSERT (! iot_flow_congested (flow))
+  iot_threadpool_free (pool);
+  iot_data_t * stats = iot_flow_stats (flow);
+  CU_ASSERT (iot_data_ui32 (iot_data_string_map_get (stats, "level")) == 0u)
+  CU_ASSERT (iot_data_ui64 (iot_data_string_map_get (stats, "congestions")) == 1u)
+  iot_data_free (stats);
+  iot_flow_free (flow);
+}
+
+static void cunit_threadpool_flow (void)
+{
+  counter = 0;
+  cunit_threadpool_flow_run (iot_threadpool_alloc (2u, 8u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger));
+  cunit_threadpool_flow_run (iot_threadpool_alloc_stealing (2u, 8u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger));
+  CU_ASSERT (counter == 8u)
+}
+
+static void cunit_threadpool_shutdown (void)
+{
+  iot_threadpool_t * pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  atomic_uint count = 0;
+  iot_threadpool_start (pool);
+  for (uint32_t i = 0; i < 64u; i++) iot_threadpool_add_work (pool, cunit_pool_atomic_counter, &count, IOT_THREAD_NO_PRIORITY);
+  iot_threadpool_shutdown (pool, false);
+  CU_ASSERT (atomic_load (&count) == 64u)
+  iot_threadpool_free (pool);
+
+  pool = iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger);
+  counter = 0;
+  for (uint32_t i = 0; i < 8u; i++) iot_threadpool_add_work (pool, cunit_pool_counter, NULL, IOT_THREAD_NO_PRIORITY);
+  uint64_t start = iot_time_msecs ();
+  iot_threadpool_shutdown (pool, true);
+  CU_ASSERT ((iot_time_msecs () - start) < 100u)
+  CU_ASSERT (counter == 0u)
+  iot_threadpool_add_work (pool, cunit_pool_counter, NULL, IOT_THREAD_NO_PRIORITY);
+  iot_threadpool_free (pool);
+  CU_ASSERT (counter == 0u)
+}
+
+static void cunit_threadpool_shutdown_future_run (iot_threadpool_t * pool)
+{
+  iot_future_t * sq = iot_threadpool_submit (pool, cunit_future_square, (void*) 7u, IOT_THREAD_NO_PRIORITY);
+  iot_future_t * add = iot_future_then (sq, pool, cunit_future_add, (void*) 1u);
+  iot_future_t * direct = iot_future_then (sq, NULL, cunit_future_add, (void*) 2u);
+  iot_threadpool_shutdown (pool, true); // Never started, so submitted job cancelled
+  CU_ASSERT (! iot_future_ready (sq))
+  iot_threadpool_free (pool);
+  CU_ASSERT (iot_future_ready (sq))
+  CU_ASSERT (iot_future_wait (sq) == NULL)
+  CU_ASSERT (iot_future_wait (add) == NULL) // Continuation on freed pool not run
+  CU_ASSERT ((uintptr_t) iot_future_wait (direct) == 2u)
+  iot_future_free (direct);
+  iot_future_free (add);
+  iot_future_free (sq);
+}
+
+static void cunit_threadpool_shutdown_future (void)
+{
+  cunit_threadpool_shutdown_future_run (iot_threadpool_alloc (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger));
+  cunit_threadpool_shutdown_future_run (iot_threadpool_alloc_stealing (2u, 0u, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, logger));
+}
+
 void cunit_threadpool_test_init (void)
 {
   CU_pSuite suite = CU_add_suite ("threadpool", suite_init, suite_clean);
@@ -178,4 +872,22 @@ void cunit_threadpool_test_init (void)
   CU_add_test (suite, "threadpool_try_work", cunit_threadpool_try_work);
   CU_add_test (suite, "threadpool_stop_start", cunit_threadpool_stop_start);
   CU_add_test (suite, "threadpool_refcount", cunit_threadpool_refcount);
+  CU_add_test (suite, "threadpool_stealing", cunit_threadpool_stealing);
+  CU_add_test (suite, "threadpool_prealloc", cunit_threadpool_prealloc);
+  CU_add_test (suite, "threadpool_future", cunit_threadpool_future);
+  CU_add_test (suite, "threadpool_parallel_for", cunit_threadpool_parallel_for);
+  CU_add_test (suite, "threadpool_stealing_block", cunit_threadpool_stealing_block);
+  CU_add_test (suite, "threadpool_stealing_priority", cunit_threadpool_stealing_priority);
+  CU_add_test (suite, "threadpool_batch", cunit_threadpool_batch);
+  CU_add_test (suite, "threadpool_stats", cunit_threadpool_stats);
+  CU_add_test (suite, "threadpool_wait_timed", cunit_threadpool_wait_timed);
+  CU_add_test (suite, "threadpool_cpus", cunit_threadpool_cpus);
+  CU_add_test (suite, "threadpool_elastic", cunit_threadpool_elastic);
+  CU_add_test (suite, "threadpool_keyed", cunit_threadpool_keyed);
+  CU_add_test (suite, "threadpool_job_pool", cunit_threadpool_job_pool);
+  CU_add_test (suite, "threadpool_mutex_types", cunit_threadpool_mutex_types);
+  CU_add_test (suite, "threadpool_deadline", cunit_threadpool_deadline);
+  CU_add_test (suite, "threadpool_flow", cunit_threadpool_flow);
+  CU_add_test (suite, "threadpool_shutdown", cunit_threadpool_shutdown);
+  CU_add_test (suite, "threadpool_shutdown_future", cunit_threadpool_shutdown_future);
 }
@@ -9,10 +9,22 @@
 #include "iot/uuid.h"
 
 #define RAND_READ_DELAY 1000u
-static const char  * hexdigits = "0123456789abcdef";
-static uint64_t uuid_seed[2];
-static bool uuid_initialized = false;
-static pthread_mutex_t uuid_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define IOT_HEX_ROW(h) h "0" h "1" h "2" h "3" h "4" h "5" h "6" h "7" h "8" h "9" h "a" h "b" h "c" h "d" h "e" h "f"
+
+// Two character hex strings for each byte value, so bytes are formatted without nibble branches
+
+static const char hexpairs[] =
+  IOT_HEX_ROW ("0") IOT_HEX_ROW ("1") IOT_HEX_ROW ("2") IOT_HEX_ROW ("3") IOT_HEX_ROW ("4") IOT_HEX_ROW ("5") IOT_HEX_ROW ("6") IOT_HEX_ROW ("7")
+  IOT_HEX_ROW ("8") IOT_HEX_ROW ("9") IOT_HEX_ROW ("a") IOT_HEX_ROW ("b") IOT_HEX_ROW ("c") IOT_HEX_ROW ("d") IOT_HEX_ROW ("e") IOT_HEX_ROW ("f");
+
+// Per thread generator state, seeded on first use by each thread, so generation takes no lock
+
+static _Thread_local uint64_t uuid_seed[2];
+static _Thread_local bool uuid_initialized = false;
+
+// Last UUIDv7 Unix millisecond timestamp and counter, as (msecs << 12) | counter, shared so UUIDs ordered across threads
+
+static _Atomic uint64_t uuid_v7_last = 0u;
 
 static uint64_t xorshift128plus (uint64_t *s)
 {
@@ -37,31 +49,76 @@ static void uuid_init (void)
   uuid_initialized = true;
 }
 
-void iot_uuid_generate (iot_uuid_t out)
+static inline void uuid_generate (uint8_t * out)
 {
   union { uint8_t b[16]; uint64_t word[2]; } s;
-  assert (out);
-  pthread_mutex_lock (&uuid_mutex);
-  if (! uuid_initialized) uuid_init ();
   s.word[0] = xorshift128plus (uuid_seed);
   s.word[1] = xorshift128plus (uuid_seed);
-  pthread_mutex_unlock (&uuid_mutex);
   s.b[6] = (uint8_t) ((s.b[6] & 0xf) | 0x40); // Flag as randomly generated uuid
   s.b[8] = (uint8_t) ((s.b[8] & 0x3f) | 0x80);
   memcpy (out, s.b, sizeof (s.b));
 }
 
-void iot_uuid_unparse (const iot_uuid_t uuid, char * out)
+void iot_uuid_generate (iot_uuid_t out)
+{
+  assert (out);
+  if (! uuid_initialized) uuid_init ();
+  uuid_generate (out);
+}
+
+void iot_uuid_generate_n (iot_uuid_t * out, uint32_t n)
 {
-  for (unsigned i = 0; i < 16; i++)
+  assert (out || n == 0);
+  if (! uuid_initialized) uuid_init ();
+  for (uint32_t i = 0; i < n; i++) uuid_generate (out[i]);
+}
+
+void iot_uuid_generate_v7 (iot_uuid_t out)
+{
+  assert (out);
+  uint64_t now = iot_time_msecs () << 12;
+  uint64_t last = atomic_load (&uuid_v7_last);
+  uint64_t next;
+  do
   {
-    if (i == 4 || i == 6 || i == 8 || i == 10)
-    {
-      *out++ = '-';
-    }
-    size_t tmp = uuid[i];
-    *out++ = hexdigits[tmp >> 4];
-    *out++ = hexdigits[tmp & 15];
+    next = (now > last) ? now : last + 1u; // Counter overflow advances timestamp
+  } while (! atomic_compare_exchange_weak (&uuid_v7_last, &last, next));
+
+  if (! uuid_initialized) uuid_init ();
+  uint64_t rand = xorshift128plus (uuid_seed);
+  uint64_t msecs = next >> 12;
+  out[0] = (uint8_t) (msecs >> 40);
+  out[1] = (uint8_t) (msecs >> 32);
+  out[2] = (uint8_t) (msecs >> 24);
+  out[3] = (uint8_t) (msecs >> 16);
+  out[4] = (uint8_t) (msecs >> 8);
+  out[5] = (uint8_t) msecs;
+  out[6] = (uint8_t) (0x70 | ((next >> 8) & 0xf)); // Version 7 and counter
+  out[7] = (uint8_t) next;
+  memcpy (&out[8], &rand, sizeof (rand));
+  out[8] = (uint8_t) ((out[8] & 0x3f) | 0x80);
+}
+
+static inline char * uuid_hex (char * out, const uint8_t * in, unsigned len)
+{
+  for (unsigned i = 0; i < len; i++)
+  {
+    memcpy (out, &hexpairs[in[i] * 2u], 2u);
+    out += 2;
   }
+  return out;
+}
+
+void iot_uuid_unparse (const iot_uuid_t uuid, char * out)
+{
+  out = uuid_hex (out, uuid, 4u);
+  *out++ = '-';
+  out = uuid_hex (out, uuid + 4, 2u);
+  *out++ = '-';
+  out = uuid_hex (out, uuid + 6, 2u);
+  *out++ = '-';
+  out = uuid_hex (out, uuid + 8, 2u);
+  *out++ = '-';
+  out = uuid_hex (out, uuid + 10, 6u);
   *out = '\0';
 }
@@ -4,6 +4,8 @@
 // SPDX-License-Identifier: Apache-2.0
 //
 #include "iot/bus.h"
+#include "iot/thread.h"
+#include "iot/time.h"
 
 #define DATA_ARRAY_SIZE 3
 
@@ -13,6 +15,9 @@
 #define PUB_ITERS 100000
 #endif
 
+static uint64_t latency_max = 0u;
+static uint64_t latency_total = 0u;
+
 static void publish (iot_bus_pub_t * pub, uint32_t iters);
 static void subscriber_callback (iot_data_t * data, void * self, const char * match);
 static iot_data_t * publisher_callback (void * self);
@@ -23,18 +28,24 @@ int main (void)
   int prio_max = sched_get_priority_max (SCHED_FIFO);
   int prio_min = sched_get_priority_min (SCHED_FIFO);
   printf ("\nFIFO priority max: %d min: %d\n", prio_max, prio_min);
-  iot_threadpool_t * pool = iot_threadpool_alloc (4, NULL);
-  iot_scheduler_t * scheduler = iot_scheduler_alloc (pool);
-  iot_bus_t * bus = iot_bus_alloc (scheduler, pool, 200000);
+  printf ("Static pools: %d data blocks, %d jobs\n", IOT_ZEPHYR_DATA_BLOCKS, IOT_ZEPHYR_JOBS);
+  iot_threadpool_t * pool = iot_threadpool_alloc (4, 0, IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_scheduler_t * scheduler = iot_scheduler_alloc (IOT_THREAD_NO_PRIORITY, IOT_THREAD_NO_AFFINITY, NULL);
+  iot_bus_t * bus = iot_bus_alloc (scheduler, pool, IOT_MS_TO_NS (200));
   iot_bus_sub_alloc (bus, NULL, subscriber_callback, "test/tube");
   iot_bus_pub_t * pub = iot_bus_pub_alloc (bus, NULL, publisher_callback, "test/tube");
+  iot_threadpool_start (pool);
+  iot_scheduler_start (scheduler);
   iot_bus_start (bus);
   clock_gettime (CLOCK_MONOTONIC, &start);
   publish (pub, PUB_ITERS);
   clock_gettime (CLOCK_MONOTONIC, &stop);
   printf ("Published %d samples in %d seconds %d nanoseconds\n", PUB_ITERS, stop.tv_sec - start.tv_sec, stop.tv_nsec - start.tv_nsec);
+  printf ("Publish latency average: %u nanoseconds max: %u nanoseconds\n", (uint32_t) (latency_total / PUB_ITERS), (uint32_t) latency_max);
   iot_bus_stop (bus);
   iot_bus_free (bus);
+  iot_scheduler_free (scheduler);
+  iot_threadpool_free (pool);
   printf ("Done\n");
   fflush (stdout);
   return 0;
@@ -43,15 +54,15 @@ int main (void)
 static void publish (iot_bus_pub_t * pub, uint32_t iters)
 {
   iot_data_t * map = iot_data_alloc_map (IOT_DATA_STRING);
-  iot_data_t * array = iot_data_alloc_array (DATA_ARRAY_SIZE);
+  iot_data_t * vector = iot_data_alloc_vector (DATA_ARRAY_SIZE);
   uint32_t index = 0;
 
   // Create fixed part of sample
 
-  iot_data_array_add (array, index++, iot_data_alloc_i32 (11));
-  iot_data_array_add (array, index++, iot_data_alloc_i32 (22));
-  iot_data_array_add (array, index, iot_data_alloc_i32 (33));
-  iot_data_string_map_add (map, "Coords", array);
+  iot_data_vector_add (vector, index++, iot_data_alloc_i32 (11));
+  iot_data_vector_add (vector, index++, iot_data_alloc_i32 (22));
+  iot_data_vector_add (vector, index, iot_data_alloc_i32 (33));
+  iot_data_string_map_add (map, "Coords", vector);
   iot_data_string_map_add (map, "Origin", iot_data_alloc_string ("Sensor-54", IOT_DATA_REF));
 
   while (iters--)
@@ -63,7 +74,11 @@ static void publish (iot_bus_pub_t * pub, uint32_t iters)
     // Increment map ref count or publish will delete
 
     iot_data_add_ref (map);
+    uint64_t before = iot_time_nsecs ();
     iot_bus_pub_push (pub, map, true);
+    uint64_t latency = iot_time_nsecs () - before;
+    latency_total += latency;
+    if (latency > latency_max) latency_max = latency;
   }
 
   // Finally delete sample